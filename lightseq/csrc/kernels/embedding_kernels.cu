@@ -243,14 +243,18 @@ void launch_lookup_scale_pos_dropout<float>(
     float *output, const int *input, const float *embeddings,
     const float *pos_embeddings, uint8_t *dropout_mask, int *tokens_position,
     int batch_size, int seq_len, int embedding_dim, int padding_idx,
-    float dropout_ratio, int step, cudaStream_t &stream) {
-  int p_threads = min(seq_len, MAX_THREADS);
-  dim3 p_grid_dim(batch_size, 1);
-  dim3 p_block_dim(p_threads, 1);
-  // get the position index of the tokens alone,
-  // because synchronization is required at the sequence level
-  get_tokens_position<<<p_grid_dim, p_block_dim, 0, stream>>>(
-      tokens_position, input, batch_size, seq_len, padding_idx);
+    float dropout_ratio, int step, cudaStream_t &stream,
+    bool given_position) {
+  // packed batches come with per-sample position ids in tokens_position
+  if (!given_position) {
+    int p_threads = min(seq_len, MAX_THREADS);
+    dim3 p_grid_dim(batch_size, 1);
+    dim3 p_block_dim(p_threads, 1);
+    // get the position index of the tokens alone,
+    // because synchronization is required at the sequence level
+    get_tokens_position<<<p_grid_dim, p_block_dim, 0, stream>>>(
+        tokens_position, input, batch_size, seq_len, padding_idx);
+  }
 
   float emb_scale = sqrt(embedding_dim);
   embedding_dim >>= 2;
@@ -274,14 +278,18 @@ void launch_lookup_scale_pos_dropout<__half>(
     __half *output, const int *input, const __half *embeddings,
     const __half *pos_embeddings, uint8_t *dropout_mask, int *tokens_position,
     int batch_size, int seq_len, int embedding_dim, int padding_idx,
-    float dropout_ratio, int step, cudaStream_t &stream) {
-  int p_threads = min(seq_len, MAX_THREADS);
-  dim3 p_grid_dim(batch_size, 1);
-  dim3 p_block_dim(p_threads, 1);
-  // get the position index of the tokens alone,
-  // because synchronization is required at the sequence level
-  get_tokens_position<<<p_grid_dim, p_block_dim, 0, stream>>>(
-      tokens_position, input, batch_size, seq_len, padding_idx);
+    float dropout_ratio, int step, cudaStream_t &stream,
+    bool given_position) {
+  // packed batches come with per-sample position ids in tokens_position
+  if (!given_position) {
+    int p_threads = min(seq_len, MAX_THREADS);
+    dim3 p_grid_dim(batch_size, 1);
+    dim3 p_block_dim(p_threads, 1);
+    // get the position index of the tokens alone,
+    // because synchronization is required at the sequence level
+    get_tokens_position<<<p_grid_dim, p_block_dim, 0, stream>>>(
+        tokens_position, input, batch_size, seq_len, padding_idx);
+  }
 
   float emb_scale = sqrt(embedding_dim);
   embedding_dim >>= 3;
@@ -230,3 +230,62 @@ void launch_concat3_dim1<__half>(const __half *inp1, const __half *inp2,
   kernel_concat3_dim1<<<nblock, MAX_THREADS, 0, stream>>>(
       inp1, inp2, output, sz0, sz2, sz1_1, sz1_2);
 }
+
+/**
+@brief: kernel_kv_cache_reorder
+Gather the rows of a decoder self-attention cache by beam indices,
+used to reorder the cache after beam search.
+
+@thread
+gridDim.x = ceil(nhead * length * head_dim / MAX_THREADS)
+gridDim.y = batch_beams
+blockDim.x = MAX_THREADS
+
+@param
+src, dst: [max_batch_beams, nhead, capacity, head_dim], only the first length
+  steps of each row are valid
+beam_idx: [batch_beams], row i of dst is row beam_idx[i] of src
+*/
+template <typename T>
+__global__ void kernel_kv_cache_reorder(T *dst, const T *src,
+                                        const int *beam_idx, int nhead,
+                                        int length, int head_dim,
+                                        int capacity) {
+  int nele = nhead * length * head_dim;
+  int idx = flat_2dim(blockIdx.x, threadIdx.x, blockDim.x);
+  if (idx >= nele) {
+    return;
+  }
+  int row_id = blockIdx.y;
+  int head_id, step_id, dim_id;
+  decompose_3dim(idx, length, head_dim, &head_id, &step_id, &dim_id);
+  int dst_pos =
+      flat_4dim(row_id, head_id, step_id, dim_id, nhead, capacity, head_dim);
+  int src_pos = flat_4dim(beam_idx[row_id], head_id, step_id, dim_id, nhead,
+                          capacity, head_dim);
+  ((float4 *)dst)[dst_pos] = ((const float4 *)src)[src_pos];
+}
+
+template <>
+void launch_kv_cache_reorder<float>(float *dst, const float *src,
+                                    const int *beam_idx, int batch_beams,
+                                    int nhead, int length, int head_dim,
+                                    int capacity, cudaStream_t stream) {
+  head_dim >>= 2;
+  int nele = nhead * length * head_dim;
+  dim3 grid_dim((nele + MAX_THREADS - 1) / MAX_THREADS, batch_beams);
+  kernel_kv_cache_reorder<float><<<grid_dim, MAX_THREADS, 0, stream>>>(
+      dst, src, beam_idx, nhead, length, head_dim, capacity);
+}
+
+template <>
+void launch_kv_cache_reorder<__half>(__half *dst, const __half *src,
+                                     const int *beam_idx, int batch_beams,
+                                     int nhead, int length, int head_dim,
+                                     int capacity, cudaStream_t stream) {
+  head_dim >>= 3;
+  int nele = nhead * length * head_dim;
+  dim3 grid_dim((nele + MAX_THREADS - 1) / MAX_THREADS, batch_beams);
+  kernel_kv_cache_reorder<__half><<<grid_dim, MAX_THREADS, 0, stream>>>(
+      dst, src, beam_idx, nhead, length, head_dim, capacity);
+}
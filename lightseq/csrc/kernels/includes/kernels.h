@@ -28,7 +28,7 @@ void launch_ln_bw(T *gamma_grad, T *betta_grad, T *inp_grad, const T *out_grad,
 template <typename T>
 void launch_attn_softmax(T *vals, const T *attn_mask, int batch_size, int heads,
                          int from_len, int to_len, bool mask_future,
-                         cudaStream_t stream);
+                         cudaStream_t stream, const int *seg_ids = nullptr);
 
 template <typename T>
 void launch_attn_softmax_bw(T *out_grad, const T *soft_inp, int rows,
@@ -89,6 +89,11 @@ template <typename T>
 void launch_concat3_dim1(const T *inp1, const T *inp2, T *output, int sz0,
                          int sz2, int sz1_1, int sz1_2, cudaStream_t stream);
 
+template <typename T>
+void launch_kv_cache_reorder(T *dst, const T *src, const int *beam_idx,
+                             int batch_beams, int nhead, int length,
+                             int head_dim, int capacity, cudaStream_t stream);
+
 template <typename T>
 void launch_fused_add2(T *out, const T *inp1, const T *inp2, int batch_size,
                        int seq_len, int hidden_size, cudaStream_t &stream);
@@ -113,7 +118,7 @@ void launch_lookup_scale_pos_dropout(
     T *output, const int *input, const T *embeddings, const T *pos_embeddings,
     uint8_t *dropout_mask, int *tokens_position, int batch_size, int seq_len,
     int embedding_dim, int padding_idx, float dropout_ratio, int step,
-    cudaStream_t &stream);
+    cudaStream_t &stream, bool given_position = false);
 
 template <typename T>
 void launch_d_lookup_scale_pos_dropout(
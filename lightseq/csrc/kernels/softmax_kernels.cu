@@ -29,10 +29,14 @@ attn_mask: [batch_size, to_len], padding tokens are -inf,
   attn_mask!=nullptr for enc-self-attn and enc-dec-attn
   attn_mask=nullptr and mask_future=ture for dec-self-attn training
   attn_mask=nullptr and mask_future=false for dec-self-attn infer
+seg_ids: [batch_size, to_len], only used by packed enc-self-attn, the sample
+  index of every token. A query only attends to keys of the same sample,
+  which gives a block-diagonal mask. nullptr for dense batches.
 */
 template <typename T, int block_dim, int ele_per_thread>
 __global__ void ker_attn_softmax(T *inp, const T *attn_mask, int from_len,
-                                 int to_len, bool mask_future) {
+                                 int to_len, bool mask_future,
+                                 const int *seg_ids) {
   int batch_id = blockIdx.y;
   int head_id = blockIdx.z;
   const int nhead = gridDim.z;
@@ -51,6 +55,9 @@ __global__ void ker_attn_softmax(T *inp, const T *attn_mask, int from_len,
     attn_mask += batch_id * to_len;
     BlockLoad(ts_load).Load(attn_mask, mval, to_len, REDUCE_FLOAT_INF_NEG);
   }
+  if (seg_ids) {
+    seg_ids += batch_id * to_len;
+  }
 
   inp += flat_3dim(batch_id, head_id, 0, nhead, from_len * to_len);
   for (int token_id = blockIdx.x * token_per_reduce; token_id < from_len;
@@ -69,7 +76,11 @@ __global__ void ker_attn_softmax(T *inp, const T *attn_mask, int from_len,
       l_max[i] = REDUCE_FLOAT_INF_NEG;
       for (int j = 0; j < ele_per_thread; j++) {
         float temp_val;
-        if (mask_future && ele_per_thread * threadIdx.x + j > token_id + i) {
+        int key_id = ele_per_thread * threadIdx.x + j;
+        if (mask_future && key_id > token_id + i) {
+          temp_val = REDUCE_FLOAT_INF_NEG;
+        } else if (seg_ids && key_id < to_len &&
+                   seg_ids[key_id] != seg_ids[token_id + i]) {
           temp_val = REDUCE_FLOAT_INF_NEG;
         } else {
           temp_val = (float)inp_val[i][j];
@@ -126,7 +137,8 @@ __global__ void ker_attn_softmax(T *inp, const T *attn_mask, int from_len,
 
 template <typename T, int block_dim, int ele_per_thread>
 __global__ void ker_attn_softmax_lt32(T *inp, const T *attn_mask, int from_len,
-                                      int to_len, bool mask_future) {
+                                      int to_len, bool mask_future,
+                                      const int *seg_ids) {
   int batch_id = blockIdx.y;
   int head_id = blockIdx.z;
   const int nhead = gridDim.z;
@@ -145,6 +157,9 @@ __global__ void ker_attn_softmax_lt32(T *inp, const T *attn_mask, int from_len,
     attn_mask += batch_id * to_len;
     BlockLoad(ts_load).Load(attn_mask, mval, to_len, REDUCE_FLOAT_INF_NEG);
   }
+  if (seg_ids) {
+    seg_ids += batch_id * to_len;
+  }
 
   inp += flat_3dim(batch_id, head_id, 0, nhead, from_len * to_len);
   for (int token_id = blockIdx.x * token_per_reduce; token_id < from_len;
@@ -163,7 +178,11 @@ __global__ void ker_attn_softmax_lt32(T *inp, const T *attn_mask, int from_len,
       l_max[i] = REDUCE_FLOAT_INF_NEG;
       for (int j = 0; j < ele_per_thread; j++) {
         float temp_val;
-        if (mask_future && ele_per_thread * threadIdx.x + j > token_id + i) {
+        int key_id = ele_per_thread * threadIdx.x + j;
+        if (mask_future && key_id > token_id + i) {
+          temp_val = REDUCE_FLOAT_INF_NEG;
+        } else if (seg_ids && key_id < to_len &&
+                   seg_ids[key_id] != seg_ids[token_id + i]) {
           temp_val = REDUCE_FLOAT_INF_NEG;
         } else {
           temp_val = (float)inp_val[i][j];
@@ -207,35 +226,36 @@ __global__ void ker_attn_softmax_lt32(T *inp, const T *attn_mask, int from_len,
   attn_mask!=nullptr for enc-self-attn and enc-dec-attn
   attn_mask=nullptr and mask_future=ture for dec-self-attn training
   attn_mask=nullptr and mask_future=false for dec-self-attn infer
+  seg_ids!=nullptr for packed enc-self-attn
 */
 template <>
 void launch_attn_softmax<float>(float *inp, const float *attn_mask,
                                 int batch_size, int nhead, int from_len,
                                 int to_len, bool mask_future,
-                                cudaStream_t stream) {
+                                cudaStream_t stream, const int *seg_ids) {
   dim3 grid_dim(1, batch_size, nhead);
   if (to_len <= 32) {
     ker_attn_softmax_lt32<float, 32, 1><<<grid_dim, 32, 0, stream>>>(
-        inp, attn_mask, from_len, to_len, mask_future);
+        inp, attn_mask, from_len, to_len, mask_future, seg_ids);
   } else if (to_len <= 64) {
     ker_attn_softmax_lt32<float, 32, 2><<<grid_dim, 32, 0, stream>>>(
-        inp, attn_mask, from_len, to_len, mask_future);
+        inp, attn_mask, from_len, to_len, mask_future, seg_ids);
   } else if (to_len <= 128) {
     grid_dim.x = 16;
     ker_attn_softmax<float, 64, 2><<<grid_dim, 64, 0, stream>>>(
-        inp, attn_mask, from_len, to_len, mask_future);
+        inp, attn_mask, from_len, to_len, mask_future, seg_ids);
   } else if (to_len <= 256) {
     grid_dim.x = 32;
     ker_attn_softmax<float, 128, 2><<<grid_dim, 128, 0, stream>>>(
-        inp, attn_mask, from_len, to_len, mask_future);
+        inp, attn_mask, from_len, to_len, mask_future, seg_ids);
   } else if (to_len <= 512) {
     grid_dim.x = 64;
     ker_attn_softmax<float, 256, 2><<<grid_dim, 256, 0, stream>>>(
-        inp, attn_mask, from_len, to_len, mask_future);
+        inp, attn_mask, from_len, to_len, mask_future, seg_ids);
   } else if (to_len <= 1024) {
     grid_dim.x = 128;
     ker_attn_softmax<float, 512, 2><<<grid_dim, 512, 0, stream>>>(
-        inp, attn_mask, from_len, to_len, mask_future);
+        inp, attn_mask, from_len, to_len, mask_future, seg_ids);
   } else {
     throw std::runtime_error(
         "Sequence length greater than 512 is currently not supported");
@@ -246,30 +266,30 @@ template <>
 void launch_attn_softmax<__half>(__half *inp, const __half *attn_mask,
                                  int batch_size, int nhead, int from_len,
                                  int to_len, bool mask_future,
-                                 cudaStream_t stream) {
+                                 cudaStream_t stream, const int *seg_ids) {
   dim3 grid_dim(1, batch_size, nhead);
   if (to_len <= 32) {
     ker_attn_softmax_lt32<__half, 32, 1><<<grid_dim, 32, 0, stream>>>(
-        inp, attn_mask, from_len, to_len, mask_future);
+        inp, attn_mask, from_len, to_len, mask_future, seg_ids);
   } else if (to_len <= 64) {
     ker_attn_softmax_lt32<__half, 32, 2><<<grid_dim, 32, 0, stream>>>(
-        inp, attn_mask, from_len, to_len, mask_future);
+        inp, attn_mask, from_len, to_len, mask_future, seg_ids);
   } else if (to_len <= 128) {
     grid_dim.x = 8;
     ker_attn_softmax<__half, 64, 2><<<grid_dim, 64, 0, stream>>>(
-        inp, attn_mask, from_len, to_len, mask_future);
+        inp, attn_mask, from_len, to_len, mask_future, seg_ids);
   } else if (to_len <= 256) {
     grid_dim.x = 16;
     ker_attn_softmax<__half, 128, 2><<<grid_dim, 128, 0, stream>>>(
-        inp, attn_mask, from_len, to_len, mask_future);
+        inp, attn_mask, from_len, to_len, mask_future, seg_ids);
   } else if (to_len <= 512) {
     grid_dim.x = 32;
     ker_attn_softmax<__half, 256, 2><<<grid_dim, 256, 0, stream>>>(
-        inp, attn_mask, from_len, to_len, mask_future);
+        inp, attn_mask, from_len, to_len, mask_future, seg_ids);
   } else if (to_len <= 1024) {
     grid_dim.x = 64;
     ker_attn_softmax<__half, 512, 2><<<grid_dim, 512, 0, stream>>>(
-        inp, attn_mask, from_len, to_len, mask_future);
+        inp, attn_mask, from_len, to_len, mask_future, seg_ids);
   } else {
     throw std::runtime_error(
         "Sequence length greater than 512 is currently not supported");
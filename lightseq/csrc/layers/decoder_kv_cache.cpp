@@ -0,0 +1,114 @@
+#include "decoder_kv_cache.h"
+
+#include "kernels.h"
+
+template <typename T>
+DecoderKVCache<T>::DecoderKVCache(int nhead, int head_dim, int max_seq_len,
+                                  int chunk_size)
+    : _layout(nhead, head_dim, max_seq_len, chunk_size), _bank(0) {
+  _k_cache[0] = _k_cache[1] = nullptr;
+  _v_cache[0] = _v_cache[1] = nullptr;
+}
+
+template <typename T>
+DecoderKVCache<T>::~DecoderKVCache() {
+  free_mem_buffer();
+}
+
+template <typename T>
+void DecoderKVCache<T>::free_mem_buffer() {
+  for (int i = 0; i < 2; i++) {
+    cuda_free(_k_cache[i]);
+    cuda_free(_v_cache[i]);
+    _k_cache[i] = nullptr;
+    _v_cache[i] = nullptr;
+  }
+}
+
+template <typename T>
+void DecoderKVCache<T>::reset(int batch_beams) {
+  if (batch_beams > _layout.max_batch_beams) {
+    // rows are the outer dim, a larger batch needs a new allocation
+    free_mem_buffer();
+    _layout.max_batch_beams = batch_beams;
+    _layout.capacity = 0;
+  }
+  _layout.batch_beams = batch_beams;
+  _layout.length = 0;
+  _bank = 0;
+}
+
+template <typename T>
+void DecoderKVCache<T>::reserve(int new_length, cudaStream_t stream) {
+  if (!_layout.need_realloc(_layout.batch_beams, new_length)) {
+    return;
+  }
+  KVCacheLayout new_layout = _layout;
+  new_layout.capacity = _layout.capacity_for(new_length);
+  size_t ele_num = new_layout.allocated_elements();
+  T *new_k = cuda_malloc<T>(ele_num);
+  T *new_v = cuda_malloc<T>(ele_num);
+  if (_layout.length > 0) {
+    // copy the valid prefix of every (batch_beam, head) row
+    size_t src_pitch = _layout.row_stride() * sizeof(T);
+    size_t dst_pitch = new_layout.row_stride() * sizeof(T);
+    size_t width = (size_t)_layout.length * _layout.head_dim * sizeof(T);
+    size_t rows = (size_t)_layout.batch_beams * _layout.nhead;
+    CHECK_GPU_ERROR(cudaMemcpy2DAsync(new_k, dst_pitch, k_cache(), src_pitch,
+                                      width, rows, cudaMemcpyDeviceToDevice,
+                                      stream));
+    CHECK_GPU_ERROR(cudaMemcpy2DAsync(new_v, dst_pitch, v_cache(), src_pitch,
+                                      width, rows, cudaMemcpyDeviceToDevice,
+                                      stream));
+  }
+  // the old buffers may still be read by queued kernels
+  CHECK_GPU_ERROR(cudaStreamSynchronize(stream));
+  free_mem_buffer();
+  _k_cache[0] = new_k;
+  _v_cache[0] = new_v;
+  _k_cache[1] = cuda_malloc<T>(ele_num);
+  _v_cache[1] = cuda_malloc<T>(ele_num);
+  _bank = 0;
+  _layout = new_layout;
+}
+
+template <typename T>
+void DecoderKVCache<T>::append(const T *new_k, const T *new_v,
+                               cudaStream_t stream) {
+  reserve(_layout.length + 1, stream);
+  // write step `length` of every (batch_beam, head) row
+  size_t dst_pitch = _layout.row_stride() * sizeof(T);
+  size_t width = (size_t)_layout.head_dim * sizeof(T);
+  size_t rows = (size_t)_layout.batch_beams * _layout.nhead;
+  size_t offset = (size_t)_layout.length * _layout.head_dim;
+  CHECK_GPU_ERROR(cudaMemcpy2DAsync(k_cache() + offset, dst_pitch, new_k,
+                                    width, width, rows,
+                                    cudaMemcpyDeviceToDevice, stream));
+  CHECK_GPU_ERROR(cudaMemcpy2DAsync(v_cache() + offset, dst_pitch, new_v,
+                                    width, width, rows,
+                                    cudaMemcpyDeviceToDevice, stream));
+  _layout.length += 1;
+}
+
+template <typename T>
+void DecoderKVCache<T>::reorder(const int *beam_idx, int new_batch_beams,
+                                cudaStream_t stream) {
+  if (new_batch_beams > _layout.batch_beams) {
+    throw std::runtime_error(
+        "kv cache can not be reordered into more rows than it holds");
+  }
+  if (_layout.length > 0) {
+    int idle = 1 - _bank;
+    launch_kv_cache_reorder<T>(_k_cache[idle], _k_cache[_bank], beam_idx,
+                               new_batch_beams, _layout.nhead, _layout.length,
+                               _layout.head_dim, _layout.capacity, stream);
+    launch_kv_cache_reorder<T>(_v_cache[idle], _v_cache[_bank], beam_idx,
+                               new_batch_beams, _layout.nhead, _layout.length,
+                               _layout.head_dim, _layout.capacity, stream);
+    _bank = idle;
+  }
+  _layout.batch_beams = new_batch_beams;
+}
+
+template class DecoderKVCache<float>;
+template class DecoderKVCache<__half>;
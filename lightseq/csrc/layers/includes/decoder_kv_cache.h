@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cuda.h>
+#include <cuda_fp16.h>
+#include <cuda_runtime_api.h>
+
+#include "cuda_util.h"
+#include "kv_cache_layout.h"
+
+/**
+@brief: DecoderKVCache
+Self-attention k/v cache of one decoder layer for step-wise inference. It
+replaces the python-side cache tensors that are re-allocated and
+concatenated on every step: the cache grows in chunks of steps (see
+KVCacheLayout), a new step is written in place and beam search reorders it
+on the device, so no memory is reserved for max_seq_len and no index_select
+is needed.
+
+Two banks are kept for k and v, reorder gathers into the idle bank and swaps.
+*/
+template <typename T>
+class DecoderKVCache {
+ public:
+  DecoderKVCache(int nhead, int head_dim, int max_seq_len, int chunk_size);
+
+  virtual ~DecoderKVCache();
+
+  // start a new sequence with batch_beams rows, keeps the allocation
+  void reset(int batch_beams);
+
+  // make sure there is room for new_length steps
+  void reserve(int new_length, cudaStream_t stream);
+
+  // write k, v of the current step, [batch_beams, nhead, head_dim] each
+  void append(const T *new_k, const T *new_v, cudaStream_t stream);
+
+  // row i becomes row beam_idx[i], beam_idx: [new_batch_beams] on device
+  void reorder(const int *beam_idx, int new_batch_beams, cudaStream_t stream);
+
+  T *k_cache() { return _k_cache[_bank]; }
+  T *v_cache() { return _v_cache[_bank]; }
+  const KVCacheLayout &layout() const { return _layout; }
+  int length() const { return _layout.length; }
+  int capacity() const { return _layout.capacity; }
+  int batch_beams() const { return _layout.batch_beams; }
+  // bytes of device memory held by both banks of k and v
+  size_t allocated_bytes() const {
+    return 4 * _layout.allocated_elements() * sizeof(T);
+  }
+  // bytes of valid k and v
+  size_t used_bytes() const { return 2 * _layout.used_elements() * sizeof(T); }
+
+ private:
+  void free_mem_buffer();
+
+  KVCacheLayout _layout;
+  int _bank;
+  T *_k_cache[2];
+  T *_v_cache[2];
+};
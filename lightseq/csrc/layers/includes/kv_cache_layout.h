@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stddef.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+@brief: KVCacheLayout
+Host-side bookkeeping of a decoder self-attention cache that grows step by
+step in inference. The cache of one layer is stored as
+  [batch_beams, nhead, capacity, head_dim]
+and only the first `length` positions of every (batch_beam, head) row are
+valid. Keeping the capacity in the row stride lets a new step be written in
+place and lets the attention gemm read the cache directly, with a batch stride
+of capacity * head_dim. The capacity grows in chunks of `chunk_size` steps, so
+no memory is reserved for max_seq_len up front.
+*/
+struct KVCacheLayout {
+  int nhead;
+  int head_dim;
+  int max_seq_len;
+  int chunk_size;
+  // rows currently in use, batch_size * beam_size
+  int batch_beams;
+  // rows the allocation can hold
+  int max_batch_beams;
+  // steps the allocation can hold per row
+  int capacity;
+  // valid steps per row
+  int length;
+
+  KVCacheLayout(int nhead, int head_dim, int max_seq_len, int chunk_size)
+      : nhead(nhead),
+        head_dim(head_dim),
+        max_seq_len(max_seq_len),
+        chunk_size(chunk_size),
+        batch_beams(0),
+        max_batch_beams(0),
+        capacity(0),
+        length(0) {
+    if (chunk_size <= 0) {
+      throw std::runtime_error("kv cache chunk size should be positive");
+    }
+  }
+
+  /* Capacity needed to hold new_length steps, rounded up to a whole chunk */
+  int capacity_for(int new_length) const {
+    if (new_length > max_seq_len) {
+      throw std::runtime_error(
+          "kv cache length " + std::to_string(new_length) +
+          " exceeds the max sequence length " + std::to_string(max_seq_len));
+    }
+    int cap = (new_length + chunk_size - 1) / chunk_size * chunk_size;
+    return cap < max_seq_len ? cap : max_seq_len;
+  }
+
+  /* Whether holding new_length steps for new_batch_beams rows needs a new
+   * allocation */
+  bool need_realloc(int new_batch_beams, int new_length) const {
+    return new_batch_beams > max_batch_beams || new_length > capacity;
+  }
+
+  /* Elements of one (batch_beam, head) row */
+  size_t row_stride() const { return (size_t)capacity * head_dim; }
+
+  /* Offset of element (row, head, step, dim) */
+  size_t offset(int row, int head, int step, int dim) const {
+    return ((size_t)row * nhead + head) * row_stride() +
+           (size_t)step * head_dim + dim;
+  }
+
+  /* Elements of one bank (k or v) of the allocation */
+  size_t allocated_elements() const {
+    return (size_t)max_batch_beams * nhead * capacity * head_dim;
+  }
+
+  /* Valid elements of one bank (k or v) */
+  size_t used_elements() const {
+    return (size_t)batch_beams * nhead * length * head_dim;
+  }
+};
+
+/**
+@brief: kv_cache_reorder_cpu
+CPU reference of launch_kv_cache_reorder, row i of dst is row beam_idx[i] of
+src, for the first `length` steps. dst and src share the same layout.
+*/
+template <typename T>
+void kv_cache_reorder_cpu(T *dst, const T *src,
+                          const std::vector<int> &beam_idx,
+                          const KVCacheLayout &layout) {
+  for (size_t i = 0; i < beam_idx.size(); i++) {
+    if (beam_idx[i] < 0 || beam_idx[i] >= layout.batch_beams) {
+      throw std::runtime_error("beam index " + std::to_string(beam_idx[i]) +
+                               " out of range");
+    }
+    for (int h = 0; h < layout.nhead; h++) {
+      for (int s = 0; s < layout.length; s++) {
+        for (int d = 0; d < layout.head_dim; d++) {
+          dst[layout.offset(i, h, s, d)] =
+              src[layout.offset(beam_idx[i], h, s, d)];
+        }
+      }
+    }
+  }
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+@brief: packed sequence helpers
+In packed (sequence-packing) mode several variable-length samples are
+concatenated into one row of the [batch_size, seq_len] token matrix, so that
+no compute goes to padding. The layout of a packed batch is described by the
+cumulative sample lengths of every row:
+  row_cu_seqlens[b] = {0, l0, l0 + l1, ..., l0 + ... + ln}
+sample i of row b occupies tokens
+  [row_cu_seqlens[b][i], row_cu_seqlens[b][i + 1])
+of that row, tokens after the last offset are padding.
+
+From the offsets we derive, on host:
+  segment ids: [batch_size, seq_len], the index of the sample a token belongs
+    to inside its row, or -1 for padding. Attention is block-diagonal: a query
+    only attends to keys with the same segment id.
+  position ids: [batch_size, seq_len], the position of a token inside its
+    sample (restarting from 0 for every sample), 0 for padding.
+*/
+
+/* Check that row_cu_seqlens is a valid packing of [batch_size, seq_len] */
+inline void check_packed_cu_seqlens(
+    const std::vector<std::vector<int>> &row_cu_seqlens, int batch_size,
+    int seq_len) {
+  if ((int)row_cu_seqlens.size() != batch_size) {
+    throw std::runtime_error("packed offsets are given for " +
+                             std::to_string(row_cu_seqlens.size()) +
+                             " rows, but batch size is " +
+                             std::to_string(batch_size));
+  }
+  for (int b = 0; b < batch_size; b++) {
+    const std::vector<int> &cu_seqlens = row_cu_seqlens[b];
+    if (cu_seqlens.empty() || cu_seqlens[0] != 0) {
+      throw std::runtime_error("packed offsets of row " + std::to_string(b) +
+                               " should start with 0");
+    }
+    for (size_t i = 1; i < cu_seqlens.size(); i++) {
+      if (cu_seqlens[i] <= cu_seqlens[i - 1]) {
+        throw std::runtime_error("packed offsets of row " + std::to_string(b) +
+                                 " should be strictly increasing");
+      }
+    }
+    if (cu_seqlens.back() > seq_len) {
+      throw std::runtime_error(
+          "packed samples of row " + std::to_string(b) + " take " +
+          std::to_string(cu_seqlens.back()) +
+          " tokens, exceeding the sequence length " + std::to_string(seq_len));
+    }
+  }
+}
+
+/* Segment id of every token, -1 for padding */
+inline std::vector<int> get_packed_segment_ids(
+    const std::vector<std::vector<int>> &row_cu_seqlens, int batch_size,
+    int seq_len) {
+  check_packed_cu_seqlens(row_cu_seqlens, batch_size, seq_len);
+  std::vector<int> seg_ids(batch_size * seq_len, -1);
+  for (int b = 0; b < batch_size; b++) {
+    const std::vector<int> &cu_seqlens = row_cu_seqlens[b];
+    for (size_t i = 1; i < cu_seqlens.size(); i++) {
+      for (int t = cu_seqlens[i - 1]; t < cu_seqlens[i]; t++) {
+        seg_ids[b * seq_len + t] = i - 1;
+      }
+    }
+  }
+  return seg_ids;
+}
+
+/* Position id of every token inside its sample, 0 for padding */
+inline std::vector<int> get_packed_position_ids(
+    const std::vector<std::vector<int>> &row_cu_seqlens, int batch_size,
+    int seq_len) {
+  check_packed_cu_seqlens(row_cu_seqlens, batch_size, seq_len);
+  std::vector<int> pos_ids(batch_size * seq_len, 0);
+  for (int b = 0; b < batch_size; b++) {
+    const std::vector<int> &cu_seqlens = row_cu_seqlens[b];
+    for (size_t i = 1; i < cu_seqlens.size(); i++) {
+      for (int t = cu_seqlens[i - 1]; t < cu_seqlens[i]; t++) {
+        pos_ids[b * seq_len + t] = t - cu_seqlens[i - 1];
+      }
+    }
+  }
+  return pos_ids;
+}
+
+/* Longest packed sample, bounds the position embedding lookup */
+inline int get_packed_max_sample_len(
+    const std::vector<std::vector<int>> &row_cu_seqlens) {
+  int max_len = 0;
+  for (const std::vector<int> &cu_seqlens : row_cu_seqlens) {
+    for (size_t i = 1; i < cu_seqlens.size(); i++) {
+      max_len = std::max(max_len, cu_seqlens[i] - cu_seqlens[i - 1]);
+    }
+  }
+  return max_len;
+}
@@ -8,6 +8,7 @@
 #include <type_traits>
 
 #include "cuda_util.h"
+#include "decoder_kv_cache.h"
 #include "dropout.h"
 #include "feed_forward.h"
 #include "normalize_layer.h"
@@ -84,6 +85,10 @@ class TransformerDecoderLayer {
     }
   }
 
+  // managed self-attn cache for step-wise inference, nullptr to use the
+  // caller-provided cache tensors
+  void set_kv_cache(DecoderKVCache<T> *kv_cache) { _kv_cache = kv_cache; }
+
   void SetTrainingMode(bool training) {
     _training = training;
     _attn_prob_dropout.SetTrainingMode(training);
@@ -301,6 +306,7 @@ class TransformerDecoderLayer {
   int _step;
   bool _training;
   bool _predict;
+  DecoderKVCache<T> *_kv_cache;
 
   cublasHandle_t _cublasHandle;
   cudaStream_t _stream;
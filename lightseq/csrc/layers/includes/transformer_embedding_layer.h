@@ -28,6 +28,13 @@ class TransformerEmbeddingLayer {
     _seq_len = seq_len;
   }
 
+  // packed mode, pos_ids_ptr: [batch_size, seq_len] on device, position of
+  // every token inside its sample (see packed_sequence.h). nullptr for dense
+  // padded batches, whose positions are computed from the padding tokens.
+  void set_packed_position_ids(const int *pos_ids_ptr) {
+    _packed_pos_ids_ptr = pos_ids_ptr;
+  }
+
   void SetTrainingMode(bool training);
   inline bool IsTrainingMode() const { return _training; }
   inline float DropoutRatio() const { return _training ? _dropout_ratio : 0.0; }
@@ -88,6 +95,7 @@ class TransformerEmbeddingLayer {
   bool _trainable_pos;
   uint8_t *_dropout_mask;
   int *_tokens_position;
+  const int *_packed_pos_ids_ptr;
 
   // weights ptr
   const T *_pos_embeddings_ptr;
@@ -54,6 +54,12 @@ class TransformerEncoderLayer {
     _attn_context.SetConfig(_hidden_size / _heads, _seq_len, _seq_len);
   }
 
+  // packed mode, seg_ids_ptr: [batch_size, seq_len] on device, sample index of
+  // every token (see packed_sequence.h). nullptr for dense padded batches.
+  void set_packed_seg_ids(const int *seg_ids_ptr) {
+    _packed_seg_ids_ptr = seg_ids_ptr;
+  }
+
   void SetTrainingMode(bool training);
   inline bool IsTrainingMode() const { return _training; }
 
@@ -182,6 +188,7 @@ class TransformerEncoderLayer {
   size_t _batch_heads;
   size_t _batch_dim;
   bool _training;
+  const int *_packed_seg_ids_ptr;
 
   cublasHandle_t _cublasHandle;
   cudaStream_t _stream;
@@ -17,6 +17,7 @@ TransformerDecoderLayer<T>::TransformerDecoderLayer(
       _intermediate_size(intermediate_size),
       _training(true),
       _predict(false),
+      _kv_cache(nullptr),
       _pre_or_postLayerNorm(pre_or_postLayerNorm),
       _activation_fn(activation_fn),
       // >>> decoder self attn layer
@@ -102,7 +103,17 @@ void TransformerDecoderLayer<T>::self_attn_layer_fw(const T *input_ptr,
   launch_bias_add_transform_20314<T>(q_tf_ptr, buffer, _attn_qkvb_ptr,
                                      batch_size, from_len, 3, _heads,
                                      _hidden_size / _heads, _stream);
-  if (_predict) {
+  if (_predict && _kv_cache) {
+    // write k, v of this step in place, the cache rows are strided by its
+    // capacity
+    _kv_cache->append(k_tf_ptr, v_tf_ptr, _stream);
+    k_tf_ptr = _kv_cache->k_cache();
+    v_tf_ptr = _kv_cache->v_cache();
+    int head_dim = _hidden_size / _heads;
+    int row_stride = _kv_cache->capacity() * head_dim;
+    _attn_scores.SetConfig(_step + 1, 1, head_dim, row_stride);
+    _attn_context.SetConfig(head_dim, 1, _step + 1, row_stride);
+  } else if (_predict) {
     launch_concat3_dim1(cache[2], k_tf_ptr, cache[0], batch_heads,
                         _hidden_size / _heads, _step, 1, _stream);
     launch_concat3_dim1(cache[3], v_tf_ptr, cache[1], batch_heads,
@@ -17,7 +17,8 @@ TransformerEmbeddingLayer<T>::TransformerEmbeddingLayer(
       _padding_idx(padding_idx),
       _dropout_ratio(dropout_ratio),
       _trainable_pos(trainable_pos),
-      _training(true) {
+      _training(true),
+      _packed_pos_ids_ptr(nullptr) {
   allocate_mem_buffer();
 }
 
@@ -30,10 +31,18 @@ template <typename T>
 void TransformerEmbeddingLayer<T>::Forward(const int *input_ptr, T *out_ptr,
                                            int step) {
   cudaStream_t stream = Context::Instance().get_stream();
+  bool packed = _packed_pos_ids_ptr != nullptr;
+  if (packed) {
+    // keep positions in _tokens_position, they are also used by backward
+    CHECK_GPU_ERROR(cudaMemcpyAsync(
+        _tokens_position, _packed_pos_ids_ptr,
+        _batch_size * _seq_len * sizeof(int), cudaMemcpyDeviceToDevice,
+        stream));
+  }
   launch_lookup_scale_pos_dropout<T>(
       out_ptr, input_ptr, _embeddings_ptr, _pos_embeddings_ptr, _dropout_mask,
       _tokens_position, _batch_size, _seq_len, _embedding_dim, _padding_idx,
-      DropoutRatio(), step, stream);
+      DropoutRatio(), step, stream, packed);
 }
 
 template <typename T>
@@ -17,6 +17,7 @@ TransformerEncoderLayer<T>::TransformerEncoderLayer(
       _heads(num_heads),
       _intermediate_size(intermediate_size),
       _training(true),
+      _packed_seg_ids_ptr(nullptr),
       _pre_or_postLayerNorm(pre_or_postLayerNorm),
       _activation_fn(activation_fn),
       _qkv_linear(
@@ -78,9 +79,9 @@ void TransformerEncoderLayer<T>::attn_layer_fw(const T *input_ptr,
   _attn_scores.Forward(_batch_heads, _soft_out_ptr, k_tf_ptr, q_tf_ptr,
                        _cublasHandle);
 
-  // Softmax + Mask
+  // Softmax + Mask, block-diagonal mask is added in packed mode
   _softmax.Forward(_soft_out_ptr, input_mask_ptr, _batch_size, _seq_len,
-                   _seq_len, _stream);
+                   _seq_len, _stream, false, _packed_seg_ids_ptr);
 
   // attn prob dropout.
   _attn_prob_dropout.dropout(_ctx_bufB_ptr, _soft_out_ptr,
@@ -25,7 +25,8 @@ class Softmax {
   ~Softmax() {}
 
   void Forward(T *vals, const T *attn_mask, int batch_size, int from_len,
-               int to_len, cudaStream_t &stream, bool mask_future = false);
+               int to_len, cudaStream_t &stream, bool mask_future = false,
+               const int *seg_ids = nullptr);
 
   void Backward(T *out_grad, const T *soft_out, int batch_size, int from_len,
                 int to_len, cudaStream_t stream);
@@ -19,6 +19,8 @@ class StridedBatchGemm {
     int m;
     int n;
     int k;
+    // batch stride of A, 0 means the dense m * k
+    int stride_a;
     float alpha;
     float beta;
     cublasOperation_t op_A;
@@ -27,15 +29,17 @@ class StridedBatchGemm {
 
     Config(float param_alpha, float param_beta, cublasOperation_t opA,
            cublasOperation_t opB)
-        : alpha(param_alpha),
+        : stride_a(0),
+          alpha(param_alpha),
           beta(param_beta),
           op_A(opA),
           op_B(opB),
           gemm_algos(std::array<int, 3>({99, 99, 99})) {}
-    void SetConfig(int mm, int nn, int kk) {
+    void SetConfig(int mm, int nn, int kk, int ss = 0) {
       m = mm;
       n = nn;
       k = kk;
+      stride_a = ss;
     }
   };
 
@@ -50,7 +54,7 @@ class StridedBatchGemm {
                 const T *_buffer_b, cublasHandle_t handle,
                 T *inpGradA = nullptr, T *inpGradB = nullptr);
 
-  void SetConfig(int m, int n, int k);
+  void SetConfig(int m, int n, int k, int stride_a = 0);
 
  private:
   Config _config;
@@ -3,9 +3,10 @@
 template <typename T>
 void Softmax<T>::Forward(T *vals, const T *attn_mask, int batch_size,
                          int from_len, int to_len, cudaStream_t &stream,
-                         bool mask_future) {
+                         bool mask_future, const int *seg_ids) {
   launch_attn_softmax<T>(vals, attn_mask, batch_size, config_.nhead, from_len,
-                         to_len, config_.mask_future | mask_future, stream);
+                         to_len, config_.mask_future | mask_future, stream,
+                         seg_ids);
 }
 
 template <typename T>
@@ -7,7 +7,8 @@
 template <typename T>
 void StridedBatchGemm<T>::Forward(int bsz, T *output, const T *_buffer_a,
                                   const T *_buffer_b, cublasHandle_t handle) {
-  int stride_a = _config.m * _config.k;
+  int stride_a =
+      _config.stride_a > 0 ? _config.stride_a : _config.m * _config.k;
   int stride_b = _config.n * _config.k;
   int stride_c = _config.m * _config.n;
 
@@ -57,8 +58,9 @@ void StridedBatchGemm<T>::Backward(int bsz, const T *d_output,
 }
 
 template <typename T>
-inline void StridedBatchGemm<T>::SetConfig(int m, int n, int k) {
-  _config.SetConfig(m, n, k);
+inline void StridedBatchGemm<T>::SetConfig(int m, int n, int k,
+                                           int stride_a) {
+  _config.SetConfig(m, n, k, stride_a);
 }
 
 template class StridedBatchGemm<float>;
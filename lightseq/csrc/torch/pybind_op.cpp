@@ -4,6 +4,8 @@
 
 #include "context.h"
 #include "cross_entropy_layer.h"
+#include "decoder_kv_cache.h"
+#include "packed_sequence.h"
 #include "transformer_decoder_layer.h"
 #include "transformer_embedding_layer.h"
 #include "transformer_encoder_layer.h"
@@ -48,12 +50,21 @@ int create_transformer_encoder_layer(
 template <typename T>
 std::vector<torch::Tensor> transformer_encoder_layer_fw(
     int layer_id, const torch::Tensor &input, const torch::Tensor &input_mask,
-    bool training_mode, bool prelayernorm) {
+    bool training_mode, bool prelayernorm,
+    const torch::Tensor &packed_seg_ids) {
   CHECK_INPUT(input);
   CHECK_INPUT(input_mask);
 
   const T *input_ptr = (const T *)input.data_ptr();
   const T *input_mask_ptr = (const T *)input_mask.data_ptr();
+  // empty packed_seg_ids means a dense padded batch
+  const int *packed_seg_ids_ptr = nullptr;
+  if (packed_seg_ids.numel() > 0) {
+    CHECK_INPUT(packed_seg_ids);
+    AT_ASSERTM(packed_seg_ids.dtype() == torch::kInt32,
+               "packed_seg_ids must be int32");
+    packed_seg_ids_ptr = (const int *)packed_seg_ids.data_ptr();
+  }
 
   auto output = torch::empty_like(input);
   T *out_ptr = (T *)output.data_ptr();
@@ -62,6 +73,7 @@ std::vector<torch::Tensor> transformer_encoder_layer_fw(
       std::static_pointer_cast<TransformerEncoderLayer<T>>(
           s_transformer_encoder_layers[layer_id]);
   layer->set_cur_batch_shape(input.size(0), input.size(1));
+  layer->set_packed_seg_ids(packed_seg_ids_ptr);
   layer->SetTrainingMode(training_mode);
   layer->Forward(input_ptr, input_mask_ptr, out_ptr);
 
@@ -174,6 +186,91 @@ std::vector<torch::Tensor> transformer_decoder_layer_fw(
   return {dec_output};
 }
 
+static std::unordered_map<int, std::shared_ptr<void>> s_decoder_kv_caches;
+
+template <typename T>
+int create_decoder_kv_cache(int layer_id, int nhead, int head_dim,
+                            int max_seq_len, int chunk_size) {
+  s_decoder_kv_caches[layer_id] = std::make_shared<DecoderKVCache<T>>(
+      nhead, head_dim, max_seq_len, chunk_size);
+  return 0;
+}
+
+template <typename T>
+std::shared_ptr<DecoderKVCache<T>> get_decoder_kv_cache(int layer_id) {
+  auto iter = s_decoder_kv_caches.find(layer_id);
+  AT_ASSERTM(iter != s_decoder_kv_caches.end(),
+             "kv cache of decoder layer is not created");
+  return std::static_pointer_cast<DecoderKVCache<T>>(iter->second);
+}
+
+template <typename T>
+std::vector<torch::Tensor> transformer_decoder_layer_fw_kv_cache(
+    int layer_id, const torch::Tensor &dec_input,
+    const torch::Tensor &enc_output, const torch::Tensor &enc_mask,
+    bool prelayernorm, bool start, std::vector<torch::Tensor> &encdec_kv) {
+  CHECK_INPUT(dec_input);
+  CHECK_INPUT(enc_output);
+  CHECK_INPUT(enc_mask);
+
+  const T *dec_input_ptr = (const T *)dec_input.data_ptr();
+  const T *enc_output_ptr = (const T *)enc_output.data_ptr();
+  const T *enc_mask_ptr = (const T *)enc_mask.data_ptr();
+
+  auto dec_output = torch::empty_like(dec_input);
+  T *dec_output_ptr = (T *)dec_output.data_ptr();
+
+  std::shared_ptr<TransformerDecoderLayer<T>> layer =
+      std::static_pointer_cast<TransformerDecoderLayer<T>>(
+          s_transformer_decoder_layers[layer_id]);
+  std::shared_ptr<DecoderKVCache<T>> kv_cache =
+      get_decoder_kv_cache<T>(layer_id);
+
+  int batch_size = enc_output.size(0);
+  int batch_beams = dec_input.size(0);
+  int beam_size = batch_beams / batch_size;
+  if (start) {
+    kv_cache->reset(batch_beams);
+  }
+  AT_ASSERTM(kv_cache->batch_beams() == batch_beams,
+             "decoder input does not match the rows of kv cache");
+  int step = kv_cache->length();
+  // only layer 0 holds the enc-dec kv of all layers
+  std::vector<T *> cache_ptr = {nullptr, nullptr, nullptr, nullptr, nullptr};
+  if (layer_id == 0) {
+    CHECK_INPUT(encdec_kv[0]);
+    cache_ptr[4] = (T *)encdec_kv[0].data_ptr();
+  }
+  layer->set_cur_batch_shape(batch_size, beam_size, enc_output.size(1), step);
+  layer->SetTrainingMode(false);
+  layer->set_kv_cache(kv_cache.get());
+  layer->Forward(dec_input_ptr, enc_output_ptr, enc_mask_ptr, dec_output_ptr,
+                 cache_ptr);
+  layer->set_kv_cache(nullptr);
+
+  return {dec_output};
+}
+
+template <typename T>
+void decoder_kv_cache_reorder(int layer_id, const torch::Tensor &new_order) {
+  CHECK_INPUT(new_order);
+  AT_ASSERTM(new_order.dtype() == torch::kInt32, "new_order must be int32");
+  cudaStream_t stream = Context::Instance().get_stream();
+  get_decoder_kv_cache<T>(layer_id)->reorder(
+      (const int *)new_order.data_ptr(), new_order.numel(), stream);
+}
+
+template <typename T>
+std::unordered_map<std::string, int64_t> decoder_kv_cache_stats(int layer_id) {
+  std::shared_ptr<DecoderKVCache<T>> kv_cache =
+      get_decoder_kv_cache<T>(layer_id);
+  return {{"length", kv_cache->length()},
+          {"capacity", kv_cache->capacity()},
+          {"batch_beams", kv_cache->batch_beams()},
+          {"allocated_bytes", kv_cache->allocated_bytes()},
+          {"used_bytes", kv_cache->used_bytes()}};
+}
+
 template <typename T>
 std::vector<torch::Tensor> transformer_decoder_layer_bw(
     int layer_id, const torch::Tensor &grad_dec_output,
@@ -246,9 +343,18 @@ int create_transformer_embedding_layer(int layer_id,
 
 template <typename T>
 std::vector<torch::Tensor> transformer_embedding_layer_fw(
-    int layer_id, const torch::Tensor &input, int step, bool training_mode) {
+    int layer_id, const torch::Tensor &input, int step, bool training_mode,
+    const torch::Tensor &packed_pos_ids) {
   CHECK_INPUT(input);
   const int *input_ptr = (const int *)input.data_ptr();
+  // empty packed_pos_ids means a dense padded batch
+  const int *packed_pos_ids_ptr = nullptr;
+  if (packed_pos_ids.numel() > 0) {
+    CHECK_INPUT(packed_pos_ids);
+    AT_ASSERTM(packed_pos_ids.dtype() == torch::kInt32,
+               "packed_pos_ids must be int32");
+    packed_pos_ids_ptr = (const int *)packed_pos_ids.data_ptr();
+  }
 
   std::shared_ptr<TransformerEmbeddingLayer<T>> layer =
       std::static_pointer_cast<TransformerEmbeddingLayer<T>>(
@@ -267,6 +373,7 @@ std::vector<torch::Tensor> transformer_embedding_layer_fw(
   T *out_ptr = (T *)output.data_ptr();
 
   layer->set_cur_batch_shape(input.size(0), input.size(1));
+  layer->set_packed_position_ids(packed_pos_ids_ptr);
   layer->SetTrainingMode(training_mode);
   layer->Forward(input_ptr, out_ptr, step);
 
@@ -293,6 +400,22 @@ void transformer_embedding_layer_bw(int layer_id,
   return;
 }
 
+std::vector<torch::Tensor> get_packed_sequence_info(
+    const std::vector<std::vector<int>> &row_cu_seqlens, int batch_size,
+    int seq_len) {
+  std::vector<int> seg_ids =
+      get_packed_segment_ids(row_cu_seqlens, batch_size, seq_len);
+  std::vector<int> pos_ids =
+      get_packed_position_ids(row_cu_seqlens, batch_size, seq_len);
+
+  auto options = torch::TensorOptions().dtype(torch::kInt32);
+  auto seg_ids_tensor = torch::empty({batch_size, seq_len}, options);
+  auto pos_ids_tensor = torch::empty({batch_size, seq_len}, options);
+  std::copy(seg_ids.begin(), seg_ids.end(), (int *)seg_ids_tensor.data_ptr());
+  std::copy(pos_ids.begin(), pos_ids.end(), (int *)pos_ids_tensor.data_ptr());
+  return {seg_ids_tensor, pos_ids_tensor};
+}
+
 template <typename T>
 void assign_layer_weight_grad(const torch::Tensor &weights,
                               torch::Tensor &grads, std::string layer_name,
@@ -445,6 +568,24 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m) {
   m.def("create_transformer_decoder_layer_fp16",
         &create_transformer_decoder_layer<__half>,
         "Create LightSeq Transformer Decoder Layer with fp16 (CUDA)");
+  m.def("create_decoder_kv_cache_fp32", &create_decoder_kv_cache<float>,
+        "Create LightSeq Decoder KV Cache with fp32 (CUDA)");
+  m.def("create_decoder_kv_cache_fp16", &create_decoder_kv_cache<__half>,
+        "Create LightSeq Decoder KV Cache with fp16 (CUDA)");
+  m.def("transformer_decoder_layer_fw_kv_cache_fp32",
+        &transformer_decoder_layer_fw_kv_cache<float>,
+        "LightSeq Transformer Decoder step with managed kv cache, fp32 (CUDA)");
+  m.def("transformer_decoder_layer_fw_kv_cache_fp16",
+        &transformer_decoder_layer_fw_kv_cache<__half>,
+        "LightSeq Transformer Decoder step with managed kv cache, fp16 (CUDA)");
+  m.def("decoder_kv_cache_reorder_fp32", &decoder_kv_cache_reorder<float>,
+        "Reorder LightSeq Decoder KV Cache by beam indices with fp32 (CUDA)");
+  m.def("decoder_kv_cache_reorder_fp16", &decoder_kv_cache_reorder<__half>,
+        "Reorder LightSeq Decoder KV Cache by beam indices with fp16 (CUDA)");
+  m.def("decoder_kv_cache_stats_fp32", &decoder_kv_cache_stats<float>,
+        "Capacity and usage of LightSeq Decoder KV Cache with fp32");
+  m.def("decoder_kv_cache_stats_fp16", &decoder_kv_cache_stats<__half>,
+        "Capacity and usage of LightSeq Decoder KV Cache with fp16");
   m.def("transformer_embedding_layer_fw_fp32",
         &transformer_embedding_layer_fw<float>,
         "LightSeq Transformer Embedding forward with fp32 (CUDA)");
@@ -475,6 +616,8 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m) {
         "LightSeq Cross Entropy backward with fp32 (CUDA)");
   m.def("cross_entropy_layer_bw_fp16", &cross_entropy_layer_bw<__half>,
         "LightSeq Cross Entropy backward with fp16 (CUDA)");
+  m.def("get_packed_sequence_info", &get_packed_sequence_info,
+        "Segment and position ids of a packed batch (CPU)");
   m.def("assign_layer_weight_grad_fp32", &assign_layer_weight_grad<float>,
         "Bind layer weights and grads");
   m.def("assign_layer_weight_grad_fp16", &assign_layer_weight_grad<__half>,
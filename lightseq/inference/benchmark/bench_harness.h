@@ -0,0 +1,631 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "model_base.h"
+
+/**
+@file
+Benchmark harness of the inference models. It is free of cuda so that the
+sweep, the synthetic model shapes, the timing loop and the json report can
+be tested on host against a stub model, the device specific parts are
+behind BenchBackend.
+*/
+namespace lightseq {
+namespace cuda {
+
+/* Models the synthetic weight generator knows how to build */
+const std::vector<std::string> kBenchModels = {
+    "Transformer", "Bert", "Gpt", "Moe", "QuantTransformer", "QuantBert",
+    "QuantGpt"};
+
+inline bool bench_is_encoder_only(const std::string &model) {
+  return model == "Bert" || model == "QuantBert";
+}
+
+inline bool bench_is_gpt(const std::string &model) {
+  return model == "Gpt" || model == "QuantGpt";
+}
+
+/**
+Shape of a synthetic model, weights are drawn from a fixed seed so every run
+of the same shape benchmarks the same model.
+*/
+struct SyntheticModelShape {
+  std::string model = "Transformer";
+  int enc_layers = 6;
+  int dec_layers = 6;
+  int hidden = 512;
+  int heads = 8;
+  int inner = 2048;
+  int vocab = 32000;
+  int max_step = 256;
+  // generation stops after seq_len + extra_decode_length steps at most
+  int extra_decode_length = 32;
+  // moe only, every layer is a moe layer when expert_num > 0
+  int expert_num = 4;
+  int moe_topk = 1;
+  int beam_size = 4;
+  std::string sampling_method = "beam_search";
+  int topk = 4;
+  float topp = 0.75f;
+  uint64_t seed = 1234;
+
+  void check() const {
+    if (std::find(kBenchModels.begin(), kBenchModels.end(), model) ==
+        kBenchModels.end()) {
+      throw std::runtime_error("unsupported benchmark model: " + model);
+    }
+    if (hidden % heads != 0 || hidden % 4 != 0) {
+      throw std::runtime_error(
+          "hidden size should be a multiple of 4 and of head number");
+    }
+    if (vocab < 4 || max_step <= 0 || inner <= 0) {
+      throw std::runtime_error("invalid synthetic model shape");
+    }
+  }
+
+  // number of weights, used for the report and the stub model
+  size_t param_count() const {
+    size_t h = hidden, i = inner, v = vocab, s = max_step;
+    size_t ffn = 2 * h * i + i + h;
+    if (model == "Moe" && expert_num > 0) {
+      // experts and the gate
+      ffn = ffn * expert_num + h * expert_num;
+    }
+    // qkv, output projection, two layer norms
+    size_t enc_layer = 4 * h * h + 3 * h + h + 4 * h + ffn;
+    size_t emb = v * h + s * h + 2 * h;
+    if (bench_is_encoder_only(model) || bench_is_gpt(model)) {
+      return emb + enc_layer * enc_layers;
+    }
+    // encdec q, output projection, one more layer norm
+    size_t dec_layer = enc_layer + 2 * h * h + 2 * h + 2 * h;
+    size_t trg_emb = emb + 2 * h * h * dec_layers + 2 * h * dec_layers + v;
+    return emb + enc_layer * enc_layers + trg_emb + dec_layer * dec_layers;
+  }
+};
+
+/**
+Deterministic generator of the synthetic weights and inputs (splitmix64),
+independent of the standard library implementation.
+*/
+class SyntheticRng {
+ public:
+  explicit SyntheticRng(uint64_t seed) : _state(seed) {}
+
+  uint64_t next() {
+    uint64_t z = (_state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+  // uniform in [lo, hi)
+  float uniform(float lo, float hi) {
+    return lo + (hi - lo) * (float)((next() >> 40) * (1.0 / (1ULL << 24)));
+  }
+
+  // uniform in [lo, hi)
+  int randint(int lo, int hi) { return lo + (int)(next() % (hi - lo)); }
+
+ private:
+  uint64_t _state;
+};
+
+/* Token ids of a synthetic batch, 0 is left out as the padding id */
+inline std::vector<int> synthetic_token_ids(int batch_size, int seq_len,
+                                            int vocab, uint64_t seed) {
+  SyntheticRng rng(seed);
+  std::vector<int> ids(batch_size * seq_len);
+  for (int &id : ids) id = rng.randint(1, vocab - 1);
+  return ids;
+}
+
+/* One point of the sweep */
+struct BenchCase {
+  std::string model;
+  int batch_size;
+  int seq_len;
+  int beam_size;
+  std::string sampling_method;
+
+  std::string name() const {
+    std::ostringstream oss;
+    oss << model << "/bs" << batch_size << "/len" << seq_len;
+    if (!bench_is_encoder_only(model)) {
+      oss << "/" << sampling_method << "/beam" << beam_size;
+    }
+    return oss.str();
+  }
+};
+
+struct BenchSweep {
+  std::vector<std::string> models = {"Transformer"};
+  std::vector<int> batch_sizes = {1, 8, 32};
+  std::vector<int> seq_lens = {32, 128};
+  std::vector<int> beam_sizes = {1, 4};
+  std::vector<std::string> sampling_methods = {"beam_search", "topk"};
+};
+
+/**
+Cartesian product of the sweep, skipping the combinations a model can not
+run: encoder-only models ignore beam and sampling, gpt only samples, beam
+size > 1 only goes with beam search.
+*/
+inline std::vector<BenchCase> expand_bench_sweep(const BenchSweep &sweep) {
+  std::vector<BenchCase> cases;
+  for (const std::string &model : sweep.models) {
+    for (int bs : sweep.batch_sizes) {
+      for (int len : sweep.seq_lens) {
+        if (bench_is_encoder_only(model)) {
+          cases.push_back({model, bs, len, 1, ""});
+          continue;
+        }
+        for (const std::string &method : sweep.sampling_methods) {
+          if (bench_is_gpt(model) && method != "topk" && method != "topp") {
+            continue;
+          }
+          for (int beam : sweep.beam_sizes) {
+            if ((method == "beam_search") != (beam > 1)) continue;
+            cases.push_back({model, bs, len, beam, method});
+          }
+        }
+      }
+    }
+  }
+  return cases;
+}
+
+struct LatencyStats {
+  int count = 0;
+  double mean_ms = 0;
+  double min_ms = 0;
+  double max_ms = 0;
+  double p50_ms = 0;
+  double p90_ms = 0;
+  double p99_ms = 0;
+};
+
+/* Percentile with linear interpolation between closest ranks */
+inline double latency_percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty()) return 0;
+  double rank = p / 100.0 * (sorted.size() - 1);
+  size_t lo = (size_t)rank;
+  size_t hi = std::min(lo + 1, sorted.size() - 1);
+  return sorted[lo] + (rank - lo) * (sorted[hi] - sorted[lo]);
+}
+
+inline LatencyStats compute_latency_stats(std::vector<double> latency_ms) {
+  LatencyStats stats;
+  if (latency_ms.empty()) return stats;
+  std::sort(latency_ms.begin(), latency_ms.end());
+  stats.count = latency_ms.size();
+  double sum = 0;
+  for (double t : latency_ms) sum += t;
+  stats.mean_ms = sum / latency_ms.size();
+  stats.min_ms = latency_ms.front();
+  stats.max_ms = latency_ms.back();
+  stats.p50_ms = latency_percentile(latency_ms, 50);
+  stats.p90_ms = latency_percentile(latency_ms, 90);
+  stats.p99_ms = latency_percentile(latency_ms, 99);
+  return stats;
+}
+
+struct BenchResult {
+  BenchCase bench_case;
+  LatencyStats latency;
+  // generated tokens for generation models, input tokens for encoders
+  double tokens_per_infer = 0;
+  double tokens_per_sec = 0;
+  // the most device memory in use sampled during the timed runs, see
+  // BenchBackend::max_memory_in_use
+  size_t device_memory_in_use_bytes = 0;
+  // the profiling stages of the timed runs, with BenchOptions::profile
+  std::map<std::string, StageStats> stages;
+  // label of the sweep the result belongs to, e.g. "epilogue_off"
+  std::string variant;
+  std::string error;
+};
+
+/**
+Device side of a benchmark run. The cuda backend lives with the benchmark
+binary, HostBenchBackend (stub_model.h) runs the harness against a stub
+model.
+*/
+class BenchBackend {
+ public:
+  virtual ~BenchBackend() {}
+  virtual std::string name() const = 0;
+  virtual void *malloc(size_t bytes) = 0;
+  virtual void free(void *ptr) = 0;
+  virtual void copy_to_device(void *dst, const void *src, size_t bytes) = 0;
+  virtual void copy_to_host(void *dst, const void *src, size_t bytes) = 0;
+  virtual void synchronize() = 0;
+  /* The most memory in use seen since reset_memory_in_use. The gpu backend
+   * samples the whole device after every synchronize, so it includes the
+   * cuda context and other processes, not only the model */
+  virtual void reset_memory_in_use() = 0;
+  virtual size_t max_memory_in_use() = 0;
+};
+
+inline size_t bench_dtype_bytes(DataType dtype) {
+  switch (dtype) {
+    case kInt8:
+    case kByte:
+    case kUInt8:
+      return 1;
+    case kFloat16:
+    case kInt16:
+    case kUInt16:
+      return 2;
+    case kInt64:
+    case kUInt64:
+    case kFloat64:
+      return 8;
+    default:
+      return 4;
+  }
+}
+
+inline size_t bench_shape_numel(const std::vector<int> &shape) {
+  size_t numel = 1;
+  for (int d : shape) numel *= d;
+  return numel;
+}
+
+/* End id of the synthetic models, trg_end_id and eos_id */
+inline int bench_end_id(int vocab) { return vocab - 1; }
+
+/**
+Generated tokens of the output ids of a generation model. Every row of the
+first dim holds its sequences of shape.back() ids, the best one first: the
+other beams of beam search are alternatives and are not counted. The gpt
+sequences start with the prompt_len prompt tokens. A sequence ends at its
+first end_id, the padding after it is not counted.
+*/
+inline size_t bench_generated_tokens(const std::vector<int> &ids,
+                                     const std::vector<int> &shape,
+                                     int prompt_len, int end_id) {
+  if (shape.empty() || ids.empty()) return 0;
+  size_t rows = shape[0];
+  size_t row_size = ids.size() / rows;
+  int seq_len = shape.back();
+  size_t tokens = 0;
+  for (size_t r = 0; r < rows; r++) {
+    const int *seq = ids.data() + r * row_size;
+    for (int t = prompt_len; t < seq_len; t++) {
+      tokens++;
+      if (seq[t] == end_id) break;
+    }
+  }
+  return tokens;
+}
+
+/**
+Time case.iters runs of model->Infer() on a synthetic batch, after
+warmup runs. Every run is synchronized so the latency covers the whole
+inference. With profile, the per-stage latency of the timed runs (e.g. the
+"ffn" stage of every layer) is reported as well.
+*/
+inline BenchResult run_bench_case(LSModel *model, const BenchCase &bench_case,
+                                  BenchBackend *backend, int vocab,
+                                  int warmup, int iters, uint64_t seed,
+                                  bool profile = false) {
+  BenchResult result;
+  result.bench_case = bench_case;
+  int bs = bench_case.batch_size;
+  int len = bench_case.seq_len;
+  std::vector<int> max_shape = model->get_input_max_shape(0);
+  if (bs > max_shape[0] || len > max_shape[1]) {
+    throw std::runtime_error(bench_case.name() +
+                             " exceeds the max input shape of the model");
+  }
+
+  std::vector<int> ids = synthetic_token_ids(bs, len, vocab, seed);
+  void *d_input = backend->malloc(ids.size() * sizeof(int));
+  backend->copy_to_device(d_input, ids.data(), ids.size() * sizeof(int));
+  model->set_input_ptr(0, d_input);
+  model->set_input_shape(0, {bs, len});
+
+  std::vector<void *> d_outputs;
+  for (int i = 0; i < model->get_output_size(); i++) {
+    size_t bytes = bench_shape_numel(model->get_output_max_shape(i)) *
+                   bench_dtype_bytes(model->get_output_dtype(i));
+    d_outputs.push_back(backend->malloc(bytes));
+    model->set_output_ptr(i, d_outputs.back());
+  }
+
+  backend->synchronize();
+  backend->reset_memory_in_use();
+  for (int i = 0; i < warmup; i++) model->Infer();
+  backend->synchronize();
+  model->reset_profiling();
+  model->enable_profiling(profile);
+
+  std::vector<double> latency_ms;
+  for (int i = 0; i < iters; i++) {
+    auto start = std::chrono::steady_clock::now();
+    model->Infer();
+    backend->synchronize();
+    auto end = std::chrono::steady_clock::now();
+    latency_ms.push_back(
+        std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  result.latency = compute_latency_stats(latency_ms);
+  if (profile) {
+    result.stages = model->get_stage_stats();
+    model->enable_profiling(false);
+  }
+  result.device_memory_in_use_bytes = backend->max_memory_in_use();
+
+  if (bench_is_encoder_only(bench_case.model)) {
+    result.tokens_per_infer = (double)bs * len;
+  } else {
+    std::vector<int> out_shape = model->get_output_shape(0);
+    std::vector<int> out_ids(bench_shape_numel(out_shape));
+    backend->copy_to_host(out_ids.data(), d_outputs[0],
+                          out_ids.size() * sizeof(int));
+    result.tokens_per_infer = bench_generated_tokens(
+        out_ids, out_shape, bench_is_gpt(bench_case.model) ? len : 0,
+        bench_end_id(vocab));
+  }
+  if (result.latency.mean_ms > 0) {
+    result.tokens_per_sec =
+        result.tokens_per_infer / (result.latency.mean_ms / 1000.0);
+  }
+
+  backend->free(d_input);
+  for (void *ptr : d_outputs) backend->free(ptr);
+  return result;
+}
+
+/* "1,8,32" -> {1, 8, 32} */
+inline std::vector<std::string> bench_split(const std::string &str) {
+  std::vector<std::string> res;
+  std::stringstream ss(str);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (!item.empty()) res.push_back(item);
+  }
+  return res;
+}
+
+inline std::vector<int> bench_split_int(const std::string &str) {
+  std::vector<int> res;
+  for (const std::string &item : bench_split(str)) {
+    res.push_back(std::stoi(item));
+  }
+  return res;
+}
+
+/**
+Options of the benchmark binary, given as --key=value. Unknown keys are an
+error so that a typo does not silently benchmark the default.
+*/
+struct BenchOptions {
+  BenchSweep sweep;
+  SyntheticModelShape shape;
+  int warmup = 3;
+  int iters = 20;
+  // gpu runs the real models, stub runs the harness on host
+  std::string device = "gpu";
+  std::string output = "";
+  std::string work_dir = "/tmp";
+  // report the per-stage latency of every case
+  bool profile = false;
+  // run the sweep with the cublasLt epilogue off, then on, profiled
+  bool epilogue_ab = false;
+};
+
+inline BenchOptions parse_bench_options(int argc, char *argv[]) {
+  BenchOptions opt;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t eq = arg.find('=');
+    if (arg.compare(0, 2, "--") != 0 || eq == std::string::npos) {
+      throw std::runtime_error("expect --key=value, got " + arg);
+    }
+    std::string key = arg.substr(2, eq - 2);
+    std::string value = arg.substr(eq + 1);
+    if (key == "models") {
+      opt.sweep.models = bench_split(value);
+    } else if (key == "batch_sizes") {
+      opt.sweep.batch_sizes = bench_split_int(value);
+    } else if (key == "seq_lens") {
+      opt.sweep.seq_lens = bench_split_int(value);
+    } else if (key == "beam_sizes") {
+      opt.sweep.beam_sizes = bench_split_int(value);
+    } else if (key == "sampling_methods") {
+      opt.sweep.sampling_methods = bench_split(value);
+    } else if (key == "enc_layers") {
+      opt.shape.enc_layers = std::stoi(value);
+    } else if (key == "dec_layers") {
+      opt.shape.dec_layers = std::stoi(value);
+    } else if (key == "layers") {
+      opt.shape.enc_layers = opt.shape.dec_layers = std::stoi(value);
+    } else if (key == "hidden") {
+      opt.shape.hidden = std::stoi(value);
+    } else if (key == "heads") {
+      opt.shape.heads = std::stoi(value);
+    } else if (key == "inner") {
+      opt.shape.inner = std::stoi(value);
+    } else if (key == "vocab") {
+      opt.shape.vocab = std::stoi(value);
+    } else if (key == "max_step") {
+      opt.shape.max_step = std::stoi(value);
+    } else if (key == "extra_decode_length") {
+      opt.shape.extra_decode_length = std::stoi(value);
+    } else if (key == "expert_num") {
+      opt.shape.expert_num = std::stoi(value);
+    } else if (key == "seed") {
+      opt.shape.seed = std::stoull(value);
+    } else if (key == "warmup") {
+      opt.warmup = std::stoi(value);
+    } else if (key == "iters") {
+      opt.iters = std::stoi(value);
+    } else if (key == "device") {
+      opt.device = value;
+    } else if (key == "output") {
+      opt.output = value;
+    } else if (key == "work_dir") {
+      opt.work_dir = value;
+    } else if (key == "profile") {
+      opt.profile = std::stoi(value) != 0;
+    } else if (key == "epilogue_ab") {
+      opt.epilogue_ab = std::stoi(value) != 0;
+      if (opt.epilogue_ab) opt.profile = true;
+    } else {
+      throw std::runtime_error("unknown benchmark option --" + key);
+    }
+  }
+  for (const std::string &model : opt.sweep.models) {
+    SyntheticModelShape shape = opt.shape;
+    shape.model = model;
+    shape.check();
+  }
+  if (opt.device != "gpu" && opt.device != "stub") {
+    throw std::runtime_error("device should be gpu or stub");
+  }
+  return opt;
+}
+
+typedef std::function<LSModel *(const SyntheticModelShape &, int)>
+    BenchModelCreator;
+
+/**
+Run the whole sweep. Beam size and sampling method are part of the model
+config, so one model is created for every (model, beam, sampling) group and
+shared by its batch sizes and lengths. A failing case is reported with its
+error instead of stopping the sweep.
+*/
+inline std::vector<BenchResult> run_bench_sweep(
+    const BenchOptions &opt, const BenchModelCreator &create_model,
+    BenchBackend *backend) {
+  std::vector<BenchCase> cases = expand_bench_sweep(opt.sweep);
+  int max_batch_size = *std::max_element(opt.sweep.batch_sizes.begin(),
+                                         opt.sweep.batch_sizes.end());
+  std::vector<BenchResult> results;
+  std::vector<bool> done(cases.size(), false);
+  for (size_t i = 0; i < cases.size(); i++) {
+    if (done[i]) continue;
+    SyntheticModelShape shape = opt.shape;
+    shape.model = cases[i].model;
+    shape.beam_size = cases[i].beam_size;
+    if (!cases[i].sampling_method.empty()) {
+      shape.sampling_method = cases[i].sampling_method;
+    }
+    std::unique_ptr<LSModel> model;
+    std::string error;
+    try {
+      model.reset(create_model(shape, max_batch_size));
+    } catch (std::exception &e) {
+      error = e.what();
+    }
+    for (size_t j = i; j < cases.size(); j++) {
+      const BenchCase &c = cases[j];
+      if (c.model != cases[i].model || c.beam_size != cases[i].beam_size ||
+          c.sampling_method != cases[i].sampling_method) {
+        continue;
+      }
+      done[j] = true;
+      BenchResult result;
+      result.bench_case = c;
+      result.error = error;
+      if (model) {
+        try {
+          result = run_bench_case(model.get(), c, backend, shape.vocab,
+                                  opt.warmup, opt.iters, shape.seed + j,
+                                  opt.profile);
+        } catch (std::exception &e) {
+          result.error = e.what();
+        }
+      }
+      results.push_back(result);
+    }
+  }
+  return results;
+}
+
+inline std::string bench_json_escape(const std::string &str) {
+  std::string res;
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      res += '\\';
+      res += c;
+    } else if (c == '\n') {
+      res += "\\n";
+    } else {
+      res += c;
+    }
+  }
+  return res;
+}
+
+/* Report of a whole sweep, one object per case */
+inline std::string bench_results_to_json(
+    const std::vector<BenchResult> &results,
+    const std::map<std::string, std::string> &meta) {
+  std::ostringstream oss;
+  oss << "{\n  \"meta\": {";
+  bool first = true;
+  for (const auto &kv : meta) {
+    oss << (first ? "" : ", ") << "\"" << bench_json_escape(kv.first)
+        << "\": \"" << bench_json_escape(kv.second) << "\"";
+    first = false;
+  }
+  oss << "},\n  \"results\": [";
+  for (size_t i = 0; i < results.size(); i++) {
+    const BenchResult &r = results[i];
+    const LatencyStats &l = r.latency;
+    oss << (i ? "," : "") << "\n    {\"name\": \""
+        << bench_json_escape(r.bench_case.name()) << "\", \"model\": \""
+        << r.bench_case.model << "\", \"batch_size\": "
+        << r.bench_case.batch_size << ", \"seq_len\": " << r.bench_case.seq_len
+        << ", \"beam_size\": " << r.bench_case.beam_size
+        << ", \"sampling_method\": \"" << r.bench_case.sampling_method << "\"";
+    if (!r.variant.empty()) {
+      oss << ", \"variant\": \"" << bench_json_escape(r.variant) << "\"";
+    }
+    if (!r.error.empty()) {
+      oss << ", \"error\": \"" << bench_json_escape(r.error) << "\"}";
+      continue;
+    }
+    oss << ", \"iters\": " << l.count << ", \"latency_ms\": {\"mean\": "
+        << l.mean_ms << ", \"min\": " << l.min_ms << ", \"max\": " << l.max_ms
+        << ", \"p50\": " << l.p50_ms << ", \"p90\": " << l.p90_ms
+        << ", \"p99\": " << l.p99_ms << "}, \"tokens_per_infer\": "
+        << r.tokens_per_infer << ", \"tokens_per_sec\": " << r.tokens_per_sec
+        << ", \"device_memory_in_use_bytes\": "
+        << r.device_memory_in_use_bytes;
+    if (!r.stages.empty()) {
+      oss << ", \"stages\": {";
+      bool first_stage = true;
+      for (const auto &kv : r.stages) {
+        const StageStats &s = kv.second;
+        oss << (first_stage ? "" : ", ") << "\""
+            << bench_json_escape(kv.first) << "\": {\"count\": " << s.count
+            << ", \"mean\": " << s.mean_ms << ", \"p50\": " << s.p50_ms
+            << ", \"p99\": " << s.p99_ms << "}";
+        first_stage = false;
+      }
+      oss << "}";
+    }
+    oss << "}";
+  }
+  oss << "\n  ]\n}\n";
+  return oss.str();
+}
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,154 @@
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include "bench_harness.h"
+#include "gemm_dispatch.h"
+#include "stub_model.h"
+#include "synthetic_model.h"
+#include "util.h"
+
+/**
+@file
+End-to-end benchmark of the inference models on synthetic weights.
+
+Example:
+  lightseq_benchmark --models=Transformer,Bert --batch_sizes=1,8,32 \
+    --seq_lens=32,128 --beam_sizes=1,4 --sampling_methods=beam_search,topk \
+    --layers=6 --hidden=512 --heads=8 --vocab=32000 --output=result.json
+
+--device=stub runs the same sweep against the host stub model.
+
+With LS_GEMM_TUNE=1 and LS_GEMM_ALGO_CACHE=<file>, a tuning pass over the
+same sweep first tunes the gemms of every shape and saves them to the file,
+see gemm_dispatch.h. The measured sweep then runs the tuned algos.
+
+--profile=1 adds the per-stage latency of every case to the report, e.g.
+"decoder.layer_0.ffn". --epilogue_ab=1 runs the sweep twice, with the
+cublasLt bias/activation epilogue off ("variant": "epilogue_off") and on
+("epilogue_on"), profiled, for a per-layer before/after of the ffn stages.
+*/
+namespace lightseq {
+namespace cuda {
+
+class CudaBenchBackend : public BenchBackend {
+ public:
+  std::string name() const override {
+    cudaDeviceProp prop;
+    int device;
+    CHECK_GPU_ERROR(cudaGetDevice(&device));
+    CHECK_GPU_ERROR(cudaGetDeviceProperties(&prop, device));
+    return prop.name;
+  }
+  void *malloc(size_t bytes) override {
+    void *ptr;
+    CHECK_GPU_ERROR(cudaMalloc(&ptr, bytes));
+    return ptr;
+  }
+  void free(void *ptr) override { CHECK_GPU_ERROR(cudaFree(ptr)); }
+  void copy_to_device(void *dst, const void *src, size_t bytes) override {
+    CHECK_GPU_ERROR(cudaMemcpy(dst, src, bytes, cudaMemcpyHostToDevice));
+  }
+  void copy_to_host(void *dst, const void *src, size_t bytes) override {
+    CHECK_GPU_ERROR(cudaMemcpy(dst, src, bytes, cudaMemcpyDeviceToHost));
+  }
+  // memory in use of the whole device, sampled after every run. The models
+  // allocate their buffers up front, so the samples see them all
+  void synchronize() override {
+    CHECK_GPU_ERROR(cudaDeviceSynchronize());
+    _max_used = std::max(_max_used, used_bytes());
+  }
+  void reset_memory_in_use() override { _max_used = used_bytes(); }
+  size_t max_memory_in_use() override { return _max_used; }
+
+ private:
+  size_t used_bytes() {
+    size_t free_bytes, total_bytes;
+    CHECK_GPU_ERROR(cudaMemGetInfo(&free_bytes, &total_bytes));
+    return total_bytes - free_bytes;
+  }
+
+  size_t _max_used = 0;
+};
+
+}  // namespace cuda
+}  // namespace lightseq
+
+int main(int argc, char *argv[]) {
+  using namespace lightseq::cuda;
+  BenchOptions opt = parse_bench_options(argc, argv);
+
+  std::unique_ptr<BenchBackend> backend;
+  BenchModelCreator create_model;
+  if (opt.device == "stub") {
+    backend.reset(new HostBenchBackend());
+    create_model = [](const SyntheticModelShape &shape, int max_batch_size) {
+      return new StubModel(shape, max_batch_size);
+    };
+  } else {
+    backend.reset(new CudaBenchBackend());
+    std::string work_dir = opt.work_dir;
+    create_model = [work_dir](const SyntheticModelShape &shape,
+                              int max_batch_size) {
+      std::string path = work_dir + "/lightseq_bench_" + shape.model + "_" +
+                         std::to_string(shape.seed) + ".pb";
+      std::string res = write_synthetic_model(shape, path);
+      if (!res.empty()) throw std::runtime_error(res);
+      LSModel *model = LSModelFactory::GetInstance().CreateModel(
+          shape.model, path, max_batch_size);
+      std::remove(path.c_str());
+      return model;
+    };
+  }
+
+  if (opt.device != "stub" && GemmTuneConfig::from_env().tune) {
+    BenchOptions tune_opt = opt;
+    tune_opt.warmup = 0;
+    tune_opt.iters = 1;
+    begin_gemm_tuning();
+    run_bench_sweep(tune_opt, create_model, backend.get());
+    end_gemm_tuning();
+  }
+
+  std::vector<BenchResult> results;
+  if (opt.epilogue_ab) {
+    for (bool epilogue : {false, true}) {
+      set_gemm_epilogue(epilogue);
+      for (BenchResult &r : run_bench_sweep(opt, create_model, backend.get())) {
+        r.variant = epilogue ? "epilogue_on" : "epilogue_off";
+        results.push_back(r);
+      }
+    }
+  } else {
+    results = run_bench_sweep(opt, create_model, backend.get());
+  }
+
+  const SyntheticModelShape &s = opt.shape;
+  std::map<std::string, std::string> meta = {
+      {"device", backend->name()},
+      {"enc_layers", std::to_string(s.enc_layers)},
+      {"dec_layers", std::to_string(s.dec_layers)},
+      {"hidden", std::to_string(s.hidden)},
+      {"heads", std::to_string(s.heads)},
+      {"inner", std::to_string(s.inner)},
+      {"vocab", std::to_string(s.vocab)},
+      {"max_step", std::to_string(s.max_step)},
+      {"seed", std::to_string(s.seed)},
+      {"warmup", std::to_string(opt.warmup)},
+      {"iters", std::to_string(opt.iters)},
+#ifdef FP16_MODE
+      {"precision", "fp16"},
+#else
+      {"precision", "fp32"},
+#endif
+  };
+  std::string json = bench_results_to_json(results, meta);
+  if (opt.output.empty()) {
+    std::cout << json;
+  } else {
+    std::ofstream fout(opt.output);
+    fout << json;
+    std::cout << "benchmark result written to " << opt.output << std::endl;
+  }
+  return 0;
+}
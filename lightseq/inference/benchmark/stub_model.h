@@ -0,0 +1,183 @@
+#pragma once
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <map>
+
+#include "bench_harness.h"
+
+/**
+@file
+Host implementations of LSModel and BenchBackend, so that the benchmark
+harness, the synthetic shapes and the report can run without a gpu.
+*/
+namespace lightseq {
+namespace cuda {
+
+/**
+Runs on host, pointers are plain host memory. The memory in use is the bytes
+allocated through it.
+*/
+class HostBenchBackend : public BenchBackend {
+ public:
+  ~HostBenchBackend() {
+    for (auto &kv : _sizes) ::free(kv.first);
+  }
+  std::string name() const override { return "stub"; }
+  void *malloc(size_t bytes) override {
+    void *ptr = ::malloc(bytes ? bytes : 1);
+    _sizes[ptr] = bytes;
+    _cur += bytes;
+    _peak = std::max(_peak, _cur);
+    return ptr;
+  }
+  void free(void *ptr) override {
+    auto iter = _sizes.find(ptr);
+    if (iter == _sizes.end()) return;
+    _cur -= iter->second;
+    _sizes.erase(iter);
+    ::free(ptr);
+  }
+  void copy_to_device(void *dst, const void *src, size_t bytes) override {
+    memcpy(dst, src, bytes);
+  }
+  void copy_to_host(void *dst, const void *src, size_t bytes) override {
+    memcpy(dst, src, bytes);
+  }
+  void synchronize() override {}
+  void reset_memory_in_use() override { _peak = _cur; }
+  size_t max_memory_in_use() override { return _peak; }
+  size_t current_bytes() const { return _cur; }
+
+ private:
+  std::map<void *, size_t> _sizes;
+  size_t _cur = 0;
+  size_t _peak = 0;
+};
+
+/**
+Stand-in of the inference models with the same inputs and outputs. It keeps
+a synthetic embedding table and does a small amount of host work per token,
+the outputs are deterministic for a given shape and input.
+*/
+class StubModel : public LSModel {
+ public:
+  StubModel(const SyntheticModelShape &shape, int max_batch_size)
+      : LSModel({bench_is_encoder_only(shape.model) || bench_is_gpt(shape.model)
+                     ? "token_ids"
+                     : "source_ids"},
+                output_names(shape.model)),
+        _shape(shape),
+        _max_batch_size(max_batch_size),
+        _input(nullptr) {
+    shape.check();
+    SyntheticRng rng(shape.seed);
+    _emb.resize((size_t)shape.vocab * shape.hidden);
+    for (float &e : _emb) e = rng.uniform(-1.f, 1.f);
+    _outputs.resize(kOutputNames.size(), nullptr);
+    for (int l = 0; l < shape.enc_layers; l++) {
+      _stage_layers.push_back(
+          profiler_.stage_id("stub.layer_" + std::to_string(l) + ".ffn"));
+    }
+  }
+
+  void Infer() override {
+    HostStageScope infer_scope(&profiler_, infer_stage_);
+    const std::vector<int> &shape = input_shapes_[0];
+    int bs = shape[0], len = shape[1];
+    int hidden = _shape.hidden;
+    bool encoder_only = bench_is_encoder_only(_shape.model);
+    bool gpt = bench_is_gpt(_shape.model);
+    int beam = encoder_only || gpt ? 1 : _shape.beam_size;
+    // gpt returns the prompt followed by the sampled tokens
+    int out_len =
+        gpt ? std::min(len + _shape.extra_decode_length, _shape.max_step) : len;
+    std::vector<float> state(hidden);
+    for (int b = 0; b < bs; b++) {
+      for (int t = 0; t < len; t++) {
+        int id = _input[b * len + t];
+        const float *row = _emb.data() + (size_t)id * hidden;
+        float sum = 0;
+        for (int l = 0; l < _shape.enc_layers; l++) {
+          HostStageScope layer_scope(&profiler_, _stage_layers[l]);
+          for (int d = 0; d < hidden; d++) {
+            state[d] = row[d] * (l + 1) + sum * 1e-3f;
+            sum += state[d];
+          }
+        }
+        if (encoder_only) {
+          float *out = (float *)_outputs[0] + ((size_t)b * len + t) * hidden;
+          memcpy(out, state.data(), hidden * sizeof(float));
+          continue;
+        }
+        for (int k = 0; k < beam; k++) {
+          int *ids = (int *)_outputs[0] + ((size_t)b * beam + k) * out_len;
+          // gpt echoes the prompt, the end id is left for the last token
+          ids[t] = gpt ? id : (id + k + (sum > 0)) % (_shape.vocab - 1);
+        }
+      }
+      if (gpt) {
+        int *ids = (int *)_outputs[0] + (size_t)b * out_len;
+        for (int t = len; t < out_len; t++) {
+          ids[t] = t + 1 < out_len ? (ids[t - 1] + 1) % (_shape.vocab - 1)
+                                   : bench_end_id(_shape.vocab);
+        }
+      }
+      if (!encoder_only && _outputs.size() > 1) {
+        for (int k = 0; k < beam; k++) {
+          ((float *)_outputs[1])[b * beam + k] = -1.f * k;
+        }
+      }
+    }
+    if (encoder_only) {
+      set_output_shape(0, {bs, len, hidden});
+    } else {
+      set_output_shape(0, {bs, beam, out_len});
+      if (_outputs.size() > 1) set_output_shape(1, {bs, beam});
+    }
+  }
+
+  void set_input_ptr(int index, void *input_ptr) override {
+    if (index != 0) throw std::runtime_error("invalid input index");
+    _input = (const int *)input_ptr;
+  }
+  void set_output_ptr(int index, void *output_ptr) override {
+    _outputs.at(index) = output_ptr;
+  }
+  const void *get_output_ptr(int index) override { return _outputs.at(index); }
+
+  std::vector<int> get_input_max_shape(int index) override {
+    return {_max_batch_size, _shape.max_step};
+  }
+  std::vector<int> get_output_max_shape(int index) override {
+    if (bench_is_encoder_only(_shape.model)) {
+      return {_max_batch_size, _shape.max_step, _shape.hidden};
+    }
+    int beam = bench_is_gpt(_shape.model) ? 1 : _shape.beam_size;
+    if (index == 0) return {_max_batch_size, beam, _shape.max_step};
+    return {_max_batch_size, beam};
+  }
+  DataType get_input_dtype(int index) override { return kInt32; }
+  DataType get_output_dtype(int index) override {
+    if (bench_is_encoder_only(_shape.model) || index == 1) return kFloat32;
+    return kInt32;
+  }
+
+ private:
+  static std::vector<std::string> output_names(const std::string &model) {
+    if (bench_is_encoder_only(model)) return {"encoder_output"};
+    if (bench_is_gpt(model)) return {"result"};
+    return {"target_ids", "target_scores"};
+  }
+
+  SyntheticModelShape _shape;
+  int _max_batch_size;
+  const int *_input;
+  std::vector<void *> _outputs;
+  std::vector<float> _emb;
+  std::vector<int> _stage_layers;
+};
+
+}  // namespace cuda
+}  // namespace lightseq
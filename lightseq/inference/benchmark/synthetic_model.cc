@@ -0,0 +1,361 @@
+#include "synthetic_model.h"
+
+#include <cmath>
+#include <fstream>
+
+#include "bert.pb.h"
+#include "gpt.pb.h"
+#include "moe.pb.h"
+#include "quant_bert.pb.h"
+#include "quant_gpt.pb.h"
+#include "quant_transformer.pb.h"
+#include "transformer.pb.h"
+
+/**
+@file
+Synthetic models for the benchmark. The field names of the encoder, decoder
+and embedding messages are shared by all the protos, so one template fills
+them for every model. Float fields get uniform weights, int8 (bytes) fields
+of the quant models get uniform bytes with a fixed clip max.
+*/
+namespace lightseq {
+namespace cuda {
+
+namespace {
+
+// clip max of the activations of quant models
+const float kActClipMax = 8.f;
+
+class WeightFiller {
+ public:
+  explicit WeightFiller(uint64_t seed) : _rng(seed) {}
+
+  void uniform(google::protobuf::RepeatedField<float> *field, size_t size,
+               float scale) {
+    field->Reserve(size);
+    for (size_t i = 0; i < size; i++) field->Add(_rng.uniform(-scale, scale));
+  }
+
+  // int8 weights of quant models
+  void uniform(std::string *field, size_t size, float scale) {
+    field->resize(size);
+    for (char &c : *field) c = (char)(_rng.next() & 0xff);
+  }
+
+  void constant(google::protobuf::RepeatedField<float> *field, size_t size,
+                float value) {
+    field->Reserve(size);
+    for (size_t i = 0; i < size; i++) field->Add(value);
+  }
+
+ private:
+  SyntheticRng _rng;
+};
+
+template <typename Layer>
+void fill_encoder_layer(Layer *layer, const SyntheticModelShape &shape,
+                        int expert_num, WeightFiller *filler) {
+  size_t h = shape.hidden, i = shape.inner, e = expert_num > 0 ? expert_num : 1;
+  float ws = 1.f / std::sqrt((float)h);
+  filler->constant(layer->mutable_multihead_norm_scale(), h, 1.f);
+  filler->constant(layer->mutable_multihead_norm_bias(), h, 0.f);
+  filler->uniform(layer->mutable_multihead_project_kernel_qkv(), 3 * h * h, ws);
+  filler->uniform(layer->mutable_multihead_project_bias_qkv(), 3 * h, ws);
+  filler->uniform(layer->mutable_multihead_project_kernel_output(), h * h, ws);
+  filler->uniform(layer->mutable_multihead_project_bias_output(), h, ws);
+  filler->constant(layer->mutable_ffn_norm_scale(), h, 1.f);
+  filler->constant(layer->mutable_ffn_norm_bias(), h, 0.f);
+  filler->uniform(layer->mutable_ffn_first_kernel(), e * h * i, ws);
+  filler->uniform(layer->mutable_ffn_first_bias(), e * i, ws);
+  filler->uniform(layer->mutable_ffn_second_kernel(), e * i * h, ws);
+  filler->uniform(layer->mutable_ffn_second_bias(), e * h, ws);
+}
+
+template <typename Layer>
+void fill_decoder_layer(Layer *layer, const SyntheticModelShape &shape,
+                        int expert_num, WeightFiller *filler) {
+  size_t h = shape.hidden, i = shape.inner, e = expert_num > 0 ? expert_num : 1;
+  float ws = 1.f / std::sqrt((float)h);
+  filler->constant(layer->mutable_self_norm_scale(), h, 1.f);
+  filler->constant(layer->mutable_self_norm_bias(), h, 0.f);
+  filler->uniform(layer->mutable_self_project_kernel_qkv(), 3 * h * h, ws);
+  filler->uniform(layer->mutable_self_project_bias_qkv(), 3 * h, ws);
+  filler->uniform(layer->mutable_self_project_kernel_output(), h * h, ws);
+  filler->uniform(layer->mutable_self_project_bias_output(), h, ws);
+  filler->constant(layer->mutable_encdec_norm_scale(), h, 1.f);
+  filler->constant(layer->mutable_encdec_norm_bias(), h, 0.f);
+  filler->uniform(layer->mutable_encdec_project_kernel_q(), h * h, ws);
+  filler->uniform(layer->mutable_encdec_project_bias_q(), h, ws);
+  filler->uniform(layer->mutable_encdec_project_kernel_output(), h * h, ws);
+  filler->uniform(layer->mutable_encdec_project_bias_output(), h, ws);
+  filler->constant(layer->mutable_ffn_norm_scale(), h, 1.f);
+  filler->constant(layer->mutable_ffn_norm_bias(), h, 0.f);
+  filler->uniform(layer->mutable_ffn_first_kernel(), e * h * i, ws);
+  filler->uniform(layer->mutable_ffn_first_bias(), e * i, ws);
+  filler->uniform(layer->mutable_ffn_second_kernel(), e * i * h, ws);
+  filler->uniform(layer->mutable_ffn_second_bias(), e * h, ws);
+}
+
+template <typename Emb>
+void fill_embedding(Emb *emb, const SyntheticModelShape &shape,
+                    WeightFiller *filler) {
+  size_t h = shape.hidden;
+  filler->uniform(emb->mutable_token_embedding(), shape.vocab * h,
+                  1.f / std::sqrt((float)h));
+  filler->uniform(emb->mutable_position_embedding(), shape.max_step * h, 0.1f);
+  filler->constant(emb->mutable_norm_scale(), h, 1.f);
+  filler->constant(emb->mutable_norm_bias(), h, 0.f);
+}
+
+// encoder output projection of all decoder layers and the logits bias
+template <typename Emb>
+void fill_trg_embedding(Emb *emb, const SyntheticModelShape &shape,
+                        WeightFiller *filler) {
+  size_t h = shape.hidden, l = shape.dec_layers;
+  float ws = 1.f / std::sqrt((float)h);
+  fill_embedding(emb, shape, filler);
+  filler->uniform(emb->mutable_encode_output_project_kernel_kv(),
+                  2 * h * h * l, ws);
+  filler->uniform(emb->mutable_encode_output_project_bias_kv(), 2 * h * l, ws);
+  filler->constant(emb->mutable_shared_bias(), shape.vocab, 0.f);
+}
+
+template <typename Conf>
+void fill_generation_conf(Conf *conf, const SyntheticModelShape &shape) {
+  conf->set_head_num(shape.heads);
+  conf->set_beam_size(shape.beam_size);
+  conf->set_extra_decode_length(shape.extra_decode_length);
+  conf->set_length_penalty(0.6f);
+  conf->set_src_padding_id(0);
+  conf->set_trg_start_id(shape.vocab - 2);
+  conf->set_trg_end_id(shape.vocab - 1);
+  conf->set_sampling_method(shape.sampling_method);
+  conf->set_topk(shape.topk);
+  conf->set_topp(shape.topp);
+  conf->set_use_gelu(false);
+}
+
+// clip max of the int8 kernels and activations, common to all quant layers
+template <typename Layer>
+void set_quant_encoder_clip_max(Layer *layer, float ws) {
+  layer->set_multihead_project_kernel_qkv_clip_max(ws);
+  layer->set_multihead_project_kernel_output_clip_max(ws);
+  layer->set_ffn_first_kernel_clip_max(ws);
+  layer->set_ffn_second_kernel_clip_max(ws);
+  layer->set_multihead_ln_clip_max(kActClipMax);
+  layer->set_multihead_project_output_clip_max(kActClipMax);
+  layer->set_ffn_ln_clip_max(kActClipMax);
+  layer->set_ffn_first_act_clip_max(kActClipMax);
+  layer->set_multihead_qkv_dense_clip_max(kActClipMax);
+  layer->set_multihead_output_dense_clip_max(kActClipMax);
+  layer->set_ffn_first_output_clip_max(kActClipMax);
+}
+
+void set_quant_decoder_clip_max(QuantDecoderLayer *layer, float ws) {
+  layer->set_self_project_kernel_qkv_clip_max(ws);
+  layer->set_self_project_kernel_output_clip_max(ws);
+  layer->set_encdec_project_kernel_q_clip_max(ws);
+  layer->set_encdec_project_kernel_output_clip_max(ws);
+  layer->set_ffn_first_kernel_clip_max(ws);
+  layer->set_ffn_second_kernel_clip_max(ws);
+  layer->set_self_ln_clip_max(kActClipMax);
+  layer->set_self_project_output_clip_max(kActClipMax);
+  layer->set_encdec_ln_clip_max(kActClipMax);
+  layer->set_encdec_project_output_clip_max(kActClipMax);
+  layer->set_ffn_ln_clip_max(kActClipMax);
+  layer->set_ffn_first_act_clip_max(kActClipMax);
+  layer->set_self_qkv_dense_clip_max(kActClipMax);
+  layer->set_self_output_dense_clip_max(kActClipMax);
+  layer->set_encdec_q_dense_clip_max(kActClipMax);
+  layer->set_encdec_output_dense_clip_max(kActClipMax);
+  layer->set_ffn_first_output_clip_max(kActClipMax);
+  layer->set_ffn_second_output_clip_max(kActClipMax);
+  layer->set_self_qkv_bias_out_clip_max(kActClipMax);
+}
+
+void build_transformer(const SyntheticModelShape &shape, WeightFiller *filler,
+                       Transformer *model) {
+  fill_embedding(model->mutable_src_embedding(), shape, filler);
+  for (int l = 0; l < shape.enc_layers; l++) {
+    fill_encoder_layer(model->add_encoder_stack(), shape, 0, filler);
+  }
+  fill_trg_embedding(model->mutable_trg_embedding(), shape, filler);
+  for (int l = 0; l < shape.dec_layers; l++) {
+    fill_decoder_layer(model->add_decoder_stack(), shape, 0, filler);
+  }
+  fill_generation_conf(model->mutable_model_conf(), shape);
+}
+
+void build_moe(const SyntheticModelShape &shape, WeightFiller *filler,
+               Moe *model) {
+  size_t h = shape.hidden;
+  float ws = 1.f / std::sqrt((float)h);
+  fill_embedding(model->mutable_src_embedding(), shape, filler);
+  for (int l = 0; l < shape.enc_layers; l++) {
+    MoeEncoderLayer *layer = model->add_encoder_stack();
+    fill_encoder_layer(layer, shape, shape.expert_num, filler);
+    if (shape.expert_num > 0) {
+      filler->uniform(layer->mutable_gate_kernel(), h * shape.expert_num, ws);
+      model->mutable_model_conf()->add_moe_list_encoder(l);
+    }
+  }
+  fill_trg_embedding(model->mutable_trg_embedding(), shape, filler);
+  for (int l = 0; l < shape.dec_layers; l++) {
+    MoeDecoderLayer *layer = model->add_decoder_stack();
+    fill_decoder_layer(layer, shape, shape.expert_num, filler);
+    if (shape.expert_num > 0) {
+      filler->uniform(layer->mutable_gate_kernel(), h * shape.expert_num, ws);
+      model->mutable_model_conf()->add_moe_list_decoder(l);
+    }
+  }
+  MoeModelConf *conf = model->mutable_model_conf();
+  fill_generation_conf(conf, shape);
+  conf->set_expert_num_encoder(shape.expert_num);
+  conf->set_expert_num_decoder(shape.expert_num);
+  conf->set_moe_topk_encoder(shape.moe_topk);
+  conf->set_moe_topk_decoder(shape.moe_topk);
+}
+
+void build_quant_transformer(const SyntheticModelShape &shape,
+                             WeightFiller *filler, QuantTransformer *model) {
+  float ws = 1.f / std::sqrt((float)shape.hidden);
+  QuantEmbeddingLayer *src_emb = model->mutable_src_embedding();
+  fill_embedding(src_emb, shape, filler);
+  src_emb->set_emb_clip_max(ws);
+  for (int l = 0; l < shape.enc_layers; l++) {
+    QuantEncoderLayer *layer = model->add_encoder_stack();
+    fill_encoder_layer(layer, shape, 0, filler);
+    set_quant_encoder_clip_max(layer, ws);
+    layer->set_ffn_second_output_clip_max(kActClipMax);
+  }
+  QuantEmbeddingLayer *trg_emb = model->mutable_trg_embedding();
+  fill_trg_embedding(trg_emb, shape, filler);
+  trg_emb->set_emb_clip_max(ws);
+  trg_emb->set_output_ln_clip_max(kActClipMax);
+  trg_emb->set_logits_clip_max(kActClipMax);
+  for (int l = 0; l < shape.dec_layers; l++) {
+    QuantDecoderLayer *layer = model->add_decoder_stack();
+    fill_decoder_layer(layer, shape, 0, filler);
+    set_quant_decoder_clip_max(layer, ws);
+    trg_emb->add_encode_output_project_kernel_kv_clip_max(ws);
+  }
+  fill_generation_conf(model->mutable_model_conf(), shape);
+}
+
+void build_bert(const SyntheticModelShape &shape, WeightFiller *filler,
+                Bert *model) {
+  fill_embedding(model->mutable_src_embedding(), shape, filler);
+  for (int l = 0; l < shape.enc_layers; l++) {
+    fill_encoder_layer(model->add_encoder_stack(), shape, 0, filler);
+  }
+  model->mutable_model_conf()->set_head_num(shape.heads);
+  model->mutable_model_conf()->set_src_padding_id(0);
+}
+
+void build_quant_bert(const SyntheticModelShape &shape, WeightFiller *filler,
+                      QuantBert *model) {
+  float ws = 1.f / std::sqrt((float)shape.hidden);
+  fill_embedding(model->mutable_src_embedding(), shape, filler);
+  model->mutable_src_embedding()->set_emb_clip_max(ws);
+  for (int l = 0; l < shape.enc_layers; l++) {
+    QuantBertEncoderLayer *layer = model->add_encoder_stack();
+    fill_encoder_layer(layer, shape, 0, filler);
+    set_quant_encoder_clip_max(layer, ws);
+  }
+  model->mutable_model_conf()->set_head_num(shape.heads);
+  model->mutable_model_conf()->set_src_padding_id(0);
+}
+
+template <typename Conf>
+void fill_gpt_conf(Conf *conf, const SyntheticModelShape &shape) {
+  conf->set_head_num(shape.heads);
+  conf->set_src_padding_id(0);
+  conf->set_sampling_method(shape.sampling_method);
+  conf->set_topk(shape.topk);
+  conf->set_topp(shape.topp);
+  conf->set_eos_id(shape.vocab - 1);
+}
+
+void build_gpt(const SyntheticModelShape &shape, WeightFiller *filler,
+               Gpt *model) {
+  fill_embedding(model->mutable_src_embedding(), shape, filler);
+  for (int l = 0; l < shape.enc_layers; l++) {
+    fill_encoder_layer(model->add_encoder_stack(), shape, 0, filler);
+  }
+  fill_gpt_conf(model->mutable_model_conf(), shape);
+  model->mutable_model_conf()->set_extra_decode_length(
+      shape.extra_decode_length);
+}
+
+void build_quant_gpt(const SyntheticModelShape &shape, WeightFiller *filler,
+                     QuantGpt *model) {
+  float ws = 1.f / std::sqrt((float)shape.hidden);
+  QuantGptEmbeddingLayer *emb = model->mutable_src_embedding();
+  fill_embedding(emb, shape, filler);
+  emb->set_emb_clip_max(ws);
+  emb->set_output_ln_clip_max(kActClipMax);
+  emb->set_logits_clip_max(kActClipMax);
+  for (int l = 0; l < shape.enc_layers; l++) {
+    QuantGptEncoderLayer *layer = model->add_encoder_stack();
+    fill_encoder_layer(layer, shape, 0, filler);
+    set_quant_encoder_clip_max(layer, ws);
+    layer->set_self_qkv_bias_out_clip_max(kActClipMax);
+  }
+  fill_gpt_conf(model->mutable_model_conf(), shape);
+}
+
+template <typename Model>
+std::string write_proto(const Model &model, const std::string &path) {
+  std::fstream output(path,
+                      std::ios::out | std::ios::trunc | std::ios::binary);
+  if (!model.SerializeToOstream(&output)) {
+    return "Write synthetic model to [" + path + "] failed.";
+  }
+  return "";
+}
+
+}  // namespace
+
+std::string write_synthetic_model(const SyntheticModelShape &shape,
+                                  const std::string &path) {
+  try {
+    shape.check();
+  } catch (std::exception &e) {
+    return e.what();
+  }
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+  WeightFiller filler(shape.seed);
+  if (shape.model == "Transformer") {
+    Transformer model;
+    build_transformer(shape, &filler, &model);
+    return write_proto(model, path);
+  } else if (shape.model == "Moe") {
+    Moe model;
+    build_moe(shape, &filler, &model);
+    return write_proto(model, path);
+  } else if (shape.model == "QuantTransformer") {
+    QuantTransformer model;
+    build_quant_transformer(shape, &filler, &model);
+    return write_proto(model, path);
+  } else if (shape.model == "Bert") {
+    Bert model;
+    build_bert(shape, &filler, &model);
+    return write_proto(model, path);
+  } else if (shape.model == "QuantBert") {
+    QuantBert model;
+    build_quant_bert(shape, &filler, &model);
+    return write_proto(model, path);
+  } else if (shape.model == "Gpt") {
+    Gpt model;
+    build_gpt(shape, &filler, &model);
+    return write_proto(model, path);
+  } else if (shape.model == "QuantGpt") {
+    QuantGpt model;
+    build_quant_gpt(shape, &filler, &model);
+    return write_proto(model, path);
+  }
+  return "unsupported benchmark model: " + shape.model;
+}
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+
+#include "bench_harness.h"
+
+namespace lightseq {
+namespace cuda {
+
+/**
+Write a model of the given shape, with weights drawn from shape.seed, as a
+protobuf file at path, so that it is loaded by the same weight classes as a
+real exported model. Return an empty string on success, the error otherwise.
+*/
+std::string write_synthetic_model(const SyntheticModelShape &shape,
+                                  const std::string &path);
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,163 @@
+#include "common.h"
+#include "batchCompactKernels.h"
+#include "transformerKernels.h"
+
+/**
+@file
+Implemented the cuda kernel function and its launcher of the batch
+compaction of the shrinking-batch beam search, see
+model/batch_compaction.h
+*/
+namespace lightseq {
+namespace cuda {
+
+/**
+@brief: ker_beam_batch_finished
+whether all the beams of a batch item are finished
+
+@thread
+gridDim.x = batch_size
+blockDim.x = beam_size
+
+@param
+alive_seq: [batch_size, beam_size, max_step]
+finished: [batch_size]
+seq_pos: position of the last token in alive_seq
+*/
+__global__ void ker_beam_batch_finished(const int *alive_seq, int *finished,
+                                        int max_step, int seq_pos,
+                                        int end_id) {
+  int token =
+      alive_seq[(blockIdx.x * blockDim.x + threadIdx.x) * max_step + seq_pos];
+  int all_finished = __syncthreads_and(token == end_id);
+  if (threadIdx.x == 0) {
+    finished[blockIdx.x] = all_finished;
+  }
+}
+
+void launch_beam_batch_finished(const int *alive_seq, int *finished,
+                                int batch_size, int beam_size, int max_step,
+                                int seq_pos, int end_id, cudaStream_t stream) {
+  ker_beam_batch_finished<<<batch_size, beam_size, 0, stream>>>(
+      alive_seq, finished, max_step, seq_pos, end_id);
+}
+
+/**
+@brief: ker_move_batch_rows
+copy the rows of batch items, src and dst may be the same buffer if no item
+is both the src of a move and the dst of another one
+
+@thread
+gridDim.x = num_moves
+gridDim.y = rows_per_item
+gridDim.z = num_chunks
+blockDim.x = max_thread_per_block
+
+@param
+src, dst: [num_chunks, ..., batch_size, rows_per_item, row_stride], chunks are
+  chunk_stride elements apart
+moves: [num_moves, 2], (src item, dst item)
+row_len: number of elements to copy in each row
+*/
+template <typename T>
+__global__ void ker_move_batch_rows(const T *src, T *dst, const int *moves,
+                                    long chunk_stride, int rows_per_item,
+                                    int row_stride, int row_len) {
+  int src_item = moves[blockIdx.x * 2];
+  int dst_item = moves[blockIdx.x * 2 + 1];
+  long chunk_offset = blockIdx.z * chunk_stride;
+  long src_offset =
+      chunk_offset + ((long)src_item * rows_per_item + blockIdx.y) * row_stride;
+  long dst_offset =
+      chunk_offset + ((long)dst_item * rows_per_item + blockIdx.y) * row_stride;
+  for (int i = threadIdx.x; i < row_len; i += blockDim.x) {
+    dst[dst_offset + i] = src[src_offset + i];
+  }
+}
+
+template <typename T>
+void move_batch_rows(const void *src, void *dst, const int *moves,
+                     int num_moves, int num_chunks, long chunk_stride,
+                     int rows_per_item, int row_stride, int row_len,
+                     int max_thread_per_block, cudaStream_t stream) {
+  int block_dim = min(max_thread_per_block, row_len);
+  ker_move_batch_rows<T>
+      <<<dim3(num_moves, rows_per_item, num_chunks), block_dim, 0, stream>>>(
+          reinterpret_cast<const T *>(src), reinterpret_cast<T *>(dst), moves,
+          chunk_stride, rows_per_item, row_stride, row_len);
+}
+
+void launch_move_batch_rows(const void *src, void *dst, const int *moves,
+                            int num_moves, int num_chunks, long chunk_stride,
+                            int rows_per_item, int row_stride, int row_len,
+                            int elem_bytes, int max_thread_per_block,
+                            cudaStream_t stream) {
+  if (num_moves == 0 || row_len == 0) return;
+  // copy in the widest unit that all the offsets are aligned to
+  long bytes = chunk_stride * elem_bytes | row_stride * elem_bytes |
+               row_len * elem_bytes | reinterpret_cast<size_t>(src) |
+               reinterpret_cast<size_t>(dst);
+  int unit = 16;
+  while (bytes % unit != 0) unit /= 2;
+  chunk_stride = chunk_stride * elem_bytes / unit;
+  row_stride = row_stride * elem_bytes / unit;
+  row_len = row_len * elem_bytes / unit;
+  switch (unit) {
+    case 16:
+      move_batch_rows<float4>(src, dst, moves, num_moves, num_chunks,
+                              chunk_stride, rows_per_item, row_stride, row_len,
+                              max_thread_per_block, stream);
+      break;
+    case 8:
+      move_batch_rows<float2>(src, dst, moves, num_moves, num_chunks,
+                              chunk_stride, rows_per_item, row_stride, row_len,
+                              max_thread_per_block, stream);
+      break;
+    case 4:
+      move_batch_rows<float>(src, dst, moves, num_moves, num_chunks,
+                             chunk_stride, rows_per_item, row_stride, row_len,
+                             max_thread_per_block, stream);
+      break;
+    case 2:
+      move_batch_rows<short>(src, dst, moves, num_moves, num_chunks,
+                             chunk_stride, rows_per_item, row_stride, row_len,
+                             max_thread_per_block, stream);
+      break;
+    default:
+      move_batch_rows<char>(src, dst, moves, num_moves, num_chunks,
+                            chunk_stride, rows_per_item, row_stride, row_len,
+                            max_thread_per_block, stream);
+  }
+}
+
+/**
+@brief: ker_move_beam_score
+copy the seq_score of batch items, the score of a finished beam carries the
+offset batch_id * min_log_probability, see ker_refresh_result
+
+@thread
+gridDim.x = num_moves
+blockDim.x = beam_size
+
+@param
+src, dst: [batch_size, beam_size]
+moves: [num_moves, 2], (src item, dst item)
+*/
+__global__ void ker_move_beam_score(const float *src, float *dst,
+                                    const int *moves) {
+  int src_item = moves[blockIdx.x * 2];
+  int dst_item = moves[blockIdx.x * 2 + 1];
+  dst[dst_item * blockDim.x + threadIdx.x] =
+      src[src_item * blockDim.x + threadIdx.x] +
+      (dst_item - src_item) * min_log_probability;
+}
+
+void launch_move_beam_score(const float *src, float *dst, const int *moves,
+                            int num_moves, int beam_size,
+                            cudaStream_t stream) {
+  if (num_moves == 0) return;
+  ker_move_beam_score<<<num_moves, beam_size, 0, stream>>>(src, dst, moves);
+}
+
+}  // namespace cuda
+}  // namespace lightseq
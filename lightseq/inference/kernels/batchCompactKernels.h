@@ -0,0 +1,31 @@
+#pragma once
+#include <cuda.h>
+#include <cuda_fp16.h>
+
+namespace lightseq {
+namespace cuda {
+
+/* finished[i] = whether all the beams of batch item i end with end_id at
+ * seq_pos, alive_seq: [batch_size, beam_size, max_step] */
+void launch_beam_batch_finished(const int *alive_seq, int *finished,
+                                int batch_size, int beam_size, int max_step,
+                                int seq_pos, int end_id, cudaStream_t stream);
+
+/* Copy batch items between buffers of layout
+ * [num_chunks, ..., batch_size, rows_per_item, row_stride], only the first
+ * row_len elements of each row are copied. moves: [num_moves, 2] device
+ * array of (src item, dst item), see batch_compaction.h. Strides and lens
+ * are in elements of elem_bytes */
+void launch_move_batch_rows(const void *src, void *dst, const int *moves,
+                            int num_moves, int num_chunks, long chunk_stride,
+                            int rows_per_item, int row_stride, int row_len,
+                            int elem_bytes, int max_thread_per_block,
+                            cudaStream_t stream);
+
+/* Copy the seq_score [batch_size, beam_size] of batch items, their batch
+ * offset of min_log_probability is changed to the one of dst */
+void launch_move_beam_score(const float *src, float *dst, const int *moves,
+                            int num_moves, int beam_size, cudaStream_t stream);
+
+}  // namespace cuda
+}  // namespace lightseq
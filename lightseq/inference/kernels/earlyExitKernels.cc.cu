@@ -0,0 +1,70 @@
+#include "common.h"
+#include "earlyExitKernels.h"
+#include "early_exit.h"
+
+/**
+@file
+Implemented the cuda kernel function and its launcher of the early exit of
+Bert classification, see early_exit.h
+*/
+namespace lightseq {
+namespace cuda {
+
+/**
+@brief: ker_exit_decision
+add the bias of the exit head and decide the exit of every sample
+
+@thread
+gridDim.x = (batch_size + max_thread_per_block - 1) / max_thread_per_block
+blockDim.x = max_thread_per_block
+
+@param
+head_out: [batch_size, num_labels], output of the head gemm
+head_bias: [num_labels]
+logits: [batch_size, num_labels]
+finished: [batch_size]
+*/
+template <typename T>
+__global__ void ker_exit_decision(const T *head_out, const T *head_bias,
+                                  float *logits, int *finished,
+                                  int batch_size, int num_labels,
+                                  int criterion, float threshold,
+                                  bool force_exit) {
+  int sample = blockIdx.x * blockDim.x + threadIdx.x;
+  if (sample >= batch_size) return;
+  float *sample_logits = logits + (long)sample * num_labels;
+  for (int i = 0; i < num_labels; i++) {
+    sample_logits[i] = (float)head_out[(long)sample * num_labels + i] +
+                       (float)head_bias[i];
+  }
+  finished[sample] =
+      force_exit ||
+      should_exit(sample_logits, num_labels, criterion, threshold);
+}
+
+template <typename T>
+void launch_exit_decision(const T *head_out, const T *head_bias,
+                          float *logits, int *finished, int batch_size,
+                          int num_labels, int criterion, float threshold,
+                          bool force_exit, int max_thread_per_block,
+                          cudaStream_t stream) {
+  int grid_dim = (batch_size + max_thread_per_block - 1) / max_thread_per_block;
+  ker_exit_decision<T><<<grid_dim, max_thread_per_block, 0, stream>>>(
+      head_out, head_bias, logits, finished, batch_size, num_labels,
+      criterion, threshold, force_exit);
+}
+
+template void launch_exit_decision<float>(
+    const float *head_out, const float *head_bias, float *logits,
+    int *finished, int batch_size, int num_labels, int criterion,
+    float threshold, bool force_exit, int max_thread_per_block,
+    cudaStream_t stream);
+
+template void launch_exit_decision<__half>(
+    const __half *head_out, const __half *head_bias, float *logits,
+    int *finished, int batch_size, int num_labels, int criterion,
+    float threshold, bool force_exit, int max_thread_per_block,
+    cudaStream_t stream);
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,19 @@
+#pragma once
+#include <cuda.h>
+#include <cuda_fp16.h>
+
+namespace lightseq {
+namespace cuda {
+
+/* Exit decision of the live samples after an exit head, see early_exit.h.
+ * logits = head_out + head_bias in fp32, finished = force_exit or the
+ * criterion is met. head_out: [batch_size, num_labels] */
+template <typename T>
+void launch_exit_decision(const T *head_out, const T *head_bias,
+                          float *logits, int *finished, int batch_size,
+                          int num_labels, int criterion, float threshold,
+                          bool force_exit, int max_thread_per_block,
+                          cudaStream_t stream);
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <math.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef LS_HOST_DEVICE
+#ifdef __CUDACC__
+#define LS_HOST_DEVICE __host__ __device__
+#else
+#define LS_HOST_DEVICE
+#endif
+#endif
+
+/**
+@file
+Early exit of the Bert classification. Exit heads, classifiers on the
+[CLS] row of some encoder layers, are loaded from the weight file, the head
+of the last layer being the final classifier. After a layer with a head,
+the samples whose prediction is confident enough are retired from the batch
+and the encoder continues with the others, see BertEncoder::exit_check.
+
+The criterion, the CPU reference of the exits and the threshold calibration
+are CUDA-free so that they can be tested on host, the device kernel
+(ker_exit_decision in earlyExitKernels.cc.cu) shares the criterion.
+*/
+namespace lightseq {
+namespace cuda {
+
+enum ExitCriterion {
+  kExitNone = 0,     // run all the layers
+  kExitEntropy = 1,  // exit if the normalized entropy <= threshold
+  kExitMaxProb = 2,  // exit if the max probability >= threshold
+};
+
+struct EarlyExitConfig {
+  int criterion = kExitNone;
+  float threshold = 0.f;
+
+  bool enabled() const { return criterion != kExitNone; }
+
+  std::string check() const {
+    if (criterion == kExitNone) return "";
+    if (criterion != kExitEntropy && criterion != kExitMaxProb) {
+      return "unknown exit criterion " + std::to_string(criterion);
+    }
+    if (threshold < 0.f || threshold > 1.f) {
+      return "exit threshold should be in [0, 1]";
+    }
+    return "";
+  }
+};
+
+/* Entropy of softmax(logits) divided by log(num_labels), in [0, 1] */
+LS_HOST_DEVICE inline float exit_entropy(const float *logits,
+                                         int num_labels) {
+  if (num_labels < 2) return 0.f;
+  float max_logit = logits[0];
+  for (int i = 1; i < num_labels; i++) max_logit = fmaxf(max_logit, logits[i]);
+  float sum = 0.f, weighted = 0.f;
+  for (int i = 0; i < num_labels; i++) {
+    float x = logits[i] - max_logit;
+    float e = expf(x);
+    sum += e;
+    weighted += e * x;
+  }
+  // -sum(p * log(p)) with p = e / sum and log(p) = x - log(sum)
+  float entropy = logf(sum) - weighted / sum;
+  return fminf(fmaxf(entropy / logf((float)num_labels), 0.f), 1.f);
+}
+
+LS_HOST_DEVICE inline float exit_max_prob(const float *logits,
+                                          int num_labels) {
+  float max_logit = logits[0];
+  for (int i = 1; i < num_labels; i++) max_logit = fmaxf(max_logit, logits[i]);
+  float sum = 0.f;
+  for (int i = 0; i < num_labels; i++) sum += expf(logits[i] - max_logit);
+  return 1.f / sum;
+}
+
+LS_HOST_DEVICE inline bool should_exit(const float *logits, int num_labels,
+                                       int criterion, float threshold) {
+  if (criterion == kExitEntropy) {
+    return exit_entropy(logits, num_labels) <= threshold;
+  }
+  if (criterion == kExitMaxProb) {
+    return exit_max_prob(logits, num_labels) >= threshold;
+  }
+  return false;
+}
+
+/**
+CPU reference of the exits: the index of the head every sample exits at.
+head_logits[h]: [batch_size, num_labels] logits of head h, the heads in the
+  order of their layers, the last one is the final classifier
+*/
+inline std::vector<int> early_exit_heads(
+    const std::vector<std::vector<float>> &head_logits, int batch_size,
+    int num_labels, const EarlyExitConfig &config) {
+  int num_heads = head_logits.size();
+  std::vector<int> res(batch_size, num_heads - 1);
+  for (int b = 0; b < batch_size; b++) {
+    for (int h = 0; h + 1 < num_heads; h++) {
+      if (should_exit(head_logits[h].data() + b * num_labels, num_labels,
+                      config.criterion, config.threshold)) {
+        res[b] = h;
+        break;
+      }
+    }
+  }
+  return res;
+}
+
+struct ExitCalibration {
+  float threshold;
+  float accuracy;    // of the exit predictions
+  float avg_layers;  // average number of encoder layers run
+};
+
+/**
+Calibrate the threshold of a criterion on a dev set: the threshold with the
+fewest average layers whose accuracy is at most max_accuracy_drop below the
+one of the final classifier.
+head_logits: [num_heads][num_samples * num_labels], see early_exit_heads
+head_layers: number of encoder layers run before each head
+labels: [num_samples] gold labels
+The candidates are max_candidates quantiles of the scores of the samples.
+*/
+inline ExitCalibration calibrate_early_exit(
+    const std::vector<std::vector<float>> &head_logits,
+    const std::vector<int> &head_layers, const std::vector<int> &labels,
+    int num_labels, int criterion, float max_accuracy_drop,
+    int max_candidates = 100) {
+  if (head_logits.empty() || head_logits.size() != head_layers.size()) {
+    throw std::runtime_error("calibrate_early_exit: bad heads");
+  }
+  if (criterion != kExitEntropy && criterion != kExitMaxProb) {
+    throw std::runtime_error("calibrate_early_exit: bad criterion");
+  }
+  int num_samples = labels.size();
+  for (const std::vector<float> &logits : head_logits) {
+    if ((int)logits.size() != num_samples * num_labels) {
+      throw std::runtime_error("calibrate_early_exit: bad logits size");
+    }
+  }
+  auto evaluate = [&](float threshold) {
+    EarlyExitConfig config;
+    config.criterion = criterion;
+    config.threshold = threshold;
+    std::vector<int> exits =
+        early_exit_heads(head_logits, num_samples, num_labels, config);
+    ExitCalibration res = {threshold, 0.f, 0.f};
+    for (int i = 0; i < num_samples; i++) {
+      const float *logits = head_logits[exits[i]].data() + i * num_labels;
+      int pred = std::max_element(logits, logits + num_labels) - logits;
+      res.accuracy += pred == labels[i];
+      res.avg_layers += head_layers[exits[i]];
+    }
+    res.accuracy /= std::max(num_samples, 1);
+    res.avg_layers /= std::max(num_samples, 1);
+    return res;
+  };
+
+  std::vector<float> scores;
+  for (size_t h = 0; h + 1 < head_logits.size(); h++) {
+    for (int i = 0; i < num_samples; i++) {
+      const float *logits = head_logits[h].data() + i * num_labels;
+      scores.push_back(criterion == kExitEntropy
+                           ? exit_entropy(logits, num_labels)
+                           : exit_max_prob(logits, num_labels));
+    }
+  }
+  std::sort(scores.begin(), scores.end());
+  float final_accuracy = 0.f;
+  for (int i = 0; i < num_samples; i++) {
+    const float *logits = head_logits.back().data() + i * num_labels;
+    int pred = std::max_element(logits, logits + num_labels) - logits;
+    final_accuracy += pred == labels[i];
+  }
+  final_accuracy /= std::max(num_samples, 1);
+  float min_accuracy = final_accuracy - max_accuracy_drop;
+  // the strictest threshold, only the saturated predictions exit early
+  ExitCalibration best = evaluate(criterion == kExitEntropy ? 0.f : 1.f);
+  int num_candidates = std::min<int>(max_candidates, scores.size());
+  for (int c = 0; c < num_candidates; c++) {
+    float threshold = scores[(long)c * scores.size() / num_candidates];
+    ExitCalibration res = evaluate(threshold);
+    if (res.accuracy >= min_accuracy && res.avg_layers < best.avg_layers) {
+      best = res;
+    }
+  }
+  return best;
+}
+
+}  // namespace cuda
+}  // namespace lightseq
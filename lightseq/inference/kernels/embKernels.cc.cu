@@ -1,5 +1,6 @@
 #include "common.h"
 #include "embKernels.h"
+#include "patch_im2col.h"
 
 /**
 @file
@@ -467,7 +468,8 @@ gridDim.x = (nele + MAX_THREADS - 1) / MAX_THREADS;
 blockDim.x = MAX_THREADS
 
 @param
-token_emb: [hidden_dim, vocab_size], note, it is different with encoder
+token_emb: [hidden_dim, vocab_size], note, it is different with encoder,
+  [vocab_size, hidden_dim] if tied_emb
 pos_emb: [max_step, hidden_dim]
 tokens: input token id, [batch_size, beam_size, max_step]
 lang_emb: language embedding, [num_lang, hidden_dim]
@@ -477,13 +479,14 @@ step: current decoder step
 max_step: max decoder steps
 multilg_type: 0 for no multilg, 1 for token level multilg,
   2 for sentence level multilg
+tied_emb: token_emb is the source embedding, see TransformerWeight
 */
 template <typename T>
 __global__ void ker_dec_emb(const T *token_emb, const T *pos_emb, int *tokens,
                             const T *lang_emb, const int *lang_id, T *output,
                             int batch_size, int beam_size, int hidden_dim,
                             int vocab_size, int step, int max_step,
-                            int multilg_type) {
+                            int multilg_type, bool tied_emb) {
   int idx = blockIdx.x * blockDim.x + threadIdx.x;
   if (idx >= batch_size * beam_size * hidden_dim) {
     return;
@@ -500,7 +503,8 @@ __global__ void ker_dec_emb(const T *token_emb, const T *pos_emb, int *tokens,
   } else {
     int token =
         tokens[flat_3dim(batch_idx, beam_idx, step, beam_size, max_step)];
-    emb = token_emb[flat_2dim(dim_idx, token, vocab_size)];
+    emb = tied_emb ? token_emb[flat_2dim(token, dim_idx, hidden_dim)]
+                   : token_emb[flat_2dim(dim_idx, token, vocab_size)];
   }
   float value =
       float(emb) + float(pos_emb[flat_2dim(step, dim_idx, hidden_dim)]);
@@ -517,7 +521,7 @@ void launch_dec_emb(const T *token_emb, const T *pos_emb, int *tokens,
                     const T *lang_emb, const int *lang_id, T *output,
                     int batch_size, int beam_size, int hidden_dim,
                     int vocab_size, int step, int max_step, int multilg_type,
-                    cudaStream_t stream) {
+                    cudaStream_t stream, bool tied_emb) {
   if (step >= max_step) {
     throw std::runtime_error("violate step < max_step");
   }
@@ -525,7 +529,8 @@ void launch_dec_emb(const T *token_emb, const T *pos_emb, int *tokens,
   int nblock = (nele + MAX_THREADS - 1) / MAX_THREADS;
   ker_dec_emb<T><<<nblock, MAX_THREADS, 0, stream>>>(
       token_emb, pos_emb, tokens, lang_emb, lang_id, output, batch_size,
-      beam_size, hidden_dim, vocab_size, step, max_step, multilg_type);
+      beam_size, hidden_dim, vocab_size, step, max_step, multilg_type,
+      tied_emb);
 }
 
 template void launch_dec_emb<float>(const float *token_emb,
@@ -534,7 +539,8 @@ template void launch_dec_emb<float>(const float *token_emb,
                                     float *output, int batch_size,
                                     int beam_size, int hidden_dim,
                                     int vocab_size, int step, int max_step,
-                                    int multilg_type, cudaStream_t stream);
+                                    int multilg_type, cudaStream_t stream,
+                                    bool tied_emb);
 
 template void launch_dec_emb<__half>(const __half *token_emb,
                                      const __half *pos_emb, int *tokens,
@@ -542,7 +548,8 @@ template void launch_dec_emb<__half>(const __half *token_emb,
                                      __half *output, int batch_size,
                                      int beam_size, int hidden_dim,
                                      int vocab_size, int step, int max_step,
-                                     int multilg_type, cudaStream_t stream);
+                                     int multilg_type, cudaStream_t stream,
+                                     bool tied_emb);
 
 /**
 @brief: ker_patch_emb
@@ -629,5 +636,103 @@ template void launch_patch_emb<__half>(
     int image_size, int batch_size, int max_step, int hidden_dim,
     int channel_input, cudaStream_t stream);
 
+/**
+@brief: ker_patch_im2col
+gather the patches of the images into the rows of a matrix, so that the
+patch embedding conv2d is a gemm against conv_weight, see patch_im2col.h
+
+@thread
+gridDim.x = batch_size * num_patch
+blockDim.x = MAX_THREADS
+
+@param
+input: [batch_size, channel_input, image_size, image_size]
+col: [batch_size * num_patch, channel_input * patch_size * patch_size]
+*/
+template <typename T>
+__global__ void ker_patch_im2col(const float *input, T *col, int patch_size,
+                                 int image_size, int channel_input) {
+  int col_dim = channel_input * patch_size * patch_size;
+  T *col_row = col + (size_t)blockIdx.x * col_dim;
+  for (int idx = threadIdx.x; idx < col_dim; idx += blockDim.x) {
+    col_row[idx] = (T)__ldg(&input[patch_im2col_src_offset(
+        blockIdx.x, idx, patch_size, image_size, channel_input)]);
+  }
+}
+
+template <typename T>
+void launch_patch_im2col(const float *input, T *col, int patch_size,
+                         int image_size, int batch_size, int channel_input,
+                         cudaStream_t stream) {
+  int patch_per_row = image_size / patch_size;
+  int grid_dim = batch_size * patch_per_row * patch_per_row;
+  ker_patch_im2col<T><<<grid_dim, MAX_THREADS, 0, stream>>>(
+      input, col, patch_size, image_size, channel_input);
+}
+
+template void launch_patch_im2col<float>(const float *input, float *col,
+                                         int patch_size, int image_size,
+                                         int batch_size, int channel_input,
+                                         cudaStream_t stream);
+
+template void launch_patch_im2col<__half>(const float *input, __half *col,
+                                          int patch_size, int image_size,
+                                          int batch_size, int channel_input,
+                                          cudaStream_t stream);
+
+/**
+@brief: ker_patch_emb_epilogue
+in place on the output of the patch gemm, write the cls embedding to token 0
+and add conv bias and position embedding to the patch tokens
+
+@thread
+gridDim.x = batch_size
+gridDim.y = max_step
+blockDim.x = min(hidden_dim, MAX_THREADS)
+
+@param
+conv_bias: [hidden_dim]
+pos_emb: [max_step, hidden_dim]
+cls_emb: [hidden_dim]
+output: [batch_size, max_step, hidden_dim], token 1.. hold the patch gemm
+  output
+*/
+template <typename T>
+__global__ void ker_patch_emb_epilogue(const T *conv_bias, const T *pos_emb,
+                                       const T *cls_emb, T *output,
+                                       int hidden_dim) {
+  T *out = output + flat_3dim(blockIdx.x, blockIdx.y, 0, gridDim.y, hidden_dim);
+  const T *pos = pos_emb + flat_2dim(blockIdx.y, 0, hidden_dim);
+  for (int i = threadIdx.x; i < hidden_dim; i += blockDim.x) {
+    float val;
+    if (blockIdx.y == 0) {
+      val = (float)__ldg(&cls_emb[i]) + (float)__ldg(&pos[i]);
+    } else {
+      val = (float)out[i] + (float)__ldg(&conv_bias[i]) + (float)__ldg(&pos[i]);
+    }
+    out[i] = (T)val;
+  }
+}
+
+template <typename T>
+void launch_patch_emb_epilogue(const T *conv_bias, const T *pos_emb,
+                               const T *cls_emb, T *output, int batch_size,
+                               int max_step, int hidden_dim,
+                               cudaStream_t stream) {
+  ker_patch_emb_epilogue<T>
+      <<<dim3(batch_size, max_step), min(hidden_dim, MAX_THREADS), 0,
+         stream>>>(conv_bias, pos_emb, cls_emb, output, hidden_dim);
+}
+
+template void launch_patch_emb_epilogue<float>(
+    const float *conv_bias, const float *pos_emb, const float *cls_emb,
+    float *output, int batch_size, int max_step, int hidden_dim,
+    cudaStream_t stream);
+
+template void launch_patch_emb_epilogue<__half>(
+    const __half *conv_bias, const __half *pos_emb, const __half *cls_emb,
+    __half *output, int batch_size, int max_step, int hidden_dim,
+    cudaStream_t stream);
+
 }  // namespace cuda
 }  // namespace lightseq
@@ -21,7 +21,7 @@ void launch_dec_emb(const T *token_emb, const T *pos_emb, int *tokens,
                     const T *lang_emb, const int *lang_id, T *output,
                     int batch_size, int beam_size, int hidden_dim,
                     int vocab_size, int step, int max_step, int multilg_type,
-                    cudaStream_t stream);
+                    cudaStream_t stream, bool tied_emb = false);
 
 template <typename T>
 void launch_patch_emb(const T *conv_weight, const T *conv_bias,
@@ -30,5 +30,21 @@ void launch_patch_emb(const T *conv_weight, const T *conv_bias,
                       int max_step, int hidden_dim, int channel_input,
                       cudaStream_t stream);
 
+/* Patch embedding as im2col + gemm + epilogue, the gemm is run by the caller:
+ *   launch_patch_im2col: input -> col, [batch_size * num_patch, col_dim]
+ *   gemm: token 1.. of output = col * conv_weight^T
+ *   launch_patch_emb_epilogue: cls token, conv bias and position embedding
+ */
+template <typename T>
+void launch_patch_im2col(const float *input, T *col, int patch_size,
+                         int image_size, int batch_size, int channel_input,
+                         cudaStream_t stream);
+
+template <typename T>
+void launch_patch_emb_epilogue(const T *conv_bias, const T *pos_emb,
+                               const T *cls_emb, T *output, int batch_size,
+                               int max_step, int hidden_dim,
+                               cudaStream_t stream);
+
 }  // namespace cuda
 }  // namespace lightseq
@@ -378,6 +378,56 @@ template void ker_arrange_qkv_with_cache_launcher<__half>(
     __half* k_cache, __half* new_v, __half* v_cache, int max_batch_dim,
     int batch_seq_len, int dim_per_head, int head_num);
 
+/**
+@brief: ker_gpt_fork_rows
+replicate every row of input num_forks times, output row
+  i * num_forks + j is input row i
+
+@thread
+gridDim.x = (batch_size * num_forks * row_size + MAX_THREADS - 1) /
+  MAX_THREADS
+blockDim.x = MAX_THREADS
+
+@param
+input: [batch_size, in_row_stride], the first row_size elements of a row are
+  replicated
+output: [batch_size * num_forks, row_size], must not overlap input
+*/
+template <typename T>
+__global__ void ker_gpt_fork_rows(const T* input, T* output, int num_forks,
+                                  int row_size, int in_row_stride, long nele) {
+  long idx = (long)blockIdx.x * blockDim.x + threadIdx.x;
+  if (idx >= nele) return;
+  long out_row = idx / row_size;
+  int col = idx % row_size;
+  output[idx] = input[out_row / num_forks * in_row_stride + col];
+}
+
+template <typename T>
+void ker_gpt_fork_rows_launcher(int batch_size, int num_forks, int row_size,
+                                int in_row_stride, cudaStream_t stream,
+                                const T* input, T* output) {
+  long nele = (long)batch_size * num_forks * row_size;
+  int nblock = (nele + MAX_THREADS - 1) / MAX_THREADS;
+  ker_gpt_fork_rows<T><<<nblock, MAX_THREADS, 0, stream>>>(
+      input, output, num_forks, row_size, in_row_stride, nele);
+}
+
+template void ker_gpt_fork_rows_launcher<float>(int batch_size, int num_forks,
+                                                int row_size, int in_row_stride,
+                                                cudaStream_t stream,
+                                                const float* input,
+                                                float* output);
+
+template void ker_gpt_fork_rows_launcher<__half>(
+    int batch_size, int num_forks, int row_size, int in_row_stride,
+    cudaStream_t stream, const __half* input, __half* output);
+
+template void ker_gpt_fork_rows_launcher<int>(int batch_size, int num_forks,
+                                              int row_size, int in_row_stride,
+                                              cudaStream_t stream,
+                                              const int* input, int* output);
+
 /**
 @brief: ker_ppl
 compute ppl from logit
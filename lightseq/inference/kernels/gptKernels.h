@@ -35,6 +35,11 @@ void ker_arrange_qkv_with_cache_launcher(int batch_token_num, int hidden_size,
                                          int max_batch_dim, int batch_seq_len,
                                          int dim_per_head, int head_num);
 
+template <typename T>
+void ker_gpt_fork_rows_launcher(int batch_size, int num_forks, int row_size,
+                                int in_row_stride, cudaStream_t stream,
+                                const T* input, T* output);
+
 template <typename T>
 void ker_ppl_launcher(int batch_size, int batch_seq_len,
                       int max_thread_per_block, cudaStream_t stream,
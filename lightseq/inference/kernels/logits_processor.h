@@ -0,0 +1,358 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <string>
+#include <vector>
+
+#ifndef LS_HOST_DEVICE
+#ifdef __CUDACC__
+#define LS_HOST_DEVICE __host__ __device__
+#else
+#define LS_HOST_DEVICE
+#endif
+#endif
+
+/**
+@file
+Logits processor chain of generation, applied to the logits of a step
+before beam search or sampling. The config and the CPU reference are
+CUDA-free so that the chain can be tested on host, the device kernel
+(ker_logits_processor in samplingKernels.cc.cu) shares their per-token rules.
+
+The processors, in the order of the CPU reference:
+  logit bias                the decoder's trg logit bias, if any
+  temperature               logit / temperature
+  repetition_penalty        logit / penalty if positive, logit * penalty
+                            otherwise, for every token in the sequence
+  no_repeat_ngram_size      ban the tokens completing an n-gram that is
+                            already in the sequence
+  bad_words                 ban the last token of a bad word whose prefix
+                            ends the sequence
+  min_length                ban eos while fewer tokens are generated
+  max_length                force eos as the max_length-th generated token,
+                            its logit is set to 0 and the others masked
+  top_k                     keep the logits >= the k-th largest one
+  top_p                     keep the logits >= the smallest one of the
+                            shortest prefix of the sorted probs whose sum
+                            is >= top_p
+
+top_k and top_p are exact, ties at the threshold are kept. A banned logit is
+set to kMaskedLogit. Applying the temperature before the penalty and the
+bans is equivalent to the usual order and lets the device kernel fuse it
+with the bias into one pass over the vocab.
+*/
+namespace lightseq {
+namespace cuda {
+
+const float kMaskedLogit = -100000000.f;
+
+struct LogitsProcessorConfig {
+  float temperature = 1.f;
+  float repetition_penalty = 1.f;
+  int no_repeat_ngram_size = 0;
+  int min_length = 0;
+  int max_length = 0;  // 0 for no forced eos
+  int top_k = 0;       // 0 for all the vocab
+  float top_p = 1.f;
+  std::vector<std::vector<int>> bad_words;
+
+  bool enabled() const {
+    return temperature != 1.f || repetition_penalty != 1.f ||
+           no_repeat_ngram_size > 0 || min_length > 0 || max_length > 0 ||
+           top_k > 0 || top_p < 1.f || !bad_words.empty();
+  }
+
+  // the chain makes the decoding random
+  bool samples() const {
+    return temperature != 1.f || top_k > 0 || top_p < 1.f;
+  }
+
+  std::string check(int vocab_size) const {
+    if (temperature <= 0.f) return "temperature should be greater than 0";
+    if (repetition_penalty <= 0.f) {
+      return "repetition_penalty should be greater than 0";
+    }
+    if (no_repeat_ngram_size < 0) {
+      return "no_repeat_ngram_size should not be negative";
+    }
+    if (min_length < 0 || max_length < 0) {
+      return "min_length and max_length should not be negative";
+    }
+    if (max_length > 0 && min_length >= max_length) {
+      return "min_length should be less than max_length";
+    }
+    if (top_k < 0) return "top_k should not be negative";
+    if (top_p <= 0.f || top_p > 1.f) return "top_p should be in (0, 1]";
+    for (const std::vector<int> &word : bad_words) {
+      if (word.empty()) return "bad word should not be empty";
+      for (int token : word) {
+        if (token < 0 || token >= vocab_size) {
+          return "bad word token " + std::to_string(token) +
+                 " out of vocab range";
+        }
+      }
+    }
+    return "";
+  }
+};
+
+/* Bad words flattened for the device, word i is
+ * tokens[offsets[i], offsets[i + 1]) */
+struct FlatBadWords {
+  std::vector<int> tokens;
+  std::vector<int> offsets;
+
+  explicit FlatBadWords(const std::vector<std::vector<int>> &words) {
+    offsets.push_back(0);
+    for (const std::vector<int> &word : words) {
+      tokens.insert(tokens.end(), word.begin(), word.end());
+      offsets.push_back(tokens.size());
+    }
+  }
+  int size() const { return offsets.size() - 1; }
+};
+
+/* The config as passed to the device kernel by value, the bad words point to
+ * device memory */
+struct LogitsProcessorParams {
+  float temperature;
+  float repetition_penalty;
+  int no_repeat_ngram_size;
+  int min_length;
+  int max_length;
+  int top_k;
+  float top_p;
+  const int *bad_word_tokens;
+  const int *bad_word_offsets;
+  int num_bad_words;
+  int eos_id;
+  int pad_id;  // ignored by repetition_penalty, -1 for none
+};
+
+inline LogitsProcessorParams make_logits_processor_params(
+    const LogitsProcessorConfig &config, const int *bad_word_tokens,
+    const int *bad_word_offsets, int eos_id, int pad_id) {
+  LogitsProcessorParams params;
+  params.temperature = config.temperature;
+  params.repetition_penalty = config.repetition_penalty;
+  params.no_repeat_ngram_size = config.no_repeat_ngram_size;
+  params.min_length = config.min_length;
+  params.max_length = config.max_length;
+  params.top_k = config.top_k;
+  params.top_p = config.top_p;
+  params.bad_word_tokens = bad_word_tokens;
+  params.bad_word_offsets = bad_word_offsets;
+  params.num_bad_words = config.bad_words.size();
+  params.eos_id = eos_id;
+  params.pad_id = pad_id;
+  return params;
+}
+
+LS_HOST_DEVICE inline float repetition_penalized(float logit, float penalty) {
+  return logit > 0.f ? logit / penalty : logit * penalty;
+}
+
+/* Whether seq[start, start + n - 1) equals the last n - 1 tokens of seq, the
+ * token seq[start + n - 1] is then banned by no_repeat_ngram */
+LS_HOST_DEVICE inline bool ngram_prefix_matches(const int *seq, int seq_len,
+                                                int start, int n) {
+  for (int i = 0; i < n - 1; i++) {
+    if (seq[start + i] != seq[seq_len - n + 1 + i]) return false;
+  }
+  return true;
+}
+
+/* Whether all but the last token of word end the sequence */
+LS_HOST_DEVICE inline bool bad_word_prefix_matches(const int *seq, int seq_len,
+                                                   const int *word,
+                                                   int word_len) {
+  if (word_len - 1 > seq_len) return false;
+  for (int i = 0; i < word_len - 1; i++) {
+    if (word[i] != seq[seq_len - word_len + 1 + i]) return false;
+  }
+  return true;
+}
+
+/* Map a float to an uint32 of the same order, for the bisection of the top_k
+ * and top_p thresholds */
+LS_HOST_DEVICE inline uint32_t float_to_ordered(float f) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  return (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+}
+
+LS_HOST_DEVICE inline float ordered_to_float(uint32_t o) {
+  uint32_t bits = (o & 0x80000000u) ? o & 0x7fffffffu : ~o;
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+/**
+Bisection of the top_k and top_p thresholds, shared by ker_logits_processor
+and its host mirrors below: the largest ordered threshold in [lo, hi] for
+which keeps(threshold) holds. keeps should hold at lo and not hold again
+once it fails, the kernel reduces over the block inside it.
+*/
+template <typename Keeps>
+LS_HOST_DEVICE inline uint32_t bisect_ordered_threshold(uint32_t lo,
+                                                        uint32_t hi,
+                                                        Keeps keeps) {
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo + 1) / 2;
+    if (keeps(mid)) {
+      lo = mid;
+    } else {
+      hi = mid - 1;
+    }
+  }
+  return lo;
+}
+
+/* Host mirror of the top_k step of ker_logits_processor, one thread in
+ * place of the block */
+inline void top_k_filter_bisect(float *logits, int vocab_size, int top_k) {
+  if (top_k <= 0 || top_k >= vocab_size) return;
+  float min_logit = *std::min_element(logits, logits + vocab_size);
+  float max_logit = *std::max_element(logits, logits + vocab_size);
+  uint32_t threshold = bisect_ordered_threshold(
+      float_to_ordered(min_logit), float_to_ordered(max_logit),
+      [&](uint32_t mid) {
+        int cnt = 0;
+        for (int i = 0; i < vocab_size; i++) {
+          cnt += float_to_ordered(logits[i]) >= mid;
+        }
+        return cnt >= top_k;
+      });
+  for (int i = 0; i < vocab_size; i++) {
+    if (float_to_ordered(logits[i]) < threshold) logits[i] = kMaskedLogit;
+  }
+}
+
+/* Host mirror of the top_p step of ker_logits_processor */
+inline void top_p_filter_bisect(float *logits, int vocab_size, float top_p) {
+  if (top_p >= 1.f) return;
+  float min_logit = *std::min_element(logits, logits + vocab_size);
+  float max_logit = *std::max_element(logits, logits + vocab_size);
+  float total = 0.f;
+  for (int i = 0; i < vocab_size; i++) total += expf(logits[i] - max_logit);
+  float target = top_p * total;
+  uint32_t threshold = bisect_ordered_threshold(
+      float_to_ordered(min_logit), float_to_ordered(max_logit),
+      [&](uint32_t mid) {
+        float mass = 0.f;
+        for (int i = 0; i < vocab_size; i++) {
+          if (float_to_ordered(logits[i]) >= mid) {
+            mass += expf(logits[i] - max_logit);
+          }
+        }
+        return mass >= target;
+      });
+  for (int i = 0; i < vocab_size; i++) {
+    if (float_to_ordered(logits[i]) < threshold) logits[i] = kMaskedLogit;
+  }
+}
+
+/**
+CPU reference of the chain on the logits of one sequence.
+seq: the tokens so far, [seq_len], generated_len of them are generated
+logit_bias: [vocab_size] or nullptr
+*/
+inline void process_logits_cpu(const LogitsProcessorConfig &config,
+                               float *logits, const float *logit_bias,
+                               int vocab_size, const int *seq, int seq_len,
+                               int generated_len, int eos_id,
+                               int pad_id = -1) {
+  if (logit_bias) {
+    for (int i = 0; i < vocab_size; i++) logits[i] += logit_bias[i];
+  }
+  if (config.temperature != 1.f) {
+    for (int i = 0; i < vocab_size; i++) logits[i] /= config.temperature;
+  }
+  if (config.repetition_penalty != 1.f) {
+    std::vector<bool> seen(vocab_size, false);
+    for (int i = 0; i < seq_len; i++) {
+      int token = seq[i];
+      if (token == pad_id || seen[token]) continue;
+      seen[token] = true;
+      logits[token] = repetition_penalized(logits[token],
+                                           config.repetition_penalty);
+    }
+  }
+  int n = config.no_repeat_ngram_size;
+  if (n > 0 && seq_len >= n) {
+    for (int start = 0; start + n - 1 < seq_len; start++) {
+      if (ngram_prefix_matches(seq, seq_len, start, n)) {
+        logits[seq[start + n - 1]] = kMaskedLogit;
+      }
+    }
+  }
+  for (const std::vector<int> &word : config.bad_words) {
+    if (bad_word_prefix_matches(seq, seq_len, word.data(), word.size())) {
+      logits[word.back()] = kMaskedLogit;
+    }
+  }
+  if (generated_len < config.min_length) logits[eos_id] = kMaskedLogit;
+  if (config.max_length > 0 && generated_len >= config.max_length - 1) {
+    for (int i = 0; i < vocab_size; i++) {
+      logits[i] = i == eos_id ? 0.f : kMaskedLogit;
+    }
+  }
+  if (config.top_k > 0 && config.top_k < vocab_size) {
+    std::vector<float> sorted(logits, logits + vocab_size);
+    std::nth_element(sorted.begin(), sorted.begin() + config.top_k - 1,
+                     sorted.end(), std::greater<float>());
+    float threshold = sorted[config.top_k - 1];
+    for (int i = 0; i < vocab_size; i++) {
+      if (logits[i] < threshold) logits[i] = kMaskedLogit;
+    }
+  }
+  if (config.top_p < 1.f) {
+    std::vector<float> sorted(logits, logits + vocab_size);
+    std::sort(sorted.begin(), sorted.end(), std::greater<float>());
+    float max_logit = sorted[0];
+    double total = 0;
+    for (float l : sorted) total += std::exp(l - max_logit);
+    double mass = 0;
+    float threshold = sorted.back();
+    for (float l : sorted) {
+      mass += std::exp(l - max_logit);
+      if (mass >= config.top_p * total) {
+        threshold = l;
+        break;
+      }
+    }
+    for (int i = 0; i < vocab_size; i++) {
+      if (logits[i] < threshold) logits[i] = kMaskedLogit;
+    }
+  }
+}
+
+/* CPU reference of the multinomial sampling of ker_multinomial_sample, with
+ * the uniform random number u in (0, 1] */
+inline int multinomial_sample_cpu(const float *logits, int vocab_size,
+                                  float u) {
+  float max_logit = *std::max_element(logits, logits + vocab_size);
+  std::vector<float> probs(vocab_size);
+  float total = 0;
+  for (int i = 0; i < vocab_size; i++) {
+    probs[i] = std::exp(logits[i] - max_logit);
+    total += probs[i];
+  }
+  float target = u * total;
+  float prefix = 0;
+  for (int i = 0; i < vocab_size; i++) {
+    prefix += probs[i];
+    if (probs[i] > 0 && prefix >= target) return i;
+  }
+  // rounding of the prefix sum, fall back to the argmax
+  return std::max_element(logits, logits + vocab_size) - logits;
+}
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <vector>
+
+#ifndef LS_HOST_DEVICE
+#ifdef __CUDACC__
+#define LS_HOST_DEVICE __host__ __device__
+#else
+#define LS_HOST_DEVICE
+#endif
+#endif
+
+/**
+@file
+Patch layout of the im2col + gemm ViT patch embedding, shared by the cuda
+kernels and the CPU reference so that the layout can be tested on host.
+
+The conv2d with kernel_size = stride = patch_size is computed as
+  col: [batch_size * num_patch, channel_input * patch_size * patch_size]
+  patch_out = col * conv_weight^T, conv_weight: [hidden_dim, col_dim]
+which is one gemm. Row i of col is patch i % num_patch of image
+i / num_patch, patches in row major order of the image, and its elements are
+in the (channel, row in patch, col in patch) order of conv_weight.
+*/
+namespace lightseq {
+namespace cuda {
+
+/* Offset in input [batch_size, channel_input, image_size, image_size] of
+ * element col_id of im2col row row_id */
+LS_HOST_DEVICE inline int patch_im2col_src_offset(int row_id, int col_id,
+                                                  int patch_size,
+                                                  int image_size,
+                                                  int channel_input) {
+  int patch_per_row = image_size / patch_size;
+  int num_patch = patch_per_row * patch_per_row;
+  int batch_id = row_id / num_patch;
+  int patch_id = row_id % num_patch;
+  int patch_row_id = patch_id / patch_per_row;
+  int patch_col_id = patch_id % patch_per_row;
+  int patch_area = patch_size * patch_size;
+  int channel_id = col_id / patch_area;
+  int value_row_id = col_id % patch_area / patch_size;
+  int value_col_id = col_id % patch_size;
+  int row = patch_row_id * patch_size + value_row_id;
+  int col = patch_col_id * patch_size + value_col_id;
+  return ((batch_id * channel_input + channel_id) * image_size + row) *
+             image_size +
+         col;
+}
+
+/* CPU reference of the im2col, col: [batch_size * num_patch, col_dim] */
+inline void patch_im2col_cpu(const float *input, float *col, int patch_size,
+                             int image_size, int batch_size,
+                             int channel_input) {
+  int patch_per_row = image_size / patch_size;
+  int rows = batch_size * patch_per_row * patch_per_row;
+  int col_dim = channel_input * patch_size * patch_size;
+  for (int r = 0; r < rows; r++) {
+    for (int c = 0; c < col_dim; c++) {
+      col[r * col_dim + c] = input[patch_im2col_src_offset(
+          r, c, patch_size, image_size, channel_input)];
+    }
+  }
+}
+
+/**
+CPU reference of the im2col + gemm + epilogue pipeline of VitEncoder, with
+the gemm output written into token 1.. of each image as the strided batched
+gemm does. Shapes as in ker_patch_emb, output: [batch_size, max_step,
+hidden_dim].
+*/
+inline void patch_emb_gemm_cpu(const float *conv_weight, const float *conv_bias,
+                               const float *pos_emb, const float *cls_emb,
+                               const float *input, float *output,
+                               int patch_size, int image_size, int batch_size,
+                               int max_step, int hidden_dim,
+                               int channel_input) {
+  int num_patch = max_step - 1;
+  int col_dim = channel_input * patch_size * patch_size;
+  std::vector<float> col((size_t)batch_size * num_patch * col_dim);
+  patch_im2col_cpu(input, col.data(), patch_size, image_size, batch_size,
+                   channel_input);
+  for (int b = 0; b < batch_size; b++) {
+    for (int p = 0; p < num_patch; p++) {
+      const float *col_row = col.data() + ((size_t)b * num_patch + p) * col_dim;
+      float *out = output + ((size_t)b * max_step + p + 1) * hidden_dim;
+      for (int h = 0; h < hidden_dim; h++) {
+        const float *w = conv_weight + (size_t)h * col_dim;
+        float val = 0.f;
+        for (int c = 0; c < col_dim; c++) val += col_row[c] * w[c];
+        out[h] = val;
+      }
+    }
+  }
+  // epilogue: cls token, conv bias and position embedding
+  for (int b = 0; b < batch_size; b++) {
+    for (int s = 0; s < max_step; s++) {
+      float *out = output + ((size_t)b * max_step + s) * hidden_dim;
+      for (int h = 0; h < hidden_dim; h++) {
+        if (s == 0) {
+          out[h] = cls_emb[h] + pos_emb[h];
+        } else {
+          out[h] += conv_bias[h] + pos_emb[s * hidden_dim + h];
+        }
+      }
+    }
+  }
+}
+
+/* CPU reference of ker_patch_emb, the direct conv2d */
+inline void patch_emb_conv_cpu(const float *conv_weight, const float *conv_bias,
+                               const float *pos_emb, const float *cls_emb,
+                               const float *input, float *output,
+                               int patch_size, int image_size, int batch_size,
+                               int max_step, int hidden_dim,
+                               int channel_input) {
+  int patch_per_row = image_size / patch_size;
+  int val_num = channel_input * patch_size * patch_size;
+  for (int b = 0; b < batch_size; b++) {
+    for (int s = 0; s < max_step; s++) {
+      for (int h = 0; h < hidden_dim; h++) {
+        float *out = output + ((size_t)b * max_step + s) * hidden_dim + h;
+        if (s == 0) {
+          *out = cls_emb[h] + pos_emb[h];
+          continue;
+        }
+        int patch_row_id = (s - 1) / patch_per_row;
+        int patch_col_id = (s - 1) % patch_per_row;
+        float val = 0.f;
+        for (int c = 0; c < channel_input; c++) {
+          for (int i = 0; i < patch_size; i++) {
+            for (int j = 0; j < patch_size; j++) {
+              int w_id = (c * patch_size + i) * patch_size + j;
+              int row = patch_row_id * patch_size + i;
+              int col = patch_col_id * patch_size + j;
+              val += input[((b * channel_input + c) * image_size + row) *
+                               image_size +
+                           col] *
+                     conv_weight[h * val_num + w_id];
+            }
+          }
+        }
+        *out = val + conv_bias[h] + pos_emb[s * hidden_dim + h];
+      }
+    }
+  }
+}
+
+}  // namespace cuda
+}  // namespace lightseq
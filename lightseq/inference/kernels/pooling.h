@@ -0,0 +1,100 @@
+#pragma once
+
+#include <math.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifndef LS_HOST_DEVICE
+#ifdef __CUDACC__
+#define LS_HOST_DEVICE __host__ __device__
+#else
+#define LS_HOST_DEVICE
+#endif
+#endif
+
+/**
+@file
+Pooled output of the Bert encoder, one [hidden_size] vector per sample
+instead of the [batch_size, seq_len, hidden_size] hidden states, computed
+on the device after the output layer norm (see ker_bert_pooling in
+poolingKernels.cc.cu) so that only [batch_size, hidden_size] is copied back.
+
+The pooling of one element is CUDA-free and shared with the CPU reference
+so that it can be tested on host.
+*/
+namespace lightseq {
+namespace cuda {
+
+enum PoolingMode {
+  kPoolNone = 0,  // full hidden states only
+  kPoolCls = 1,   // hidden state of the first token
+  kPoolMean = 2,  // mean over the non-pad tokens
+  kPoolMax = 3,   // max over the non-pad tokens
+};
+
+inline std::string check_pooling_mode(int mode) {
+  if (mode < kPoolNone || mode > kPoolMax) {
+    return "unknown pooling mode " + std::to_string(mode);
+  }
+  return "";
+}
+
+inline int parse_pooling_mode(const std::string &name) {
+  if (name == "none") return kPoolNone;
+  if (name == "cls") return kPoolCls;
+  if (name == "mean") return kPoolMean;
+  if (name == "max") return kPoolMax;
+  throw std::runtime_error("unknown pooling mode " + name +
+                           ", expected none, cls, mean or max");
+}
+
+/**
+Pooled value of dimension dim of one sample, 0 if the sample has no
+non-pad token.
+hidden: [seq_len, hidden_size] hidden states of the sample
+tokens: [seq_len] token ids of the sample
+*/
+template <typename T>
+LS_HOST_DEVICE float pool_hidden_dim(const T *hidden, const int *tokens,
+                                     int pad_id, int seq_len,
+                                     int hidden_size, int dim, int mode) {
+  if (mode == kPoolCls) return (float)hidden[dim];
+  float res = 0.f;
+  int count = 0;
+  for (int t = 0; t < seq_len; t++) {
+    if (tokens[t] == pad_id) continue;
+    float x = (float)hidden[(long)t * hidden_size + dim];
+    if (mode == kPoolMean) {
+      res += x;
+    } else {
+      res = count == 0 ? x : fmaxf(res, x);
+    }
+    count++;
+  }
+  if (mode == kPoolMean && count > 0) res /= count;
+  return res;
+}
+
+/* CPU reference, hidden: [batch_size, seq_len, hidden_size], tokens:
+ * [batch_size, seq_len], returns [batch_size, hidden_size] */
+inline std::vector<float> pool_hidden_states(const std::vector<float> &hidden,
+                                             const std::vector<int> &tokens,
+                                             int batch_size, int seq_len,
+                                             int hidden_size, int pad_id,
+                                             int mode) {
+  std::vector<float> res((long)batch_size * hidden_size);
+  for (int b = 0; b < batch_size; b++) {
+    for (int d = 0; d < hidden_size; d++) {
+      res[(long)b * hidden_size + d] = pool_hidden_dim(
+          hidden.data() + (long)b * seq_len * hidden_size,
+          tokens.data() + (long)b * seq_len, pad_id, seq_len, hidden_size, d,
+          mode);
+    }
+  }
+  return res;
+}
+
+}  // namespace cuda
+}  // namespace lightseq
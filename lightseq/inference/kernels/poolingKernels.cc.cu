@@ -0,0 +1,67 @@
+#include "common.h"
+#include "pooling.h"
+#include "poolingKernels.h"
+
+/**
+@file
+Implemented the cuda kernel function and its launcher of the pooled output
+of Bert, see pooling.h
+*/
+namespace lightseq {
+namespace cuda {
+
+/**
+@brief: ker_bert_pooling
+pool the hidden states of every sample, a thread per hidden dimension so
+that the reads of a token are coalesced
+
+@thread
+gridDim.x = batch_size
+gridDim.y = (hidden_size + max_thread_per_block - 1) / max_thread_per_block
+blockDim.x = max_thread_per_block
+
+@param
+hidden: [batch_size, seq_len, hidden_size]
+tokens: [batch_size, seq_len]
+output: [batch_size, hidden_size]
+*/
+template <typename T>
+__global__ void ker_bert_pooling(const T *hidden, const int *tokens,
+                                 T *output, int seq_len, int hidden_size,
+                                 int pad_id, int mode) {
+  int dim = blockIdx.y * blockDim.x + threadIdx.x;
+  if (dim >= hidden_size) return;
+  long sample = blockIdx.x;
+  float res = pool_hidden_dim(hidden + sample * seq_len * hidden_size,
+                              tokens + sample * seq_len, pad_id, seq_len,
+                              hidden_size, dim, mode);
+  output[sample * hidden_size + dim] = (T)res;
+}
+
+template <typename T>
+void launch_bert_pooling(const T *hidden, const int *tokens, T *output,
+                         int batch_size, int seq_len, int hidden_size,
+                         int pad_id, int mode, int max_thread_per_block,
+                         cudaStream_t stream) {
+  dim3 grid_dim(batch_size, (hidden_size + max_thread_per_block - 1) /
+                                max_thread_per_block);
+  ker_bert_pooling<T><<<grid_dim, max_thread_per_block, 0, stream>>>(
+      hidden, tokens, output, seq_len, hidden_size, pad_id, mode);
+}
+
+template void launch_bert_pooling<float>(const float *hidden,
+                                         const int *tokens, float *output,
+                                         int batch_size, int seq_len,
+                                         int hidden_size, int pad_id,
+                                         int mode, int max_thread_per_block,
+                                         cudaStream_t stream);
+
+template void launch_bert_pooling<__half>(const __half *hidden,
+                                          const int *tokens, __half *output,
+                                          int batch_size, int seq_len,
+                                          int hidden_size, int pad_id,
+                                          int mode, int max_thread_per_block,
+                                          cudaStream_t stream);
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,19 @@
+#pragma once
+#include <cuda.h>
+#include <cuda_fp16.h>
+
+namespace lightseq {
+namespace cuda {
+
+/* Pool the hidden states [batch_size, seq_len, hidden_size] of the samples
+ * into output [batch_size, hidden_size], see pooling.h. tokens:
+ * [batch_size, seq_len], the ones equal to pad_id are skipped by mean and
+ * max, e.g. the padding mask of the encoder with pad_id 1 */
+template <typename T>
+void launch_bert_pooling(const T *hidden, const int *tokens, T *output,
+                         int batch_size, int seq_len, int hidden_size,
+                         int pad_id, int mode, int max_thread_per_block,
+                         cudaStream_t stream);
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,389 @@
+#include "common.h"
+#include "samplingKernels.h"
+
+/**
+@file
+Implemented the cuda kernel function and its launcher of the logits
+processor chain and the exact multinomial sampling after it.
+Currently, fp16 and fp32 versions are provided
+*/
+namespace lightseq {
+namespace cuda {
+
+/* Block reductions whose result is visible to every thread of the block */
+template <typename T>
+__forceinline__ __device__ T blockAllReduceSum(T val) {
+  __shared__ T s_val;
+  val = blockReduceSum<T>(val);
+  if (threadIdx.x == 0) s_val = val;
+  __syncthreads();
+  val = s_val;
+  __syncthreads();
+  return val;
+}
+
+__forceinline__ __device__ float blockAllReduceMax(float val) {
+  __shared__ float s_val;
+  val = blockReduceMax<float>(val);
+  if (threadIdx.x == 0) s_val = val;
+  __syncthreads();
+  val = s_val;
+  __syncthreads();
+  return val;
+}
+
+__forceinline__ __device__ float blockAllReduceMin(float val) {
+  __shared__ float s_val;
+  val = blockReduceMin<float>(val);
+  if (threadIdx.x == 0) s_val = val;
+  __syncthreads();
+  val = s_val;
+  __syncthreads();
+  return val;
+}
+
+/**
+@brief: ker_logits_processor
+apply the logits processor chain of logits_processor.h to the last logits of
+each row, in place
+
+@thread
+gridDim.x = rows
+blockDim.x = max_thread_per_block
+
+@param
+logits: [rows, logits_seq_len, vocab_size]
+logit_bias: [vocab_size] or nullptr
+seqs: [rows, seq_stride], the first seq_len tokens of each row are the
+  sequence so far, generated_len of them are generated
+*/
+template <typename T>
+__global__ void ker_logits_processor(T *logits, const T *logit_bias,
+                                     const int *seqs, int seq_stride,
+                                     int seq_len, int generated_len,
+                                     int logits_seq_len, int vocab_size,
+                                     LogitsProcessorParams params) {
+  T *row_logits =
+      logits +
+      ((size_t)blockIdx.x * logits_seq_len + logits_seq_len - 1) * vocab_size;
+  const int *seq = seqs + (size_t)blockIdx.x * seq_stride;
+
+  /* step 1. logit bias and temperature, the only full pass over the vocab
+   * when top_k and top_p are off */
+  if (logit_bias != nullptr || params.temperature != 1.f) {
+    for (int i = threadIdx.x; i < vocab_size; i += blockDim.x) {
+      float val = (float)row_logits[i];
+      if (logit_bias != nullptr) val += (float)__ldg(&logit_bias[i]);
+      row_logits[i] = (T)(val / params.temperature);
+    }
+    __syncthreads();
+  }
+
+  /* step 2. repetition penalty, by the first occurrence of each token */
+  if (params.repetition_penalty != 1.f) {
+    for (int i = threadIdx.x; i < seq_len; i += blockDim.x) {
+      int token = seq[i];
+      bool first = token != params.pad_id;
+      for (int j = 0; j < i && first; j++) first = seq[j] != token;
+      if (first) {
+        row_logits[token] = (T)repetition_penalized((float)row_logits[token],
+                                                    params.repetition_penalty);
+      }
+    }
+    __syncthreads();
+  }
+
+  /* step 3. bans, concurrent writes to a token are all kMaskedLogit */
+  int n = params.no_repeat_ngram_size;
+  if (n > 0) {
+    for (int start = threadIdx.x; start + n - 1 < seq_len;
+         start += blockDim.x) {
+      if (ngram_prefix_matches(seq, seq_len, start, n)) {
+        row_logits[seq[start + n - 1]] = (T)kMaskedLogit;
+      }
+    }
+  }
+  for (int w = threadIdx.x; w < params.num_bad_words; w += blockDim.x) {
+    int offset = params.bad_word_offsets[w];
+    int word_len = params.bad_word_offsets[w + 1] - offset;
+    const int *word = params.bad_word_tokens + offset;
+    if (bad_word_prefix_matches(seq, seq_len, word, word_len)) {
+      row_logits[word[word_len - 1]] = (T)kMaskedLogit;
+    }
+  }
+  if (threadIdx.x == 0 && generated_len < params.min_length) {
+    row_logits[params.eos_id] = (T)kMaskedLogit;
+  }
+  __syncthreads();
+
+  /* step 4. forced eos */
+  if (params.max_length > 0 && generated_len >= params.max_length - 1) {
+    for (int i = threadIdx.x; i < vocab_size; i += blockDim.x) {
+      row_logits[i] = (T)(i == params.eos_id ? 0.f : kMaskedLogit);
+    }
+    return;
+  }
+
+  /* step 5. exact top_k, bisect the largest threshold that keeps at least k
+   * logits on the order preserving uint32 of the logits */
+  if (params.top_k > 0 && params.top_k < vocab_size) {
+    float min_logit = CUDA_FLOAT_INF_POS, max_logit = CUDA_FLOAT_INF_NEG;
+    for (int i = threadIdx.x; i < vocab_size; i += blockDim.x) {
+      float val = (float)row_logits[i];
+      min_logit = fminf(min_logit, val);
+      max_logit = fmaxf(max_logit, val);
+    }
+    uint32_t lo = bisect_ordered_threshold(
+        float_to_ordered(blockAllReduceMin(min_logit)),
+        float_to_ordered(blockAllReduceMax(max_logit)), [&](uint32_t mid) {
+          int cnt = 0;
+          for (int i = threadIdx.x; i < vocab_size; i += blockDim.x) {
+            cnt += float_to_ordered((float)row_logits[i]) >= mid;
+          }
+          return blockAllReduceSum(cnt) >= params.top_k;
+        });
+    for (int i = threadIdx.x; i < vocab_size; i += blockDim.x) {
+      if (float_to_ordered((float)row_logits[i]) < lo) {
+        row_logits[i] = (T)kMaskedLogit;
+      }
+    }
+    __syncthreads();
+  }
+
+  /* step 6. exact top_p, bisect the largest threshold that keeps at least
+   * top_p of the probability mass */
+  if (params.top_p < 1.f) {
+    float min_logit = CUDA_FLOAT_INF_POS, max_logit = CUDA_FLOAT_INF_NEG;
+    for (int i = threadIdx.x; i < vocab_size; i += blockDim.x) {
+      float val = (float)row_logits[i];
+      min_logit = fminf(min_logit, val);
+      max_logit = fmaxf(max_logit, val);
+    }
+    min_logit = blockAllReduceMin(min_logit);
+    max_logit = blockAllReduceMax(max_logit);
+    float total = 0.f;
+    for (int i = threadIdx.x; i < vocab_size; i += blockDim.x) {
+      total += expf((float)row_logits[i] - max_logit);
+    }
+    float target = params.top_p * blockAllReduceSum(total);
+    uint32_t lo = bisect_ordered_threshold(
+        float_to_ordered(min_logit), float_to_ordered(max_logit),
+        [&](uint32_t mid) {
+          float mass = 0.f;
+          for (int i = threadIdx.x; i < vocab_size; i += blockDim.x) {
+            float val = (float)row_logits[i];
+            if (float_to_ordered(val) >= mid) mass += expf(val - max_logit);
+          }
+          return blockAllReduceSum(mass) >= target;
+        });
+    for (int i = threadIdx.x; i < vocab_size; i += blockDim.x) {
+      if (float_to_ordered((float)row_logits[i]) < lo) {
+        row_logits[i] = (T)kMaskedLogit;
+      }
+    }
+  }
+}
+
+template <typename T>
+void launch_logits_processor(T *logits, const T *logit_bias, const int *seqs,
+                             int seq_stride, int seq_len, int generated_len,
+                             int rows, int logits_seq_len, int vocab_size,
+                             const LogitsProcessorParams &params,
+                             int max_thread_per_block, cudaStream_t stream) {
+  ker_logits_processor<T><<<rows, max_thread_per_block, 0, stream>>>(
+      logits, logit_bias, seqs, seq_stride, seq_len, generated_len,
+      logits_seq_len, vocab_size, params);
+}
+
+template void launch_logits_processor<float>(
+    float *logits, const float *logit_bias, const int *seqs, int seq_stride,
+    int seq_len, int generated_len, int rows, int logits_seq_len,
+    int vocab_size, const LogitsProcessorParams &params,
+    int max_thread_per_block, cudaStream_t stream);
+
+template void launch_logits_processor<__half>(
+    __half *logits, const __half *logit_bias, const int *seqs, int seq_stride,
+    int seq_len, int generated_len, int rows, int logits_seq_len,
+    int vocab_size, const LogitsProcessorParams &params,
+    int max_thread_per_block, cudaStream_t stream);
+
+/**
+Sample one token of a block from the softmax of logits: the first token
+whose prefix sum of probs reaches u * sum of probs, as
+multinomial_sample_cpu. blockDim.x should be 1024
+*/
+template <typename T>
+__forceinline__ __device__ int blockMultinomialSample(const T *logits,
+                                                      int vocab_size,
+                                                      curandState *state) {
+  float max_logit = CUDA_FLOAT_INF_NEG;
+  for (int i = threadIdx.x; i < vocab_size; i += blockDim.x) {
+    max_logit = fmaxf(max_logit, (float)logits[i]);
+  }
+  max_logit = blockAllReduceMax(max_logit);
+  float sum = 0.f;
+  for (int i = threadIdx.x; i < vocab_size; i += blockDim.x) {
+    sum += expf((float)logits[i] - max_logit);
+  }
+  sum = blockAllReduceSum(sum);
+
+  __shared__ float s_target, s_prefix;
+  __shared__ int s_token;
+  if (threadIdx.x == 0) {
+    s_target = curand_uniform(state) * sum;
+    s_prefix = 0.f;
+    s_token = vocab_size;
+  }
+  __syncthreads();
+
+  typedef cub::BlockScan<float, 1024> BlockScan;
+  __shared__ typename BlockScan::TempStorage temp_storage;
+  for (int base = 0; base < vocab_size; base += blockDim.x) {
+    int i = base + threadIdx.x;
+    float prob = i < vocab_size ? expf((float)logits[i] - max_logit) : 0.f;
+    float prefix, chunk_sum;
+    BlockScan(temp_storage).InclusiveSum(prob, prefix, chunk_sum);
+    if (prob > 0.f && s_prefix + prefix >= s_target) atomicMin(&s_token, i);
+    __syncthreads();
+    if (threadIdx.x == 0) s_prefix += chunk_sum;
+    __syncthreads();
+    if (s_token < vocab_size) break;
+  }
+  // rounding of the prefix sum, fall back to the argmax
+  if (s_token == vocab_size) {
+    for (int i = threadIdx.x; i < vocab_size; i += blockDim.x) {
+      if ((float)logits[i] == max_logit) atomicMin(&s_token, i);
+    }
+    __syncthreads();
+  }
+  return s_token;
+}
+
+/**
+@brief: ker_multinomial_sample
+sample the next token of each row from its processed logits
+
+@thread
+gridDim.x = rows
+blockDim.x = 1024
+
+@param
+logits: [rows, vocab_size]
+alive_seq: [rows, max_step]
+unfinished: [1]
+curandstate: [rows]
+*/
+template <typename T>
+__global__ void ker_multinomial_sample(const T *logits, int *alive_seq,
+                                       int seq_len, int max_step,
+                                       int vocab_size, int *unfinished,
+                                       curandState *curandstate, int eos_id) {
+  int last_token_idx = blockIdx.x * max_step + seq_len - 1;
+  /* add EOS to end if last token is EOS */
+  if (seq_len > 1 && alive_seq[last_token_idx] == eos_id) {
+    if (threadIdx.x == 0) alive_seq[last_token_idx + 1] = eos_id;
+    return;
+  }
+  int token = blockMultinomialSample(logits + (size_t)blockIdx.x * vocab_size,
+                                     vocab_size, curandstate + blockIdx.x);
+  if (threadIdx.x == 0) {
+    if (token != eos_id) unfinished[0] = 1;
+    alive_seq[last_token_idx + 1] = token;
+  }
+}
+
+template <typename T>
+void launch_multinomial_sample(const T *logits, int *alive_seq, int rows,
+                               int seq_len, int max_step, int vocab_size,
+                               int max_thread_per_block, cudaStream_t stream,
+                               int *unfinished, curandState *curandstate,
+                               int eos_id) {
+  ker_multinomial_sample<T><<<rows, max_thread_per_block, 0, stream>>>(
+      logits, alive_seq, seq_len, max_step, vocab_size, unfinished,
+      curandstate, eos_id);
+}
+
+template void launch_multinomial_sample<float>(
+    const float *logits, int *alive_seq, int rows, int seq_len, int max_step,
+    int vocab_size, int max_thread_per_block, cudaStream_t stream,
+    int *unfinished, curandState *curandstate, int eos_id);
+
+template void launch_multinomial_sample<__half>(
+    const __half *logits, int *alive_seq, int rows, int seq_len, int max_step,
+    int vocab_size, int max_thread_per_block, cudaStream_t stream,
+    int *unfinished, curandState *curandstate, int eos_id);
+
+/**
+@brief: ker_gpt_multinomial_sample
+ker_multinomial_sample with the ids of ker_topk_sample in gptKernels.cc.cu
+
+@thread
+gridDim.x = batch_size
+blockDim.x = 1024
+
+@param
+logits: [batch_size, logits_seq_len, vocab_size]
+old_input_ids: [batch_size, batch_seq_len]
+new_input_ids: [batch_size, batch_seq_len+1]
+unfinished: [1]
+curandstate: [batch_size]
+*/
+template <typename T>
+__global__ void ker_gpt_multinomial_sample(const T *logits, int *old_input_ids,
+                                           int *new_input_ids,
+                                           int batch_seq_len,
+                                           int logits_seq_len, int vocab_size,
+                                           int *unfinished,
+                                           curandState *curandstate,
+                                           int eos_id) {
+  int last_token_idx = blockIdx.x * batch_seq_len + batch_seq_len - 1;
+  int token = eos_id;
+  if (old_input_ids[last_token_idx] != eos_id) {
+    const T *row_logits =
+        logits +
+        ((size_t)blockIdx.x * logits_seq_len + logits_seq_len - 1) * vocab_size;
+    token = blockMultinomialSample(row_logits, vocab_size,
+                                   curandstate + blockIdx.x);
+    if (threadIdx.x == 0 && token != eos_id) unfinished[0] = 1;
+  }
+
+  /* copy old_input_ids to new_input_ids and add new sampled ids */
+  int left_token_idx = blockIdx.x * batch_seq_len + threadIdx.x;
+  int right_token_idx = (blockIdx.x + 1) * batch_seq_len;
+  for (int idx = left_token_idx; idx < right_token_idx; idx += blockDim.x) {
+    new_input_ids[idx + blockIdx.x] = old_input_ids[idx];
+  }
+  if (threadIdx.x == 0) {
+    new_input_ids[(blockIdx.x + 1) * (batch_seq_len + 1) - 1] = token;
+    // save the newly sampled ids to old_input_ids for next step inputs
+    old_input_ids[gridDim.x * batch_seq_len + blockIdx.x] = token;
+  }
+}
+
+template <typename T>
+void launch_gpt_multinomial_sample(const T *logits, int *old_input_ids,
+                                   int *new_input_ids, int batch_size,
+                                   int batch_seq_len, int logits_seq_len,
+                                   int vocab_size, int max_thread_per_block,
+                                   cudaStream_t stream, int *unfinished,
+                                   curandState *curandstate, int eos_id) {
+  ker_gpt_multinomial_sample<T><<<batch_size, max_thread_per_block, 0,
+                                  stream>>>(
+      logits, old_input_ids, new_input_ids, batch_seq_len, logits_seq_len,
+      vocab_size, unfinished, curandstate, eos_id);
+}
+
+template void launch_gpt_multinomial_sample<float>(
+    const float *logits, int *old_input_ids, int *new_input_ids,
+    int batch_size, int batch_seq_len, int logits_seq_len, int vocab_size,
+    int max_thread_per_block, cudaStream_t stream, int *unfinished,
+    curandState *curandstate, int eos_id);
+
+template void launch_gpt_multinomial_sample<__half>(
+    const __half *logits, int *old_input_ids, int *new_input_ids,
+    int batch_size, int batch_seq_len, int logits_seq_len, int vocab_size,
+    int max_thread_per_block, cudaStream_t stream, int *unfinished,
+    curandState *curandstate, int eos_id);
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,42 @@
+#pragma once
+#include <cuda.h>
+#include <cuda_fp16.h>
+#include <curand_kernel.h>
+#include <cub/cub.cuh>
+
+#include "logits_processor.h"
+
+namespace lightseq {
+namespace cuda {
+
+/* Apply the logits processor chain in place, see logits_processor.h.
+ * logit_bias is folded into the logits, pass a zero bias to the sampler or
+ * beam search after it */
+template <typename T>
+void launch_logits_processor(T *logits, const T *logit_bias, const int *seqs,
+                             int seq_stride, int seq_len, int generated_len,
+                             int rows, int logits_seq_len, int vocab_size,
+                             const LogitsProcessorParams &params,
+                             int max_thread_per_block, cudaStream_t stream);
+
+/* Exact multinomial sampling from processed logits, ids in the decoder layout
+ * [rows, max_step], the new id is written at seq_len */
+template <typename T>
+void launch_multinomial_sample(const T *logits, int *alive_seq, int rows,
+                               int seq_len, int max_step, int vocab_size,
+                               int max_thread_per_block, cudaStream_t stream,
+                               int *unfinished, curandState *curandstate,
+                               int eos_id);
+
+/* Same as launch_multinomial_sample with the ids in the gpt layout of
+ * ker_topk_sample_launcher in gptKernels.h */
+template <typename T>
+void launch_gpt_multinomial_sample(const T *logits, int *old_input_ids,
+                                   int *new_input_ids, int batch_size,
+                                   int batch_seq_len, int logits_seq_len,
+                                   int vocab_size, int max_thread_per_block,
+                                   cudaStream_t stream, int *unfinished,
+                                   curandState *curandstate, int eos_id);
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,224 @@
+#include "common.h"
+#include "scoringKernels.h"
+
+/**
+@file
+Implemented the cuda kernel function and its launcher of the teacher-forced
+scoring of the Transformer decoder, see sequence_scoring.h
+*/
+namespace lightseq {
+namespace cuda {
+
+/**
+@brief: ker_score_target_len
+scored length of the targets of a pass
+
+@thread
+gridDim.x = (num_pass_targets + MAX_THREADS - 1) / MAX_THREADS
+blockDim.x = MAX_THREADS
+
+@param
+targets: [num_targets, trg_seq_len]
+trg_len: [num_pass_targets]
+*/
+__global__ void ker_score_target_len(const int *targets, int *trg_len,
+                                     ScorePass pass, int num_pass_targets,
+                                     int trg_seq_len, int end_id) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= num_pass_targets) return;
+  const int *target = targets + (long)score_target_id(pass, i) * trg_seq_len;
+  trg_len[i] = score_target_len(target, trg_seq_len, end_id);
+}
+
+void launch_score_target_len(const int *targets, int *trg_len,
+                             const ScorePass &pass, int num_pass_targets,
+                             int trg_seq_len, int end_id,
+                             cudaStream_t stream) {
+  int nblock = (num_pass_targets + MAX_THREADS - 1) / MAX_THREADS;
+  ker_score_target_len<<<nblock, MAX_THREADS, 0, stream>>>(
+      targets, trg_len, pass, num_pass_targets, trg_seq_len, end_id);
+}
+
+/**
+@brief: ker_score_dec_emb
+for the decoder scoring, look up the embedding of the input token of every
+position, add position embedding
+
+@thread
+gridDim.x = (nele + MAX_THREADS - 1) / MAX_THREADS
+blockDim.x = MAX_THREADS
+
+@param
+token_emb: [hidden_dim, vocab_size], note, it is different with encoder,
+  [vocab_size, hidden_dim] if tied_emb
+pos_emb: [max_step, hidden_dim]
+targets: [num_targets, trg_seq_len]
+output: [num_pass_targets, trg_seq_len, hidden_dim]
+*/
+template <typename T>
+__global__ void ker_score_dec_emb(const T *token_emb, const T *pos_emb,
+                                  const int *targets, T *output,
+                                  ScorePass pass, int num_pass_targets,
+                                  int trg_seq_len, int hidden_dim,
+                                  int vocab_size, int start_id,
+                                  bool tied_emb) {
+  int idx = blockIdx.x * blockDim.x + threadIdx.x;
+  if (idx >= num_pass_targets * trg_seq_len * hidden_dim) {
+    return;
+  }
+  int target_idx, pos, dim_idx;
+  decompose_3dim(idx, trg_seq_len, hidden_dim, &target_idx, &pos, &dim_idx);
+  const int *target =
+      targets + (long)score_target_id(pass, target_idx) * trg_seq_len;
+  int token = score_input_token(target, pos, start_id);
+  T emb = tied_emb ? token_emb[flat_2dim(token, dim_idx, hidden_dim)]
+                   : token_emb[flat_2dim(dim_idx, token, vocab_size)];
+  float value =
+      float(emb) + float(pos_emb[flat_2dim(pos, dim_idx, hidden_dim)]);
+  output[idx] = T(value);
+}
+
+template <typename T>
+void launch_score_dec_emb(const T *token_emb, const T *pos_emb,
+                          const int *targets, T *output, const ScorePass &pass,
+                          int num_pass_targets, int trg_seq_len,
+                          int hidden_dim, int vocab_size, int start_id,
+                          cudaStream_t stream, bool tied_emb) {
+  int nele = num_pass_targets * trg_seq_len * hidden_dim;
+  int nblock = (nele + MAX_THREADS - 1) / MAX_THREADS;
+  ker_score_dec_emb<T><<<nblock, MAX_THREADS, 0, stream>>>(
+      token_emb, pos_emb, targets, output, pass, num_pass_targets, trg_seq_len,
+      hidden_dim, vocab_size, start_id, tied_emb);
+}
+
+template void launch_score_dec_emb<float>(
+    const float *token_emb, const float *pos_emb, const int *targets,
+    float *output, const ScorePass &pass, int num_pass_targets,
+    int trg_seq_len, int hidden_dim, int vocab_size, int start_id,
+    cudaStream_t stream, bool tied_emb);
+
+template void launch_score_dec_emb<__half>(
+    const __half *token_emb, const __half *pos_emb, const int *targets,
+    __half *output, const ScorePass &pass, int num_pass_targets,
+    int trg_seq_len, int hidden_dim, int vocab_size, int start_id,
+    cudaStream_t stream, bool tied_emb);
+
+/**
+@brief: ker_score_log_prob
+log probability of the target token of a position, log_softmax over the
+whole vocab
+
+@thread
+gridDim.x = num_rows
+blockDim.x = max_thread_per_block
+
+@param
+logits: [num_rows, vocab_size], without the logit bias
+logit_bias: [vocab_size]
+targets: [num_targets, trg_seq_len]
+trg_len: [num_pass_targets]
+token_log_prob: [num_targets, trg_seq_len]
+row_begin: first row of the pass in logits, row = pass target * trg_seq_len
+  + position
+*/
+template <typename T>
+__global__ void ker_score_log_prob(const T *logits, const T *logit_bias,
+                                   const int *targets, const int *trg_len,
+                                   float *token_log_prob, ScorePass pass,
+                                   int row_begin, int trg_seq_len,
+                                   int vocab_size) {
+  int row = row_begin + blockIdx.x;
+  int pass_target = row / trg_seq_len;
+  int pos = row % trg_seq_len;
+  long out_idx =
+      (long)score_target_id(pass, pass_target) * trg_seq_len + pos;
+  if (pos >= trg_len[pass_target]) {
+    // after the end of the target
+    if (threadIdx.x == 0) token_log_prob[out_idx] = 0.f;
+    return;
+  }
+  const T *row_logits = logits + (long)blockIdx.x * vocab_size;
+
+  float max_logit = CUDA_FLOAT_INF_NEG;
+  for (int i = threadIdx.x; i < vocab_size; i += blockDim.x) {
+    max_logit =
+        fmaxf(max_logit, (float)row_logits[i] + (float)__ldg(&logit_bias[i]));
+  }
+  max_logit = blockReduceMax(max_logit);
+  __shared__ float s_max_logit;
+  if (threadIdx.x == 0) s_max_logit = max_logit;
+  __syncthreads();
+
+  float sum_exp_logit = 0.f;
+  for (int i = threadIdx.x; i < vocab_size; i += blockDim.x) {
+    sum_exp_logit += expf((float)row_logits[i] +
+                          (float)__ldg(&logit_bias[i]) - s_max_logit);
+  }
+  sum_exp_logit = blockReduceSum(sum_exp_logit);
+
+  if (threadIdx.x == 0) {
+    int token = targets[out_idx];
+    token_log_prob[out_idx] = (float)row_logits[token] +
+                              (float)logit_bias[token] - s_max_logit -
+                              logf(sum_exp_logit);
+  }
+}
+
+template <typename T>
+void launch_score_log_prob(const T *logits, const T *logit_bias,
+                           const int *targets, const int *trg_len,
+                           float *token_log_prob, const ScorePass &pass,
+                           int row_begin, int num_rows, int trg_seq_len,
+                           int vocab_size, int max_thread_per_block,
+                           cudaStream_t stream) {
+  ker_score_log_prob<T><<<num_rows, max_thread_per_block, 0, stream>>>(
+      logits, logit_bias, targets, trg_len, token_log_prob, pass, row_begin,
+      trg_seq_len, vocab_size);
+}
+
+template void launch_score_log_prob<float>(
+    const float *logits, const float *logit_bias, const int *targets,
+    const int *trg_len, float *token_log_prob, const ScorePass &pass,
+    int row_begin, int num_rows, int trg_seq_len, int vocab_size,
+    int max_thread_per_block, cudaStream_t stream);
+
+template void launch_score_log_prob<__half>(
+    const __half *logits, const __half *logit_bias, const int *targets,
+    const int *trg_len, float *token_log_prob, const ScorePass &pass,
+    int row_begin, int num_rows, int trg_seq_len, int vocab_size,
+    int max_thread_per_block, cudaStream_t stream);
+
+/**
+@brief: ker_score_seq_log_prob
+sum the token log probabilities of a target, in a fixed order so that the
+scores are deterministic
+
+@thread
+gridDim.x = num_pass_targets
+blockDim.x = WARP_SIZE
+
+@param
+token_log_prob: [num_targets, trg_seq_len]
+seq_log_prob: [num_targets]
+*/
+__global__ void ker_score_seq_log_prob(const float *token_log_prob,
+                                       float *seq_log_prob, ScorePass pass,
+                                       int trg_seq_len) {
+  int target_id = score_target_id(pass, blockIdx.x);
+  const float *row = token_log_prob + (long)target_id * trg_seq_len;
+  float sum = 0.f;
+  for (int t = threadIdx.x; t < trg_seq_len; t += blockDim.x) sum += row[t];
+  sum = warpReduceSum(sum);
+  if (threadIdx.x == 0) seq_log_prob[target_id] = sum;
+}
+
+void launch_score_seq_log_prob(const float *token_log_prob,
+                               float *seq_log_prob, const ScorePass &pass,
+                               int num_pass_targets, int trg_seq_len,
+                               cudaStream_t stream) {
+  ker_score_seq_log_prob<<<num_pass_targets, WARP_SIZE, 0, stream>>>(
+      token_log_prob, seq_log_prob, pass, trg_seq_len);
+}
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,42 @@
+#pragma once
+#include <cuda.h>
+#include <cuda_fp16.h>
+
+#include "sequence_scoring.h"
+
+namespace lightseq {
+namespace cuda {
+
+/* Scored length of the targets of a pass, trg_len: [pass targets] */
+void launch_score_target_len(const int *targets, int *trg_len,
+                             const ScorePass &pass, int num_pass_targets,
+                             int trg_seq_len, int end_id, cudaStream_t stream);
+
+/* Decoder embedding of all the positions of the targets of a pass,
+ * token_emb: [hidden_dim, vocab_size] ([vocab_size, hidden_dim] if
+ * tied_emb), output: [pass targets, trg_seq_len, hidden_dim] */
+template <typename T>
+void launch_score_dec_emb(const T *token_emb, const T *pos_emb,
+                          const int *targets, T *output, const ScorePass &pass,
+                          int num_pass_targets, int trg_seq_len,
+                          int hidden_dim, int vocab_size, int start_id,
+                          cudaStream_t stream, bool tied_emb = false);
+
+/* Token log probabilities of the rows [row_begin, row_begin + num_rows) of
+ * a pass from their logits [num_rows, vocab_size], see sequence_scoring.h */
+template <typename T>
+void launch_score_log_prob(const T *logits, const T *logit_bias,
+                           const int *targets, const int *trg_len,
+                           float *token_log_prob, const ScorePass &pass,
+                           int row_begin, int num_rows, int trg_seq_len,
+                           int vocab_size, int max_thread_per_block,
+                           cudaStream_t stream);
+
+/* Sequence log probabilities of the targets of a pass */
+void launch_score_seq_log_prob(const float *token_log_prob,
+                               float *seq_log_prob, const ScorePass &pass,
+                               int num_pass_targets, int trg_seq_len,
+                               cudaStream_t stream);
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#ifndef LS_HOST_DEVICE
+#ifdef __CUDACC__
+#define LS_HOST_DEVICE __host__ __device__
+#else
+#define LS_HOST_DEVICE
+#endif
+#endif
+
+/**
+@file
+Teacher-forced scoring of given target sequences by the Transformer
+decoder, e.g. to rerank the n-best list of another system. The encoder runs
+once per source, the decoder runs over all the positions of the targets in
+one pass with a causal mask instead of the step loop, see
+Decoder::run_score.
+
+The targets are grouped by source: targets [i * n, (i + 1) * n) are the n
+candidates of source i. A target row [y_0, ..., y_{L-1}] ends at its first
+end_id, the tokens after it are padding. Position t reads y_{t-1}, the start
+token at t = 0, and scores y_t; the positions after the end are not scored
+and their log probability is 0. The sequence log probability is the sum of
+its token ones, without length penalty.
+
+The passes, the token semantics and the CPU reference are CUDA-free so that
+they can be tested on host, the device kernels (scoringKernels.cc.cu) share
+them.
+*/
+namespace lightseq {
+namespace cuda {
+
+// max gridDim.y, the encdec softmax has a block per (head, query) of a source
+const int kScoreMaxGridY = 65535;
+
+/* The candidates [cand_begin, cand_begin + cand_num) of every source */
+struct ScorePass {
+  int cand_begin;
+  int cand_num;
+  int num_candidates;  // candidates per source
+};
+
+/* Target id of the i-th target of a pass */
+LS_HOST_DEVICE inline int score_target_id(const ScorePass &pass, int i) {
+  return i / pass.cand_num * pass.num_candidates + pass.cand_begin +
+         i % pass.cand_num;
+}
+
+/* Number of scored positions of a target, through its first end_id */
+LS_HOST_DEVICE inline int score_target_len(const int *target, int trg_seq_len,
+                                           int end_id) {
+  for (int t = 0; t < trg_seq_len; t++) {
+    if (target[t] == end_id) return t + 1;
+  }
+  return trg_seq_len;
+}
+
+/* Decoder input token of position pos */
+LS_HOST_DEVICE inline int score_input_token(const int *target, int pos,
+                                            int start_id) {
+  return pos == 0 ? start_id : target[pos - 1];
+}
+
+/**
+Split the num_candidates candidates of batch_size sources into passes whose
+token rows fit max_token_num, with every source in every pass. A pass has at
+least one candidate, batch_size * trg_seq_len <= max_token_num is checked by
+the caller.
+*/
+inline std::vector<ScorePass> score_passes(int batch_size, int num_candidates,
+                                           int trg_seq_len, int head_num,
+                                           int max_token_num) {
+  int cand_num = max_token_num / std::max(batch_size * trg_seq_len, 1);
+  cand_num = std::min(cand_num, kScoreMaxGridY / (head_num * trg_seq_len));
+  cand_num = std::max(1, std::min(cand_num, num_candidates));
+  std::vector<ScorePass> res;
+  for (int begin = 0; begin < num_candidates; begin += cand_num) {
+    res.push_back(
+        {begin, std::min(cand_num, num_candidates - begin), num_candidates});
+  }
+  return res;
+}
+
+/**
+CPU reference of the log probabilities from the logits of every position.
+logits: [num_targets, trg_seq_len, vocab_size], bias included
+targets, token_log_prob: [num_targets, trg_seq_len]
+seq_log_prob: [num_targets]
+*/
+inline void score_log_prob_reference(const float *logits, const int *targets,
+                                     int num_targets, int trg_seq_len,
+                                     int vocab_size, int end_id,
+                                     float *token_log_prob,
+                                     float *seq_log_prob) {
+  for (int i = 0; i < num_targets; i++) {
+    const int *target = targets + (long)i * trg_seq_len;
+    int len = score_target_len(target, trg_seq_len, end_id);
+    float sum = 0.f;
+    for (int t = 0; t < trg_seq_len; t++) {
+      float lp = 0.f;
+      if (t < len) {
+        const float *row = logits + ((long)i * trg_seq_len + t) * vocab_size;
+        float m = *std::max_element(row, row + vocab_size);
+        float s = 0.f;
+        for (int v = 0; v < vocab_size; v++) s += expf(row[v] - m);
+        lp = row[target[t]] - m - logf(s);
+      }
+      token_log_prob[(long)i * trg_seq_len + t] = lp;
+      sum += lp;
+    }
+    seq_log_prob[i] = sum;
+  }
+}
+
+}  // namespace cuda
+}  // namespace lightseq
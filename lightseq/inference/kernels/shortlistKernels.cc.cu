@@ -0,0 +1,136 @@
+#include "common.h"
+#include "shortlistKernels.h"
+
+/**
+@file
+Implemented the cuda kernel function and its launcher of the vocab shortlist
+decoding, see tools/lexical_shortlist.h
+*/
+namespace lightseq {
+namespace cuda {
+
+/**
+@brief: ker_gather_vocab_columns
+gather the shortlist columns of a matrix
+
+@thread
+gridDim.x = rows
+gridDim.y = (shortlist_size + max_thread_per_block - 1) / max_thread_per_block
+blockDim.x = max_thread_per_block
+
+@param
+in: [rows, vocab_size]
+out: [rows, shortlist_size]
+shortlist: [shortlist_size], ids in the vocab
+*/
+template <typename T>
+__global__ void ker_gather_vocab_columns(const T *in, T *out,
+                                         const int *shortlist, int vocab_size,
+                                         int shortlist_size) {
+  int col = blockIdx.y * blockDim.x + threadIdx.x;
+  if (col >= shortlist_size) return;
+  out[(long)blockIdx.x * shortlist_size + col] =
+      in[(long)blockIdx.x * vocab_size + shortlist[col]];
+}
+
+template <typename T>
+void launch_gather_vocab_columns(const T *in, T *out, const int *shortlist,
+                                 int rows, int vocab_size, int shortlist_size,
+                                 int max_thread_per_block,
+                                 cudaStream_t stream) {
+  dim3 grid_dim(rows, (shortlist_size + max_thread_per_block - 1) /
+                          max_thread_per_block);
+  ker_gather_vocab_columns<T><<<grid_dim, max_thread_per_block, 0, stream>>>(
+      in, out, shortlist, vocab_size, shortlist_size);
+}
+
+template void launch_gather_vocab_columns<float>(
+    const float *in, float *out, const int *shortlist, int rows,
+    int vocab_size, int shortlist_size, int max_thread_per_block,
+    cudaStream_t stream);
+
+template void launch_gather_vocab_columns<__half>(
+    const __half *in, __half *out, const int *shortlist, int rows,
+    int vocab_size, int shortlist_size, int max_thread_per_block,
+    cudaStream_t stream);
+
+/**
+@brief: ker_gather_vocab_rows
+gather the shortlist rows of a matrix
+
+@thread
+gridDim.x = shortlist_size
+gridDim.y = (cols + max_thread_per_block - 1) / max_thread_per_block
+blockDim.x = max_thread_per_block
+
+@param
+in: [vocab_size, cols]
+out: [shortlist_size, cols]
+shortlist: [shortlist_size], ids in the vocab
+*/
+template <typename T>
+__global__ void ker_gather_vocab_rows(const T *in, T *out,
+                                      const int *shortlist, int cols) {
+  int col = blockIdx.y * blockDim.x + threadIdx.x;
+  if (col >= cols) return;
+  out[(long)blockIdx.x * cols + col] =
+      in[(long)shortlist[blockIdx.x] * cols + col];
+}
+
+template <typename T>
+void launch_gather_vocab_rows(const T *in, T *out, const int *shortlist,
+                              int cols, int shortlist_size,
+                              int max_thread_per_block, cudaStream_t stream) {
+  dim3 grid_dim(shortlist_size,
+                (cols + max_thread_per_block - 1) / max_thread_per_block);
+  ker_gather_vocab_rows<T><<<grid_dim, max_thread_per_block, 0, stream>>>(
+      in, out, shortlist, cols);
+}
+
+template void launch_gather_vocab_rows<float>(const float *in, float *out,
+                                              const int *shortlist, int cols,
+                                              int shortlist_size,
+                                              int max_thread_per_block,
+                                              cudaStream_t stream);
+
+template void launch_gather_vocab_rows<__half>(const __half *in, __half *out,
+                                               const int *shortlist, int cols,
+                                               int shortlist_size,
+                                               int max_thread_per_block,
+                                               cudaStream_t stream);
+
+/**
+@brief: ker_shortlist_to_vocab
+map the candidate ids from the shortlist to the full vocab
+
+@thread
+gridDim.x = (num_can + max_thread_per_block - 1) / max_thread_per_block
+blockDim.x = max_thread_per_block
+
+@param
+can_idx: [num_can], beam_id * shortlist_size + shortlist index, turned into
+  beam_id * vocab_size + vocab_id
+shortlist: [shortlist_size], ids in the vocab
+*/
+__global__ void ker_shortlist_to_vocab(int *can_idx, const int *shortlist,
+                                       int num_can, int vocab_size,
+                                       int shortlist_size) {
+  int i = blockIdx.x * blockDim.x + threadIdx.x;
+  if (i >= num_can) return;
+  int idx = can_idx[i];
+  can_idx[i] =
+      idx / shortlist_size * vocab_size + shortlist[idx % shortlist_size];
+}
+
+void launch_shortlist_to_vocab(int *can_idx, const int *shortlist,
+                               int num_can, int vocab_size,
+                               int shortlist_size, int max_thread_per_block,
+                               cudaStream_t stream) {
+  if (num_can == 0) return;
+  int grid_dim = (num_can + max_thread_per_block - 1) / max_thread_per_block;
+  ker_shortlist_to_vocab<<<grid_dim, max_thread_per_block, 0, stream>>>(
+      can_idx, shortlist, num_can, vocab_size, shortlist_size);
+}
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,33 @@
+#pragma once
+#include <cuda.h>
+#include <cuda_fp16.h>
+
+namespace lightseq {
+namespace cuda {
+
+/* Gather the columns of the vocab shortlist from a [rows, vocab_size]
+ * matrix, e.g. the tied embedding [hidden_size, vocab_size] or the logit
+ * bias with rows = 1, out: [rows, shortlist_size] */
+template <typename T>
+void launch_gather_vocab_columns(const T *in, T *out, const int *shortlist,
+                                 int rows, int vocab_size, int shortlist_size,
+                                 int max_thread_per_block,
+                                 cudaStream_t stream);
+
+/* Gather the rows of the vocab shortlist from a [vocab_size, cols] matrix,
+ * e.g. the embedding [vocab_size, hidden_size] tied with the source one,
+ * out: [shortlist_size, cols] */
+template <typename T>
+void launch_gather_vocab_rows(const T *in, T *out, const int *shortlist,
+                              int cols, int shortlist_size,
+                              int max_thread_per_block, cudaStream_t stream);
+
+/* Map the candidates of beam search from the shortlist to the full vocab,
+ * can_idx = beam_id * vocab_size + vocab_id */
+void launch_shortlist_to_vocab(int *can_idx, const int *shortlist,
+                               int num_can, int vocab_size,
+                               int shortlist_size, int max_thread_per_block,
+                               cudaStream_t stream);
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+#ifndef LS_HOST_DEVICE
+#ifdef __CUDACC__
+#define LS_HOST_DEVICE __host__ __device__
+#else
+#define LS_HOST_DEVICE
+#endif
+#endif
+
+/**
+@file
+Split-K (flash-decoding) self-attention of a decoder step. The cached keys
+of every (batch, beam, head) row are split into chunks, each handled by its
+own block, so that a small batch still fills the gpu and the number of
+steps is not bounded by the block size.
+
+Chunk i gives the max m_i of its scores, the sum l_i of exp(score - m_i)
+and its unnormalized output o_i = sum exp(score - m_i) * v. A second pass
+merges the chunks of a row:
+  m = max m_i, l = sum l_i * exp(m_i - m), out = sum o_i * exp(m_i - m) / l
+
+The split plan and the merge are CUDA-free so that they can be tested on
+host against the CPU reference below, the device kernels
+(ker_split_k_attention_decself in transformerKernels.cc.cu) share them.
+*/
+namespace lightseq {
+namespace cuda {
+
+// keys per block, their scores are kept in shared memory
+const int kSplitKMaxChunk = 1024;
+// below this a chunk does not amortize the merge
+const int kSplitKMinChunk = 64;
+const int kSplitKMaxSplits = 32;
+
+struct SplitKPlan {
+  int num_splits;
+  int chunk;  // keys per split, the last split may have less
+};
+
+/**
+Split of step_num keys for num_rows (batch * beam * head) rows on a gpu of
+num_sms multiprocessors: about two blocks per multiprocessor, chunks of at
+least kSplitKMinChunk keys and at most kSplitKMaxChunk. One split means the
+single block path is as good.
+*/
+inline SplitKPlan split_k_plan(int step_num, int num_rows, int num_sms) {
+  int min_splits = (step_num + kSplitKMaxChunk - 1) / kSplitKMaxChunk;
+  int fill_splits = (2 * num_sms + num_rows - 1) / std::max(num_rows, 1);
+  int splits = std::min(fill_splits, step_num / kSplitKMinChunk);
+  splits = std::max(min_splits, std::min(splits, kSplitKMaxSplits));
+  splits = std::max(splits, 1);
+  int chunk = (step_num + splits - 1) / splits;
+  // no empty split
+  return {(step_num + chunk - 1) / chunk, chunk};
+}
+
+/* Upper bound of num_rows * num_splits of split_k_plan for up to max_rows
+ * rows and max_step keys */
+inline long split_k_max_partials(int max_rows, int max_step, int num_sms) {
+  long min_splits = (max_step + kSplitKMaxChunk - 1) / kSplitKMaxChunk;
+  return std::max(max_rows * min_splits, 2L * num_sms + max_rows);
+}
+
+/**
+Merge the statistics {m_0, l_0, m_1, l_1, ...} of num_splits chunks into the
+max m and the sum l of the row.
+*/
+LS_HOST_DEVICE inline void split_k_merge_stats(const float *stats,
+                                               int num_splits, float *max,
+                                               float *sum) {
+  float m = stats[0];
+  for (int i = 1; i < num_splits; i++) m = fmaxf(m, stats[2 * i]);
+  float l = 0.f;
+  for (int i = 0; i < num_splits; i++) {
+    l += stats[2 * i + 1] * expf(stats[2 * i] - m);
+  }
+  *max = m;
+  *sum = l;
+}
+
+/**
+CPU reference, one decoder step of num_rows rows.
+q: [num_rows, dim], k and v: [num_rows, max_step, dim] of which the first
+step_num steps are used, out: [num_rows, dim]. The scores are
+scale * q . k.
+*/
+inline void split_k_attention_reference(const float *q, const float *k,
+                                        const float *v, int num_rows,
+                                        int step_num, int max_step, int dim,
+                                        float scale, const SplitKPlan &plan,
+                                        float *out) {
+  std::vector<float> stats(plan.num_splits * 2);
+  std::vector<float> partial(plan.num_splits * dim);
+  std::vector<float> p(plan.chunk);
+  for (int r = 0; r < num_rows; r++) {
+    const float *qr = q + (long)r * dim;
+    const float *kr = k + (long)r * max_step * dim;
+    const float *vr = v + (long)r * max_step * dim;
+    for (int s = 0; s < plan.num_splits; s++) {
+      int begin = s * plan.chunk;
+      int len = std::min(plan.chunk, step_num - begin);
+      float m = -INFINITY;
+      for (int j = 0; j < len; j++) {
+        float score = 0.f;
+        for (int d = 0; d < dim; d++) {
+          score += qr[d] * kr[(long)(begin + j) * dim + d];
+        }
+        p[j] = score * scale;
+        m = std::max(m, p[j]);
+      }
+      float l = 0.f;
+      for (int j = 0; j < len; j++) {
+        p[j] = expf(p[j] - m);
+        l += p[j];
+      }
+      for (int d = 0; d < dim; d++) {
+        float acc = 0.f;
+        for (int j = 0; j < len; j++) {
+          acc += p[j] * vr[(long)(begin + j) * dim + d];
+        }
+        partial[s * dim + d] = acc;
+      }
+      stats[2 * s] = m;
+      stats[2 * s + 1] = l;
+    }
+    float m, l;
+    split_k_merge_stats(stats.data(), plan.num_splits, &m, &l);
+    for (int d = 0; d < dim; d++) {
+      float acc = 0.f;
+      for (int s = 0; s < plan.num_splits; s++) {
+        acc += partial[s * dim + d] * expf(stats[2 * s] - m);
+      }
+      out[(long)r * dim + d] = acc / l;
+    }
+  }
+}
+
+}  // namespace cuda
+}  // namespace lightseq
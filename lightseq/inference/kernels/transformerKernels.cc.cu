@@ -107,13 +107,16 @@ max_step: max decode step
 length_norm: length penlty value for current step
 cur_step: current step
 diverse_lambda: lambda for diverse beam search
+can_end_id: id of end_id in the vocab of logits, differs from end_id with a
+    vocab shortlist
 */
 template <typename T, int beam_size>
 __global__ void select_beam_rough_topk(
     const T* logits, const T* logit_bias, const float* seq_probs,
     const float* seq_score, const int* alive_seq, int* can_idx,
     float* can_score, int* num_beam_can, int vocab_size, int max_step,
-    float length_norm, int cur_step, float diverse_lambda, int end_id) {
+    float length_norm, int cur_step, float diverse_lambda, int end_id,
+    int can_end_id) {
   if (cur_step != 0 && alive_seq[blockIdx.x * max_step + cur_step] == end_id) {
     // this is a finished beam
     if (threadIdx.x == 0) {
@@ -128,7 +131,8 @@ __global__ void select_beam_rough_topk(
         can_score[pos] = seq_score[blockIdx.x] +
                          (blockIdx.x - batch_id) * min_log_probability;
       }
-      can_idx[pos] = end_id + (blockIdx.x % beam_size) * vocab_size;  // EOS
+      can_idx[pos] =
+          can_end_id + (blockIdx.x % beam_size) * vocab_size;  // EOS
     }
     return;
   }
@@ -240,43 +244,44 @@ void select_beam_rough_topk_launcher(
     float* can_score, int* num_beam_can, int vocab_size, int max_step,
     float length_norm, int cur_step, int step_token_num,
     int max_thread_per_block, cudaStream_t stream, int beam_size,
-    float diverse_lambda, int end_id) {
+    float diverse_lambda, int end_id, int can_end_id) {
+  if (can_end_id < 0) can_end_id = end_id;
   if (beam_size == 1)
     select_beam_rough_topk<T, 1>
         <<<step_token_num, max_thread_per_block, 0, stream>>>(
             logits, logit_bias, seq_probs, seq_score, alive_seq, can_idx,
             can_score, num_beam_can, vocab_size, max_step, length_norm,
-            cur_step, diverse_lambda, end_id);
+            cur_step, diverse_lambda, end_id, can_end_id);
   if (beam_size == 2)
     select_beam_rough_topk<T, 2>
         <<<step_token_num, max_thread_per_block, 0, stream>>>(
             logits, logit_bias, seq_probs, seq_score, alive_seq, can_idx,
             can_score, num_beam_can, vocab_size, max_step, length_norm,
-            cur_step, diverse_lambda, end_id);
+            cur_step, diverse_lambda, end_id, can_end_id);
   if (beam_size == 4)
     select_beam_rough_topk<T, 4>
         <<<step_token_num, max_thread_per_block, 0, stream>>>(
             logits, logit_bias, seq_probs, seq_score, alive_seq, can_idx,
             can_score, num_beam_can, vocab_size, max_step, length_norm,
-            cur_step, diverse_lambda, end_id);
+            cur_step, diverse_lambda, end_id, can_end_id);
   if (beam_size == 8)
     select_beam_rough_topk<T, 8>
         <<<step_token_num, max_thread_per_block, 0, stream>>>(
             logits, logit_bias, seq_probs, seq_score, alive_seq, can_idx,
             can_score, num_beam_can, vocab_size, max_step, length_norm,
-            cur_step, diverse_lambda, end_id);
+            cur_step, diverse_lambda, end_id, can_end_id);
   if (beam_size == 16)
     select_beam_rough_topk<T, 16>
         <<<step_token_num, max_thread_per_block, 0, stream>>>(
             logits, logit_bias, seq_probs, seq_score, alive_seq, can_idx,
             can_score, num_beam_can, vocab_size, max_step, length_norm,
-            cur_step, diverse_lambda, end_id);
+            cur_step, diverse_lambda, end_id, can_end_id);
   if (beam_size == 32)
     select_beam_rough_topk<T, 32>
         <<<step_token_num, max_thread_per_block, 0, stream>>>(
             logits, logit_bias, seq_probs, seq_score, alive_seq, can_idx,
             can_score, num_beam_can, vocab_size, max_step, length_norm,
-            cur_step, diverse_lambda, end_id);
+            cur_step, diverse_lambda, end_id, can_end_id);
 }
 
 template void select_beam_rough_topk_launcher<float>(
@@ -285,7 +290,7 @@ template void select_beam_rough_topk_launcher<float>(
     float* can_score, int* num_beam_can, int vocab_size, int max_step,
     float length_norm, int cur_step, int step_token_num,
     int max_thread_per_block, cudaStream_t stream, int beam_size,
-    float diverse_lambda, int end_id);
+    float diverse_lambda, int end_id, int can_end_id);
 
 template void select_beam_rough_topk_launcher<__half>(
     const __half* logits, const __half* logit_bias, const float* seq_probs,
@@ -293,7 +298,7 @@ template void select_beam_rough_topk_launcher<__half>(
     float* can_score, int* num_beam_can, int vocab_size, int max_step,
     float length_norm, int cur_step, int step_token_num,
     int max_thread_per_block, cudaStream_t stream, int beam_size,
-    float diverse_lambda, int end_id);
+    float diverse_lambda, int end_id, int can_end_id);
 
 /**
 @brief: ker_diverse_beam_search
@@ -1222,6 +1227,141 @@ template void ker_correlation_softmax_decself_launcher<float>(
 template void ker_correlation_softmax_decself_launcher<__half>(
     int batch_head_num, int step_num, cudaStream_t stream, __half* correlation);
 
+/**
+@brief: ker_split_k_attention_decself
+partial decoder self attention of a chunk of the cached keys, see
+split_k_attention.h
+
+@thread
+gridDim.x = batch_size * beam_size * head_num
+gridDim.y = num_splits
+blockDim.x = kSplitKBlockDim
+
+@param
+q: [batch_size, beam_size, head_num, dim_per_head]
+k, v: [batch_size, beam_size, head_num, max_step, dim_per_head]
+partial_out: [batch_size, beam_size, head_num, num_splits, dim_per_head]
+partial_stats: [batch_size, beam_size, head_num, num_splits, 2], the max and
+  the exp sum of the scores of each chunk
+step_num: number of the cached keys, cur_step + 1
+chunk: keys per split
+*/
+template <typename T>
+__global__ void ker_split_k_attention_decself(
+    const T* q, const T* k, const T* v, float* partial_out,
+    float* partial_stats, int step_num, int chunk, int max_step,
+    int dim_per_head, float scale) {
+  extern __shared__ float s_split_k[];
+  float* s_q = s_split_k;                 // [dim_per_head]
+  float* s_p = s_split_k + dim_per_head;  // [chunk]
+  __shared__ float s_max, s_sum;
+
+  int row = blockIdx.x;
+  int begin = blockIdx.y * chunk;
+  int len = min(chunk, step_num - begin);
+  const T* k_row = k + ((long)row * max_step + begin) * dim_per_head;
+  const T* v_row = v + ((long)row * max_step + begin) * dim_per_head;
+
+  for (int d = threadIdx.x; d < dim_per_head; d += blockDim.x) {
+    s_q[d] = (float)q[row * dim_per_head + d] * scale;
+  }
+  __syncthreads();
+
+  // a warp per key
+  int lane = threadIdx.x & 0x1f;
+  int num_warps = blockDim.x >> 5;
+  for (int j = threadIdx.x >> 5; j < len; j += num_warps) {
+    float score = 0.f;
+    for (int d = lane; d < dim_per_head; d += WARP_SIZE) {
+      score += s_q[d] * (float)k_row[j * dim_per_head + d];
+    }
+    score = warpReduceSum(score);
+    if (lane == 0) s_p[j] = score;
+  }
+  __syncthreads();
+
+  float val = CUDA_FLOAT_INF_NEG;
+  for (int j = threadIdx.x; j < len; j += blockDim.x) val = fmaxf(val, s_p[j]);
+  float max_val = blockReduceMax(val);
+  if (threadIdx.x == 0) s_max = max_val;
+  __syncthreads();
+
+  val = 0.f;
+  for (int j = threadIdx.x; j < len; j += blockDim.x) {
+    s_p[j] = expf(s_p[j] - s_max);
+    val += s_p[j];
+  }
+  float sum_val = blockReduceSum(val);
+  if (threadIdx.x == 0) s_sum = sum_val;
+  __syncthreads();
+
+  long out_row = (long)row * gridDim.y + blockIdx.y;
+  for (int d = threadIdx.x; d < dim_per_head; d += blockDim.x) {
+    float acc = 0.f;
+    for (int j = 0; j < len; j++) {
+      acc += s_p[j] * (float)v_row[j * dim_per_head + d];
+    }
+    partial_out[out_row * dim_per_head + d] = acc;
+  }
+  if (threadIdx.x == 0) {
+    partial_stats[out_row * 2] = s_max;
+    partial_stats[out_row * 2 + 1] = s_sum;
+  }
+}
+
+/**
+@brief: ker_split_k_attention_merge
+merge the chunks of ker_split_k_attention_decself
+
+@thread
+gridDim.x = batch_size * beam_size * head_num
+blockDim.x = dim_per_head
+
+@param
+output: [batch_size, beam_size, head_num, dim_per_head]
+*/
+template <typename T>
+__global__ void ker_split_k_attention_merge(const float* partial_out,
+                                            const float* partial_stats,
+                                            T* output, int num_splits) {
+  int row = blockIdx.x;
+  const float* stats = partial_stats + (long)row * num_splits * 2;
+  float max_val, sum_val;
+  split_k_merge_stats(stats, num_splits, &max_val, &sum_val);
+  const float* out = partial_out + (long)row * num_splits * blockDim.x;
+  float acc = 0.f;
+  for (int i = 0; i < num_splits; i++) {
+    acc += out[i * blockDim.x + threadIdx.x] * expf(stats[2 * i] - max_val);
+  }
+  output[row * blockDim.x + threadIdx.x] = (T)(acc / sum_val);
+}
+
+template <typename T>
+void ker_split_k_attention_decself_launcher(
+    int batch_head_num, int step_num, int max_step, int dim_per_head,
+    float scale, const SplitKPlan& plan, cudaStream_t stream, const T* q,
+    const T* k, const T* v, float* partial_buf, T* output) {
+  float* partial_stats =
+      partial_buf + (long)batch_head_num * plan.num_splits * dim_per_head;
+  size_t smem = (dim_per_head + plan.chunk) * sizeof(float);
+  ker_split_k_attention_decself<T>
+      <<<dim3(batch_head_num, plan.num_splits), kSplitKBlockDim, smem,
+         stream>>>(q, k, v, partial_buf, partial_stats, step_num, plan.chunk,
+                   max_step, dim_per_head, scale);
+  ker_split_k_attention_merge<T><<<batch_head_num, dim_per_head, 0, stream>>>(
+      partial_buf, partial_stats, output, plan.num_splits);
+}
+
+template void ker_split_k_attention_decself_launcher<float>(
+    int batch_head_num, int step_num, int max_step, int dim_per_head,
+    float scale, const SplitKPlan& plan, cudaStream_t stream, const float* q,
+    const float* k, const float* v, float* partial_buf, float* output);
+
+template void ker_split_k_attention_decself_launcher<__half>(
+    int batch_head_num, int step_num, int max_step, int dim_per_head,
+    float scale, const SplitKPlan& plan, cudaStream_t stream, const __half* q,
+    const __half* k, const __half* v, float* partial_buf, __half* output);
+
 /**
 @brief: ker_correlation_softmax_encdec
 query-key correlation softmax for encoder-decoder attention
@@ -1376,7 +1516,7 @@ sorted candidate
 @thread
 gridDim.x = batch_size
 gridDim.y = beam_size
-blockDim.x = max_step
+blockDim.x = min(max_step, max_thread_per_block)
 
 @param
 can_idx: [none], no certain length, determined by rough candidate number
@@ -1394,6 +1534,7 @@ num_finish_beam: record current finished beam.
 vocab_size: target vocabulary size
 cur_step: current step
 length_norm: length penlty norm value
+max_step: length of the alive seqs
 */
 __global__ void ker_refresh_result(const int* can_idx, const float* can_score,
                                    const int* num_can_per_beam,
@@ -1401,7 +1542,8 @@ __global__ void ker_refresh_result(const int* can_idx, const float* can_score,
                                    float* seq_probs, float* seq_score,
                                    int* num_finish_beam, int vocab_size,
                                    int cur_step, float length_norm,
-                                   float diverse_lambda, int end_id) {
+                                   float diverse_lambda, int end_id,
+                                   int max_step) {
   // step1 update alive_seq
   int can_pos = num_can_per_beam[blockIdx.x * gridDim.y] + blockIdx.y;
   int ori_can_idx = can_idx[can_pos];  // can_beam_id * vocab_size + vocab_id
@@ -1412,19 +1554,21 @@ __global__ void ker_refresh_result(const int* can_idx, const float* can_score,
     rank_id = can_beam_id / gridDim.y;  // rank in each beam
     can_beam_id %= gridDim.y;
   }
-  int thread_vocab_id;
-  if (threadIdx.x > cur_step + 1) {
-    thread_vocab_id = end_id;
-  } else if (threadIdx.x == cur_step + 1) {
-    // add current step generate vocabulary id
-    thread_vocab_id = can_vocab_id;
-  } else {
-    // threadIdx.x <= cur_step
-    thread_vocab_id = old_alive_seq[targetid_3dim(
-        blockIdx.x, can_beam_id, threadIdx.x, gridDim.y, blockDim.x)];
+  for (int i = threadIdx.x; i < max_step; i += blockDim.x) {
+    int thread_vocab_id;
+    if (i > cur_step + 1) {
+      thread_vocab_id = end_id;
+    } else if (i == cur_step + 1) {
+      // add current step generate vocabulary id
+      thread_vocab_id = can_vocab_id;
+    } else {
+      // i <= cur_step
+      thread_vocab_id = old_alive_seq[targetid_3dim(
+          blockIdx.x, can_beam_id, i, gridDim.y, max_step)];
+    }
+    new_alive_seq[targetid_3dim(blockIdx.x, blockIdx.y, i, gridDim.y,
+                                max_step)] = thread_vocab_id;
   }
-  new_alive_seq[targetid_3dim(blockIdx.x, blockIdx.y, threadIdx.x, gridDim.y,
-                              blockDim.x)] = thread_vocab_id;
 
   // step2 update seq_probs if alive seq when not eos
   if (can_vocab_id != end_id) {
@@ -1449,7 +1593,7 @@ __global__ void ker_refresh_result(const int* can_idx, const float* can_score,
     atomicAdd(num_finish_beam, 1);
   }
   int seq_last_id = old_alive_seq[targetid_3dim(
-      blockIdx.x, can_beam_id, cur_step, gridDim.y, blockDim.x)];
+      blockIdx.x, can_beam_id, cur_step, gridDim.y, max_step)];
   // update finished seq score
   if (threadIdx.x == 0) {
     // note, with batch offset value, to sort between batch element
@@ -1711,20 +1855,23 @@ simply output the beam0 as final result
 
 @thread
 gridDim.x = batch_size
-blockDim.x = cur_step + 1
+blockDim.x = min(cur_step + 1, max_thread_per_block)
 
 @param
 alive_seq: [batch_size, beam_size, max_step], <start> is the first token in
 each beam
 output: [batch_size, cur_step + 1], no <start> and at least one <eos> in the
 last of seq
+seq_len: cur_step + 1
 */
 __global__ void ker_write_trg_tokenid_pos_penalty(const int* alive_seq,
                                                   float* seq_score, int* output,
-                                                  int max_step, int beam_size) {
-  int target_id =
-      targetid_3dim(blockIdx.x, 0, threadIdx.x + 1, beam_size, max_step);
-  output[blockIdx.x * blockDim.x + threadIdx.x] = alive_seq[target_id];
+                                                  int max_step, int beam_size,
+                                                  int seq_len) {
+  for (int i = threadIdx.x; i < seq_len; i += blockDim.x) {
+    int target_id = targetid_3dim(blockIdx.x, 0, i + 1, beam_size, max_step);
+    output[blockIdx.x * seq_len + i] = alive_seq[target_id];
+  }
   if (threadIdx.x == 0) {
     seq_score[blockIdx.x] =
         seq_score[blockIdx.x * beam_size] - blockIdx.x * min_log_probability;
@@ -1739,7 +1886,7 @@ compute each beam's score and select the top beam
 
 @thread
 gridDim.x = batch_size
-blockDim.x = cur_step + 1
+blockDim.x = min(cur_step + 1, max_thread_per_block)
 
 @param
 alive_seq: [batch_size, beam_size, max_step], <start> is the first token in
@@ -1748,12 +1895,13 @@ seq_score: [batch_size, beam_size], the length_penlty < 0, seq_score is also
 the sum_log_probs
 output: [batch_size, cur_step + 1], no <start> and at least one <eos> in the
 last of seq
+seq_len: cur_step + 1
 */
 __global__ void ker_write_trg_tokenid_neg_penalty(const int* alive_seq,
                                                   const float* seq_score,
                                                   int* output, int max_step,
                                                   int beam_size, int vocab_size,
-                                                  int end_id) {
+                                                  int end_id, int seq_len) {
   __shared__ float seq_final_score;
   __shared__ int res_beam_id;
   if (threadIdx.x == 0) {
@@ -1761,14 +1909,17 @@ __global__ void ker_write_trg_tokenid_neg_penalty(const int* alive_seq,
     res_beam_id = 0;
   }
   for (int beam_id = 0; beam_id < beam_size; beam_id++) {
-    int target_id = targetid_3dim(blockIdx.x, beam_id, threadIdx.x + 1,
-                                  beam_size, max_step);
-    int seq_len =
-        blockReduceSum(int(alive_seq[target_id] != end_id));  // compute seq len
+    int thread_len = 0;
+    for (int i = threadIdx.x; i < seq_len; i += blockDim.x) {
+      int target_id =
+          targetid_3dim(blockIdx.x, beam_id, i + 1, beam_size, max_step);
+      thread_len += int(alive_seq[target_id] != end_id);
+    }
+    int beam_len = blockReduceSum(thread_len);  // compute seq len
     if (threadIdx.x == 0) {
       float cur_beam_score = seq_score[blockIdx.x * beam_size + beam_id] -
                              blockIdx.x * min_log_probability;  // recover prob
-      cur_beam_score /= (float(seq_len) + epsilon);
+      cur_beam_score /= (float(beam_len) + epsilon);
       if (cur_beam_score > seq_final_score) {
         seq_final_score = cur_beam_score;
         res_beam_id = beam_id;
@@ -1776,9 +1927,11 @@ __global__ void ker_write_trg_tokenid_neg_penalty(const int* alive_seq,
     }
     __syncthreads();
   }
-  int target_id = targetid_3dim(blockIdx.x, res_beam_id, threadIdx.x + 1,
-                                beam_size, max_step);
-  output[blockIdx.x * blockDim.x + threadIdx.x] = alive_seq[target_id];
+  for (int i = threadIdx.x; i < seq_len; i += blockDim.x) {
+    int target_id =
+        targetid_3dim(blockIdx.x, res_beam_id, i + 1, beam_size, max_step);
+    output[blockIdx.x * seq_len + i] = alive_seq[target_id];
+  }
   // output[blockIdx.x * blockDim.x + threadIdx.x] =
   // int(seq_final_score[threadIdx.x]);
 }
@@ -1790,7 +1943,7 @@ for length_penlty > 0
 
 @thread
 gridDim.x = batch_size * beam_size
-blockDim.x = cur_step + 1
+blockDim.x = min(cur_step + 1, max_thread_per_block)
 
 @param
 alive_seq: [batch_size, beam_size, max_step], <start> is the first token in
@@ -1799,15 +1952,19 @@ seq_score: [batch_size, beam_size]
 seq_probs: [batch_size, beam_size]
 output: [batch_size, cur_step + 1], no <start> and at least one <eos> in the
 last of seq
+seq_len: cur_step + 1
 */
 __global__ void ker_write_topk_result(const int* alive_seq, float* seq_score,
                                       int* res_seq, int vocab_size,
-                                      int max_step, int beam_size, int end_id) {
-  res_seq[blockIdx.x * blockDim.x + threadIdx.x] =
-      alive_seq[blockIdx.x * max_step + threadIdx.x + 1];
+                                      int max_step, int beam_size, int end_id,
+                                      int seq_len) {
+  for (int i = threadIdx.x; i < seq_len; i += blockDim.x) {
+    // the last token is written by its own thread, no race with thread 0
+    res_seq[blockIdx.x * seq_len + i] =
+        i == seq_len - 1 ? end_id : alive_seq[blockIdx.x * max_step + i + 1];
+  }
   if (threadIdx.x == 0) {
     seq_score[blockIdx.x] -= (blockIdx.x / beam_size) * min_log_probability;
-    res_seq[blockIdx.x * blockDim.x + blockDim.x - 1] = end_id;
   }
 }
 
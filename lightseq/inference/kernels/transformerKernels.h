@@ -4,6 +4,8 @@
 #include <curand_kernel.h>
 #include <cub/cub.cuh>
 
+#include "split_k_attention.h"
+
 namespace lightseq {
 namespace cuda {
 
@@ -36,7 +38,7 @@ void select_beam_rough_topk_launcher(
     float* can_score, int* num_beam_can, int vocab_size, int max_step,
     float length_norm, int cur_step, int step_token_num,
     int max_thread_per_block, cudaStream_t stream, int beam_size,
-    float diverse_lambda, int end_id);
+    float diverse_lambda, int end_id, int can_end_id = -1);
 
 void ker_diverse_beam_search_launcher(float* can_score, int* can_ids,
                                       int* num_beam_can, int step_token_num,
@@ -99,6 +101,17 @@ void ker_correlation_softmax_decself_launcher(int batch_head_num, int step_num,
                                               cudaStream_t stream,
                                               T* correlation);
 
+const int kSplitKBlockDim = 128;
+
+/* Decoder self attention split over the cached keys, see
+ * split_k_attention.h. partial_buf holds
+ * batch_head_num * plan.num_splits * (dim_per_head + 2) floats */
+template <typename T>
+void ker_split_k_attention_decself_launcher(
+    int batch_head_num, int step_num, int max_step, int dim_per_head,
+    float scale, const SplitKPlan& plan, cudaStream_t stream, const T* q,
+    const T* k, const T* v, float* partial_buf, T* output);
+
 template <typename T>
 void ker_correlation_softmax_encdec_launcher(
     int batch_size, int head_num_per_seq, int batch_seq_len,
@@ -117,22 +130,24 @@ __global__ void ker_refresh_result(const int* can_idx, const float* can_score,
                                    float* seq_probs, float* seq_score,
                                    int* num_finish_beam, int vocab_size,
                                    int cur_step, float length_norm,
-                                   float diverse_lambda, int end_id);
+                                   float diverse_lambda, int end_id,
+                                   int max_step);
 
 __global__ void ker_write_trg_tokenid_pos_penalty(const int* alive_seq,
                                                   float* seq_scores,
                                                   int* output, int max_step,
-                                                  int beam_size);
+                                                  int beam_size, int seq_len);
 
 __global__ void ker_write_trg_tokenid_neg_penalty(const int* alive_seq,
                                                   const float* seq_score,
                                                   int* output, int max_step,
                                                   int beam_size, int vocab_size,
-                                                  int end_id);
+                                                  int end_id, int seq_len);
 
 __global__ void ker_write_topk_result(const int* alive_seq, float* seq_score,
                                       int* res_seq, int vocab_size,
-                                      int max_step, int beam_size, int end_id);
+                                      int max_step, int beam_size, int end_id,
+                                      int seq_len);
 
 __forceinline__ __host__ __device__ float length_norm(int length, float alpha) {
   if (alpha < 0.f) return 1.f / length;
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdexcept>
+#include <vector>
+
+/**
+@file
+Slot bookkeeping of the shrinking-batch beam search of Decoder, CUDA-free so
+that it can be tested on host.
+
+The live batch items are kept in the dense prefix [0, num_live) of the
+decoder buffers, slot i holding the original batch item live_items()[i].
+When the beams of some items are all finished, their results are saved at
+their original positions and the holes they leave in the prefix are filled
+by the live items of the tail. A move never reads a slot that another move
+of the same compaction writes, so the moves can be applied in place and in
+parallel.
+*/
+namespace lightseq {
+namespace cuda {
+
+/* Batch item src is copied to dst */
+struct BatchMove {
+  int src;
+  int dst;
+};
+
+class BatchCompaction {
+ public:
+  void reset(int batch_size) {
+    _live_items.resize(batch_size);
+    for (int i = 0; i < batch_size; i++) _live_items[i] = i;
+    _batch_size = batch_size;
+  }
+
+  int batch_size() const { return _batch_size; }
+  int num_live() const { return _live_items.size(); }
+  bool compacted() const { return num_live() < _batch_size; }
+  // slot -> original batch item
+  const std::vector<int>& live_items() const { return _live_items; }
+
+  /**
+  Drop the slots whose finished flag is set.
+  saves: (slot, original item) of the dropped slots, their results should be
+    saved before the moves are applied
+  moves: (src slot, dst slot) filling the dropped slots of the new prefix
+    from the tail, src >= num_live() > dst after the call
+  */
+  void drop(const std::vector<int>& finished, std::vector<BatchMove>* saves,
+            std::vector<BatchMove>* moves) {
+    int n = num_live();
+    if ((int)finished.size() < n) {
+      throw std::runtime_error("finished flags fewer than the live slots");
+    }
+    saves->clear();
+    moves->clear();
+    int num_finished = 0;
+    for (int i = 0; i < n; i++) {
+      if (finished[i]) {
+        saves->push_back({i, _live_items[i]});
+        num_finished++;
+      }
+    }
+    int new_live = n - num_finished;
+    // live slots of the tail fill the finished slots of the prefix in order
+    int tail = new_live;
+    for (int i = 0; i < new_live; i++) {
+      if (!finished[i]) continue;
+      while (finished[tail]) tail++;
+      moves->push_back({tail, i});
+      _live_items[i] = _live_items[tail];
+      tail++;
+    }
+    _live_items.resize(new_live);
+  }
+
+  /* (slot, original item) of the live slots, to scatter them back to their
+   * original positions at the end */
+  std::vector<BatchMove> scatter_moves() const {
+    std::vector<BatchMove> res;
+    for (int i = 0; i < num_live(); i++) res.push_back({i, _live_items[i]});
+    return res;
+  }
+
+ private:
+  int _batch_size = 0;
+  std::vector<int> _live_items;
+};
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -1,5 +1,8 @@
 #include "bert_encoder.h"
+#include "../kernels/batchCompactKernels.h"
+#include "../kernels/earlyExitKernels.h"
 #include "../kernels/embKernels.h"
+#include "../kernels/poolingKernels.h"
 #include "../kernels/transformerKernels.h"
 
 /**
@@ -27,11 +30,76 @@ BertEncoder<OpType_>::BertEncoder(int max_batch_size, const int *p_d_token_id,
       _hd(hd),
       _p_d_src_emb_wei(tw.get_src_emb_wei()),
       _p_d_enc_wei(tw.get_enc_wei()),
+      _p_d_exit_wei(tw.get_exit_wei()),
+      _p_d_exit_logits(nullptr),
+      _p_d_exit_layer(nullptr),
+      _exit_hidden_used(false),
+      _exit_mask_used(false),
+      _p_d_cls(nullptr),
+      _p_d_head_out(nullptr),
+      _p_d_slot_logits(nullptr),
+      _p_d_exit_finished(nullptr),
+      _p_d_exit_moves(nullptr),
+      _p_d_exit_hidden(nullptr),
+      _p_d_exit_mask(nullptr),
+      _pooling_mode(tw._pooling_mode),
+      _p_d_pooled_output(nullptr),
       _fone((_DataType)1.f),
       _fzero((_DataType)0.f),
       _atten_scaler((_DataType)sqrt(1.f / tw._dim_per_head)),
       _max_batch_dim(max_batch_size * tw._max_step * tw._hidden_size),
-      _max_thread_per_block(1024) {}
+      _max_thread_per_block(1024),
+      _stage_timer(nullptr),
+      _stage_emb(-1),
+      _stage_norm(-1),
+      _stage_attn(tw._n_enc_layer, -1),
+      _stage_ffn(tw._n_enc_layer, -1),
+      _stage_exit(-1),
+      _stage_pooling(-1) {}
+
+/**
+Register the timed stages of encoder, embedding, attention and ffn of every
+layer, the output layer norm, the exit checks and the pooling
+*/
+template <OperationType OpType_>
+void BertEncoder<OpType_>::set_stage_timer(CudaStageTimer *timer) {
+  _stage_timer = timer;
+  _stage_emb = timer->stage_id("bert.embedding");
+  _stage_norm = timer->stage_id("bert.output_norm");
+  _stage_attn = timer->layer_stage_ids("bert", "attention", _tw._n_enc_layer);
+  _stage_ffn = timer->layer_stage_ids("bert", "ffn", _tw._n_enc_layer);
+  _stage_exit = timer->stage_id("bert.early_exit");
+  _stage_pooling = timer->stage_id("bert.pooling");
+}
+
+/**
+Exit criterion of the following infers, see early_exit.h. Without criterion
+all the samples run to the last layer, the heads still classify them.
+*/
+template <OperationType OpType_>
+void BertEncoder<OpType_>::set_early_exit(const EarlyExitConfig &config) {
+  std::string res = config.check();
+  if (!res.empty()) {
+    throw std::runtime_error(res);
+  }
+  if (config.enabled() && _tw._num_labels == 0) {
+    throw std::runtime_error("early exit needs a model with exit heads");
+  }
+  _exit_config = config;
+}
+
+/**
+Pooled output of the following infers, see pooling.h. The full hidden states
+are still written to _p_d_output.
+*/
+template <OperationType OpType_>
+void BertEncoder<OpType_>::set_pooling_mode(int mode) {
+  std::string res = check_pooling_mode(mode);
+  if (!res.empty()) {
+    throw std::runtime_error(res);
+  }
+  _pooling_mode = mode;
+}
 
 /**
 Compute GPU memory size needed by transformer encoder,
@@ -61,6 +129,28 @@ void BertEncoder<OpType_>::init_buffer(void *pbuf) {
   _p_d_c = _p_d_v + _max_batch_dim;
   _p_d_ffn_buf1 = p_d_buf;
   _p_d_ffn_buf2 = _p_d_ffn_buf1 + _max_batch_dim;
+
+  // without exit heads every sample runs all the layers
+  _h_exit_layer.assign(_max_batch_size, _tw._n_enc_layer);
+  if (_tw._num_labels > 0) {
+    int max_logits = _max_batch_size * _tw._num_labels;
+    _h_exit_finished.resize(_max_batch_size);
+    CHECK_GPU_ERROR(cudaMalloc((void **)&_p_d_cls, _max_batch_size *
+                                                       _tw._hidden_size *
+                                                       sizeof(_DataType)));
+    CHECK_GPU_ERROR(cudaMalloc((void **)&_p_d_head_out,
+                               max_logits * sizeof(_DataType)));
+    CHECK_GPU_ERROR(
+        cudaMalloc((void **)&_p_d_slot_logits, max_logits * sizeof(float)));
+    CHECK_GPU_ERROR(cudaMalloc((void **)&_p_d_exit_finished,
+                               _max_batch_size * sizeof(int)));
+    CHECK_GPU_ERROR(cudaMalloc((void **)&_p_d_exit_moves,
+                               _max_batch_size * 4 * sizeof(int)));
+    CHECK_GPU_ERROR(cudaMalloc((void **)&_p_d_exit_hidden,
+                               _max_batch_dim * sizeof(_DataType)));
+    CHECK_GPU_ERROR(cudaMalloc((void **)&_p_d_exit_mask,
+                               _max_batch_size * _tw._max_step * sizeof(int)));
+  }
   return;
 }
 
@@ -90,6 +180,9 @@ std::string BertEncoder<OpType_>::check() {
   if (_tw._multilg_type != 0 && _p_d_lang_id == nullptr) {
     return "lang id should not be null when multilg";
   }
+  if (_p_d_exit_wei.size() != _tw._exit_layers.size() * 2) {
+    return "violate p_d_exit_wei.size() = exit_head_num * 2";
+  }
   return "";
 }
 
@@ -108,6 +201,12 @@ void BertEncoder<OpType_>::run_one_infer(int batch_size, int batch_seq_len) {
   _batch_size = batch_size;
   _batch_seq_len = batch_seq_len;
   _batch_token_num = batch_size * batch_seq_len;
+  bool early_exit = _tw._num_labels > 0;
+  if (early_exit) {
+    _compaction.reset(batch_size);
+    _exit_hidden_used = false;
+    _exit_mask_used = false;
+  }
 #ifdef DEBUG_RESULT
   std::cout << "batch_size-" << batch_size << " batch_seq_len-" << batch_seq_len
             << std::endl;
@@ -115,11 +214,14 @@ void BertEncoder<OpType_>::run_one_infer(int batch_size, int batch_seq_len) {
 #endif
 
   /* ---step2. encoder feedforward--- */
-  launch_enc_emb<_DataType>(_p_d_src_emb_wei[0], _p_d_src_emb_wei[1],
-                            _p_d_token_id, _p_d_output, _p_d_padding_mask,
-                            _tw._padding_id, batch_size, batch_seq_len,
-                            _tw._hidden_size, _stream, _p_d_src_emb_wei[4],
-                            _p_d_lang_id, _tw._multilg_type);
+  {
+    CudaStageScope scope(_stage_timer, _stage_emb, _stream);
+    launch_enc_emb<_DataType>(_p_d_src_emb_wei[0], _p_d_src_emb_wei[1],
+                              _p_d_token_id, _p_d_output, _p_d_padding_mask,
+                              _tw._padding_id, batch_size, batch_seq_len,
+                              _tw._hidden_size, _stream, _p_d_src_emb_wei[4],
+                              _p_d_lang_id, _tw._multilg_type);
+  }
 #ifdef DEBUG_RESULT
   for (int i = 0; i < _batch_size; i++) {       // batch_id
     for (int j = 0; j < _batch_seq_len; j++) {  // token_id
@@ -132,13 +234,62 @@ void BertEncoder<OpType_>::run_one_infer(int batch_size, int batch_seq_len) {
 #endif
   for (_layer_id = 0; _layer_id < _tw._n_enc_layer; _layer_id++) {
     _weight_offset = _layer_id * _tw._weight_per_enc_layer;
-    self_attention();
-    ffn_add_norm();
+    {
+      CudaStageScope scope(_stage_timer, _stage_attn[_layer_id], _stream);
+      self_attention();
+    }
+    {
+      CudaStageScope scope(_stage_timer, _stage_ffn[_layer_id], _stream);
+      ffn_add_norm();
+    }
+    // without criterion only the final classifier runs
+    int head = early_exit ? _tw._exit_head_of_layer[_layer_id] : -1;
+    if (head >= 0 &&
+        (_exit_config.enabled() || _layer_id == _tw._n_enc_layer - 1)) {
+      CudaStageScope scope(_stage_timer, _stage_exit, _stream);
+      exit_check(head);
+      if (_batch_size == 0) break;
+    }
+  }
+  if (early_exit) {
+    // restore the batch in its original order
+    if (_exit_hidden_used) {
+      CHECK_GPU_ERROR(cudaMemcpyAsync(
+          _p_d_output, _p_d_exit_hidden,
+          (long)batch_size * batch_seq_len * _tw._hidden_size *
+              sizeof(_DataType),
+          cudaMemcpyDeviceToDevice, _stream));
+    }
+    if (_exit_mask_used) {
+      CHECK_GPU_ERROR(cudaMemcpyAsync(
+          _p_d_padding_mask, _p_d_exit_mask,
+          (long)batch_size * batch_seq_len * sizeof(int),
+          cudaMemcpyDeviceToDevice, _stream));
+    }
+    _batch_size = batch_size;
+    _batch_token_num = batch_size * batch_seq_len;
+  }
+  if (_p_d_exit_layer != nullptr) {
+    CHECK_GPU_ERROR(cudaMemcpyAsync(_p_d_exit_layer, _h_exit_layer.data(),
+                                    batch_size * sizeof(int),
+                                    cudaMemcpyHostToDevice, _stream));
   }
   // last layer norm
-  ker_norm_layer_launcher<_DataType>(
-      _batch_token_num, _tw._hidden_size, _stream, _p_d_output,
-      _p_d_src_emb_wei[2], _p_d_src_emb_wei[3], _max_thread_per_block);
+  {
+    CudaStageScope scope(_stage_timer, _stage_norm, _stream);
+    ker_norm_layer_launcher<_DataType>(
+        _batch_token_num, _tw._hidden_size, _stream, _p_d_output,
+        _p_d_src_emb_wei[2], _p_d_src_emb_wei[3], _max_thread_per_block);
+  }
+  if (_pooling_mode != kPoolNone && _p_d_pooled_output != nullptr) {
+    CudaStageScope scope(_stage_timer, _stage_pooling, _stream);
+    // the padding mask is 1 at the pad tokens
+    launch_bert_pooling<_DataType>(_p_d_output, _p_d_padding_mask,
+                                   _p_d_pooled_output, batch_size,
+                                   batch_seq_len, _tw._hidden_size, 1,
+                                   _pooling_mode, _max_thread_per_block,
+                                   _stream);
+  }
 
 #ifdef DEBUG_RESULT
   for (int i = 0; i < _batch_size; i++) {       // batch_id
@@ -174,7 +325,7 @@ void BertEncoder<OpType_>::self_attention() {
 
   /* ---step 1. qkv = ori_q * qkv_wei + bias, and reshape qkv for multi-head
    * gemm--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size * 3, _batch_token_num,
       _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 2], _AType,
       _tw._hidden_size * 3, _p_d_q, _BType, _tw._hidden_size, &_fzero,
@@ -194,7 +345,7 @@ void BertEncoder<OpType_>::self_attention() {
       _tw._dim_per_head, _tw._head_num, _max_thread_per_block);
 
   /* ---step 2. correlation = q * k, perform softmax on correlation--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_T, CUBLAS_OP_N, _batch_seq_len, _batch_seq_len,
       _tw._dim_per_head, &_atten_scaler, _p_d_k, _AType, _tw._dim_per_head,
       _batch_seq_len * _tw._dim_per_head, _p_d_q, _BType, _tw._dim_per_head,
@@ -213,7 +364,7 @@ void BertEncoder<OpType_>::self_attention() {
 #endif
 
   /* ---step 3. new_q = correlation * v--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._dim_per_head, _batch_seq_len,
       _batch_seq_len, &_fone, _p_d_v, _AType, _tw._dim_per_head,
       _batch_seq_len * _tw._dim_per_head, _p_d_c, _BType, _batch_seq_len,
@@ -232,7 +383,7 @@ void BertEncoder<OpType_>::self_attention() {
 #endif
 
   /* ---step 4. new_q = ori_q + new_q * output_wei--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _batch_token_num,
       _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 4], _AType,
       _tw._hidden_size, _p_d_v, _BType, _tw._hidden_size, &_fone, _p_d_output,
@@ -267,21 +418,30 @@ void BertEncoder<OpType_>::ffn_add_norm() {
 #endif
 
   /* ---step 1. first ffn layer--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
-      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _batch_token_num,
-      _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 8], _AType,
-      _tw._inner_size, _p_d_ffn_buf1, _BType, _tw._hidden_size, &_fzero,
-      _p_d_ffn_buf2, _CType, _tw._inner_size, _computeType,
-      CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  if (!cublaslt_gemm_bias_act(
+          _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _batch_token_num,
+          _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 8],
+          _tw._inner_size, _p_d_ffn_buf1, _tw._hidden_size, &_fzero,
+          _p_d_ffn_buf2, _tw._inner_size, _p_d_enc_wei[_weight_offset + 9],
+          _AType, _computeType,
+          _tw._use_gelu ? GemmEpilogue::kBiasGelu
+                        : GemmEpilogue::kBiasRelu)) {
+    CHECK_GPU_ERROR(cublas_gemm_ex(
+        _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _batch_token_num,
+        _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 8], _AType,
+        _tw._inner_size, _p_d_ffn_buf1, _BType, _tw._hidden_size, &_fzero,
+        _p_d_ffn_buf2, _CType, _tw._inner_size, _computeType,
+        CUBLAS_GEMM_DEFAULT_TENSOR_OP));
 
-  if (_tw._use_gelu) {
-    ker_bias_gelu_launcher<_DataType>(
-        _batch_token_num, _max_thread_per_block, _stream, _p_d_ffn_buf2,
-        _p_d_enc_wei[_weight_offset + 9], _tw._inner_size);
-  } else {
-    ker_bias_relu_launcher<_DataType>(
-        _batch_token_num, _max_thread_per_block, _stream, _p_d_ffn_buf2,
-        _p_d_enc_wei[_weight_offset + 9], _tw._inner_size);
+    if (_tw._use_gelu) {
+      ker_bias_gelu_launcher<_DataType>(
+          _batch_token_num, _max_thread_per_block, _stream, _p_d_ffn_buf2,
+          _p_d_enc_wei[_weight_offset + 9], _tw._inner_size);
+    } else {
+      ker_bias_relu_launcher<_DataType>(
+          _batch_token_num, _max_thread_per_block, _stream, _p_d_ffn_buf2,
+          _p_d_enc_wei[_weight_offset + 9], _tw._inner_size);
+    }
   }
 
 #ifdef DEBUG_RESULT
@@ -291,7 +451,7 @@ void BertEncoder<OpType_>::ffn_add_norm() {
 #endif
 
   /* ---step 2. second ffn layer--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _batch_token_num,
       _tw._inner_size, &_fone, _p_d_enc_wei[_weight_offset + 10], _AType,
       _tw._hidden_size, _p_d_ffn_buf2, _BType, _tw._inner_size, &_fone,
@@ -300,6 +460,98 @@ void BertEncoder<OpType_>::ffn_add_norm() {
   return;
 }
 
+/**
+Exit check after the layer of exit head head: classify the [CLS] rows of the
+live samples, save the results of the confident ones and compact the batch.
+All the live samples exit at the last head.
+*/
+template <OperationType OpType_>
+void BertEncoder<OpType_>::exit_check(int head) {
+  bool last = head + 1 == (int)_tw._exit_layers.size();
+  int hidden_size = _tw._hidden_size, num_labels = _tw._num_labels;
+  int seq_dim = _batch_seq_len * hidden_size;
+
+  /* ---step 0. head input, [CLS] rows after the last layer norm--- */
+  CHECK_GPU_ERROR(cudaMemcpy2DAsync(
+      _p_d_cls, hidden_size * sizeof(_DataType), _p_d_output,
+      seq_dim * sizeof(_DataType), hidden_size * sizeof(_DataType),
+      _batch_size, cudaMemcpyDeviceToDevice, _stream));
+  ker_norm_layer_launcher<_DataType>(_batch_size, hidden_size, _stream,
+                                     _p_d_cls, _p_d_src_emb_wei[2],
+                                     _p_d_src_emb_wei[3],
+                                     _max_thread_per_block);
+
+  /* ---step 1. logits = cls * head_kernel + head_bias, exit decision--- */
+  CHECK_GPU_ERROR(cublas_gemm_ex(
+      _hd, CUBLAS_OP_N, CUBLAS_OP_N, num_labels, _batch_size, hidden_size,
+      &_fone, _p_d_exit_wei[head * 2], _AType, num_labels, _p_d_cls, _BType,
+      hidden_size, &_fzero, _p_d_head_out, _CType, num_labels, _computeType,
+      CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  launch_exit_decision<_DataType>(
+      _p_d_head_out, _p_d_exit_wei[head * 2 + 1], _p_d_slot_logits,
+      _p_d_exit_finished, _batch_size, num_labels, _exit_config.criterion,
+      _exit_config.threshold, last, _max_thread_per_block, _stream);
+  if (last) {
+    std::fill(_h_exit_finished.begin(), _h_exit_finished.begin() + _batch_size,
+              1);
+  } else {
+    CHECK_GPU_ERROR(cudaMemcpyAsync(
+        _h_exit_finished.data(), _p_d_exit_finished, _batch_size * sizeof(int),
+        cudaMemcpyDeviceToHost, _stream));
+    CHECK_GPU_ERROR(cudaStreamSynchronize(_stream));
+  }
+
+  std::vector<BatchMove> saves, moves;
+  _compaction.drop(_h_exit_finished, &saves, &moves);
+  if (saves.empty()) {
+    return;
+  }
+  for (const BatchMove &save : saves) {
+    _h_exit_layer[save.dst] = _tw._exit_layers[head] + 1;
+  }
+  std::vector<BatchMove> h_moves(saves);
+  h_moves.insert(h_moves.end(), moves.begin(), moves.end());
+  CHECK_GPU_ERROR(cudaMemcpyAsync(_p_d_exit_moves, h_moves.data(),
+                                  h_moves.size() * sizeof(BatchMove),
+                                  cudaMemcpyHostToDevice, _stream));
+  const int *p_d_saves = _p_d_exit_moves;
+  const int *p_d_moves = _p_d_exit_moves + saves.size() * 2;
+
+  /* ---step 2. save the results of the exited samples--- */
+  if (_p_d_exit_logits != nullptr) {
+    launch_move_batch_rows(_p_d_slot_logits, _p_d_exit_logits, p_d_saves,
+                           saves.size(), 1, 0, 1, num_labels, num_labels,
+                           sizeof(float), _max_thread_per_block, _stream);
+  }
+  // the hidden states stay in place until a sample exits before the end
+  _exit_hidden_used |= !last;
+  if (_exit_hidden_used) {
+    launch_move_batch_rows(_p_d_output, _p_d_exit_hidden, p_d_saves,
+                           saves.size(), 1, 0, 1, seq_dim, seq_dim,
+                           sizeof(_DataType), _max_thread_per_block, _stream);
+  }
+
+  /* ---step 3. move the live samples of the tail into the exited slots--- */
+  if (!moves.empty()) {
+    launch_move_batch_rows(_p_d_output, _p_d_output, p_d_moves, moves.size(),
+                           1, 0, 1, seq_dim, seq_dim, sizeof(_DataType),
+                           _max_thread_per_block, _stream);
+    if (!_exit_mask_used) {
+      CHECK_GPU_ERROR(cudaMemcpyAsync(
+          _p_d_exit_mask, _p_d_padding_mask,
+          (long)_compaction.batch_size() * _batch_seq_len * sizeof(int),
+          cudaMemcpyDeviceToDevice, _stream));
+      _exit_mask_used = true;
+    }
+    launch_move_batch_rows(_p_d_padding_mask, _p_d_padding_mask, p_d_moves,
+                           moves.size(), 1, 0, 1, _batch_seq_len,
+                           _batch_seq_len, sizeof(int), _max_thread_per_block,
+                           _stream);
+  }
+  _batch_size = _compaction.num_live();
+  _batch_token_num = _batch_size * _batch_seq_len;
+}
+
 template class BertEncoder<OperationType::FP16>;
 template class BertEncoder<OperationType::FP32>;
 
@@ -12,8 +12,13 @@
 #include <iostream>
 #include <string>
 
+#include "../kernels/early_exit.h"
+#include "../kernels/pooling.h"
 #include "../proto/bert_weight.h"
+#include "../tools/cuda_stage_timer.h"
+#include "../tools/gemm_dispatch.h"
 #include "../tools/util.h"
+#include "batch_compaction.h"
 
 /**
 @file
@@ -37,6 +42,7 @@ class BertEncoder {
   // private member function
   void self_attention();
   void ffn_add_norm();
+  void exit_check(int head);
 
   const int _max_batch_size;
   int *_p_d_padding_mask;  // true sequence length(remove padding), [batch_size]
@@ -67,6 +73,29 @@ class BertEncoder {
   // ffn_first_kernel, ffn_first_bias, ffn_second_kernel, ffn_second_bias} *
   // encoder_layer_num
   const std::vector<const _DataType *> &_p_d_enc_wei;
+  // {exit_head_kernel, exit_head_bias} * exit_head_num
+  const std::vector<const _DataType *> &_p_d_exit_wei;
+
+  // early exit of classification, see early_exit.h. The live samples are
+  // kept in the prefix of the batch, the hidden states of the exited ones
+  // are saved in _p_d_exit_hidden once the batch is reordered
+  EarlyExitConfig _exit_config;
+  BatchCompaction _compaction;
+  std::vector<int> _h_exit_finished;
+  std::vector<int> _h_exit_layer;
+  bool _exit_hidden_used;
+  // the padding mask of the input order, saved before the first move of the
+  // live samples and restored after the last layer
+  bool _exit_mask_used;
+  _DataType *_p_d_cls;          // [batch_size, hidden_size]
+  _DataType *_p_d_head_out;     // [batch_size, num_labels]
+  float *_p_d_slot_logits;      // [batch_size, num_labels]
+  int *_p_d_exit_finished;      // [batch_size]
+  int *_p_d_exit_moves;         // [batch_size * 2, 2]
+  _DataType *_p_d_exit_hidden;  // [batch_size, batch_seq_len, hidden_size]
+  int *_p_d_exit_mask;          // [batch_size, batch_seq_len]
+
+  int _pooling_mode;  // see pooling.h
 
   int _batch_size;
   int _batch_seq_len;
@@ -74,10 +103,27 @@ class BertEncoder {
   int _layer_id;
   int _weight_offset;
 
+  // per-stage timing, see cuda_stage_timer.h
+  CudaStageTimer *_stage_timer;
+  int _stage_emb;
+  int _stage_norm;
+  std::vector<int> _stage_attn;
+  std::vector<int> _stage_ffn;
+  int _stage_exit;
+  int _stage_pooling;
+
  public:
   const int *_p_d_token_id;  // input token id [batch_size, batch_seq_len]
   _DataType
       *_p_d_output;  // encoder output, [batch_size, batch_seq_len, hidden_size]
+  // logits of the exit head of every sample, [batch_size, num_labels], empty
+  // without exit heads, and the number of encoder layers it ran,
+  // [batch_size], all of them without exit heads
+  float *_p_d_exit_logits;
+  int *_p_d_exit_layer;
+  // pooled output, [batch_size, hidden_size], written unless the pooling
+  // mode is none
+  _DataType *_p_d_pooled_output;
 
   BertEncoder(int max_batch_size, const int *p_d_token_id,
               int *p_d_padding_mask, _DataType *p_d_output,
@@ -87,6 +133,10 @@ class BertEncoder {
   void init_buffer(void *pbuf);
   std::string check();
   void run_one_infer(int batch_size, int batch_seq_len);
+  void set_stage_timer(CudaStageTimer *timer);
+  void set_early_exit(const EarlyExitConfig &config);
+  void set_pooling_mode(int mode);
+  int pooling_mode() const { return _pooling_mode; }
 };
 
 }  // namespace cuda
@@ -5,6 +5,7 @@
 #include <cuda_fp16.h>
 #include <cublasLt.h>
 
+#include "gemm_dispatch.h"
 #include "transformerKernels_int8.h"
 #include "util.h"
 
@@ -103,9 +104,20 @@ void cublasLtMM_withAlgo(int* res, int batchCount, int m, int n, int k,
   int alphaI = 1;
   int betaI = 0;
 
+  cublasLtMatmulAlgo_t algo;
+  GemmKey key = {"i8i32i32",
+                 use_ORDER_COL32_2R_4R4 ? "col32_col32_2r_4r4"
+                                        : "col32_col4_4r2_8c",
+                 m, n, k, batchCount};
+  bool has_algo = cublaslt_find_algo(
+      cublasLt_handle, key, computeType, CUDA_R_32I, CUDA_R_8I, CUDA_R_8I,
+      CUDA_R_32I, matmulDesc, &alphaI, ATransform, AtransformDesc, kernel,
+      BtransformDesc, &betaI, res, CtransformDesc, stream, &algo);
+
   cublasLtMatmul(cublasLt_handle, matmulDesc, &alphaI, ATransform,
                  AtransformDesc, kernel, BtransformDesc, &betaI, res,
-                 CtransformDesc, res, CtransformDesc, NULL, NULL, 0, stream);
+                 CtransformDesc, res, CtransformDesc,
+                 has_algo ? &algo : NULL, NULL, 0, stream);
 
   cublasLtMatmulDescDestroy(matmulDesc);
   cublasLtMatrixLayoutDestroy(AtransformDesc);
@@ -212,10 +224,19 @@ void cublasLtMM_withAlgo_i8IO(int8_t* res, int batchCount, int m, int n, int k,
   }
 
   float beta = 0.0f;
-  CHECK_GPU_ERROR(cublasLtMatmul(cublasLt_handle, matmulDesc, &alpha,
-                                 ATransform, AtransformDesc, kernel,
-                                 BtransformDesc, &beta, res, CtransformDesc,
-                                 res, CtransformDesc, NULL, NULL, 0, stream));
+  cublasLtMatmulAlgo_t algo;
+  GemmKey key = {"i8i8i32",
+                 use_ORDER_COL32_2R_4R4 ? "col32_col32_2r_4r4"
+                                        : "col32_col4_4r2_8c",
+                 m, n, k, batchCount};
+  bool has_algo = cublaslt_find_algo(
+      cublasLt_handle, key, computeType, scaleType, CUDA_R_8I, CUDA_R_8I,
+      CUDA_R_8I, matmulDesc, &alpha, ATransform, AtransformDesc, kernel,
+      BtransformDesc, &beta, res, CtransformDesc, stream, &algo);
+  CHECK_GPU_ERROR(cublasLtMatmul(
+      cublasLt_handle, matmulDesc, &alpha, ATransform, AtransformDesc, kernel,
+      BtransformDesc, &beta, res, CtransformDesc, res, CtransformDesc,
+      has_algo ? &algo : NULL, NULL, 0, stream));
 
   CHECK_GPU_ERROR(cublasLtMatmulDescDestroy(matmulDesc));
   CHECK_GPU_ERROR(cublasLtMatrixLayoutDestroy(AtransformDesc));
@@ -309,9 +330,17 @@ void cublaslt_gemm(const int8_t* input_a, const int8_t* input_b,
   }
 
   ScaleType beta = ScaleType(0);
-  CHECK_GPU_ERROR(cublasLtMatmul(
-      cublasLt_handle, matmul_desc, &alpha, input_a, desc_a, input_b, desc_b,
-      &beta, output_c, desc_c, output_c, desc_c, NULL, NULL, 0, stream));
+  cublasLtMatmulAlgo_t algo;
+  GemmKey key = {std::is_same<OutType, int8_t>::value ? "i8i8i32" : "i8i32i32",
+                 "TN", m, n, k, batch_count};
+  bool has_algo = cublaslt_find_algo(
+      cublasLt_handle, key, compute_type, scale_dtype, CUDA_R_8I, CUDA_R_8I,
+      out_dtype, matmul_desc, &alpha, input_a, desc_a, input_b, desc_b, &beta,
+      output_c, desc_c, stream, &algo);
+  CHECK_GPU_ERROR(cublasLtMatmul(cublasLt_handle, matmul_desc, &alpha, input_a,
+                                 desc_a, input_b, desc_b, &beta, output_c,
+                                 desc_c, output_c, desc_c,
+                                 has_algo ? &algo : NULL, NULL, 0, stream));
 
   CHECK_GPU_ERROR(cublasLtMatmulDescDestroy(matmul_desc));
   CHECK_GPU_ERROR(cublasLtMatrixLayoutDestroy(desc_a));
@@ -437,5 +466,115 @@ template void quantize_weight<half>(const half* origin_weight,
                                     cudaStream_t stream,
                                     cublasLtHandle_t handle, Layout layout);
 
+/**
+ * @brief upload of a kernel already quantized on host, see quant_weight.h
+ *
+ * @param host_weight input int8 kernel data, row major
+ * @param quantized_weight output kernel data in layout
+ * @param rows
+ * @param cols
+ * @param stream
+ * @param handle
+ * @param layout layout to support different gemm
+ */
+void load_int8_weight(const int8_t* host_weight, int8_t* quantized_weight,
+                      int rows, int cols, cudaStream_t stream,
+                      cublasLtHandle_t handle, Layout layout) {
+  size_t size = (size_t)rows * cols * sizeof(int8_t);
+  if (layout == kRowMajor) {
+    CHECK_GPU_ERROR(cudaMemcpyAsync(quantized_weight, host_weight, size,
+                                    cudaMemcpyHostToDevice, stream));
+    return;
+  }
+  int8_t* temp;
+  CHECK_GPU_ERROR(cudaMalloc(&temp, size));
+  CHECK_GPU_ERROR(cudaMemcpyAsync(temp, host_weight, size,
+                                  cudaMemcpyHostToDevice, stream));
+  transform_weight_layout(temp, quantized_weight, rows, cols, layout, handle,
+                          stream);
+  CHECK_GPU_ERROR(cudaFree(temp));
+}
+
+/**
+ * @brief load_int8_weight through the cache of the transformed kernels, see
+ * int8_weight_cache.h
+ *
+ * @param host_weight input int8 kernel data, row major
+ * @param quantized_weight output kernel data in layout
+ * @param rows
+ * @param cols
+ * @param stream
+ * @param handle
+ * @param cache the cache of the model, from open_int8_weight_cache
+ * @param layout layout to support different gemm
+ */
+void load_int8_weight(const int8_t* host_weight, int8_t* quantized_weight,
+                      int rows, int cols, cudaStream_t stream,
+                      cublasLtHandle_t handle, Int8WeightCache* cache,
+                      Layout layout) {
+  if (!cache->enabled()) {
+    load_int8_weight(host_weight, quantized_weight, rows, cols, stream, handle,
+                     layout);
+    return;
+  }
+  size_t size = (size_t)rows * cols * sizeof(int8_t);
+  const std::vector<int8_t>* cached = cache->next(rows, cols, layout);
+  if (cached != nullptr) {
+    CHECK_GPU_ERROR(cudaMemcpyAsync(quantized_weight, cached->data(), size,
+                                    cudaMemcpyHostToDevice, stream));
+    return;
+  }
+  load_int8_weight(host_weight, quantized_weight, rows, cols, stream, handle,
+                   layout);
+  std::vector<int8_t> transformed(size);
+  CHECK_GPU_ERROR(cudaMemcpyAsync(transformed.data(), quantized_weight, size,
+                                  cudaMemcpyDeviceToHost, stream));
+  CHECK_GPU_ERROR(cudaStreamSynchronize(stream));
+  cache->add(rows, cols, layout, std::move(transformed));
+}
+
+/**
+ * @brief the cache of the transformed int8 kernels of a model, read from
+ * LS_INT8_WEIGHT_CACHE if it has one for this device
+ *
+ * @param name tells apart the models of the same weights
+ * @param weight_hash hash of the int8 weights of the model
+ */
+Int8WeightCache open_int8_weight_cache(const std::string& name,
+                                       uint64_t weight_hash) {
+  int device;
+  CHECK_GPU_ERROR(cudaGetDevice(&device));
+  cudaDeviceProp prop;
+  CHECK_GPU_ERROR(cudaGetDeviceProperties(&prop, device));
+  int arch = prop.major * 10 + prop.minor;
+  std::string path = int8_weight_cache_path(name, weight_hash, arch);
+  if (path.empty()) return Int8WeightCache();
+
+  // the transformed layouts are not specified across cublasLt versions
+  std::string key = name + " " + std::to_string(weight_hash) + " sm" +
+                    std::to_string(arch) + " cublasLt" +
+                    std::to_string(cublasLtGetVersion());
+  Int8WeightCache cache(path, key);
+  std::string res = cache.load();
+  if (res.empty()) {
+    std::cout << "loaded " << cache.size() << " int8 kernels from " << path
+              << std::endl;
+  }
+  return cache;
+}
+
+/* Save the cache if kernels were transformed, waits for stream */
+void close_int8_weight_cache(Int8WeightCache* cache, cudaStream_t stream) {
+  CHECK_GPU_ERROR(cudaStreamSynchronize(stream));
+  if (!cache->dirty()) return;
+  std::string res = cache->save();
+  if (!res.empty()) {
+    std::cout << res << std::endl;
+  } else {
+    std::cout << "saved " << cache->size() << " int8 kernels to "
+              << cache->path() << std::endl;
+  }
+}
+
 }  // namespace cuda
 }  // namespace lightseq
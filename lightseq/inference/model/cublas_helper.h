@@ -4,6 +4,9 @@
 #include <cuda_runtime.h>
 #include <cublasLt.h>
 
+#include <string>
+
+#include "int8_weight_cache.h"
 #include "transformerKernels_int8.h"
 
 namespace lightseq {
@@ -46,5 +49,19 @@ void quantize_weight(const T* origin_weight, int8_t* quantized_weight, int rows,
                      int cols, float quant_scale, cudaStream_t stream,
                      cublasLtHandle_t handle, Layout layout = kColMajor32);
 
+void load_int8_weight(const int8_t* host_weight, int8_t* quantized_weight,
+                      int rows, int cols, cudaStream_t stream,
+                      cublasLtHandle_t handle, Layout layout = kColMajor32);
+
+void load_int8_weight(const int8_t* host_weight, int8_t* quantized_weight,
+                      int rows, int cols, cudaStream_t stream,
+                      cublasLtHandle_t handle, Int8WeightCache* cache,
+                      Layout layout = kColMajor32);
+
+Int8WeightCache open_int8_weight_cache(const std::string& name,
+                                       uint64_t weight_hash);
+
+void close_int8_weight_cache(Int8WeightCache* cache, cudaStream_t stream);
+
 }  // namespace cuda
 }  // namespace lightseq
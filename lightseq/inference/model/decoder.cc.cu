@@ -2,6 +2,11 @@
 
 #include "../kernels/transformerKernels.h"
 #include "../kernels/embKernels.h"
+#include "../kernels/samplingKernels.h"
+#include "../kernels/batchCompactKernels.h"
+#include "../kernels/shortlistKernels.h"
+#include "../kernels/scoringKernels.h"
+#include "../kernels/gptKernels.h"
 
 /**
 @file
@@ -24,6 +29,7 @@ Decoder<OpType_>::Decoder(int max_batch_size, const int* p_d_padding_mask,
       _cub_sort_buffer_bytes(max_batch_size * tw._beam_size *
                              tw._trg_vocab_size * sizeof(_DataType)),
       _p_d_padding_mask(p_d_padding_mask),
+      _p_d_step_padding_mask(p_d_padding_mask),
       _p_d_encoder_output(p_d_encoder_output),
       _p_d_result(p_d_result),
       _p_d_trg_emb_wei(tw.get_trg_emb_wei()),
@@ -45,7 +51,40 @@ Decoder<OpType_>::Decoder(int max_batch_size, const int* p_d_padding_mask,
       _h_alive_seq_probs(max_batch_size * tw._beam_size,
                          min_log_probability / 2),
       _h_length_norm(tw._max_step, 1.f),
-      _h_unfinished(1) {
+      _h_unfinished(1),
+      _fan_out(1),
+      _stage_timer(nullptr),
+      _stage_project(-1),
+      _stage_emb(-1),
+      _stage_logits(-1),
+      _stage_search(-1),
+      _stage_shrink(-1),
+      _stage_score(-1),
+      _stage_self_attn(tw._n_dec_layer, -1),
+      _stage_encdec_attn(tw._n_dec_layer, -1),
+      _stage_ffn(tw._n_dec_layer, -1),
+      _p_d_bad_words(nullptr),
+      _p_d_zero_logit_bias(nullptr),
+      _shrink_batch(false),
+      _p_d_batch_finished(nullptr),
+      _p_d_batch_moves(nullptr),
+      _p_d_finished_seq(nullptr),
+      _p_d_finished_score(nullptr),
+      _p_d_compact_padding_mask(nullptr),
+      _step_vocab_size(tw._trg_vocab_size),
+      _shortlist_end_id(-1),
+      _p_d_shortlist(nullptr),
+      _p_d_shortlist_emb(nullptr),
+      _p_d_shortlist_bias(nullptr),
+      _num_sms(0),
+      _p_d_split_k_buf(nullptr),
+      _score_max_token_num(max_batch_size * tw._max_step),
+      _p_d_score_query(nullptr),
+      _p_d_score_buf1(nullptr),
+      _p_d_score_buf2(nullptr),
+      _p_d_score_qkv(nullptr),
+      _p_d_score_c(nullptr),
+      _p_d_score_trg_len(nullptr) {
   for (int i = 0; i < _h_alive_seq_probs.size(); i += tw._beam_size) {
     _h_alive_seq_probs[i] = 0.f;
   }
@@ -58,6 +97,15 @@ Decoder<OpType_>::Decoder(int max_batch_size, const int* p_d_padding_mask,
   return;
 }
 
+template <OperationType OpType_>
+Decoder<OpType_>::~Decoder() {
+  // the logits processor buffers, allocated by set_logits_processor
+  if (_p_d_bad_words != nullptr) CHECK_GPU_ERROR(cudaFree(_p_d_bad_words));
+  if (_p_d_zero_logit_bias != nullptr) {
+    CHECK_GPU_ERROR(cudaFree(_p_d_zero_logit_bias));
+  }
+}
+
 /**
 Compute GPU memory size needed by transformer decoder,
   to see how these memory is used, checkout init_buffer() for detail
@@ -201,6 +249,37 @@ void Decoder<OpType_>::init_buffer(void* pbuf) {
                              _max_batch_size * sizeof(curandState)));
   ker_curand_setup<<<_max_batch_size, 1, 0, _stream>>>(_p_d_curandstate);
 
+  // the finished batch items of beam search are dropped from the decoding,
+  // multilingual and diverse beam search keep the whole batch
+  _shrink_batch = _tw._sampling_method == "beam_search" &&
+                  _tw._multilg_type == 0 && _tw._diverse_lambda == 0;
+  if (_shrink_batch) {
+    int beam_token_num = _max_batch_size * _tw._beam_size;
+    _h_batch_finished.resize(_max_batch_size);
+    CHECK_GPU_ERROR(cudaMalloc((void**)&_p_d_batch_finished,
+                               _max_batch_size * sizeof(int)));
+    CHECK_GPU_ERROR(cudaMalloc((void**)&_p_d_batch_moves,
+                               _max_batch_size * 4 * sizeof(int)));
+    CHECK_GPU_ERROR(cudaMalloc((void**)&_p_d_finished_seq,
+                               beam_token_num * _tw._max_step * sizeof(int)));
+    CHECK_GPU_ERROR(cudaMalloc((void**)&_p_d_finished_score,
+                               beam_token_num * sizeof(float)));
+    CHECK_GPU_ERROR(
+        cudaMalloc((void**)&_p_d_compact_padding_mask,
+                   _max_batch_size * _tw._max_step * sizeof(int)));
+  }
+
+  int device;
+  CHECK_GPU_ERROR(cudaGetDevice(&device));
+  CHECK_GPU_ERROR(cudaDeviceGetAttribute(
+      &_num_sms, cudaDevAttrMultiProcessorCount, device));
+  long split_k_partials = split_k_max_partials(
+      _max_batch_size * _tw._beam_size * _tw._head_num, _tw._max_step,
+      _num_sms);
+  CHECK_GPU_ERROR(cudaMalloc(
+      (void**)&_p_d_split_k_buf,
+      split_k_partials * (_tw._dim_per_head + 2) * sizeof(float)));
+
   CHECK_GPU_ERROR(cudaStreamSynchronize(_stream));
   CHECK_GPU_ERROR(cudaGetLastError());
   std::cout << "decoder buffer init succeed" << std::endl;
@@ -254,9 +333,6 @@ std::string Decoder<OpType_>::check() {
   if (_tw._multilg_type != 0 && _p_d_lang_id == nullptr) {
     return "lang id should not be null when multilg";
   }
-  if (_tw._max_step > 1024) {
-    return "max_step should not greater than 1024";
-  }
   return "";
 }
 
@@ -271,11 +347,19 @@ void Decoder<OpType_>::run_one_infer(int batch_size, int batch_seq_len) {
   if (batch_seq_len > _tw._max_step) {
     throw std::runtime_error("seq len of input greater than max_step");
   }
+  // the encdec attention softmax has a thread per source token
+  if (batch_seq_len > _max_thread_per_block) {
+    throw std::runtime_error("seq len of input greater than 1024");
+  }
+  if (batch_size % _fan_out != 0) {
+    throw std::runtime_error("batch size should be a multiple of fan_out");
+  }
 
   /* ---step1. init--- */
   _batch_size = batch_size;
   _batch_seq_len = batch_seq_len;
-  _batch_token_num = batch_size * batch_seq_len;
+  // the encoder output has a row per source
+  _batch_token_num = batch_size / _fan_out * batch_seq_len;
   _step_token_num = batch_size * _tw._beam_size;
   _batch_max_decode_length =
       min(_tw._max_step, batch_seq_len + _tw._extra_decode_length) - 1;
@@ -286,7 +370,13 @@ void Decoder<OpType_>::run_one_infer(int batch_size, int batch_seq_len) {
     _batch_max_decode_length = _tw._max_step;
   }
 
-  project_encoder_output();  // project encoder output
+  _compaction.reset(batch_size);
+  _p_d_step_padding_mask = _p_d_padding_mask;
+
+  {
+    CudaStageScope scope(_stage_timer, _stage_project, _stream);
+    project_encoder_output();  // project encoder output
+  }
   // init the first step's token id with target start_id
   CHECK_GPU_ERROR(cudaMemcpyAsync(_p_d_alive_seq_probs,
                                   _h_alive_seq_probs.data(),
@@ -301,29 +391,36 @@ void Decoder<OpType_>::run_one_infer(int batch_size, int batch_seq_len) {
     if (run_step()) {  // one step
       break;
     }
+    if (_shrink_batch) {
+      CudaStageScope scope(_stage_timer, _stage_shrink, _stream);
+      shrink_batch();
+    }
   }
+  scatter_batch();
 
   /* ---step3. output the decoding result--- */
   if (_output_topk || _is_sampling) {
     if (_cur_step == _batch_max_decode_length) {
       _cur_step -= 1;
     }
-    ker_write_topk_result<<<_batch_size * _tw._beam_size, _cur_step + 1, 0,
+    ker_write_topk_result<<<_batch_size * _tw._beam_size,
+                            std::min(_cur_step + 1, _max_thread_per_block), 0,
                             _stream>>>(
         _p_d_alive_seq, _p_d_alive_seq_score, _p_d_result, _tw._trg_vocab_size,
-        _tw._max_step, _tw._beam_size, _tw._end_id);
+        _tw._max_step, _tw._beam_size, _tw._end_id, _cur_step + 1);
     return;
   }
   if (_tw._length_penalty >= 0.f || _cur_step == _batch_max_decode_length) {
-    ker_write_trg_tokenid_pos_penalty<<<_batch_size, _cur_step + 1, 0,
-                                        _stream>>>(
-        _p_d_alive_seq, _p_d_alive_seq_score, _p_d_result, _tw._max_step,
-        _tw._beam_size);
+    ker_write_trg_tokenid_pos_penalty<<<
+        _batch_size, std::min(_cur_step + 1, _max_thread_per_block), 0,
+        _stream>>>(_p_d_alive_seq, _p_d_alive_seq_score, _p_d_result,
+                   _tw._max_step, _tw._beam_size, _cur_step + 1);
   } else {
-    ker_write_trg_tokenid_neg_penalty<<<_batch_size, _cur_step + 1, 0,
-                                        _stream>>>(
-        _p_d_alive_seq, _p_d_alive_seq_score, _p_d_result, _tw._max_step,
-        _tw._beam_size, _tw._trg_vocab_size, _tw._end_id);
+    ker_write_trg_tokenid_neg_penalty<<<
+        _batch_size, std::min(_cur_step + 1, _max_thread_per_block), 0,
+        _stream>>>(_p_d_alive_seq, _p_d_alive_seq_score, _p_d_result,
+                   _tw._max_step, _tw._beam_size, _tw._trg_vocab_size,
+                   _tw._end_id, _cur_step + 1);
   }
 #ifdef DEBUG_RESULT
   for (int i = 0; i < _batch_size; i++) {
@@ -333,6 +430,310 @@ void Decoder<OpType_>::run_one_infer(int batch_size, int batch_seq_len) {
   return;
 }
 
+/**
+Teacher-forced scoring of the targets p_d_target [num_targets, trg_seq_len],
+  grouped by source, of the batch_size sources encoded into the encoder
+  output. Write the log probability of every position into
+  p_d_token_log_prob [num_targets, trg_seq_len] and of every target into
+  p_d_seq_log_prob [num_targets], see sequence_scoring.h. The vocab shortlist
+  and the logits processor do not apply
+*/
+template <OperationType OpType_>
+void Decoder<OpType_>::run_score(int batch_size, int batch_seq_len,
+                                 const int* p_d_target, int num_targets,
+                                 int trg_seq_len, float* p_d_token_log_prob,
+                                 float* p_d_seq_log_prob) {
+  if (batch_size > _max_batch_size) {
+    throw std::runtime_error("batch size of input greater than max_batch_size");
+  }
+  if (batch_seq_len > _tw._max_step) {
+    throw std::runtime_error("seq len of input greater than max_step");
+  }
+  if (batch_seq_len > _max_thread_per_block) {
+    throw std::runtime_error("seq len of input greater than 1024");
+  }
+  if (batch_size <= 0 || num_targets % batch_size != 0) {
+    throw std::runtime_error(
+        "scoring: the number of targets should be a multiple of the number "
+        "of sources");
+  }
+  if (trg_seq_len > _tw._max_step) {
+    throw std::runtime_error("scoring: target len greater than max_step");
+  }
+  // the causal softmax has a thread per target position
+  if (trg_seq_len > _max_thread_per_block) {
+    throw std::runtime_error("scoring: target len greater than 1024");
+  }
+  if (_tw._multilg_type != 0) {
+    throw std::runtime_error(
+        "scoring: not supported by the multilingual models");
+  }
+  if (_p_d_score_query == nullptr) {
+    init_score_buffer();
+  }
+
+  _batch_size = batch_size;
+  _batch_seq_len = batch_seq_len;
+  _batch_token_num = batch_size * batch_seq_len;
+  _p_d_step_padding_mask = _p_d_padding_mask;
+  {
+    CudaStageScope scope(_stage_timer, _stage_project, _stream);
+    project_encoder_output();
+  }
+  CudaStageScope scope(_stage_timer, _stage_score, _stream);
+  for (const ScorePass& pass :
+       score_passes(batch_size, num_targets / batch_size, trg_seq_len,
+                    _tw._head_num, _score_max_token_num)) {
+    score_pass(pass, p_d_target, trg_seq_len, p_d_token_log_prob,
+               p_d_seq_log_prob);
+  }
+}
+
+/**
+Allocate the buffers of the scoring passes, sized for max_batch_size
+  targets of max_step tokens like the encoder
+*/
+template <OperationType OpType_>
+void Decoder<OpType_>::init_score_buffer() {
+  long hidden_bytes = (long)_score_max_token_num * _tw._hidden_size *
+                      sizeof(_DataType);
+  CHECK_GPU_ERROR(cudaMalloc((void**)&_p_d_score_query, hidden_bytes));
+  CHECK_GPU_ERROR(cudaMalloc((void**)&_p_d_score_buf1, hidden_bytes));
+  CHECK_GPU_ERROR(cudaMalloc(
+      (void**)&_p_d_score_buf2,
+      (long)_score_max_token_num *
+          max(_tw._hidden_size * 3, _tw._inner_size) * sizeof(_DataType)));
+  CHECK_GPU_ERROR(cudaMalloc((void**)&_p_d_score_qkv, hidden_bytes * 3));
+  CHECK_GPU_ERROR(cudaMalloc((void**)&_p_d_score_c,
+                             (long)_score_max_token_num * _tw._head_num *
+                                 _tw._max_step * sizeof(_DataType)));
+  CHECK_GPU_ERROR(cudaMalloc((void**)&_p_d_score_trg_len,
+                             _score_max_token_num * sizeof(int)));
+}
+
+/**
+Score the targets of a pass, the decoder runs over all their positions at
+  once with a causal self attention
+*/
+template <OperationType OpType_>
+void Decoder<OpType_>::score_pass(const ScorePass& pass,
+                                  const int* p_d_target, int trg_seq_len,
+                                  float* p_d_token_log_prob,
+                                  float* p_d_seq_log_prob) {
+  int num_targets = _batch_size * pass.cand_num;
+  int token_num = num_targets * trg_seq_len;
+  launch_score_target_len(p_d_target, _p_d_score_trg_len, pass, num_targets,
+                          trg_seq_len, _tw._end_id, _stream);
+  launch_score_dec_emb<_DataType>(
+      _p_d_trg_emb_wei[0], _p_d_trg_emb_wei[1], p_d_target, _p_d_score_query,
+      pass, num_targets, trg_seq_len, _tw._hidden_size, _tw._trg_vocab_size,
+      _tw._start_id, _stream, _tw._trg_emb_tied);
+
+  for (_layer_id = 0; _layer_id < _tw._n_dec_layer; _layer_id++) {
+    _weight_offset = _layer_id * _tw._weight_per_dec_layer;
+    score_self_attention(num_targets, trg_seq_len);
+    score_encdec_attention(num_targets, trg_seq_len);
+    score_ffn_add_norm(num_targets, trg_seq_len);
+  }
+  ker_norm_layer_launcher<_DataType>(
+      token_num, _tw._hidden_size, _stream, _p_d_score_query,
+      _p_d_trg_emb_wei[2], _p_d_trg_emb_wei[3], _max_thread_per_block);
+
+  // the logits of the rows of a decoding step at a time, in the logit buffer
+  int block_rows = _max_batch_size * _tw._beam_size;
+  for (int row = 0; row < token_num; row += block_rows) {
+    int num_rows = min(block_rows, token_num - row);
+    CHECK_GPU_ERROR(cublas_gemm_ex(
+        _hd, logit_wei_op(), CUBLAS_OP_N, _tw._trg_vocab_size, num_rows,
+        _tw._hidden_size, &_logit_scaler, _p_d_trg_emb_wei[0], _AType,
+        logit_wei_ld(_tw._trg_vocab_size),
+        _p_d_score_query + (long)row * _tw._hidden_size,
+        _BType, _tw._hidden_size, &_fzero, _p_d_logit_buf, _CType,
+        _tw._trg_vocab_size, CUDA_R_32F, CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+    launch_score_log_prob<_DataType>(
+        _p_d_logit_buf, _p_d_trg_emb_wei[6], p_d_target, _p_d_score_trg_len,
+        p_d_token_log_prob, pass, row, num_rows, trg_seq_len,
+        _tw._trg_vocab_size, _max_thread_per_block, _stream);
+  }
+  launch_score_seq_log_prob(p_d_token_log_prob, p_d_seq_log_prob, pass,
+                            num_targets, trg_seq_len, _stream);
+}
+
+/**
+Set the logits processor chain of the following infers, see
+  logits_processor.h. A disabled config restores the plain decoding
+*/
+template <OperationType OpType_>
+void Decoder<OpType_>::set_logits_processor(
+    const LogitsProcessorConfig& config) {
+  std::string err = config.check(_tw._trg_vocab_size);
+  if (!err.empty()) {
+    throw std::runtime_error("logits processor: " + err);
+  }
+  if (config.enabled() && _step_vocab_size != _tw._trg_vocab_size) {
+    throw std::runtime_error(
+        "logits processor: not supported with a vocab shortlist");
+  }
+  FlatBadWords bad_words(config.bad_words);
+  // cudaFree waits for the running infer that may read the old words
+  if (_p_d_bad_words != nullptr) {
+    CHECK_GPU_ERROR(cudaFree(_p_d_bad_words));
+    _p_d_bad_words = nullptr;
+  }
+  if (bad_words.size() > 0) {
+    size_t num_tokens = bad_words.tokens.size();
+    CHECK_GPU_ERROR(
+        cudaMalloc((void**)&_p_d_bad_words,
+                   (num_tokens + bad_words.offsets.size()) * sizeof(int)));
+    CHECK_GPU_ERROR(cudaMemcpy(_p_d_bad_words, bad_words.tokens.data(),
+                               num_tokens * sizeof(int),
+                               cudaMemcpyHostToDevice));
+    CHECK_GPU_ERROR(cudaMemcpy(
+        _p_d_bad_words + num_tokens, bad_words.offsets.data(),
+        bad_words.offsets.size() * sizeof(int), cudaMemcpyHostToDevice));
+  }
+  if (config.enabled() && _p_d_zero_logit_bias == nullptr) {
+    CHECK_GPU_ERROR(cudaMalloc((void**)&_p_d_zero_logit_bias,
+                               _tw._trg_vocab_size * sizeof(_DataType)));
+    CHECK_GPU_ERROR(cudaMemset(_p_d_zero_logit_bias, 0,
+                               _tw._trg_vocab_size * sizeof(_DataType)));
+  }
+  _processor_config = config;
+  _processor_params = make_logits_processor_params(
+      config, _p_d_bad_words, _p_d_bad_words + bad_words.tokens.size(),
+      _tw._end_id, -1);
+}
+
+/**
+Decode the following infers with the logits of a target vocab subset, e.g.
+  built by LexicalShortlist for the batch. The tied embedding and the logit
+  bias are gathered once here, alive seq and the results stay in the full
+  vocab. An empty ids restores the full vocab
+*/
+template <OperationType OpType_>
+void Decoder<OpType_>::set_vocab_shortlist(const std::vector<int>& ids) {
+  if (ids.empty()) {
+    _step_vocab_size = _tw._trg_vocab_size;
+    _shortlist_end_id = -1;
+    return;
+  }
+  if (_tw._sampling_method != "beam_search") {
+    throw std::runtime_error("vocab shortlist: only supported by beam_search");
+  }
+  if (_processor_config.enabled()) {
+    throw std::runtime_error(
+        "vocab shortlist: not supported with the logits processor");
+  }
+  std::string err =
+      check_vocab_shortlist(ids, _tw._trg_vocab_size, _tw._end_id);
+  if (!err.empty()) {
+    throw std::runtime_error(err);
+  }
+  if (_p_d_shortlist == nullptr) {
+    CHECK_GPU_ERROR(cudaMalloc((void**)&_p_d_shortlist,
+                               _tw._trg_vocab_size * sizeof(int)));
+    CHECK_GPU_ERROR(
+        cudaMalloc((void**)&_p_d_shortlist_emb,
+                   _tw._hidden_size * _tw._trg_vocab_size * sizeof(_DataType)));
+    CHECK_GPU_ERROR(cudaMalloc((void**)&_p_d_shortlist_bias,
+                               _tw._trg_vocab_size * sizeof(_DataType)));
+  }
+  int shortlist_size = ids.size();
+  // the stream is synchronized at the end of an infer, so the buffers are
+  // not in use
+  CHECK_GPU_ERROR(cudaMemcpyAsync(_p_d_shortlist, ids.data(),
+                                  shortlist_size * sizeof(int),
+                                  cudaMemcpyHostToDevice, _stream));
+  if (_tw._trg_emb_tied) {
+    launch_gather_vocab_rows<_DataType>(
+        _p_d_trg_emb_wei[0], _p_d_shortlist_emb, _p_d_shortlist,
+        _tw._hidden_size, shortlist_size, _max_thread_per_block, _stream);
+  } else {
+    launch_gather_vocab_columns<_DataType>(
+        _p_d_trg_emb_wei[0], _p_d_shortlist_emb, _p_d_shortlist,
+        _tw._hidden_size, _tw._trg_vocab_size, shortlist_size,
+        _max_thread_per_block, _stream);
+  }
+  launch_gather_vocab_columns<_DataType>(
+      _p_d_trg_emb_wei[6], _p_d_shortlist_bias, _p_d_shortlist, 1,
+      _tw._trg_vocab_size, shortlist_size, _max_thread_per_block, _stream);
+  CHECK_GPU_ERROR(cudaStreamSynchronize(_stream));
+  _step_vocab_size = shortlist_size;
+  _shortlist_end_id =
+      std::lower_bound(ids.begin(), ids.end(), _tw._end_id) - ids.begin();
+}
+
+/**
+Read the encoder output of the following infers from these buffers, e.g.
+  a slot of the encoder-decoder pipeline, see encdec_pipeline.h
+*/
+template <OperationType OpType_>
+void Decoder<OpType_>::set_encoder_output(const int* p_d_padding_mask,
+                                          const _DataType* p_d_encoder_output) {
+  _p_d_padding_mask = p_d_padding_mask;
+  _p_d_step_padding_mask = p_d_padding_mask;
+  _p_d_encoder_output = p_d_encoder_output;
+}
+
+/**
+Decode every source of the encoder output into fan_out consecutive batch
+  items of the following infers, e.g. into several target languages with
+  their own trg lang ids. The batch items of a source share its projected
+  encoder output and padding mask, like its beams, 1 restores one batch item
+  per source
+*/
+template <OperationType OpType_>
+void Decoder<OpType_>::set_fan_out(int fan_out) {
+  if (fan_out < 1) {
+    throw std::runtime_error("fan_out should be at least 1");
+  }
+  // shrink_batch() moves the batch items apart from their source
+  if (fan_out > 1 && _shrink_batch) {
+    throw std::runtime_error("fan_out: not supported by the shrinking batch");
+  }
+  _fan_out = fan_out;
+}
+
+/**
+Apply the logits processor chain to the logits of the cur step, return the
+  logit bias to use after it, which is folded into the logits by the chain
+*/
+template <OperationType OpType_>
+const typename Decoder<OpType_>::_DataType* Decoder<OpType_>::process_logits(
+    int rows) {
+  if (!_processor_config.enabled()) {
+    return _p_d_trg_emb_wei[6];
+  }
+  // alive_seq[0] is the start token
+  launch_logits_processor<_DataType>(
+      _p_d_logit_buf, _p_d_trg_emb_wei[6], _p_d_alive_seq, _tw._max_step,
+      _cur_step + 1, _cur_step, rows, 1, _tw._trg_vocab_size,
+      _processor_params, _max_thread_per_block, _stream);
+  return _p_d_zero_logit_bias;
+}
+
+/**
+Register the timed stages of decoder. Stages inside the decoding loop are
+recorded once per step
+*/
+template <OperationType OpType_>
+void Decoder<OpType_>::set_stage_timer(CudaStageTimer* timer) {
+  _stage_timer = timer;
+  _stage_project = timer->stage_id("decoder.project_encoder_output");
+  _stage_emb = timer->stage_id("decoder.embedding");
+  _stage_logits = timer->stage_id("decoder.logits");
+  _stage_search = timer->stage_id(_tw._sampling_method == "beam_search"
+                                      ? "decoder.beam_search"
+                                      : "decoder.sampling");
+  _stage_shrink = timer->stage_id("decoder.shrink_batch");
+  _stage_score = timer->stage_id("decoder.score");
+  _stage_self_attn =
+      timer->layer_stage_ids("decoder", "self_attention", _tw._n_dec_layer);
+  _stage_encdec_attn =
+      timer->layer_stage_ids("decoder", "encdec_attention", _tw._n_dec_layer);
+  _stage_ffn = timer->layer_stage_ids("decoder", "ffn", _tw._n_dec_layer);
+}
+
 /**
 Project encoder output
 */
@@ -346,7 +747,7 @@ void Decoder<OpType_>::project_encoder_output() {
             "_p_d_encoder_output(tail)", 5);
   print_vec(_p_d_trg_emb_wei[4], "encoder project(head):", 10);
 #endif
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, kv_dim, _batch_token_num, _tw._hidden_size,
       &_type_one, _p_d_trg_emb_wei[4], _AType, kv_dim, _p_d_encoder_output,
       _BType, _tw._hidden_size, &_type_zero, _p_d_encoder_out_buf, _CType,
@@ -374,17 +775,27 @@ Decode one step
 */
 template <OperationType OpType_>
 bool Decoder<OpType_>::run_step() {
-  embedding();
+  {
+    CudaStageScope scope(_stage_timer, _stage_emb, _stream);
+    embedding();
+  }
   decoder_stack();
   /* --- Project hidden states to vocab logits--- */
-
-  CHECK_GPU_ERROR(cublasGemmEx(
-      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._trg_vocab_size, _step_token_num,
-      _tw._hidden_size, &_logit_scaler, _p_d_trg_emb_wei[0], _AType,
-      _tw._trg_vocab_size, _p_d_cur_step_query, _BType, _tw._hidden_size,
-      // &_type_zero, _p_d_logit_buf, _CType, _tw._trg_vocab_size, _computeType,
-      &_fzero, _p_d_logit_buf, _CType, _tw._trg_vocab_size, CUDA_R_32F,
-      CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  {
+    CudaStageScope scope(_stage_timer, _stage_logits, _stream);
+    const _DataType* logit_wei = _step_vocab_size == _tw._trg_vocab_size
+                                     ? _p_d_trg_emb_wei[0]
+                                     : _p_d_shortlist_emb;
+    CHECK_GPU_ERROR(cublas_gemm_ex(
+        _hd, logit_wei_op(), CUBLAS_OP_N, _step_vocab_size, _step_token_num,
+        _tw._hidden_size, &_logit_scaler, logit_wei, _AType,
+        logit_wei_ld(_step_vocab_size), _p_d_cur_step_query, _BType,
+        _tw._hidden_size,
+        // &_type_zero, _p_d_logit_buf, _CType, _tw._trg_vocab_size,
+        // _computeType,
+        &_fzero, _p_d_logit_buf, _CType, _step_vocab_size, CUDA_R_32F,
+        CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  }
 
 #ifdef DEBUG_RESULT
   for (int i = 0; i < _batch_size; i++) {       // batch_id
@@ -400,6 +811,7 @@ bool Decoder<OpType_>::run_step() {
   }
 #endif
 
+  CudaStageScope scope(_stage_timer, _stage_search, _stream);
   if (_tw._sampling_method == "topk") {
     return sample();
   } else if (_tw._sampling_method == "topp") {
@@ -424,7 +836,8 @@ void Decoder<OpType_>::embedding() {
                             _p_d_alive_seq, _p_d_trg_emb_wei[7], _p_d_lang_id,
                             _p_d_cur_step_query, _batch_size, _tw._beam_size,
                             _tw._hidden_size, _tw._trg_vocab_size, _cur_step,
-                            _tw._max_step, _tw._multilg_type, _stream);
+                            _tw._max_step, _tw._multilg_type, _stream,
+                            _tw._trg_emb_tied);
 #ifdef DEBUG_RESULT
   for (int i = 0; i < _batch_size; i++) {       // batch_id
     for (int j = 0; j < _tw._beam_size; j++) {  // beam_id
@@ -453,11 +866,19 @@ void Decoder<OpType_>::decoder_stack() {
   for (_layer_id = 0; _layer_id < _tw._n_dec_layer; _layer_id++) {
     _weight_offset = _layer_id * _tw._weight_per_dec_layer;
 
-    self_attention();
-
-    encdec_attention();
-
-    ffn_add_norm();
+    {
+      CudaStageScope scope(_stage_timer, _stage_self_attn[_layer_id], _stream);
+      self_attention();
+    }
+    {
+      CudaStageScope scope(_stage_timer, _stage_encdec_attn[_layer_id],
+                           _stream);
+      encdec_attention();
+    }
+    {
+      CudaStageScope scope(_stage_timer, _stage_ffn[_layer_id], _stream);
+      ffn_add_norm();
+    }
   }
 
   // last layer norm
@@ -487,7 +908,7 @@ void Decoder<OpType_>::self_attention() {
 
   /* ---step 1. qkv = ori_q * qkv_wei + bias, and reshape qkv for multi-head
    * gemm--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size * 3, _step_token_num,
       _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 2], _AType,
       _tw._hidden_size * 3, _p_d_query_buf1, _BType, _tw._hidden_size,
@@ -532,31 +953,43 @@ void Decoder<OpType_>::self_attention() {
       "self attn v(tail): ", 5);
 #endif
 
-  /* ---step 2. correlation = q * k, perform softmax on correlation--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
-      _hd, CUBLAS_OP_T, CUBLAS_OP_N, _cur_step + 1, 1, _tw._dim_per_head,
-      &_atten_scaler, _p_d_self_k_bgeem1[_layer_id], _AType, _tw._dim_per_head,
-      _tw._max_step * _tw._dim_per_head, _p_d_query_buf1, _BType,
-      _tw._dim_per_head, _tw._dim_per_head, &_type_zero, _p_d_c, _CType,
-      _cur_step + 1, _cur_step + 1, _step_token_num * _tw._head_num,
-      _computeType, CUBLAS_GEMM_DEFAULT_TENSOR_OP));
-  ker_correlation_softmax_decself_launcher(_step_token_num * _tw._head_num,
-                                           _cur_step + 1, _stream, _p_d_c);
+  /* ---step 2 and 3. new_q = softmax(q * k) * v--- */
+  SplitKPlan plan = split_k_plan(
+      _cur_step + 1, _step_token_num * _tw._head_num, _num_sms);
+  if (plan.num_splits > 1) {
+    // long caches or small batches, the keys are split across blocks
+    ker_split_k_attention_decself_launcher<_DataType>(
+        _step_token_num * _tw._head_num, _cur_step + 1, _tw._max_step,
+        _tw._dim_per_head, (float)_atten_scaler, plan, _stream,
+        _p_d_query_buf1, _p_d_self_k_bgeem1[_layer_id],
+        _p_d_self_v_bgeem1[_layer_id], _p_d_split_k_buf, _p_d_query_buf1);
+  } else {
+    /* ---step 2. correlation = q * k, perform softmax on correlation--- */
+    CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
+        _hd, CUBLAS_OP_T, CUBLAS_OP_N, _cur_step + 1, 1, _tw._dim_per_head,
+        &_atten_scaler, _p_d_self_k_bgeem1[_layer_id], _AType,
+        _tw._dim_per_head, _tw._max_step * _tw._dim_per_head, _p_d_query_buf1,
+        _BType, _tw._dim_per_head, _tw._dim_per_head, &_type_zero, _p_d_c,
+        _CType, _cur_step + 1, _cur_step + 1, _step_token_num * _tw._head_num,
+        _computeType, CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+    ker_correlation_softmax_decself_launcher(_step_token_num * _tw._head_num,
+                                             _cur_step + 1, _stream, _p_d_c);
 
 #ifdef DEBUG_RESULT
-  print_vec(_p_d_c, "self attn corr(head): ", 5);
-  print_vec(_p_d_c + _step_token_num * _tw._head_num * (_cur_step + 1) - 5,
-            "self attn corr(tail): ", 5);
+    print_vec(_p_d_c, "self attn corr(head): ", 5);
+    print_vec(_p_d_c + _step_token_num * _tw._head_num * (_cur_step + 1) - 5,
+              "self attn corr(tail): ", 5);
 #endif
 
-  /* ---step 3. new_q = correlation * v--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
-      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._dim_per_head, 1, _cur_step + 1,
-      &_type_one, _p_d_self_v_bgeem1[_layer_id], _AType, _tw._dim_per_head,
-      _tw._max_step * _tw._dim_per_head, _p_d_c, _BType, _cur_step + 1,
-      _cur_step + 1, &_type_zero, _p_d_query_buf1, _CType, _tw._dim_per_head,
-      _tw._dim_per_head, _step_token_num * _tw._head_num, _computeType,
-      CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+    /* ---step 3. new_q = correlation * v--- */
+    CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
+        _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._dim_per_head, 1, _cur_step + 1,
+        &_type_one, _p_d_self_v_bgeem1[_layer_id], _AType, _tw._dim_per_head,
+        _tw._max_step * _tw._dim_per_head, _p_d_c, _BType, _cur_step + 1,
+        _cur_step + 1, &_type_zero, _p_d_query_buf1, _CType, _tw._dim_per_head,
+        _tw._dim_per_head, _step_token_num * _tw._head_num, _computeType,
+        CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  }
 
 #ifdef DEBUG_RESULT
   print_vec(_p_d_query_buf1, "self attn before ffn(head): ", 5);
@@ -564,7 +997,7 @@ void Decoder<OpType_>::self_attention() {
             "self attn before ffn(tail): ", 5);
 #endif
   /* ---step 4. new_q = ori_q + new_q * output_wei--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _step_token_num,
       _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 4], _AType,
       _tw._hidden_size, _p_d_query_buf1, _BType, _tw._hidden_size, &_type_one,
@@ -583,6 +1016,9 @@ Encode-Decoder attention
 */
 template <OperationType OpType_>
 void Decoder<OpType_>::encdec_attention() {
+  // the beams of the fan_out batch items of a source are its queries
+  int src_batch_size = _batch_size / _fan_out;
+  int src_query_num = _fan_out * _tw._beam_size;
   /* ---step 0. layer_norm, add output_bias to "query"--- */
   ker_norm_layer_resual_launcher<_DataType>(
       _step_token_num, _tw._hidden_size, _stream, _p_d_cur_step_query,
@@ -598,7 +1034,7 @@ void Decoder<OpType_>::encdec_attention() {
 
   /* ---step 1. new_q = ori_q * q_wei + bias, reshape new_q for multi-head
    * gemm--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _step_token_num,
       _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 8], _AType,
       _tw._hidden_size, _p_d_query_buf1, _BType, _tw._hidden_size, &_type_zero,
@@ -606,39 +1042,39 @@ void Decoder<OpType_>::encdec_attention() {
       CUBLAS_GEMM_DEFAULT_TENSOR_OP));
   ker_arrange_encdec_q_launcher<_DataType>(
       _step_token_num, _tw._hidden_size, _stream, _p_d_query_buf2,
-      _p_d_dec_wei[_weight_offset + 9], _p_d_query_buf1, _tw._beam_size,
+      _p_d_dec_wei[_weight_offset + 9], _p_d_query_buf1, src_query_num,
       _tw._dim_per_head, _tw._head_num, _max_thread_per_block);
 
   /* ---step 2. correlation = q * k, perform softmax on correlation--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
-      _hd, CUBLAS_OP_T, CUBLAS_OP_N, _batch_seq_len, _tw._beam_size,
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
+      _hd, CUBLAS_OP_T, CUBLAS_OP_N, _batch_seq_len, src_query_num,
       _tw._dim_per_head, &_atten_scaler, _p_d_encdec_k_bgeem[_layer_id], _AType,
       _tw._dim_per_head, _batch_seq_len * _tw._dim_per_head, _p_d_query_buf1,
-      _BType, _tw._dim_per_head, _tw._beam_size * _tw._dim_per_head,
+      _BType, _tw._dim_per_head, src_query_num * _tw._dim_per_head,
       &_type_zero, _p_d_c, _CType, _batch_seq_len,
-      _tw._beam_size * _batch_seq_len, _batch_size * _tw._head_num,
+      src_query_num * _batch_seq_len, src_batch_size * _tw._head_num,
       _computeType, CUBLAS_GEMM_DEFAULT_TENSOR_OP));
   ker_correlation_softmax_encdec_launcher<_DataType>(
-      _batch_size, _tw._head_num * _tw._beam_size, _batch_seq_len, _stream,
-      _p_d_c, _p_d_padding_mask);
+      src_batch_size, _tw._head_num * src_query_num, _batch_seq_len, _stream,
+      _p_d_c, _p_d_step_padding_mask);
 
   /* ---step 3. new_q = correlation * v--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
-      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._dim_per_head, _tw._beam_size,
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
+      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._dim_per_head, src_query_num,
       _batch_seq_len, &_type_one, _p_d_encdec_v_bgeem[_layer_id], _AType,
       _tw._dim_per_head, _batch_seq_len * _tw._dim_per_head, _p_d_c, _BType,
-      _batch_seq_len, _tw._beam_size * _batch_seq_len, &_type_zero,
+      _batch_seq_len, src_query_num * _batch_seq_len, &_type_zero,
       _p_d_query_buf1, _CType, _tw._dim_per_head,
-      _tw._beam_size * _tw._dim_per_head, _batch_size * _tw._head_num,
+      src_query_num * _tw._dim_per_head, src_batch_size * _tw._head_num,
       _computeType, CUBLAS_GEMM_DEFAULT_TENSOR_OP));
 
   ker_arrange_atten_output_launcher<_DataType>(
       _step_token_num, _tw._hidden_size, _stream, _p_d_query_buf1,
-      _p_d_query_buf2, _tw._beam_size, _tw._dim_per_head, _tw._head_num,
+      _p_d_query_buf2, src_query_num, _tw._dim_per_head, _tw._head_num,
       _max_thread_per_block);
 
   /* ---step 4. new_q = ori_q + new_q * output_wei--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _step_token_num,
       _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 10], _AType,
       _tw._hidden_size, _p_d_query_buf2, _BType, _tw._hidden_size, &_type_one,
@@ -670,25 +1106,34 @@ void Decoder<OpType_>::ffn_add_norm() {
 #endif
 
   /* ---step 1. first ffn layer--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
-      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _step_token_num,
-      _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 14], _AType,
-      _tw._inner_size, _p_d_query_buf1, _BType, _tw._hidden_size, &_type_zero,
-      _p_d_query_buf2, _CType, _tw._inner_size, _computeType,
-      CUBLAS_GEMM_DEFAULT_TENSOR_OP));
-
-  if (_tw._use_gelu) {
-    ker_bias_gelu_launcher<_DataType>(
-        _step_token_num, _max_thread_per_block, _stream, _p_d_query_buf2,
-        _p_d_dec_wei[_weight_offset + 15], _tw._inner_size);
-  } else {
-    ker_bias_relu_launcher<_DataType>(
-        _step_token_num, _max_thread_per_block, _stream, _p_d_query_buf2,
-        _p_d_dec_wei[_weight_offset + 15], _tw._inner_size);
+  if (!cublaslt_gemm_bias_act(
+          _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _step_token_num,
+          _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 14],
+          _tw._inner_size, _p_d_query_buf1, _tw._hidden_size, &_type_zero,
+          _p_d_query_buf2, _tw._inner_size, _p_d_dec_wei[_weight_offset + 15],
+          _AType, _computeType,
+          _tw._use_gelu ? GemmEpilogue::kBiasGelu
+                        : GemmEpilogue::kBiasRelu)) {
+    CHECK_GPU_ERROR(cublas_gemm_ex(
+        _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _step_token_num,
+        _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 14], _AType,
+        _tw._inner_size, _p_d_query_buf1, _BType, _tw._hidden_size, &_type_zero,
+        _p_d_query_buf2, _CType, _tw._inner_size, _computeType,
+        CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+
+    if (_tw._use_gelu) {
+      ker_bias_gelu_launcher<_DataType>(
+          _step_token_num, _max_thread_per_block, _stream, _p_d_query_buf2,
+          _p_d_dec_wei[_weight_offset + 15], _tw._inner_size);
+    } else {
+      ker_bias_relu_launcher<_DataType>(
+          _step_token_num, _max_thread_per_block, _stream, _p_d_query_buf2,
+          _p_d_dec_wei[_weight_offset + 15], _tw._inner_size);
+    }
   }
 
   /* ---step 2. second ffn layer--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _step_token_num,
       _tw._inner_size, &_type_one, _p_d_dec_wei[_weight_offset + 16], _AType,
       _tw._hidden_size, _p_d_query_buf2, _BType, _tw._inner_size, &_type_one,
@@ -706,12 +1151,196 @@ void Decoder<OpType_>::ffn_add_norm() {
   return;
 }
 
+/**
+Causal self attention over all the positions of the targets of a scoring
+  pass
+*/
+template <OperationType OpType_>
+void Decoder<OpType_>::score_self_attention(int num_targets,
+                                            int trg_seq_len) {
+  int token_num = num_targets * trg_seq_len;
+  /* ---step 0. layer_norm, add output_bias to "query"--- */
+  ker_norm_layer_resual_launcher<_DataType>(
+      token_num, _tw._hidden_size, _stream, _p_d_score_query, _p_d_score_buf1,
+      _p_d_dec_wei[_weight_offset], _p_d_dec_wei[_weight_offset + 1],
+      _p_d_dec_wei[_weight_offset + 5], _max_thread_per_block,
+      _tw._is_post_ln);
+
+  /* ---step 1. qkv = ori_q * qkv_wei + bias, and reshape qkv for multi-head
+   * gemm--- */
+  CHECK_GPU_ERROR(cublas_gemm_ex(
+      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size * 3, token_num,
+      _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 2], _AType,
+      _tw._hidden_size * 3, _p_d_score_buf1, _BType, _tw._hidden_size,
+      &_type_zero, _p_d_score_buf2, _CType, _tw._hidden_size * 3,
+      _computeType, CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  int max_batch_dim = _score_max_token_num * _tw._hidden_size;
+  ker_arrange_encself_qkv_launcher<_DataType>(
+      token_num, _tw._hidden_size, _stream, _p_d_score_buf2,
+      _p_d_dec_wei[_weight_offset + 3], _p_d_score_qkv, max_batch_dim,
+      trg_seq_len, _tw._dim_per_head, _tw._head_num, _max_thread_per_block);
+  _DataType* p_d_q = _p_d_score_qkv;
+  _DataType* p_d_k = p_d_q + max_batch_dim;
+  _DataType* p_d_v = p_d_k + max_batch_dim;
+
+  /* ---step 2. correlation = q * k, perform causal softmax on correlation,
+   * the positions after the end of a target are skipped--- */
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
+      _hd, CUBLAS_OP_T, CUBLAS_OP_N, trg_seq_len, trg_seq_len,
+      _tw._dim_per_head, &_atten_scaler, p_d_k, _AType, _tw._dim_per_head,
+      trg_seq_len * _tw._dim_per_head, p_d_q, _BType, _tw._dim_per_head,
+      trg_seq_len * _tw._dim_per_head, &_type_zero, _p_d_score_c, _CType,
+      trg_seq_len, trg_seq_len * trg_seq_len, num_targets * _tw._head_num,
+      _computeType, CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  ker_correlation_softmax_gpt_launcher<_DataType>(
+      num_targets, trg_seq_len, _tw._head_num, _stream, _p_d_score_c,
+      _p_d_score_trg_len);
+
+  /* ---step 3. new_q = correlation * v--- */
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
+      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._dim_per_head, trg_seq_len,
+      trg_seq_len, &_type_one, p_d_v, _AType, _tw._dim_per_head,
+      trg_seq_len * _tw._dim_per_head, _p_d_score_c, _BType, trg_seq_len,
+      trg_seq_len * trg_seq_len, &_type_zero, p_d_q, _CType,
+      _tw._dim_per_head, trg_seq_len * _tw._dim_per_head,
+      num_targets * _tw._head_num, _computeType,
+      CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  ker_arrange_atten_output_launcher<_DataType>(
+      token_num, _tw._hidden_size, _stream, p_d_q, _p_d_score_buf1,
+      trg_seq_len, _tw._dim_per_head, _tw._head_num, _max_thread_per_block);
+
+  /* ---step 4. new_q = ori_q + new_q * output_wei--- */
+  CHECK_GPU_ERROR(cublas_gemm_ex(
+      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, token_num,
+      _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 4], _AType,
+      _tw._hidden_size, _p_d_score_buf1, _BType, _tw._hidden_size,
+      &_type_one, _p_d_score_query, _CType, _tw._hidden_size, _computeType,
+      CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+}
+
+/**
+Encode-Decoder attention of a scoring pass, the positions of the targets
+  of a source are its queries
+*/
+template <OperationType OpType_>
+void Decoder<OpType_>::score_encdec_attention(int num_targets,
+                                              int trg_seq_len) {
+  int token_num = num_targets * trg_seq_len;
+  int query_num = token_num / _batch_size;
+  /* ---step 0. layer_norm, add output_bias to "query"--- */
+  ker_norm_layer_resual_launcher<_DataType>(
+      token_num, _tw._hidden_size, _stream, _p_d_score_query, _p_d_score_buf1,
+      _p_d_dec_wei[_weight_offset + 6], _p_d_dec_wei[_weight_offset + 7],
+      _p_d_dec_wei[_weight_offset + 11], _max_thread_per_block,
+      _tw._is_post_ln);
+
+  /* ---step 1. new_q = ori_q * q_wei + bias, reshape new_q for multi-head
+   * gemm--- */
+  CHECK_GPU_ERROR(cublas_gemm_ex(
+      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, token_num,
+      _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 8], _AType,
+      _tw._hidden_size, _p_d_score_buf1, _BType, _tw._hidden_size,
+      &_type_zero, _p_d_score_buf2, _CType, _tw._hidden_size, _computeType,
+      CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  ker_arrange_encdec_q_launcher<_DataType>(
+      token_num, _tw._hidden_size, _stream, _p_d_score_buf2,
+      _p_d_dec_wei[_weight_offset + 9], _p_d_score_buf1, query_num,
+      _tw._dim_per_head, _tw._head_num, _max_thread_per_block);
+
+  /* ---step 2. correlation = q * k, perform softmax on correlation--- */
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
+      _hd, CUBLAS_OP_T, CUBLAS_OP_N, _batch_seq_len, query_num,
+      _tw._dim_per_head, &_atten_scaler, _p_d_encdec_k_bgeem[_layer_id], _AType,
+      _tw._dim_per_head, _batch_seq_len * _tw._dim_per_head, _p_d_score_buf1,
+      _BType, _tw._dim_per_head, query_num * _tw._dim_per_head, &_type_zero,
+      _p_d_score_c, _CType, _batch_seq_len, query_num * _batch_seq_len,
+      _batch_size * _tw._head_num, _computeType,
+      CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  ker_correlation_softmax_encdec_launcher<_DataType>(
+      _batch_size, _tw._head_num * query_num, _batch_seq_len, _stream,
+      _p_d_score_c, _p_d_padding_mask);
+
+  /* ---step 3. new_q = correlation * v--- */
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
+      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._dim_per_head, query_num,
+      _batch_seq_len, &_type_one, _p_d_encdec_v_bgeem[_layer_id], _AType,
+      _tw._dim_per_head, _batch_seq_len * _tw._dim_per_head, _p_d_score_c,
+      _BType, _batch_seq_len, query_num * _batch_seq_len, &_type_zero,
+      _p_d_score_buf1, _CType, _tw._dim_per_head,
+      query_num * _tw._dim_per_head, _batch_size * _tw._head_num,
+      _computeType, CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  ker_arrange_atten_output_launcher<_DataType>(
+      token_num, _tw._hidden_size, _stream, _p_d_score_buf1, _p_d_score_buf2,
+      query_num, _tw._dim_per_head, _tw._head_num, _max_thread_per_block);
+
+  /* ---step 4. new_q = ori_q + new_q * output_wei--- */
+  CHECK_GPU_ERROR(cublas_gemm_ex(
+      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, token_num,
+      _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 10], _AType,
+      _tw._hidden_size, _p_d_score_buf2, _BType, _tw._hidden_size,
+      &_type_one, _p_d_score_query, _CType, _tw._hidden_size, _computeType,
+      CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+}
+
+template <OperationType OpType_>
+void Decoder<OpType_>::score_ffn_add_norm(int num_targets, int trg_seq_len) {
+  int token_num = num_targets * trg_seq_len;
+  /* ---step 0. layer_norm, add output_bias to "query"--- */
+  ker_norm_layer_resual_launcher<_DataType>(
+      token_num, _tw._hidden_size, _stream, _p_d_score_query, _p_d_score_buf1,
+      _p_d_dec_wei[_weight_offset + 12], _p_d_dec_wei[_weight_offset + 13],
+      _p_d_dec_wei[_weight_offset + 17], _max_thread_per_block,
+      _tw._is_post_ln);
+
+  /* ---step 1. first ffn layer--- */
+  if (!cublaslt_gemm_bias_act(
+          _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, token_num,
+          _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 14],
+          _tw._inner_size, _p_d_score_buf1, _tw._hidden_size, &_type_zero,
+          _p_d_score_buf2, _tw._inner_size, _p_d_dec_wei[_weight_offset + 15],
+          _AType, _computeType,
+          _tw._use_gelu ? GemmEpilogue::kBiasGelu
+                        : GemmEpilogue::kBiasRelu)) {
+    CHECK_GPU_ERROR(cublas_gemm_ex(
+        _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, token_num,
+        _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 14], _AType,
+        _tw._inner_size, _p_d_score_buf1, _BType, _tw._hidden_size, &_type_zero,
+        _p_d_score_buf2, _CType, _tw._inner_size, _computeType,
+        CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+
+    if (_tw._use_gelu) {
+      ker_bias_gelu_launcher<_DataType>(
+          token_num, _max_thread_per_block, _stream, _p_d_score_buf2,
+          _p_d_dec_wei[_weight_offset + 15], _tw._inner_size);
+    } else {
+      ker_bias_relu_launcher<_DataType>(
+          token_num, _max_thread_per_block, _stream, _p_d_score_buf2,
+          _p_d_dec_wei[_weight_offset + 15], _tw._inner_size);
+    }
+  }
+
+  /* ---step 2. second ffn layer--- */
+  CHECK_GPU_ERROR(cublas_gemm_ex(
+      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, token_num,
+      _tw._inner_size, &_type_one, _p_d_dec_wei[_weight_offset + 16], _AType,
+      _tw._hidden_size, _p_d_score_buf2, _BType, _tw._inner_size, &_type_one,
+      _p_d_score_query, _CType, _tw._hidden_size, _computeType,
+      CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+}
+
 template <OperationType OpType_>
 bool Decoder<OpType_>::sample() {
   CHECK_GPU_ERROR(
       cudaMemsetAsync(_p_d_sample_unfinished, 0, sizeof(int), _stream));
   /* --- Sample new tokens from logits --- */
-  if (_tw._sampling_method == "topk") {
+  if (_processor_config.enabled()) {
+    // exact sampling from the processed logits, top_k and top_p included
+    process_logits(_batch_size);
+    launch_multinomial_sample<_DataType>(
+        _p_d_logit_buf, _p_d_alive_seq, _batch_size, _cur_step + 1,
+        _tw._max_step, _tw._trg_vocab_size, _max_thread_per_block, _stream,
+        _p_d_sample_unfinished, _p_d_curandstate, _tw._end_id);
+  } else if (_tw._sampling_method == "topk") {
     ker_topk_sample_launcher<_DataType>(
         _batch_size, (_cur_step + 1), _tw._max_step, 1, _max_thread_per_block,
         _stream, _p_d_logit_buf, _p_d_trg_emb_wei[6], _p_d_alive_seq,
@@ -767,12 +1396,17 @@ bool Decoder<OpType_>::beam_search() {
     ker_diverse_beam_search_launcher(_p_d_can_score, _p_d_can_idx, _p_d_can_num,
                                      _step_token_num, _max_thread_per_block,
                                      _stream, _tw._beam_size,
-                                     _tw._diverse_lambda, _tw._trg_vocab_size);
+                                     _tw._diverse_lambda, _step_vocab_size);
   }
 
   thrust::sort_by_key(thrust::cuda::par.on(_stream), _p_d_can_score,
                       _p_d_can_score + _h_can_num_batch, _p_d_can_idx,
                       thrust::greater<float>());
+  if (_step_vocab_size != _tw._trg_vocab_size) {
+    launch_shortlist_to_vocab(_p_d_can_idx, _p_d_shortlist, _h_can_num_batch,
+                              _tw._trg_vocab_size, _step_vocab_size,
+                              _max_thread_per_block, _stream);
+  }
 
 #ifdef DEBUG_RESULT
   print_vec(_p_d_can_score, "can score", _h_can_num_batch);
@@ -785,12 +1419,13 @@ bool Decoder<OpType_>::beam_search() {
       Deciding whether early stop based on num_finish_beam
   */
   CHECK_GPU_ERROR(cudaMemsetAsync(_p_d_can_num, 0, sizeof(int), _stream));
-  ker_refresh_result<<<dim3(_batch_size, _tw._beam_size), _tw._max_step, 0,
+  ker_refresh_result<<<dim3(_batch_size, _tw._beam_size),
+                       std::min(_tw._max_step, _max_thread_per_block), 0,
                        _stream>>>(
       _p_d_can_idx, _p_d_can_score, _p_d_can_num + 1, _p_d_alive_seq,
       _p_d_alive_seq_buf, _p_d_alive_seq_probs, _p_d_alive_seq_score,
       _p_d_can_num, _tw._trg_vocab_size, _cur_step, _h_length_norm[_cur_step],
-      _tw._diverse_lambda, _tw._end_id);
+      _tw._diverse_lambda, _tw._end_id, _tw._max_step);
   int* tmp = _p_d_alive_seq_buf;
   _p_d_alive_seq_buf = _p_d_alive_seq;
   _p_d_alive_seq = tmp;
@@ -846,19 +1481,139 @@ template <OperationType OpType_>
 void Decoder<OpType_>::update_new_seq_probs() {
   CHECK_GPU_ERROR(cudaMemsetAsync(_p_d_can_num, 0, sizeof(int), _stream));
 
+  const _DataType* logit_bias = _step_vocab_size == _tw._trg_vocab_size
+                                    ? process_logits(_step_token_num)
+                                    : _p_d_shortlist_bias;
   select_beam_rough_topk_launcher(
-      _p_d_logit_buf, _p_d_trg_emb_wei[6], _p_d_alive_seq_probs,
+      _p_d_logit_buf, logit_bias, _p_d_alive_seq_probs,
       _p_d_alive_seq_score, _p_d_alive_seq, _p_d_can_idx, _p_d_can_score,
-      _p_d_can_num, _tw._trg_vocab_size, _tw._max_step,
+      _p_d_can_num, _step_vocab_size, _tw._max_step,
       _h_length_norm[_cur_step], _cur_step, _step_token_num,
       _max_thread_per_block, _stream, _tw._beam_size, _tw._diverse_lambda,
-      _tw._end_id);
+      _tw._end_id, _shortlist_end_id);
 
   thrust::exclusive_scan(thrust::cuda::par.on(_stream), _p_d_can_num + 1,
                          _p_d_can_num + 1 + _step_token_num, _p_d_can_num + 1);
   return;
 }
 
+/**
+Drop the batch items whose beams are all finished from the following steps.
+Their results are saved at their original positions, and the live items of
+the tail are moved into the slots they leave, see batch_compaction.h.
+Alive seq, seq probs and scores, the self attention cache of the filled steps,
+the encdec attention key and value and the padding mask are moved.
+*/
+template <OperationType OpType_>
+void Decoder<OpType_>::shrink_batch() {
+  // _h_can_num_batch: number of finished beams, refreshed by beam_search
+  if (_h_can_num_batch < _tw._beam_size) {
+    return;
+  }
+  launch_beam_batch_finished(_p_d_alive_seq, _p_d_batch_finished, _batch_size,
+                             _tw._beam_size, _tw._max_step, _cur_step + 1,
+                             _tw._end_id, _stream);
+  CHECK_GPU_ERROR(cudaMemcpyAsync(
+      _h_batch_finished.data(), _p_d_batch_finished, _batch_size * sizeof(int),
+      cudaMemcpyDeviceToHost, _stream));
+  CHECK_GPU_ERROR(cudaStreamSynchronize(_stream));
+
+  std::vector<BatchMove> saves, moves;
+  _compaction.drop(_h_batch_finished, &saves, &moves);
+  if (saves.empty()) {
+    return;
+  }
+  if (_p_d_step_padding_mask == _p_d_padding_mask) {
+    // the mask of the encoder is read only
+    CHECK_GPU_ERROR(cudaMemcpyAsync(
+        _p_d_compact_padding_mask, _p_d_padding_mask,
+        _compaction.batch_size() * _batch_seq_len * sizeof(int),
+        cudaMemcpyDeviceToDevice, _stream));
+    _p_d_step_padding_mask = _p_d_compact_padding_mask;
+  }
+  std::vector<BatchMove> h_moves(saves);
+  h_moves.insert(h_moves.end(), moves.begin(), moves.end());
+  CHECK_GPU_ERROR(cudaMemcpyAsync(_p_d_batch_moves, h_moves.data(),
+                                  h_moves.size() * sizeof(BatchMove),
+                                  cudaMemcpyHostToDevice, _stream));
+  const int* p_d_saves = _p_d_batch_moves;
+  const int* p_d_moves = _p_d_batch_moves + saves.size() * 2;
+  int seq_len = _tw._beam_size * _tw._max_step;
+
+  /* ---step 1. save the results of the finished items--- */
+  launch_move_batch_rows(_p_d_alive_seq, _p_d_finished_seq, p_d_saves,
+                         saves.size(), 1, 0, 1, seq_len, seq_len, sizeof(int),
+                         _max_thread_per_block, _stream);
+  launch_move_beam_score(_p_d_alive_seq_score, _p_d_finished_score, p_d_saves,
+                         saves.size(), _tw._beam_size, _stream);
+
+  /* ---step 2. move the live items of the tail into the finished slots--- */
+  if (!moves.empty()) {
+    launch_move_batch_rows(_p_d_alive_seq, _p_d_alive_seq, p_d_moves,
+                           moves.size(), 1, 0, 1, seq_len, seq_len,
+                           sizeof(int), _max_thread_per_block, _stream);
+    launch_move_batch_rows(_p_d_alive_seq_probs, _p_d_alive_seq_probs,
+                           p_d_moves, moves.size(), 1, 0, 1, _tw._beam_size,
+                           _tw._beam_size, sizeof(float),
+                           _max_thread_per_block, _stream);
+    launch_move_beam_score(_p_d_alive_seq_score, _p_d_alive_seq_score,
+                           p_d_moves, moves.size(), _tw._beam_size, _stream);
+    // steps [0, cur_step] of the self attention cache are filled
+    for (_DataType* cache : {_p_d_self_k_bgeem1[0], _p_d_self_v_bgeem1[0]}) {
+      launch_move_batch_rows(
+          cache, cache, p_d_moves, moves.size(), _tw._n_dec_layer,
+          _layer_size_self_k, _tw._beam_size * _tw._head_num,
+          _tw._max_step * _tw._dim_per_head,
+          (_cur_step + 1) * _tw._dim_per_head, sizeof(_DataType),
+          _max_thread_per_block, _stream);
+    }
+    int encdec_len = _tw._hidden_size * _batch_seq_len;
+    for (_DataType* kv : {_p_d_encdec_k_bgeem[0], _p_d_encdec_v_bgeem[0]}) {
+      launch_move_batch_rows(kv, kv, p_d_moves, moves.size(),
+                             _tw._n_dec_layer, _layer_size_encdec_k, 1,
+                             encdec_len, encdec_len, sizeof(_DataType),
+                             _max_thread_per_block, _stream);
+    }
+    launch_move_batch_rows(_p_d_compact_padding_mask,
+                           _p_d_compact_padding_mask, p_d_moves, moves.size(),
+                           1, 0, 1, _batch_seq_len, _batch_seq_len,
+                           sizeof(int), _max_thread_per_block, _stream);
+  }
+  _batch_size = _compaction.num_live();
+  _step_token_num = _batch_size * _tw._beam_size;
+}
+
+/**
+Scatter the live batch items back to their original positions and restore
+the whole batch, for the output kernels
+*/
+template <OperationType OpType_>
+void Decoder<OpType_>::scatter_batch() {
+  if (!_compaction.compacted()) {
+    return;
+  }
+  std::vector<BatchMove> scatters = _compaction.scatter_moves();
+  CHECK_GPU_ERROR(cudaMemcpyAsync(_p_d_batch_moves, scatters.data(),
+                                  scatters.size() * sizeof(BatchMove),
+                                  cudaMemcpyHostToDevice, _stream));
+  int seq_len = _tw._beam_size * _tw._max_step;
+  launch_move_batch_rows(_p_d_alive_seq, _p_d_finished_seq, _p_d_batch_moves,
+                         scatters.size(), 1, 0, 1, seq_len, seq_len,
+                         sizeof(int), _max_thread_per_block, _stream);
+  launch_move_beam_score(_p_d_alive_seq_score, _p_d_finished_score,
+                         _p_d_batch_moves, scatters.size(), _tw._beam_size,
+                         _stream);
+
+  _batch_size = _compaction.batch_size();
+  _step_token_num = _batch_size * _tw._beam_size;
+  CHECK_GPU_ERROR(cudaMemcpyAsync(_p_d_alive_seq, _p_d_finished_seq,
+                                  _step_token_num * _tw._max_step * sizeof(int),
+                                  cudaMemcpyDeviceToDevice, _stream));
+  CHECK_GPU_ERROR(cudaMemcpyAsync(_p_d_alive_seq_score, _p_d_finished_score,
+                                  _step_token_num * sizeof(float),
+                                  cudaMemcpyDeviceToDevice, _stream));
+}
+
 template <OperationType OpType_>
 bool Decoder<OpType_>::topk_greedy_search() {
   _tw._diverse_lambda = 0;
@@ -869,9 +1624,10 @@ bool Decoder<OpType_>::topk_greedy_search() {
   CHECK_GPU_ERROR(
       cudaMemsetAsync(_p_d_sample_unfinished, 0, sizeof(int), _stream));
   /* --- Sample new tokens from logits --- */
+  const _DataType* logit_bias = process_logits(_step_token_num);
   ker_topk_sample_launcher<_DataType>(
       _step_token_num, (_cur_step + 1), _tw._max_step, 1, _max_thread_per_block,
-      _stream, _p_d_logit_buf, _p_d_trg_emb_wei[6], _p_d_alive_seq,
+      _stream, _p_d_logit_buf, logit_bias, _p_d_alive_seq,
       _p_d_alive_seq_buf, _tw._trg_vocab_size, 1, _p_d_sample_unfinished,
       _p_d_curandstate, _tw._end_id);
 
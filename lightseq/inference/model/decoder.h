@@ -16,6 +16,12 @@
 #include <unistd.h>
 
 #include "../proto/transformer_weight.h"
+#include "../kernels/logits_processor.h"
+#include "../kernels/sequence_scoring.h"
+#include "../tools/lexical_shortlist.h"
+#include "batch_compaction.h"
+#include "../tools/cuda_stage_timer.h"
+#include "../tools/gemm_dispatch.h"
 #include "../tools/util.h"
 
 /**
@@ -47,6 +53,24 @@ class Decoder {
   bool beam_search();
   void update_new_seq_probs();
   bool topk_greedy_search();
+  const _DataType* process_logits(int rows);
+  void shrink_batch();
+  void scatter_batch();
+  void init_score_buffer();
+  void score_pass(const ScorePass& pass, const int* p_d_target,
+                  int trg_seq_len, float* p_d_token_log_prob,
+                  float* p_d_seq_log_prob);
+  void score_self_attention(int num_targets, int trg_seq_len);
+  void score_encdec_attention(int num_targets, int trg_seq_len);
+  void score_ffn_add_norm(int num_targets, int trg_seq_len);
+  // the logits gemm reads the tied embedding [vocab_size, hidden_size]
+  // transposed, see TransformerWeight::_trg_emb_tied
+  cublasOperation_t logit_wei_op() const {
+    return _tw._trg_emb_tied ? CUBLAS_OP_T : CUBLAS_OP_N;
+  }
+  int logit_wei_ld(int vocab_size) const {
+    return _tw._trg_emb_tied ? _tw._hidden_size : vocab_size;
+  }
 
   // constructor init var
   const int _max_batch_size;
@@ -59,6 +83,8 @@ class Decoder {
   cublasHandle_t _hd;
 
   const int* _p_d_padding_mask;
+  // padding mask of the live batch items, see shrink_batch()
+  const int* _p_d_step_padding_mask;
   const _DataType* _p_d_encoder_output;
   int* _p_d_sample_unfinished;
   curandState* _p_d_curandstate;  //[batch_size]
@@ -110,6 +136,63 @@ class Decoder {
   int _step_token_num;
   int _batch_max_decode_length;
   bool _is_sampling;
+  // consecutive batch items decoding the same encoded source, see
+  // set_fan_out()
+  int _fan_out;
+
+  // per-stage timing, see cuda_stage_timer.h
+  CudaStageTimer* _stage_timer;
+  int _stage_project;
+  int _stage_emb;
+  int _stage_logits;
+  int _stage_search;
+  int _stage_shrink;
+  int _stage_score;
+  std::vector<int> _stage_self_attn;
+  std::vector<int> _stage_encdec_attn;
+  std::vector<int> _stage_ffn;
+
+  // logits processor chain, see logits_processor.h
+  LogitsProcessorConfig _processor_config;
+  LogitsProcessorParams _processor_params;
+  int* _p_d_bad_words;  // flattened bad word tokens, then their offsets
+  _DataType* _p_d_zero_logit_bias;  // [vocab_size], the chain folds the bias
+
+  // shrinking-batch beam search, the finished batch items are dropped from
+  // the decoding, see batch_compaction.h
+  bool _shrink_batch;
+  BatchCompaction _compaction;
+  std::vector<int> _h_batch_finished;
+  int* _p_d_batch_finished;        // [batch_size]
+  int* _p_d_batch_moves;           // [batch_size * 2, 2], saves then moves
+  int* _p_d_finished_seq;          // [batch_size, beam_size, max_step]
+  float* _p_d_finished_score;      // [batch_size, beam_size]
+  int* _p_d_compact_padding_mask;  // [batch_size, batch_seq_len]
+
+  // vocab shortlist of beam search, the logits are computed for the
+  // shortlist ids only, see lexical_shortlist.h
+  int _step_vocab_size;  // vocab size of the logits
+  int _shortlist_end_id;  // index of end_id in the shortlist
+  int* _p_d_shortlist;    // [vocab_size]
+  // [hidden_size, vocab_size], [vocab_size, hidden_size] if tied
+  _DataType* _p_d_shortlist_emb;
+  _DataType* _p_d_shortlist_bias;  // [vocab_size]
+
+  // split-K self attention of the long caches, see split_k_attention.h
+  int _num_sms;
+  float* _p_d_split_k_buf;  // partial outputs and softmax statistics
+
+  // teacher-forced scoring, all the positions of a pass at once, allocated
+  // by the first run_score, see sequence_scoring.h
+  int _score_max_token_num;
+  _DataType* _p_d_score_query;  // [max_token_num, hidden_size]
+  _DataType* _p_d_score_buf1;   // [max_token_num, hidden_size]
+  // [max_token_num, max(3 * hidden_size, inner_size)]
+  _DataType* _p_d_score_buf2;
+  _DataType* _p_d_score_qkv;  // [3, max_token_num, hidden_size]
+  // [max_token_num, head_num, max_step]
+  _DataType* _p_d_score_c;
+  int* _p_d_score_trg_len;  // [max_token_num]
 
   const std::vector<const _DataType*>& _p_d_trg_emb_wei;  // size: 7
   const std::vector<const _DataType*>&
@@ -134,10 +217,20 @@ class Decoder {
           TransformerWeight<OpType_>& tw, cudaStream_t stream,
           cublasHandle_t hd, bool output_topk = false,
           const int* p_d_lang_id = nullptr);
+  ~Decoder();
   long compute_buffer_bytesize();
   void init_buffer(void* pbuf);
   std::string check();
   void run_one_infer(int batch_size, int batch_seq_len);
+  void run_score(int batch_size, int batch_seq_len, const int* p_d_target,
+                 int num_targets, int trg_seq_len, float* p_d_token_log_prob,
+                 float* p_d_seq_log_prob);
+  void set_stage_timer(CudaStageTimer* timer);
+  void set_logits_processor(const LogitsProcessorConfig& config);
+  void set_vocab_shortlist(const std::vector<int>& ids);
+  void set_encoder_output(const int* p_d_padding_mask,
+                          const _DataType* p_d_encoder_output);
+  void set_fan_out(int fan_out);
   int _cur_step;
   float* _p_d_alive_seq_score;
   bool _output_topk;
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+@file
+Schedule of the pipelined encoder-decoder inference of several batches,
+CUDA-free so that the queueing and the handoff can be tested on host.
+
+The encoder and the decoder run on their own streams. The encoder writes
+the output of a batch into one of depth slots, the decoder reads it from
+there. The host issues the encoder of batch i + depth right after the
+decoder of batch i, which reuses its slot, so the encoders of the next
+batches are queued on the gpu while the decoder of batch i is stepping.
+The handoffs are stream events:
+  encode(i, slot): the encoder stream waits the slot is freed by the
+    decoder of batch i - depth, then encodes batch i into it and records
+    the slot encoded
+  decode(i, slot): the decoder stream waits the slot is encoded, then
+    decodes batch i from it and records the slot freed
+Decode is blocking on the host, as the decoder synchronizes every step.
+*/
+namespace lightseq {
+namespace cuda {
+
+struct PipelineStep {
+  bool encode;  // encode or decode
+  int batch;
+  int slot;
+};
+
+class EncDecPipeline {
+ public:
+  explicit EncDecPipeline(int depth) : _depth(depth) {
+    if (depth < 1) {
+      throw std::runtime_error("pipeline depth should be at least 1, got " +
+                               std::to_string(depth));
+    }
+  }
+
+  int depth() const { return _depth; }
+  int slot(int batch) const { return batch % _depth; }
+
+  /* Issue order of the steps of num_batches batches, depth 1 is serial */
+  std::vector<PipelineStep> schedule(int num_batches) const {
+    std::vector<PipelineStep> steps;
+    for (int i = 0; i < num_batches && i < _depth; i++) {
+      steps.push_back({true, i, slot(i)});
+    }
+    for (int i = 0; i < num_batches; i++) {
+      steps.push_back({false, i, slot(i)});
+      if (i + _depth < num_batches) {
+        steps.push_back({true, i + _depth, slot(i)});
+      }
+    }
+    return steps;
+  }
+
+  /* Issue the steps, encode(batch, slot) and decode(batch, slot) */
+  template <typename Encode, typename Decode>
+  void run(int num_batches, Encode encode, Decode decode) const {
+    for (const PipelineStep& step : schedule(num_batches)) {
+      if (step.encode) {
+        encode(step.batch, step.slot);
+      } else {
+        decode(step.batch, step.slot);
+      }
+    }
+  }
+
+ private:
+  int _depth;
+};
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -33,7 +33,26 @@ Encoder<OpType_>::Encoder(int max_batch_size, int *p_d_token_id,
 
       _atten_scaler((_DataType)sqrt(1.f / tw._dim_per_head)),
       _max_batch_dim(max_batch_size * tw._max_step * tw._hidden_size),
-      _max_thread_per_block(1024) {}
+      _max_thread_per_block(1024),
+      _stage_timer(nullptr),
+      _stage_emb(-1),
+      _stage_norm(-1),
+      _stage_attn(tw._n_enc_layer, -1),
+      _stage_ffn(tw._n_enc_layer, -1) {}
+
+/**
+Register the timed stages of encoder, embedding, attention and ffn of every
+layer, and the output layer norm
+*/
+template <OperationType OpType_>
+void Encoder<OpType_>::set_stage_timer(CudaStageTimer *timer) {
+  _stage_timer = timer;
+  _stage_emb = timer->stage_id("encoder.embedding");
+  _stage_norm = timer->stage_id("encoder.output_norm");
+  _stage_attn =
+      timer->layer_stage_ids("encoder", "attention", _tw._n_enc_layer);
+  _stage_ffn = timer->layer_stage_ids("encoder", "ffn", _tw._n_enc_layer);
+}
 
 /**
 Compute GPU memory size needed by transformer encoder,
@@ -120,11 +139,14 @@ void Encoder<OpType_>::run_one_infer(int batch_size, int batch_seq_len) {
 #endif
 
   /* ---step2. encoder feedforward--- */
-  launch_enc_emb<_DataType>(_p_d_src_emb_wei[0], _p_d_src_emb_wei[1],
-                            _p_d_token_id, _p_d_output, _p_d_padding_mask,
-                            _tw._padding_id, batch_size, batch_seq_len,
-                            _tw._hidden_size, _stream, _p_d_src_emb_wei[4],
-                            _p_d_lang_id, _tw._multilg_type);
+  {
+    CudaStageScope scope(_stage_timer, _stage_emb, _stream);
+    launch_enc_emb<_DataType>(_p_d_src_emb_wei[0], _p_d_src_emb_wei[1],
+                              _p_d_token_id, _p_d_output, _p_d_padding_mask,
+                              _tw._padding_id, batch_size, batch_seq_len,
+                              _tw._hidden_size, _stream, _p_d_src_emb_wei[4],
+                              _p_d_lang_id, _tw._multilg_type);
+  }
 #ifdef DEBUG_RESULT
   for (int i = 0; i < _batch_size; i++) {       // batch_id
     for (int j = 0; j < _batch_seq_len; j++) {  // token_id
@@ -139,14 +161,23 @@ void Encoder<OpType_>::run_one_infer(int batch_size, int batch_seq_len) {
 #endif
   for (_layer_id = 0; _layer_id < _tw._n_enc_layer; _layer_id++) {
     _weight_offset = _layer_id * _tw._weight_per_enc_layer;
-    self_attention();
-    ffn_add_norm();
+    {
+      CudaStageScope scope(_stage_timer, _stage_attn[_layer_id], _stream);
+      self_attention();
+    }
+    {
+      CudaStageScope scope(_stage_timer, _stage_ffn[_layer_id], _stream);
+      ffn_add_norm();
+    }
   }
 
   // last layer norm
-  ker_norm_layer_launcher<_DataType>(
-      _batch_token_num, _tw._hidden_size, _stream, _p_d_output,
-      _p_d_src_emb_wei[2], _p_d_src_emb_wei[3], _max_thread_per_block);
+  {
+    CudaStageScope scope(_stage_timer, _stage_norm, _stream);
+    ker_norm_layer_launcher<_DataType>(
+        _batch_token_num, _tw._hidden_size, _stream, _p_d_output,
+        _p_d_src_emb_wei[2], _p_d_src_emb_wei[3], _max_thread_per_block);
+  }
 
 #ifdef DEBUG_RESULT
   for (int i = 0; i < _batch_size; i++) {       // batch_id
@@ -174,7 +205,7 @@ void Encoder<OpType_>::self_attention() {
 
   /* ---step 1. qkv = ori_q * qkv_wei + bias, and reshape qkv for multi-head
    * gemm--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size * 3, _batch_token_num,
       _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 2], _AType,
       _tw._hidden_size * 3, _p_d_q, _BType, _tw._hidden_size, &_fzero,
@@ -187,7 +218,7 @@ void Encoder<OpType_>::self_attention() {
       _tw._dim_per_head, _tw._head_num, _max_thread_per_block);
 
   /* ---step 2. correlation = q * k, perform softmax on correlation--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_T, CUBLAS_OP_N, _batch_seq_len, _batch_seq_len,
       _tw._dim_per_head, &_atten_scaler, _p_d_k, _AType, _tw._dim_per_head,
       _batch_seq_len * _tw._dim_per_head, _p_d_q, _BType, _tw._dim_per_head,
@@ -200,7 +231,7 @@ void Encoder<OpType_>::self_attention() {
       _p_d_padding_mask);
 
   /* ---step 3. new_q = correlation * v--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._dim_per_head, _batch_seq_len,
       _batch_seq_len, &_fone, _p_d_v, _AType, _tw._dim_per_head,
       _batch_seq_len * _tw._dim_per_head, _p_d_c, _BType, _batch_seq_len,
@@ -216,7 +247,7 @@ void Encoder<OpType_>::self_attention() {
       _batch_seq_len, _tw._dim_per_head, _tw._head_num, _max_thread_per_block);
 
   /* ---step 4. new_q = ori_q + new_q * output_wei--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _batch_token_num,
       _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 4], _AType,
       _tw._hidden_size, _p_d_v, _BType, _tw._hidden_size, &_fone, _p_d_output,
@@ -234,23 +265,32 @@ void Encoder<OpType_>::ffn_add_norm() {
       _p_d_enc_wei[_weight_offset + 11], _max_thread_per_block,
       _tw._is_post_ln);
   /* ---step 1. first ffn layer--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
-      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _batch_token_num,
-      _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 8], _AType,
-      _tw._inner_size, _p_d_ffn_buf1, _BType, _tw._hidden_size, &_fzero,
-      _p_d_ffn_buf2, _CType, _tw._inner_size, _computeType,
-      CUBLAS_GEMM_DEFAULT_TENSOR_OP));
-  if (_tw._use_gelu) {
-    ker_bias_gelu_launcher<_DataType>(
-        _batch_token_num, _max_thread_per_block, _stream, _p_d_ffn_buf2,
-        _p_d_enc_wei[_weight_offset + 9], _tw._inner_size);
-  } else {
-    ker_bias_relu_launcher<_DataType>(
-        _batch_token_num, _max_thread_per_block, _stream, _p_d_ffn_buf2,
-        _p_d_enc_wei[_weight_offset + 9], _tw._inner_size);
+  if (!cublaslt_gemm_bias_act(
+          _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _batch_token_num,
+          _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 8],
+          _tw._inner_size, _p_d_ffn_buf1, _tw._hidden_size, &_fzero,
+          _p_d_ffn_buf2, _tw._inner_size, _p_d_enc_wei[_weight_offset + 9],
+          _AType, _computeType,
+          _tw._use_gelu ? GemmEpilogue::kBiasGelu
+                        : GemmEpilogue::kBiasRelu)) {
+    CHECK_GPU_ERROR(cublas_gemm_ex(
+        _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _batch_token_num,
+        _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 8], _AType,
+        _tw._inner_size, _p_d_ffn_buf1, _BType, _tw._hidden_size, &_fzero,
+        _p_d_ffn_buf2, _CType, _tw._inner_size, _computeType,
+        CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+    if (_tw._use_gelu) {
+      ker_bias_gelu_launcher<_DataType>(
+          _batch_token_num, _max_thread_per_block, _stream, _p_d_ffn_buf2,
+          _p_d_enc_wei[_weight_offset + 9], _tw._inner_size);
+    } else {
+      ker_bias_relu_launcher<_DataType>(
+          _batch_token_num, _max_thread_per_block, _stream, _p_d_ffn_buf2,
+          _p_d_enc_wei[_weight_offset + 9], _tw._inner_size);
+    }
   }
   /* ---step 2. second ffn layer--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _batch_token_num,
       _tw._inner_size, &_fone, _p_d_enc_wei[_weight_offset + 10], _AType,
       _tw._hidden_size, _p_d_ffn_buf2, _BType, _tw._inner_size, &_fone,
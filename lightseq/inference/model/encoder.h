@@ -13,6 +13,8 @@
 #include <string>
 
 #include "../proto/transformer_weight.h"
+#include "../tools/cuda_stage_timer.h"
+#include "../tools/gemm_dispatch.h"
 #include "../tools/util.h"
 
 /**
@@ -76,6 +78,13 @@ class Encoder {
   int _layer_id;
   int _weight_offset;
 
+  // per-stage timing, see cuda_stage_timer.h
+  CudaStageTimer *_stage_timer;
+  int _stage_emb;
+  int _stage_norm;
+  std::vector<int> _stage_attn;
+  std::vector<int> _stage_ffn;
+
  public:
   Encoder(int max_batch_size, int *p_d_token_id, int *p_d_padding_mask,
           _DataType *p_d_output, const TransformerWeight<OpType_> &tw,
@@ -85,6 +94,7 @@ class Encoder {
   void init_buffer(void *pbuf);
   std::string check();
   void run_one_infer(int batch_size, int batch_seq_len);
+  void set_stage_timer(CudaStageTimer *timer);
   int *_p_d_token_id;  // input token id [batch_size, batch_seq_len]
   const int *_p_d_lang_id;
 };
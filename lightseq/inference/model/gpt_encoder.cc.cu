@@ -1,4 +1,5 @@
 #include "../kernels/gptKernels.h"
+#include "../kernels/samplingKernels.h"
 #include "../kernels/transformerKernels.h"
 #include "gpt_encoder.h"
 
@@ -37,7 +38,92 @@ GptEncoder<OpType_>::GptEncoder(int max_batch_size, const int *p_d_token_id,
       _h_real_seq_len(max_batch_size, 0),
       _h_ppl(max_batch_size, 0.f),
       _h_sample_id(max_batch_size * tw._max_step, 0),
-      _h_unfinished(1) {}
+      _h_unfinished(1),
+      _stage_timer(nullptr),
+      _stage_emb(-1),
+      _stage_norm(-1),
+      _stage_logits(-1),
+      _stage_sampling(-1),
+      _stage_ppl(-1),
+      _stage_attn(tw._n_enc_layer, -1),
+      _stage_ffn(tw._n_enc_layer, -1),
+      _p_d_bad_words(nullptr),
+      _prompt_len(0),
+      _num_return_sequences(1) {}
+
+template <OperationType OpType_>
+GptEncoder<OpType_>::~GptEncoder() {
+  // the logits processor buffers, allocated by set_logits_processor
+  if (_p_d_bad_words != nullptr) CHECK_GPU_ERROR(cudaFree(_p_d_bad_words));
+}
+
+/**
+Set the logits processor chain of the following samples, see
+  logits_processor.h. The generated length of min_length and max_length
+  excludes the prompt, the padding id is ignored by repetition_penalty
+*/
+template <OperationType OpType_>
+void GptEncoder<OpType_>::set_logits_processor(
+    const LogitsProcessorConfig &config) {
+  std::string err = config.check(_tw._src_vocab_size);
+  if (!err.empty()) {
+    throw std::runtime_error("logits processor: " + err);
+  }
+  FlatBadWords bad_words(config.bad_words);
+  // cudaFree waits for the running sample that may read the old words
+  if (_p_d_bad_words != nullptr) {
+    CHECK_GPU_ERROR(cudaFree(_p_d_bad_words));
+    _p_d_bad_words = nullptr;
+  }
+  if (bad_words.size() > 0) {
+    size_t num_tokens = bad_words.tokens.size();
+    CHECK_GPU_ERROR(
+        cudaMalloc((void **)&_p_d_bad_words,
+                   (num_tokens + bad_words.offsets.size()) * sizeof(int)));
+    CHECK_GPU_ERROR(cudaMemcpy(_p_d_bad_words, bad_words.tokens.data(),
+                               num_tokens * sizeof(int),
+                               cudaMemcpyHostToDevice));
+    CHECK_GPU_ERROR(cudaMemcpy(
+        _p_d_bad_words + num_tokens, bad_words.offsets.data(),
+        bad_words.offsets.size() * sizeof(int), cudaMemcpyHostToDevice));
+  }
+  _processor_config = config;
+  _processor_params = make_logits_processor_params(
+      config, _p_d_bad_words, _p_d_bad_words + bad_words.tokens.size(),
+      _tw._eos_id, _tw._padding_id);
+}
+
+/**
+Sample num_return_sequences sequences per prompt in the following samples,
+  the prompt runs once and its keys and values are forked, see fork_prompt()
+*/
+template <OperationType OpType_>
+void GptEncoder<OpType_>::set_num_return_sequences(int n) {
+  if (n < 1) {
+    throw std::runtime_error("num_return_sequences should be at least 1");
+  }
+  if (n > _max_batch_size) {
+    throw std::runtime_error(
+        "num_return_sequences greater than max_batch_size");
+  }
+  _num_return_sequences = n;
+}
+
+/**
+Register the timed stages of gpt. The prompt and every generated token go
+through the same stages, so the per-layer stages cover both
+*/
+template <OperationType OpType_>
+void GptEncoder<OpType_>::set_stage_timer(CudaStageTimer *timer) {
+  _stage_timer = timer;
+  _stage_emb = timer->stage_id("gpt.embedding");
+  _stage_norm = timer->stage_id("gpt.output_norm");
+  _stage_logits = timer->stage_id("gpt.logits");
+  _stage_sampling = timer->stage_id("gpt.sampling");
+  _stage_ppl = timer->stage_id("gpt.ppl");
+  _stage_attn = timer->layer_stage_ids("gpt", "attention", _tw._n_enc_layer);
+  _stage_ffn = timer->layer_stage_ids("gpt", "ffn", _tw._n_enc_layer);
+}
 
 /**
 Compute GPU memory size needed by gpt encoder,
@@ -162,10 +248,13 @@ void GptEncoder<OpType_>::run_one_infer(int batch_size, int batch_seq_len) {
 #endif
 
   // token embedding, add position embedding and layer_norm
-  ker_gpt_embedding_launcher<_DataType>(
-      batch_size, batch_seq_len, _tw._hidden_size, _stream, _p_d_src_emb_wei[0],
-      _p_d_src_emb_wei[1], _p_d_token_id, _p_d_query, _p_d_real_seq_len,
-      _tw._padding_id, 0);
+  {
+    CudaStageScope scope(_stage_timer, _stage_emb, _stream);
+    ker_gpt_embedding_launcher<_DataType>(
+        batch_size, batch_seq_len, _tw._hidden_size, _stream,
+        _p_d_src_emb_wei[0], _p_d_src_emb_wei[1], _p_d_token_id, _p_d_query,
+        _p_d_real_seq_len, _tw._padding_id, 0);
+  }
 
 #ifdef DEBUG_RESULT
   print_vec(_p_d_query, "input embeddings",
@@ -175,16 +264,28 @@ void GptEncoder<OpType_>::run_one_infer(int batch_size, int batch_seq_len) {
 
   for (_layer_id = 0; _layer_id < _tw._n_enc_layer; _layer_id++) {
     _weight_offset = _layer_id * _tw._weight_per_enc_layer;
-    self_attention();
-    ffn_add_norm();
+    {
+      CudaStageScope scope(_stage_timer, _stage_attn[_layer_id], _stream);
+      self_attention();
+    }
+    {
+      CudaStageScope scope(_stage_timer, _stage_ffn[_layer_id], _stream);
+      ffn_add_norm();
+    }
   }
 
   // last layer norm
-  ker_norm_layer_launcher<_DataType>(
-      _batch_token_num, _tw._hidden_size, _stream, _p_d_query,
-      _p_d_src_emb_wei[2], _p_d_src_emb_wei[3], _max_thread_per_block);
+  {
+    CudaStageScope scope(_stage_timer, _stage_norm, _stream);
+    ker_norm_layer_launcher<_DataType>(
+        _batch_token_num, _tw._hidden_size, _stream, _p_d_query,
+        _p_d_src_emb_wei[2], _p_d_src_emb_wei[3], _max_thread_per_block);
+  }
 
-  compute_ppl();
+  {
+    CudaStageScope scope(_stage_timer, _stage_ppl, _stream);
+    compute_ppl();
+  }
 
   return;
 }
@@ -197,8 +298,13 @@ int GptEncoder<OpType_>::run_one_sample(int batch_size, int batch_seq_len) {
   if (batch_seq_len > _tw._max_step) {
     throw std::runtime_error("seq len of input greater than max_step");
   }
+  if (batch_size * _num_return_sequences > _max_batch_size) {
+    throw std::runtime_error(
+        "batch size * num_return_sequences greater than max_batch_size");
+  }
   _batch_size = batch_size;
   _batch_seq_len = batch_seq_len;
+  _prompt_len = batch_seq_len;
   _batch_token_num = batch_size * batch_seq_len;
   _batch_max_seq_len =
       min(_tw._max_step, batch_seq_len + _tw._extra_decode_length);
@@ -222,10 +328,13 @@ int GptEncoder<OpType_>::run_one_sample(int batch_size, int batch_seq_len) {
 #endif
 
   // token embedding, add position embedding and layer_norm
-  ker_gpt_embedding_launcher<_DataType>(
-      _batch_size, _batch_seq_len, _tw._hidden_size, _stream,
-      _p_d_src_emb_wei[0], _p_d_src_emb_wei[1], _p_d_sample_id, _p_d_query,
-      _p_d_real_seq_len, _tw._padding_id, 0);
+  {
+    CudaStageScope scope(_stage_timer, _stage_emb, _stream);
+    ker_gpt_embedding_launcher<_DataType>(
+        _batch_size, _batch_seq_len, _tw._hidden_size, _stream,
+        _p_d_src_emb_wei[0], _p_d_src_emb_wei[1], _p_d_sample_id, _p_d_query,
+        _p_d_real_seq_len, _tw._padding_id, 0);
+  }
 
 #ifdef DEBUG_RESULT
   print_vec(_p_d_query, "embedding", _batch_token_num * _tw._hidden_size - 10,
@@ -234,15 +343,40 @@ int GptEncoder<OpType_>::run_one_sample(int batch_size, int batch_seq_len) {
 
   for (_layer_id = 0; _layer_id < _tw._n_enc_layer; _layer_id++) {
     _weight_offset = _layer_id * _tw._weight_per_enc_layer;
-    self_attention(true);
-    ffn_add_norm();
+    {
+      CudaStageScope scope(_stage_timer, _stage_attn[_layer_id], _stream);
+      self_attention(true);
+    }
+    {
+      CudaStageScope scope(_stage_timer, _stage_ffn[_layer_id], _stream);
+      ffn_add_norm();
+    }
   }
 
   // last layer norm
-  ker_norm_layer_launcher<_DataType>(
-      _batch_token_num, _tw._hidden_size, _stream, _p_d_query,
-      _p_d_src_emb_wei[2], _p_d_src_emb_wei[3], _max_thread_per_block);
-  if (sample_one_token() == 0 || _batch_seq_len >= _tw._max_step) {
+  {
+    CudaStageScope scope(_stage_timer, _stage_norm, _stream);
+    ker_norm_layer_launcher<_DataType>(
+        _batch_token_num, _tw._hidden_size, _stream, _p_d_query,
+        _p_d_src_emb_wei[2], _p_d_src_emb_wei[3], _max_thread_per_block);
+  }
+  int unfinished;
+  if (_num_return_sequences > 1) {
+    fork_prompt();
+    unfinished = sample_one_token_with_cache();
+  } else {
+    unfinished = sample_one_token();
+  }
+  return sample_with_cache(unfinished);
+}
+
+/**
+Sample the following tokens one by one with the cache after the sample of
+  the prompt, unfinished is its result. Return the sampled seq len
+*/
+template <OperationType OpType_>
+int GptEncoder<OpType_>::sample_with_cache(int unfinished) {
+  if (unfinished == 0 || _batch_seq_len >= _tw._max_step) {
     CHECK_GPU_ERROR(cudaMemcpyAsync(_p_d_sample_id_buf, _p_d_sample_id,
                                     _batch_token_num * sizeof(int),
                                     cudaMemcpyDeviceToDevice, _stream));
@@ -258,24 +392,36 @@ int GptEncoder<OpType_>::run_one_sample(int batch_size, int batch_seq_len) {
 #endif
 
     // token embedding, add position embedding and layer_norm
-    ker_gpt_embedding_launcher<_DataType>(
-        _batch_size, 1, _tw._hidden_size, _stream, _p_d_src_emb_wei[0],
-        _p_d_src_emb_wei[1], _p_d_last_sample_id, _p_d_query, _p_d_real_seq_len,
-        _tw._padding_id, _batch_seq_len - 1);
+    {
+      CudaStageScope scope(_stage_timer, _stage_emb, _stream);
+      ker_gpt_embedding_launcher<_DataType>(
+          _batch_size, 1, _tw._hidden_size, _stream, _p_d_src_emb_wei[0],
+          _p_d_src_emb_wei[1], _p_d_last_sample_id, _p_d_query,
+          _p_d_real_seq_len, _tw._padding_id, _batch_seq_len - 1);
+    }
 #ifdef DEBUG_RESULT
     print_vec(_p_d_query, "embedding", _batch_size * _tw._hidden_size - 10,
               _batch_size * _tw._hidden_size);
 #endif
     for (_layer_id = 0; _layer_id < _tw._n_enc_layer; _layer_id++) {
       _weight_offset = _layer_id * _tw._weight_per_enc_layer;
-      self_attention_with_cache();
-      ffn_add_norm_with_cache();
+      {
+        CudaStageScope scope(_stage_timer, _stage_attn[_layer_id], _stream);
+        self_attention_with_cache();
+      }
+      {
+        CudaStageScope scope(_stage_timer, _stage_ffn[_layer_id], _stream);
+        ffn_add_norm_with_cache();
+      }
     }
 
     // last layer norm
-    ker_norm_layer_launcher<_DataType>(
-        _batch_size, _tw._hidden_size, _stream, _p_d_query, _p_d_src_emb_wei[2],
-        _p_d_src_emb_wei[3], _max_thread_per_block);
+    {
+      CudaStageScope scope(_stage_timer, _stage_norm, _stream);
+      ker_norm_layer_launcher<_DataType>(
+          _batch_size, _tw._hidden_size, _stream, _p_d_query,
+          _p_d_src_emb_wei[2], _p_d_src_emb_wei[3], _max_thread_per_block);
+    }
 #ifdef DEBUG_RESULT
     print_vec(_p_d_query, "_p_d_query before logits",
               _batch_size * _tw._hidden_size - 10,
@@ -294,26 +440,266 @@ int GptEncoder<OpType_>::run_one_sample(int batch_size, int batch_seq_len) {
   return _batch_seq_len;
 }
 
+/**
+Sample the next turn of a conversation, see session_cache.h. The input
+  [1, batch_seq_len] is the whole conversation, the keys and values of its
+  first prefix_len positions are in the cache, see load_session_cache(), only
+  the following positions are encoded. Return the sampled seq len, the cache
+  then holds all the positions but the last sampled one
+*/
 template <OperationType OpType_>
-int GptEncoder<OpType_>::sample_one_token() {
-  /* ---step 1. project hidden states to vocab logits--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
-      _hd, CUBLAS_OP_T, CUBLAS_OP_N, _tw._src_vocab_size, _batch_token_num,
-      _tw._hidden_size, &_fone, _p_d_src_emb_wei[0], _AType, _tw._hidden_size,
-      _p_d_query, _BType, _tw._hidden_size, &_fzero, _p_d_logit, _CType,
-      _tw._src_vocab_size, _computeType, CUBLAS_GEMM_DEFAULT_TENSOR_OP));
-#ifdef DEBUG_RESULT
-  print_vec(_p_d_logit, "logits", _batch_token_num * _tw._src_vocab_size - 10,
-            _batch_token_num * _tw._src_vocab_size);
-#endif
-  CHECK_GPU_ERROR(cudaMemsetAsync(_p_d_unfinished, 0, sizeof(int), _stream));
-  /* ---step 2. sample new tokens from logits */
-  if (_tw._sampling_method == "topk") {
+int GptEncoder<OpType_>::run_session_sample(int batch_seq_len,
+                                            int prefix_len) {
+  if (batch_seq_len > _tw._max_step) {
+    throw std::runtime_error("seq len of input greater than max_step");
+  }
+  if (prefix_len < 0 || prefix_len >= batch_seq_len) {
+    throw std::runtime_error("session: the new turn is empty");
+  }
+  int new_len = batch_seq_len - prefix_len;
+  _batch_size = 1;
+  _batch_seq_len = batch_seq_len;
+  _prompt_len = batch_seq_len;
+  _batch_token_num = new_len;
+  _batch_max_seq_len =
+      min(_tw._max_step, batch_seq_len + _tw._extra_decode_length);
+
+  // the embedding counts the new positions
+  CHECK_GPU_ERROR(cudaMemcpyAsync(_p_d_real_seq_len, &prefix_len, sizeof(int),
+                                  cudaMemcpyHostToDevice, _stream));
+  CHECK_GPU_ERROR(cudaMemcpyAsync(_p_d_sample_id, _p_d_token_id,
+                                  sizeof(int) * batch_seq_len,
+                                  cudaMemcpyDeviceToDevice, _stream));
+  {
+    CudaStageScope scope(_stage_timer, _stage_emb, _stream);
+    ker_gpt_embedding_launcher<_DataType>(
+        1, new_len, _tw._hidden_size, _stream, _p_d_src_emb_wei[0],
+        _p_d_src_emb_wei[1], _p_d_sample_id + prefix_len, _p_d_query,
+        _p_d_real_seq_len, _tw._padding_id, prefix_len);
+  }
+
+  for (_layer_id = 0; _layer_id < _tw._n_enc_layer; _layer_id++) {
+    _weight_offset = _layer_id * _tw._weight_per_enc_layer;
+    {
+      CudaStageScope scope(_stage_timer, _stage_attn[_layer_id], _stream);
+      self_attention_with_prefix(prefix_len);
+    }
+    {
+      CudaStageScope scope(_stage_timer, _stage_ffn[_layer_id], _stream);
+      ffn_add_norm();
+    }
+  }
+
+  {
+    CudaStageScope scope(_stage_timer, _stage_norm, _stream);
+    ker_norm_layer_launcher<_DataType>(
+        new_len, _tw._hidden_size, _stream, _p_d_query, _p_d_src_emb_wei[2],
+        _p_d_src_emb_wei[3], _max_thread_per_block);
+  }
+  // the first token is sampled from the last position, like a cached step
+  if (new_len > 1) {
+    CHECK_GPU_ERROR(cudaMemcpyAsync(
+        _p_d_query, _p_d_query + (new_len - 1) * _tw._hidden_size,
+        _tw._hidden_size * sizeof(_DataType), cudaMemcpyDeviceToDevice,
+        _stream));
+  }
+  _batch_token_num = batch_seq_len;
+  return sample_with_cache(sample_one_token_with_cache());
+}
+
+/**
+Self attention of the new_len = _batch_token_num positions after the
+  prefix_len cached ones of a conversation, the cache of the layer grows to
+  all the positions
+*/
+template <OperationType OpType_>
+void GptEncoder<OpType_>::self_attention_with_prefix(int prefix_len) {
+  int new_len = _batch_token_num;
+  int seq_len = prefix_len + new_len;
+  size_t elt = sizeof(_DataType);
+  _DataType *k_cache = _p_d_k_cache + _layer_id * _max_batch_dim;
+  _DataType *v_cache = _p_d_v_cache + _layer_id * _max_batch_dim;
+
+  /* ---step 0. layer_norm, add output_bias to "query"--- */
+  ker_norm_layer_resual_launcher<_DataType>(
+      new_len, _tw._hidden_size, _stream, _p_d_query, _p_d_q,
+      _p_d_enc_wei[_weight_offset], _p_d_enc_wei[_weight_offset + 1],
+      _p_d_enc_wei[_weight_offset + 5], _max_thread_per_block);
+
+  /* ---step 1. qkv of the new positions, [head_num, new_len, dim_per_head]
+   * each--- */
+  CHECK_GPU_ERROR(cublas_gemm_ex(
+      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size * 3, new_len,
+      _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 2], _AType,
+      _tw._hidden_size * 3, _p_d_q, _BType, _tw._hidden_size, &_fzero,
+      _p_d_qkv_projected, _CType, _tw._hidden_size * 3, _computeType,
+      CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  ker_arrange_encself_qkv_launcher<_DataType>(
+      new_len, _tw._hidden_size, _stream, _p_d_qkv_projected,
+      _p_d_enc_wei[_weight_offset + 3], _p_d_q, _max_batch_dim, new_len,
+      _tw._dim_per_head, _tw._head_num, _max_thread_per_block);
+
+  /* ---step 2. append them to the cached ones of every head, in the free
+   * qkv buffer, [head_num, seq_len, dim_per_head]--- */
+  _DataType *p_k = _p_d_qkv_projected;
+  _DataType *p_v = _p_d_qkv_projected + _max_batch_dim;
+  size_t head_bytes = (size_t)seq_len * _tw._dim_per_head * elt;
+  size_t prefix_bytes = (size_t)prefix_len * _tw._dim_per_head * elt;
+  size_t new_bytes = (size_t)new_len * _tw._dim_per_head * elt;
+  if (prefix_len > 0) {
+    CHECK_GPU_ERROR(cudaMemcpy2DAsync(p_k, head_bytes, k_cache, prefix_bytes,
+                                      prefix_bytes, _tw._head_num,
+                                      cudaMemcpyDeviceToDevice, _stream));
+    CHECK_GPU_ERROR(cudaMemcpy2DAsync(p_v, head_bytes, v_cache, prefix_bytes,
+                                      prefix_bytes, _tw._head_num,
+                                      cudaMemcpyDeviceToDevice, _stream));
+  }
+  CHECK_GPU_ERROR(cudaMemcpy2DAsync(
+      p_k + prefix_len * _tw._dim_per_head, head_bytes, _p_d_k, new_bytes,
+      new_bytes, _tw._head_num, cudaMemcpyDeviceToDevice, _stream));
+  CHECK_GPU_ERROR(cudaMemcpy2DAsync(
+      p_v + prefix_len * _tw._dim_per_head, head_bytes, _p_d_v, new_bytes,
+      new_bytes, _tw._head_num, cudaMemcpyDeviceToDevice, _stream));
+  CHECK_GPU_ERROR(cudaMemcpyAsync(k_cache, p_k, _tw._head_num * head_bytes,
+                                  cudaMemcpyDeviceToDevice, _stream));
+  CHECK_GPU_ERROR(cudaMemcpyAsync(v_cache, p_v, _tw._head_num * head_bytes,
+                                  cudaMemcpyDeviceToDevice, _stream));
+
+  /* ---step 3. correlation = q * k, causal softmax over all the positions
+  correlation: [head_num, new_len, seq_len]--- */
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
+      _hd, CUBLAS_OP_T, CUBLAS_OP_N, seq_len, new_len, _tw._dim_per_head,
+      &_atten_scaler, p_k, _AType, _tw._dim_per_head,
+      seq_len * _tw._dim_per_head, _p_d_q, _BType, _tw._dim_per_head,
+      new_len * _tw._dim_per_head, &_fzero, _p_d_c, _CType, seq_len,
+      new_len * seq_len, _tw._head_num, _computeType,
+      CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  ker_attention_mask_weights_launcher<_DataType>(1, new_len, seq_len,
+                                                 _tw._head_num, _stream,
+                                                 _p_d_c, _p_d_real_seq_len);
+
+  /* ---step 4. new_q = correlation * v--- */
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
+      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._dim_per_head, new_len, seq_len,
+      &_fone, p_v, _AType, _tw._dim_per_head, seq_len * _tw._dim_per_head,
+      _p_d_c, _BType, seq_len, new_len * seq_len, &_fzero, _p_d_q, _CType,
+      _tw._dim_per_head, new_len * _tw._dim_per_head, _tw._head_num,
+      _computeType, CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  ker_arrange_atten_output_launcher<_DataType>(
+      new_len, _tw._hidden_size, _stream, _p_d_q, _p_d_v, new_len,
+      _tw._dim_per_head, _tw._head_num, _max_thread_per_block);
+
+  /* ---step 5. new_q = ori_q + new_q * output_wei--- */
+  CHECK_GPU_ERROR(cublas_gemm_ex(
+      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, new_len,
+      _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 4], _AType,
+      _tw._hidden_size, _p_d_v, _BType, _tw._hidden_size, &_fone, _p_d_query,
+      _CType, _tw._hidden_size, _computeType, CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+}
+
+/**
+Bytes of the keys and values of seq_len positions of a conversation,
+  [n_enc_layer, 2, head_num, seq_len, dim_per_head]
+*/
+template <OperationType OpType_>
+size_t GptEncoder<OpType_>::session_cache_bytes(int seq_len) const {
+  return 2 * (size_t)_tw._n_enc_layer * seq_len * _tw._hidden_size *
+         sizeof(_DataType);
+}
+
+/**
+Copy the keys and values of a conversation into the cache of batch item 0
+*/
+template <OperationType OpType_>
+void GptEncoder<OpType_>::load_session_cache(const void *src, int seq_len) {
+  // the cache copies of the previous infer are done
+  CHECK_GPU_ERROR(cudaStreamSynchronize(_cache_stream));
+  size_t bytes = (size_t)seq_len * _tw._hidden_size * sizeof(_DataType);
+  size_t pitch = _max_batch_dim * sizeof(_DataType);
+  const char *p_src = static_cast<const char *>(src);
+  CHECK_GPU_ERROR(cudaMemcpy2DAsync(_p_d_k_cache, pitch, p_src, 2 * bytes,
+                                    bytes, _tw._n_enc_layer,
+                                    cudaMemcpyDeviceToDevice, _stream));
+  CHECK_GPU_ERROR(cudaMemcpy2DAsync(_p_d_v_cache, pitch, p_src + bytes,
+                                    2 * bytes, bytes, _tw._n_enc_layer,
+                                    cudaMemcpyDeviceToDevice, _stream));
+}
+
+/**
+Copy the keys and values of the first seq_len positions of batch item 0
+  out of the cache, the inverse of load_session_cache()
+*/
+template <OperationType OpType_>
+void GptEncoder<OpType_>::save_session_cache(void *dst, int seq_len) {
+  CHECK_GPU_ERROR(cudaStreamSynchronize(_cache_stream));
+  size_t bytes = (size_t)seq_len * _tw._hidden_size * sizeof(_DataType);
+  size_t pitch = _max_batch_dim * sizeof(_DataType);
+  char *p_dst = static_cast<char *>(dst);
+  CHECK_GPU_ERROR(cudaMemcpy2DAsync(p_dst, 2 * bytes, _p_d_k_cache, pitch,
+                                    bytes, _tw._n_enc_layer,
+                                    cudaMemcpyDeviceToDevice, _stream));
+  CHECK_GPU_ERROR(cudaMemcpy2DAsync(p_dst + bytes, 2 * bytes, _p_d_v_cache,
+                                    pitch, bytes, _tw._n_enc_layer,
+                                    cudaMemcpyDeviceToDevice, _stream));
+  CHECK_GPU_ERROR(cudaStreamSynchronize(_stream));
+}
+
+/**
+Fork every prompt of the batch into num_return_sequences consecutive
+  sequences after its forward pass, the prompt keys and values are forked by
+  self_attention(). Each sequence samples with its own curand state
+*/
+template <OperationType OpType_>
+void GptEncoder<OpType_>::fork_prompt() {
+  int n = _num_return_sequences;
+  // the cache is written and _p_d_v is free
+  CHECK_GPU_ERROR(cudaStreamSynchronize(_cache_stream));
+  // hidden states of the last prompt token, for the first sample
+  ker_gpt_fork_rows_launcher<_DataType>(
+      _batch_size, n, _tw._hidden_size, _batch_seq_len * _tw._hidden_size,
+      _stream, _p_d_query + (_batch_seq_len - 1) * _tw._hidden_size, _p_d_v);
+  CHECK_GPU_ERROR(cudaMemcpyAsync(
+      _p_d_query, _p_d_v,
+      _batch_size * n * _tw._hidden_size * sizeof(_DataType),
+      cudaMemcpyDeviceToDevice, _stream));
+  ker_gpt_fork_rows_launcher<int>(_batch_size, n, _batch_seq_len,
+                                  _batch_seq_len, _stream, _p_d_sample_id,
+                                  _p_d_sample_id_buf);
+  // _p_d_sample_id is free once forked
+  ker_gpt_fork_rows_launcher<int>(_batch_size, n, 1, 1, _stream,
+                                  _p_d_real_seq_len, _p_d_sample_id);
+  CHECK_GPU_ERROR(cudaMemcpyAsync(_p_d_real_seq_len, _p_d_sample_id,
+                                  _batch_size * n * sizeof(int),
+                                  cudaMemcpyDeviceToDevice, _stream));
+  std::swap(_p_d_sample_id, _p_d_sample_id_buf);
+  _batch_size *= n;
+  _batch_token_num = _batch_size * _batch_seq_len;
+}
+
+/**
+Sample the next token of every sequence from the logits of its last token,
+  logits: [batch_size, logits_seq_len, vocab_size]
+*/
+template <OperationType OpType_>
+void GptEncoder<OpType_>::sample_from_logits(int logits_seq_len) {
+  if (_processor_config.enabled()) {
+    // exact sampling from the processed logits, top_k and top_p included
+    launch_logits_processor<_DataType>(
+        _p_d_logit, nullptr, _p_d_sample_id, _batch_seq_len, _batch_seq_len,
+        _batch_seq_len - _prompt_len, _batch_size, logits_seq_len,
+        _tw._src_vocab_size, _processor_params, _max_thread_per_block,
+        _stream);
+    launch_gpt_multinomial_sample<_DataType>(
+        _p_d_logit, _p_d_sample_id, _p_d_sample_id_buf, _batch_size,
+        _batch_seq_len, logits_seq_len, _tw._src_vocab_size,
+        _max_thread_per_block, _stream, _p_d_unfinished, _p_d_curandstate,
+        _tw._eos_id);
+  } else if (_tw._sampling_method == "topk") {
 #ifdef DEBUG_RESULT
     std::cout << "sampling using topk\n";
 #endif
     ker_topk_sample_launcher<_DataType>(
-        _batch_size, _batch_seq_len, _batch_seq_len, _max_thread_per_block,
+        _batch_size, _batch_seq_len, logits_seq_len, _max_thread_per_block,
         _stream, _p_d_logit, _p_d_sample_id, _p_d_sample_id_buf,
         _p_d_real_seq_len, _tw._src_vocab_size, _tw._topk, _p_d_unfinished,
         _p_d_curandstate, _tw._eos_id);
@@ -322,11 +708,33 @@ int GptEncoder<OpType_>::sample_one_token() {
     std::cout << "sampling using topp\n";
 #endif
     ker_topp_sample_launcher<_DataType>(
-        _batch_size, _batch_seq_len, _batch_seq_len, _max_thread_per_block,
+        _batch_size, _batch_seq_len, logits_seq_len, _max_thread_per_block,
         _stream, _p_d_logit, _p_d_sample_id, _p_d_sample_id_buf,
         _p_d_real_seq_len, _tw._src_vocab_size, _tw._topp, _p_d_unfinished,
         _p_d_curandstate, _tw._eos_id);
   }
+}
+
+template <OperationType OpType_>
+int GptEncoder<OpType_>::sample_one_token() {
+  /* ---step 1. project hidden states to vocab logits--- */
+  {
+    CudaStageScope scope(_stage_timer, _stage_logits, _stream);
+    CHECK_GPU_ERROR(cublas_gemm_ex(
+        _hd, CUBLAS_OP_T, CUBLAS_OP_N, _tw._src_vocab_size, _batch_token_num,
+        _tw._hidden_size, &_fone, _p_d_src_emb_wei[0], _AType,
+        _tw._hidden_size, _p_d_query, _BType, _tw._hidden_size, &_fzero,
+        _p_d_logit, _CType, _tw._src_vocab_size, _computeType,
+        CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  }
+#ifdef DEBUG_RESULT
+  print_vec(_p_d_logit, "logits", _batch_token_num * _tw._src_vocab_size - 10,
+            _batch_token_num * _tw._src_vocab_size);
+#endif
+  CudaStageScope sampling_scope(_stage_timer, _stage_sampling, _stream);
+  CHECK_GPU_ERROR(cudaMemsetAsync(_p_d_unfinished, 0, sizeof(int), _stream));
+  /* ---step 2. sample new tokens from logits */
+  sample_from_logits(_batch_seq_len);
   int *temp = _p_d_sample_id;
   _p_d_sample_id = _p_d_sample_id_buf;
   _p_d_sample_id_buf = temp;
@@ -342,11 +750,15 @@ int GptEncoder<OpType_>::sample_one_token() {
 template <OperationType OpType_>
 int GptEncoder<OpType_>::sample_one_token_with_cache() {
   /* ---step 1. project hidden states to vocab logits--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
-      _hd, CUBLAS_OP_T, CUBLAS_OP_N, _tw._src_vocab_size, _batch_size,
-      _tw._hidden_size, &_fone, _p_d_src_emb_wei[0], _AType, _tw._hidden_size,
-      _p_d_query, _BType, _tw._hidden_size, &_fzero, _p_d_logit, _CType,
-      _tw._src_vocab_size, _computeType, CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  {
+    CudaStageScope scope(_stage_timer, _stage_logits, _stream);
+    CHECK_GPU_ERROR(cublas_gemm_ex(
+        _hd, CUBLAS_OP_T, CUBLAS_OP_N, _tw._src_vocab_size, _batch_size,
+        _tw._hidden_size, &_fone, _p_d_src_emb_wei[0], _AType,
+        _tw._hidden_size, _p_d_query, _BType, _tw._hidden_size, &_fzero,
+        _p_d_logit, _CType, _tw._src_vocab_size, _computeType,
+        CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  }
 
 #ifdef DEBUG_RESULT
   print_vec(_p_d_logit, "sampling-logits",
@@ -354,27 +766,10 @@ int GptEncoder<OpType_>::sample_one_token_with_cache() {
             _batch_size * _tw._src_vocab_size);
 #endif
 
+  CudaStageScope sampling_scope(_stage_timer, _stage_sampling, _stream);
   CHECK_GPU_ERROR(cudaMemsetAsync(_p_d_unfinished, 0, sizeof(int), _stream));
   // /* ---step 2. sample new tokens from logits */
-  if (_tw._sampling_method == "topk") {
-#ifdef DEBUG_RESULT
-    std::cout << "sampling using topk\n";
-#endif
-    ker_topk_sample_launcher<_DataType>(
-        _batch_size, _batch_seq_len, 1, _max_thread_per_block, _stream,
-        _p_d_logit, _p_d_sample_id, _p_d_sample_id_buf, _p_d_real_seq_len,
-        _tw._src_vocab_size, _tw._topk, _p_d_unfinished, _p_d_curandstate,
-        _tw._eos_id);
-  } else {
-#ifdef DEBUG_RESULT
-    std::cout << "sampling using topp\n";
-#endif
-    ker_topp_sample_launcher<_DataType>(
-        _batch_size, _batch_seq_len, 1, _max_thread_per_block, _stream,
-        _p_d_logit, _p_d_sample_id, _p_d_sample_id_buf, _p_d_real_seq_len,
-        _tw._src_vocab_size, _tw._topp, _p_d_unfinished, _p_d_curandstate,
-        _tw._eos_id);
-  }
+  sample_from_logits(1);
   int *temp = _p_d_sample_id;
   _p_d_sample_id = _p_d_sample_id_buf;
   _p_d_sample_id_buf = temp;
@@ -408,7 +803,7 @@ void GptEncoder<OpType_>::self_attention(bool cache) {
 
   /* ---step 1. qkv = ori_q * qkv_wei + bias, and reshape qkv for multi-head
    * gemm--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size * 3, _batch_token_num,
       _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 2], _AType,
       _tw._hidden_size * 3, _p_d_q, _BType, _tw._hidden_size, &_fzero,
@@ -444,14 +839,25 @@ void GptEncoder<OpType_>::self_attention(bool cache) {
     } else {
       stream = _stream;
     }
-    CHECK_GPU_ERROR(
-        cudaMemcpyAsync(_p_d_k_cache + _layer_id * _max_batch_dim, _p_d_k,
-                        _batch_token_num * _tw._hidden_size * sizeof(_DataType),
-                        cudaMemcpyDeviceToDevice, stream));
-    CHECK_GPU_ERROR(
-        cudaMemcpyAsync(_p_d_v_cache + _layer_id * _max_batch_dim, _p_d_v,
-                        _batch_token_num * _tw._hidden_size * sizeof(_DataType),
-                        cudaMemcpyDeviceToDevice, stream));
+    if (_num_return_sequences > 1) {
+      // every sample of a prompt starts from the prompt keys and values
+      int row_size = _batch_seq_len * _tw._hidden_size;
+      ker_gpt_fork_rows_launcher<_DataType>(
+          _batch_size, _num_return_sequences, row_size, row_size, stream,
+          _p_d_k, _p_d_k_cache + _layer_id * _max_batch_dim);
+      ker_gpt_fork_rows_launcher<_DataType>(
+          _batch_size, _num_return_sequences, row_size, row_size, stream,
+          _p_d_v, _p_d_v_cache + _layer_id * _max_batch_dim);
+    } else {
+      CHECK_GPU_ERROR(cudaMemcpyAsync(
+          _p_d_k_cache + _layer_id * _max_batch_dim, _p_d_k,
+          _batch_token_num * _tw._hidden_size * sizeof(_DataType),
+          cudaMemcpyDeviceToDevice, stream));
+      CHECK_GPU_ERROR(cudaMemcpyAsync(
+          _p_d_v_cache + _layer_id * _max_batch_dim, _p_d_v,
+          _batch_token_num * _tw._hidden_size * sizeof(_DataType),
+          cudaMemcpyDeviceToDevice, stream));
+    }
   }
 
 #ifdef DEBUG_RESULT
@@ -466,7 +872,7 @@ void GptEncoder<OpType_>::self_attention(bool cache) {
 #endif
 
   /* ---step 2. correlation = q * k, perform softmax on correlation--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_T, CUBLAS_OP_N, _batch_seq_len, _batch_seq_len,
       _tw._dim_per_head, &_atten_scaler, _p_d_k, _AType, _tw._dim_per_head,
       _batch_seq_len * _tw._dim_per_head, _p_d_q, _BType, _tw._dim_per_head,
@@ -496,7 +902,7 @@ void GptEncoder<OpType_>::self_attention(bool cache) {
 #endif
 
   /* ---step 3. new_q = correlation * v--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._dim_per_head, _batch_seq_len,
       _batch_seq_len, &_fone, _p_d_v, _AType, _tw._dim_per_head,
       _batch_seq_len * _tw._dim_per_head, _p_d_c, _BType, _batch_seq_len,
@@ -527,7 +933,7 @@ void GptEncoder<OpType_>::self_attention(bool cache) {
 #endif
 
   /* ---step 4. new_q = ori_q + new_q * output_wei--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _batch_token_num,
       _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 4], _AType,
       _tw._hidden_size, _p_d_v, _BType, _tw._hidden_size, &_fone, _p_d_query,
@@ -575,7 +981,7 @@ void GptEncoder<OpType_>::self_attention_with_cache() {
 
   /* ---step 1. qkv = ori_q * qkv_wei + bias, and reshape qkv for multi-head
    * gemm--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size * 3, _batch_size,
       _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 2], _AType,
       _tw._hidden_size * 3, _p_d_q, _BType, _tw._hidden_size, &_fzero,
@@ -625,7 +1031,7 @@ void GptEncoder<OpType_>::self_attention_with_cache() {
 
   /* ---step 2. correlation = q * k, perform softmax on correlation
   correlation: [batch_size, heads_num, 1, batch_seq_len]--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_T, CUBLAS_OP_N, _batch_seq_len, 1, _tw._dim_per_head,
       &_atten_scaler, _p_d_k, _AType, _tw._dim_per_head,
       _batch_seq_len * _tw._dim_per_head, _p_d_q, _BType, _tw._dim_per_head,
@@ -652,7 +1058,7 @@ void GptEncoder<OpType_>::self_attention_with_cache() {
 #endif
 
   /* ---step 3. new_q = correlation * v--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._dim_per_head, 1, _batch_seq_len,
       &_fone, _p_d_v, _AType, _tw._dim_per_head,
       _batch_seq_len * _tw._dim_per_head, _p_d_c, _BType, _batch_seq_len,
@@ -681,7 +1087,7 @@ void GptEncoder<OpType_>::self_attention_with_cache() {
 #endif
 
   /* ---step 4. new_q = ori_q + new_q * output_wei--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _batch_size,
       _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 4], _AType,
       _tw._hidden_size, _p_d_v, _BType, _tw._hidden_size, &_fone, _p_d_query,
@@ -705,18 +1111,25 @@ void GptEncoder<OpType_>::ffn_add_norm() {
       _p_d_enc_wei[_weight_offset + 11], _max_thread_per_block);
 
   /* ---step 1. first ffn layer--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
-      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _batch_token_num,
-      _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 8], _AType,
-      _tw._inner_size, _p_d_ffn_buf1, _BType, _tw._hidden_size, &_fzero,
-      _p_d_ffn_buf2, _CType, _tw._inner_size, _computeType,
-      CUBLAS_GEMM_DEFAULT_TENSOR_OP));
-  ker_bias_gelu_launcher<_DataType>(
-      _batch_token_num, _max_thread_per_block, _stream, _p_d_ffn_buf2,
-      _p_d_enc_wei[_weight_offset + 9], _tw._inner_size);
+  if (!cublaslt_gemm_bias_act(
+          _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _batch_token_num,
+          _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 8],
+          _tw._inner_size, _p_d_ffn_buf1, _tw._hidden_size, &_fzero,
+          _p_d_ffn_buf2, _tw._inner_size, _p_d_enc_wei[_weight_offset + 9],
+          _AType, _computeType, GemmEpilogue::kBiasGelu)) {
+    CHECK_GPU_ERROR(cublas_gemm_ex(
+        _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _batch_token_num,
+        _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 8], _AType,
+        _tw._inner_size, _p_d_ffn_buf1, _BType, _tw._hidden_size, &_fzero,
+        _p_d_ffn_buf2, _CType, _tw._inner_size, _computeType,
+        CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+    ker_bias_gelu_launcher<_DataType>(
+        _batch_token_num, _max_thread_per_block, _stream, _p_d_ffn_buf2,
+        _p_d_enc_wei[_weight_offset + 9], _tw._inner_size);
+  }
 
   /* ---step 2. second ffn layer--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _batch_token_num,
       _tw._inner_size, &_fone, _p_d_enc_wei[_weight_offset + 10], _AType,
       _tw._hidden_size, _p_d_ffn_buf2, _BType, _tw._inner_size, &_fone,
@@ -734,18 +1147,25 @@ void GptEncoder<OpType_>::ffn_add_norm_with_cache() {
       _p_d_enc_wei[_weight_offset + 11], _max_thread_per_block);
 
   /* ---step 1. first ffn layer--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
-      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _batch_size,
-      _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 8], _AType,
-      _tw._inner_size, _p_d_ffn_buf1, _BType, _tw._hidden_size, &_fzero,
-      _p_d_ffn_buf2, _CType, _tw._inner_size, _computeType,
-      CUBLAS_GEMM_DEFAULT_TENSOR_OP));
-  ker_bias_gelu_launcher<_DataType>(
-      _batch_size, _max_thread_per_block, _stream, _p_d_ffn_buf2,
-      _p_d_enc_wei[_weight_offset + 9], _tw._inner_size);
+  if (!cublaslt_gemm_bias_act(
+          _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _batch_size,
+          _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 8],
+          _tw._inner_size, _p_d_ffn_buf1, _tw._hidden_size, &_fzero,
+          _p_d_ffn_buf2, _tw._inner_size, _p_d_enc_wei[_weight_offset + 9],
+          _AType, _computeType, GemmEpilogue::kBiasGelu)) {
+    CHECK_GPU_ERROR(cublas_gemm_ex(
+        _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _batch_size,
+        _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 8], _AType,
+        _tw._inner_size, _p_d_ffn_buf1, _BType, _tw._hidden_size, &_fzero,
+        _p_d_ffn_buf2, _CType, _tw._inner_size, _computeType,
+        CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+    ker_bias_gelu_launcher<_DataType>(
+        _batch_size, _max_thread_per_block, _stream, _p_d_ffn_buf2,
+        _p_d_enc_wei[_weight_offset + 9], _tw._inner_size);
+  }
 
   /* ---step 2. second ffn layer--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _batch_size,
       _tw._inner_size, &_fone, _p_d_enc_wei[_weight_offset + 10], _AType,
       _tw._hidden_size, _p_d_ffn_buf2, _BType, _tw._inner_size, &_fone,
@@ -760,11 +1180,15 @@ Compute ppl from encoder output
 template <OperationType OpType_>
 void GptEncoder<OpType_>::compute_ppl() {
   /* ---step 1. project hidden states to vocab logits--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
-      _hd, CUBLAS_OP_T, CUBLAS_OP_N, _tw._src_vocab_size, _batch_token_num,
-      _tw._hidden_size, &_fone, _p_d_src_emb_wei[0], _AType, _tw._hidden_size,
-      _p_d_query, _BType, _tw._hidden_size, &_fzero, _p_d_logit, _CType,
-      _tw._src_vocab_size, _computeType, CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  {
+    CudaStageScope scope(_stage_timer, _stage_logits, _stream);
+    CHECK_GPU_ERROR(cublas_gemm_ex(
+        _hd, CUBLAS_OP_T, CUBLAS_OP_N, _tw._src_vocab_size, _batch_token_num,
+        _tw._hidden_size, &_fone, _p_d_src_emb_wei[0], _AType,
+        _tw._hidden_size, _p_d_query, _BType, _tw._hidden_size, &_fzero,
+        _p_d_logit, _CType, _tw._src_vocab_size, _computeType,
+        CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  }
 
 #ifdef DEBUG_RESULT
   print_vec(_p_d_logit, "logits", _batch_token_num * _tw._src_vocab_size - 5,
@@ -13,7 +13,10 @@
 #include <iostream>
 #include <string>
 
+#include "../kernels/logits_processor.h"
 #include "../proto/gpt_weight.h"
+#include "../tools/cuda_stage_timer.h"
+#include "../tools/gemm_dispatch.h"
 #include "../tools/util.h"
 
 namespace lightseq {
@@ -32,10 +35,14 @@ class GptEncoder {
   // private member function
   void self_attention(bool cache = false);
   void self_attention_with_cache();
+  void self_attention_with_prefix(int prefix_len);
   void ffn_add_norm();
   void ffn_add_norm_with_cache();
   int sample_one_token();
   int sample_one_token_with_cache();
+  void sample_from_logits(int logits_seq_len);
+  void fork_prompt();
+  int sample_with_cache(int unfinished);
 
   const int _max_batch_size;
 
@@ -86,6 +93,23 @@ class GptEncoder {
   int _layer_id;
   int _weight_offset;
 
+  // per-stage timing, see cuda_stage_timer.h
+  CudaStageTimer *_stage_timer;
+  int _stage_emb;
+  int _stage_norm;
+  int _stage_logits;
+  int _stage_sampling;
+  int _stage_ppl;
+  std::vector<int> _stage_attn;
+  std::vector<int> _stage_ffn;
+
+  // logits processor chain, see logits_processor.h
+  LogitsProcessorConfig _processor_config;
+  LogitsProcessorParams _processor_params;
+  int *_p_d_bad_words;  // flattened bad word tokens, then their offsets
+  int _prompt_len;
+  int _num_return_sequences;  // samples per prompt
+
   const std::set<std::string> kSamplingMethods = {"topk", "topp", "ppl"};
 
  public:
@@ -97,12 +121,21 @@ class GptEncoder {
   GptEncoder(int max_batch_size, const int *p_d_token_id, float *p_d_ppl,
              int *p_d_sample_id, const GptWeight<OpType_> &tw,
              cudaStream_t stream, cudaStream_t cache_stream, cublasHandle_t hd);
+  ~GptEncoder();
   size_t compute_buffer_bytesize();
   void init_buffer(void *pbuf);
   std::string check();
   void run_one_infer(int batch_size, int batch_seq_len);
   int run_one_sample(int batch_size, int batch_seq_len);
+  int run_session_sample(int batch_seq_len, int prefix_len);
+  size_t session_cache_bytes(int seq_len) const;
+  void load_session_cache(const void *src, int seq_len);
+  void save_session_cache(void *dst, int seq_len);
   void compute_ppl();
+  void set_stage_timer(CudaStageTimer *timer);
+  void set_logits_processor(const LogitsProcessorConfig &config);
+  void set_num_return_sequences(int n);
+  int num_return_sequences() const { return _num_return_sequences; }
 };
 
 }  // namespace cuda
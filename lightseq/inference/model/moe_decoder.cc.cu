@@ -48,7 +48,15 @@ MoeDecoder<OpType_>::MoeDecoder(int max_batch_size, const int* p_d_padding_mask,
       _h_unfinished(1),
       _gate_weight_offset(0),
       _p_d_dec_gate_wei(tw.get_dec_gate_wei()),
-      _max_step_token_num(max_batch_size * tw._beam_size) {
+      _max_step_token_num(max_batch_size * tw._beam_size),
+      _stage_timer(nullptr),
+      _stage_project(-1),
+      _stage_emb(-1),
+      _stage_logits(-1),
+      _stage_search(-1),
+      _stage_self_attn(tw._n_dec_layer, -1),
+      _stage_encdec_attn(tw._n_dec_layer, -1),
+      _stage_ffn(tw._n_dec_layer, -1) {
   for (int i = 0; i < _h_alive_seq_probs.size(); i += tw._beam_size) {
     _h_alive_seq_probs[i] = 0.f;
   }
@@ -60,6 +68,27 @@ MoeDecoder<OpType_>::MoeDecoder(int max_batch_size, const int* p_d_padding_mask,
   return;
 }
 
+/**
+Register the timed stages of decoder: the encoder output projection, and
+per step the embedding, the attentions and ffn (or moe) of every layer, the
+logits and the search
+*/
+template <OperationType OpType_>
+void MoeDecoder<OpType_>::set_stage_timer(CudaStageTimer* timer) {
+  _stage_timer = timer;
+  _stage_project = timer->stage_id("decoder.project_encoder_output");
+  _stage_emb = timer->stage_id("decoder.embedding");
+  _stage_logits = timer->stage_id("decoder.logits");
+  _stage_search = timer->stage_id(_tw._sampling_method == "beam_search"
+                                      ? "decoder.beam_search"
+                                      : "decoder.sampling");
+  _stage_self_attn =
+      timer->layer_stage_ids("decoder", "self_attention", _tw._n_dec_layer);
+  _stage_encdec_attn =
+      timer->layer_stage_ids("decoder", "encdec_attention", _tw._n_dec_layer);
+  _stage_ffn = timer->layer_stage_ids("decoder", "ffn", _tw._n_dec_layer);
+}
+
 /**
 Compute GPU memory size needed by moe decoder,
   to see how these memory is used, checkout init_buffer() for detail
@@ -306,7 +335,10 @@ void MoeDecoder<OpType_>::run_one_infer(int batch_size, int batch_seq_len) {
     _batch_max_decode_length = _tw._max_step;
   }
 
-  project_encoder_output();  // project encoder output
+  {
+    CudaStageScope scope(_stage_timer, _stage_project, _stream);
+    project_encoder_output();  // project encoder output
+  }
   // init the first step's token id with target start_id
   CHECK_GPU_ERROR(cudaMemcpyAsync(_p_d_alive_seq_probs,
                                   _h_alive_seq_probs.data(),
@@ -328,22 +360,24 @@ void MoeDecoder<OpType_>::run_one_infer(int batch_size, int batch_seq_len) {
     if (_cur_step == _batch_max_decode_length) {
       _cur_step -= 1;
     }
-    ker_write_topk_result<<<_batch_size * _tw._beam_size, _cur_step + 1, 0,
+    ker_write_topk_result<<<_batch_size * _tw._beam_size,
+                            std::min(_cur_step + 1, _max_thread_per_block), 0,
                             _stream>>>(
         _p_d_alive_seq, _p_d_alive_seq_score, _p_d_result, _tw._trg_vocab_size,
-        _tw._max_step, _tw._beam_size, _tw._end_id);
+        _tw._max_step, _tw._beam_size, _tw._end_id, _cur_step + 1);
     return;
   }
   if (_tw._length_penalty >= 0.f || _cur_step == _batch_max_decode_length) {
-    ker_write_trg_tokenid_pos_penalty<<<_batch_size, _cur_step + 1, 0,
-                                        _stream>>>(
-        _p_d_alive_seq, _p_d_alive_seq_score, _p_d_result, _tw._max_step,
-        _tw._beam_size);
+    ker_write_trg_tokenid_pos_penalty<<<
+        _batch_size, std::min(_cur_step + 1, _max_thread_per_block), 0,
+        _stream>>>(_p_d_alive_seq, _p_d_alive_seq_score, _p_d_result,
+                   _tw._max_step, _tw._beam_size, _cur_step + 1);
   } else {
-    ker_write_trg_tokenid_neg_penalty<<<_batch_size, _cur_step + 1, 0,
-                                        _stream>>>(
-        _p_d_alive_seq, _p_d_alive_seq_score, _p_d_result, _tw._max_step,
-        _tw._beam_size, _tw._trg_vocab_size, _tw._end_id);
+    ker_write_trg_tokenid_neg_penalty<<<
+        _batch_size, std::min(_cur_step + 1, _max_thread_per_block), 0,
+        _stream>>>(_p_d_alive_seq, _p_d_alive_seq_score, _p_d_result,
+                   _tw._max_step, _tw._beam_size, _tw._trg_vocab_size,
+                   _tw._end_id, _cur_step + 1);
   }
 #ifdef DEBUG_RESULT
   for (int i = 0; i < _batch_size; i++) {
@@ -366,7 +400,7 @@ void MoeDecoder<OpType_>::project_encoder_output() {
             "_p_d_encoder_output(tail)", 5);
   print_vec(_p_d_trg_emb_wei[4], "encoder project(head):", 10);
 #endif
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, kv_dim, _batch_token_num, _tw._hidden_size,
       &_type_one, _p_d_trg_emb_wei[4], _AType, kv_dim, _p_d_encoder_output,
       _BType, _tw._hidden_size, &_type_zero, _p_d_encoder_out_buf, _CType,
@@ -394,16 +428,23 @@ Decode one step
 */
 template <OperationType OpType_>
 bool MoeDecoder<OpType_>::run_step() {
-  embedding();
+  {
+    CudaStageScope scope(_stage_timer, _stage_emb, _stream);
+    embedding();
+  }
   decoder_stack();
   /* --- Project hidden states to vocab logits--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
-      _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._trg_vocab_size, _step_token_num,
-      _tw._hidden_size, &_logit_scaler, _p_d_trg_emb_wei[0], _AType,
-      _tw._trg_vocab_size, _p_d_cur_step_query, _BType, _tw._hidden_size,
-      //&_type_zero, _p_d_logit_buf, _CType, _tw._trg_vocab_size, _computeType,
-      &_fzero, _p_d_logit_buf, _CType, _tw._trg_vocab_size, CUDA_R_32F,
-      CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  {
+    CudaStageScope scope(_stage_timer, _stage_logits, _stream);
+    CHECK_GPU_ERROR(cublas_gemm_ex(
+        _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._trg_vocab_size, _step_token_num,
+        _tw._hidden_size, &_logit_scaler, _p_d_trg_emb_wei[0], _AType,
+        _tw._trg_vocab_size, _p_d_cur_step_query, _BType, _tw._hidden_size,
+        //&_type_zero, _p_d_logit_buf, _CType, _tw._trg_vocab_size,
+        //_computeType,
+        &_fzero, _p_d_logit_buf, _CType, _tw._trg_vocab_size, CUDA_R_32F,
+        CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+  }
 #ifdef DEBUG_RESULT
   for (int i = 0; i < _batch_size; i++) {       // batch_id
     for (int j = 0; j < _tw._beam_size; j++) {  // beam_id
@@ -417,6 +458,7 @@ bool MoeDecoder<OpType_>::run_step() {
     }
   }
 #endif
+  CudaStageScope scope(_stage_timer, _stage_search, _stream);
   if (_tw._sampling_method == "topk") {
     return sample();
   } else if (_tw._sampling_method == "topp") {
@@ -471,11 +513,19 @@ void MoeDecoder<OpType_>::decoder_stack() {
   for (_layer_id = 0; _layer_id < _tw._n_dec_layer; _layer_id++) {
     _weight_offset = _layer_id * _tw._weight_per_dec_layer;
 
-    self_attention();
-
-    encdec_attention();
-
-    ffn_add_norm();
+    {
+      CudaStageScope scope(_stage_timer, _stage_self_attn[_layer_id], _stream);
+      self_attention();
+    }
+    {
+      CudaStageScope scope(_stage_timer, _stage_encdec_attn[_layer_id],
+                           _stream);
+      encdec_attention();
+    }
+    {
+      CudaStageScope scope(_stage_timer, _stage_ffn[_layer_id], _stream);
+      ffn_add_norm();
+    }
   }
 
   // last layer norm
@@ -505,7 +555,7 @@ void MoeDecoder<OpType_>::self_attention() {
 
   /* ---step 1. qkv = ori_q * qkv_wei + bias, and reshape qkv for multi-head
    * gemm--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size * 3, _step_token_num,
       _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 2], _AType,
       _tw._hidden_size * 3, _p_d_query_buf1, _BType, _tw._hidden_size,
@@ -551,7 +601,7 @@ void MoeDecoder<OpType_>::self_attention() {
 #endif
 
   /* ---step 2. correlation = q * k, perform softmax on correlation--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_T, CUBLAS_OP_N, _cur_step + 1, 1, _tw._dim_per_head,
       &_atten_scaler, _p_d_self_k_bgeem1[_layer_id], _AType, _tw._dim_per_head,
       _tw._max_step * _tw._dim_per_head, _p_d_query_buf1, _BType,
@@ -568,7 +618,7 @@ void MoeDecoder<OpType_>::self_attention() {
 #endif
 
   /* ---step 3. new_q = correlation * v--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._dim_per_head, 1, _cur_step + 1,
       &_type_one, _p_d_self_v_bgeem1[_layer_id], _AType, _tw._dim_per_head,
       _tw._max_step * _tw._dim_per_head, _p_d_c, _BType, _cur_step + 1,
@@ -583,7 +633,7 @@ void MoeDecoder<OpType_>::self_attention() {
 #endif
 
   /* ---step 4. new_q = ori_q + new_q * output_wei--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _step_token_num,
       _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 4], _AType,
       _tw._hidden_size, _p_d_query_buf1, _BType, _tw._hidden_size, &_type_one,
@@ -617,7 +667,7 @@ void MoeDecoder<OpType_>::encdec_attention() {
 
   /* ---step 1. new_q = ori_q * q_wei + bias, reshape new_q for multi-head
    * gemm--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _step_token_num,
       _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 8], _AType,
       _tw._hidden_size, _p_d_query_buf1, _BType, _tw._hidden_size, &_type_zero,
@@ -629,7 +679,7 @@ void MoeDecoder<OpType_>::encdec_attention() {
       _tw._dim_per_head, _tw._head_num, _max_thread_per_block);
 
   /* ---step 2. correlation = q * k, perform softmax on correlation--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_T, CUBLAS_OP_N, _batch_seq_len, _tw._beam_size,
       _tw._dim_per_head, &_atten_scaler, _p_d_encdec_k_bgeem[_layer_id], _AType,
       _tw._dim_per_head, _batch_seq_len * _tw._dim_per_head, _p_d_query_buf1,
@@ -642,7 +692,7 @@ void MoeDecoder<OpType_>::encdec_attention() {
       _p_d_c, _p_d_padding_mask);
 
   /* ---step 3. new_q = correlation * v--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._dim_per_head, _tw._beam_size,
       _batch_seq_len, &_type_one, _p_d_encdec_v_bgeem[_layer_id], _AType,
       _tw._dim_per_head, _batch_seq_len * _tw._dim_per_head, _p_d_c, _BType,
@@ -656,7 +706,7 @@ void MoeDecoder<OpType_>::encdec_attention() {
       _max_thread_per_block);
 
   /* ---step 4. new_q = ori_q + new_q * output_wei--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _step_token_num,
       _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 10], _AType,
       _tw._hidden_size, _p_d_query_buf2, _BType, _tw._hidden_size, &_type_one,
@@ -692,7 +742,7 @@ void MoeDecoder<OpType_>::ffn() {
 #endif
 
   /* ---step 1. first ffn layer--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _step_token_num,
       _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 14], _AType,
       _tw._inner_size, _p_d_query_buf1, _BType, _tw._hidden_size, &_type_zero,
@@ -710,7 +760,7 @@ void MoeDecoder<OpType_>::ffn() {
   }
 
   /* ---step 2. second ffn layer--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _step_token_num,
       _tw._inner_size, &_type_one, _p_d_dec_wei[_weight_offset + 16], _AType,
       _tw._hidden_size, _p_d_query_buf2, _BType, _tw._inner_size, &_type_one,
@@ -727,7 +777,7 @@ void MoeDecoder<OpType_>::moe_fw() {
       _p_d_dec_wei[_weight_offset + 13], _max_thread_per_block,
       _tw._is_post_ln);
 
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._expert_num_decoder, _step_token_num,
       _tw._hidden_size, &_type_one, _p_d_dec_gate_wei[_gate_weight_offset],
       _AType, _tw._expert_num_decoder, _p_d_query_buf1, _BType,
@@ -744,7 +794,7 @@ void MoeDecoder<OpType_>::moe_fw() {
       _tw._hidden_size, _max_thread_per_block, _stream, _p_d_query_buf1,
       _p_d_score_routed, _p_d_moe_input_buf);
 
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _step_token_num,
       _tw._hidden_size, &_type_one, _p_d_dec_wei[_weight_offset + 14], _AType,
       _tw._inner_size, _tw._hidden_size * _tw._inner_size, _p_d_moe_input_buf,
@@ -765,7 +815,7 @@ void MoeDecoder<OpType_>::moe_fw() {
         _p_d_dec_wei[_weight_offset + 15]);
   }
 
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _step_token_num,
       _tw._inner_size, &_type_one, _p_d_dec_wei[_weight_offset + 16], _AType,
       _tw._hidden_size, _tw._hidden_size * _tw._inner_size, _p_d_moe_inner_buf,
@@ -860,12 +910,13 @@ bool MoeDecoder<OpType_>::beam_search() {
       Deciding whether early stop based on num_finish_beam
   */
   CHECK_GPU_ERROR(cudaMemsetAsync(_p_d_can_num, 0, sizeof(int), _stream));
-  ker_refresh_result<<<dim3(_batch_size, _tw._beam_size), _tw._max_step, 0,
+  ker_refresh_result<<<dim3(_batch_size, _tw._beam_size),
+                       std::min(_tw._max_step, _max_thread_per_block), 0,
                        _stream>>>(
       _p_d_can_idx, _p_d_can_score, _p_d_can_num + 1, _p_d_alive_seq,
       _p_d_alive_seq_buf, _p_d_alive_seq_probs, _p_d_alive_seq_score,
       _p_d_can_num, _tw._trg_vocab_size, _cur_step, _h_length_norm[_cur_step],
-      _tw._diverse_lambda, _tw._end_id);
+      _tw._diverse_lambda, _tw._end_id, _tw._max_step);
   int* tmp = _p_d_alive_seq_buf;
   _p_d_alive_seq_buf = _p_d_alive_seq;
   _p_d_alive_seq = tmp;
@@ -15,6 +15,8 @@
 #include <unistd.h>
 
 #include "../proto/moe_weight.h"
+#include "../tools/cuda_stage_timer.h"
+#include "../tools/gemm_dispatch.h"
 #include "../tools/util.h"
 
 /**
@@ -135,6 +137,16 @@ class MoeDecoder {
   const std::set<std::string> kSamplingMethods = {"beam_search", "topk", "topp",
                                                   "topk_greedy"};
 
+  // per-stage timing, see cuda_stage_timer.h
+  CudaStageTimer* _stage_timer;
+  int _stage_project;
+  int _stage_emb;
+  int _stage_logits;
+  int _stage_search;
+  std::vector<int> _stage_self_attn;
+  std::vector<int> _stage_encdec_attn;
+  std::vector<int> _stage_ffn;
+
  public:
   MoeDecoder(int max_batch_size, const int* p_d_padding_mask,
              const _DataType* p_d_encoder_output, int* p_d_result,
@@ -144,6 +156,7 @@ class MoeDecoder {
   void init_buffer(void* pbuf);
   std::string check();
   void run_one_infer(int batch_size, int batch_seq_len);
+  void set_stage_timer(CudaStageTimer* timer);
   int _cur_step;
   float* _p_d_alive_seq_score;
   bool _output_topk;
@@ -35,7 +35,26 @@ MoeEncoder<OpType_>::MoeEncoder(int max_batch_size, int *p_d_token_id,
       _max_token_num(max_batch_size * tw._max_step),
       _max_thread_per_block(1024),
       _gate_weight_offset(0),
-      _p_d_enc_gate_wei(tw.get_enc_gate_wei()) {}
+      _p_d_enc_gate_wei(tw.get_enc_gate_wei()),
+      _stage_timer(nullptr),
+      _stage_emb(-1),
+      _stage_norm(-1),
+      _stage_attn(tw._n_enc_layer, -1),
+      _stage_ffn(tw._n_enc_layer, -1) {}
+
+/**
+Register the timed stages of encoder, embedding, attention and ffn (or moe) of
+every layer, and the output layer norm
+*/
+template <OperationType OpType_>
+void MoeEncoder<OpType_>::set_stage_timer(CudaStageTimer *timer) {
+  _stage_timer = timer;
+  _stage_emb = timer->stage_id("encoder.embedding");
+  _stage_norm = timer->stage_id("encoder.output_norm");
+  _stage_attn =
+      timer->layer_stage_ids("encoder", "attention", _tw._n_enc_layer);
+  _stage_ffn = timer->layer_stage_ids("encoder", "ffn", _tw._n_enc_layer);
+}
 
 /**
 Compute GPU memory size needed by moe_encoder,
@@ -144,11 +163,14 @@ void MoeEncoder<OpType_>::run_one_infer(int batch_size, int batch_seq_len) {
 #endif
 
   /* ---step2. encoder feedforward--- */
-  launch_enc_emb<_DataType>(_p_d_src_emb_wei[0], _p_d_src_emb_wei[1],
-                            _p_d_token_id, _p_d_output, _p_d_padding_mask,
-                            _tw._padding_id, batch_size, batch_seq_len,
-                            _tw._hidden_size, _stream, _p_d_src_emb_wei[4],
-                            _p_d_lang_id, _tw._multilg_type);
+  {
+    CudaStageScope scope(_stage_timer, _stage_emb, _stream);
+    launch_enc_emb<_DataType>(_p_d_src_emb_wei[0], _p_d_src_emb_wei[1],
+                              _p_d_token_id, _p_d_output, _p_d_padding_mask,
+                              _tw._padding_id, batch_size, batch_seq_len,
+                              _tw._hidden_size, _stream, _p_d_src_emb_wei[4],
+                              _p_d_lang_id, _tw._multilg_type);
+  }
 #ifdef DEBUG_RESULT
   for (int i = 0; i < _batch_size; i++) {       // batch_id
     for (int j = 0; j < _batch_seq_len; j++) {  // token_id
@@ -163,13 +185,22 @@ void MoeEncoder<OpType_>::run_one_infer(int batch_size, int batch_seq_len) {
 #endif
   for (_layer_id = 0; _layer_id < _tw._n_enc_layer; _layer_id++) {
     _weight_offset = _layer_id * _tw._weight_per_enc_layer;
-    self_attention();
-    ffn_add_norm();
+    {
+      CudaStageScope scope(_stage_timer, _stage_attn[_layer_id], _stream);
+      self_attention();
+    }
+    {
+      CudaStageScope scope(_stage_timer, _stage_ffn[_layer_id], _stream);
+      ffn_add_norm();
+    }
   }
   // last layer norm
-  ker_norm_layer_launcher<_DataType>(
-      _batch_token_num, _tw._hidden_size, _stream, _p_d_output,
-      _p_d_src_emb_wei[2], _p_d_src_emb_wei[3], _max_thread_per_block);
+  {
+    CudaStageScope scope(_stage_timer, _stage_norm, _stream);
+    ker_norm_layer_launcher<_DataType>(
+        _batch_token_num, _tw._hidden_size, _stream, _p_d_output,
+        _p_d_src_emb_wei[2], _p_d_src_emb_wei[3], _max_thread_per_block);
+  }
 
 #ifdef DEBUG_RESULT
   for (int i = 0; i < _batch_size; i++) {       // batch_id
@@ -197,7 +228,7 @@ void MoeEncoder<OpType_>::self_attention() {
 
   /* ---step 1. qkv = ori_q * qkv_wei + bias, and reshape qkv for multi-head
    * gemm--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size * 3, _batch_token_num,
       _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 2], _AType,
       _tw._hidden_size * 3, _p_d_q, _BType, _tw._hidden_size, &_fzero,
@@ -211,7 +242,7 @@ void MoeEncoder<OpType_>::self_attention() {
       _tw._dim_per_head, _tw._head_num, _max_thread_per_block);
 
   /* ---step 2. correlation = q * k, perform softmax on correlation--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_T, CUBLAS_OP_N, _batch_seq_len, _batch_seq_len,
       _tw._dim_per_head, &_atten_scaler, _p_d_k, _AType, _tw._dim_per_head,
       _batch_seq_len * _tw._dim_per_head, _p_d_q, _BType, _tw._dim_per_head,
@@ -224,7 +255,7 @@ void MoeEncoder<OpType_>::self_attention() {
       _p_d_padding_mask);
 
   /* ---step 3. new_q = correlation * v--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._dim_per_head, _batch_seq_len,
       _batch_seq_len, &_fone, _p_d_v, _AType, _tw._dim_per_head,
       _batch_seq_len * _tw._dim_per_head, _p_d_c, _BType, _batch_seq_len,
@@ -239,7 +270,7 @@ void MoeEncoder<OpType_>::self_attention() {
       _batch_seq_len, _tw._dim_per_head, _tw._head_num, _max_thread_per_block);
 
   /* ---step 4. new_q = ori_q + new_q * output_wei--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _batch_token_num,
       _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 4], _AType,
       _tw._hidden_size, _p_d_v, _BType, _tw._hidden_size, &_fone, _p_d_output,
@@ -267,7 +298,7 @@ void MoeEncoder<OpType_>::ffn() {
       _p_d_enc_wei[_weight_offset + 11], _max_thread_per_block,
       _tw._is_post_ln);
   /* ---step 1. first ffn layer--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _batch_token_num,
       _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 8], _AType,
       _tw._inner_size, _p_d_ffn_buf1, _BType, _tw._hidden_size, &_fzero,
@@ -285,7 +316,7 @@ void MoeEncoder<OpType_>::ffn() {
   }
 
   /* ---step 2. second ffn layer--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _batch_token_num,
       _tw._inner_size, &_fone, _p_d_enc_wei[_weight_offset + 10], _AType,
       _tw._hidden_size, _p_d_ffn_buf2, _BType, _tw._inner_size, &_fone,
@@ -301,7 +332,7 @@ void MoeEncoder<OpType_>::moe_fw() {
       _p_d_enc_wei[_weight_offset + 6], _p_d_enc_wei[_weight_offset + 7],
       _max_thread_per_block, _tw._is_post_ln);
 
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._expert_num_encoder, _batch_token_num,
       _tw._hidden_size, &_fone, _p_d_enc_gate_wei[_gate_weight_offset], _AType,
       _tw._expert_num_encoder, _p_d_ffn_buf1, _BType, _tw._hidden_size, &_fzero,
@@ -318,7 +349,7 @@ void MoeEncoder<OpType_>::moe_fw() {
       _tw._hidden_size, _max_thread_per_block, _stream, _p_d_ffn_buf1,
       _p_d_score_routed, _p_d_moe_input_buf);
 
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _batch_token_num,
       _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 8], _AType,
       _tw._inner_size, _tw._hidden_size * _tw._inner_size, _p_d_moe_input_buf,
@@ -339,7 +370,7 @@ void MoeEncoder<OpType_>::moe_fw() {
         _p_d_enc_wei[_weight_offset + 9]);
   }
 
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _batch_token_num,
       _tw._inner_size, &_fone, _p_d_enc_wei[_weight_offset + 10], _AType,
       _tw._hidden_size, _tw._hidden_size * _tw._inner_size, _p_d_moe_inner_buf,
@@ -13,6 +13,8 @@
 #include <string>
 
 #include "../proto/moe_weight.h"
+#include "../tools/cuda_stage_timer.h"
+#include "../tools/gemm_dispatch.h"
 #include "../tools/util.h"
 
 namespace lightseq {
@@ -78,6 +80,13 @@ class MoeEncoder {
   int _weight_offset;
   int _gate_weight_offset;
 
+  // per-stage timing, see cuda_stage_timer.h
+  CudaStageTimer *_stage_timer;
+  int _stage_emb;
+  int _stage_norm;
+  std::vector<int> _stage_attn;
+  std::vector<int> _stage_ffn;
+
  public:
   MoeEncoder(int max_batch_size, int *p_d_token_id, int *p_d_padding_mask,
              _DataType *p_d_output, const MoeWeight<OpType_> &tw,
@@ -87,6 +96,7 @@ class MoeEncoder {
   void init_buffer(void *pbuf);
   std::string check();
   void run_one_infer(int batch_size, int batch_seq_len);
+  void set_stage_timer(CudaStageTimer *timer);
   int *_p_d_token_id;  // input token id [batch_size, batch_seq_len]
   const int *_p_d_lang_id;
 };
@@ -1,4 +1,5 @@
 #include "quant_bert_encoder.h"
+#include "../tools/quant_weight.h"
 #include "../kernels/embKernels_int8.h"
 #include "../kernels/transformerKernels.h"
 #include "../kernels/transformerKernels_int8.h"
@@ -28,6 +29,8 @@ QuantBertEncoder<OpType_>::QuantBertEncoder(
       _hd(hd),
       _p_d_src_emb_wei(tw.get_src_emb_wei()),
       _p_d_enc_wei(tw.get_enc_wei()),
+      _p_i8_src_emb_wei(tw.get_int8_src_emb_wei()),
+      _p_i8_enc_wei(tw.get_int8_enc_wei()),
       _fone((_DataType)1.f),
       _fzero((_DataType)0.f),
       _src_emb_clip_max(tw.get_src_emb_clip_max()),
@@ -36,10 +39,26 @@ QuantBertEncoder<OpType_>::QuantBertEncoder(
       _izero((int32_t)0),
       _atten_scaler((_DataType)sqrt(1.f / tw._dim_per_head)),
       _max_batch_dim(max_batch_size * tw._max_step * tw._hidden_size),
-      _max_thread_per_block(1024) {
+      _max_thread_per_block(1024),
+      _stage_timer(nullptr),
+      _stage_emb(-1),
+      _stage_attn(tw._n_enc_layer, -1),
+      _stage_ffn(tw._n_enc_layer, -1) {
   CHECK_GPU_ERROR(cublasLtCreate(&_cublas_lt_handle));
 }
 
+/**
+Register the timed stages of encoder, embedding, attention and ffn of every
+layer. The output layer norm is fused into the last ffn
+*/
+template <OperationType OpType_>
+void QuantBertEncoder<OpType_>::set_stage_timer(CudaStageTimer *timer) {
+  _stage_timer = timer;
+  _stage_emb = timer->stage_id("bert.embedding");
+  _stage_attn = timer->layer_stage_ids("bert", "attention", _tw._n_enc_layer);
+  _stage_ffn = timer->layer_stage_ids("bert", "ffn", _tw._n_enc_layer);
+}
+
 /**
 Init the GPU memory pointer which point to
   the memory buffer needed by encoder.
@@ -68,13 +87,16 @@ void QuantBertEncoder<OpType_>::init_buffer() {
   CHECK_GPU_ERROR(
       cudaMalloc(&_int8_ffn_out_buf, max_batch_dim * sizeof(int8_t)));
 
+  // the int8 kernels in their gemm layouts, see int8_weight_cache.h
+  Int8WeightCache int8_cache =
+      open_int8_weight_cache("quant_bert_encoder", _tw.get_int8_weight_hash());
+
   CHECK_GPU_ERROR(
       cudaMalloc(&_int8_p_d_src_emb_wei,
                  _tw._src_vocab_size * _tw._hidden_size * sizeof(int8_t)));
-  quantize_weight(_p_d_src_emb_wei[0], _int8_p_d_src_emb_wei,
-                  _tw._src_vocab_size, _tw._hidden_size,
-                  _quant_range / _src_emb_clip_max, _stream, _cublas_lt_handle,
-                  kRowMajor);
+  load_int8_weight(_p_i8_src_emb_wei[0], _int8_p_d_src_emb_wei,
+                   _tw._src_vocab_size, _tw._hidden_size, _stream,
+                   _cublas_lt_handle, &int8_cache, kRowMajor);
 
   _p_device_emb.push_back(nullptr);
   _p_device_emb.push_back(
@@ -125,29 +147,22 @@ void QuantBertEncoder<OpType_>::init_buffer() {
     _p_device_wei.push_back(
         to_gpu(_p_d_enc_wei[_weight_offset + 11], _tw._hidden_size, _stream));
 
-    quantize_weight(_p_d_enc_wei[_weight_offset + 2],
-                    _int8_p_d_enc_wei[_layer_id * 4], _tw._hidden_size,
-                    _tw._hidden_size * 3,
-                    _quant_range / _enc_clip_max[_layer_id * 11], _stream,
-                    _cublas_lt_handle);
-
-    quantize_weight(_p_d_enc_wei[_weight_offset + 4],
-                    _int8_p_d_enc_wei[_layer_id * 4 + 1], _tw._hidden_size,
-                    _tw._hidden_size,
-                    _quant_range / _enc_clip_max[_layer_id * 11 + 1], _stream,
-                    _cublas_lt_handle);
-
-    quantize_weight(_p_d_enc_wei[_weight_offset + 8],
-                    _int8_p_d_enc_wei[_layer_id * 4 + 2], _tw._hidden_size,
-                    _tw._inner_size,
-                    _quant_range / _enc_clip_max[_layer_id * 11 + 2], _stream,
-                    _cublas_lt_handle);
-
-    quantize_weight(_p_d_enc_wei[_weight_offset + 10],
-                    _int8_p_d_enc_wei[_layer_id * 4 + 3], _tw._inner_size,
-                    _tw._hidden_size,
-                    _quant_range / _enc_clip_max[_layer_id * 11 + 3], _stream,
-                    _cublas_lt_handle);
+    load_int8_weight(_p_i8_enc_wei[_layer_id * 4],
+                     _int8_p_d_enc_wei[_layer_id * 4], _tw._hidden_size,
+                     _tw._hidden_size * 3, _stream, _cublas_lt_handle,
+                     &int8_cache);
+
+    load_int8_weight(_p_i8_enc_wei[_layer_id * 4 + 1],
+                     _int8_p_d_enc_wei[_layer_id * 4 + 1], _tw._hidden_size,
+                     _tw._hidden_size, _stream, _cublas_lt_handle, &int8_cache);
+
+    load_int8_weight(_p_i8_enc_wei[_layer_id * 4 + 2],
+                     _int8_p_d_enc_wei[_layer_id * 4 + 2], _tw._hidden_size,
+                     _tw._inner_size, _stream, _cublas_lt_handle, &int8_cache);
+
+    load_int8_weight(_p_i8_enc_wei[_layer_id * 4 + 3],
+                     _int8_p_d_enc_wei[_layer_id * 4 + 3], _tw._inner_size,
+                     _tw._hidden_size, _stream, _cublas_lt_handle, &int8_cache);
 
     if (_tw._use_gelu) {
       _scaled_ffn2_colsum[_layer_id] = nullptr;
@@ -155,21 +170,17 @@ void QuantBertEncoder<OpType_>::init_buffer() {
       CHECK_GPU_ERROR(cudaMalloc(&_scaled_ffn2_colsum[_layer_id],
                                  _tw._hidden_size * sizeof(_DataType)));
       float relu_scale = _enc_clip_max[_layer_id * 11 + 7] / 2;
-      _DataType *temp;
-      int weight_size = _tw._inner_size * _tw._hidden_size;
-
-      CHECK_GPU_ERROR(cudaMalloc(&temp, weight_size * sizeof(_DataType)));
-      CHECK_GPU_ERROR(cudaMemcpyAsync(temp, _p_d_enc_wei[_weight_offset + 10],
-                                      weight_size * sizeof(_DataType),
-                                      cudaMemcpyHostToDevice, _stream));
-      launch_scaled_colsum(temp, _scaled_ffn2_colsum[_layer_id],
-                           _tw._inner_size, _tw._hidden_size, relu_scale,
-                           _stream);
-
-      CHECK_GPU_ERROR(cudaGetLastError());
-      CHECK_GPU_ERROR(cudaFree(temp));
+      std::vector<float> colsum = int8_scaled_colsum(
+          _p_i8_enc_wei[_layer_id * 4 + 3], _tw._inner_size, _tw._hidden_size,
+          _enc_clip_max[_layer_id * 11 + 3] / _quant_range, relu_scale);
+      std::vector<_DataType> h_colsum(colsum.begin(), colsum.end());
+      CHECK_GPU_ERROR(cudaMemcpyAsync(
+          _scaled_ffn2_colsum[_layer_id], h_colsum.data(),
+          _tw._hidden_size * sizeof(_DataType), cudaMemcpyHostToDevice,
+          _stream));
     }
   }
+  close_int8_weight_cache(&int8_cache, _stream);
   std::cout << "encoder buffer init succeed" << std::endl;
   return;
 }
@@ -226,11 +237,14 @@ void QuantBertEncoder<OpType_>::run_one_infer(int batch_size,
 #endif
 
   /* ---step2. encoder feedforward--- */
-  launch_enc_emb_i8I<_DataType>(
-      _int8_p_d_src_emb_wei, _p_device_emb[1], _p_d_token_id, _p_d_output,
-      _p_d_padding_mask, _tw._padding_id, batch_size, batch_seq_len,
-      _tw._hidden_size, _stream, _p_device_emb[4], _p_d_lang_id,
-      _tw._multilg_type, _src_emb_clip_max / _quant_range, false);
+  {
+    CudaStageScope scope(_stage_timer, _stage_emb, _stream);
+    launch_enc_emb_i8I<_DataType>(
+        _int8_p_d_src_emb_wei, _p_device_emb[1], _p_d_token_id, _p_d_output,
+        _p_d_padding_mask, _tw._padding_id, batch_size, batch_seq_len,
+        _tw._hidden_size, _stream, _p_device_emb[4], _p_d_lang_id,
+        _tw._multilg_type, _src_emb_clip_max / _quant_range, false);
+  }
 #ifdef DEBUG_RESULT
   for (int i = 0; i < _batch_size; i++) {       // batch_id
     for (int j = 0; j < _batch_seq_len; j++) {  // token_id
@@ -243,8 +257,14 @@ void QuantBertEncoder<OpType_>::run_one_infer(int batch_size,
 #endif
   for (_layer_id = 0; _layer_id < _tw._n_enc_layer; _layer_id++) {
     _weight_offset = _layer_id * _tw._weight_per_enc_layer;
-    self_attention();
-    ffn_add_norm();
+    {
+      CudaStageScope scope(_stage_timer, _stage_attn[_layer_id], _stream);
+      self_attention();
+    }
+    {
+      CudaStageScope scope(_stage_timer, _stage_ffn[_layer_id], _stream);
+      ffn_add_norm();
+    }
   }
 
 #ifdef DEBUG_RESULT
@@ -305,7 +325,7 @@ void QuantBertEncoder<OpType_>::self_attention() {
       _enc_clip_max[_layer_id * 11 + 8] / _quant_range, true);
 
   /* ---step 2. correlation = q * k, perform softmax on correlation--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_T, CUBLAS_OP_N, _batch_seq_len, _batch_seq_len,
       _tw._dim_per_head, &_atten_scaler, _p_d_k, _AType, _tw._dim_per_head,
       _batch_seq_len * _tw._dim_per_head, _p_d_q, _BType, _tw._dim_per_head,
@@ -318,7 +338,7 @@ void QuantBertEncoder<OpType_>::self_attention() {
       _p_d_padding_mask);
 
   /* ---step 3. new_q = correlation * v--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._dim_per_head, _batch_seq_len,
       _batch_seq_len, &_fone, _p_d_v, _AType, _tw._dim_per_head,
       _batch_seq_len * _tw._dim_per_head, _p_d_c, _BType, _batch_seq_len,
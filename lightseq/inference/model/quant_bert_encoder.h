@@ -14,6 +14,8 @@
 #include <string>
 
 #include "../proto/quant_bert_weight.h"
+#include "../tools/cuda_stage_timer.h"
+#include "../tools/gemm_dispatch.h"
 #include "../tools/util.h"
 
 /**
@@ -75,6 +77,9 @@ class QuantBertEncoder {
   // ffn_first_kernel, ffn_first_bias, ffn_second_kernel, ffn_second_bias} *
   // encoder_layer_num
   const std::vector<const _DataType *> &_p_d_enc_wei;
+  // int8 kernels on host, see QuantBertWeight
+  const std::vector<const int8_t *> &_p_i8_src_emb_wei;
+  const std::vector<const int8_t *> &_p_i8_enc_wei;
   std::vector<const _DataType *> _p_device_wei;
   std::vector<const _DataType *> _p_device_emb;
 
@@ -91,6 +96,12 @@ class QuantBertEncoder {
   int _layer_id;
   int _weight_offset;
 
+  // per-stage timing, see cuda_stage_timer.h
+  CudaStageTimer *_stage_timer;
+  int _stage_emb;
+  std::vector<int> _stage_attn;
+  std::vector<int> _stage_ffn;
+
  public:
   const int *_p_d_token_id;  // input token id [batch_size, batch_seq_len]
   _DataType
@@ -103,6 +114,7 @@ class QuantBertEncoder {
   void init_buffer();
   std::string check();
   void run_one_infer(int batch_size, int batch_seq_len);
+  void set_stage_timer(CudaStageTimer *timer);
 };
 
 }  // namespace cuda
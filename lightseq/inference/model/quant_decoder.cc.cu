@@ -1,5 +1,6 @@
 #include "quant_decoder.h"
 
+#include "../tools/quant_weight.h"
 #include "../kernels/transformerKernels.h"
 #include "../kernels/transformerKernels_int8.h"
 #include "../kernels/embKernels_int8.h"
@@ -32,6 +33,8 @@ QuantDecoder<OpType_>::QuantDecoder(int max_batch_size,
       _p_d_result(p_d_result),
       _p_d_trg_emb_wei(tw.get_trg_emb_wei()),
       _p_d_dec_wei(tw.get_dec_wei()),
+      _p_i8_trg_emb_wei(tw.get_int8_trg_emb_wei()),
+      _p_i8_dec_wei(tw.get_int8_dec_wei()),
       _tw(tw),
       _stream(stream),
       _hd(hd),
@@ -57,7 +60,15 @@ QuantDecoder<OpType_>::QuantDecoder(int max_batch_size,
       _h_alive_seq_probs(max_batch_size * tw._beam_size,
                          min_log_probability / 2),
       _h_length_norm(tw._max_step, 1.f),
-      _h_unfinished(1) {
+      _h_unfinished(1),
+      _stage_timer(nullptr),
+      _stage_project(-1),
+      _stage_emb(-1),
+      _stage_logits(-1),
+      _stage_search(-1),
+      _stage_self_attn(tw._n_dec_layer, -1),
+      _stage_encdec_attn(tw._n_dec_layer, -1),
+      _stage_ffn(tw._n_dec_layer, -1) {
   for (int i = 0; i < _h_alive_seq_probs.size(); i += tw._beam_size) {
     _h_alive_seq_probs[i] = 0.f;
   }
@@ -70,6 +81,27 @@ QuantDecoder<OpType_>::QuantDecoder(int max_batch_size,
   return;
 }
 
+/**
+Register the timed stages of decoder: the encoder output projection, and
+per step the embedding, the attentions and ffn of every layer, the logits
+and the search
+*/
+template <OperationType OpType_>
+void QuantDecoder<OpType_>::set_stage_timer(CudaStageTimer* timer) {
+  _stage_timer = timer;
+  _stage_project = timer->stage_id("decoder.project_encoder_output");
+  _stage_emb = timer->stage_id("decoder.embedding");
+  _stage_logits = timer->stage_id("decoder.logits");
+  _stage_search = timer->stage_id(_tw._sampling_method == "beam_search"
+                                      ? "decoder.beam_search"
+                                      : "decoder.sampling");
+  _stage_self_attn =
+      timer->layer_stage_ids("decoder", "self_attention", _tw._n_dec_layer);
+  _stage_encdec_attn =
+      timer->layer_stage_ids("decoder", "encdec_attention", _tw._n_dec_layer);
+  _stage_ffn = timer->layer_stage_ids("decoder", "ffn", _tw._n_dec_layer);
+}
+
 /**
 Init the GPU memory pointer which point to
   the memory buffer needed by decoder.
@@ -156,20 +188,23 @@ void QuantDecoder<OpType_>::init_buffer() {
                                              _tw._beam_size * _max_batch_size) *
                      sizeof(int8_t)));
 
+  // the int8 kernels in their gemm layouts, see int8_weight_cache.h
+  Int8WeightCache int8_cache =
+      open_int8_weight_cache("quant_decoder", _tw.get_int8_weight_hash());
+
   // malloc embeddings
   CHECK_GPU_ERROR(
       cudaMalloc(&_int8_p_d_trg_emb_wei,
                  _tw._trg_vocab_size * _tw._hidden_size * sizeof(int8_t)));
-  quantize_weight(_p_d_trg_emb_wei[0], _int8_p_d_trg_emb_wei, _tw._hidden_size,
-                  _tw._trg_vocab_size, _quant_range / _trg_emb_clip_max,
-                  _stream, _cublas_lt_handle);
+  load_int8_weight(_p_i8_trg_emb_wei[0], _int8_p_d_trg_emb_wei,
+                   _tw._hidden_size, _tw._trg_vocab_size, _stream,
+                   _cublas_lt_handle, &int8_cache);
   CHECK_GPU_ERROR(
       cudaMalloc(&_int8_p_d_trg_emb_bottom_wei,
                  _tw._trg_vocab_size * _tw._hidden_size * sizeof(int8_t)));
-  quantize_weight(_p_d_trg_emb_wei[0], _int8_p_d_trg_emb_bottom_wei,
-                  _tw._hidden_size, _tw._trg_vocab_size,
-                  _quant_range / _trg_emb_clip_max, _stream, _cublas_lt_handle,
-                  kRowMajor);
+  load_int8_weight(_p_i8_trg_emb_wei[0], _int8_p_d_trg_emb_bottom_wei,
+                   _tw._hidden_size, _tw._trg_vocab_size, _stream,
+                   _cublas_lt_handle, &int8_cache, kRowMajor);
   _p_device_emb.push_back(nullptr);
   _p_device_emb.push_back(
       to_gpu(_p_d_trg_emb_wei[1], _tw._max_step * _tw._hidden_size, _stream));
@@ -281,41 +316,33 @@ void QuantDecoder<OpType_>::init_buffer() {
     _p_device_wei.push_back(
         to_gpu(_p_d_dec_wei[_weight_offset + 17], _tw._hidden_size, _stream));
 
-    quantize_weight(_p_d_dec_wei[_weight_offset + 2],
-                    _int8_p_d_dec_wei[_layer_id * 6], _tw._hidden_size,
-                    _tw._hidden_size * 3,
-                    _quant_range / _dec_clip_max[_layer_id * 19], _stream,
-                    _cublas_lt_handle);
-
-    quantize_weight(_p_d_dec_wei[_weight_offset + 4],
-                    _int8_p_d_dec_wei[_layer_id * 6 + 1], _tw._hidden_size,
-                    _tw._hidden_size,
-                    _quant_range / _dec_clip_max[_layer_id * 19 + 1], _stream,
-                    _cublas_lt_handle, kColMajor);
-
-    quantize_weight(_p_d_dec_wei[_weight_offset + 8],
-                    _int8_p_d_dec_wei[_layer_id * 6 + 2], _tw._hidden_size,
-                    _tw._hidden_size,
-                    _quant_range / _dec_clip_max[_layer_id * 19 + 2], _stream,
-                    _cublas_lt_handle);
-
-    quantize_weight(_p_d_dec_wei[_weight_offset + 10],
-                    _int8_p_d_dec_wei[_layer_id * 6 + 3], _tw._hidden_size,
-                    _tw._hidden_size,
-                    _quant_range / _dec_clip_max[_layer_id * 19 + 3], _stream,
-                    _cublas_lt_handle, kColMajor);
-
-    quantize_weight(_p_d_dec_wei[_weight_offset + 14],
-                    _int8_p_d_dec_wei[_layer_id * 6 + 4], _tw._hidden_size,
-                    _tw._inner_size,
-                    _quant_range / _dec_clip_max[_layer_id * 19 + 4], _stream,
-                    _cublas_lt_handle);
-
-    quantize_weight(_p_d_dec_wei[_weight_offset + 16],
-                    _int8_p_d_dec_wei[_layer_id * 6 + 5], _tw._inner_size,
-                    _tw._hidden_size,
-                    _quant_range / _dec_clip_max[_layer_id * 19 + 5], _stream,
-                    _cublas_lt_handle, kColMajor);
+    load_int8_weight(_p_i8_dec_wei[_layer_id * 6],
+                     _int8_p_d_dec_wei[_layer_id * 6], _tw._hidden_size,
+                     _tw._hidden_size * 3, _stream, _cublas_lt_handle,
+                     &int8_cache);
+
+    load_int8_weight(_p_i8_dec_wei[_layer_id * 6 + 1],
+                     _int8_p_d_dec_wei[_layer_id * 6 + 1], _tw._hidden_size,
+                     _tw._hidden_size, _stream, _cublas_lt_handle, &int8_cache,
+                     kColMajor);
+
+    load_int8_weight(_p_i8_dec_wei[_layer_id * 6 + 2],
+                     _int8_p_d_dec_wei[_layer_id * 6 + 2], _tw._hidden_size,
+                     _tw._hidden_size, _stream, _cublas_lt_handle, &int8_cache);
+
+    load_int8_weight(_p_i8_dec_wei[_layer_id * 6 + 3],
+                     _int8_p_d_dec_wei[_layer_id * 6 + 3], _tw._hidden_size,
+                     _tw._hidden_size, _stream, _cublas_lt_handle, &int8_cache,
+                     kColMajor);
+
+    load_int8_weight(_p_i8_dec_wei[_layer_id * 6 + 4],
+                     _int8_p_d_dec_wei[_layer_id * 6 + 4], _tw._hidden_size,
+                     _tw._inner_size, _stream, _cublas_lt_handle, &int8_cache);
+
+    load_int8_weight(_p_i8_dec_wei[_layer_id * 6 + 5],
+                     _int8_p_d_dec_wei[_layer_id * 6 + 5], _tw._inner_size,
+                     _tw._hidden_size, _stream, _cublas_lt_handle, &int8_cache,
+                     kColMajor);
 
     if (_tw._use_gelu) {
       _scaled_ffn2_colsum[_layer_id] = nullptr;
@@ -323,23 +350,18 @@ void QuantDecoder<OpType_>::init_buffer() {
       CHECK_GPU_ERROR(cudaMalloc(&_scaled_ffn2_colsum[_layer_id],
                                  _tw._hidden_size * sizeof(_DataType)));
       float relu_scale = _dec_clip_max[_layer_id * 19 + 11] / 2;
-
-      _DataType* temp;
-      int weight_size = _tw._inner_size * _tw._hidden_size;
-
-      CHECK_GPU_ERROR(cudaMalloc(&temp, weight_size * sizeof(_DataType)));
-      CHECK_GPU_ERROR(cudaMemcpyAsync(temp, _p_d_dec_wei[_weight_offset + 16],
-                                      weight_size * sizeof(_DataType),
-                                      cudaMemcpyHostToDevice, _stream));
-      launch_scaled_colsum(temp, _scaled_ffn2_colsum[_layer_id],
-                           _tw._inner_size, _tw._hidden_size, relu_scale,
-                           _stream);
-      CHECK_GPU_ERROR(cudaGetLastError());
-      CHECK_GPU_ERROR(cudaFree(temp));
+      std::vector<float> colsum = int8_scaled_colsum(
+          _p_i8_dec_wei[_layer_id * 6 + 5], _tw._inner_size, _tw._hidden_size,
+          _dec_clip_max[_layer_id * 19 + 5] / _quant_range, relu_scale);
+      std::vector<_DataType> h_colsum(colsum.begin(), colsum.end());
+      CHECK_GPU_ERROR(cudaMemcpyAsync(
+          _scaled_ffn2_colsum[_layer_id], h_colsum.data(),
+          _tw._hidden_size * sizeof(_DataType), cudaMemcpyHostToDevice,
+          _stream));
     }
   }
 
-  CHECK_GPU_ERROR(cudaStreamSynchronize(_stream));
+  close_int8_weight_cache(&int8_cache, _stream);
   CHECK_GPU_ERROR(cudaGetLastError());
   std::cout << "decoder buffer init succeed" << std::endl;
   return;
@@ -424,7 +446,10 @@ void QuantDecoder<OpType_>::run_one_infer(int batch_size, int batch_seq_len) {
     _batch_max_decode_length = _tw._max_step;
   }
 
-  project_encoder_output();  // project encoder output
+  {
+    CudaStageScope scope(_stage_timer, _stage_project, _stream);
+    project_encoder_output();  // project encoder output
+  }
   // init the first step's token id with target start_id
   CHECK_GPU_ERROR(cudaMemcpyAsync(_p_d_alive_seq_probs,
                                   _h_alive_seq_probs.data(),
@@ -446,22 +471,24 @@ void QuantDecoder<OpType_>::run_one_infer(int batch_size, int batch_seq_len) {
     if (_cur_step == _batch_max_decode_length) {
       _cur_step -= 1;
     }
-    ker_write_topk_result<<<_batch_size * _tw._beam_size, _cur_step + 1, 0,
+    ker_write_topk_result<<<_batch_size * _tw._beam_size,
+                            std::min(_cur_step + 1, _max_thread_per_block), 0,
                             _stream>>>(
         _p_d_alive_seq, _p_d_alive_seq_score, _p_d_result, _tw._trg_vocab_size,
-        _tw._max_step, _tw._beam_size, _tw._end_id);
+        _tw._max_step, _tw._beam_size, _tw._end_id, _cur_step + 1);
     return;
   }
   if (_tw._length_penalty >= 0.f || _cur_step == _batch_max_decode_length) {
-    ker_write_trg_tokenid_pos_penalty<<<_batch_size, _cur_step + 1, 0,
-                                        _stream>>>(
-        _p_d_alive_seq, _p_d_alive_seq_score, _p_d_result, _tw._max_step,
-        _tw._beam_size);
+    ker_write_trg_tokenid_pos_penalty<<<
+        _batch_size, std::min(_cur_step + 1, _max_thread_per_block), 0,
+        _stream>>>(_p_d_alive_seq, _p_d_alive_seq_score, _p_d_result,
+                   _tw._max_step, _tw._beam_size, _cur_step + 1);
   } else {
-    ker_write_trg_tokenid_neg_penalty<<<_batch_size, _cur_step + 1, 0,
-                                        _stream>>>(
-        _p_d_alive_seq, _p_d_alive_seq_score, _p_d_result, _tw._max_step,
-        _tw._beam_size, _tw._trg_vocab_size, _tw._end_id);
+    ker_write_trg_tokenid_neg_penalty<<<
+        _batch_size, std::min(_cur_step + 1, _max_thread_per_block), 0,
+        _stream>>>(_p_d_alive_seq, _p_d_alive_seq_score, _p_d_result,
+                   _tw._max_step, _tw._beam_size, _tw._trg_vocab_size,
+                   _tw._end_id, _cur_step + 1);
   }
 #ifdef DEBUG_RESULT
   for (int i = 0; i < _batch_size; i++) {
@@ -484,7 +511,7 @@ void QuantDecoder<OpType_>::project_encoder_output() {
             "_p_d_encoder_output(tail)", 5);
   print_vec(_p_device_emb[4], "encoder project(head):", 10);
 #endif
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, kv_dim, _batch_token_num, _tw._hidden_size,
       &_type_one, _p_device_emb[4], _AType, kv_dim, _p_d_encoder_output, _BType,
       _tw._hidden_size, &_type_zero, _p_d_encoder_out_buf, _CType, kv_dim,
@@ -512,18 +539,23 @@ Decode one step
 */
 template <OperationType OpType_>
 bool QuantDecoder<OpType_>::run_step() {
-  embedding();
+  {
+    CudaStageScope scope(_stage_timer, _stage_emb, _stream);
+    embedding();
+  }
   decoder_stack();
   /* --- Project hidden states to vocab logits--- */
 
   // _step_token_num (beam_size * batch_size) must be 4x
-
-  cublasLtMM_withAlgo_i8IO(_int8_ffn_out_buf, 1, _step_token_num,
-                           _tw._trg_vocab_size, _tw._hidden_size, 0, 0, 0,
-                           _output_ln_clip_max * _trg_emb_clip_max /
-                               (_logits_clip_max * _quant_range),
-                           _int8_ffn_in_buf, _int8_p_d_trg_emb_wei,
-                           _cublas_lt_handle, _stream, false);
+  {
+    CudaStageScope scope(_stage_timer, _stage_logits, _stream);
+    cublasLtMM_withAlgo_i8IO(_int8_ffn_out_buf, 1, _step_token_num,
+                             _tw._trg_vocab_size, _tw._hidden_size, 0, 0, 0,
+                             _output_ln_clip_max * _trg_emb_clip_max /
+                                 (_logits_clip_max * _quant_range),
+                             _int8_ffn_in_buf, _int8_p_d_trg_emb_wei,
+                             _cublas_lt_handle, _stream, false);
+  }
 
 #ifdef DEBUG_RESULT
   for (int i = 0; i < _batch_size; i++) {       // batch_id
@@ -539,6 +571,7 @@ bool QuantDecoder<OpType_>::run_step() {
   }
 #endif
 
+  CudaStageScope scope(_stage_timer, _stage_search, _stream);
   if (_tw._sampling_method == "topk") {
     return sample();
   } else if (_tw._sampling_method == "topp") {
@@ -593,11 +626,19 @@ void QuantDecoder<OpType_>::decoder_stack() {
   for (_layer_id = 0; _layer_id < _tw._n_dec_layer; _layer_id++) {
     _weight_offset = _layer_id * _tw._weight_per_dec_layer;
 
-    self_attention();
-
-    encdec_attention();
-
-    ffn_add_norm();
+    {
+      CudaStageScope scope(_stage_timer, _stage_self_attn[_layer_id], _stream);
+      self_attention();
+    }
+    {
+      CudaStageScope scope(_stage_timer, _stage_encdec_attn[_layer_id],
+                           _stream);
+      encdec_attention();
+    }
+    {
+      CudaStageScope scope(_stage_timer, _stage_ffn[_layer_id], _stream);
+      ffn_add_norm();
+    }
   }
 }
 
@@ -655,7 +696,7 @@ void QuantDecoder<OpType_>::self_attention() {
   CHECK_GPU_ERROR(cudaGetLastError());
 #endif
 
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_T, CUBLAS_OP_N, _cur_step + 1, 1, _tw._dim_per_head,
       &_ione, _p_d_self_k_cache1[_layer_id], CUDA_R_8I, _tw._dim_per_head,
       _tw._max_step * _tw._dim_per_head, _int8_ffn_in_buf, CUDA_R_8I,
@@ -747,7 +788,7 @@ void QuantDecoder<OpType_>::encdec_attention() {
 #endif
 
   /* ---step 2. correlation = q * k, perform softmax on correlation--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_T, CUBLAS_OP_N, _batch_seq_len, _tw._beam_size,
       _tw._dim_per_head, &_atten_scaler, _p_d_encdec_k_bgeem[_layer_id], _AType,
       _tw._dim_per_head, _batch_seq_len * _tw._dim_per_head, _p_d_query_buf1,
@@ -760,7 +801,7 @@ void QuantDecoder<OpType_>::encdec_attention() {
       _p_d_c, _p_d_padding_mask);
 
   /* ---step 3. new_q = correlation * v--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._dim_per_head, _tw._beam_size,
       _batch_seq_len, &_type_one, _p_d_encdec_v_bgeem[_layer_id], _AType,
       _tw._dim_per_head, _batch_seq_len * _tw._dim_per_head, _p_d_c, _BType,
@@ -977,12 +1018,13 @@ bool QuantDecoder<OpType_>::beam_search() {
       Deciding whether early stop based on num_finish_beam
   */
   CHECK_GPU_ERROR(cudaMemsetAsync(_p_d_can_num, 0, sizeof(int), _stream));
-  ker_refresh_result<<<dim3(_batch_size, _tw._beam_size), _tw._max_step, 0,
+  ker_refresh_result<<<dim3(_batch_size, _tw._beam_size),
+                       std::min(_tw._max_step, _max_thread_per_block), 0,
                        _stream>>>(
       _p_d_can_idx, _p_d_can_score, _p_d_can_num + 1, _p_d_alive_seq,
       _p_d_alive_seq_buf, _p_d_alive_seq_probs, _p_d_alive_seq_score,
       _p_d_can_num, _tw._trg_vocab_size, _cur_step, _h_length_norm[_cur_step],
-      _tw._diverse_lambda, _tw._end_id);
+      _tw._diverse_lambda, _tw._end_id, _tw._max_step);
   int* tmp = _p_d_alive_seq_buf;
   _p_d_alive_seq_buf = _p_d_alive_seq;
   _p_d_alive_seq = tmp;
@@ -16,6 +16,8 @@
 #include <unistd.h>
 
 #include "../proto/quant_transformer_weight.h"
+#include "../tools/cuda_stage_timer.h"
+#include "../tools/gemm_dispatch.h"
 #include "../tools/util.h"
 
 /**
@@ -124,6 +126,9 @@ class QuantDecoder {
   const std::vector<const _DataType*>& _p_d_trg_emb_wei;  // size: 7
   const std::vector<const _DataType*>&
       _p_d_dec_wei;  // size: 18 * dec_layer_num
+  // int8 kernels on host, see QuantTransformerWeight
+  const std::vector<const int8_t*>& _p_i8_trg_emb_wei;
+  const std::vector<const int8_t*>& _p_i8_dec_wei;
   std::vector<const _DataType*> _p_device_wei;
   std::vector<const _DataType*> _p_device_emb;
 
@@ -152,6 +157,16 @@ class QuantDecoder {
   const std::set<std::string> kSamplingMethods = {"beam_search", "topk", "topp",
                                                   "topk_greedy"};
 
+  // per-stage timing, see cuda_stage_timer.h
+  CudaStageTimer* _stage_timer;
+  int _stage_project;
+  int _stage_emb;
+  int _stage_logits;
+  int _stage_search;
+  std::vector<int> _stage_self_attn;
+  std::vector<int> _stage_encdec_attn;
+  std::vector<int> _stage_ffn;
+
  public:
   QuantDecoder(int max_batch_size, const int* p_d_padding_mask,
                const _DataType* p_d_encoder_output, int* p_d_result,
@@ -161,6 +176,7 @@ class QuantDecoder {
   void init_buffer();
   std::string check();
   void run_one_infer(int batch_size, int batch_seq_len);
+  void set_stage_timer(CudaStageTimer* timer);
   int _cur_step;
   float* _p_d_alive_seq_score;
   bool _output_topk;
@@ -14,6 +14,8 @@
 #include <string>
 
 #include "../proto/quant_transformer_weight.h"
+#include "../tools/cuda_stage_timer.h"
+#include "../tools/gemm_dispatch.h"
 #include "../tools/util.h"
 
 /**
@@ -78,6 +80,9 @@ class QuantEncoder {
   // ffn_first_kernel, ffn_first_bias, ffn_second_kernel, ffn_second_bias} *
   // encoder_layer_num
   const std::vector<const _DataType *> &_p_d_enc_wei;
+  // int8 kernels on host, see QuantTransformerWeight
+  const std::vector<const int8_t *> &_p_i8_src_emb_wei;
+  const std::vector<const int8_t *> &_p_i8_enc_wei;
   std::vector<const _DataType *> _p_device_wei;
   std::vector<const _DataType *> _p_device_emb;
 
@@ -94,6 +99,12 @@ class QuantEncoder {
   int _layer_id;
   int _weight_offset;
 
+  // per-stage timing, see cuda_stage_timer.h
+  CudaStageTimer *_stage_timer;
+  int _stage_emb;
+  std::vector<int> _stage_attn;
+  std::vector<int> _stage_ffn;
+
  public:
   QuantEncoder(int max_batch_size, int *p_d_token_id, int *p_d_padding_mask,
                _DataType *p_d_output, const QuantTransformerWeight<OpType_> &tw,
@@ -102,6 +113,7 @@ class QuantEncoder {
   void init_buffer();
   std::string check();
   void run_one_infer(int batch_size, int batch_seq_len);
+  void set_stage_timer(CudaStageTimer *timer);
   int *_p_d_token_id;  // input token id [batch_size, batch_seq_len]
   const int *_p_d_lang_id;
 };
@@ -1,3 +1,4 @@
+#include "../tools/quant_weight.h"
 #include "../kernels/gptKernels.h"
 #include "../kernels/gptKernels_int8.h"
 #include "../kernels/transformerKernels.h"
@@ -31,6 +32,8 @@ QuantGptEncoder<OpType_>::QuantGptEncoder(
       _hd(hd),
       _p_d_src_emb_wei(tw.get_src_emb_wei()),
       _p_d_enc_wei(tw.get_enc_wei()),
+      _p_i8_src_emb_wei(tw.get_int8_src_emb_wei()),
+      _p_i8_enc_wei(tw.get_int8_enc_wei()),
       _fone((_DataType)1.f),
       _fzero((_DataType)0.f),
       _src_emb_clip_max(tw.get_src_emb_clip_max()),
@@ -45,10 +48,33 @@ QuantGptEncoder<OpType_>::QuantGptEncoder(
       _h_real_seq_len(max_batch_size, 0),
       _h_ppl(max_batch_size, 0.f),
       _h_sample_id(max_batch_size * tw._max_step, 0),
-      _h_unfinished(1) {
+      _h_unfinished(1),
+      _stage_timer(nullptr),
+      _stage_emb(-1),
+      _stage_logits(-1),
+      _stage_sampling(-1),
+      _stage_ppl(-1),
+      _stage_attn(tw._n_enc_layer, -1),
+      _stage_ffn(tw._n_enc_layer, -1) {
   CHECK_GPU_ERROR(cublasLtCreate(&_cublas_lt_handle));
 }
 
+/**
+Register the timed stages of gpt, embedding, attention and ffn of every
+layer, logits, sampling and ppl. The output layer norm is fused into the
+last ffn
+*/
+template <OperationType OpType_>
+void QuantGptEncoder<OpType_>::set_stage_timer(CudaStageTimer *timer) {
+  _stage_timer = timer;
+  _stage_emb = timer->stage_id("gpt.embedding");
+  _stage_logits = timer->stage_id("gpt.logits");
+  _stage_sampling = timer->stage_id("gpt.sampling");
+  _stage_ppl = timer->stage_id("gpt.ppl");
+  _stage_attn = timer->layer_stage_ids("gpt", "attention", _tw._n_enc_layer);
+  _stage_ffn = timer->layer_stage_ids("gpt", "ffn", _tw._n_enc_layer);
+}
+
 /**
 Init the GPU memory pointer which point to
   the memory buffer needed by encoder.
@@ -92,20 +118,23 @@ void QuantGptEncoder<OpType_>::init_buffer() {
                                              _tw._max_step * _max_batch_size) *
                      sizeof(int8_t)));
 
+  // the int8 kernels in their gemm layouts, see int8_weight_cache.h
+  Int8WeightCache int8_cache =
+      open_int8_weight_cache("quant_gpt_encoder", _tw.get_int8_weight_hash());
+
   // malloc embeddings
   CHECK_GPU_ERROR(
       cudaMalloc(&_int8_p_d_src_emb_wei,
                  _tw._src_vocab_size * _tw._hidden_size * sizeof(int8_t)));
-  quantize_weight(_p_d_src_emb_wei[0], _int8_p_d_src_emb_wei, _tw._hidden_size,
-                  _tw._src_vocab_size, _quant_range / _src_emb_clip_max,
-                  _stream, _cublas_lt_handle);
+  load_int8_weight(_p_i8_src_emb_wei[0], _int8_p_d_src_emb_wei,
+                   _tw._hidden_size, _tw._src_vocab_size, _stream,
+                   _cublas_lt_handle, &int8_cache);
   CHECK_GPU_ERROR(
       cudaMalloc(&_int8_p_d_src_emb_bottom_wei,
                  _tw._src_vocab_size * _tw._hidden_size * sizeof(int8_t)));
-  quantize_weight(_p_d_src_emb_wei[0], _int8_p_d_src_emb_bottom_wei,
-                  _tw._hidden_size, _tw._src_vocab_size,
-                  _quant_range / _src_emb_clip_max, _stream, _cublas_lt_handle,
-                  kColMajor);
+  load_int8_weight(_p_i8_src_emb_wei[0], _int8_p_d_src_emb_bottom_wei,
+                   _tw._hidden_size, _tw._src_vocab_size, _stream,
+                   _cublas_lt_handle, &int8_cache, kColMajor);
   _p_device_emb.push_back(nullptr);
   _p_device_emb.push_back(
       to_gpu(_p_d_src_emb_wei[1], _tw._max_step * _tw._hidden_size, _stream));
@@ -177,34 +206,29 @@ void QuantGptEncoder<OpType_>::init_buffer() {
     _p_device_wei.push_back(
         to_gpu(_p_d_enc_wei[_weight_offset + 11], _tw._hidden_size, _stream));
 
-    quantize_weight(_p_d_enc_wei[_weight_offset + 2],
-                    _int8_p_d_enc_wei[_layer_id * 4], _tw._hidden_size,
-                    _tw._hidden_size * 3,
-                    _quant_range / _enc_clip_max[_layer_id * 12], _stream,
-                    _cublas_lt_handle);
-
-    quantize_weight(_p_d_enc_wei[_weight_offset + 4],
-                    _int8_p_d_enc_wei[_layer_id * 4 + 1], _tw._hidden_size,
-                    _tw._hidden_size,
-                    _quant_range / _enc_clip_max[_layer_id * 12 + 1], _stream,
-                    _cublas_lt_handle, kColMajor);
-
-    quantize_weight(_p_d_enc_wei[_weight_offset + 8],
-                    _int8_p_d_enc_wei[_layer_id * 4 + 2], _tw._hidden_size,
-                    _tw._inner_size,
-                    _quant_range / _enc_clip_max[_layer_id * 12 + 2], _stream,
-                    _cublas_lt_handle);
-
-    quantize_weight(_p_d_enc_wei[_weight_offset + 10],
-                    _int8_p_d_enc_wei[_layer_id * 4 + 3], _tw._inner_size,
-                    _tw._hidden_size,
-                    _quant_range / _enc_clip_max[_layer_id * 12 + 3], _stream,
-                    _cublas_lt_handle, kColMajor);
+    load_int8_weight(_p_i8_enc_wei[_layer_id * 4],
+                     _int8_p_d_enc_wei[_layer_id * 4], _tw._hidden_size,
+                     _tw._hidden_size * 3, _stream, _cublas_lt_handle,
+                     &int8_cache);
+
+    load_int8_weight(_p_i8_enc_wei[_layer_id * 4 + 1],
+                     _int8_p_d_enc_wei[_layer_id * 4 + 1], _tw._hidden_size,
+                     _tw._hidden_size, _stream, _cublas_lt_handle, &int8_cache,
+                     kColMajor);
+
+    load_int8_weight(_p_i8_enc_wei[_layer_id * 4 + 2],
+                     _int8_p_d_enc_wei[_layer_id * 4 + 2], _tw._hidden_size,
+                     _tw._inner_size, _stream, _cublas_lt_handle, &int8_cache);
+
+    load_int8_weight(_p_i8_enc_wei[_layer_id * 4 + 3],
+                     _int8_p_d_enc_wei[_layer_id * 4 + 3], _tw._inner_size,
+                     _tw._hidden_size, _stream, _cublas_lt_handle, &int8_cache,
+                     kColMajor);
 
     _scaled_ffn2_colsum[_layer_id] = nullptr;
   }
 
-  CHECK_GPU_ERROR(cudaStreamSynchronize(_stream));
+  close_int8_weight_cache(&int8_cache, _stream);
   CHECK_GPU_ERROR(cudaGetLastError());
   std::cout << "quantized encoder buffer init succeed" << std::endl;
 
@@ -272,18 +296,31 @@ void QuantGptEncoder<OpType_>::run_one_infer(int batch_size,
 #endif
 
   // token embedding, add position embedding and layer_norm
-  ker_gpt_embedding_i8I_launcher<_DataType>(
-      batch_size, batch_seq_len, _tw._hidden_size, _stream,
-      _int8_p_d_src_emb_bottom_wei, _p_device_emb[1], _p_d_token_id, _p_d_query,
-      _p_d_real_seq_len, _tw._padding_id, 0, _src_emb_clip_max / _quant_range);
+  {
+    CudaStageScope scope(_stage_timer, _stage_emb, _stream);
+    ker_gpt_embedding_i8I_launcher<_DataType>(
+        batch_size, batch_seq_len, _tw._hidden_size, _stream,
+        _int8_p_d_src_emb_bottom_wei, _p_device_emb[1], _p_d_token_id,
+        _p_d_query, _p_d_real_seq_len, _tw._padding_id, 0,
+        _src_emb_clip_max / _quant_range);
+  }
 
   for (_layer_id = 0; _layer_id < _tw._n_enc_layer; _layer_id++) {
     _weight_offset = _layer_id * _tw._weight_per_enc_layer;
-    self_attention();
-    ffn_add_norm();
+    {
+      CudaStageScope scope(_stage_timer, _stage_attn[_layer_id], _stream);
+      self_attention();
+    }
+    {
+      CudaStageScope scope(_stage_timer, _stage_ffn[_layer_id], _stream);
+      ffn_add_norm();
+    }
   }
 
-  compute_ppl();
+  {
+    CudaStageScope scope(_stage_timer, _stage_ppl, _stream);
+    compute_ppl();
+  }
   return;
 }
 
@@ -319,16 +356,25 @@ int QuantGptEncoder<OpType_>::run_one_sample(int batch_size,
 #endif
 
   // token embedding, add position embedding and layer_norm
-  ker_gpt_embedding_i8I_launcher<_DataType>(
-      _batch_size, _batch_seq_len, _tw._hidden_size, _stream,
-      _int8_p_d_src_emb_bottom_wei, _p_device_emb[1], _p_d_sample_id,
-      _p_d_query, _p_d_real_seq_len, _tw._padding_id, 0,
-      _src_emb_clip_max / _quant_range);
+  {
+    CudaStageScope scope(_stage_timer, _stage_emb, _stream);
+    ker_gpt_embedding_i8I_launcher<_DataType>(
+        _batch_size, _batch_seq_len, _tw._hidden_size, _stream,
+        _int8_p_d_src_emb_bottom_wei, _p_device_emb[1], _p_d_sample_id,
+        _p_d_query, _p_d_real_seq_len, _tw._padding_id, 0,
+        _src_emb_clip_max / _quant_range);
+  }
 
   for (_layer_id = 0; _layer_id < _tw._n_enc_layer; _layer_id++) {
     _weight_offset = _layer_id * _tw._weight_per_enc_layer;
-    self_attention();
-    ffn_add_norm();
+    {
+      CudaStageScope scope(_stage_timer, _stage_attn[_layer_id], _stream);
+      self_attention();
+    }
+    {
+      CudaStageScope scope(_stage_timer, _stage_ffn[_layer_id], _stream);
+      ffn_add_norm();
+    }
   }
 
   int8_t **ftmp = _p_d_self_k_cache2;
@@ -354,15 +400,25 @@ int QuantGptEncoder<OpType_>::run_one_sample(int batch_size,
 #endif
 
     // token embedding, add position embedding and layer_norm
-    ker_gpt_embedding_i8I_launcher<_DataType>(
-        batch_size, 1, _tw._hidden_size, _stream, _int8_p_d_src_emb_bottom_wei,
-        _p_device_emb[1], _p_d_last_sample_id, _p_d_query, _p_d_real_seq_len,
-        _tw._padding_id, _batch_seq_len - 1, _src_emb_clip_max / _quant_range);
+    {
+      CudaStageScope scope(_stage_timer, _stage_emb, _stream);
+      ker_gpt_embedding_i8I_launcher<_DataType>(
+          batch_size, 1, _tw._hidden_size, _stream,
+          _int8_p_d_src_emb_bottom_wei, _p_device_emb[1], _p_d_last_sample_id,
+          _p_d_query, _p_d_real_seq_len, _tw._padding_id, _batch_seq_len - 1,
+          _src_emb_clip_max / _quant_range);
+    }
 
     for (_layer_id = 0; _layer_id < _tw._n_enc_layer; _layer_id++) {
       _weight_offset = _layer_id * _tw._weight_per_enc_layer;
-      self_attention_with_cache();
-      ffn_add_norm_with_cache();
+      {
+        CudaStageScope scope(_stage_timer, _stage_attn[_layer_id], _stream);
+        self_attention_with_cache();
+      }
+      {
+        CudaStageScope scope(_stage_timer, _stage_ffn[_layer_id], _stream);
+        ffn_add_norm_with_cache();
+      }
     }
 
     int8_t **ftmp = _p_d_self_k_cache2;
@@ -387,12 +443,16 @@ int QuantGptEncoder<OpType_>::run_one_sample(int batch_size,
 template <OperationType OpType_>
 int QuantGptEncoder<OpType_>::sample_one_token() {
   /* ---step 1. project hidden states to vocab logits--- */
-  cublasLtMM_withAlgo_i8IO(_int8_ffn_out_buf, 1, _batch_token_num,
-                           _tw._src_vocab_size, _tw._hidden_size, 0, 0, 0,
-                           _output_ln_clip_max * _src_emb_clip_max /
-                               (_logits_clip_max * _quant_range),
-                           _int8_ffn_in_buf, _int8_p_d_src_emb_wei,
-                           _cublas_lt_handle, _stream, false);
+  {
+    CudaStageScope scope(_stage_timer, _stage_logits, _stream);
+    cublasLtMM_withAlgo_i8IO(_int8_ffn_out_buf, 1, _batch_token_num,
+                             _tw._src_vocab_size, _tw._hidden_size, 0, 0, 0,
+                             _output_ln_clip_max * _src_emb_clip_max /
+                                 (_logits_clip_max * _quant_range),
+                             _int8_ffn_in_buf, _int8_p_d_src_emb_wei,
+                             _cublas_lt_handle, _stream, false);
+  }
+  CudaStageScope sampling_scope(_stage_timer, _stage_sampling, _stream);
   CHECK_GPU_ERROR(cudaMemsetAsync(_p_d_unfinished, 0, sizeof(int), _stream));
   /* ---step 2. sample new tokens from logits */
   if (_tw._sampling_method == "topk") {
@@ -429,13 +489,17 @@ int QuantGptEncoder<OpType_>::sample_one_token() {
 template <OperationType OpType_>
 int QuantGptEncoder<OpType_>::sample_one_token_with_cache() {
   /* ---step 1. project hidden states to vocab logits--- */
-  cublasLtMM_withAlgo_i8IO(_int8_ffn_out_buf, 1, _batch_size,
-                           _tw._src_vocab_size, _tw._hidden_size, 0, 0, 0,
-                           _output_ln_clip_max * _src_emb_clip_max /
-                               (_logits_clip_max * _quant_range),
-                           _int8_ffn_in_buf, _int8_p_d_src_emb_wei,
-                           _cublas_lt_handle, _stream, false);
+  {
+    CudaStageScope scope(_stage_timer, _stage_logits, _stream);
+    cublasLtMM_withAlgo_i8IO(_int8_ffn_out_buf, 1, _batch_size,
+                             _tw._src_vocab_size, _tw._hidden_size, 0, 0, 0,
+                             _output_ln_clip_max * _src_emb_clip_max /
+                                 (_logits_clip_max * _quant_range),
+                             _int8_ffn_in_buf, _int8_p_d_src_emb_wei,
+                             _cublas_lt_handle, _stream, false);
+  }
 
+  CudaStageScope sampling_scope(_stage_timer, _stage_sampling, _stream);
   CHECK_GPU_ERROR(cudaMemsetAsync(_p_d_unfinished, 0, sizeof(int), _stream));
   // /* ---step 2. sample new tokens from logits */
   if (_tw._sampling_method == "topk") {
@@ -505,7 +569,7 @@ void QuantGptEncoder<OpType_>::self_attention() {
       _quant_range / _enc_clip_max[_layer_id * 12 + 11], true);
 
   /* ---step 2. correlation = q * k, perform softmax on correlation--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_T, CUBLAS_OP_N, _batch_seq_len, _batch_seq_len,
       _tw._dim_per_head, &_ione, _p_d_self_k_cache1[_layer_id], CUDA_R_8I,
       _tw._dim_per_head, _batch_seq_len * _tw._dim_per_head, _int8_ffn_in_buf,
@@ -520,7 +584,7 @@ void QuantGptEncoder<OpType_>::self_attention() {
       _enc_clip_max[_layer_id * 12 + 11] / _quant_range);
 
   /* ---step 3. new_q = correlation * v--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._dim_per_head, _batch_seq_len,
       _batch_seq_len, &_fone, _p_d_v, _AType, _tw._dim_per_head,
       _batch_seq_len * _tw._dim_per_head, _p_d_c, _BType, _batch_seq_len,
@@ -594,7 +658,7 @@ void QuantGptEncoder<OpType_>::self_attention_with_cache() {
 
   /* ---step 2. correlation = q * k, perform softmax on correlation
   correlation: [batch_size, heads_num, 1, batch_seq_len]--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_T, CUBLAS_OP_N, _batch_seq_len, 1, _tw._dim_per_head,
       &_ione, _p_d_self_k_cache1[_layer_id], CUDA_R_8I, _tw._dim_per_head,
       _batch_seq_len * _tw._dim_per_head, _int8_ffn_in_buf, CUDA_R_8I,
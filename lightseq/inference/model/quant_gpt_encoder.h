@@ -15,6 +15,8 @@
 #include <string>
 
 #include "../proto/quant_gpt_weight.h"
+#include "../tools/cuda_stage_timer.h"
+#include "../tools/gemm_dispatch.h"
 #include "../tools/util.h"
 
 namespace lightseq {
@@ -93,6 +95,9 @@ class QuantGptEncoder {
   // ffn_first_kernel, ffn_first_bias, ffn_second_kernel, ffn_second_bias} *
   // encoder_layer_num
   const std::vector<const _DataType *> &_p_d_enc_wei;
+  // int8 kernels on host, see QuantGptWeight
+  const std::vector<const int8_t *> &_p_i8_src_emb_wei;
+  const std::vector<const int8_t *> &_p_i8_enc_wei;
   std::vector<const _DataType *> _p_device_wei;
   std::vector<const _DataType *> _p_device_emb;
 
@@ -113,6 +118,15 @@ class QuantGptEncoder {
 
   const std::set<std::string> kSamplingMethods = {"topk", "topp", "ppl"};
 
+  // per-stage timing, see cuda_stage_timer.h
+  CudaStageTimer *_stage_timer;
+  int _stage_emb;
+  int _stage_logits;
+  int _stage_sampling;
+  int _stage_ppl;
+  std::vector<int> _stage_attn;
+  std::vector<int> _stage_ffn;
+
  public:
   int _batch_seq_len;
   const int *_p_d_token_id;  // input token id, [batch_size, batch_seq_len]
@@ -128,6 +142,7 @@ class QuantGptEncoder {
   void run_one_infer(int batch_size, int batch_seq_len);
   int run_one_sample(int batch_size, int batch_seq_len);
   void compute_ppl();
+  void set_stage_timer(CudaStageTimer *timer);
 };
 
 }  // namespace cuda
@@ -30,7 +30,25 @@ VitEncoder<OpType_>::VitEncoder(int max_batch_size,
       _fzero((_DataType)0.f),
       _atten_scaler((_DataType)sqrt(1.f / tw._dim_per_head)),
       _max_batch_dim(max_batch_size * tw._max_step * tw._hidden_size),
-      _max_thread_per_block(1024) {}
+      _max_thread_per_block(1024),
+      _stage_timer(nullptr),
+      _stage_emb(-1),
+      _stage_norm(-1),
+      _stage_attn(tw._n_enc_layer, -1),
+      _stage_ffn(tw._n_enc_layer, -1) {}
+
+/**
+Register the timed stages of vit, patch embedding, attention and ffn of every
+layer, and the output layer norm
+*/
+template <OperationType OpType_>
+void VitEncoder<OpType_>::set_stage_timer(CudaStageTimer *timer) {
+  _stage_timer = timer;
+  _stage_emb = timer->stage_id("vit.patch_embedding");
+  _stage_norm = timer->stage_id("vit.output_norm");
+  _stage_attn = timer->layer_stage_ids("vit", "attention", _tw._n_enc_layer);
+  _stage_ffn = timer->layer_stage_ids("vit", "ffn", _tw._n_enc_layer);
+}
 
 /**
 Compute GPU memory size needed by transformer encoder,
@@ -41,7 +59,10 @@ long VitEncoder<OpType_>::compute_buffer_bytesize() {
   long sz1 = _max_batch_dim * 6 +
              _max_batch_size * _tw._head_num * _tw._max_step * _tw._max_step;
   long sz2 = _max_batch_dim + _max_batch_size * _tw._max_step * _tw._inner_size;
-  return max(sz1, sz2) * sizeof(_DataType);
+  // im2col of the patch embedding
+  long sz3 = (long)_max_batch_size * (_tw._max_step - 1) * _tw._channel_input *
+             _tw._patch_size * _tw._patch_size;
+  return max(max(sz1, sz2), sz3) * sizeof(_DataType);
 }
 
 /**
@@ -60,6 +81,7 @@ void VitEncoder<OpType_>::init_buffer(void *pbuf) {
   _p_d_c = _p_d_v + _max_batch_dim;
   _p_d_ffn_buf1 = p_d_buf;
   _p_d_ffn_buf2 = _p_d_ffn_buf1 + _max_batch_dim;
+  _p_d_patch_col = p_d_buf;
   return;
 }
 
@@ -105,11 +127,10 @@ void VitEncoder<OpType_>::run_one_infer(int batch_size) {
   _batch_token_num = batch_size * _batch_seq_len;
 
   /* ---step2. encoder feedforward--- */
-  launch_patch_emb<_DataType>(_p_d_src_emb_wei[0], _p_d_src_emb_wei[1],
-                              _p_d_src_emb_wei[2], _p_d_src_emb_wei[3],
-                              _p_d_pixel_input, _p_d_output, _tw._patch_size,
-                              _tw._image_size, _batch_size, _tw._max_step,
-                              _tw._hidden_size, _tw._channel_input, _stream);
+  {
+    CudaStageScope scope(_stage_timer, _stage_emb, _stream);
+    patch_embedding();
+  }
 #ifdef DEBUG_RESULT
   for (int i = 0; i < _batch_size; i++) {  // batch_id
     for (int j = 0; j < 10; j++) {         // patch_id
@@ -122,13 +143,22 @@ void VitEncoder<OpType_>::run_one_infer(int batch_size) {
 #endif
   for (_layer_id = 0; _layer_id < _tw._n_enc_layer; _layer_id++) {
     _weight_offset = _layer_id * _tw._weight_per_enc_layer;
-    self_attention();
-    ffn_add_norm();
+    {
+      CudaStageScope scope(_stage_timer, _stage_attn[_layer_id], _stream);
+      self_attention();
+    }
+    {
+      CudaStageScope scope(_stage_timer, _stage_ffn[_layer_id], _stream);
+      ffn_add_norm();
+    }
   }
   // last layer norm
-  ker_norm_layer_launcher<_DataType>(
-      _batch_token_num, _tw._hidden_size, _stream, _p_d_output,
-      _p_d_src_emb_wei[4], _p_d_src_emb_wei[5], _max_thread_per_block);
+  {
+    CudaStageScope scope(_stage_timer, _stage_norm, _stream);
+    ker_norm_layer_launcher<_DataType>(
+        _batch_token_num, _tw._hidden_size, _stream, _p_d_output,
+        _p_d_src_emb_wei[4], _p_d_src_emb_wei[5], _max_thread_per_block);
+  }
 
 #ifdef DEBUG_RESULT
   for (int i = 0; i < _batch_size; i++) {       // batch_id
@@ -143,6 +173,32 @@ void VitEncoder<OpType_>::run_one_infer(int batch_size) {
   return;
 }
 
+/**
+Patch embedding, the conv2d with kernel_size = stride = patch_size as
+  im2col + one gemm against the conv weight + epilogue, see patch_im2col.h
+*/
+template <OperationType OpType_>
+void VitEncoder<OpType_>::patch_embedding() {
+  int num_patch = _tw._max_step - 1;
+  int col_dim = _tw._channel_input * _tw._patch_size * _tw._patch_size;
+  launch_patch_im2col<_DataType>(_p_d_pixel_input, _p_d_patch_col,
+                                 _tw._patch_size, _tw._image_size, _batch_size,
+                                 _tw._channel_input, _stream);
+
+  /* patch_out = col * conv_weight^T, written to token 1.. of each image, token
+   * 0 is the cls token */
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
+      _hd, CUBLAS_OP_T, CUBLAS_OP_N, _tw._hidden_size, num_patch, col_dim,
+      &_fone, _p_d_src_emb_wei[0], _AType, col_dim, 0, _p_d_patch_col, _BType,
+      col_dim, num_patch * col_dim, &_fzero, _p_d_output + _tw._hidden_size,
+      _CType, _tw._hidden_size, _tw._max_step * _tw._hidden_size, _batch_size,
+      _computeType, CUBLAS_GEMM_DEFAULT_TENSOR_OP));
+
+  launch_patch_emb_epilogue<_DataType>(
+      _p_d_src_emb_wei[1], _p_d_src_emb_wei[2], _p_d_src_emb_wei[3],
+      _p_d_output, _batch_size, _tw._max_step, _tw._hidden_size, _stream);
+}
+
 /**
 Encoder self attention
 */
@@ -164,7 +220,7 @@ void VitEncoder<OpType_>::self_attention() {
 
   /* ---step 1. qkv = ori_q * qkv_wei + bias, and reshape qkv for multi-head
    * gemm--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size * 3, _batch_token_num,
       _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 2], _AType,
       _tw._hidden_size * 3, _p_d_q, _BType, _tw._hidden_size, &_fzero,
@@ -184,7 +240,7 @@ void VitEncoder<OpType_>::self_attention() {
       _tw._dim_per_head, _tw._head_num, _max_thread_per_block);
 
   /* ---step 2. correlation = q * k, perform softmax on correlation--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_T, CUBLAS_OP_N, _batch_seq_len, _batch_seq_len,
       _tw._dim_per_head, &_atten_scaler, _p_d_k, _AType, _tw._dim_per_head,
       _batch_seq_len * _tw._dim_per_head, _p_d_q, _BType, _tw._dim_per_head,
@@ -203,7 +259,7 @@ void VitEncoder<OpType_>::self_attention() {
 #endif
 
   /* ---step 3. new_q = correlation * v--- */
-  CHECK_GPU_ERROR(cublasGemmStridedBatchedEx(
+  CHECK_GPU_ERROR(cublas_gemm_strided_batched_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._dim_per_head, _batch_seq_len,
       _batch_seq_len, &_fone, _p_d_v, _AType, _tw._dim_per_head,
       _batch_seq_len * _tw._dim_per_head, _p_d_c, _BType, _batch_seq_len,
@@ -222,7 +278,7 @@ void VitEncoder<OpType_>::self_attention() {
 #endif
 
   /* ---step 4. new_q = ori_q + new_q * output_wei--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _batch_token_num,
       _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 4], _AType,
       _tw._hidden_size, _p_d_v, _BType, _tw._hidden_size, &_fone, _p_d_output,
@@ -257,7 +313,7 @@ void VitEncoder<OpType_>::ffn_add_norm() {
 #endif
 
   /* ---step 1. first ffn layer--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._inner_size, _batch_token_num,
       _tw._hidden_size, &_fone, _p_d_enc_wei[_weight_offset + 8], _AType,
       _tw._inner_size, _p_d_ffn_buf1, _BType, _tw._hidden_size, &_fzero,
@@ -281,7 +337,7 @@ void VitEncoder<OpType_>::ffn_add_norm() {
 #endif
 
   /* ---step 2. second ffn layer--- */
-  CHECK_GPU_ERROR(cublasGemmEx(
+  CHECK_GPU_ERROR(cublas_gemm_ex(
       _hd, CUBLAS_OP_N, CUBLAS_OP_N, _tw._hidden_size, _batch_token_num,
       _tw._inner_size, &_fone, _p_d_enc_wei[_weight_offset + 10], _AType,
       _tw._hidden_size, _p_d_ffn_buf2, _BType, _tw._inner_size, &_fone,
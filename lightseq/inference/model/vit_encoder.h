@@ -13,6 +13,8 @@
 #include <string>
 
 #include "../proto/vit_weight.h"
+#include "../tools/cuda_stage_timer.h"
+#include "../tools/gemm_dispatch.h"
 #include "../tools/util.h"
 
 /**
@@ -35,6 +37,7 @@ class VitEncoder {
   const cudaDataType_t _CType = _optraits::CType;
 
   // private member function
+  void patch_embedding();
   void self_attention();
   void ffn_add_norm();
 
@@ -57,6 +60,7 @@ class VitEncoder {
   _DataType *_p_d_c;
   _DataType *_p_d_ffn_buf1;
   _DataType *_p_d_ffn_buf2;
+  _DataType *_p_d_patch_col;  // im2col of the patches, aliases the buffer
 
   // {conv_weight, conv_bias, pos_emb, cls_embedding}
   const std::vector<const _DataType *> &_p_d_src_emb_wei;
@@ -73,6 +77,13 @@ class VitEncoder {
   int _layer_id;
   int _weight_offset;
 
+  // per-stage timing, see cuda_stage_timer.h
+  CudaStageTimer *_stage_timer;
+  int _stage_emb;
+  int _stage_norm;
+  std::vector<int> _stage_attn;
+  std::vector<int> _stage_ffn;
+
  public:
   const float *_p_d_pixel_input;  // input pixels [batch_size, channel_input,
                                   // image_size, image_size]
@@ -87,6 +98,7 @@ class VitEncoder {
   void init_buffer(void *pbuf);
   std::string check();
   void run_one_infer(int batch_size);
+  void set_stage_timer(CudaStageTimer *timer);
 };
 
 }  // namespace cuda
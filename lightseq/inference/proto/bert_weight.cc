@@ -2,6 +2,9 @@
 
 #include <fstream>
 
+#include "../kernels/pooling.h"
+#include "../tools/weight_upload.h"
+
 /**
 @file
 Load the model weights which stored in custom proto file into GPU memory.
@@ -47,6 +50,7 @@ void BertWeight<OpType_>::proto_get_model_config(const Bert &bert) {
   _is_post_ln = bert.model_conf().is_post_ln();
   _use_gelu = bert.model_conf().use_gelu();
   _multilg_type = bert.model_conf().multilg_type();
+  _pooling_mode = bert.model_conf().pooling_mode();
 }
 
 /**
@@ -81,9 +85,7 @@ std::string BertWeight<OpType_>::proto_parse_emb_wei(
   for (float ele : layer.norm_bias()) value.push_back(ele);
   idx += _hidden_size;
 
-  std::vector<_DataType> raw_value;
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_src_emb_wei = raw_value;
+  upload_weights(value, &_d_src_emb_wei);
   for (int e : offset)
     _p_d_src_emb_wei.push_back(thrust::raw_pointer_cast(_d_src_emb_wei.data()) +
                                e);
@@ -97,98 +99,104 @@ Load the weights of encoder into GPU memory.
 */
 template <OperationType OpType_>
 std::string BertWeight<OpType_>::proto_parse_enc_wei(const Bert &bert) {
-  std::vector<int> offset;
-  std::vector<float> value;
-  int idx = 0;
-
-  for (auto enc_layer : bert.encoder_stack()) {
-    offset.push_back(idx);
-    if (enc_layer.multihead_norm_scale_size() != _hidden_size)
-      return "wrong multihead_norm_scale_size !";
-    for (float ele : enc_layer.multihead_norm_scale()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-    if (enc_layer.multihead_norm_bias_size() != _hidden_size)
-      return "wrong multihead_norm_bias_size !";
-    for (float ele : enc_layer.multihead_norm_bias()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-    if (enc_layer.multihead_project_kernel_qkv_size() !=
-        _hidden_size * _hidden_size * 3)
-      return "wrong multihead_project_kernel_qkv_size !";
-    for (float ele : enc_layer.multihead_project_kernel_qkv())
-      value.push_back(ele);
-    idx += _hidden_size * _hidden_size * 3;
-
-    offset.push_back(idx);
-    if (enc_layer.multihead_project_bias_qkv_size() != _hidden_size * 3)
-      return "wrong multihead_project_bias_qkv_size !";
-    for (float ele : enc_layer.multihead_project_bias_qkv())
-      value.push_back(ele);
-    idx += _hidden_size * 3;
-
-    offset.push_back(idx);
-    if (enc_layer.multihead_project_kernel_output_size() !=
-        _hidden_size * _hidden_size)
-      return "wrong multihead_project_kernel_output_size !";
-    for (float ele : enc_layer.multihead_project_kernel_output())
-      value.push_back(ele);
-    idx += _hidden_size * _hidden_size;
-
-    offset.push_back(idx);
-    if (enc_layer.multihead_project_bias_output_size() != _hidden_size)
-      return "wrong multihead_project_bias_output_size !";
-    for (float ele : enc_layer.multihead_project_bias_output())
-      value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-    if (enc_layer.ffn_norm_scale_size() != _hidden_size)
-      return "wrong ffn_norm_scale_size !";
-    for (float ele : enc_layer.ffn_norm_scale()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-    if (enc_layer.ffn_norm_bias_size() != _hidden_size)
-      return "wrong ffn_norm_bias_size !";
-    for (float ele : enc_layer.ffn_norm_bias()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-    if (enc_layer.ffn_first_kernel_size() != _hidden_size * _inner_size)
-      return "wrong ffn_first_kernel_size !";
-    for (float ele : enc_layer.ffn_first_kernel()) value.push_back(ele);
-    idx += _hidden_size * _inner_size;
-
-    offset.push_back(idx);
-    if (enc_layer.ffn_first_bias_size() != _inner_size)
-      return "wrong ffn_first_bias_size !";
-    for (float ele : enc_layer.ffn_first_bias()) value.push_back(ele);
-    idx += _inner_size;
-
-    offset.push_back(idx);
-    if (enc_layer.ffn_second_kernel_size() != _hidden_size * _inner_size)
-      return "wrong ffn_second_kernel_size !";
-    for (float ele : enc_layer.ffn_second_kernel()) value.push_back(ele);
-    idx += _hidden_size * _inner_size;
-
-    offset.push_back(idx);
-    if (enc_layer.ffn_second_bias_size() != _hidden_size)
-      return "wrong ffn_second_bias_size !";
-    for (float ele : enc_layer.ffn_second_bias()) value.push_back(ele);
-    idx += _hidden_size;
+  // the layers are copied in parallel and uploaded as they are done, see
+  // weight_upload.h
+  std::vector<size_t> sizes = {
+      (size_t)_hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size * _hidden_size * 3,
+      (size_t)_hidden_size * 3,
+      (size_t)_hidden_size * _hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size * _inner_size,
+      (size_t)_inner_size,
+      (size_t)_hidden_size * _inner_size,
+      (size_t)_hidden_size};
+  std::vector<std::string> names = {
+      "multihead_norm_scale", "multihead_norm_bias",
+      "multihead_project_kernel_qkv", "multihead_project_bias_qkv",
+      "multihead_project_kernel_output", "multihead_project_bias_output",
+      "ffn_norm_scale", "ffn_norm_bias", "ffn_first_kernel",
+      "ffn_first_bias", "ffn_second_kernel", "ffn_second_bias"};
+  int num_layers = bert.encoder_stack_size();
+  std::string res = upload_layers(
+      num_layers, sizes, names,
+      [&](int layer_id) {
+        const BertEncoderLayer &layer = bert.encoder_stack(layer_id);
+        return std::vector<const google::protobuf::RepeatedField<float> *>{
+            &layer.multihead_norm_scale(),
+            &layer.multihead_norm_bias(),
+            &layer.multihead_project_kernel_qkv(),
+            &layer.multihead_project_bias_qkv(),
+            &layer.multihead_project_kernel_output(),
+            &layer.multihead_project_bias_output(),
+            &layer.ffn_norm_scale(),
+            &layer.ffn_norm_bias(),
+            &layer.ffn_first_kernel(),
+            &layer.ffn_first_bias(),
+            &layer.ffn_second_kernel(),
+            &layer.ffn_second_bias()};
+      },
+      &_d_enc_wei);
+  if (!res.empty()) return res;
+
+  for (int e : layer_offsets(num_layers, sizes))
+    _p_d_enc_wei.push_back(thrust::raw_pointer_cast(_d_enc_wei.data()) + e);
+  std::cout << "finish initializing enc_wei from host to device" << std::endl;
+  return "";
+}
 
-  }  // for
+/**
+Check the exit heads and load them into GPU memory. The heads should be in
+the order of their layers, on distinct layers, and the last one on the last
+layer as the final classifier. No head disables the early exit.
+*/
+template <OperationType OpType_>
+std::string BertWeight<OpType_>::init_exit_heads(
+    const std::vector<int> &layer_ids,
+    const std::vector<std::vector<float>> &kernels,
+    const std::vector<std::vector<float>> &biases) {
+  _num_labels = 0;
+  _exit_layers.clear();
+  _exit_head_of_layer.assign(_n_enc_layer, -1);
+  if (layer_ids.empty()) return "";
+
+  int num_heads = layer_ids.size();
+  int num_labels = biases[0].size();
+  if (num_labels < 1) return "wrong exit head bias size !";
+  for (int i = 0; i < num_heads; i++) {
+    if (layer_ids[i] < 0 || layer_ids[i] >= _n_enc_layer ||
+        (i > 0 && layer_ids[i] <= layer_ids[i - 1])) {
+      return "exit head layer ids should be increasing encoder layers";
+    }
+    if ((int)biases[i].size() != num_labels)
+      return "wrong exit head bias size !";
+    if ((int)kernels[i].size() != _hidden_size * num_labels)
+      return "wrong exit head kernel size !";
+  }
+  if (layer_ids.back() != _n_enc_layer - 1) {
+    return "the last exit head should be on the last encoder layer";
+  }
 
+  std::vector<int> offset;
   std::vector<_DataType> raw_value;
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_enc_wei = raw_value;
-
+  for (int i = 0; i < num_heads; i++) {
+    offset.push_back(raw_value.size());
+    for (float e : kernels[i]) raw_value.push_back(float2required(e));
+    offset.push_back(raw_value.size());
+    for (float e : biases[i]) raw_value.push_back(float2required(e));
+    _exit_head_of_layer[layer_ids[i]] = i;
+  }
+  _d_exit_wei = raw_value;
+  _p_d_exit_wei.clear();
   for (int e : offset)
-    _p_d_enc_wei.push_back(thrust::raw_pointer_cast(_d_enc_wei.data()) + e);
-  std::cout << "finish initializing enc_wei from host to device" << std::endl;
+    _p_d_exit_wei.push_back(thrust::raw_pointer_cast(_d_exit_wei.data()) + e);
+  _num_labels = num_labels;
+  _exit_layers = layer_ids;
+  std::cout << "finish initializing exit heads from host to device"
+            << std::endl;
   return "";
 }
 
@@ -236,6 +244,14 @@ void BertWeight<OpType_>::hdf5_get_model_config(hid_t hdf5_file) {
     // default value
     _multilg_type = 0;
   }
+
+  try {
+    read_hdf5_dataset_scalar(hdf5_file, "model_conf/pooling_mode",
+                             H5T_NATIVE_INT, &_pooling_mode);
+  } catch (HDF5DatasetNotFoundError &e) {
+    // default value
+    _pooling_mode = kPoolNone;
+  }
 }
 
 /**
@@ -284,10 +300,7 @@ void BertWeight<OpType_>::hdf5_parse_emb_wei(hid_t hdf5_file) {
       "Wrong norm_bias_size !");
   idx += _hidden_size;
 
-  std::vector<_DataType> raw_value;
-  raw_value.reserve(value.size());
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_src_emb_wei = raw_value;
+  upload_weights(value, &_d_src_emb_wei);
   for (int e : offset)
     _p_d_src_emb_wei.push_back(thrust::raw_pointer_cast(_d_src_emb_wei.data()) +
                                e);
@@ -407,16 +420,41 @@ void BertWeight<OpType_>::hdf5_parse_enc_wei(hid_t hdf5_file) {
 
   }  // for
 
-  std::vector<_DataType> raw_value;
-  raw_value.reserve(value.size());
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_enc_wei = raw_value;
+  upload_weights(value, &_d_enc_wei);
 
   for (int e : offset)
     _p_d_enc_wei.push_back(thrust::raw_pointer_cast(_d_enc_wei.data()) + e);
   std::cout << "Finish loading enc_wei from host to device" << std::endl;
 }
 
+/**
+Load the optional exit heads, exit_heads/<i>/{layer_id, kernel, bias}.
+*/
+template <OperationType OpType_>
+void BertWeight<OpType_>::hdf5_parse_exit_heads(hid_t hdf5_file) {
+  int num_heads = 0;
+  try {
+    read_hdf5_dataset_scalar(hdf5_file, "model_conf/n_exit_heads",
+                             H5T_NATIVE_INT, &num_heads);
+  } catch (HDF5DatasetNotFoundError &e) {
+    // default value
+    num_heads = 0;
+  }
+  std::vector<int> layer_ids(num_heads);
+  std::vector<std::vector<float>> kernels, biases;
+  for (int i = 0; i < num_heads; i++) {
+    std::string dataset_prefix = "exit_heads/" + std::to_string(i);
+    read_hdf5_dataset_scalar(hdf5_file, dataset_prefix + "/layer_id",
+                             H5T_NATIVE_INT, &layer_ids[i]);
+    kernels.push_back(read_hdf5_dataset_data_float(
+        hdf5_file, dataset_prefix + "/kernel", H5T_NATIVE_FLOAT));
+    biases.push_back(read_hdf5_dataset_data_float(
+        hdf5_file, dataset_prefix + "/bias", H5T_NATIVE_FLOAT));
+  }
+  std::string res = init_exit_heads(layer_ids, kernels, biases);
+  if (!res.empty()) throw std::runtime_error(res);
+}
+
 /**
 Load the proto file into CPU memory and parse it.
 */
@@ -439,13 +477,25 @@ std::string BertWeight<OpType_>::initializing(std::string weight_path) {
       return "hidden_size should be a multiple of 4 to avoid misaligned "
              "address in CUDA";
     }
+    std::string res = check_pooling_mode(_pooling_mode);
+    if (!res.empty()) return res;
 
-    std::string res = proto_parse_emb_wei(bert.src_embedding());
+    res = proto_parse_emb_wei(bert.src_embedding());
     if (!res.empty()) return res;
 
     res = proto_parse_enc_wei(bert);
     if (!res.empty()) return res;
 
+    std::vector<int> layer_ids;
+    std::vector<std::vector<float>> kernels, biases;
+    for (const BertExitHead &head : bert.exit_heads()) {
+      layer_ids.push_back(head.layer_id());
+      kernels.emplace_back(head.kernel().begin(), head.kernel().end());
+      biases.emplace_back(head.bias().begin(), head.bias().end());
+    }
+    res = init_exit_heads(layer_ids, kernels, biases);
+    if (!res.empty()) return res;
+
     std::cout << "finish initializing all weight from host to device"
               << std::endl;
     // Optional:  Delete all global objects allocated by libprotobuf.
@@ -463,9 +513,12 @@ std::string BertWeight<OpType_>::initializing(std::string weight_path) {
       return "hidden_size should be a multiple of 4 to avoid misaligned "
              "address in CUDA";
     }
+    std::string res = check_pooling_mode(_pooling_mode);
+    if (!res.empty()) return res;
     // hdf5_parse_* would throw std::runtime_error on error
     hdf5_parse_emb_wei(hdf5_file);
     hdf5_parse_enc_wei(hdf5_file);
+    hdf5_parse_exit_heads(hdf5_file);
     H5Fclose(hdf5_file);
 
     std::cout << "Finish loading all weight from host to device" << std::endl;
@@ -35,6 +35,10 @@ class BertWeight {
   void hdf5_get_model_config(hid_t hdf5_file);
   void hdf5_parse_emb_wei(hid_t hdf5_file);
   void hdf5_parse_enc_wei(hid_t hdf5_file);
+  void hdf5_parse_exit_heads(hid_t hdf5_file);
+  std::string init_exit_heads(const std::vector<int> &layer_ids,
+                              const std::vector<std::vector<float>> &kernels,
+                              const std::vector<std::vector<float>> &biases);
   // store the weights pointer
   std::vector<const _DataType *> _p_d_src_emb_wei;  // size: 4
   std::vector<const _DataType *> _p_d_enc_wei;      // size: 12 * enc_layer_num
@@ -43,6 +47,10 @@ class BertWeight {
   thrust::device_vector<_DataType> _d_src_emb_wei;
   thrust::device_vector<_DataType> _d_enc_wei;
 
+  // {kernel, bias} of the exit heads, see early_exit.h
+  std::vector<const _DataType *> _p_d_exit_wei;
+  thrust::device_vector<_DataType> _d_exit_wei;
+
  public:
   std::string initializing(std::string proto_path);
 
@@ -60,6 +68,11 @@ class BertWeight {
     return _p_d_enc_wei;
   }
 
+  const std::vector<const _DataType *> &get_exit_wei() const {
+    // {exit_head_kernel, exit_head_bias} * exit_head_num
+    return _p_d_exit_wei;
+  }
+
   int _hidden_size;
   int _inner_size;
   int _max_step;
@@ -73,6 +86,12 @@ class BertWeight {
   bool _is_post_ln;
   bool _use_gelu;
   int _multilg_type;
+  int _pooling_mode;  // default pooling of the output, see pooling.h
+
+  // exit heads of early exit, 0 labels if the model has none
+  int _num_labels;
+  std::vector<int> _exit_head_of_layer;  // head index of a layer, or -1
+  std::vector<int> _exit_layers;         // layer id of a head
 
   void print_model_config() {
     std::cout << "***model config***" << std::endl;
@@ -85,6 +104,11 @@ class BertWeight {
     std::cout << "is_post_ln: " << _is_post_ln << std::endl;
     std::cout << "use_gelu: " << _use_gelu << std::endl;
     std::cout << "padding_id: " << _padding_id << std::endl;
+    std::cout << "pooling_mode: " << _pooling_mode << std::endl;
+    if (_num_labels > 0) {
+      std::cout << "exit heads: " << _exit_layers.size() << std::endl;
+      std::cout << "num labels: " << _num_labels << std::endl;
+    }
     std::cout << std::endl;
   }
 };
@@ -2,6 +2,8 @@
 
 #include <fstream>
 
+#include "../tools/weight_upload.h"
+
 /**
 @file
 Load the model weights which stored in custom proto file into GPU memory.
@@ -100,9 +102,7 @@ std::string GptWeight<OpType_>::proto_parse_emb_wei(
   for (float ele : layer.norm_bias()) value.push_back(ele);
   idx += _hidden_size;
 
-  std::vector<_DataType> raw_value;
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_src_emb_wei = raw_value;
+  upload_weights(value, &_d_src_emb_wei);
   for (int e : offset)
     _p_d_src_emb_wei.push_back(thrust::raw_pointer_cast(_d_src_emb_wei.data()) +
                                e);
@@ -116,96 +116,50 @@ Load the weights of encoder into GPU memory.
 */
 template <OperationType OpType_>
 std::string GptWeight<OpType_>::proto_parse_enc_wei(const Gpt &gpt) {
-  std::vector<int> offset;
-  std::vector<float> value;
-  int idx = 0;
-
-  for (auto enc_layer : gpt.encoder_stack()) {
-    offset.push_back(idx);
-    if (enc_layer.multihead_norm_scale_size() != _hidden_size)
-      return "wrong multihead_norm_scale_size !";
-    for (float ele : enc_layer.multihead_norm_scale()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-    if (enc_layer.multihead_norm_bias_size() != _hidden_size)
-      return "wrong multihead_norm_bias_size !";
-    for (float ele : enc_layer.multihead_norm_bias()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-    if (enc_layer.multihead_project_kernel_qkv_size() !=
-        _hidden_size * _hidden_size * 3)
-      return "wrong multihead_project_kernel_qkv_size !";
-    for (float ele : enc_layer.multihead_project_kernel_qkv())
-      value.push_back(ele);
-    idx += _hidden_size * _hidden_size * 3;
-
-    offset.push_back(idx);
-    if (enc_layer.multihead_project_bias_qkv_size() != _hidden_size * 3)
-      return "wrong multihead_project_bias_qkv_size !";
-    for (float ele : enc_layer.multihead_project_bias_qkv())
-      value.push_back(ele);
-    idx += _hidden_size * 3;
-
-    offset.push_back(idx);
-    if (enc_layer.multihead_project_kernel_output_size() !=
-        _hidden_size * _hidden_size)
-      return "wrong multihead_project_kernel_output_size !";
-    for (float ele : enc_layer.multihead_project_kernel_output())
-      value.push_back(ele);
-    idx += _hidden_size * _hidden_size;
-
-    offset.push_back(idx);
-    if (enc_layer.multihead_project_bias_output_size() != _hidden_size)
-      return "wrong multihead_project_bias_output_size !";
-    for (float ele : enc_layer.multihead_project_bias_output())
-      value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-    if (enc_layer.ffn_norm_scale_size() != _hidden_size)
-      return "wrong ffn_norm_scale_size !";
-    for (float ele : enc_layer.ffn_norm_scale()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-    if (enc_layer.ffn_norm_bias_size() != _hidden_size)
-      return "wrong ffn_norm_bias_size !";
-    for (float ele : enc_layer.ffn_norm_bias()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-    if (enc_layer.ffn_first_kernel_size() != _hidden_size * _inner_size)
-      return "wrong ffn_first_kernel_size !";
-    for (float ele : enc_layer.ffn_first_kernel()) value.push_back(ele);
-    idx += _hidden_size * _inner_size;
-
-    offset.push_back(idx);
-    if (enc_layer.ffn_first_bias_size() != _inner_size)
-      return "wrong ffn_first_bias_size !";
-    for (float ele : enc_layer.ffn_first_bias()) value.push_back(ele);
-    idx += _inner_size;
-
-    offset.push_back(idx);
-    if (enc_layer.ffn_second_kernel_size() != _hidden_size * _inner_size)
-      return "wrong ffn_second_kernel_size !";
-    for (float ele : enc_layer.ffn_second_kernel()) value.push_back(ele);
-    idx += _hidden_size * _inner_size;
-
-    offset.push_back(idx);
-    if (enc_layer.ffn_second_bias_size() != _hidden_size)
-      return "wrong ffn_second_bias_size !";
-    for (float ele : enc_layer.ffn_second_bias()) value.push_back(ele);
-    idx += _hidden_size;
-
-  }  // for
-
-  std::vector<_DataType> raw_value;
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_enc_wei = raw_value;
-
-  for (int e : offset)
+  // the layers are copied in parallel and uploaded as they are done, see
+  // weight_upload.h
+  std::vector<size_t> sizes = {
+      (size_t)_hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size * _hidden_size * 3,
+      (size_t)_hidden_size * 3,
+      (size_t)_hidden_size * _hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size * _inner_size,
+      (size_t)_inner_size,
+      (size_t)_hidden_size * _inner_size,
+      (size_t)_hidden_size};
+  std::vector<std::string> names = {
+      "multihead_norm_scale", "multihead_norm_bias",
+      "multihead_project_kernel_qkv", "multihead_project_bias_qkv",
+      "multihead_project_kernel_output", "multihead_project_bias_output",
+      "ffn_norm_scale", "ffn_norm_bias", "ffn_first_kernel",
+      "ffn_first_bias", "ffn_second_kernel", "ffn_second_bias"};
+  int num_layers = gpt.encoder_stack_size();
+  std::string res = upload_layers(
+      num_layers, sizes, names,
+      [&](int layer_id) {
+        const GptEncoderLayer &layer = gpt.encoder_stack(layer_id);
+        return std::vector<const google::protobuf::RepeatedField<float> *>{
+            &layer.multihead_norm_scale(),
+            &layer.multihead_norm_bias(),
+            &layer.multihead_project_kernel_qkv(),
+            &layer.multihead_project_bias_qkv(),
+            &layer.multihead_project_kernel_output(),
+            &layer.multihead_project_bias_output(),
+            &layer.ffn_norm_scale(),
+            &layer.ffn_norm_bias(),
+            &layer.ffn_first_kernel(),
+            &layer.ffn_first_bias(),
+            &layer.ffn_second_kernel(),
+            &layer.ffn_second_bias()};
+      },
+      &_d_enc_wei);
+  if (!res.empty()) return res;
+
+  for (int e : layer_offsets(num_layers, sizes))
     _p_d_enc_wei.push_back(thrust::raw_pointer_cast(_d_enc_wei.data()) + e);
   std::cout << "finish initializing enc_wei from host to device" << std::endl;
   return "";
@@ -333,10 +287,7 @@ void GptWeight<OpType_>::hdf5_parse_emb_wei(hid_t hdf5_file) {
       "Wrong norm_bias_size !");
   idx += _hidden_size;
 
-  std::vector<_DataType> raw_value;
-  raw_value.reserve(value.size());
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_src_emb_wei = raw_value;
+  upload_weights(value, &_d_src_emb_wei);
   for (int e : offset)
     _p_d_src_emb_wei.push_back(thrust::raw_pointer_cast(_d_src_emb_wei.data()) +
                                e);
@@ -456,9 +407,7 @@ void GptWeight<OpType_>::hdf5_parse_enc_wei(hid_t hdf5_file) {
     idx += _hidden_size;
   }  // for
 
-  std::vector<_DataType> raw_value;
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_enc_wei = raw_value;
+  upload_weights(value, &_d_enc_wei);
 
   for (int e : offset)
     _p_d_enc_wei.push_back(thrust::raw_pointer_cast(_d_enc_wei.data()) + e);
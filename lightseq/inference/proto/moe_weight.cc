@@ -1,6 +1,9 @@
 #include "moe_weight.h"
 
 #include <fstream>
+
+#include "../tools/weight_upload.h"
+
 /**
 @file
 Load the model weights which stored in custom proto file into GPU memory.
@@ -140,9 +143,7 @@ std::string MoeWeight<OpType_>::proto_parse_emb_wei(
   idx += _hidden_size;
 
   if (source == "src") {
-    std::vector<_DataType> raw_value;
-    for (float e : value) raw_value.push_back(float2required(e));
-    _d_src_emb_wei = raw_value;
+    upload_weights(value, &_d_src_emb_wei);
     for (int e : offset)
       _p_d_src_emb_wei.push_back(
           thrust::raw_pointer_cast(_d_src_emb_wei.data()) + e);
@@ -171,9 +172,7 @@ std::string MoeWeight<OpType_>::proto_parse_emb_wei(
     for (float ele : layer.shared_bias()) value.push_back(ele);
     idx += vocab_size;
 
-    std::vector<_DataType> raw_value;
-    for (float e : value) raw_value.push_back(float2required(e));
-    _d_trg_emb_wei = raw_value;
+    upload_weights(value, &_d_trg_emb_wei);
     for (int e : offset) {
       _p_d_trg_emb_wei.push_back(
           thrust::raw_pointer_cast(_d_trg_emb_wei.data()) + e);
@@ -336,17 +335,13 @@ std::string MoeWeight<OpType_>::proto_parse_enc_wei(const Moe &moe) {
     }
   }  // for
 
-  std::vector<_DataType> raw_value;
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_enc_wei = raw_value;
+  upload_weights(value, &_d_enc_wei);
 
   for (int e : offset)
     _p_d_enc_wei.push_back(thrust::raw_pointer_cast(_d_enc_wei.data()) + e);
 
   if (_n_moelayer_encoder) {
-    std::vector<_DataType> raw_value_gate;
-    for (float e : value_gate) raw_value_gate.push_back(float2required(e));
-    _d_enc_gate_wei = raw_value_gate;
+    upload_weights(value_gate, &_d_enc_gate_wei);
 
     for (int e : offset_gate)
       _p_d_enc_gate_wei.push_back(
@@ -523,17 +518,13 @@ std::string MoeWeight<OpType_>::proto_parse_dec_wei(const Moe &moe) {
     }
   }  // for
 
-  std::vector<_DataType> raw_value;
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_dec_wei = raw_value;
+  upload_weights(value, &_d_dec_wei);
 
   for (int e : offset)
     _p_d_dec_wei.push_back(thrust::raw_pointer_cast(_d_dec_wei.data()) + e);
 
   if (_n_moelayer_decoder) {
-    std::vector<_DataType> raw_value_gate;
-    for (float e : value_gate) raw_value_gate.push_back(float2required(e));
-    _d_dec_gate_wei = raw_value_gate;
+    upload_weights(value_gate, &_d_dec_gate_wei);
 
     for (int e : offset_gate)
       _p_d_dec_gate_wei.push_back(
@@ -740,10 +731,7 @@ void MoeWeight<OpType_>::hdf5_parse_emb_wei(hid_t hdf5_file,
   idx += _hidden_size;
 
   if (source == "src") {
-    std::vector<_DataType> raw_value;
-    raw_value.reserve(value.size());
-    for (float e : value) raw_value.push_back(float2required(e));
-    _d_src_emb_wei = raw_value;
+    upload_weights(value, &_d_src_emb_wei);
     for (int e : offset)
       _p_d_src_emb_wei.push_back(
           thrust::raw_pointer_cast(_d_src_emb_wei.data()) + e);
@@ -775,10 +763,7 @@ void MoeWeight<OpType_>::hdf5_parse_emb_wei(hid_t hdf5_file,
         "Wrong shared_bias_size !");
     idx += vocab_size;
 
-    std::vector<_DataType> raw_value;
-    raw_value.reserve(value.size());
-    for (float e : value) raw_value.push_back(float2required(e));
-    _d_trg_emb_wei = raw_value;
+    upload_weights(value, &_d_trg_emb_wei);
     for (int e : offset) {
       _p_d_trg_emb_wei.push_back(
           thrust::raw_pointer_cast(_d_trg_emb_wei.data()) + e);
@@ -970,19 +955,13 @@ void MoeWeight<OpType_>::hdf5_parse_enc_wei(hid_t hdf5_file) {
     }
   }
 
-  std::vector<_DataType> raw_value;
-  raw_value.reserve(value.size());
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_enc_wei = raw_value;
+  upload_weights(value, &_d_enc_wei);
 
   for (int e : offset)
     _p_d_enc_wei.push_back(thrust::raw_pointer_cast(_d_enc_wei.data()) + e);
 
   if (_n_moelayer_encoder) {
-    std::vector<_DataType> raw_value_gate;
-    raw_value_gate.reserve(value_gate.size());
-    for (float e : value_gate) raw_value_gate.push_back(float2required(e));
-    _d_enc_gate_wei = raw_value_gate;
+    upload_weights(value_gate, &_d_enc_gate_wei);
 
     for (int e : offset_gate)
       _p_d_enc_gate_wei.push_back(
@@ -1197,19 +1176,13 @@ void MoeWeight<OpType_>::hdf5_parse_dec_wei(hid_t hdf5_file) {
     }
   }
 
-  std::vector<_DataType> raw_value;
-  raw_value.reserve(value.size());
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_dec_wei = raw_value;
+  upload_weights(value, &_d_dec_wei);
 
   for (int e : offset)
     _p_d_dec_wei.push_back(thrust::raw_pointer_cast(_d_dec_wei.data()) + e);
 
   if (_n_moelayer_decoder) {
-    std::vector<_DataType> raw_value_gate;
-    raw_value_gate.reserve(value_gate.size());
-    for (float e : value_gate) raw_value_gate.push_back(float2required(e));
-    _d_dec_gate_wei = raw_value_gate;
+    upload_weights(value_gate, &_d_dec_gate_wei);
 
     for (int e : offset_gate)
       _p_d_dec_gate_wei.push_back(
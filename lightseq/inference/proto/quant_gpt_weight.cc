@@ -2,6 +2,9 @@
 
 #include <fstream>
 
+#include "../tools/quant_weight.h"
+#include "../tools/weight_upload.h"
+
 /**
 @file
 Load the model weights which stored in custom proto file into GPU memory.
@@ -73,12 +76,11 @@ std::string QuantGptWeight<OpType_>::proto_parse_emb_wei(
   std::vector<float> value;
   int idx = 0;
 
-  offset.push_back(idx);
+  offset.push_back(-1);
   if (layer.token_embedding().size() != _src_vocab_size * _hidden_size)
     return "wrong token_embedding_size !";
-  for (unsigned char ele : layer.token_embedding())
-    value.push_back(dequantize(ele, _quant_range, layer.emb_clip_max()));
-  idx += _src_vocab_size * _hidden_size;
+  std::vector<int8_t> value_i8;
+  append_int8_weight(layer.token_embedding(), &value_i8);
   _src_emb_clip_max = layer.emb_clip_max();
   _output_ln_clip_max = layer.output_ln_clip_max();
   _logits_clip_max = layer.logits_clip_max();
@@ -99,10 +101,11 @@ std::string QuantGptWeight<OpType_>::proto_parse_emb_wei(
   for (float ele : layer.norm_bias()) value.push_back(ele);
   idx += _hidden_size;
 
-  std::vector<_DataType> raw_value;
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_src_emb_wei = raw_value;
-  for (int e : offset) _p_d_src_emb_wei.push_back(_d_src_emb_wei.data() + e);
+  upload_weights(value, &_d_src_emb_wei);
+  _i8_src_emb_wei = std::move(value_i8);
+  for (int e : offset)
+    _p_d_src_emb_wei.push_back(e < 0 ? nullptr : _d_src_emb_wei.data() + e);
+  _p_i8_src_emb_wei.push_back(_i8_src_emb_wei.data());
 
   std::cout << "finish initializing emb_wei from host to device" << std::endl;
   return "";
@@ -115,6 +118,8 @@ template <OperationType OpType_>
 std::string QuantGptWeight<OpType_>::proto_parse_enc_wei(const QuantGpt &gpt) {
   std::vector<int> offset;
   std::vector<float> value;
+  std::vector<int> offset_i8;
+  std::vector<int8_t> value_i8;
   int idx = 0;
 
   for (auto enc_layer : gpt.encoder_stack()) {
@@ -130,15 +135,12 @@ std::string QuantGptWeight<OpType_>::proto_parse_enc_wei(const QuantGpt &gpt) {
     for (float ele : enc_layer.multihead_norm_bias()) value.push_back(ele);
     idx += _hidden_size;
 
-    offset.push_back(idx);
+    offset.push_back(-1);
     if (enc_layer.multihead_project_kernel_qkv().size() !=
         _hidden_size * _hidden_size * 3)
       return "wrong multihead_project_kernel_qkv_size !";
-    for (unsigned char ele : enc_layer.multihead_project_kernel_qkv())
-      value.push_back(
-          dequantize(ele, _quant_range,
-                     enc_layer.multihead_project_kernel_qkv_clip_max()));
-    idx += _hidden_size * _hidden_size * 3;
+    offset_i8.push_back(append_int8_weight(
+        enc_layer.multihead_project_kernel_qkv(), &value_i8));
 
     offset.push_back(idx);
     if (enc_layer.multihead_project_bias_qkv_size() != _hidden_size * 3)
@@ -147,15 +149,12 @@ std::string QuantGptWeight<OpType_>::proto_parse_enc_wei(const QuantGpt &gpt) {
       value.push_back(ele);
     idx += _hidden_size * 3;
 
-    offset.push_back(idx);
+    offset.push_back(-1);
     if (enc_layer.multihead_project_kernel_output().size() !=
         _hidden_size * _hidden_size)
       return "wrong multihead_project_kernel_output_size !";
-    for (unsigned char ele : enc_layer.multihead_project_kernel_output())
-      value.push_back(
-          dequantize(ele, _quant_range,
-                     enc_layer.multihead_project_kernel_output_clip_max()));
-    idx += _hidden_size * _hidden_size;
+    offset_i8.push_back(append_int8_weight(
+        enc_layer.multihead_project_kernel_output(), &value_i8));
 
     offset.push_back(idx);
     if (enc_layer.multihead_project_bias_output_size() != _hidden_size)
@@ -176,13 +175,11 @@ std::string QuantGptWeight<OpType_>::proto_parse_enc_wei(const QuantGpt &gpt) {
     for (float ele : enc_layer.ffn_norm_bias()) value.push_back(ele);
     idx += _hidden_size;
 
-    offset.push_back(idx);
+    offset.push_back(-1);
     if (enc_layer.ffn_first_kernel().size() != _hidden_size * _inner_size)
       return "wrong ffn_first_kernel_size !";
-    for (unsigned char ele : enc_layer.ffn_first_kernel())
-      value.push_back(
-          dequantize(ele, _quant_range, enc_layer.ffn_first_kernel_clip_max()));
-    idx += _hidden_size * _inner_size;
+    offset_i8.push_back(
+        append_int8_weight(enc_layer.ffn_first_kernel(), &value_i8));
 
     offset.push_back(idx);
     if (enc_layer.ffn_first_bias_size() != _inner_size)
@@ -190,13 +187,11 @@ std::string QuantGptWeight<OpType_>::proto_parse_enc_wei(const QuantGpt &gpt) {
     for (float ele : enc_layer.ffn_first_bias()) value.push_back(ele);
     idx += _inner_size;
 
-    offset.push_back(idx);
+    offset.push_back(-1);
     if (enc_layer.ffn_second_kernel().size() != _hidden_size * _inner_size)
       return "wrong ffn_second_kernel_size !";
-    for (unsigned char ele : enc_layer.ffn_second_kernel())
-      value.push_back(dequantize(ele, _quant_range,
-                                 enc_layer.ffn_second_kernel_clip_max()));
-    idx += _hidden_size * _inner_size;
+    offset_i8.push_back(
+        append_int8_weight(enc_layer.ffn_second_kernel(), &value_i8));
 
     offset.push_back(idx);
     if (enc_layer.ffn_second_bias_size() != _hidden_size)
@@ -220,11 +215,13 @@ std::string QuantGptWeight<OpType_>::proto_parse_enc_wei(const QuantGpt &gpt) {
 
   }  // for
 
-  std::vector<_DataType> raw_value;
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_enc_wei = raw_value;
+  upload_weights(value, &_d_enc_wei);
+  _i8_enc_wei = std::move(value_i8);
 
-  for (int e : offset) _p_d_enc_wei.push_back(_d_enc_wei.data() + e);
+  // the kernels are kept in int8, see get_int8_enc_wei
+  for (int e : offset)
+    _p_d_enc_wei.push_back(e < 0 ? nullptr : _d_enc_wei.data() + e);
+  for (int e : offset_i8) _p_i8_enc_wei.push_back(_i8_enc_wei.data() + e);
   std::cout << "finish initializing enc_wei from host to device" << std::endl;
   return "";
 }
@@ -303,32 +300,29 @@ Load the weights of embedding layer into GPU memory.
 template <OperationType OpType_>
 void QuantGptWeight<OpType_>::hdf5_parse_emb_wei(hid_t hdf5_file) {
   std::string dataset_prefix = "src_embedding";
-  size_t value_size = _src_vocab_size * _hidden_size +
-                      _max_step * _hidden_size + _hidden_size * 2;
+  size_t value_size = _max_step * _hidden_size + 2 * _hidden_size;
 
   std::vector<int> offset;
   std::vector<float> value(value_size);  // preallocate vector for performance
-  std::vector<unsigned char> value_i8(value_size);
-  std::cout << "loading " << value_size * sizeof(OpType_) / (1024 * 1024)
+  // the token embedding is read in int8, see get_int8_src_emb_wei
+  std::vector<unsigned char> token_u8(_src_vocab_size * _hidden_size);
+  std::cout << "loading "
+            << (value_size * sizeof(OpType_) + token_u8.size()) / (1024 * 1024)
             << " MB of embedding weight." << std::endl;
   int idx = 0;
 
-  offset.push_back(idx);
+  offset.push_back(-1);
   read_hdf5_dataset_data(
       hdf5_file, dataset_prefix + "/token_embedding", H5T_NATIVE_UCHAR,
-      value_i8.data() + idx,
+      token_u8.data(),
       [=](int size) { return size != _src_vocab_size * _hidden_size; },
       "Wrong token_embedding_size !");
   read_hdf5_dataset_scalar(hdf5_file, dataset_prefix + "/emb_clip_max",
                            H5T_NATIVE_FLOAT, &_src_emb_clip_max);
-  dequantize_array(value_i8, value, _src_emb_clip_max, _quant_range, idx,
-                   _src_vocab_size * _hidden_size);
   read_hdf5_dataset_scalar(hdf5_file, dataset_prefix + "/output_ln_clip_max",
                            H5T_NATIVE_FLOAT, &_output_ln_clip_max);
   read_hdf5_dataset_scalar(hdf5_file, dataset_prefix + "/logits_clip_max",
                            H5T_NATIVE_FLOAT, &_logits_clip_max);
-  idx += _src_vocab_size * _hidden_size;
-
   offset.push_back(idx);
   read_hdf5_dataset_data(
       hdf5_file, dataset_prefix + "/position_embedding", H5T_NATIVE_FLOAT,
@@ -351,11 +345,12 @@ void QuantGptWeight<OpType_>::hdf5_parse_emb_wei(hid_t hdf5_file) {
       "Wrong norm_bias_size !");
   idx += _hidden_size;
 
-  std::vector<_DataType> raw_value;
-  raw_value.reserve(value.size());
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_src_emb_wei = raw_value;
-  for (int e : offset) _p_d_src_emb_wei.push_back(_d_src_emb_wei.data() + e);
+  upload_weights(value, &_d_src_emb_wei);
+  _i8_src_emb_wei.resize(token_u8.size());
+  uint8_to_int8(token_u8.data(), _i8_src_emb_wei.data(), token_u8.size());
+  for (int e : offset)
+    _p_d_src_emb_wei.push_back(e < 0 ? nullptr : _d_src_emb_wei.data() + e);
+  _p_i8_src_emb_wei.push_back(_i8_src_emb_wei.data());
 
   std::cout << "finish initializing emb_wei from host to device" << std::endl;
 }
@@ -365,20 +360,20 @@ Load the weights of encoder into GPU memory.
 */
 template <OperationType OpType_>
 void QuantGptWeight<OpType_>::hdf5_parse_enc_wei(hid_t hdf5_file) {
-  size_t value_size =
-      (_hidden_size * 2 + _hidden_size * _hidden_size * 3 + _hidden_size * 3 +
-       _hidden_size * _hidden_size + _hidden_size * 3 +
-       _hidden_size * _inner_size + _inner_size + _hidden_size * _inner_size +
-       _hidden_size) *
+  // the kernels are read in int8, see get_int8_enc_wei
+  size_t value_size = (_hidden_size * 9 + _inner_size) * _n_enc_layer;
+  size_t value_size_i8 =
+      (_hidden_size * _hidden_size * 4 + _hidden_size * _inner_size * 2) *
       _n_enc_layer;
-  std::vector<int> offset;
+  std::vector<int> offset, offset_i8;
   std::vector<float> value(value_size);
-  std::vector<unsigned char> value_i8(value_size);
-  std::cout << "loading " << value_size * sizeof(OpType_) / (1024 * 1024)
+  std::vector<unsigned char> value_u8(value_size_i8);
+  std::cout << "loading "
+            << (value_size * sizeof(OpType_) + value_size_i8) / (1024 * 1024)
             << " MB of encoder weight." << std::endl;
 
   float clip_max;
-  int idx = 0;
+  int idx = 0, idx_i8 = 0;
   for (int layer_id = 0; layer_id < _n_enc_layer; ++layer_id) {
     std::string dataset_prefix = "encoder_stack/" + std::to_string(layer_id);
 
@@ -396,19 +391,18 @@ void QuantGptWeight<OpType_>::hdf5_parse_enc_wei(hid_t hdf5_file) {
         "Wrong multihead_norm_bias_size !");
     idx += _hidden_size;
 
-    offset.push_back(idx);
+    offset.push_back(-1);
+    offset_i8.push_back(idx_i8);
     read_hdf5_dataset_data(
         hdf5_file, dataset_prefix + "/multihead_project_kernel_qkv",
-        H5T_NATIVE_UCHAR, value_i8.data() + idx,
+        H5T_NATIVE_UCHAR, value_u8.data() + idx_i8,
         [=](int size) { return size != _hidden_size * _hidden_size * 3; },
         "Wrong multihead_project_kernel_qkv_size !");
     read_hdf5_dataset_scalar(
         hdf5_file, dataset_prefix + "/multihead_project_kernel_qkv_clip_max",
         H5T_NATIVE_FLOAT, &clip_max);
-    dequantize_array(value_i8, value, clip_max, _quant_range, idx,
-                     _hidden_size * _hidden_size * 3);
     _enc_clip_max.push_back(clip_max);
-    idx += _hidden_size * _hidden_size * 3;
+    idx_i8 += _hidden_size * _hidden_size * 3;
 
     offset.push_back(idx);
     read_hdf5_dataset_data(
@@ -418,19 +412,18 @@ void QuantGptWeight<OpType_>::hdf5_parse_enc_wei(hid_t hdf5_file) {
         "Wrong multihead_project_bias_qkv_size !");
     idx += _hidden_size * 3;
 
-    offset.push_back(idx);
+    offset.push_back(-1);
+    offset_i8.push_back(idx_i8);
     read_hdf5_dataset_data(
         hdf5_file, dataset_prefix + "/multihead_project_kernel_output",
-        H5T_NATIVE_UCHAR, value_i8.data() + idx,
+        H5T_NATIVE_UCHAR, value_u8.data() + idx_i8,
         [=](int size) { return size != _hidden_size * _hidden_size; },
         "Wrong multihead_project_kernel_output_size !");
     read_hdf5_dataset_scalar(
         hdf5_file, dataset_prefix + "/multihead_project_kernel_output_clip_max",
         H5T_NATIVE_FLOAT, &clip_max);
-    dequantize_array(value_i8, value, clip_max, _quant_range, idx,
-                     _hidden_size * _hidden_size);
     _enc_clip_max.push_back(clip_max);
-    idx += _hidden_size * _hidden_size;
+    idx_i8 += _hidden_size * _hidden_size;
 
     offset.push_back(idx);
     read_hdf5_dataset_data(
@@ -454,19 +447,18 @@ void QuantGptWeight<OpType_>::hdf5_parse_enc_wei(hid_t hdf5_file) {
         "Wrong ffn_norm_bias_size !");
     idx += _hidden_size;
 
-    offset.push_back(idx);
+    offset.push_back(-1);
+    offset_i8.push_back(idx_i8);
     read_hdf5_dataset_data(
         hdf5_file, dataset_prefix + "/ffn_first_kernel", H5T_NATIVE_UCHAR,
-        value_i8.data() + idx,
+        value_u8.data() + idx_i8,
         [=](int size) { return size != _hidden_size * _inner_size; },
         "Wrong ffn_first_kernel_size !");
     read_hdf5_dataset_scalar(hdf5_file,
                              dataset_prefix + "/ffn_first_kernel_clip_max",
                              H5T_NATIVE_FLOAT, &clip_max);
-    dequantize_array(value_i8, value, clip_max, _quant_range, idx,
-                     _hidden_size * _inner_size);
     _enc_clip_max.push_back(clip_max);
-    idx += _hidden_size * _inner_size;
+    idx_i8 += _hidden_size * _inner_size;
 
     offset.push_back(idx);
     read_hdf5_dataset_data(
@@ -475,19 +467,18 @@ void QuantGptWeight<OpType_>::hdf5_parse_enc_wei(hid_t hdf5_file) {
         "Wrong ffn_first_bias_size !");
     idx += _inner_size;
 
-    offset.push_back(idx);
+    offset.push_back(-1);
+    offset_i8.push_back(idx_i8);
     read_hdf5_dataset_data(
         hdf5_file, dataset_prefix + "/ffn_second_kernel", H5T_NATIVE_UCHAR,
-        value_i8.data() + idx,
+        value_u8.data() + idx_i8,
         [=](int size) { return size != _hidden_size * _inner_size; },
         "Wrong ffn_second_kernel_size !");
     read_hdf5_dataset_scalar(hdf5_file,
                              dataset_prefix + "/ffn_second_kernel_clip_max",
                              H5T_NATIVE_FLOAT, &clip_max);
-    dequantize_array(value_i8, value, clip_max, _quant_range, idx,
-                     _hidden_size * _inner_size);
     _enc_clip_max.push_back(clip_max);
-    idx += _hidden_size * _inner_size;
+    idx_i8 += _hidden_size * _inner_size;
 
     offset.push_back(idx);
     read_hdf5_dataset_data(
@@ -529,11 +520,14 @@ void QuantGptWeight<OpType_>::hdf5_parse_enc_wei(hid_t hdf5_file) {
     _enc_clip_max.push_back(clip_max);
   }  // for
 
-  std::vector<_DataType> raw_value;
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_enc_wei = raw_value;
+  upload_weights(value, &_d_enc_wei);
+  _i8_enc_wei.resize(value_size_i8);
+  uint8_to_int8(value_u8.data(), _i8_enc_wei.data(), value_size_i8);
 
-  for (int e : offset) _p_d_enc_wei.push_back(_d_enc_wei.data() + e);
+  // the kernels are kept in int8, see get_int8_enc_wei
+  for (int e : offset)
+    _p_d_enc_wei.push_back(e < 0 ? nullptr : _d_enc_wei.data() + e);
+  for (int e : offset_i8) _p_i8_enc_wei.push_back(_i8_enc_wei.data() + e);
   std::cout << "finish initializing enc_wei from host to device" << std::endl;
 }
 
@@ -13,6 +13,7 @@
 #include <vector>
 
 #include "quant_gpt.pb.h"
+#include "../tools/int8_weight_cache.h"
 #include "../tools/util.h"
 
 namespace lightseq {
@@ -46,6 +47,14 @@ class QuantGptWeight {
   std::vector<_DataType> _d_src_emb_wei;
   std::vector<_DataType> _d_enc_wei;
 
+  // int8 kernels, in the row major layout of the weight file, their slots
+  // in the weights pointer above are nullptr
+  std::vector<const int8_t *> _p_i8_src_emb_wei;  // size: 1
+  std::vector<const int8_t *> _p_i8_enc_wei;      // size: 4 * enc_layer_num
+  std::vector<int8_t> _i8_src_emb_wei;
+  std::vector<int8_t> _i8_enc_wei;
+  mutable uint64_t _int8_weight_hash = 0;  // see get_int8_weight_hash
+
   // store the clip_max of weights and activations
   float _src_emb_clip_max;
   float _output_ln_clip_max;
@@ -69,6 +78,27 @@ class QuantGptWeight {
     return _p_d_enc_wei;
   }
 
+  const std::vector<const int8_t *> &get_int8_src_emb_wei() const {
+    // {token_emb}
+    return _p_i8_src_emb_wei;
+  }
+
+  const std::vector<const int8_t *> &get_int8_enc_wei() const {
+    // {multihead_qkv_kernel, multihead_output_kernel, ffn_first_kernel,
+    // ffn_second_kernel} * encoder_layer_num
+    return _p_i8_enc_wei;
+  }
+
+  // hash of all the int8 kernels, keys the cache of their transformed
+  // layouts, see int8_weight_cache.h
+  uint64_t get_int8_weight_hash() const {
+    if (_int8_weight_hash != 0) return _int8_weight_hash;
+    uint64_t h = bytes_hash(_i8_src_emb_wei);
+    h = bytes_hash(_i8_enc_wei, h);
+    _int8_weight_hash = h;
+    return h;
+  }
+
   float get_src_emb_clip_max() const { return _src_emb_clip_max; }
 
   float get_output_ln_clip_max() const { return _output_ln_clip_max; }
@@ -1,6 +1,10 @@
 #include "quant_transformer_weight.h"
 
 #include <fstream>
+
+#include "../tools/quant_weight.h"
+#include "../tools/weight_upload.h"
+
 /**
 @file
 Load the model weights which stored in custom proto file into GPU memory.
@@ -100,13 +104,11 @@ std::string QuantTransformerWeight<OpType_>::proto_parse_emb_wei(
   std::vector<float> value;
   int idx = 0;
 
-  offset.push_back(idx);
-
+  offset.push_back(-1);
   if (layer.token_embedding().size() != vocab_size * _hidden_size)
     return "Wrong token_embedding_size !";
-  for (unsigned char ele : layer.token_embedding())
-    value.push_back(dequantize(ele, _quant_range, layer.emb_clip_max()));
-  idx += vocab_size * _hidden_size;
+  std::vector<int8_t> value_i8;
+  append_int8_weight(layer.token_embedding(), &value_i8);
 
   if (source == "src")
     _src_emb_clip_max = layer.emb_clip_max();
@@ -133,10 +135,11 @@ std::string QuantTransformerWeight<OpType_>::proto_parse_emb_wei(
   idx += _hidden_size;
 
   if (source == "src") {
-    std::vector<_DataType> raw_value;
-    for (float e : value) raw_value.push_back(float2required(e));
-    _d_src_emb_wei = raw_value;
-    for (int e : offset) _p_d_src_emb_wei.push_back(_d_src_emb_wei.data() + e);
+    upload_weights(value, &_d_src_emb_wei);
+    _i8_src_emb_wei = std::move(value_i8);
+    for (int e : offset)
+      _p_d_src_emb_wei.push_back(e < 0 ? nullptr : _d_src_emb_wei.data() + e);
+    _p_i8_src_emb_wei.push_back(_i8_src_emb_wei.data());
   } else {
     // for trg, encdec_kv_kernel, encdec_kv_bias, logit_bias
 
@@ -176,12 +179,11 @@ std::string QuantTransformerWeight<OpType_>::proto_parse_emb_wei(
     for (float ele : layer.shared_bias()) value.push_back(ele);
     idx += vocab_size;
 
-    std::vector<_DataType> raw_value;
-    for (float e : value) raw_value.push_back(float2required(e));
-    _d_trg_emb_wei = raw_value;
-    for (int e : offset) {
-      _p_d_trg_emb_wei.push_back(_d_trg_emb_wei.data() + e);
-    }
+    upload_weights(value, &_d_trg_emb_wei);
+    _i8_trg_emb_wei = std::move(value_i8);
+    for (int e : offset)
+      _p_d_trg_emb_wei.push_back(e < 0 ? nullptr : _d_trg_emb_wei.data() + e);
+    _p_i8_trg_emb_wei.push_back(_i8_trg_emb_wei.data());
   }  // trg
 
   if (_multilg_type != 0) {
@@ -216,6 +218,8 @@ std::string QuantTransformerWeight<OpType_>::proto_parse_enc_wei(
     const QuantTransformer &transformer) {
   std::vector<int> offset;
   std::vector<float> value;
+  std::vector<int> offset_i8;
+  std::vector<int8_t> value_i8;
   int idx = 0;
 
   for (auto enc_layer : transformer.encoder_stack()) {
@@ -231,17 +235,12 @@ std::string QuantTransformerWeight<OpType_>::proto_parse_enc_wei(
     for (float ele : enc_layer.multihead_norm_bias()) value.push_back(ele);
     idx += _hidden_size;
 
-    offset.push_back(idx);
-
+    offset.push_back(-1);
     if (enc_layer.multihead_project_kernel_qkv().size() !=
         _hidden_size * _hidden_size * 3)
       return "Wrong multihead_project_kernel_qkv_size !";
-    for (unsigned char ele : enc_layer.multihead_project_kernel_qkv())
-      value.push_back(
-          dequantize(ele, _quant_range,
-                     enc_layer.multihead_project_kernel_qkv_clip_max()));
-
-    idx += _hidden_size * _hidden_size * 3;
+    offset_i8.push_back(append_int8_weight(
+        enc_layer.multihead_project_kernel_qkv(), &value_i8));
 
     offset.push_back(idx);
     if (enc_layer.multihead_project_bias_qkv_size() != _hidden_size * 3)
@@ -250,17 +249,12 @@ std::string QuantTransformerWeight<OpType_>::proto_parse_enc_wei(
       value.push_back(ele);
     idx += _hidden_size * 3;
 
-    offset.push_back(idx);
-
+    offset.push_back(-1);
     if (enc_layer.multihead_project_kernel_output().size() !=
         _hidden_size * _hidden_size)
       return "Wrong multihead_project_kernel_output_size !";
-    for (unsigned char ele : enc_layer.multihead_project_kernel_output())
-      value.push_back(
-          dequantize(ele, _quant_range,
-                     enc_layer.multihead_project_kernel_output_clip_max()));
-
-    idx += _hidden_size * _hidden_size;
+    offset_i8.push_back(append_int8_weight(
+        enc_layer.multihead_project_kernel_output(), &value_i8));
 
     offset.push_back(idx);
     if (enc_layer.multihead_project_bias_output_size() != _hidden_size)
@@ -281,15 +275,11 @@ std::string QuantTransformerWeight<OpType_>::proto_parse_enc_wei(
     for (float ele : enc_layer.ffn_norm_bias()) value.push_back(ele);
     idx += _hidden_size;
 
-    offset.push_back(idx);
-
+    offset.push_back(-1);
     if (enc_layer.ffn_first_kernel().size() != _hidden_size * _inner_size)
       return "Wrong ffn_first_kernel_size !";
-    for (unsigned char ele : enc_layer.ffn_first_kernel())
-      value.push_back(
-          dequantize(ele, _quant_range, enc_layer.ffn_first_kernel_clip_max()));
-
-    idx += _hidden_size * _inner_size;
+    offset_i8.push_back(
+        append_int8_weight(enc_layer.ffn_first_kernel(), &value_i8));
 
     offset.push_back(idx);
     if (enc_layer.ffn_first_bias_size() != _inner_size)
@@ -297,15 +287,11 @@ std::string QuantTransformerWeight<OpType_>::proto_parse_enc_wei(
     for (float ele : enc_layer.ffn_first_bias()) value.push_back(ele);
     idx += _inner_size;
 
-    offset.push_back(idx);
-
+    offset.push_back(-1);
     if (enc_layer.ffn_second_kernel().size() != _hidden_size * _inner_size)
       return "Wrong ffn_second_kernel_size !";
-    for (unsigned char ele : enc_layer.ffn_second_kernel())
-      value.push_back(dequantize(ele, _quant_range,
-                                 enc_layer.ffn_second_kernel_clip_max()));
-
-    idx += _hidden_size * _inner_size;
+    offset_i8.push_back(
+        append_int8_weight(enc_layer.ffn_second_kernel(), &value_i8));
 
     offset.push_back(idx);
     if (enc_layer.ffn_second_bias_size() != _hidden_size)
@@ -329,11 +315,13 @@ std::string QuantTransformerWeight<OpType_>::proto_parse_enc_wei(
 
   }  // for
 
-  std::vector<_DataType> raw_value;
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_enc_wei = raw_value;
+  upload_weights(value, &_d_enc_wei);
+  _i8_enc_wei = std::move(value_i8);
 
-  for (int e : offset) _p_d_enc_wei.push_back((_d_enc_wei.data()) + e);
+  // the kernels are kept in int8, see get_int8_enc_wei
+  for (int e : offset)
+    _p_d_enc_wei.push_back(e < 0 ? nullptr : _d_enc_wei.data() + e);
+  for (int e : offset_i8) _p_i8_enc_wei.push_back(_i8_enc_wei.data() + e);
   std::cout << "Finish loading enc_wei from host to device" << std::endl;
   return "";
 }
@@ -346,6 +334,8 @@ std::string QuantTransformerWeight<OpType_>::proto_parse_dec_wei(
     const QuantTransformer &transformer) {
   std::vector<int> offset;
   std::vector<float> value;
+  std::vector<int> offset_i8;
+  std::vector<int8_t> value_i8;
   int idx = 0;
 
   for (auto dec_layer : transformer.decoder_stack()) {
@@ -361,16 +351,12 @@ std::string QuantTransformerWeight<OpType_>::proto_parse_dec_wei(
     for (float ele : dec_layer.self_norm_bias()) value.push_back(ele);
     idx += _hidden_size;
 
-    offset.push_back(idx);
-
+    offset.push_back(-1);
     if (dec_layer.self_project_kernel_qkv().size() !=
         _hidden_size * _hidden_size * 3)
       return "Wrong self_project_kernel_qkv size !";
-    for (unsigned char ele : dec_layer.self_project_kernel_qkv())
-      value.push_back(dequantize(ele, _quant_range,
-                                 dec_layer.self_project_kernel_qkv_clip_max()));
-
-    idx += _hidden_size * _hidden_size * 3;
+    offset_i8.push_back(
+        append_int8_weight(dec_layer.self_project_kernel_qkv(), &value_i8));
 
     offset.push_back(idx);
     if (dec_layer.self_project_bias_qkv_size() != _hidden_size * 3)
@@ -378,16 +364,12 @@ std::string QuantTransformerWeight<OpType_>::proto_parse_dec_wei(
     for (float ele : dec_layer.self_project_bias_qkv()) value.push_back(ele);
     idx += _hidden_size * 3;
 
-    offset.push_back(idx);
-
+    offset.push_back(-1);
     if (dec_layer.self_project_kernel_output().size() !=
         _hidden_size * _hidden_size)
       return "Wrong self_project_kernel_output size !";
-    for (unsigned char ele : dec_layer.self_project_kernel_output())
-      value.push_back(dequantize(
-          ele, _quant_range, dec_layer.self_project_kernel_output_clip_max()));
-
-    idx += _hidden_size * _hidden_size;
+    offset_i8.push_back(
+        append_int8_weight(dec_layer.self_project_kernel_output(), &value_i8));
 
     offset.push_back(idx);
     if (dec_layer.self_project_bias_output_size() != _hidden_size)
@@ -407,16 +389,12 @@ std::string QuantTransformerWeight<OpType_>::proto_parse_dec_wei(
     for (float ele : dec_layer.encdec_norm_bias()) value.push_back(ele);
     idx += _hidden_size;
 
-    offset.push_back(idx);
-
+    offset.push_back(-1);
     if (dec_layer.encdec_project_kernel_q().size() !=
         _hidden_size * _hidden_size)
       return "Wrong encdec_project_kernel_q size !";
-    for (unsigned char ele : dec_layer.encdec_project_kernel_q())
-      value.push_back(dequantize(ele, _quant_range,
-                                 dec_layer.encdec_project_kernel_q_clip_max()));
-
-    idx += _hidden_size * _hidden_size;
+    offset_i8.push_back(
+        append_int8_weight(dec_layer.encdec_project_kernel_q(), &value_i8));
 
     offset.push_back(idx);
     if (dec_layer.encdec_project_bias_q_size() != _hidden_size)
@@ -424,17 +402,12 @@ std::string QuantTransformerWeight<OpType_>::proto_parse_dec_wei(
     for (float ele : dec_layer.encdec_project_bias_q()) value.push_back(ele);
     idx += _hidden_size;
 
-    offset.push_back(idx);
-
+    offset.push_back(-1);
     if (dec_layer.encdec_project_kernel_output().size() !=
         _hidden_size * _hidden_size)
       return "Wrong encdec_project_kernel_output size !";
-    for (unsigned char ele : dec_layer.encdec_project_kernel_output())
-      value.push_back(
-          dequantize(ele, _quant_range,
-                     dec_layer.encdec_project_kernel_output_clip_max()));
-
-    idx += _hidden_size * _hidden_size;
+    offset_i8.push_back(append_int8_weight(
+        dec_layer.encdec_project_kernel_output(), &value_i8));
 
     offset.push_back(idx);
     if (dec_layer.encdec_project_bias_output_size() != _hidden_size)
@@ -455,15 +428,11 @@ std::string QuantTransformerWeight<OpType_>::proto_parse_dec_wei(
     for (float ele : dec_layer.ffn_norm_bias()) value.push_back(ele);
     idx += _hidden_size;
 
-    offset.push_back(idx);
-
+    offset.push_back(-1);
     if (dec_layer.ffn_first_kernel().size() != _hidden_size * _inner_size)
       return "Wrong ffn_first_kernel_size !";
-    for (unsigned char ele : dec_layer.ffn_first_kernel())
-      value.push_back(
-          dequantize(ele, _quant_range, dec_layer.ffn_first_kernel_clip_max()));
-
-    idx += _hidden_size * _inner_size;
+    offset_i8.push_back(
+        append_int8_weight(dec_layer.ffn_first_kernel(), &value_i8));
 
     offset.push_back(idx);
     if (dec_layer.ffn_first_bias_size() != _inner_size)
@@ -471,15 +440,11 @@ std::string QuantTransformerWeight<OpType_>::proto_parse_dec_wei(
     for (float ele : dec_layer.ffn_first_bias()) value.push_back(ele);
     idx += _inner_size;
 
-    offset.push_back(idx);
-
+    offset.push_back(-1);
     if (dec_layer.ffn_second_kernel().size() != _hidden_size * _inner_size)
       return "Wrong ffn_second_kernel_size !";
-    for (unsigned char ele : dec_layer.ffn_second_kernel())
-      value.push_back(dequantize(ele, _quant_range,
-                                 dec_layer.ffn_second_kernel_clip_max()));
-
-    idx += _hidden_size * _inner_size;
+    offset_i8.push_back(
+        append_int8_weight(dec_layer.ffn_second_kernel(), &value_i8));
 
     offset.push_back(idx);
     if (dec_layer.ffn_second_bias_size() != _hidden_size)
@@ -509,11 +474,13 @@ std::string QuantTransformerWeight<OpType_>::proto_parse_dec_wei(
 
   }  // for
 
-  std::vector<_DataType> raw_value;
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_dec_wei = raw_value;
+  upload_weights(value, &_d_dec_wei);
+  _i8_dec_wei = std::move(value_i8);
 
-  for (int e : offset) _p_d_dec_wei.push_back(_d_dec_wei.data() + e);
+  // the kernels are kept in int8, see get_int8_dec_wei
+  for (int e : offset)
+    _p_d_dec_wei.push_back(e < 0 ? nullptr : _d_dec_wei.data() + e);
+  for (int e : offset_i8) _p_i8_dec_wei.push_back(_i8_dec_wei.data() + e);
   std::cout << "Finish loading dec_wei from host to device" << std::endl;
   return "";
 }
@@ -636,8 +603,7 @@ void QuantTransformerWeight<OpType_>::hdf5_parse_emb_wei(hid_t hdf5_file,
 
   std::string dataset_prefix =
       (source == "src") ? "src_embedding" : "trg_embedding";
-  size_t value_size =
-      vocab_size * _hidden_size + _max_step * _hidden_size + 2 * _hidden_size;
+  size_t value_size = _max_step * _hidden_size + 2 * _hidden_size;
   if (source != "src") {
     value_size += _hidden_size * _hidden_size * 2 * _n_dec_layer +
                   _hidden_size * 2 * _n_dec_layer + vocab_size;
@@ -646,21 +612,23 @@ void QuantTransformerWeight<OpType_>::hdf5_parse_emb_wei(hid_t hdf5_file,
   std::vector<int> offset;
   std::vector<float> value(value_size);  // preallocate vector for performance
   std::vector<unsigned char> value_i8(value_size);
-  std::cout << "loading " << value_size * sizeof(OpType_) / (1024 * 1024)
+  // the token embedding is read in int8, see get_int8_src_emb_wei and
+  // get_int8_trg_emb_wei
+  std::vector<unsigned char> token_u8(vocab_size * _hidden_size);
+  std::cout << "loading "
+            << (value_size * sizeof(OpType_) + token_u8.size()) / (1024 * 1024)
             << " MB of embedding weight." << std::endl;
   int idx = 0;
   float clip_max;
 
-  offset.push_back(idx);
+  offset.push_back(-1);
   read_hdf5_dataset_data(
       hdf5_file, dataset_prefix + "/token_embedding", H5T_NATIVE_UCHAR,
-      value_i8.data() + idx,
+      token_u8.data(),
       [=](int size) { return size != vocab_size * _hidden_size; },
       "Wrong token_embedding_size !");
   read_hdf5_dataset_scalar(hdf5_file, dataset_prefix + "/emb_clip_max",
                            H5T_NATIVE_FLOAT, &clip_max);
-  dequantize_array(value_i8, value, clip_max, _quant_range, idx,
-                   vocab_size * _hidden_size);
   if (source == "src")
     _src_emb_clip_max = clip_max;
   else {
@@ -671,8 +639,6 @@ void QuantTransformerWeight<OpType_>::hdf5_parse_emb_wei(hid_t hdf5_file,
                              H5T_NATIVE_FLOAT, &_logits_clip_max);
   }
 
-  idx += vocab_size * _hidden_size;
-
   offset.push_back(idx);
   read_hdf5_dataset_data(
       hdf5_file, dataset_prefix + "/position_embedding", H5T_NATIVE_FLOAT,
@@ -696,11 +662,12 @@ void QuantTransformerWeight<OpType_>::hdf5_parse_emb_wei(hid_t hdf5_file,
   idx += _hidden_size;
 
   if (source == "src") {
-    std::vector<_DataType> raw_value;
-    raw_value.reserve(value.size());
-    for (float e : value) raw_value.push_back(float2required(e));
-    _d_src_emb_wei = raw_value;
-    for (int e : offset) _p_d_src_emb_wei.push_back(_d_src_emb_wei.data() + e);
+    upload_weights(value, &_d_src_emb_wei);
+    _i8_src_emb_wei.resize(token_u8.size());
+    uint8_to_int8(token_u8.data(), _i8_src_emb_wei.data(), token_u8.size());
+    for (int e : offset)
+      _p_d_src_emb_wei.push_back(e < 0 ? nullptr : _d_src_emb_wei.data() + e);
+    _p_i8_src_emb_wei.push_back(_i8_src_emb_wei.data());
   } else {
     // for trg, encdec_kv_kernel, encdec_kv_bias, logit_bias
 
@@ -742,13 +709,12 @@ void QuantTransformerWeight<OpType_>::hdf5_parse_emb_wei(hid_t hdf5_file,
         "Wrong shared_bias_size !");
     idx += vocab_size;
 
-    std::vector<_DataType> raw_value;
-    raw_value.reserve(value.size());
-    for (float e : value) raw_value.push_back(float2required(e));
-    _d_trg_emb_wei = raw_value;
-    for (int e : offset) {
-      _p_d_trg_emb_wei.push_back(_d_trg_emb_wei.data() + e);
-    }
+    upload_weights(value, &_d_trg_emb_wei);
+    _i8_trg_emb_wei.resize(token_u8.size());
+    uint8_to_int8(token_u8.data(), _i8_trg_emb_wei.data(), token_u8.size());
+    for (int e : offset)
+      _p_d_trg_emb_wei.push_back(e < 0 ? nullptr : _d_trg_emb_wei.data() + e);
+    _p_i8_trg_emb_wei.push_back(_i8_trg_emb_wei.data());
   }  // trg
 
   if (_multilg_type) {
@@ -780,20 +746,20 @@ Load the weights of encoder into GPU memory.
 */
 template <OperationType OpType_>
 void QuantTransformerWeight<OpType_>::hdf5_parse_enc_wei(hid_t hdf5_file) {
-  size_t value_size =
-      (_hidden_size * 2 + _hidden_size * _hidden_size * 3 + _hidden_size * 3 +
-       _hidden_size * _hidden_size + _hidden_size * 3 +
-       _hidden_size * _inner_size + _inner_size + _hidden_size * _inner_size +
-       _hidden_size) *
+  // the kernels are read in int8, see get_int8_enc_wei
+  size_t value_size = (_hidden_size * 9 + _inner_size) * _n_enc_layer;
+  size_t value_size_i8 =
+      (_hidden_size * _hidden_size * 4 + _hidden_size * _inner_size * 2) *
       _n_enc_layer;
-  std::vector<int> offset;
+  std::vector<int> offset, offset_i8;
   std::vector<float> value(value_size);
-  std::vector<unsigned char> value_i8(value_size);
-  std::cout << "loading " << value_size * sizeof(OpType_) / (1024 * 1024)
+  std::vector<unsigned char> value_u8(value_size_i8);
+  std::cout << "loading "
+            << (value_size * sizeof(OpType_) + value_size_i8) / (1024 * 1024)
             << " MB of encoder weight." << std::endl;
 
   float clip_max;
-  int idx = 0;
+  int idx = 0, idx_i8 = 0;
   for (int layer_id = 0; layer_id < _n_enc_layer; ++layer_id) {
     std::string dataset_prefix = "encoder_stack/" + std::to_string(layer_id);
 
@@ -811,19 +777,18 @@ void QuantTransformerWeight<OpType_>::hdf5_parse_enc_wei(hid_t hdf5_file) {
         "Wrong multihead_norm_bias_size !");
     idx += _hidden_size;
 
-    offset.push_back(idx);
+    offset.push_back(-1);
+    offset_i8.push_back(idx_i8);
     read_hdf5_dataset_data(
         hdf5_file, dataset_prefix + "/multihead_project_kernel_qkv",
-        H5T_NATIVE_UCHAR, value_i8.data() + idx,
+        H5T_NATIVE_UCHAR, value_u8.data() + idx_i8,
         [=](int size) { return size != _hidden_size * _hidden_size * 3; },
         "Wrong multihead_project_kernel_qkv_size !");
     read_hdf5_dataset_scalar(
         hdf5_file, dataset_prefix + "/multihead_project_kernel_qkv_clip_max",
         H5T_NATIVE_FLOAT, &clip_max);
-    dequantize_array(value_i8, value, clip_max, _quant_range, idx,
-                     _hidden_size * _hidden_size * 3);
     _enc_clip_max.push_back(clip_max);
-    idx += _hidden_size * _hidden_size * 3;
+    idx_i8 += _hidden_size * _hidden_size * 3;
 
     offset.push_back(idx);
     read_hdf5_dataset_data(
@@ -833,19 +798,18 @@ void QuantTransformerWeight<OpType_>::hdf5_parse_enc_wei(hid_t hdf5_file) {
         "Wrong multihead_project_bias_qkv_size !");
     idx += _hidden_size * 3;
 
-    offset.push_back(idx);
+    offset.push_back(-1);
+    offset_i8.push_back(idx_i8);
     read_hdf5_dataset_data(
         hdf5_file, dataset_prefix + "/multihead_project_kernel_output",
-        H5T_NATIVE_UCHAR, value_i8.data() + idx,
+        H5T_NATIVE_UCHAR, value_u8.data() + idx_i8,
         [=](int size) { return size != _hidden_size * _hidden_size; },
         "Wrong multihead_project_kernel_output_size !");
     read_hdf5_dataset_scalar(
         hdf5_file, dataset_prefix + "/multihead_project_kernel_output_clip_max",
         H5T_NATIVE_FLOAT, &clip_max);
-    dequantize_array(value_i8, value, clip_max, _quant_range, idx,
-                     _hidden_size * _hidden_size);
     _enc_clip_max.push_back(clip_max);
-    idx += _hidden_size * _hidden_size;
+    idx_i8 += _hidden_size * _hidden_size;
 
     offset.push_back(idx);
     read_hdf5_dataset_data(
@@ -869,19 +833,18 @@ void QuantTransformerWeight<OpType_>::hdf5_parse_enc_wei(hid_t hdf5_file) {
         "Wrong ffn_norm_bias_size !");
     idx += _hidden_size;
 
-    offset.push_back(idx);
+    offset.push_back(-1);
+    offset_i8.push_back(idx_i8);
     read_hdf5_dataset_data(
         hdf5_file, dataset_prefix + "/ffn_first_kernel", H5T_NATIVE_UCHAR,
-        value_i8.data() + idx,
+        value_u8.data() + idx_i8,
         [=](int size) { return size != _hidden_size * _inner_size; },
         "Wrong ffn_first_kernel_size !");
     read_hdf5_dataset_scalar(hdf5_file,
                              dataset_prefix + "/ffn_first_kernel_clip_max",
                              H5T_NATIVE_FLOAT, &clip_max);
-    dequantize_array(value_i8, value, clip_max, _quant_range, idx,
-                     _hidden_size * _inner_size);
     _enc_clip_max.push_back(clip_max);
-    idx += _hidden_size * _inner_size;
+    idx_i8 += _hidden_size * _inner_size;
 
     offset.push_back(idx);
     read_hdf5_dataset_data(
@@ -890,19 +853,18 @@ void QuantTransformerWeight<OpType_>::hdf5_parse_enc_wei(hid_t hdf5_file) {
         "Wrong ffn_first_bias_size !");
     idx += _inner_size;
 
-    offset.push_back(idx);
+    offset.push_back(-1);
+    offset_i8.push_back(idx_i8);
     read_hdf5_dataset_data(
         hdf5_file, dataset_prefix + "/ffn_second_kernel", H5T_NATIVE_UCHAR,
-        value_i8.data() + idx,
+        value_u8.data() + idx_i8,
         [=](int size) { return size != _hidden_size * _inner_size; },
         "Wrong ffn_second_kernel_size !");
     read_hdf5_dataset_scalar(hdf5_file,
                              dataset_prefix + "/ffn_second_kernel_clip_max",
                              H5T_NATIVE_FLOAT, &clip_max);
-    dequantize_array(value_i8, value, clip_max, _quant_range, idx,
-                     _hidden_size * _inner_size);
     _enc_clip_max.push_back(clip_max);
-    idx += _hidden_size * _inner_size;
+    idx_i8 += _hidden_size * _inner_size;
 
     offset.push_back(idx);
     read_hdf5_dataset_data(
@@ -941,12 +903,14 @@ void QuantTransformerWeight<OpType_>::hdf5_parse_enc_wei(hid_t hdf5_file) {
     _enc_clip_max.push_back(0.0);
   }  // for
 
-  std::vector<_DataType> raw_value;
-  raw_value.reserve(value.size());
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_enc_wei = raw_value;
+  upload_weights(value, &_d_enc_wei);
+  _i8_enc_wei.resize(value_size_i8);
+  uint8_to_int8(value_u8.data(), _i8_enc_wei.data(), value_size_i8);
 
-  for (int e : offset) _p_d_enc_wei.push_back((_d_enc_wei.data()) + e);
+  // the kernels are kept in int8, see get_int8_enc_wei
+  for (int e : offset)
+    _p_d_enc_wei.push_back(e < 0 ? nullptr : _d_enc_wei.data() + e);
+  for (int e : offset_i8) _p_i8_enc_wei.push_back(_i8_enc_wei.data() + e);
   std::cout << "Finish loading enc_wei from host to device" << std::endl;
 }
 
@@ -955,20 +919,18 @@ Load the weights of decoder into GPU memory.
 */
 template <OperationType OpType_>
 void QuantTransformerWeight<OpType_>::hdf5_parse_dec_wei(hid_t hdf5_file) {
-  size_t value_size =
-      (_hidden_size * 2 + _hidden_size * _hidden_size * 3 + _hidden_size * 3 +
-       _hidden_size * _hidden_size + _hidden_size * 3 +
-       _hidden_size * _hidden_size + _hidden_size +
-       _hidden_size * _hidden_size + _hidden_size * 3 +
-       _hidden_size * _inner_size + _inner_size + _hidden_size * _inner_size +
-       _hidden_size) *
+  // the kernels are read in int8, see get_int8_dec_wei
+  size_t value_size = (_hidden_size * 13 + _inner_size) * _n_dec_layer;
+  size_t value_size_i8 =
+      (_hidden_size * _hidden_size * 6 + _hidden_size * _inner_size * 2) *
       _n_dec_layer;
-  std::vector<int> offset;
+  std::vector<int> offset, offset_i8;
   std::vector<float> value(value_size);
-  std::vector<unsigned char> value_i8(value_size);
-  std::cout << "loading " << value_size * sizeof(OpType_) / (1024 * 1024)
+  std::vector<unsigned char> value_u8(value_size_i8);
+  std::cout << "loading "
+            << (value_size * sizeof(OpType_) + value_size_i8) / (1024 * 1024)
             << " MB of decoder weight." << std::endl;
-  int idx = 0;
+  int idx = 0, idx_i8 = 0;
   float clip_max;
 
   for (int layer_id = 0; layer_id < _n_dec_layer; ++layer_id) {
@@ -988,19 +950,18 @@ void QuantTransformerWeight<OpType_>::hdf5_parse_dec_wei(hid_t hdf5_file) {
         "Wrong self_norm_bias_size !");
     idx += _hidden_size;
 
-    offset.push_back(idx);
+    offset.push_back(-1);
+    offset_i8.push_back(idx_i8);
     read_hdf5_dataset_data(
         hdf5_file, dataset_prefix + "/self_project_kernel_qkv",
-        H5T_NATIVE_UCHAR, value_i8.data() + idx,
+        H5T_NATIVE_UCHAR, value_u8.data() + idx_i8,
         [=](int size) { return size != _hidden_size * _hidden_size * 3; },
         "Wrong self_project_kernel_qkv_size !");
     read_hdf5_dataset_scalar(
         hdf5_file, dataset_prefix + "/self_project_kernel_qkv_clip_max",
         H5T_NATIVE_FLOAT, &clip_max);
-    dequantize_array(value_i8, value, clip_max, _quant_range, idx,
-                     _hidden_size * _hidden_size * 3);
     _dec_clip_max.push_back(clip_max);
-    idx += _hidden_size * _hidden_size * 3;
+    idx_i8 += _hidden_size * _hidden_size * 3;
 
     offset.push_back(idx);
     read_hdf5_dataset_data(
@@ -1009,19 +970,18 @@ void QuantTransformerWeight<OpType_>::hdf5_parse_dec_wei(hid_t hdf5_file) {
         "Wrong self_project_bias_qkv_size !");
     idx += _hidden_size * 3;
 
-    offset.push_back(idx);
+    offset.push_back(-1);
+    offset_i8.push_back(idx_i8);
     read_hdf5_dataset_data(
         hdf5_file, dataset_prefix + "/self_project_kernel_output",
-        H5T_NATIVE_UCHAR, value_i8.data() + idx,
+        H5T_NATIVE_UCHAR, value_u8.data() + idx_i8,
         [=](int size) { return size != _hidden_size * _hidden_size; },
         "Wrong self_project_kernel_output_size !");
     read_hdf5_dataset_scalar(
         hdf5_file, dataset_prefix + "/self_project_kernel_output_clip_max",
         H5T_NATIVE_FLOAT, &clip_max);
-    dequantize_array(value_i8, value, clip_max, _quant_range, idx,
-                     _hidden_size * _hidden_size);
     _dec_clip_max.push_back(clip_max);
-    idx += _hidden_size * _hidden_size;
+    idx_i8 += _hidden_size * _hidden_size;
 
     offset.push_back(idx);
     read_hdf5_dataset_data(
@@ -1045,19 +1005,18 @@ void QuantTransformerWeight<OpType_>::hdf5_parse_dec_wei(hid_t hdf5_file) {
         "Wrong encdec_norm_bias_size !");
     idx += _hidden_size;
 
-    offset.push_back(idx);
+    offset.push_back(-1);
+    offset_i8.push_back(idx_i8);
     read_hdf5_dataset_data(
         hdf5_file, dataset_prefix + "/encdec_project_kernel_q",
-        H5T_NATIVE_UCHAR, value_i8.data() + idx,
+        H5T_NATIVE_UCHAR, value_u8.data() + idx_i8,
         [=](int size) { return size != _hidden_size * _hidden_size; },
         "Wrong encdec_project_kernel_q_size !");
     read_hdf5_dataset_scalar(
         hdf5_file, dataset_prefix + "/encdec_project_kernel_q_clip_max",
         H5T_NATIVE_FLOAT, &clip_max);
-    dequantize_array(value_i8, value, clip_max, _quant_range, idx,
-                     _hidden_size * _hidden_size);
     _dec_clip_max.push_back(clip_max);
-    idx += _hidden_size * _hidden_size;
+    idx_i8 += _hidden_size * _hidden_size;
 
     offset.push_back(idx);
     read_hdf5_dataset_data(
@@ -1066,19 +1025,18 @@ void QuantTransformerWeight<OpType_>::hdf5_parse_dec_wei(hid_t hdf5_file) {
         "Wrong encdec_project_bias_q_size !");
     idx += _hidden_size;
 
-    offset.push_back(idx);
+    offset.push_back(-1);
+    offset_i8.push_back(idx_i8);
     read_hdf5_dataset_data(
         hdf5_file, dataset_prefix + "/encdec_project_kernel_output",
-        H5T_NATIVE_UCHAR, value_i8.data() + idx,
+        H5T_NATIVE_UCHAR, value_u8.data() + idx_i8,
         [=](int size) { return size != _hidden_size * _hidden_size; },
         "Wrong encdec_project_kernel_output_size !");
     read_hdf5_dataset_scalar(
         hdf5_file, dataset_prefix + "/encdec_project_kernel_output_clip_max",
         H5T_NATIVE_FLOAT, &clip_max);
-    dequantize_array(value_i8, value, clip_max, _quant_range, idx,
-                     _hidden_size * _hidden_size);
     _dec_clip_max.push_back(clip_max);
-    idx += _hidden_size * _hidden_size;
+    idx_i8 += _hidden_size * _hidden_size;
 
     offset.push_back(idx);
     read_hdf5_dataset_data(
@@ -1102,19 +1060,18 @@ void QuantTransformerWeight<OpType_>::hdf5_parse_dec_wei(hid_t hdf5_file) {
         "Wrong ffn_norm_bias_size !");
     idx += _hidden_size;
 
-    offset.push_back(idx);
+    offset.push_back(-1);
+    offset_i8.push_back(idx_i8);
     read_hdf5_dataset_data(
         hdf5_file, dataset_prefix + "/ffn_first_kernel", H5T_NATIVE_UCHAR,
-        value_i8.data() + idx,
+        value_u8.data() + idx_i8,
         [=](int size) { return size != _hidden_size * _inner_size; },
         "Wrong ffn_first_kernel_size !");
     read_hdf5_dataset_scalar(hdf5_file,
                              dataset_prefix + "/ffn_first_kernel_clip_max",
                              H5T_NATIVE_FLOAT, &clip_max);
-    dequantize_array(value_i8, value, clip_max, _quant_range, idx,
-                     _hidden_size * _inner_size);
     _dec_clip_max.push_back(clip_max);
-    idx += _hidden_size * _inner_size;
+    idx_i8 += _hidden_size * _inner_size;
 
     offset.push_back(idx);
     read_hdf5_dataset_data(
@@ -1123,19 +1080,18 @@ void QuantTransformerWeight<OpType_>::hdf5_parse_dec_wei(hid_t hdf5_file) {
         "Wrong ffn_first_bias_size !");
     idx += _inner_size;
 
-    offset.push_back(idx);
+    offset.push_back(-1);
+    offset_i8.push_back(idx_i8);
     read_hdf5_dataset_data(
         hdf5_file, dataset_prefix + "/ffn_second_kernel", H5T_NATIVE_UCHAR,
-        value_i8.data() + idx,
+        value_u8.data() + idx_i8,
         [=](int size) { return size != _hidden_size * _inner_size; },
         "Wrong ffn_second_kernel_size !");
     read_hdf5_dataset_scalar(hdf5_file,
                              dataset_prefix + "/ffn_second_kernel_clip_max",
                              H5T_NATIVE_FLOAT, &clip_max);
-    dequantize_array(value_i8, value, clip_max, _quant_range, idx,
-                     _hidden_size * _inner_size);
     _dec_clip_max.push_back(clip_max);
-    idx += _hidden_size * _inner_size;
+    idx_i8 += _hidden_size * _inner_size;
 
     offset.push_back(idx);
     read_hdf5_dataset_data(
@@ -1192,12 +1148,14 @@ void QuantTransformerWeight<OpType_>::hdf5_parse_dec_wei(hid_t hdf5_file) {
     _dec_clip_max.push_back(clip_max);
   }  // for
 
-  std::vector<_DataType> raw_value;
-  raw_value.reserve(value.size());
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_dec_wei = raw_value;
+  upload_weights(value, &_d_dec_wei);
+  _i8_dec_wei.resize(value_size_i8);
+  uint8_to_int8(value_u8.data(), _i8_dec_wei.data(), value_size_i8);
 
-  for (int e : offset) _p_d_dec_wei.push_back(_d_dec_wei.data() + e);
+  // the kernels are kept in int8, see get_int8_dec_wei
+  for (int e : offset)
+    _p_d_dec_wei.push_back(e < 0 ? nullptr : _d_dec_wei.data() + e);
+  for (int e : offset_i8) _p_i8_dec_wei.push_back(_i8_dec_wei.data() + e);
   std::cout << "Finish loading dec_wei from host to device" << std::endl;
 }
 
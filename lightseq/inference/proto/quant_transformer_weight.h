@@ -12,6 +12,7 @@
 #include <string>
 #include <vector>
 
+#include "../tools/int8_weight_cache.h"
 #include "../tools/util.h"
 
 #include "quant_transformer.pb.h"
@@ -57,6 +58,18 @@ class QuantTransformerWeight {
   std::vector<_DataType> _d_src_emb_wei;
   std::vector<_DataType> _d_src_lang_emb;
 
+  // int8 kernels, in the row major layout of the weight file, their slots
+  // in the weights pointer above are nullptr
+  std::vector<const int8_t *> _p_i8_src_emb_wei;  // size: 1
+  std::vector<const int8_t *> _p_i8_enc_wei;      // size: 4 * enc_layer_num
+  std::vector<const int8_t *> _p_i8_trg_emb_wei;  // size: 1
+  std::vector<const int8_t *> _p_i8_dec_wei;      // size: 6 * dec_layer_num
+  std::vector<int8_t> _i8_src_emb_wei;
+  std::vector<int8_t> _i8_enc_wei;
+  std::vector<int8_t> _i8_trg_emb_wei;
+  std::vector<int8_t> _i8_dec_wei;
+  mutable uint64_t _int8_weight_hash = 0;  // see get_int8_weight_hash
+
   // store the clip_max of weights and activations
   float _src_emb_clip_max;
   float _trg_emb_clip_max;
@@ -99,6 +112,41 @@ class QuantTransformerWeight {
     return _p_d_dec_wei;
   }
 
+  const std::vector<const int8_t *> &get_int8_src_emb_wei() const {
+    // {token_emb}
+    return _p_i8_src_emb_wei;
+  }
+
+  const std::vector<const int8_t *> &get_int8_enc_wei() const {
+    // {multihead_qkv_kernel, multihead_output_kernel, ffn_first_kernel,
+    // ffn_second_kernel} * encoder_layer_num
+    return _p_i8_enc_wei;
+  }
+
+  const std::vector<const int8_t *> &get_int8_trg_emb_wei() const {
+    // {token_emb}
+    return _p_i8_trg_emb_wei;
+  }
+
+  const std::vector<const int8_t *> &get_int8_dec_wei() const {
+    // {self_qkv_kernel, self_output_kernel, encdec_q_kernel,
+    // encdec_output_kernel, ffn_first_kernel, ffn_second_kernel} *
+    // decoder_layer_num
+    return _p_i8_dec_wei;
+  }
+
+  // hash of all the int8 kernels, keys the cache of their transformed
+  // layouts, see int8_weight_cache.h
+  uint64_t get_int8_weight_hash() const {
+    if (_int8_weight_hash != 0) return _int8_weight_hash;
+    uint64_t h = bytes_hash(_i8_src_emb_wei);
+    h = bytes_hash(_i8_enc_wei, h);
+    h = bytes_hash(_i8_trg_emb_wei, h);
+    h = bytes_hash(_i8_dec_wei, h);
+    _int8_weight_hash = h;
+    return h;
+  }
+
   float get_src_emb_clip_max() const { return _src_emb_clip_max; }
 
   float get_trg_emb_clip_max() const { return _trg_emb_clip_max; }
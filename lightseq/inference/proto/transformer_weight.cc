@@ -1,6 +1,9 @@
 #include "transformer_weight.h"
 
 #include <fstream>
+
+#include "../tools/weight_upload.h"
+
 /**
 @file
 Load the model weights which stored in custom proto file into GPU memory.
@@ -121,12 +124,8 @@ std::string TransformerWeight<OpType_>::proto_parse_emb_wei(
   idx += _hidden_size;
 
   if (source == "src") {
-    std::vector<_DataType> raw_value;
-    for (float e : value) raw_value.push_back(float2required(e));
-    _d_src_emb_wei = raw_value;
-    for (int e : offset)
-      _p_d_src_emb_wei.push_back(
-          thrust::raw_pointer_cast(_d_src_emb_wei.data()) + e);
+    _p_d_src_emb_wei = upload_weights(std::move(value), offset,
+                                      &_d_src_emb_wei, &_dedup);
   } else {
     // for trg, encdec_kv_kernel, encdec_kv_bias, logit_bias
 
@@ -154,13 +153,13 @@ std::string TransformerWeight<OpType_>::proto_parse_emb_wei(
     for (float ele : layer.shared_bias()) value.push_back(ele);
     idx += vocab_size;
 
-    std::vector<_DataType> raw_value;
-    for (float e : value) raw_value.push_back(float2required(e));
-    _d_trg_emb_wei = raw_value;
-    for (int e : offset) {
-      _p_d_trg_emb_wei.push_back(
-          thrust::raw_pointer_cast(_d_trg_emb_wei.data()) + e);
-    }
+    // the token embedding [hidden, vocab] of tied embeddings is the source
+    // one transposed
+    std::vector<TransposedMatch> tied = {
+        {0, (size_t)_hidden_size, (size_t)vocab_size}};
+    _p_d_trg_emb_wei = upload_weights(std::move(value), offset,
+                                      &_d_trg_emb_wei, &_dedup, &tied);
+    _trg_emb_tied = tied[0].matched;
   }  // trg
 
   if (_multilg_type != 0) {
@@ -195,105 +194,52 @@ Load the weights of encoder into GPU memory.
 template <OperationType OpType_>
 std::string TransformerWeight<OpType_>::proto_parse_enc_wei(
     const Transformer &transformer) {
-  std::vector<int> offset;
-  std::vector<float> value;
-  int idx = 0;
-
-  for (auto enc_layer : transformer.encoder_stack()) {
-    offset.push_back(idx);
-    if (enc_layer.multihead_norm_scale_size() != _hidden_size)
-      return "Wrong multihead_norm_scale_size !";
-    for (float ele : enc_layer.multihead_norm_scale()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-    if (enc_layer.multihead_norm_bias_size() != _hidden_size)
-      return "Wrong multihead_norm_bias_size !";
-    for (float ele : enc_layer.multihead_norm_bias()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-
-    if (enc_layer.multihead_project_kernel_qkv_size() !=
-        _hidden_size * _hidden_size * 3)
-      return "Wrong multihead_project_kernel_qkv_size !";
-    for (float ele : enc_layer.multihead_project_kernel_qkv())
-      value.push_back(ele);
-
-    idx += _hidden_size * _hidden_size * 3;
-
-    offset.push_back(idx);
-    if (enc_layer.multihead_project_bias_qkv_size() != _hidden_size * 3)
-      return "Wrong multihead_project_bias_qkv_size !";
-    for (float ele : enc_layer.multihead_project_bias_qkv())
-      value.push_back(ele);
-    idx += _hidden_size * 3;
-
-    offset.push_back(idx);
-
-    if (enc_layer.multihead_project_kernel_output_size() !=
-        _hidden_size * _hidden_size)
-      return "Wrong multihead_project_kernel_output_size !";
-    for (float ele : enc_layer.multihead_project_kernel_output())
-      value.push_back(ele);
-
-    idx += _hidden_size * _hidden_size;
-
-    offset.push_back(idx);
-    if (enc_layer.multihead_project_bias_output_size() != _hidden_size)
-      return "Wrong multihead_project_bias_output_size !";
-    for (float ele : enc_layer.multihead_project_bias_output())
-      value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-    if (enc_layer.ffn_norm_scale_size() != _hidden_size)
-      return "Wrong ffn_norm_scale_size !";
-    for (float ele : enc_layer.ffn_norm_scale()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-    if (enc_layer.ffn_norm_bias_size() != _hidden_size)
-      return "Wrong ffn_norm_bias_size !";
-    for (float ele : enc_layer.ffn_norm_bias()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-
-    if (enc_layer.ffn_first_kernel_size() != _hidden_size * _inner_size)
-      return "Wrong ffn_first_kernel_size !";
-    for (float ele : enc_layer.ffn_first_kernel()) value.push_back(ele);
-
-    idx += _hidden_size * _inner_size;
-
-    offset.push_back(idx);
-    if (enc_layer.ffn_first_bias_size() != _inner_size)
-      return "Wrong ffn_first_bias_size !";
-    for (float ele : enc_layer.ffn_first_bias()) value.push_back(ele);
-    idx += _inner_size;
-
-    offset.push_back(idx);
-
-    if (enc_layer.ffn_second_kernel_size() != _hidden_size * _inner_size)
-      return "Wrong ffn_second_kernel_size !";
-    for (float ele : enc_layer.ffn_second_kernel()) value.push_back(ele);
-
-    idx += _hidden_size * _inner_size;
-
-    offset.push_back(idx);
-    if (enc_layer.ffn_second_bias_size() != _hidden_size)
-      return "Wrong ffn_second_bias_size !";
-    for (float ele : enc_layer.ffn_second_bias()) value.push_back(ele);
-    idx += _hidden_size;
-
-  }  // for
-
-  std::vector<_DataType> raw_value;
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_enc_wei = raw_value;
-
-  for (int e : offset)
-    _p_d_enc_wei.push_back(thrust::raw_pointer_cast(_d_enc_wei.data()) + e);
+  // the layers are copied in parallel, see weight_loader.h
+  std::vector<size_t> sizes = {
+      (size_t)_hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size * _hidden_size * 3,
+      (size_t)_hidden_size * 3,
+      (size_t)_hidden_size * _hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size * _inner_size,
+      (size_t)_inner_size,
+      (size_t)_hidden_size * _inner_size,
+      (size_t)_hidden_size};
+  std::vector<std::string> names = {
+      "multihead_norm_scale", "multihead_norm_bias",
+      "multihead_project_kernel_qkv", "multihead_project_bias_qkv",
+      "multihead_project_kernel_output", "multihead_project_bias_output",
+      "ffn_norm_scale", "ffn_norm_bias", "ffn_first_kernel",
+      "ffn_first_bias", "ffn_second_kernel", "ffn_second_bias"};
+  int num_layers = transformer.encoder_stack_size();
+  std::vector<float> value(num_layers * layer_size(sizes));
+  std::string res = copy_layers_parallel(
+      num_layers, sizes, names,
+      [&](int layer_id) {
+        const EncoderLayer &layer = transformer.encoder_stack(layer_id);
+        return std::vector<const google::protobuf::RepeatedField<float> *>{
+            &layer.multihead_norm_scale(),
+            &layer.multihead_norm_bias(),
+            &layer.multihead_project_kernel_qkv(),
+            &layer.multihead_project_bias_qkv(),
+            &layer.multihead_project_kernel_output(),
+            &layer.multihead_project_bias_output(),
+            &layer.ffn_norm_scale(),
+            &layer.ffn_norm_bias(),
+            &layer.ffn_first_kernel(),
+            &layer.ffn_first_bias(),
+            &layer.ffn_second_kernel(),
+            &layer.ffn_second_bias()};
+      },
+      value.data());
+  if (!res.empty()) return res;
+
+  _p_d_enc_wei = upload_weights(std::move(value),
+                                layer_offsets(num_layers, sizes), &_d_enc_wei,
+                                &_dedup);
   std::cout << "Finish loading enc_wei from host to device" << std::endl;
   return "";
 }
@@ -304,145 +250,66 @@ Load the weights of decoder into GPU memory.
 template <OperationType OpType_>
 std::string TransformerWeight<OpType_>::proto_parse_dec_wei(
     const Transformer &transformer) {
-  std::vector<int> offset;
-  std::vector<float> value;
-  int idx = 0;
-
-  for (auto dec_layer : transformer.decoder_stack()) {
-    offset.push_back(idx);
-    if (dec_layer.self_norm_scale_size() != _hidden_size)
-      return "Wrong self_norm_scale size !";
-    for (float ele : dec_layer.self_norm_scale()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-    if (dec_layer.self_norm_bias_size() != _hidden_size)
-      return "Wrong self_norm_bias_size !";
-    for (float ele : dec_layer.self_norm_bias()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-
-    if (dec_layer.self_project_kernel_qkv_size() !=
-        _hidden_size * _hidden_size * 3)
-      return "Wrong self_project_kernel_qkv size !";
-    for (float ele : dec_layer.self_project_kernel_qkv()) value.push_back(ele);
-
-    idx += _hidden_size * _hidden_size * 3;
-
-    offset.push_back(idx);
-    if (dec_layer.self_project_bias_qkv_size() != _hidden_size * 3)
-      return "Wrong self_project_bias_qkv size !";
-    for (float ele : dec_layer.self_project_bias_qkv()) value.push_back(ele);
-    idx += _hidden_size * 3;
-
-    offset.push_back(idx);
-
-    if (dec_layer.self_project_kernel_output_size() !=
-        _hidden_size * _hidden_size)
-      return "Wrong self_project_kernel_output size !";
-    for (float ele : dec_layer.self_project_kernel_output())
-      value.push_back(ele);
-
-    idx += _hidden_size * _hidden_size;
-
-    offset.push_back(idx);
-    if (dec_layer.self_project_bias_output_size() != _hidden_size)
-      return "Wrong self_project_bias_output size !";
-    for (float ele : dec_layer.self_project_bias_output()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-    if (dec_layer.encdec_norm_scale_size() != _hidden_size)
-      return "Wrong encdec_norm_scale size !";
-    for (float ele : dec_layer.encdec_norm_scale()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-    if (dec_layer.encdec_norm_bias_size() != _hidden_size)
-      return "Wrong encdec_norm_bias_size !";
-    for (float ele : dec_layer.encdec_norm_bias()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-
-    if (dec_layer.encdec_project_kernel_q_size() != _hidden_size * _hidden_size)
-      return "Wrong encdec_project_kernel_q size !";
-    for (float ele : dec_layer.encdec_project_kernel_q()) value.push_back(ele);
-
-    idx += _hidden_size * _hidden_size;
-
-    offset.push_back(idx);
-    if (dec_layer.encdec_project_bias_q_size() != _hidden_size)
-      return "Wrong encdec_project_bias_q size !";
-    for (float ele : dec_layer.encdec_project_bias_q()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-
-    if (dec_layer.encdec_project_kernel_output_size() !=
-        _hidden_size * _hidden_size)
-      return "Wrong encdec_project_kernel_output size !";
-    for (float ele : dec_layer.encdec_project_kernel_output())
-      value.push_back(ele);
-
-    idx += _hidden_size * _hidden_size;
-
-    offset.push_back(idx);
-    if (dec_layer.encdec_project_bias_output_size() != _hidden_size)
-      return "Wrong encdec_project_bias_output size !";
-    for (float ele : dec_layer.encdec_project_bias_output())
-      value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-    if (dec_layer.ffn_norm_scale_size() != _hidden_size)
-      return "Wrong ffn_norm_scale_size !";
-    for (float ele : dec_layer.ffn_norm_scale()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-    if (dec_layer.ffn_norm_bias_size() != _hidden_size)
-      return "Wrong ffn_norm_bias_size !";
-    for (float ele : dec_layer.ffn_norm_bias()) value.push_back(ele);
-    idx += _hidden_size;
-
-    offset.push_back(idx);
-
-    if (dec_layer.ffn_first_kernel_size() != _hidden_size * _inner_size)
-      return "Wrong ffn_first_kernel_size !";
-    for (float ele : dec_layer.ffn_first_kernel()) value.push_back(ele);
-
-    idx += _hidden_size * _inner_size;
-
-    offset.push_back(idx);
-    if (dec_layer.ffn_first_bias_size() != _inner_size)
-      return "Wrong ffn_first_bias_size !";
-    for (float ele : dec_layer.ffn_first_bias()) value.push_back(ele);
-    idx += _inner_size;
-
-    offset.push_back(idx);
-
-    if (dec_layer.ffn_second_kernel_size() != _hidden_size * _inner_size)
-      return "Wrong ffn_second_kernel_size !";
-    for (float ele : dec_layer.ffn_second_kernel()) value.push_back(ele);
-
-    idx += _hidden_size * _inner_size;
-
-    offset.push_back(idx);
-    if (dec_layer.ffn_second_bias_size() != _hidden_size)
-      return "Wrong ffn_second_bias_size !";
-    for (float ele : dec_layer.ffn_second_bias()) value.push_back(ele);
-    idx += _hidden_size;
-
-  }  // for
-
-  std::vector<_DataType> raw_value;
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_dec_wei = raw_value;
-
-  for (int e : offset)
-    _p_d_dec_wei.push_back(thrust::raw_pointer_cast(_d_dec_wei.data()) + e);
+  // the layers are copied in parallel, see weight_loader.h
+  std::vector<size_t> sizes = {
+      (size_t)_hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size * _hidden_size * 3,
+      (size_t)_hidden_size * 3,
+      (size_t)_hidden_size * _hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size * _hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size * _hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size,
+      (size_t)_hidden_size * _inner_size,
+      (size_t)_inner_size,
+      (size_t)_hidden_size * _inner_size,
+      (size_t)_hidden_size};
+  std::vector<std::string> names = {
+      "self_norm_scale", "self_norm_bias", "self_project_kernel_qkv",
+      "self_project_bias_qkv", "self_project_kernel_output",
+      "self_project_bias_output", "encdec_norm_scale", "encdec_norm_bias",
+      "encdec_project_kernel_q", "encdec_project_bias_q",
+      "encdec_project_kernel_output", "encdec_project_bias_output",
+      "ffn_norm_scale", "ffn_norm_bias", "ffn_first_kernel",
+      "ffn_first_bias", "ffn_second_kernel", "ffn_second_bias"};
+  int num_layers = transformer.decoder_stack_size();
+  std::vector<float> value(num_layers * layer_size(sizes));
+  std::string res = copy_layers_parallel(
+      num_layers, sizes, names,
+      [&](int layer_id) {
+        const DecoderLayer &layer = transformer.decoder_stack(layer_id);
+        return std::vector<const google::protobuf::RepeatedField<float> *>{
+            &layer.self_norm_scale(),
+            &layer.self_norm_bias(),
+            &layer.self_project_kernel_qkv(),
+            &layer.self_project_bias_qkv(),
+            &layer.self_project_kernel_output(),
+            &layer.self_project_bias_output(),
+            &layer.encdec_norm_scale(),
+            &layer.encdec_norm_bias(),
+            &layer.encdec_project_kernel_q(),
+            &layer.encdec_project_bias_q(),
+            &layer.encdec_project_kernel_output(),
+            &layer.encdec_project_bias_output(),
+            &layer.ffn_norm_scale(),
+            &layer.ffn_norm_bias(),
+            &layer.ffn_first_kernel(),
+            &layer.ffn_first_bias(),
+            &layer.ffn_second_kernel(),
+            &layer.ffn_second_bias()};
+      },
+      value.data());
+  if (!res.empty()) return res;
+
+  _p_d_dec_wei = upload_weights(std::move(value),
+                                layer_offsets(num_layers, sizes), &_d_dec_wei,
+                                &_dedup);
   std::cout << "Finish loading dec_wei from host to device" << std::endl;
   return "";
 }
@@ -609,13 +476,8 @@ void TransformerWeight<OpType_>::hdf5_parse_emb_wei(hid_t hdf5_file,
   idx += _hidden_size;
 
   if (source == "src") {
-    std::vector<_DataType> raw_value;
-    raw_value.reserve(value.size());
-    for (float e : value) raw_value.push_back(float2required(e));
-    _d_src_emb_wei = raw_value;
-    for (int e : offset)
-      _p_d_src_emb_wei.push_back(
-          thrust::raw_pointer_cast(_d_src_emb_wei.data()) + e);
+    _p_d_src_emb_wei = upload_weights(std::move(value), offset,
+                                      &_d_src_emb_wei, &_dedup);
   } else {
     // for trg, encdec_kv_kernel, encdec_kv_bias, logit_bias
 
@@ -644,14 +506,13 @@ void TransformerWeight<OpType_>::hdf5_parse_emb_wei(hid_t hdf5_file,
         "Wrong shared_bias_size !");
     idx += vocab_size;
 
-    std::vector<_DataType> raw_value;
-    raw_value.reserve(value.size());
-    for (float e : value) raw_value.push_back(float2required(e));
-    _d_trg_emb_wei = raw_value;
-    for (int e : offset) {
-      _p_d_trg_emb_wei.push_back(
-          thrust::raw_pointer_cast(_d_trg_emb_wei.data()) + e);
-    }
+    // the token embedding [hidden, vocab] of tied embeddings is the source
+    // one transposed
+    std::vector<TransposedMatch> tied = {
+        {0, (size_t)_hidden_size, (size_t)vocab_size}};
+    _p_d_trg_emb_wei = upload_weights(std::move(value), offset,
+                                      &_d_trg_emb_wei, &_dedup, &tied);
+    _trg_emb_tied = tied[0].matched;
   }  // trg
 
   if (_multilg_type) {
@@ -792,13 +653,8 @@ void TransformerWeight<OpType_>::hdf5_parse_enc_wei(hid_t hdf5_file) {
 
   }  // for
 
-  std::vector<_DataType> raw_value;
-  raw_value.reserve(value.size());
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_enc_wei = raw_value;
-
-  for (int e : offset)
-    _p_d_enc_wei.push_back(thrust::raw_pointer_cast(_d_enc_wei.data()) + e);
+  _p_d_enc_wei =
+      upload_weights(std::move(value), offset, &_d_enc_wei, &_dedup);
   std::cout << "Finish loading enc_wei from host to device" << std::endl;
 }
 
@@ -960,16 +816,23 @@ void TransformerWeight<OpType_>::hdf5_parse_dec_wei(hid_t hdf5_file) {
 
   }  // for
 
-  std::vector<_DataType> raw_value;
-  raw_value.reserve(value.size());
-  for (float e : value) raw_value.push_back(float2required(e));
-  _d_dec_wei = raw_value;
-
-  for (int e : offset)
-    _p_d_dec_wei.push_back(thrust::raw_pointer_cast(_d_dec_wei.data()) + e);
+  _p_d_dec_wei =
+      upload_weights(std::move(value), offset, &_d_dec_wei, &_dedup);
   std::cout << "Finish loading dec_wei from host to device" << std::endl;
 }
 
+/**
+Report the bytes saved by the deduplication of the weights and free its
+host copies.
+*/
+template <OperationType OpType_>
+void TransformerWeight<OpType_>::finish_dedup() {
+  std::cout << "Deduplicated " << _dedup.num_aliased()
+            << " weight tensors, saved "
+            << _dedup.saved_bytes() / (1024 * 1024) << " MB" << std::endl;
+  _dedup.release();
+}
+
 /**
 Load the proto file into CPU memory and parse it.
 */
@@ -1013,6 +876,7 @@ std::string TransformerWeight<OpType_>::initializing(std::string weight_path,
     res = proto_parse_dec_wei(transformer);
     if (!res.empty()) return res;
 
+    finish_dedup();
     std::cout << "Finish loading all weight from host to device" << std::endl;
     // Optional:  Delete all global objects allocated by libprotobuf.
     // google::protobuf::ShutdownProtobufLibrary();
@@ -1041,6 +905,7 @@ std::string TransformerWeight<OpType_>::initializing(std::string weight_path,
     hdf5_parse_dec_wei(hdf5_file);
     H5Fclose(hdf5_file);
 
+    finish_dedup();
     std::cout << "Finish loading all weight from host to device" << std::endl;
     return "";
   } else {
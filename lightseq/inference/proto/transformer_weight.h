@@ -14,6 +14,7 @@
 #include <vector>
 
 #include "../tools/util.h"
+#include "../tools/weight_dedup.h"
 #include "transformer.pb.h"
 
 namespace lightseq {
@@ -43,6 +44,10 @@ class TransformerWeight {
   void hdf5_parse_enc_wei(hid_t hdf5_file);
   void hdf5_parse_dec_wei(hid_t hdf5_file);
 
+  // identical tensors of the blocks share their storage, see weight_dedup.h
+  WeightDedup _dedup;
+  void finish_dedup();
+
   // store the weights pointer
   std::vector<const _DataType *> _p_d_src_emb_wei;  // size: 4
   std::vector<const _DataType *> _p_d_trg_emb_wei;  // size: 4
@@ -116,6 +121,9 @@ class TransformerWeight {
   bool _no_scale_embedding;
   bool _use_gelu;
   int _multilg_type;
+  // the target token embedding aliases the source one, so it is
+  // [vocab_size, hidden_size] instead of [hidden_size, vocab_size]
+  bool _trg_emb_tied = false;
 
   void print_model_config() {
     std::cout << "***model config***" << std::endl;
@@ -4,8 +4,11 @@ namespace lightseq {
 namespace cuda {
 
 Bert::Bert(const std::string weight_path, const int max_batch_size)
-    : LSModel({"token_ids"}, {"encoder_output"}),
-      _max_batch_size(max_batch_size) {
+    : LSModel({"token_ids"},
+              {"encoder_output", "exit_logits", "exit_layer",
+               "pooled_output"}),
+      _max_batch_size(max_batch_size),
+      stage_timer_(&profiler_) {
   /* ---step1. init environment--- */
   CHECK_GPU_ERROR(cudaStreamCreate(&stream_));
   CHECK_GPU_ERROR(cublasCreate(&hd_));
@@ -36,10 +39,20 @@ Bert::Bert(const std::string weight_path, const int max_batch_size)
   CHECK_GPU_ERROR(cudaMalloc(
       &d_encoder_output_, _max_batch_size * tw_._max_step * tw_._hidden_size *
                               sizeof(optraits::DataType)));
+  CHECK_GPU_ERROR(cudaMalloc(
+      &d_exit_logits_,
+      _max_batch_size * std::max(tw_._num_labels, 1) * sizeof(float)));
+  CHECK_GPU_ERROR(cudaMalloc(&d_exit_layer_, _max_batch_size * sizeof(int)));
+  CHECK_GPU_ERROR(cudaMalloc(
+      &d_pooled_output_,
+      _max_batch_size * tw_._hidden_size * sizeof(optraits::DataType)));
 
   encoder_ = std::make_shared<BertEncoder<bert_optype>>(
       max_batch_size, d_input_, d_padding_mask_, d_encoder_output_, tw_,
       stream_, hd_);
+  encoder_->_p_d_exit_logits = d_exit_logits_;
+  encoder_->_p_d_exit_layer = d_exit_layer_;
+  encoder_->_p_d_pooled_output = d_pooled_output_;
   res = encoder_->check();
   if (!res.empty()) {
     throw std::runtime_error(res);
@@ -51,6 +64,7 @@ Bert::Bert(const std::string weight_path, const int max_batch_size)
   // encoder and decoder use the same buffer to save gpu memory useage
   CHECK_GPU_ERROR(cudaMalloc(&d_buf_, (size_t)buf_bytesize));
   encoder_->init_buffer(d_buf_);
+  encoder_->set_stage_timer(&stage_timer_);
   CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
 }
 
@@ -58,18 +72,37 @@ Bert::~Bert() {
   CHECK_GPU_ERROR(cudaFree(d_input_));
   CHECK_GPU_ERROR(cudaFree(d_padding_mask_));
   CHECK_GPU_ERROR(cudaFree(d_encoder_output_));
+  CHECK_GPU_ERROR(cudaFree(d_exit_logits_));
+  CHECK_GPU_ERROR(cudaFree(d_exit_layer_));
+  CHECK_GPU_ERROR(cudaFree(d_pooled_output_));
   CHECK_GPU_ERROR(cudaFree(d_buf_));
   CHECK_GPU_ERROR(cublasDestroy(hd_));
   CHECK_GPU_ERROR(cudaStreamDestroy(stream_));
 }
 
 void Bert::Infer() {
+  HostStageScope infer_scope(&profiler_, infer_stage_);
+  stage_timer_.begin_infer(stream_);
   int batch_size = input_shapes_[0][0], seq_len = input_shapes_[0][1];
   encoder_->run_one_infer(batch_size, seq_len);
   CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
+  stage_timer_.end_infer(stream_);
   set_output_shape(0, {batch_size, seq_len, tw_._hidden_size});
+  // empty without exit heads, the exit layer is then the last layer
+  set_output_shape(1, {batch_size, tw_._num_labels});
+  set_output_shape(2, {batch_size});
+  // empty without pooling
+  set_output_shape(3, {batch_size, encoder_->pooling_mode() == kPoolNone
+                                       ? 0
+                                       : tw_._hidden_size});
+}
+
+void Bert::set_early_exit(const EarlyExitConfig &config) {
+  encoder_->set_early_exit(config);
 }
 
+void Bert::set_pooling_mode(int mode) { encoder_->set_pooling_mode(mode); }
+
 void Bert::set_input_ptr(int index, void *input_ptr) {
   switch (index) {
     case 0:
@@ -88,6 +121,19 @@ void Bert::set_output_ptr(int index, void *output_ptr) {
       encoder_->_p_d_output = static_cast<optraits::DataType *>(output_ptr);
       break;
 
+    case 1:
+      encoder_->_p_d_exit_logits = static_cast<float *>(output_ptr);
+      break;
+
+    case 2:
+      encoder_->_p_d_exit_layer = static_cast<int *>(output_ptr);
+      break;
+
+    case 3:
+      encoder_->_p_d_pooled_output =
+          static_cast<optraits::DataType *>(output_ptr);
+      break;
+
     default:
       throw std::runtime_error("invalid output index");
       break;
@@ -99,6 +145,15 @@ const void *Bert::get_output_ptr(int index) {
     case 0:
       return static_cast<void *>(encoder_->_p_d_output);
 
+    case 1:
+      return static_cast<void *>(encoder_->_p_d_exit_logits);
+
+    case 2:
+      return static_cast<void *>(encoder_->_p_d_exit_layer);
+
+    case 3:
+      return static_cast<void *>(encoder_->_p_d_pooled_output);
+
     default:
       throw std::runtime_error("invalid output index");
       break;
@@ -120,6 +175,15 @@ std::vector<int> Bert::get_output_max_shape(int index) {
     case 0:
       return {_max_batch_size, tw_._max_step, tw_._hidden_size};
 
+    case 1:
+      return {_max_batch_size, std::max(tw_._num_labels, 1)};
+
+    case 2:
+      return {_max_batch_size};
+
+    case 3:
+      return {_max_batch_size, tw_._hidden_size};
+
     default:
       throw std::runtime_error("invalid output index");
       break;
@@ -148,6 +212,22 @@ DataType Bert::get_output_dtype(int index) {
       }
       break;
 
+    case 1:
+      return DataType::kFloat32;
+      break;
+
+    case 2:
+      return DataType::kInt32;
+      break;
+
+    case 3:
+      if (bert_optype == OperationType::FP32) {
+        return DataType::kFloat32;
+      } else {
+        return DataType::kFloat16;
+      }
+      break;
+
     default:
       throw std::runtime_error("invalid output index");
       break;
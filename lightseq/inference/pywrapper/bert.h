@@ -20,10 +20,14 @@ class Bert : public LSModel {
   std::shared_ptr<BertEncoder<bert_optype>> encoder_;
 
   optraits::DataType *d_encoder_output_;
+  float *d_exit_logits_;
+  int *d_exit_layer_;
+  optraits::DataType *d_pooled_output_;
   int *d_input_;
   int *d_padding_mask_;
   int _max_batch_size;
   cudaStream_t stream_;
+  CudaStageTimer stage_timer_;
   cublasHandle_t hd_;
   void *d_buf_;
   BertWeight<bert_optype> tw_;
@@ -41,6 +45,9 @@ class Bert : public LSModel {
   std::vector<int> get_output_max_shape(int index) override;
   DataType get_input_dtype(int index) override;
   DataType get_output_dtype(int index) override;
+  void *get_stream() override { return stream_; }
+  void set_early_exit(const EarlyExitConfig &config) override;
+  void set_pooling_mode(int mode) override;
 };
 
 LSMODEL_REGISTER(Bert);
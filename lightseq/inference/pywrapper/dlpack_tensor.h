@@ -0,0 +1,217 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "model_base.h"
+
+/**
+@file
+DLPack tensors for the zero-copy inference of the python wrapper, the inputs
+are read in place from the device memory of the caller (e.g. a torch cuda
+tensor) and the outputs are handed over as DLPack tensors of the model dtype,
+so fp16 outputs stay fp16. CUDA-free so that the checks and the ownership
+can be tested on host.
+*/
+
+// The DLPack ABI v0.6, see https://github.com/dmlc/dlpack, skipped if
+// dlpack.h is already included
+#ifndef DLPACK_VERSION
+#define DLPACK_VERSION 60
+extern "C" {
+typedef enum {
+  kDLCPU = 1,
+  kDLCUDA = 2,
+  kDLCUDAHost = 3,
+  kDLCUDAManaged = 13,
+} DLDeviceType;
+
+typedef struct {
+  DLDeviceType device_type;
+  int32_t device_id;
+} DLDevice;
+
+typedef enum {
+  kDLInt = 0U,
+  kDLUInt = 1U,
+  kDLFloat = 2U,
+  kDLOpaqueHandle = 3U,
+  kDLBfloat = 4U,
+  kDLComplex = 5U,
+} DLDataTypeCode;
+
+typedef struct {
+  uint8_t code;
+  uint8_t bits;
+  uint16_t lanes;
+} DLDataType;
+
+typedef struct {
+  void* data;
+  DLDevice device;
+  int32_t ndim;
+  DLDataType dtype;
+  int64_t* shape;
+  int64_t* strides;  // nullptr for the compact row major layout
+  uint64_t byte_offset;
+} DLTensor;
+
+typedef struct DLManagedTensor {
+  DLTensor dl_tensor;
+  void* manager_ctx;
+  void (*deleter)(struct DLManagedTensor* self);
+} DLManagedTensor;
+}
+#endif
+
+namespace lightseq {
+namespace cuda {
+
+inline DLDataType dl_dtype(DataType dtype) {
+  switch (dtype) {
+    case kFloat32:
+      return {kDLFloat, 32, 1};
+    case kFloat16:
+      return {kDLFloat, 16, 1};
+    case kFloat64:
+      return {kDLFloat, 64, 1};
+    case kInt8:
+      return {kDLInt, 8, 1};
+    case kInt16:
+      return {kDLInt, 16, 1};
+    case kInt32:
+      return {kDLInt, 32, 1};
+    case kInt64:
+      return {kDLInt, 64, 1};
+    case kByte:
+    case kUInt8:
+      return {kDLUInt, 8, 1};
+    case kUInt16:
+      return {kDLUInt, 16, 1};
+    case kUInt32:
+      return {kDLUInt, 32, 1};
+    case kUInt64:
+      return {kDLUInt, 64, 1};
+    default:
+      throw std::runtime_error("data type not supported by DLPack");
+  }
+}
+
+inline int data_type_bytes(DataType dtype) { return dl_dtype(dtype).bits / 8; }
+
+inline std::string dl_dtype_str(DLDataType dtype) {
+  const char* codes[] = {"int", "uint", "float", "handle", "bfloat", "complex"};
+  std::string res = dtype.code < 6 ? codes[dtype.code] : "unknown";
+  res += std::to_string(dtype.bits);
+  if (dtype.lanes != 1) res += "x" + std::to_string(dtype.lanes);
+  return res;
+}
+
+inline int64_t dl_numel(const DLTensor& t) {
+  int64_t numel = 1;
+  for (int i = 0; i < t.ndim; i++) numel *= t.shape[i];
+  return numel;
+}
+
+/* Whether the tensor is dense in row major order, size-1 dims may have any
+ * stride */
+inline bool dl_is_compact(const DLTensor& t) {
+  if (t.strides == nullptr) return true;
+  int64_t expect = 1;
+  for (int i = t.ndim - 1; i >= 0; i--) {
+    if (t.shape[i] != 1 && t.strides[i] != expect) return false;
+    expect *= t.shape[i];
+  }
+  return true;
+}
+
+inline void* dl_data_ptr(const DLTensor& t) {
+  return static_cast<char*>(t.data) + t.byte_offset;
+}
+
+inline std::vector<int> dl_shape(const DLTensor& t) {
+  return std::vector<int>(t.shape, t.shape + t.ndim);
+}
+
+/* Check a DLPack input of the model, returns the error or "" */
+inline std::string check_dl_tensor(const DLTensor& t, DataType dtype,
+                                   const std::vector<int>& max_shape,
+                                   int device_id) {
+  if (t.device.device_type != kDLCUDA &&
+      t.device.device_type != kDLCUDAManaged) {
+    return "tensor should be on a cuda device";
+  }
+  if (t.device.device_id != device_id) {
+    return "tensor is on device " + std::to_string(t.device.device_id) +
+           ", the model is on device " + std::to_string(device_id);
+  }
+  DLDataType expect = dl_dtype(dtype);
+  if (t.dtype.code != expect.code || t.dtype.bits != expect.bits ||
+      t.dtype.lanes != expect.lanes) {
+    return "dtype should be " + dl_dtype_str(expect) + ", got " +
+           dl_dtype_str(t.dtype);
+  }
+  if (t.ndim != (int)max_shape.size()) {
+    return "ndim should be " + std::to_string(max_shape.size()) + ", got " +
+           std::to_string(t.ndim);
+  }
+  for (int i = 0; i < t.ndim; i++) {
+    if (t.shape[i] <= 0 || t.shape[i] > max_shape[i]) {
+      return "dim " + std::to_string(i) + " should be in [1, " +
+             std::to_string(max_shape[i]) + "], got " +
+             std::to_string(t.shape[i]);
+    }
+  }
+  if (!dl_is_compact(t)) return "tensor should be contiguous";
+  return "";
+}
+
+struct DLManagedTensorDeleter {
+  void operator()(DLManagedTensor* t) const {
+    if (t && t->deleter) t->deleter(t);
+  }
+};
+
+/* A DLPack tensor consumed from the caller, returned to its owner when
+ * released */
+typedef std::unique_ptr<DLManagedTensor, DLManagedTensorDeleter>
+    DLManagedTensorPtr;
+
+/**
+Wrap data as a DLPack tensor that owns it, free_data(data) is called by the
+deleter of the consumer.
+*/
+inline DLManagedTensor* make_dl_managed_tensor(
+    void* data, DataType dtype, const std::vector<int>& shape, DLDevice device,
+    std::function<void(void*)> free_data) {
+  struct Context {
+    std::vector<int64_t> shape;
+    std::function<void(void*)> free_data;
+  };
+  Context* ctx = new Context{std::vector<int64_t>(shape.begin(), shape.end()),
+                             std::move(free_data)};
+  DLManagedTensor* t = new DLManagedTensor();
+  t->dl_tensor.data = data;
+  t->dl_tensor.device = device;
+  t->dl_tensor.ndim = shape.size();
+  t->dl_tensor.dtype = dl_dtype(dtype);
+  t->dl_tensor.shape = ctx->shape.data();
+  t->dl_tensor.strides = nullptr;
+  t->dl_tensor.byte_offset = 0;
+  t->manager_ctx = ctx;
+  t->deleter = [](DLManagedTensor* self) {
+    Context* ctx = static_cast<Context*>(self->manager_ctx);
+    if (ctx->free_data) ctx->free_data(self->dl_tensor.data);
+    delete ctx;
+    delete self;
+  };
+  return t;
+}
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -3,12 +3,46 @@
 namespace lightseq {
 namespace cuda {
 
+/* The sessions on device, spilled to pageable host memory */
+static SessionStorage gpt_session_storage() {
+  SessionStorage storage;
+  storage.alloc = [](SessionEntry& e) {
+    CHECK_GPU_ERROR(cudaMalloc(&e.device_data, e.bytes));
+  };
+  storage.spill = [](SessionEntry& e) {
+    e.host_data = malloc(e.bytes);
+    if (e.host_data == nullptr) {
+      throw std::runtime_error("session: out of host memory");
+    }
+    CHECK_GPU_ERROR(cudaMemcpy(e.host_data, e.device_data, e.bytes,
+                               cudaMemcpyDeviceToHost));
+    CHECK_GPU_ERROR(cudaFree(e.device_data));
+    e.device_data = nullptr;
+  };
+  storage.restore = [](SessionEntry& e) {
+    CHECK_GPU_ERROR(cudaMalloc(&e.device_data, e.bytes));
+    CHECK_GPU_ERROR(cudaMemcpy(e.device_data, e.host_data, e.bytes,
+                               cudaMemcpyHostToDevice));
+    free(e.host_data);
+    e.host_data = nullptr;
+  };
+  storage.release = [](SessionEntry& e) {
+    if (e.device_data != nullptr) CHECK_GPU_ERROR(cudaFree(e.device_data));
+    free(e.host_data);
+    e.device_data = nullptr;
+    e.host_data = nullptr;
+  };
+  return storage;
+}
+
 Gpt::Gpt(const std::string weight_path, const int max_batch_size)
     : LSModel({"token_ids"}, {"result"}),
       stream_(nullptr),
       hd_(nullptr),
       encoder_(nullptr),
-      _max_batch_size(max_batch_size) {
+      _max_batch_size(max_batch_size),
+      stage_timer_(&profiler_),
+      sessions_(SessionCacheConfig(), gpt_session_storage()) {
   /* ---step1. init environment--- */
   CHECK_GPU_ERROR(cudaStreamCreate(&stream_));
   CHECK_GPU_ERROR(cudaStreamCreate(&cache_stream_));
@@ -34,6 +68,7 @@ Gpt::Gpt(const std::string weight_path, const int max_batch_size)
       cudaMalloc(&d_input_, _max_batch_size * tw_._max_step * sizeof(int)));
   CHECK_GPU_ERROR(
       cudaMalloc(&d_sample_id, _max_batch_size * tw_._max_step * sizeof(int)));
+  CHECK_GPU_ERROR(cudaMalloc(&d_session_input_, tw_._max_step * sizeof(int)));
   CHECK_GPU_ERROR(cudaMalloc(&d_ppl, _max_batch_size * sizeof(float)));
 
   encoder_ = std::make_shared<GptEncoder<gpt_optype>>(
@@ -51,11 +86,14 @@ Gpt::Gpt(const std::string weight_path, const int max_batch_size)
   // encoder and decoder use the same buffer to save gpu memory useage
   CHECK_GPU_ERROR(cudaMalloc((void**)&d_buf_, (size_t)buf_bytesize));
   encoder_->init_buffer(d_buf_);
+  encoder_->set_stage_timer(&stage_timer_);
   CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
 }
 
 Gpt::~Gpt() {
+  sessions_.clear();
   CHECK_GPU_ERROR(cudaFree(d_input_));
+  CHECK_GPU_ERROR(cudaFree(d_session_input_));
   CHECK_GPU_ERROR(cudaFree(d_sample_id));
   CHECK_GPU_ERROR(cudaFree(d_ppl));
   CHECK_GPU_ERROR(cudaFree(d_buf_));
@@ -68,21 +106,118 @@ const int* Gpt::get_result_ptr() { return d_sample_id; }
 const float* Gpt::get_score_ptr() { return d_ppl; }
 
 void Gpt::Infer() {
+  HostStageScope infer_scope(&profiler_, infer_stage_);
+  stage_timer_.begin_infer(stream_);
   int batch_size = input_shapes_[0][0], seq_len = input_shapes_[0][1];
 
   if (tw_._sampling_method == "ppl") {
     encoder_->run_one_infer(batch_size, seq_len);
     CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
+    stage_timer_.end_infer(stream_);
     set_output_shape(0, {batch_size});
   } else if (tw_._sampling_method == "topk" || tw_._sampling_method == "topp") {
     int sampled_seq_len = encoder_->run_one_sample(batch_size, seq_len);
     CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
-    set_output_shape(0, {batch_size, sampled_seq_len});
+    stage_timer_.end_infer(stream_);
+    set_output_shape(0, {batch_size * encoder_->num_return_sequences(),
+                         sampled_seq_len});
   } else {
     throw std::runtime_error("Unsupported sampling_method");
   }
 }
 
+/**
+Sample the next turn of a conversation, only the new turn and the last
+sampled token of the previous call are encoded, see session_cache.h
+*/
+void Gpt::InferSession(uint64_t session_id, bool start, bool end) {
+  if (!supports_sessions()) {
+    throw std::runtime_error("session: only for the sampling models");
+  }
+  int batch_size = input_shapes_[0][0], seq_len = input_shapes_[0][1];
+  if (batch_size != 1) {
+    throw std::runtime_error("session: batch size should be 1");
+  }
+  if (encoder_->num_return_sequences() != 1) {
+    throw std::runtime_error(
+        "session: not supported with num_return_sequences");
+  }
+  HostStageScope infer_scope(&profiler_, infer_stage_);
+  int64_t now_ms = session_now_ms();
+  if (start) {
+    sessions_.erase(session_id);
+  }
+  SessionEntry* session = sessions_.acquire(session_id, now_ms);
+  if (session == nullptr && !start) {
+    throw std::runtime_error("session: unknown or expired session " +
+                             std::to_string(session_id));
+  }
+  std::vector<int> tokens;
+  int prefix_len = 0;
+  if (session != nullptr) {
+    tokens = session->tokens;
+    prefix_len = session->seq_len;
+  }
+  int conversation_len = tokens.size() + seq_len;
+  if (conversation_len > tw_._max_step) {
+    throw std::runtime_error("session: the conversation exceeds max_step");
+  }
+
+  stage_timer_.begin_infer(stream_);
+  // the conversation so far, then the new turn
+  CHECK_GPU_ERROR(cudaMemcpy(d_session_input_, tokens.data(),
+                             tokens.size() * sizeof(int),
+                             cudaMemcpyHostToDevice));
+  CHECK_GPU_ERROR(cudaMemcpyAsync(
+      d_session_input_ + tokens.size(), encoder_->_p_d_token_id,
+      seq_len * sizeof(int), cudaMemcpyDeviceToDevice, stream_));
+  if (session != nullptr) {
+    encoder_->load_session_cache(session->device_data, prefix_len);
+  }
+  const int* input = encoder_->_p_d_token_id;
+  encoder_->_p_d_token_id = d_session_input_;
+  int sampled_seq_len;
+  try {
+    sampled_seq_len =
+        encoder_->run_session_sample(conversation_len, prefix_len);
+  } catch (...) {
+    encoder_->_p_d_token_id = input;
+    throw;
+  }
+  encoder_->_p_d_token_id = input;
+  stage_timer_.end_infer(stream_);
+  set_output_shape(0, {1, sampled_seq_len});
+
+  if (end) {
+    sessions_.erase(session_id);
+    return;
+  }
+  tokens.resize(sampled_seq_len);
+  CHECK_GPU_ERROR(cudaMemcpy(tokens.data(), encoder_->_p_d_sample_id,
+                             sampled_seq_len * sizeof(int),
+                             cudaMemcpyDeviceToHost));
+  // the last sampled token is encoded by the next turn
+  int cached_len = sampled_seq_len - 1;
+  session = sessions_.store(session_id, cached_len, std::move(tokens),
+                            encoder_->session_cache_bytes(cached_len),
+                            now_ms);
+  if (session != nullptr) {
+    encoder_->save_session_cache(session->device_data, cached_len);
+  }
+}
+
+bool Gpt::supports_sessions() const {
+  return tw_._sampling_method == "topk" || tw_._sampling_method == "topp";
+}
+
+void Gpt::set_session_config(const SessionCacheConfig& config) {
+  std::string err = config.check();
+  if (!err.empty()) {
+    throw std::runtime_error("session: " + err);
+  }
+  sessions_.set_config(config);
+}
+
 void Gpt::set_input_ptr(int index, void* input_ptr) {
   switch (index) {
     case 0:
@@ -204,5 +339,13 @@ DataType Gpt::get_output_dtype(int index) {
   }
 }
 
+void Gpt::set_logits_processor(const LogitsProcessorConfig& config) {
+  encoder_->set_logits_processor(config);
+}
+
+void Gpt::set_num_return_sequences(int n) {
+  encoder_->set_num_return_sequences(n);
+}
+
 }  // namespace cuda
 }  // namespace lightseq
@@ -20,16 +20,19 @@ class Gpt : public LSModel {
   std::shared_ptr<lightseq::cuda::GptEncoder<gpt_optype>> encoder_;
 
   int* d_input_;
+  int* d_session_input_;  // the conversation of InferSession
   int* d_sample_id;
   float* d_ppl;
   void* d_buf_;
 
   int _max_batch_size;
   cudaStream_t stream_;
+  CudaStageTimer stage_timer_;
   cudaStream_t cache_stream_;
   cublasHandle_t hd_;
   lightseq::cuda::GptWeight<gpt_optype> tw_;
   std::set<std::string> available_sampling_methods = {"topk", "topp"};
+  SessionCache sessions_;
 
  public:
   Gpt(const std::string weight_path, const int max_batch_size);
@@ -48,6 +51,12 @@ class Gpt : public LSModel {
   std::vector<int> get_output_max_shape(int index) override;
   DataType get_input_dtype(int index) override;
   DataType get_output_dtype(int index) override;
+  void *get_stream() override { return stream_; }
+  void set_logits_processor(const LogitsProcessorConfig& config) override;
+  void set_num_return_sequences(int n) override;
+  void InferSession(uint64_t session_id, bool start, bool end) override;
+  bool supports_sessions() const override;
+  void set_session_config(const SessionCacheConfig& config) override;
 };
 
 LSMODEL_REGISTER(Gpt);
@@ -1,11 +1,18 @@
 #ifndef MODEL_BASE_H
 #define MODEL_BASE_H
 
+#include <functional>
 #include <iostream>
 #include <map>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "../kernels/early_exit.h"
+#include "../kernels/logits_processor.h"
+#include "../tools/session_cache.h"
+#include "../tools/stage_profiler.h"
+
 namespace lightseq {
 namespace cuda {
 
@@ -63,6 +70,7 @@ class LSModel {
       : kInputNames(input_names), kOutputNames(output_names) {
     input_shapes_ = std::vector<std::vector<int>>(input_names.size());
     output_shapes_ = std::vector<std::vector<int>>(output_names.size());
+    infer_stage_ = profiler_.stage_id("infer");
   }
 
   virtual ~LSModel() {}
@@ -87,6 +95,116 @@ class LSModel {
   virtual std::vector<int> get_output_max_shape(int index) = 0;
   virtual DataType get_output_dtype(int index) = 0;
 
+  // the cudaStream_t Infer() runs on, inputs passed by device pointer should
+  // be ready on it. nullptr for the legacy default stream
+  virtual void* get_stream() { return nullptr; }
+
+  // per-stage latency profiling, off by default
+  void enable_profiling(bool enable) { profiler_.enable(enable); }
+  bool profiling_enabled() const { return profiler_.enabled(); }
+  std::map<std::string, StageStats> get_stage_stats() const {
+    return profiler_.stats();
+  }
+  std::string export_chrome_trace() const { return profiler_.chrome_trace(); }
+  void reset_profiling() { profiler_.reset(); }
+  StageProfiler* profiler() { return &profiler_; }
+
+  // logits processor chain of the generation models, see logits_processor.h
+  virtual void set_logits_processor(const LogitsProcessorConfig& config) {
+    throw std::runtime_error(
+        "logits processor is only supported by the generation models");
+  }
+
+  /* Infer num_batches batches. set_batch(i) sets the inputs of batch i,
+   * which should be ready on get_stream() and stay valid until the call
+   * returns. on_output(i) reads the outputs of batch i, they are overwritten
+   * by the next batch. Serial by default, see set_pipeline_depth */
+  virtual void InferBatches(int num_batches,
+                            const std::function<void(int)>& set_batch,
+                            const std::function<void(int)>& on_output) {
+    for (int i = 0; i < num_batches; i++) {
+      set_batch(i);
+      Infer();
+      on_output(i);
+    }
+  }
+
+  // overlap the encoder of the next batches with the decoder in
+  // InferBatches, see encdec_pipeline.h. 1 for serial
+  virtual void set_pipeline_depth(int depth) {
+    if (depth != 1) {
+      throw std::runtime_error(
+          "encoder-decoder pipeline is only supported by the Transformer "
+          "model");
+    }
+  }
+
+  /* Teacher-forced log probabilities of the targets [num_targets,
+   * trg_seq_len] given the sources [batch_size, src_seq_len], targets
+   * grouped by source, see sequence_scoring.h. Device pointers, the inputs
+   * should be ready on get_stream() */
+  virtual void Score(const int* d_source, int batch_size, int src_seq_len,
+                     const int* d_target, int num_targets, int trg_seq_len,
+                     float* d_token_log_prob, float* d_seq_log_prob) {
+    throw std::runtime_error(
+        "scoring is only supported by the Transformer model");
+  }
+
+  /* Infer with every request decoded into each of the target languages
+   * trg_lang_ids of a multilingual model, the encoder runs once per request.
+   * The outputs have a batch item per (request, target language), the
+   * languages of a request consecutive */
+  virtual void InferFanOut(const std::vector<int>& trg_lang_ids) {
+    throw std::runtime_error(
+        "fan-out is only supported by the multilingual Transformer model");
+  }
+
+  // sampled sequences per prompt of the following infers, the prompt runs
+  // once. The outputs have the n samples of a prompt consecutive
+  virtual void set_num_return_sequences(int n) {
+    if (n != 1) {
+      throw std::runtime_error(
+          "num_return_sequences is only supported by the Gpt model");
+    }
+  }
+
+  /* Sample the next turn of the conversation session_id, input 0 [1,
+   * seq_len] is the new turn. The model keeps the keys and values of the
+   * conversation between calls so that only the new turn is encoded, the
+   * output is the whole conversation. start begins a new conversation, end
+   * releases it after the call, see session_cache.h */
+  virtual void InferSession(uint64_t session_id, bool start, bool end) {
+    throw std::runtime_error("sessions are only supported by the Gpt model");
+  }
+
+  // InferSession can run, i.e. a Gpt model that samples
+  virtual bool supports_sessions() const { return false; }
+
+  // Infer returns the same outputs for the same inputs, the results can be
+  // cached, see result_cache.h
+  virtual bool deterministic() const { return false; }
+
+  // memory budget and ttl of the sessions, see session_cache.h
+  virtual void set_session_config(const SessionCacheConfig& config) {
+    throw std::runtime_error("sessions are only supported by the Gpt model");
+  }
+
+  // target vocab subset of the following infers, see lexical_shortlist.h
+  virtual void set_vocab_shortlist(const std::vector<int>& ids) {
+    throw std::runtime_error(
+        "vocab shortlist is only supported by the Transformer model");
+  }
+
+  // exit criterion of the classification, see early_exit.h
+  virtual void set_early_exit(const EarlyExitConfig& config) {
+    throw std::runtime_error("early exit is only supported by the Bert model");
+  }
+
+  // pooled output of the encoder, see pooling.h
+  virtual void set_pooling_mode(int mode) {
+    throw std::runtime_error("pooling is only supported by the Bert model");
+  }
+
  protected:
   void set_output_shape(int index, std::vector<int> shape) {
     output_shapes_.at(index) = std::move(shape);
@@ -95,6 +213,9 @@ class LSModel {
   const std::vector<std::string> kOutputNames;
   std::vector<std::vector<int>> input_shapes_;
   std::vector<std::vector<int>> output_shapes_;
+  StageProfiler profiler_;
+  // host time of a whole Infer()
+  int infer_stage_;
 };
 
 typedef LSModel* (*LSModelConstructor)(const std::string, const int);
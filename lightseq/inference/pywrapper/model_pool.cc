@@ -0,0 +1,36 @@
+#include "model_pool.h"
+
+#include <cuda_runtime.h>
+
+#include "../tools/util.h"
+
+namespace lightseq {
+namespace cuda {
+
+PoolMemory cuda_pool_memory() {
+  PoolMemory m;
+  m.malloc = [](size_t bytes) {
+    void *ptr;
+    CHECK_GPU_ERROR(cudaMalloc(&ptr, bytes));
+    return ptr;
+  };
+  m.free = [](void *ptr) { CHECK_GPU_ERROR(cudaFree(ptr)); };
+  // pageable host memory, the copy to device returns once the source is
+  // staged, so the request may free it
+  m.copy_to_device = [](void *dst, const void *src, size_t bytes,
+                        void *stream) {
+    CHECK_GPU_ERROR(cudaMemcpyAsync(dst, src, bytes, cudaMemcpyHostToDevice,
+                                    static_cast<cudaStream_t>(stream)));
+  };
+  m.copy_to_host = [](void *dst, const void *src, size_t bytes,
+                      void *stream) {
+    cudaStream_t s = static_cast<cudaStream_t>(stream);
+    CHECK_GPU_ERROR(
+        cudaMemcpyAsync(dst, src, bytes, cudaMemcpyDeviceToHost, s));
+    CHECK_GPU_ERROR(cudaStreamSynchronize(s));
+  };
+  return m;
+}
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,461 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "dlpack_tensor.h"
+#include "model_base.h"
+
+/**
+@file
+A pool of instances of a model serving concurrent callers. LSModel is not
+thread-safe: its inputs are set through set_input_ptr and set_input_shape and
+Infer() blocks, so every caller had to lock and pool the instances itself.
+
+  ModelPoolConfig config;
+  config.num_instances = 2;
+  ModelPool pool(
+      [&]() {
+        return LSModelFactory::GetInstance().CreateModel("Gpt", path, 8);
+      },
+      config, cuda_pool_memory());
+  std::future<std::vector<PoolTensor>> res =
+      pool.submit({PoolTensor::of<int>(kInt32, {1, 3}, {5, 6, 7})});
+
+submit() puts the request into a bounded lock-free queue and returns the
+future of its outputs. Every instance owns its input and output buffers,
+allocated for the max shapes, and a worker thread that pops the requests,
+copies the inputs in, runs Infer() on the stream of the instance and copies
+the outputs out. A failed request sets the exception of its future.
+
+With micro_batch, a worker also takes the queued requests whose inputs have
+the same shapes but for the batch dim, up to the max batch size of the model,
+runs them as one batch and splits the outputs by batch again. It does not
+wait for more requests. Only for the models whose inputs and outputs all
+lead with the batch dim, and a merged request may get longer padding than it
+would alone, e.g. the decoded length of a Transformer.
+
+The pool is CUDA-free, the device memory is behind PoolMemory so that it can
+be tested on host with a mock model. cuda_pool_memory() is the device one.
+*/
+namespace lightseq {
+namespace cuda {
+
+/* A host tensor, shape.size() == 0 for a scalar */
+struct PoolTensor {
+  DataType dtype = kInt32;
+  std::vector<int> shape;
+  std::vector<char> data;
+
+  size_t numel() const {
+    size_t res = 1;
+    for (int d : shape) res *= d;
+    return res;
+  }
+  size_t bytes() const { return numel() * data_type_bytes(dtype); }
+
+  template <typename T>
+  static PoolTensor of(DataType dtype, const std::vector<int> &shape,
+                       const std::vector<T> &values) {
+    PoolTensor res;
+    res.dtype = dtype;
+    res.shape = shape;
+    if (values.size() != res.numel() ||
+        sizeof(T) != (size_t)data_type_bytes(dtype)) {
+      throw std::runtime_error("values do not match the tensor shape");
+    }
+    res.data.resize(res.bytes());
+    memcpy(res.data.data(), values.data(), res.data.size());
+    return res;
+  }
+  template <typename T>
+  const T *as() const {
+    return reinterpret_cast<const T *>(data.data());
+  }
+};
+
+/* Memory of the pool. The copies are ordered with Infer() on the stream of
+ * the instance, copy_to_host returns once the bytes are on host */
+struct PoolMemory {
+  std::function<void *(size_t bytes)> malloc;
+  std::function<void(void *ptr)> free;
+  std::function<void(void *dst, const void *src, size_t bytes, void *stream)>
+      copy_to_device;
+  std::function<void(void *dst, const void *src, size_t bytes, void *stream)>
+      copy_to_host;
+};
+
+/* cudaMalloc and cudaMemcpyAsync on the stream of the instance, see
+ * model_pool.cc */
+PoolMemory cuda_pool_memory();
+
+struct ModelPoolConfig {
+  int num_instances = 1;
+  size_t queue_capacity = 1024;
+  bool micro_batch = false;
+
+  std::string check() const {
+    if (num_instances < 1) return "num_instances should be positive";
+    if (queue_capacity < 2) return "queue_capacity should be at least 2";
+    return "";
+  }
+};
+
+/**
+Bounded multi-producer multi-consumer queue, lock-free: every cell has a
+sequence number telling whether it is free for the push or ready for the pop
+of a given position (D. Vyukov's bounded MPMC queue). The capacity is rounded
+up to a power of 2.
+*/
+template <typename T>
+class MpmcQueue {
+ public:
+  explicit MpmcQueue(size_t capacity) {
+    size_t n = 2;
+    while (n < capacity) n *= 2;
+    mask_ = n - 1;
+    cells_.reset(new Cell[n]);
+    for (size_t i = 0; i < n; i++) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+    push_pos_.store(0, std::memory_order_relaxed);
+    pop_pos_.store(0, std::memory_order_relaxed);
+  }
+
+  /* False if the queue is full, value is then left unchanged */
+  bool try_push(T &value) {
+    size_t pos = push_pos_.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+      if (dif == 0) {
+        if (push_pos_.compare_exchange_weak(pos, pos + 1,
+                                            std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = push_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = std::move(value);
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /* False if the queue is empty */
+  bool try_pop(T *value) {
+    size_t pos = pop_pos_.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+      if (dif == 0) {
+        if (pop_pos_.compare_exchange_weak(pos, pos + 1,
+                                           std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = pop_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    *value = std::move(cell->value);
+    cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+
+  /* Exact when no push or pop is in flight */
+  size_t size_approx() const {
+    size_t push = push_pos_.load(std::memory_order_acquire);
+    size_t pop = pop_pos_.load(std::memory_order_acquire);
+    return push > pop ? push - pop : 0;
+  }
+  size_t capacity() const { return mask_ + 1; }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T value;
+  };
+  std::unique_ptr<Cell[]> cells_;
+  size_t mask_;
+  alignas(64) std::atomic<size_t> push_pos_;
+  alignas(64) std::atomic<size_t> pop_pos_;
+};
+
+class ModelPool {
+ public:
+  typedef std::vector<PoolTensor> Tensors;
+
+  /* create_model is called num_instances times on the calling thread */
+  ModelPool(const std::function<LSModel *()> &create_model,
+            const ModelPoolConfig &config, const PoolMemory &memory)
+      : config_(config), memory_(memory), queue_(config.queue_capacity) {
+    std::string res = config.check();
+    if (!res.empty()) throw std::runtime_error(res);
+    for (int i = 0; i < config.num_instances; i++) {
+      instances_.emplace_back(new Instance());
+      init_instance(instances_.back().get(), create_model());
+    }
+    for (auto &inst : instances_) {
+      Instance *p = inst.get();
+      p->worker = std::thread([this, p]() { work(p); });
+    }
+  }
+
+  /* Finishes the queued requests first */
+  ~ModelPool() {
+    {
+      std::lock_guard<std::mutex> lock(wake_mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto &inst : instances_) inst->worker.join();
+    for (auto &inst : instances_) {
+      for (void *ptr : inst->d_inputs) memory_.free(ptr);
+      for (void *ptr : inst->d_outputs) memory_.free(ptr);
+    }
+  }
+
+  /* Throws if the queue is full, the errors of the request itself are set on
+   * the future */
+  std::future<Tensors> submit(Tensors inputs) {
+    std::unique_ptr<Job> job(new Job());
+    job->inputs = std::move(inputs);
+    std::future<Tensors> res = job->result.get_future();
+    if (stop_) throw std::runtime_error("model pool is stopped");
+    if (!queue_.try_push(job)) {
+      throw std::runtime_error("model pool queue is full");
+    }
+    // the lock orders the push with the wait of an idle worker
+    { std::lock_guard<std::mutex> lock(wake_mutex_); }
+    wake_.notify_one();
+    return res;
+  }
+
+  int num_instances() const { return (int)instances_.size(); }
+  size_t queued() const { return queue_.size_approx(); }
+
+ private:
+  struct Job {
+    Tensors inputs;
+    std::promise<Tensors> result;
+  };
+
+  struct Instance {
+    std::unique_ptr<LSModel> model;
+    void *stream = nullptr;
+    std::vector<void *> d_inputs;
+    std::vector<void *> d_outputs;
+    std::vector<std::vector<int>> input_max_shapes;
+    // popped but not mergeable with the batch before it
+    std::unique_ptr<Job> held;
+    std::thread worker;
+  };
+
+  static size_t numel(const std::vector<int> &shape) {
+    size_t res = 1;
+    for (int d : shape) res *= d;
+    return res;
+  }
+
+  void init_instance(Instance *inst, LSModel *model) {
+    inst->model.reset(model);
+    inst->stream = model->get_stream();
+    for (int i = 0; i < model->get_input_size(); i++) {
+      inst->input_max_shapes.push_back(model->get_input_max_shape(i));
+      inst->d_inputs.push_back(
+          memory_.malloc(numel(inst->input_max_shapes.back()) *
+                         data_type_bytes(model->get_input_dtype(i))));
+    }
+    for (int i = 0; i < model->get_output_size(); i++) {
+      inst->d_outputs.push_back(
+          memory_.malloc(numel(model->get_output_max_shape(i)) *
+                         data_type_bytes(model->get_output_dtype(i))));
+      model->set_output_ptr(i, inst->d_outputs.back());
+    }
+  }
+
+  /* Next request of the worker, nullptr once stopped and drained */
+  std::unique_ptr<Job> next_job(Instance *inst) {
+    std::unique_ptr<Job> job = std::move(inst->held);
+    while (!job) {
+      if (queue_.try_pop(&job)) break;
+      std::unique_lock<std::mutex> lock(wake_mutex_);
+      wake_.wait(lock, [this]() { return stop_ || queue_.size_approx() > 0; });
+      if (stop_ && queue_.size_approx() == 0) return nullptr;
+    }
+    return job;
+  }
+
+  /* Batch dim of the request if it can run on the instance, throws if not */
+  int check_inputs(Instance *inst, const Tensors &inputs) {
+    LSModel *model = inst->model.get();
+    if ((int)inputs.size() != model->get_input_size()) {
+      throw std::runtime_error("expect " +
+                               std::to_string(model->get_input_size()) +
+                               " inputs, got " + std::to_string(inputs.size()));
+    }
+    for (int i = 0; i < (int)inputs.size(); i++) {
+      const PoolTensor &t = inputs[i];
+      const std::vector<int> &max_shape = inst->input_max_shapes[i];
+      std::string name = model->get_input_name(i);
+      if (t.dtype != model->get_input_dtype(i)) {
+        throw std::runtime_error("wrong data type of input " + name);
+      }
+      if (t.data.size() != t.bytes()) {
+        throw std::runtime_error("data size of input " + name +
+                                 " does not match its shape");
+      }
+      bool fits = t.shape.size() == max_shape.size() && !t.shape.empty();
+      for (size_t d = 0; fits && d < t.shape.size(); d++) {
+        fits = t.shape[d] > 0 && t.shape[d] <= max_shape[d];
+      }
+      if (!fits) {
+        throw std::runtime_error("shape of input " + name +
+                                 " exceeds its max shape");
+      }
+    }
+    return inputs[0].shape[0];
+  }
+
+  /* Whether b can run in one batch after a, same shapes but the batch dim */
+  static bool mergeable(const Tensors &a, const Tensors &b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+      if (a[i].dtype != b[i].dtype || a[i].shape.size() != b[i].shape.size() ||
+          a[i].shape.empty()) {
+        return false;
+      }
+      for (size_t d = 1; d < a[i].shape.size(); d++) {
+        if (a[i].shape[d] != b[i].shape[d]) return false;
+      }
+    }
+    return true;
+  }
+
+  void work(Instance *inst) {
+    for (;;) {
+      std::unique_ptr<Job> job = next_job(inst);
+      if (!job) return;
+      std::vector<std::unique_ptr<Job>> batch;
+      batch.push_back(std::move(job));
+      int max_batch = inst->input_max_shapes.empty() ||
+                              inst->input_max_shapes[0].empty()
+                          ? 1
+                          : inst->input_max_shapes[0][0];
+      int batch_size = 0;
+      if (config_.micro_batch) {
+        try {
+          batch_size = check_inputs(inst, batch[0]->inputs);
+        } catch (...) {
+          batch[0]->result.set_exception(std::current_exception());
+          continue;
+        }
+        std::unique_ptr<Job> more;
+        while (queue_.try_pop(&more)) {
+          int more_size;
+          try {
+            more_size = check_inputs(inst, more->inputs);
+          } catch (...) {
+            more->result.set_exception(std::current_exception());
+            continue;
+          }
+          if (!mergeable(batch[0]->inputs, more->inputs) ||
+              batch_size + more_size > max_batch) {
+            inst->held = std::move(more);
+            break;
+          }
+          batch_size += more_size;
+          batch.push_back(std::move(more));
+        }
+      }
+      run(inst, &batch);
+    }
+  }
+
+  /* Run the requests as one batch, concatenated along the batch dim */
+  void run(Instance *inst, std::vector<std::unique_ptr<Job>> *batch) {
+    try {
+      LSModel *model = inst->model.get();
+      int batch_size = 0;
+      for (auto &job : *batch) batch_size += check_inputs(inst, job->inputs);
+      for (int i = 0; i < model->get_input_size(); i++) {
+        char *dst = static_cast<char *>(inst->d_inputs[i]);
+        for (auto &job : *batch) {
+          const PoolTensor &t = job->inputs[i];
+          memory_.copy_to_device(dst, t.data.data(), t.data.size(),
+                                 inst->stream);
+          dst += t.data.size();
+        }
+        std::vector<int> shape = (*batch)[0]->inputs[i].shape;
+        shape[0] = batch_size;
+        model->set_input_ptr(i, inst->d_inputs[i]);
+        model->set_input_shape(i, shape);
+      }
+      model->Infer();
+
+      std::vector<Tensors> outputs(batch->size());
+      for (int i = 0; i < model->get_output_size(); i++) {
+        std::vector<int> shape = model->get_output_shape(i);
+        DataType dtype = model->get_output_dtype(i);
+        size_t row_bytes = 0;
+        if (batch->size() > 1) {
+          if (shape.empty() || shape[0] != batch_size) {
+            throw std::runtime_error("output " + model->get_output_name(i) +
+                                     " does not lead with the batch dim");
+          }
+          row_bytes = numel(shape) / shape[0] * data_type_bytes(dtype);
+        }
+        const char *src = static_cast<const char *>(model->get_output_ptr(i));
+        for (size_t j = 0; j < batch->size(); j++) {
+          PoolTensor t;
+          t.dtype = dtype;
+          t.shape = shape;
+          if (batch->size() > 1) t.shape[0] = (*batch)[j]->inputs[0].shape[0];
+          t.data.resize(batch->size() > 1 ? t.shape[0] * row_bytes
+                                          : t.bytes());
+          memory_.copy_to_host(t.data.data(), src, t.data.size(),
+                               inst->stream);
+          src += t.data.size();
+          outputs[j].push_back(std::move(t));
+        }
+      }
+      for (size_t j = 0; j < batch->size(); j++) {
+        (*batch)[j]->result.set_value(std::move(outputs[j]));
+      }
+    } catch (...) {
+      for (auto &job : *batch) {
+        job->result.set_exception(std::current_exception());
+      }
+    }
+  }
+
+  ModelPoolConfig config_;
+  PoolMemory memory_;
+  MpmcQueue<std::unique_ptr<Job>> queue_;
+  std::vector<std::unique_ptr<Instance>> instances_;
+  std::mutex wake_mutex_;
+  std::condition_variable wake_;
+  std::atomic<bool> stop_{false};
+};
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -10,7 +10,8 @@ Moe::Moe(const std::string weight_path, const int max_batch_size)
       stream_(nullptr),
       hd_(nullptr),
       decoder_(nullptr),
-      _max_batch_size(max_batch_size) {
+      _max_batch_size(max_batch_size),
+      stage_timer_(&profiler_) {
   /* ---step1. init environment--- */
   CHECK_GPU_ERROR(cudaStreamCreate(&stream_));
   CHECK_GPU_ERROR(cublasCreate(&hd_));
@@ -73,6 +74,8 @@ Moe::Moe(const std::string weight_path, const int max_batch_size)
   CHECK_GPU_ERROR(cudaMalloc(&d_buf_, buf_bytesize));
   encoder_->init_buffer(d_buf_);
   decoder_->init_buffer(d_buf_);
+  encoder_->set_stage_timer(&stage_timer_);
+  decoder_->set_stage_timer(&stage_timer_);
   CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
 }
 
@@ -93,6 +96,8 @@ const float *Moe::get_score_ptr() { return decoder_->_p_d_alive_seq_score; }
 int Moe::get_output_seq_len() { return decoder_->_cur_step + 1; };
 
 void Moe::Infer() {
+  HostStageScope infer_scope(&profiler_, infer_stage_);
+  stage_timer_.begin_infer(stream_);
   int batch_size = input_shapes_[0][0], seq_len = input_shapes_[0][1];
 
   // for multilg
@@ -114,6 +119,7 @@ void Moe::Infer() {
   decoder_->run_one_infer(batch_size, seq_len);
 
   CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
+  stage_timer_.end_infer(stream_);
 
   int output_seq_len = get_output_seq_len();
   int beam_size = tw_._beam_size;
@@ -31,6 +31,7 @@ class Moe : public LSModel {
   void *d_buf_;
   int _max_batch_size;
   cudaStream_t stream_;
+  CudaStageTimer stage_timer_;
   cublasHandle_t hd_;
   MoeWeight<moe_optytpe> tw_;
 
@@ -53,6 +54,7 @@ class Moe : public LSModel {
   std::vector<int> get_output_max_shape(int index) override;
   DataType get_input_dtype(int index) override;
   DataType get_output_dtype(int index) override;
+  void *get_stream() override { return stream_; }
 };
 
 LSMODEL_REGISTER(Moe);
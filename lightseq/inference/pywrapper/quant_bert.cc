@@ -5,7 +5,8 @@ namespace cuda {
 
 QuantBert::QuantBert(const std::string weight_path, const int max_batch_size)
     : LSModel({"token_ids"}, {"encoder_output"}),
-      _max_batch_size(max_batch_size) {
+      _max_batch_size(max_batch_size),
+      stage_timer_(&profiler_) {
   /* ---step1. init environment--- */
   CHECK_GPU_ERROR(cudaSetDevice(0));
   CHECK_GPU_ERROR(cudaStreamCreate(&stream_));
@@ -47,6 +48,7 @@ QuantBert::QuantBert(const std::string weight_path, const int max_batch_size)
   }
 
   encoder_->init_buffer();
+  encoder_->set_stage_timer(&stage_timer_);
   CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
 }
 
@@ -59,9 +61,12 @@ QuantBert::~QuantBert() {
 }
 
 void QuantBert::Infer() {
+  HostStageScope infer_scope(&profiler_, infer_stage_);
+  stage_timer_.begin_infer(stream_);
   int batch_size = input_shapes_[0][0], seq_len = input_shapes_[0][1];
   encoder_->run_one_infer(batch_size, seq_len);
   CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
+  stage_timer_.end_infer(stream_);
   set_output_shape(0, {batch_size, seq_len, tw_._hidden_size});
 }
 
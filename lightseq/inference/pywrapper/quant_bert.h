@@ -24,6 +24,7 @@ class QuantBert : public LSModel {
   int *d_padding_mask_;
   int _max_batch_size;
   cudaStream_t stream_;
+  CudaStageTimer stage_timer_;
   cublasHandle_t hd_;
   QuantBertWeight<bert_optype> tw_;
 
@@ -40,6 +41,7 @@ class QuantBert : public LSModel {
   std::vector<int> get_output_max_shape(int index) override;
   DataType get_input_dtype(int index) override;
   DataType get_output_dtype(int index) override;
+  void *get_stream() override { return stream_; }
 };
 
 LSMODEL_REGISTER(QuantBert);
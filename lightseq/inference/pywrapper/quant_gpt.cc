@@ -8,7 +8,8 @@ QuantGpt::QuantGpt(const std::string weight_path, const int max_batch_size)
       stream_(nullptr),
       hd_(nullptr),
       encoder_(nullptr),
-      _max_batch_size(max_batch_size) {
+      _max_batch_size(max_batch_size),
+      stage_timer_(&profiler_) {
   /* ---step1. init environment--- */
   CHECK_GPU_ERROR(cudaSetDevice(0));
   CHECK_GPU_ERROR(cudaStreamCreate(&stream_));
@@ -46,6 +47,7 @@ QuantGpt::QuantGpt(const std::string weight_path, const int max_batch_size)
   }
 
   encoder_->init_buffer();
+  encoder_->set_stage_timer(&stage_timer_);
   CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
 }
 
@@ -62,15 +64,19 @@ const int* QuantGpt::get_result_ptr() { return d_sample_id; }
 const float* QuantGpt::get_score_ptr() { return d_ppl; }
 
 void QuantGpt::Infer() {
+  HostStageScope infer_scope(&profiler_, infer_stage_);
+  stage_timer_.begin_infer(stream_);
   int batch_size = input_shapes_[0][0], seq_len = input_shapes_[0][1];
 
   if (tw_._sampling_method == "ppl") {
     encoder_->run_one_infer(batch_size, seq_len);
     CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
+    stage_timer_.end_infer(stream_);
     set_output_shape(0, {batch_size});
   } else if (tw_._sampling_method == "topk" || tw_._sampling_method == "topp") {
     int sampled_seq_len = encoder_->run_one_sample(batch_size, seq_len);
     CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
+    stage_timer_.end_infer(stream_);
     set_output_shape(0, {batch_size, sampled_seq_len});
   } else {
     throw std::runtime_error("Unsupported sampling_method");
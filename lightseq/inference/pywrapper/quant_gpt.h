@@ -26,6 +26,7 @@ class QuantGpt : public LSModel {
   int _max_batch_size;
   cudaStream_t stream_;
   cudaStream_t cache_stream_;
+  CudaStageTimer stage_timer_;
   cublasHandle_t hd_;
   lightseq::cuda::QuantGptWeight<gpt_optype> tw_;
   std::set<std::string> available_sampling_methods = {"topk", "topp"};
@@ -47,6 +48,7 @@ class QuantGpt : public LSModel {
   std::vector<int> get_output_max_shape(int index) override;
   DataType get_input_dtype(int index) override;
   DataType get_output_dtype(int index) override;
+  void *get_stream() override { return stream_; }
 };
 
 LSMODEL_REGISTER(QuantGpt);
@@ -11,7 +11,8 @@ QuantTransformer::QuantTransformer(const std::string weight_path,
       stream_(nullptr),
       hd_(nullptr),
       decoder_(nullptr),
-      _max_batch_size(max_batch_size) {
+      _max_batch_size(max_batch_size),
+      stage_timer_(&profiler_) {
   /* ---step1. init environment--- */
   CHECK_GPU_ERROR(cudaStreamCreate(&stream_));
   CHECK_GPU_ERROR(cublasCreate(&hd_));
@@ -67,6 +68,8 @@ QuantTransformer::QuantTransformer(const std::string weight_path,
 
   encoder_->init_buffer();
   decoder_->init_buffer();
+  encoder_->set_stage_timer(&stage_timer_);
+  decoder_->set_stage_timer(&stage_timer_);
   CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
 }
 
@@ -88,6 +91,7 @@ const float *QuantTransformer::get_score_ptr() {
 int QuantTransformer::get_output_seq_len() { return decoder_->_cur_step + 1; };
 
 void QuantTransformer::Infer() {
+  HostStageScope infer_scope(&profiler_, infer_stage_);
   int batch_size = input_shapes_[0][0], seq_len = input_shapes_[0][1];
 
   // for multilg
@@ -95,10 +99,12 @@ void QuantTransformer::Infer() {
     throw std::runtime_error("multilingle not supported");
   }
 
+  stage_timer_.begin_infer(stream_);
   encoder_->run_one_infer(batch_size, seq_len);
   decoder_->run_one_infer(batch_size, seq_len);
 
   CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
+  stage_timer_.end_infer(stream_);
 
   int output_seq_len = get_output_seq_len();
   int beam_size = tw_._beam_size;
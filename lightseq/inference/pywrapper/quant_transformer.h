@@ -30,6 +30,7 @@ class QuantTransformer : public LSModel {
   int *d_padding_mask_;
   int _max_batch_size;
   cudaStream_t stream_;
+  CudaStageTimer stage_timer_;
   cublasHandle_t hd_;
   QuantTransformerWeight<qtransformer_optytpe> tw_;
 
@@ -52,6 +53,7 @@ class QuantTransformer : public LSModel {
   std::vector<int> get_output_max_shape(int index);
   DataType get_input_dtype(int index);
   DataType get_output_dtype(int index);
+  void *get_stream() { return stream_; }
 };
 
 LSMODEL_REGISTER(QuantTransformer);
@@ -11,7 +11,14 @@ Transformer::Transformer(const std::string weight_path,
       stream_(nullptr),
       hd_(nullptr),
       decoder_(nullptr),
-      _max_batch_size(max_batch_size) {
+      _max_batch_size(max_batch_size),
+      stage_timer_(&profiler_),
+      processor_samples_(false),
+      pipeline_depth_(1),
+      enc_stream_(nullptr),
+      enc_hd_(nullptr),
+      d_enc_buf_(nullptr),
+      input_ready_(nullptr) {
   /* ---step1. init environment--- */
   CHECK_GPU_ERROR(cudaStreamCreate(&stream_));
   CHECK_GPU_ERROR(cublasCreate(&hd_));
@@ -80,6 +87,8 @@ Transformer::Transformer(const std::string weight_path,
   CHECK_GPU_ERROR(cudaMalloc(&d_buf_, buf_bytesize));
   encoder_->init_buffer(d_buf_);
   decoder_->init_buffer(d_buf_);
+  encoder_->set_stage_timer(&stage_timer_);
+  decoder_->set_stage_timer(&stage_timer_);
   CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
 }
 
@@ -90,6 +99,21 @@ Transformer::~Transformer() {
   CHECK_GPU_ERROR(cudaFree(d_buf_));
   CHECK_GPU_ERROR(cudaFree(d_src_lang_id_));
   CHECK_GPU_ERROR(cudaFree(d_trg_lang_id_));
+  for (EncoderSlot &slot : slots_) {
+    CHECK_GPU_ERROR(cudaFree(slot.d_input));
+    CHECK_GPU_ERROR(cudaFree(slot.d_padding_mask));
+    CHECK_GPU_ERROR(cudaFree(slot.d_src_lang_id));
+    CHECK_GPU_ERROR(cudaFree(slot.d_trg_lang_id));
+    CHECK_GPU_ERROR(cudaFree(slot.d_encoder_output));
+    CHECK_GPU_ERROR(cudaEventDestroy(slot.encoded));
+    CHECK_GPU_ERROR(cudaEventDestroy(slot.freed));
+  }
+  if (enc_stream_ != nullptr) {
+    CHECK_GPU_ERROR(cudaFree(d_enc_buf_));
+    CHECK_GPU_ERROR(cudaEventDestroy(input_ready_));
+    CHECK_GPU_ERROR(cublasDestroy(enc_hd_));
+    CHECK_GPU_ERROR(cudaStreamDestroy(enc_stream_));
+  }
   CHECK_GPU_ERROR(cudaStreamDestroy(stream_));
 }
 
@@ -102,27 +126,23 @@ const float *Transformer::get_score_ptr() {
 int Transformer::get_output_seq_len() { return decoder_->_cur_step + 1; };
 
 void Transformer::Infer() {
+  HostStageScope infer_scope(&profiler_, infer_stage_);
+  stage_timer_.begin_infer(stream_);
   int batch_size = input_shapes_[0][0], seq_len = input_shapes_[0][1];
 
   // for multilg
   if (tw_._multilg_type != 0) {
-    // multilg request: src_lang_id, trg_lang_id, src_token0, src_token1...
-    launch_split_multilg_request(encoder_->_p_d_token_id, d_src_lang_id_,
-                                 d_trg_lang_id_, d_input_, batch_size, seq_len,
-                                 stream_);
+    seq_len = split_multilg_request(encoder_->_p_d_token_id, d_input_,
+                                    d_src_lang_id_, d_trg_lang_id_,
+                                    batch_size, seq_len, stream_);
     encoder_->_p_d_token_id = d_input_;
-    if (tw_._multilg_type == 1) {
-      seq_len -= 2;
-    }
-    if (tw_._multilg_type == 2 || tw_._multilg_type == 3) {
-      seq_len -= 1;
-    }
   }
 
   encoder_->run_one_infer(batch_size, seq_len);
   decoder_->run_one_infer(batch_size, seq_len);
 
   CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
+  stage_timer_.end_infer(stream_);
 
   int output_seq_len = get_output_seq_len();
   int beam_size = tw_._beam_size;
@@ -132,6 +152,226 @@ void Transformer::Infer() {
   set_output_shape(1, {batch_size, output_k});
 }
 
+/**
+Encode the requests once and decode each of them into every target language,
+the trg lang ids of the requests are ignored. The decoder batch items of a
+request share its encoder output and padding mask, see Decoder::set_fan_out
+*/
+void Transformer::InferFanOut(const std::vector<int> &trg_lang_ids) {
+  if (tw_._multilg_type == 0) {
+    throw std::runtime_error("fan-out: only for the multilingual models");
+  }
+  // the encoder of type 3 reads the target language
+  if (tw_._multilg_type == 3) {
+    throw std::runtime_error("fan-out: not supported by multilg_type 3");
+  }
+  int batch_size = input_shapes_[0][0], seq_len = input_shapes_[0][1];
+  int fan_out = trg_lang_ids.size();
+  if (fan_out == 0) {
+    throw std::runtime_error("fan-out: no target language");
+  }
+  if (batch_size * fan_out > _max_batch_size) {
+    throw std::runtime_error(
+        "fan-out: batch size * target languages exceeds max batch size");
+  }
+  HostStageScope infer_scope(&profiler_, infer_stage_);
+  stage_timer_.begin_infer(stream_);
+
+  seq_len = split_multilg_request(encoder_->_p_d_token_id, d_input_,
+                                  d_src_lang_id_, d_trg_lang_id_, batch_size,
+                                  seq_len, stream_);
+  encoder_->_p_d_token_id = d_input_;
+  encoder_->run_one_infer(batch_size, seq_len);
+
+  std::vector<int> h_trg_lang_id(batch_size * fan_out);
+  for (int i = 0; i < batch_size; i++) {
+    std::copy(trg_lang_ids.begin(), trg_lang_ids.end(),
+              h_trg_lang_id.begin() + i * fan_out);
+  }
+  CHECK_GPU_ERROR(cudaMemcpyAsync(d_trg_lang_id_, h_trg_lang_id.data(),
+                                  h_trg_lang_id.size() * sizeof(int),
+                                  cudaMemcpyHostToDevice, stream_));
+  decoder_->set_fan_out(fan_out);
+  try {
+    decoder_->run_one_infer(batch_size * fan_out, seq_len);
+  } catch (...) {
+    decoder_->set_fan_out(1);
+    throw;
+  }
+  decoder_->set_fan_out(1);
+
+  CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
+  stage_timer_.end_infer(stream_);
+
+  int output_seq_len = get_output_seq_len();
+  int output_k = decoder_->_output_topk ? tw_._beam_size : 1;
+  set_output_shape(0, {batch_size * fan_out, output_k, output_seq_len});
+  set_output_shape(1, {batch_size * fan_out, output_k});
+}
+
+/**
+Teacher-forced scoring, the encoder runs once on the sources and the
+decoder on all the positions of their targets, see sequence_scoring.h
+*/
+void Transformer::Score(const int *d_source, int batch_size, int src_seq_len,
+                        const int *d_target, int num_targets, int trg_seq_len,
+                        float *d_token_log_prob, float *d_seq_log_prob) {
+  if (tw_._multilg_type != 0) {
+    throw std::runtime_error(
+        "scoring: not supported by the multilingual models");
+  }
+  HostStageScope infer_scope(&profiler_, infer_stage_);
+  stage_timer_.begin_infer(stream_);
+  int *input = encoder_->_p_d_token_id;
+  encoder_->_p_d_token_id = const_cast<int *>(d_source);
+  try {
+    encoder_->run_one_infer(batch_size, src_seq_len);
+    decoder_->run_score(batch_size, src_seq_len, d_target, num_targets,
+                        trg_seq_len, d_token_log_prob, d_seq_log_prob);
+  } catch (...) {
+    encoder_->_p_d_token_id = input;
+    throw;
+  }
+  encoder_->_p_d_token_id = input;
+  CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
+  stage_timer_.end_infer(stream_);
+}
+
+/**
+Split the lang ids from a multilg request, return the seq len of the source
+tokens
+*/
+int Transformer::split_multilg_request(const int *request, int *d_input,
+                                       int *d_src_lang_id, int *d_trg_lang_id,
+                                       int batch_size, int seq_len,
+                                       cudaStream_t stream) {
+  // multilg request: src_lang_id, trg_lang_id, src_token0, src_token1...
+  launch_split_multilg_request(request, d_src_lang_id, d_trg_lang_id, d_input,
+                               batch_size, seq_len, stream);
+  if (tw_._multilg_type == 1) {
+    seq_len -= 2;
+  }
+  if (tw_._multilg_type == 2 || tw_._multilg_type == 3) {
+    seq_len -= 1;
+  }
+  return seq_len;
+}
+
+void Transformer::set_pipeline_depth(int depth) {
+  if (depth < 1) {
+    throw std::runtime_error("pipeline depth should be at least 1");
+  }
+  if (depth > 1 && enc_stream_ == nullptr) {
+    // not ordered with the legacy default stream, so that the host copies
+    // of the outputs do not wait the encoders of the next batches
+    CHECK_GPU_ERROR(
+        cudaStreamCreateWithFlags(&enc_stream_, cudaStreamNonBlocking));
+    CHECK_GPU_ERROR(cublasCreate(&enc_hd_));
+    CHECK_GPU_ERROR(cublasSetStream(enc_hd_, enc_stream_));
+    CHECK_GPU_ERROR(
+        cudaEventCreateWithFlags(&input_ready_, cudaEventDisableTiming));
+    // the encoders of the slots run one by one on the encoder stream
+    CHECK_GPU_ERROR(
+        cudaMalloc(&d_enc_buf_, encoder_->compute_buffer_bytesize()));
+  }
+  while ((int)slots_.size() < depth) {
+    EncoderSlot slot;
+    int max_token_num = _max_batch_size * tw_._max_step;
+    CHECK_GPU_ERROR(cudaMalloc(&slot.d_input, max_token_num * sizeof(int)));
+    CHECK_GPU_ERROR(
+        cudaMalloc(&slot.d_padding_mask, max_token_num * sizeof(int)));
+    CHECK_GPU_ERROR(
+        cudaMalloc(&slot.d_src_lang_id, _max_batch_size * sizeof(int)));
+    CHECK_GPU_ERROR(
+        cudaMalloc(&slot.d_trg_lang_id, _max_batch_size * sizeof(int)));
+    CHECK_GPU_ERROR(cudaMalloc(
+        &slot.d_encoder_output,
+        max_token_num * tw_._hidden_size * sizeof(optraits::DataType)));
+    CHECK_GPU_ERROR(
+        cudaEventCreateWithFlags(&slot.encoded, cudaEventDisableTiming));
+    CHECK_GPU_ERROR(
+        cudaEventCreateWithFlags(&slot.freed, cudaEventDisableTiming));
+    slot.encoder = std::make_shared<Encoder<transformer_optytpe>>(
+        _max_batch_size, slot.d_input, slot.d_padding_mask,
+        slot.d_encoder_output, tw_, enc_stream_, enc_hd_,
+        tw_._multilg_type < 3 ? slot.d_src_lang_id : slot.d_trg_lang_id);
+    slot.encoder->init_buffer(d_enc_buf_);
+    slot.encoder->set_stage_timer(&stage_timer_);
+    slot.batch_size = 0;
+    slot.seq_len = 0;
+    slots_.push_back(slot);
+  }
+  pipeline_depth_ = depth;
+}
+
+/**
+Encode the batch of the current inputs into a slot on the encoder stream,
+after the decoder is done with the previous batch of the slot
+*/
+void Transformer::encode_slot(EncoderSlot &slot) {
+  int batch_size = input_shapes_[0][0], seq_len = input_shapes_[0][1];
+  int *request = encoder_->_p_d_token_id;
+  CHECK_GPU_ERROR(cudaEventRecord(input_ready_, stream_));
+  CHECK_GPU_ERROR(cudaStreamWaitEvent(enc_stream_, input_ready_, 0));
+  CHECK_GPU_ERROR(cudaStreamWaitEvent(enc_stream_, slot.freed, 0));
+  if (tw_._multilg_type != 0) {
+    seq_len = split_multilg_request(request, slot.d_input, slot.d_src_lang_id,
+                                    slot.d_trg_lang_id, batch_size, seq_len,
+                                    enc_stream_);
+    request = slot.d_input;
+  }
+  slot.encoder->_p_d_token_id = request;
+  slot.encoder->run_one_infer(batch_size, seq_len);
+  CHECK_GPU_ERROR(cudaEventRecord(slot.encoded, enc_stream_));
+  slot.batch_size = batch_size;
+  slot.seq_len = seq_len;
+}
+
+/**
+Decode the batch of a slot on the decoder stream, then free the slot
+*/
+void Transformer::decode_slot(EncoderSlot &slot) {
+  CHECK_GPU_ERROR(cudaStreamWaitEvent(stream_, slot.encoded, 0));
+  decoder_->set_encoder_output(slot.d_padding_mask, slot.d_encoder_output);
+  decoder_->_p_d_lang_id = slot.d_trg_lang_id;
+  decoder_->run_one_infer(slot.batch_size, slot.seq_len);
+  CHECK_GPU_ERROR(cudaEventRecord(slot.freed, stream_));
+  CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
+
+  int output_k = decoder_->_output_topk ? tw_._beam_size : 1;
+  set_output_shape(0, {slot.batch_size, output_k, get_output_seq_len()});
+  set_output_shape(1, {slot.batch_size, output_k});
+}
+
+void Transformer::InferBatches(int num_batches,
+                               const std::function<void(int)> &set_batch,
+                               const std::function<void(int)> &on_output) {
+  if (pipeline_depth_ == 1) {
+    LSModel::InferBatches(num_batches, set_batch, on_output);
+    return;
+  }
+  HostStageScope infer_scope(&profiler_, infer_stage_);
+  stage_timer_.begin_infer(stream_);
+  int *input = encoder_->_p_d_token_id;
+  EncDecPipeline pipeline(pipeline_depth_);
+  pipeline.run(
+      num_batches,
+      [&](int batch, int slot) {
+        set_batch(batch);
+        encode_slot(slots_[slot]);
+      },
+      [&](int batch, int slot) {
+        decode_slot(slots_[slot]);
+        on_output(batch);
+      });
+  // restore the buffers of Infer()
+  encoder_->_p_d_token_id = input;
+  decoder_->set_encoder_output(d_padding_mask_, d_encoder_output_);
+  decoder_->_p_d_lang_id = d_trg_lang_id_;
+  CHECK_GPU_ERROR(cudaStreamSynchronize(enc_stream_));
+  stage_timer_.end_infer(stream_);
+}
+
 void Transformer::set_input_ptr(int index, void *input_ptr) {
   switch (index) {
     case 0:
@@ -231,5 +471,23 @@ DataType Transformer::get_output_dtype(int index) {
   }
 }
 
+void Transformer::set_logits_processor(const LogitsProcessorConfig& config) {
+  decoder_->set_logits_processor(config);
+  processor_samples_ = config.samples();
+}
+
+/**
+Beam search and greedy decoding, unless the logits processor samples
+*/
+bool Transformer::deterministic() const {
+  return (tw_._sampling_method == "beam_search" ||
+          tw_._sampling_method == "topk_greedy") &&
+         !processor_samples_;
+}
+
+void Transformer::set_vocab_shortlist(const std::vector<int>& ids) {
+  decoder_->set_vocab_shortlist(ids);
+}
+
 }  // namespace cuda
 }  // namespace lightseq
@@ -3,6 +3,7 @@
 #include "model_base.h"
 #include "../model/decoder.h"
 #include "../model/encoder.h"
+#include "../model/encdec_pipeline.h"
 #include "../proto/transformer_weight.h"
 #include "../tools/util.h"
 
@@ -31,8 +32,38 @@ class Transformer : public LSModel {
   void *d_buf_;
   int _max_batch_size;
   cudaStream_t stream_;
+  CudaStageTimer stage_timer_;
   cublasHandle_t hd_;
   TransformerWeight<transformer_optytpe> tw_;
+  bool processor_samples_;  // see deterministic()
+
+  // encoder-decoder pipeline of InferBatches, the encoders of the slots
+  // run on their own stream and buffer, see encdec_pipeline.h
+  struct EncoderSlot {
+    std::shared_ptr<Encoder<transformer_optytpe>> encoder;
+    int *d_input;
+    int *d_padding_mask;
+    int *d_src_lang_id;
+    int *d_trg_lang_id;
+    optraits::DataType *d_encoder_output;
+    cudaEvent_t encoded;
+    cudaEvent_t freed;
+    int batch_size;
+    int seq_len;
+  };
+  int pipeline_depth_;
+  cudaStream_t enc_stream_;
+  cublasHandle_t enc_hd_;
+  void *d_enc_buf_;
+  cudaEvent_t input_ready_;
+  std::vector<EncoderSlot> slots_;
+
+  int split_multilg_request(const int *request, int *d_input,
+                            int *d_src_lang_id, int *d_trg_lang_id,
+                            int batch_size, int seq_len,
+                            cudaStream_t stream);
+  void encode_slot(EncoderSlot &slot);
+  void decode_slot(EncoderSlot &slot);
 
   int get_output_seq_len();
 
@@ -46,6 +77,9 @@ class Transformer : public LSModel {
   ~Transformer();
 
   void Infer() override;
+  void InferBatches(int num_batches, const std::function<void(int)> &set_batch,
+                    const std::function<void(int)> &on_output) override;
+  void set_pipeline_depth(int depth) override;
   void set_input_ptr(int index, void *input_ptr) override;
   void set_output_ptr(int index, void *output_ptr) override;
   const void *get_output_ptr(int index) override;
@@ -53,6 +87,14 @@ class Transformer : public LSModel {
   std::vector<int> get_output_max_shape(int index) override;
   DataType get_input_dtype(int index) override;
   DataType get_output_dtype(int index) override;
+  void *get_stream() override { return stream_; }
+  void set_logits_processor(const LogitsProcessorConfig& config) override;
+  bool deterministic() const override;
+  void set_vocab_shortlist(const std::vector<int>& ids) override;
+  void Score(const int *d_source, int batch_size, int src_seq_len,
+             const int *d_target, int num_targets, int trg_seq_len,
+             float *d_token_log_prob, float *d_seq_log_prob) override;
+  void InferFanOut(const std::vector<int> &trg_lang_ids) override;
 };
 
 LSMODEL_REGISTER(Transformer);
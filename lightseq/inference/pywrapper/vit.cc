@@ -5,7 +5,8 @@ namespace cuda {
 
 Vit::Vit(const std::string weight_path, const int max_batch_size)
     : LSModel({"pixel_values"}, {"encoder_output"}),
-      _max_batch_size(max_batch_size) {
+      _max_batch_size(max_batch_size),
+      stage_timer_(&profiler_) {
   /* ---step1. init environment--- */
   CHECK_GPU_ERROR(cudaSetDevice(0));
   CHECK_GPU_ERROR(cudaStreamCreate(&stream_));
@@ -53,6 +54,7 @@ Vit::Vit(const std::string weight_path, const int max_batch_size)
   // encoder and decoder use the same buffer to save gpu memory useage
   CHECK_GPU_ERROR(cudaMalloc(&d_buf_, (size_t)buf_bytesize));
   encoder_->init_buffer(d_buf_);
+  encoder_->set_stage_timer(&stage_timer_);
   CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
 }
 
@@ -66,9 +68,12 @@ Vit::~Vit() {
 }
 
 void Vit::Infer() {
+  HostStageScope infer_scope(&profiler_, infer_stage_);
+  stage_timer_.begin_infer(stream_);
   int batch_size = input_shapes_[0][0];
   encoder_->run_one_infer(batch_size);
   CHECK_GPU_ERROR(cudaStreamSynchronize(stream_));
+  stage_timer_.end_infer(stream_);
   set_output_shape(0, {batch_size, tw_._max_step, tw_._hidden_size});
 }
 
@@ -2,8 +2,17 @@
 #include <cuda_fp16.h>
 #include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
+#include <pybind11/stl.h>
 
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include "dlpack_tensor.h"
 #include "model_base.h"
+#include "../kernels/pooling.h"
+#include "../tools/lexical_shortlist.h"
+#include "../tools/result_cache.h"
 #include "util.h"
 #include "transformer_decoder.cc.cu"
 
@@ -14,9 +23,16 @@ class PyTransformer {
   lightseq::cuda::LSModel *model_;
   int *d_input_;
   std::vector<void *> d_outputs_;
+  // exact-match results of infer, see result_cache.h
+  std::unique_ptr<lightseq::cuda::ResultCache> result_cache_;
+  std::string model_id_;
+  // the decoding settings by name, they are part of the cache key
+  std::map<std::string, std::string> generation_config_;
+  int cache_padding_id_ = -1;
 
  public:
-  PyTransformer(std::string weight_path, int max_batch_size) {
+  PyTransformer(std::string weight_path, int max_batch_size)
+      : model_id_(weight_path) {
     model_ = lightseq::cuda::LSModelFactory::GetInstance().CreateModel(
         "Transformer", weight_path, max_batch_size);
     std::vector<int> max_input_shape = model_->get_input_max_shape(0);
@@ -37,6 +53,8 @@ class PyTransformer {
       d_outputs_.push_back(d_output);
     }
   }
+  lightseq::cuda::LSModel *get_model() { return model_; }
+
   ~PyTransformer() {
     delete model_;
     lightseq::cuda::CHECK_GPU_ERROR(cudaFree(d_input_));
@@ -52,6 +70,11 @@ class PyTransformer {
     int batch_size = input_seq_out.shape(0);
     int batch_seq_len = input_seq_out.shape(1);
 
+    // a sampled result would be returned again for every repeat
+    if (result_cache_ && model_->deterministic()) {
+      return infer_cached(input_seq_data, batch_size, batch_seq_len);
+    }
+
     lightseq::cuda::CHECK_GPU_ERROR(
         cudaMemcpy(d_input_, input_seq_data, sizeof(int) * input_seq_out.size(),
                    cudaMemcpyHostToDevice));
@@ -60,7 +83,208 @@ class PyTransformer {
     model_->set_input_shape(0, {batch_size, batch_seq_len});
 
     model_->Infer();
+    return fetch_outputs();
+  }
+
+  /* Enable the result cache of infer, 0 bytes disables it. Rows are keyed
+   * without their trailing padding_id, -1 keys them as given */
+  void set_result_cache(size_t capacity_bytes, int num_shards,
+                        bool admission, int padding_id) {
+    if (capacity_bytes == 0) {
+      result_cache_.reset();
+      return;
+    }
+    lightseq::cuda::ResultCacheConfig config;
+    config.capacity_bytes = capacity_bytes;
+    config.num_shards = num_shards;
+    config.admission = admission;
+    result_cache_.reset(new lightseq::cuda::ResultCache(config));
+    cache_padding_id_ = padding_id;
+  }
+
+  lightseq::cuda::ResultCacheStats result_cache_stats() {
+    if (!result_cache_) return lightseq::cuda::ResultCacheStats();
+    return result_cache_->stats();
+  }
+
+  void set_generation_config(const std::string &name,
+                             const std::string &value) {
+    generation_config_[name] = value;
+  }
+
+  // Decode every request of a multilingual model into each of the target
+  // languages, the encoder runs once per request. Output batch item
+  // i * len(trg_lang_ids) + j is request i in language trg_lang_ids[j]
+  std::tuple<py::array_t<int>, py::array_t<float>> infer_fan_out(
+      py::array_t<int, py::array::c_style | py::array::forcecast> input_seq,
+      const std::vector<int> &trg_lang_ids) {
+    auto input_seq_out = input_seq.mutable_unchecked<2>();
+    const int *input_seq_data = input_seq_out.data(0, 0);
+    int batch_size = input_seq_out.shape(0);
+    int batch_seq_len = input_seq_out.shape(1);
+
+    lightseq::cuda::CHECK_GPU_ERROR(
+        cudaMemcpy(d_input_, input_seq_data, sizeof(int) * input_seq_out.size(),
+                   cudaMemcpyHostToDevice));
+
+    model_->set_input_ptr(0, d_input_);
+    model_->set_input_shape(0, {batch_size, batch_seq_len});
+
+    model_->InferFanOut(trg_lang_ids);
+    return fetch_outputs();
+  }
+
+  // Infer several batches, the encoder of the next batches overlaps the
+  // decoder with set_pipeline_depth > 1
+  std::vector<std::tuple<py::array_t<int>, py::array_t<float>>> infer_batches(
+      const std::vector<
+          py::array_t<int, py::array::c_style | py::array::forcecast>>
+          &input_seqs) {
+    // upload all the batches first, the encoders read them while the earlier
+    // batches are decoding
+    std::vector<size_t> offsets = {0};
+    for (const auto &input_seq : input_seqs) {
+      if (input_seq.ndim() != 2) {
+        throw std::runtime_error("input_seq should be [batch_size, seq_len]");
+      }
+      offsets.push_back(offsets.back() + input_seq.size());
+    }
+    int *d_inputs;
+    lightseq::cuda::CHECK_GPU_ERROR(cudaMalloc(
+        &d_inputs, sizeof(int) * std::max<size_t>(offsets.back(), 1)));
+    for (size_t i = 0; i < input_seqs.size(); i++) {
+      lightseq::cuda::CHECK_GPU_ERROR(cudaMemcpy(
+          d_inputs + offsets[i], input_seqs[i].data(),
+          sizeof(int) * input_seqs[i].size(), cudaMemcpyHostToDevice));
+    }
+
+    std::vector<std::tuple<py::array_t<int>, py::array_t<float>>> results;
+    try {
+      model_->InferBatches(
+          input_seqs.size(),
+          [&](int i) {
+            model_->set_input_ptr(0, d_inputs + offsets[i]);
+            model_->set_input_shape(0, {(int)input_seqs[i].shape(0),
+                                        (int)input_seqs[i].shape(1)});
+          },
+          [&](int i) { results.push_back(fetch_outputs()); });
+    } catch (...) {
+      lightseq::cuda::CHECK_GPU_ERROR(cudaFree(d_inputs));
+      model_->set_input_ptr(0, d_input_);
+      throw;
+    }
+    lightseq::cuda::CHECK_GPU_ERROR(cudaFree(d_inputs));
+    model_->set_input_ptr(0, d_input_);
+    return results;
+  }
+
+  // Teacher-forced log probabilities of the n = target.shape[0] /
+  // source.shape[0] candidates of every source, targets [i * n, (i + 1) * n)
+  // are the candidates of source i
+  std::tuple<py::array_t<float>, py::array_t<float>> score(
+      py::array_t<int, py::array::c_style | py::array::forcecast> source,
+      py::array_t<int, py::array::c_style | py::array::forcecast> target) {
+    if (source.ndim() != 2 || target.ndim() != 2) {
+      throw std::runtime_error(
+          "source should be [batch_size, src_seq_len] and target "
+          "[num_targets, trg_seq_len]");
+    }
+    int batch_size = source.shape(0), src_seq_len = source.shape(1);
+    int num_targets = target.shape(0), trg_seq_len = target.shape(1);
+    auto token_log_probs = py::array_t<float>({num_targets, trg_seq_len});
+    auto seq_log_probs = py::array_t<float>(num_targets);
+
+    size_t num_ints = source.size() + target.size();
+    size_t num_floats = token_log_probs.size() + seq_log_probs.size();
+    int *d_ints;
+    float *d_floats;
+    lightseq::cuda::CHECK_GPU_ERROR(
+        cudaMalloc(&d_ints, sizeof(int) * std::max<size_t>(num_ints, 1)));
+    lightseq::cuda::CHECK_GPU_ERROR(cudaMalloc(
+        &d_floats, sizeof(float) * std::max<size_t>(num_floats, 1)));
+    lightseq::cuda::CHECK_GPU_ERROR(cudaMemcpy(d_ints, source.data(),
+                                               sizeof(int) * source.size(),
+                                               cudaMemcpyHostToDevice));
+    lightseq::cuda::CHECK_GPU_ERROR(
+        cudaMemcpy(d_ints + source.size(), target.data(),
+                   sizeof(int) * target.size(), cudaMemcpyHostToDevice));
+    float *d_seq_log_probs = d_floats + token_log_probs.size();
+    try {
+      model_->Score(d_ints, batch_size, src_seq_len, d_ints + source.size(),
+                    num_targets, trg_seq_len, d_floats, d_seq_log_probs);
+    } catch (...) {
+      lightseq::cuda::CHECK_GPU_ERROR(cudaFree(d_ints));
+      lightseq::cuda::CHECK_GPU_ERROR(cudaFree(d_floats));
+      throw;
+    }
+    lightseq::cuda::CHECK_GPU_ERROR(cudaMemcpy(
+        token_log_probs.mutable_data(), d_floats,
+        sizeof(float) * token_log_probs.size(), cudaMemcpyDeviceToHost));
+    lightseq::cuda::CHECK_GPU_ERROR(cudaMemcpy(
+        seq_log_probs.mutable_data(), d_seq_log_probs,
+        sizeof(float) * seq_log_probs.size(), cudaMemcpyDeviceToHost));
+    lightseq::cuda::CHECK_GPU_ERROR(cudaFree(d_ints));
+    lightseq::cuda::CHECK_GPU_ERROR(cudaFree(d_floats));
+    return std::make_tuple(token_log_probs, seq_log_probs);
+  }
+
+ private:
+  /* Infer the cache misses of the batch only, the duplicates of a row in the
+   * batch run once */
+  std::tuple<py::array_t<int>, py::array_t<float>> infer_cached(
+      const int *input, int batch_size, int batch_seq_len) {
+    std::string config;
+    for (auto &kv : generation_config_) {
+      config += kv.first + "=" + kv.second + ";";
+    }
+    lightseq::cuda::ResultBatchPlan plan = lightseq::cuda::plan_result_batch(
+        result_cache_.get(), model_id_, config, input, batch_size,
+        batch_seq_len, cache_padding_id_);
+    std::vector<lightseq::cuda::CachedResult> miss_results;
+    int miss_num = plan.miss_rows.size();
+    if (miss_num > 0) {
+      std::vector<int> miss_input;
+      for (int row : plan.miss_rows) {
+        const int *src = input + (size_t)row * batch_seq_len;
+        miss_input.insert(miss_input.end(), src, src + batch_seq_len);
+      }
+      lightseq::cuda::CHECK_GPU_ERROR(
+          cudaMemcpy(d_input_, miss_input.data(),
+                     sizeof(int) * miss_input.size(), cudaMemcpyHostToDevice));
+      model_->set_input_ptr(0, d_input_);
+      model_->set_input_shape(0, {miss_num, batch_seq_len});
+      model_->Infer();
+
+      std::vector<int> shape = model_->get_output_shape(0);
+      std::vector<int> ids((size_t)shape[0] * shape[1] * shape[2]);
+      std::vector<float> scores((size_t)shape[0] * shape[1]);
+      lightseq::cuda::CHECK_GPU_ERROR(
+          cudaMemcpy(ids.data(), model_->get_output_ptr(0),
+                     sizeof(int) * ids.size(), cudaMemcpyDeviceToHost));
+      lightseq::cuda::CHECK_GPU_ERROR(
+          cudaMemcpy(scores.data(), model_->get_output_ptr(1),
+                     sizeof(float) * scores.size(), cudaMemcpyDeviceToHost));
+      for (int i = 0; i < miss_num; i++) {
+        miss_results.push_back(lightseq::cuda::result_of_row(
+            ids.data(), scores.data(), i, shape[1], shape[2]));
+      }
+    }
+
+    std::vector<int> ids;
+    std::vector<float> scores;
+    int num_seqs, seq_len;
+    lightseq::cuda::fill_result_batch(result_cache_.get(), &plan,
+                                      miss_results, &ids, &scores, &num_seqs,
+                                      &seq_len);
+    auto tokens = py::array_t<int>({batch_size, num_seqs, seq_len});
+    memcpy(tokens.mutable_data(), ids.data(), sizeof(int) * ids.size());
+    auto out_scores = py::array_t<float>({batch_size, num_seqs});
+    memcpy(out_scores.mutable_data(), scores.data(),
+           sizeof(float) * scores.size());
+    return std::make_tuple(tokens, out_scores);
+  }
 
+  std::tuple<py::array_t<int>, py::array_t<float>> fetch_outputs() {
     std::vector<int> output_shape = model_->get_output_shape(0);
     auto tokens = py::array_t<int>(output_shape);
     int *tokens_data = tokens.mutable_data(0, 0);
@@ -110,6 +334,8 @@ class PyQuantTransformer {
       d_outputs_.push_back(d_output);
     }
   }
+  lightseq::cuda::LSModel *get_model() { return model_; }
+
   ~PyQuantTransformer() {
     delete model_;
     lightseq::cuda::CHECK_GPU_ERROR(cudaFree(d_input_));
@@ -183,6 +409,8 @@ class PyBert {
       d_outputs_.push_back(d_output);
     }
   }
+  lightseq::cuda::LSModel *get_model() { return model_; }
+
   ~PyBert() {
     delete model_;
     lightseq::cuda::CHECK_GPU_ERROR(cudaFree(d_input_));
@@ -193,34 +421,25 @@ class PyBert {
 
   py::array_t<float> infer(
       py::array_t<int, py::array::c_style | py::array::forcecast> input_seq) {
-    auto input_seq_out = input_seq.mutable_unchecked<2>();
-    const int *input_seq_data = input_seq_out.data(0, 0);
-    int batch_size = input_seq_out.shape(0);
-    int batch_seq_len = input_seq_out.shape(1);
-
-    lightseq::cuda::CHECK_GPU_ERROR(
-        cudaMemcpy(d_input_, input_seq_data, sizeof(int) * input_seq_out.size(),
-                   cudaMemcpyHostToDevice));
-
-    model_->set_input_ptr(0, d_input_);
-    model_->set_input_shape(0, {batch_size, batch_seq_len});
-
-    model_->Infer();
+    run_infer(input_seq);
 
-    std::vector<int> output_shape = model_->get_output_shape(0);
+    // only the pooled output [batch_size, hidden_size] is copied back if the
+    // encoder pools, see set_pooling
+    int index = model_->get_output_shape(3)[1] > 0 ? 3 : 0;
+    std::vector<int> output_shape = model_->get_output_shape(index);
     auto output = py::array_t<float>(output_shape);
     float *output_data = output.mutable_data(0, 0);
-    lightseq::cuda::DataType output_type = model_->get_output_dtype(0);
+    lightseq::cuda::DataType output_type = model_->get_output_dtype(index);
     if (output_type == lightseq::cuda::kFloat32) {
       const float *d_output =
-          static_cast<const float *>(model_->get_output_ptr(0));
+          static_cast<const float *>(model_->get_output_ptr(index));
 
       lightseq::cuda::CHECK_GPU_ERROR(cudaMemcpy(output_data, d_output,
                                                  sizeof(float) * output.size(),
                                                  cudaMemcpyDeviceToHost));
     } else if (output_type == lightseq::cuda::kFloat16) {
       const half *d_output =
-          static_cast<const half *>(model_->get_output_ptr(0));
+          static_cast<const half *>(model_->get_output_ptr(index));
       std::vector<half> h_bert_out(output.size());
       lightseq::cuda::CHECK_GPU_ERROR(cudaMemcpy(h_bert_out.data(), d_output,
                                                  sizeof(half) * output.size(),
@@ -235,6 +454,43 @@ class PyBert {
 
     return output;
   }
+
+  /* logits of the exit head of every sample and the number of encoder
+   * layers it ran, see set_early_exit */
+  std::tuple<py::array_t<float>, py::array_t<int>> classify(
+      py::array_t<int, py::array::c_style | py::array::forcecast> input_seq) {
+    run_infer(input_seq);
+    auto logits = py::array_t<float>(model_->get_output_shape(1));
+    auto exit_layer = py::array_t<int>(model_->get_output_shape(2));
+    if (logits.size() == 0) {
+      throw std::runtime_error("the model has no exit heads");
+    }
+    lightseq::cuda::CHECK_GPU_ERROR(cudaMemcpy(
+        logits.mutable_data(), model_->get_output_ptr(1),
+        sizeof(float) * logits.size(), cudaMemcpyDeviceToHost));
+    lightseq::cuda::CHECK_GPU_ERROR(cudaMemcpy(
+        exit_layer.mutable_data(), model_->get_output_ptr(2),
+        sizeof(int) * exit_layer.size(), cudaMemcpyDeviceToHost));
+    return std::make_tuple(logits, exit_layer);
+  }
+
+ private:
+  void run_infer(
+      py::array_t<int, py::array::c_style | py::array::forcecast> input_seq) {
+    auto input_seq_out = input_seq.mutable_unchecked<2>();
+    const int *input_seq_data = input_seq_out.data(0, 0);
+    int batch_size = input_seq_out.shape(0);
+    int batch_seq_len = input_seq_out.shape(1);
+
+    lightseq::cuda::CHECK_GPU_ERROR(
+        cudaMemcpy(d_input_, input_seq_data, sizeof(int) * input_seq_out.size(),
+                   cudaMemcpyHostToDevice));
+
+    model_->set_input_ptr(0, d_input_);
+    model_->set_input_shape(0, {batch_size, batch_seq_len});
+
+    model_->Infer();
+  }
 };
 
 class PyQuantBert {
@@ -265,6 +521,8 @@ class PyQuantBert {
       d_outputs_.push_back(d_output);
     }
   }
+  lightseq::cuda::LSModel *get_model() { return model_; }
+
   ~PyQuantBert() {
     delete model_;
     lightseq::cuda::CHECK_GPU_ERROR(cudaFree(d_input_));
@@ -347,6 +605,8 @@ class PyGpt {
       d_outputs_.push_back(d_output);
     }
   }
+  lightseq::cuda::LSModel *get_model() { return model_; }
+
   ~PyGpt() {
     delete model_;
     lightseq::cuda::CHECK_GPU_ERROR(cudaFree(d_input_));
@@ -355,8 +615,11 @@ class PyGpt {
     }
   }
 
+  // num_return_sequences samples per prompt, row i * num_return_sequences
+  // + j of the output is sample j of prompt i
   py::array_t<int> sample(
-      py::array_t<int, py::array::c_style | py::array::forcecast> input_seq) {
+      py::array_t<int, py::array::c_style | py::array::forcecast> input_seq,
+      int num_return_sequences) {
     auto input_seq_out = input_seq.mutable_unchecked<2>();
     const int *input_seq_data = input_seq_out.data(0, 0);
     int batch_size = input_seq_out.shape(0);
@@ -375,6 +638,7 @@ class PyGpt {
     model_->set_input_ptr(0, d_input_);
     model_->set_input_shape(0, {batch_size, batch_seq_len});
 
+    model_->set_num_return_sequences(num_return_sequences);
     model_->Infer();
 
     std::vector<int> output_shape = model_->get_output_shape(0);
@@ -388,6 +652,33 @@ class PyGpt {
     return output;
   }
 
+  // Sample the next turn of the conversation session_id, only the new turn
+  // input_seq [1, seq_len] is encoded. Returns the whole conversation
+  py::array_t<int> sample_session(
+      py::array_t<int, py::array::c_style | py::array::forcecast> input_seq,
+      uint64_t session_id, bool start, bool end) {
+    if (input_seq.ndim() != 2) {
+      throw std::runtime_error("input_seq should be [1, seq_len]");
+    }
+    lightseq::cuda::CHECK_GPU_ERROR(
+        cudaMemcpy(d_input_, input_seq.data(), sizeof(int) * input_seq.size(),
+                   cudaMemcpyHostToDevice));
+    model_->set_input_ptr(0, d_input_);
+    model_->set_input_shape(
+        0, {(int)input_seq.shape(0), (int)input_seq.shape(1)});
+
+    model_->set_num_return_sequences(1);
+    model_->InferSession(session_id, start, end);
+
+    std::vector<int> output_shape = model_->get_output_shape(0);
+    auto output = py::array_t<int>(output_shape);
+    const int *d_output = static_cast<const int *>(model_->get_output_ptr(0));
+    lightseq::cuda::CHECK_GPU_ERROR(cudaMemcpy(output.mutable_data(), d_output,
+                                               sizeof(int) * output.size(),
+                                               cudaMemcpyDeviceToHost));
+    return output;
+  }
+
   py::array_t<float> ppl(
       py::array_t<int, py::array::c_style | py::array::forcecast> input_seq) {
     auto input_seq_out = input_seq.mutable_unchecked<2>();
@@ -452,6 +743,8 @@ class PyQuantGpt {
       d_outputs_.push_back(d_output);
     }
   }
+  lightseq::cuda::LSModel *get_model() { return model_; }
+
   ~PyQuantGpt() {
     delete model_;
     lightseq::cuda::CHECK_GPU_ERROR(cudaFree(d_input_));
@@ -557,6 +850,8 @@ class PyMoe {
       d_outputs_.push_back(d_output);
     }
   }
+  lightseq::cuda::LSModel *get_model() { return model_; }
+
   ~PyMoe() {
     delete model_;
     lightseq::cuda::CHECK_GPU_ERROR(cudaFree(d_input_));
@@ -630,6 +925,8 @@ class PyVit {
       d_outputs_.push_back(d_output);
     }
   }
+  lightseq::cuda::LSModel *get_model() { return model_; }
+
   ~PyVit() {
     delete model_;
     lightseq::cuda::CHECK_GPU_ERROR(cudaFree(d_input_));
@@ -686,6 +983,214 @@ class PyVit {
   }
 };
 
+// per-stage latency profiling, see stage_profiler.h
+template <typename PyModel>
+void def_profiling(py::class_<PyModel> &cls) {
+  cls.def(
+         "enable_profiling",
+         [](PyModel &self, bool enable) {
+           self.get_model()->enable_profiling(enable);
+         },
+         py::arg("enable") = true)
+      .def("reset_profiling",
+           [](PyModel &self) { self.get_model()->reset_profiling(); })
+      .def("stage_stats",
+           [](PyModel &self) {
+             py::dict res;
+             for (auto &kv : self.get_model()->get_stage_stats()) {
+               const lightseq::cuda::StageStats &s = kv.second;
+               py::dict stats;
+               stats["count"] = s.count;
+               stats["total_ms"] = s.total_ms;
+               stats["mean_ms"] = s.mean_ms;
+               stats["min_ms"] = s.min_ms;
+               stats["max_ms"] = s.max_ms;
+               stats["p50_ms"] = s.p50_ms;
+               stats["p90_ms"] = s.p90_ms;
+               stats["p99_ms"] = s.p99_ms;
+               res[py::str(kv.first)] = stats;
+             }
+             return res;
+           })
+      .def(
+          "export_chrome_trace",
+          [](PyModel &self, const std::string &path) {
+            std::ofstream fout(path);
+            if (!fout) throw std::runtime_error("failed to open " + path);
+            fout << self.get_model()->export_chrome_trace();
+          },
+          py::arg("path"));
+}
+
+// the decoding settings keep the cached results of PyTransformer apart
+template <typename PyModel>
+void on_generation_config(PyModel &self, const std::string &name,
+                          const std::string &value) {}
+void on_generation_config(PyTransformer &self, const std::string &name,
+                          const std::string &value) {
+  self.set_generation_config(name, value);
+}
+
+template <typename T>
+std::string join_values(const std::vector<T> &values) {
+  std::ostringstream out;
+  for (const T &v : values) out << v << ",";
+  return out.str();
+}
+
+// logits processor chain of generation, see logits_processor.h. The config
+// stays set until the next call, call it before infer / sample to change it
+// per request
+template <typename PyModel>
+void def_logits_processor(py::class_<PyModel> &cls) {
+  cls.def(
+      "set_logits_processor",
+      [](PyModel &self, float temperature, float repetition_penalty,
+         int no_repeat_ngram_size, int min_length, int max_length, int top_k,
+         float top_p, const std::vector<std::vector<int>> &bad_words) {
+        lightseq::cuda::LogitsProcessorConfig config;
+        config.temperature = temperature;
+        config.repetition_penalty = repetition_penalty;
+        config.no_repeat_ngram_size = no_repeat_ngram_size;
+        config.min_length = min_length;
+        config.max_length = max_length;
+        config.top_k = top_k;
+        config.top_p = top_p;
+        config.bad_words = bad_words;
+        self.get_model()->set_logits_processor(config);
+        std::ostringstream key;
+        key << temperature << "," << repetition_penalty << ","
+            << no_repeat_ngram_size << "," << min_length << "," << max_length
+            << "," << top_k << "," << top_p << ",";
+        for (auto &words : bad_words) key << "[" << join_values(words) << "]";
+        on_generation_config(self, "logits_processor", key.str());
+      },
+      py::arg("temperature") = 1.f, py::arg("repetition_penalty") = 1.f,
+      py::arg("no_repeat_ngram_size") = 0, py::arg("min_length") = 0,
+      py::arg("max_length") = 0, py::arg("top_k") = 0, py::arg("top_p") = 1.f,
+      py::arg("bad_words") = std::vector<std::vector<int>>());
+}
+
+// zero-copy inference on DLPack tensors, see dlpack_tensor.h
+const char *kDLTensorName = "dltensor";
+const char *kUsedDLTensorName = "used_dltensor";
+
+// Take the DLPack tensor of a capsule or of an object with __dlpack__ (e.g.
+// a torch tensor), the producer orders its pending work before the model
+// stream. A bare capsule should already be ready
+lightseq::cuda::DLManagedTensorPtr dlpack_from_py(py::object obj,
+                                                  void *stream) {
+  if (py::hasattr(obj, "__dlpack__")) {
+    // 1 for the legacy default stream, see the python array API
+    intptr_t stream_id = stream ? reinterpret_cast<intptr_t>(stream) : 1;
+    obj = obj.attr("__dlpack__")(py::arg("stream") = stream_id);
+  }
+  PyObject *capsule = obj.ptr();
+  if (!PyCapsule_IsValid(capsule, kDLTensorName)) {
+    throw std::runtime_error(
+        "expect a DLPack capsule or an object with __dlpack__, a capsule can "
+        "only be consumed once");
+  }
+  DLManagedTensor *tensor = static_cast<DLManagedTensor *>(
+      PyCapsule_GetPointer(capsule, kDLTensorName));
+  PyCapsule_SetName(capsule, kUsedDLTensorName);
+  return lightseq::cuda::DLManagedTensorPtr(tensor);
+}
+
+void dlpack_capsule_destructor(PyObject *capsule) {
+  // a consumed capsule is renamed and deleted by its consumer
+  if (!PyCapsule_IsValid(capsule, kDLTensorName)) return;
+  DLManagedTensor *tensor = static_cast<DLManagedTensor *>(
+      PyCapsule_GetPointer(capsule, kDLTensorName));
+  tensor->deleter(tensor);
+}
+
+py::capsule dlpack_to_py(DLManagedTensor *tensor) {
+  return py::reinterpret_steal<py::capsule>(
+      PyCapsule_New(tensor, kDLTensorName, dlpack_capsule_destructor));
+}
+
+// Run the model on the device memory of the inputs, the outputs are fresh
+// device buffers of the output dtype owned by the returned capsules
+py::object infer_dlpack(lightseq::cuda::LSModel *model, py::args inputs) {
+  if ((int)inputs.size() != model->get_input_size()) {
+    throw std::runtime_error("expect " +
+                             std::to_string(model->get_input_size()) +
+                             " inputs, got " + std::to_string(inputs.size()));
+  }
+  int device_id;
+  lightseq::cuda::CHECK_GPU_ERROR(cudaGetDevice(&device_id));
+  std::vector<lightseq::cuda::DLManagedTensorPtr> dl_inputs;
+  for (int i = 0; i < model->get_input_size(); i++) {
+    dl_inputs.push_back(dlpack_from_py(inputs[i], model->get_stream()));
+    const DLTensor &t = dl_inputs.back()->dl_tensor;
+    std::string err = lightseq::cuda::check_dl_tensor(
+        t, model->get_input_dtype(i), model->get_input_max_shape(i),
+        device_id);
+    if (!err.empty()) {
+      throw std::runtime_error(model->get_input_name(i) + ": " + err);
+    }
+    model->set_input_ptr(i, lightseq::cuda::dl_data_ptr(t));
+    model->set_input_shape(i, lightseq::cuda::dl_shape(t));
+  }
+
+  // the host path keeps using the buffers of the wrapper
+  std::vector<void *> prev_outputs, d_outputs;
+  for (int i = 0; i < model->get_output_size(); i++) {
+    prev_outputs.push_back(const_cast<void *>(model->get_output_ptr(i)));
+    std::vector<int> shape = model->get_output_max_shape(i);
+    size_t bytes = std::accumulate(shape.begin(), shape.end(), (size_t)1,
+                                   std::multiplies<size_t>()) *
+                   lightseq::cuda::data_type_bytes(model->get_output_dtype(i));
+    void *d_output;
+    lightseq::cuda::CHECK_GPU_ERROR(cudaMalloc(&d_output, bytes));
+    d_outputs.push_back(d_output);
+    model->set_output_ptr(i, d_output);
+  }
+  auto restore_outputs = [&]() {
+    for (int i = 0; i < model->get_output_size(); i++) {
+      model->set_output_ptr(i, prev_outputs[i]);
+    }
+  };
+  try {
+    model->Infer();
+  } catch (...) {
+    restore_outputs();
+    for (void *d_output : d_outputs) cudaFree(d_output);
+    throw;
+  }
+  restore_outputs();
+
+  py::tuple outputs(model->get_output_size());
+  for (int i = 0; i < model->get_output_size(); i++) {
+    outputs[i] = dlpack_to_py(lightseq::cuda::make_dl_managed_tensor(
+        d_outputs[i], model->get_output_dtype(i), model->get_output_shape(i),
+        {kDLCUDA, device_id}, [](void *data) { cudaFree(data); }));
+  }
+  if (outputs.size() == 1) return outputs[0];
+  return outputs;
+}
+
+template <typename PyModel>
+void def_dlpack(py::class_<PyModel> &cls) {
+  cls.def(
+      "infer_dlpack",
+      [](PyModel &self, py::args inputs) {
+        return infer_dlpack(self.get_model(), inputs);
+      },
+      "Zero-copy inference on cuda tensors, takes DLPack capsules or objects "
+      "with __dlpack__ (e.g. torch tensors) and returns DLPack capsules of "
+      "the model dtype, use torch.from_dlpack to get torch tensors");
+}
+
+int parse_exit_criterion(const std::string &criterion) {
+  if (criterion == "none") return lightseq::cuda::kExitNone;
+  if (criterion == "entropy") return lightseq::cuda::kExitEntropy;
+  if (criterion == "max_prob") return lightseq::cuda::kExitMaxProb;
+  throw std::runtime_error("unknown exit criterion " + criterion +
+                           ", expected none, entropy or max_prob");
+}
+
 PYBIND11_MODULE(inference, m) {
   m.attr("__name__") = "lightseq.inference";
   py::class_<lightseq::cuda::TransformerDecoder>(m, "TransformerDecoder")
@@ -693,55 +1198,223 @@ PYBIND11_MODULE(inference, m) {
            py::arg("max_batch_size"))
       .def("infer", &lightseq::cuda::TransformerDecoder::infer);
 
-  py::class_<PyTransformer>(m, "Transformer")
+  py::class_<PyTransformer> transformer(m, "Transformer");
+  transformer
       .def(py::init<const std::string, const int>(), py::arg("weight_path"),
            py::arg("max_batch_size"))
       .def("infer", &PyTransformer::infer,
-           py::return_value_policy::reference_internal, py::arg("input_seq"));
-
-  py::class_<PyQuantTransformer>(m, "QuantTransformer")
+           py::return_value_policy::reference_internal, py::arg("input_seq"))
+      .def("infer_batches", &PyTransformer::infer_batches,
+           py::arg("input_seqs"))
+      .def("infer_fan_out", &PyTransformer::infer_fan_out,
+           "Decode every request of a multilingual model into each of the "
+           "target languages, encoding it once",
+           py::arg("input_seq"), py::arg("trg_lang_ids"))
+      .def("score", &PyTransformer::score,
+           "Teacher-forced log probabilities of the target candidates of "
+           "every source, returns the log probability of every target token "
+           "and of every target",
+           py::arg("source"), py::arg("target"))
+      .def(
+          "set_pipeline_depth",
+          [](PyTransformer &self, int depth) {
+            self.get_model()->set_pipeline_depth(depth);
+          },
+          "Number of encoder output slots of infer_batches, the encoder of "
+          "the next depth - 1 batches overlaps the decoder, 1 for serial",
+          py::arg("depth"))
+      .def("set_result_cache", &PyTransformer::set_result_cache,
+           "Answer the rows of infer seen before from a cache of "
+           "capacity_bytes (0 disables it), keyed by the row without its "
+           "trailing padding_id (-1 keys it as given) and the decoding "
+           "settings. Sampled decoding (topk / topp, or a logits processor "
+           "with top_k, top_p or temperature) bypasses the cache. "
+           "admission keeps one-off rows from evicting frequent ones",
+           py::arg("capacity_bytes"), py::arg("num_shards") = 16,
+           py::arg("admission") = true, py::arg("padding_id") = -1)
+      .def(
+          "result_cache_stats",
+          [](PyTransformer &self) {
+            lightseq::cuda::ResultCacheStats s = self.result_cache_stats();
+            py::dict res;
+            res["hits"] = s.hits;
+            res["misses"] = s.misses;
+            res["hit_rate"] = s.hit_rate();
+            res["inserts"] = s.inserts;
+            res["rejected"] = s.rejected;
+            res["evictions"] = s.evictions;
+            res["entries"] = s.entries;
+            res["bytes"] = s.bytes;
+            res["capacity_bytes"] = s.capacity_bytes;
+            return res;
+          },
+          "Counters of the result cache, zeros when disabled");
+  def_profiling(transformer);
+  def_dlpack(transformer);
+  def_logits_processor(transformer);
+  transformer.def(
+      "set_vocab_shortlist",
+      [](PyTransformer &self, const std::vector<int> &ids) {
+        self.get_model()->set_vocab_shortlist(ids);
+        on_generation_config(self, "vocab_shortlist", join_values(ids));
+      },
+      "Decode the following infers with the logits of these ascending target "
+      "ids only, e.g. from LexicalShortlist.build, an empty list restores "
+      "the full vocab",
+      py::arg("ids"));
+
+  // lexical shortlist of the target vocab, see lexical_shortlist.h
+  py::class_<lightseq::cuda::LexicalShortlist>(m, "LexicalShortlist")
+      .def(py::init([](const std::string &path) {
+             lightseq::cuda::LexicalShortlist shortlist;
+             std::string err = shortlist.load(path);
+             if (!err.empty()) throw std::runtime_error(err);
+             return shortlist;
+           }),
+           py::arg("path"))
+      .def(
+          "build",
+          [](const lightseq::cuda::LexicalShortlist &self,
+             py::array_t<int, py::array::c_style | py::array::forcecast>
+                 input_seq,
+             int top_k, const std::vector<int> &required) {
+            return self.build(input_seq.data(), input_seq.size(), top_k,
+                              required);
+          },
+          py::arg("input_seq"), py::arg("top_k") = 0,
+          py::arg("required") = std::vector<int>());
+
+  py::class_<PyQuantTransformer> quant_transformer(m, "QuantTransformer");
+  quant_transformer
       .def(py::init<const std::string, const int>(), py::arg("weight_path"),
            py::arg("max_batch_size"))
       .def("infer", &PyQuantTransformer::infer,
            py::return_value_policy::reference_internal, py::arg("input_seq"));
+  def_profiling(quant_transformer);
+  def_dlpack(quant_transformer);
 
-  py::class_<PyGpt>(m, "Gpt")
+  py::class_<PyGpt> gpt(m, "Gpt");
+  gpt
       .def(py::init<const std::string, const int>(), py::arg("weight_path"),
            py::arg("max_batch_size"))
       .def("ppl", &PyGpt::ppl, py::return_value_policy::reference_internal,
            py::arg("input_seq"))
       .def("sample", &PyGpt::sample,
-           py::return_value_policy::reference_internal, py::arg("input_seq"));
-
-  py::class_<PyQuantGpt>(m, "QuantGpt")
+           py::return_value_policy::reference_internal, py::arg("input_seq"),
+           py::arg("num_return_sequences") = 1)
+      .def("sample_session", &PyGpt::sample_session,
+           "Sample the next turn of a conversation, the keys and values of "
+           "the earlier turns are kept by the model between calls",
+           py::arg("input_seq"), py::arg("session_id"),
+           py::arg("start") = false, py::arg("end") = false)
+      .def(
+          "set_session_config",
+          [](PyGpt &self, size_t device_bytes, size_t host_bytes,
+             int64_t ttl_ms) {
+            lightseq::cuda::SessionCacheConfig config;
+            config.device_bytes = device_bytes;
+            config.host_bytes = host_bytes;
+            config.ttl_ms = ttl_ms;
+            self.get_model()->set_session_config(config);
+          },
+          "Device budget of the kept conversations, the least recently used "
+          "ones are spilled to host_bytes of host memory or released, idle "
+          "ones are released after ttl_ms, 0 never",
+          py::arg("device_bytes"), py::arg("host_bytes") = 0,
+          py::arg("ttl_ms") = 600000);
+  def_profiling(gpt);
+  def_dlpack(gpt);
+  def_logits_processor(gpt);
+
+  py::class_<PyQuantGpt> quant_gpt(m, "QuantGpt");
+  quant_gpt
       .def(py::init<const std::string, const int>(), py::arg("weight_path"),
            py::arg("max_batch_size"))
       .def("ppl", &PyQuantGpt::ppl, py::return_value_policy::reference_internal,
            py::arg("input_seq"))
       .def("sample", &PyQuantGpt::sample,
            py::return_value_policy::reference_internal, py::arg("input_seq"));
+  def_profiling(quant_gpt);
+  def_dlpack(quant_gpt);
 
-  py::class_<PyBert>(m, "Bert")
+  py::class_<PyBert> bert(m, "Bert");
+  bert
       .def(py::init<const std::string, const int>(), py::arg("weight_path"),
            py::arg("max_batch_size"))
       .def("infer", &PyBert::infer, py::return_value_policy::reference_internal,
-           py::arg("input_seq"));
-
-  py::class_<PyQuantBert>(m, "QuantBert")
+           py::arg("input_seq"))
+      .def("classify", &PyBert::classify,
+           py::return_value_policy::reference_internal, py::arg("input_seq"))
+      .def(
+          "set_early_exit",
+          [](PyBert &self, const std::string &criterion, float threshold) {
+            lightseq::cuda::EarlyExitConfig config;
+            config.criterion = parse_exit_criterion(criterion);
+            config.threshold = threshold;
+            self.get_model()->set_early_exit(config);
+          },
+          "Retire the samples from the batch at the first exit head whose "
+          "prediction meets the criterion, 'entropy' (normalized entropy <= "
+          "threshold), 'max_prob' (max probability >= threshold) or 'none'",
+          py::arg("criterion") = "none", py::arg("threshold") = 0.f)
+      .def(
+          "set_pooling",
+          [](PyBert &self, const std::string &mode) {
+            self.get_model()->set_pooling_mode(
+                lightseq::cuda::parse_pooling_mode(mode));
+          },
+          "Pool the encoder output on the device, 'cls' (first token), "
+          "'mean' or 'max' (over the non-pad tokens), infer then returns "
+          "[batch_size, hidden_size]. 'none' returns the hidden states, the "
+          "default is the pooling_mode of the model config",
+          py::arg("mode"));
+  def_profiling(bert);
+  def_dlpack(bert);
+  m.def(
+      "calibrate_early_exit",
+      [](const std::vector<std::vector<float>> &head_logits,
+         const std::vector<int> &head_layers, const std::vector<int> &labels,
+         int num_labels, const std::string &criterion,
+         float max_accuracy_drop) {
+        lightseq::cuda::ExitCalibration res =
+            lightseq::cuda::calibrate_early_exit(
+                head_logits, head_layers, labels, num_labels,
+                parse_exit_criterion(criterion), max_accuracy_drop);
+        return std::make_tuple(res.threshold, res.accuracy, res.avg_layers);
+      },
+      "Threshold of the criterion with the fewest average layers on a dev "
+      "set whose accuracy is at most max_accuracy_drop below the final "
+      "classifier, returns (threshold, accuracy, avg_layers). head_logits: "
+      "[num_heads][num_samples * num_labels] logits of the heads in the "
+      "order of their layers, head_layers: layers run before each head",
+      py::arg("head_logits"), py::arg("head_layers"), py::arg("labels"),
+      py::arg("num_labels"), py::arg("criterion"),
+      py::arg("max_accuracy_drop"));
+
+  py::class_<PyQuantBert> quant_bert(m, "QuantBert");
+  quant_bert
       .def(py::init<const std::string, const int>(), py::arg("weight_path"),
            py::arg("max_batch_size"))
       .def("infer", &PyQuantBert::infer,
            py::return_value_policy::reference_internal, py::arg("input_seq"));
+  def_profiling(quant_bert);
+  def_dlpack(quant_bert);
 
-  py::class_<PyMoe>(m, "Moe")
+  py::class_<PyMoe> moe(m, "Moe");
+  moe
       .def(py::init<const std::string, const int>(), py::arg("weight_path"),
            py::arg("max_batch_size"))
       .def("infer", &PyMoe::infer, py::return_value_policy::reference_internal,
            py::arg("input_seq"));
+  def_profiling(moe);
+  def_dlpack(moe);
 
-  py::class_<PyVit>(m, "Vit")
+  py::class_<PyVit> vit(m, "Vit");
+  vit
       .def(py::init<const std::string, const int>(), py::arg("weight_path"),
            py::arg("max_batch_size"))
       .def("infer", &PyVit::infer, py::return_value_policy::reference_internal,
            py::arg("pixel_values"));
+  def_profiling(vit);
+  def_dlpack(vit);
 }
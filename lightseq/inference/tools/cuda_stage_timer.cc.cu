@@ -0,0 +1,68 @@
+#include "cuda_stage_timer.h"
+#include "util.h"
+
+namespace lightseq {
+namespace cuda {
+
+CudaStageTimer::CudaStageTimer(StageProfiler *profiler)
+    : _profiler(profiler), _active(false), _anchor(nullptr), _anchor_ns(0) {}
+
+CudaStageTimer::~CudaStageTimer() {
+  for (Pending &p : _pending) {
+    _pool.push_back(p.start);
+    _pool.push_back(p.stop);
+  }
+  for (cudaEvent_t e : _pool) cudaEventDestroy(e);
+  if (_anchor) cudaEventDestroy(_anchor);
+}
+
+cudaEvent_t CudaStageTimer::acquire_event() {
+  if (!_pool.empty()) {
+    cudaEvent_t e = _pool.back();
+    _pool.pop_back();
+    return e;
+  }
+  cudaEvent_t e;
+  CHECK_GPU_ERROR(cudaEventCreate(&e));
+  return e;
+}
+
+void CudaStageTimer::begin_infer(cudaStream_t stream) {
+  _active = _profiler && _profiler->enabled();
+  if (!_active) return;
+  if (!_anchor) CHECK_GPU_ERROR(cudaEventCreate(&_anchor));
+  CHECK_GPU_ERROR(cudaStreamSynchronize(stream));
+  CHECK_GPU_ERROR(cudaEventRecord(_anchor, stream));
+  CHECK_GPU_ERROR(cudaEventSynchronize(_anchor));
+  _anchor_ns = StageProfiler::now_ns();
+}
+
+int CudaStageTimer::start(int stage_id, cudaStream_t stream) {
+  Pending p = {stage_id, acquire_event(), acquire_event()};
+  CHECK_GPU_ERROR(cudaEventRecord(p.start, stream));
+  _pending.push_back(p);
+  return _pending.size() - 1;
+}
+
+void CudaStageTimer::stop(int handle, cudaStream_t stream) {
+  CHECK_GPU_ERROR(cudaEventRecord(_pending[handle].stop, stream));
+}
+
+void CudaStageTimer::end_infer(cudaStream_t stream) {
+  if (!_active) return;
+  _active = false;
+  CHECK_GPU_ERROR(cudaStreamSynchronize(stream));
+  for (Pending &p : _pending) {
+    float start_ms, stop_ms;
+    CHECK_GPU_ERROR(cudaEventElapsedTime(&start_ms, _anchor, p.start));
+    CHECK_GPU_ERROR(cudaEventElapsedTime(&stop_ms, _anchor, p.stop));
+    _profiler->record(p.stage_id, _anchor_ns + (int64_t)(start_ms * 1e6),
+                      _anchor_ns + (int64_t)(stop_ms * 1e6), kGpuTrack);
+    _pool.push_back(p.start);
+    _pool.push_back(p.stop);
+  }
+  _pending.clear();
+}
+
+}  // namespace cuda
+}  // namespace lightseq
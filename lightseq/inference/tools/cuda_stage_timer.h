@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cuda_runtime.h>
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "stage_profiler.h"
+
+/**
+@file
+Gpu side of the stage profiler. A scope records a pair of cuda events on the
+stream instead of synchronizing it, the pairs are resolved into host
+timestamps once the inference is finished. Events are pooled and reused.
+*/
+namespace lightseq {
+namespace cuda {
+
+class CudaStageTimer {
+ public:
+  explicit CudaStageTimer(StageProfiler *profiler);
+  ~CudaStageTimer();
+
+  StageProfiler *profiler() { return _profiler; }
+  int stage_id(const std::string &name) { return _profiler->stage_id(name); }
+  /* Ids of "<prefix>.layer_<i>.<stage>" of every layer */
+  std::vector<int> layer_stage_ids(const std::string &prefix,
+                                   const std::string &stage, int n_layer) {
+    std::vector<int> ids;
+    for (int i = 0; i < n_layer; i++) {
+      ids.push_back(stage_id(prefix + ".layer_" + std::to_string(i) + "." +
+                             stage));
+    }
+    return ids;
+  }
+  bool active() const { return _active; }
+
+  /* Start timing an inference, if profiling is enabled. Synchronizes the
+   * stream once to anchor the event clock to the host clock */
+  void begin_infer(cudaStream_t stream);
+  /* Synchronize the stream and move the timed stages into the profiler */
+  void end_infer(cudaStream_t stream);
+
+  // return a handle for stop()
+  int start(int stage_id, cudaStream_t stream);
+  void stop(int handle, cudaStream_t stream);
+
+ private:
+  struct Pending {
+    int stage_id;
+    cudaEvent_t start;
+    cudaEvent_t stop;
+  };
+  cudaEvent_t acquire_event();
+
+  StageProfiler *_profiler;
+  bool _active;
+  cudaEvent_t _anchor;
+  int64_t _anchor_ns;
+  std::vector<Pending> _pending;
+  std::vector<cudaEvent_t> _pool;
+};
+
+/* Times the gpu work queued on the stream during its lifetime */
+class CudaStageScope {
+ public:
+  CudaStageScope(CudaStageTimer *timer, int stage_id, cudaStream_t stream)
+      : _timer(timer && timer->active() ? timer : nullptr),
+        _stream(stream),
+        _handle(_timer ? _timer->start(stage_id, stream) : -1) {}
+  ~CudaStageScope() {
+    if (_timer) _timer->stop(_handle, _stream);
+  }
+
+ private:
+  CudaStageTimer *_timer;
+  cudaStream_t _stream;
+  int _handle;
+};
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+/**
+@file
+Shape-keyed cache of the fastest gemm algorithm, CUDA-free so that the
+format, lookup and fallback can be tested on host.
+
+A gemm is keyed by (dtype, layout, m, n, k, batch). dtype names the input,
+output and compute types, e.g. "f16f16f16", "i8i32i32", layout names the
+transposes or the cublasLt orders, e.g. "TN", "col32_col4_4r2_8c". An entry
+holds the cublas algo id and, for cublasLt, the algo config.
+
+The token count of a model gemm changes with every batch, the other dims are
+fixed by the model. The models compute C^T = W^T X^T of their row major
+tensors with the column major cublas, so the tokens are n, e.g. the qkv gemm
+is (m, n, k) = (hidden * 3, tokens, hidden). The int8 gemms of the cublasLt
+COL32 orders take them as m.
+
+The cache is filled by a tuning pass (see gemm_dispatch.h) and saved as
+text, one entry per line:
+  # lightseq gemm algo cache v1
+  device <device name, spaces replaced by _>
+  <dtype> <layout> <m> <n> <k> <batch> <algo> <tile> <split_k> <reduction>
+    <swizzle> <stages> <workspace> <time_ms>
+*/
+namespace lightseq {
+namespace cuda {
+
+struct GemmKey {
+  std::string dtype;
+  std::string layout;
+  int m;
+  int n;
+  int k;
+  int batch;
+
+  bool tokens_in_m() const { return layout.compare(0, 5, "col32") == 0; }
+  int tokens() const { return tokens_in_m() ? m : n; }
+  int model_dim() const { return tokens_in_m() ? n : m; }
+
+  // the entries of one model gemm are adjacent, ordered by the token count
+  bool operator<(const GemmKey &o) const {
+    return std::make_tuple(std::cref(dtype), std::cref(layout), model_dim(), k,
+                           batch, tokens()) <
+           std::make_tuple(std::cref(o.dtype), std::cref(o.layout),
+                           o.model_dim(), o.k, o.batch, o.tokens());
+  }
+  bool operator==(const GemmKey &o) const {
+    return !(*this < o) && !(o < *this);
+  }
+  std::string str() const {
+    std::ostringstream oss;
+    oss << dtype << "/" << layout << "/" << m << "x" << n << "x" << k;
+    if (batch > 1) oss << "x" << batch;
+    return oss.str();
+  }
+};
+
+/* Algo of one gemm, algo is a cublasGemmAlgo_t or a cublasLt algo id. The
+ * cublasLt config fields are -1 for cublasGemmEx */
+struct GemmAlgo {
+  int algo = -1;
+  int tile = -1;
+  int split_k = -1;
+  int reduction = -1;
+  int swizzle = -1;
+  int stages = -1;
+  int64_t workspace = 0;
+  float time_ms = std::numeric_limits<float>::max();
+
+  bool is_lt() const { return tile >= 0; }
+};
+
+class GemmAlgoCache {
+ public:
+  static constexpr const char *kHeader = "# lightseq gemm algo cache v1";
+
+  /* Process-wide cache used by the gemm dispatch */
+  static GemmAlgoCache &global() {
+    static GemmAlgoCache cache;
+    return cache;
+  }
+
+  void set_device(const std::string &device) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _device = sanitize(device);
+  }
+  std::string device() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _device;
+  }
+
+  // keep the faster one when the key is tuned twice
+  void insert(const GemmKey &key, const GemmAlgo &algo) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto iter = _algos.find(key);
+    if (iter == _algos.end() || algo.time_ms < iter->second.time_ms) {
+      _algos[key] = algo;
+      _dirty = true;
+    }
+  }
+
+  /* Exact match only */
+  bool find(const GemmKey &key, GemmAlgo *algo) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto iter = _algos.find(key);
+    if (iter == _algos.end()) return false;
+    *algo = iter->second;
+    return true;
+  }
+
+  /**
+  Exact match, otherwise the entry of the same gemm with the next larger
+  token count, or the largest one below it. This covers the untuned batch
+  sizes without tuning them all. False if there is no entry to fall back
+  to, the caller then uses the default algo.
+  */
+  bool lookup(const GemmKey &key, GemmAlgo *algo) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto iter = _algos.lower_bound(key);
+    if (iter != _algos.end() && iter->first == key) {
+      *algo = iter->second;
+      return true;
+    }
+    auto same_shape = [&key](const GemmKey &k) {
+      return k.dtype == key.dtype && k.layout == key.layout &&
+             k.model_dim() == key.model_dim() && k.k == key.k &&
+             k.batch == key.batch;
+    };
+    if (iter != _algos.end() && same_shape(iter->first)) {
+      *algo = iter->second;
+      return true;
+    }
+    if (iter != _algos.begin()) {
+      --iter;
+      if (same_shape(iter->first)) {
+        *algo = iter->second;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  size_t size() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _algos.size();
+  }
+  bool dirty() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _dirty;
+  }
+  void clear() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _algos.clear();
+    _dirty = false;
+  }
+
+  std::string serialize() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::ostringstream oss;
+    oss << kHeader << "\n";
+    oss << "device " << (_device.empty() ? "unknown" : _device) << "\n";
+    for (auto &kv : _algos) {
+      const GemmKey &k = kv.first;
+      const GemmAlgo &a = kv.second;
+      oss << k.dtype << " " << k.layout << " " << k.m << " " << k.n << " "
+          << k.k << " " << k.batch << " " << a.algo << " " << a.tile << " "
+          << a.split_k << " " << a.reduction << " " << a.swizzle << " "
+          << a.stages << " " << a.workspace << " " << a.time_ms << "\n";
+    }
+    return oss.str();
+  }
+
+  /**
+  Merge the entries of a serialized cache. A cache tuned on another device
+  is rejected, its algos are not valid here. Return an error message, empty
+  on success.
+  */
+  std::string deserialize(const std::string &text) {
+    std::istringstream iss(text);
+    std::string line;
+    if (!std::getline(iss, line) || line != kHeader) {
+      return "gemm algo cache: bad header";
+    }
+    std::string tag, device;
+    if (!std::getline(iss, line)) return "gemm algo cache: missing device";
+    std::istringstream device_line(line);
+    if (!(device_line >> tag >> device) || tag != "device") {
+      return "gemm algo cache: missing device";
+    }
+    std::string cur_device = this->device();
+    if (!cur_device.empty() && device != cur_device) {
+      return "gemm algo cache: tuned on " + device + ", running on " +
+             cur_device;
+    }
+    std::vector<std::pair<GemmKey, GemmAlgo>> entries;
+    int line_id = 2;
+    while (std::getline(iss, line)) {
+      line_id++;
+      if (line.empty() || line[0] == '#') continue;
+      std::istringstream fields(line);
+      GemmKey k;
+      GemmAlgo a;
+      if (!(fields >> k.dtype >> k.layout >> k.m >> k.n >> k.k >> k.batch >>
+            a.algo >> a.tile >> a.split_k >> a.reduction >> a.swizzle >>
+            a.stages >> a.workspace >> a.time_ms)) {
+        return "gemm algo cache: bad entry at line " + std::to_string(line_id);
+      }
+      entries.push_back({k, a});
+    }
+    for (auto &e : entries) insert(e.first, e.second);
+    return "";
+  }
+
+  std::string save(const std::string &path) {
+    std::ofstream fout(path);
+    if (!fout) return "gemm algo cache: failed to open " + path;
+    fout << serialize();
+    if (!fout) return "gemm algo cache: failed to write " + path;
+    std::lock_guard<std::mutex> lock(_mutex);
+    _dirty = false;
+    return "";
+  }
+
+  std::string load(const std::string &path) {
+    std::ifstream fin(path);
+    if (!fin) return "gemm algo cache: failed to open " + path;
+    std::stringstream buf;
+    buf << fin.rdbuf();
+    std::string res = deserialize(buf.str());
+    if (res.empty()) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _dirty = false;
+    }
+    return res;
+  }
+
+ private:
+  static std::string sanitize(std::string s) {
+    std::replace(s.begin(), s.end(), ' ', '_');
+    return s;
+  }
+
+  std::map<GemmKey, GemmAlgo> _algos;
+  std::string _device;
+  bool _dirty = false;
+  mutable std::mutex _mutex;
+};
+
+/* Settings of the gemm tuning, read from the environment:
+ *   LS_GEMM_ALGO_CACHE  file to load the cache from and save it to
+ *   LS_GEMM_TUNE        1 to run a tuning pass before the benchmark sweep of
+ *                       lightseq_benchmark
+ *   LS_GEMM_EPILOGUE    0 to run the bias and activation after the gemm as a
+ *                       separate kernel instead of the cublasLt epilogue
+ */
+struct GemmTuneConfig {
+  std::string cache_path;
+  bool tune = false;
+  bool epilogue = true;
+  int warmup = 2;
+  int iters = 10;
+
+  static GemmTuneConfig from_env() {
+    GemmTuneConfig config;
+    const char *path = getenv("LS_GEMM_ALGO_CACHE");
+    if (path) config.cache_path = path;
+    const char *tune = getenv("LS_GEMM_TUNE");
+    config.tune = tune && std::string(tune) == "1";
+    const char *epilogue = getenv("LS_GEMM_EPILOGUE");
+    config.epilogue = !(epilogue && std::string(epilogue) == "0");
+    return config;
+  }
+};
+
+/**
+Time every candidate with run(index of the candidate), which returns the
+elapsed ms of one call or a negative value if the candidate is not supported
+for the shape, and return the fastest with its mean time. The time of the
+returned algo is max() if no candidate ran.
+*/
+inline GemmAlgo select_fastest_algo(const std::vector<GemmAlgo> &candidates,
+                                    const std::function<float(int)> &run,
+                                    int warmup, int iters) {
+  GemmAlgo best;
+  for (int c = 0; c < (int)candidates.size(); c++) {
+    bool ok = true;
+    for (int i = 0; i < warmup && ok; i++) ok = run(c) >= 0;
+    float total = 0;
+    for (int i = 0; i < iters && ok; i++) {
+      float t = run(c);
+      ok = t >= 0;
+      total += t;
+    }
+    if (!ok || iters <= 0) continue;
+    float mean = total / iters;
+    if (mean < best.time_ms) {
+      best = candidates[c];
+      best.time_ms = mean;
+    }
+  }
+  return best;
+}
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,601 @@
+#include <string.h>
+
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+
+#include "gemm_dispatch.h"
+#include "util.h"
+
+namespace lightseq {
+namespace cuda {
+
+namespace {
+
+GemmTuneConfig &tune_config() {
+  static GemmTuneConfig config = GemmTuneConfig::from_env();
+  return config;
+}
+
+std::string dtype_name(cudaDataType_t t) {
+  switch (t) {
+    case CUDA_R_32F:
+      return "f32";
+    case CUDA_R_16F:
+      return "f16";
+    case CUDA_R_8I:
+      return "i8";
+    case CUDA_R_32I:
+      return "i32";
+    default:
+      return "t" + std::to_string((int)t);
+  }
+}
+
+std::string gemm_dtype(cudaDataType_t a, cudaDataType_t c,
+                       cudaDataType_t compute) {
+  return dtype_name(a) + dtype_name(c) + dtype_name(compute);
+}
+
+std::string gemm_layout(cublasOperation_t transa, cublasOperation_t transb) {
+  std::string res;
+  res += transa == CUBLAS_OP_N ? "N" : "T";
+  res += transb == CUBLAS_OP_N ? "N" : "T";
+  return res;
+}
+
+std::atomic<bool> &tuning() {
+  static std::atomic<bool> active(false);
+  return active;
+}
+
+// the cache has algos or is being tuned, the gemms skip the lookup otherwise
+std::atomic<bool> &cache_in_use() {
+  static std::atomic<bool> in_use(false);
+  return in_use;
+}
+
+// bumped when algos are added, drops the resolved algos of ResolvedAlgos
+std::atomic<uint64_t> &cache_generation() {
+  static std::atomic<uint64_t> generation(0);
+  return generation;
+}
+
+/* The arguments of a gemm that pick its algo */
+struct GemmShape {
+  cudaDataType_t a_type, c_type, compute;
+  cublasOperation_t transa, transb;
+  int m, n, k, batch;
+  bool operator==(const GemmShape &o) const {
+    return a_type == o.a_type && c_type == o.c_type && compute == o.compute &&
+           transa == o.transa && transb == o.transb && m == o.m && n == o.n &&
+           k == o.k && batch == o.batch;
+  }
+};
+
+struct GemmShapeHash {
+  size_t operator()(const GemmShape &s) const {
+    size_t h = 0;
+    for (int v : {(int)s.a_type, (int)s.c_type, (int)s.compute, (int)s.transa,
+                  (int)s.transb, s.m, s.n, s.k, s.batch}) {
+      h = h * 1000003 ^ (size_t)v;
+    }
+    return h;
+  }
+};
+
+/* Algo of the shapes already looked up by this thread, -1 if the cache has
+ * none, so that the gemms of the hot path take neither the lock of the cache
+ * nor build its string key */
+struct ResolvedAlgos {
+  uint64_t generation = ~0ull;
+  std::unordered_map<GemmShape, int, GemmShapeHash> algos;
+
+  static ResolvedAlgos &local() {
+    static thread_local ResolvedAlgos resolved;
+    uint64_t generation = cache_generation().load();
+    if (resolved.generation != generation) {
+      resolved.algos.clear();
+      resolved.generation = generation;
+    }
+    return resolved;
+  }
+};
+
+size_t dtype_bytes(cudaDataType_t t) {
+  switch (t) {
+    case CUDA_R_16F:
+      return 2;
+    case CUDA_R_8I:
+      return 1;
+    default:
+      return 4;
+  }
+}
+
+// host scalars of the compute type, all zero bits is 0 for every type
+bool is_zero(const void *beta, cudaDataType_t compute) {
+  size_t bytes = compute == CUDA_R_16F ? 2 : 4;
+  static const char zeros[8] = {0};
+  return memcmp(beta, zeros, bytes) == 0;
+}
+
+/* Elapsed ms of one run() on the stream, negative if it failed */
+template <typename Func>
+float time_on_stream(cudaStream_t stream, Func run) {
+  cudaEvent_t start, stop;
+  CHECK_GPU_ERROR(cudaEventCreate(&start));
+  CHECK_GPU_ERROR(cudaEventCreate(&stop));
+  CHECK_GPU_ERROR(cudaEventRecord(start, stream));
+  bool ok = run();
+  CHECK_GPU_ERROR(cudaEventRecord(stop, stream));
+  CHECK_GPU_ERROR(cudaEventSynchronize(stop));
+  float ms = -1;
+  if (ok) CHECK_GPU_ERROR(cudaEventElapsedTime(&ms, start, stop));
+  CHECK_GPU_ERROR(cudaEventDestroy(start));
+  CHECK_GPU_ERROR(cudaEventDestroy(stop));
+  return ms;
+}
+
+std::vector<GemmAlgo> cublas_candidates(cudaDataType_t compute) {
+  std::vector<GemmAlgo> res;
+  std::vector<int> ids;
+  for (int a = CUBLAS_GEMM_DEFAULT_TENSOR_OP; a <= CUBLAS_GEMM_ALGO15_TENSOR_OP;
+       a++) {
+    ids.push_back(a);
+  }
+  // the non tensor op algos only make sense in fp32
+  if (compute == CUDA_R_32F) {
+    for (int a = CUBLAS_GEMM_DEFAULT; a <= CUBLAS_GEMM_ALGO23; a++) {
+      ids.push_back(a);
+    }
+  }
+  for (int id : ids) {
+    GemmAlgo algo;
+    algo.algo = id;
+    res.push_back(algo);
+  }
+  return res;
+}
+
+/* Cached algo of a cublas gemm, tune it first inside begin_gemm_tuning. Run
+ * is the gemm with a given algo, C of c_bytes its output */
+template <typename Run>
+cublasGemmAlgo_t cached_cublas_algo(cublasHandle_t handle,
+                                    const GemmShape &shape, const void *beta,
+                                    void *C, size_t c_bytes,
+                                    cublasGemmAlgo_t fallback, Run run) {
+  init_gemm_algo_cache();
+  if (!cache_in_use()) return fallback;
+  ResolvedAlgos &resolved = ResolvedAlgos::local();
+  auto iter = resolved.algos.find(shape);
+  if (iter != resolved.algos.end() && !tuning()) {
+    return iter->second < 0 ? fallback : (cublasGemmAlgo_t)iter->second;
+  }
+
+  cudaDataType_t computeType = shape.compute;
+  GemmKey key = {gemm_dtype(shape.a_type, shape.c_type, computeType),
+                 gemm_layout(shape.transa, shape.transb), shape.m, shape.n,
+                 shape.k, shape.batch};
+  GemmAlgoCache &cache = GemmAlgoCache::global();
+  GemmAlgo algo;
+  if (tuning() && !cache.find(key, &algo)) {
+    cudaStream_t stream;
+    CHECK_GPU_ERROR(cublasGetStream(handle, &stream));
+    // every timed run accumulates into C, the residual gemms read it
+    void *c_backup = nullptr;
+    if (!is_zero(beta, computeType)) {
+      CHECK_GPU_ERROR(cudaMalloc(&c_backup, c_bytes));
+      CHECK_GPU_ERROR(cudaMemcpyAsync(c_backup, C, c_bytes,
+                                      cudaMemcpyDeviceToDevice, stream));
+    }
+    std::vector<GemmAlgo> candidates = cublas_candidates(computeType);
+    algo = select_fastest_algo(
+        candidates,
+        [&](int c) {
+          return time_on_stream(stream, [&]() {
+            cublasGemmAlgo_t a = (cublasGemmAlgo_t)candidates[c].algo;
+            return run(a) == CUBLAS_STATUS_SUCCESS;
+          });
+        },
+        tune_config().warmup, tune_config().iters);
+    if (c_backup != nullptr) {
+      CHECK_GPU_ERROR(cudaMemcpyAsync(C, c_backup, c_bytes,
+                                      cudaMemcpyDeviceToDevice, stream));
+      CHECK_GPU_ERROR(cudaStreamSynchronize(stream));
+      CHECK_GPU_ERROR(cudaFree(c_backup));
+    }
+    if (algo.time_ms < std::numeric_limits<float>::max()) {
+      cache.insert(key, algo);
+      cache_generation()++;
+    }
+  }
+  int res = cache.lookup(key, &algo) && !algo.is_lt() ? algo.algo : -1;
+  ResolvedAlgos::local().algos[shape] = res;
+  return res < 0 ? fallback : (cublasGemmAlgo_t)res;
+}
+
+}  // namespace
+
+void init_gemm_algo_cache() {
+  static std::once_flag flag;
+  std::call_once(flag, []() {
+    GemmAlgoCache &cache = GemmAlgoCache::global();
+    int device;
+    cudaDeviceProp prop;
+    CHECK_GPU_ERROR(cudaGetDevice(&device));
+    CHECK_GPU_ERROR(cudaGetDeviceProperties(&prop, device));
+    cache.set_device(std::string(prop.name) + "_sm" +
+                     std::to_string(prop.major * 10 + prop.minor));
+    const std::string &path = tune_config().cache_path;
+    if (path.empty()) return;
+    std::string res = cache.load(path);
+    if (cache.size() > 0) {
+      cache_in_use() = true;
+      cache_generation()++;
+    }
+    if (res.empty()) {
+      std::cout << "loaded " << cache.size() << " gemm algos from " << path
+                << std::endl;
+    } else if (!tune_config().tune) {
+      // a missing file is expected before the first tuning
+      std::cerr << res << ", using the default gemm algos" << std::endl;
+    }
+  });
+}
+
+void begin_gemm_tuning() {
+  init_gemm_algo_cache();
+  cache_in_use() = true;
+  tuning() = true;
+}
+
+void end_gemm_tuning() {
+  tuning() = false;
+  GemmAlgoCache &cache = GemmAlgoCache::global();
+  const std::string &path = tune_config().cache_path;
+  if (path.empty() || !cache.dirty()) return;
+  std::string res = cache.save(path);
+  if (res.empty()) {
+    std::cout << "saved " << cache.size() << " gemm algos to " << path
+              << std::endl;
+  } else {
+    std::cerr << res << std::endl;
+  }
+}
+
+void set_gemm_epilogue(bool enable) { tune_config().epilogue = enable; }
+
+cublasStatus_t cublas_gemm_ex(
+    cublasHandle_t handle, cublasOperation_t transa, cublasOperation_t transb,
+    int m, int n, int k, const void *alpha, const void *A,
+    cudaDataType_t Atype, int lda, const void *B, cudaDataType_t Btype,
+    int ldb, const void *beta, void *C, cudaDataType_t Ctype, int ldc,
+    cudaDataType_t computeType, cublasGemmAlgo_t algo) {
+  auto run = [&](cublasGemmAlgo_t a) {
+    return cublasGemmEx(handle, transa, transb, m, n, k, alpha, A, Atype, lda,
+                        B, Btype, ldb, beta, C, Ctype, ldc, computeType, a);
+  };
+  GemmShape shape = {Atype, Ctype, computeType, transa, transb, m, n, k, 1};
+  size_t c_bytes = (size_t)ldc * n * dtype_bytes(Ctype);
+  cublasGemmAlgo_t cached =
+      cached_cublas_algo(handle, shape, beta, C, c_bytes, algo, run);
+  cublasStatus_t status = run(cached);
+  // an algo from a nearby shape may not support this one
+  if (status != CUBLAS_STATUS_SUCCESS && cached != algo) status = run(algo);
+  return status;
+}
+
+cublasStatus_t cublas_gemm_strided_batched_ex(
+    cublasHandle_t handle, cublasOperation_t transa, cublasOperation_t transb,
+    int m, int n, int k, const void *alpha, const void *A,
+    cudaDataType_t Atype, int lda, long long int strideA, const void *B,
+    cudaDataType_t Btype, int ldb, long long int strideB, const void *beta,
+    void *C, cudaDataType_t Ctype, int ldc, long long int strideC,
+    int batchCount, cudaDataType_t computeType, cublasGemmAlgo_t algo) {
+  auto run = [&](cublasGemmAlgo_t a) {
+    return cublasGemmStridedBatchedEx(
+        handle, transa, transb, m, n, k, alpha, A, Atype, lda, strideA, B,
+        Btype, ldb, strideB, beta, C, Ctype, ldc, strideC, batchCount,
+        computeType, a);
+  };
+  GemmShape shape = {Atype,  Ctype, computeType, transa, transb,
+                     m,      n,     k,           batchCount};
+  size_t c_bytes = ((size_t)strideC * (batchCount - 1) + (size_t)ldc * n) *
+                   dtype_bytes(Ctype);
+  cublasGemmAlgo_t cached =
+      cached_cublas_algo(handle, shape, beta, C, c_bytes, algo, run);
+  cublasStatus_t status = run(cached);
+  if (status != CUBLAS_STATUS_SUCCESS && cached != algo) status = run(algo);
+  return status;
+}
+
+namespace {
+
+GemmAlgo lt_algo_config(const cublasLtMatmulAlgo_t &lt_algo) {
+  GemmAlgo algo;
+  size_t written;
+  cublasLtMatmulAlgoConfigGetAttribute(&lt_algo, CUBLASLT_ALGO_CONFIG_ID,
+                                       &algo.algo, sizeof(int), &written);
+  cublasLtMatmulAlgoConfigGetAttribute(&lt_algo, CUBLASLT_ALGO_CONFIG_TILE_ID,
+                                       &algo.tile, sizeof(int), &written);
+  cublasLtMatmulAlgoConfigGetAttribute(&lt_algo,
+                                       CUBLASLT_ALGO_CONFIG_SPLITK_NUM,
+                                       &algo.split_k, sizeof(int), &written);
+  cublasLtMatmulAlgoConfigGetAttribute(
+      &lt_algo, CUBLASLT_ALGO_CONFIG_REDUCTION_SCHEME, &algo.reduction,
+      sizeof(int), &written);
+  cublasLtMatmulAlgoConfigGetAttribute(&lt_algo,
+                                       CUBLASLT_ALGO_CONFIG_CTA_SWIZZLING,
+                                       &algo.swizzle, sizeof(int), &written);
+#if defined(CUDA_VERSION) && CUDA_VERSION >= 11000
+  cublasLtMatmulAlgoConfigGetAttribute(&lt_algo,
+                                       CUBLASLT_ALGO_CONFIG_STAGES_ID,
+                                       &algo.stages, sizeof(int), &written);
+#endif
+  return algo;
+}
+
+bool init_lt_algo(cublasLtHandle_t handle, const GemmAlgo &algo,
+                  LtComputeType compute_type, cudaDataType_t scale_type,
+                  cudaDataType_t a_type, cudaDataType_t b_type,
+                  cudaDataType_t c_type, cublasLtMatmulAlgo_t *lt_algo) {
+  if (cublasLtMatmulAlgoInit(handle, compute_type, scale_type, a_type, b_type,
+                             c_type, c_type, algo.algo,
+                             lt_algo) != CUBLAS_STATUS_SUCCESS) {
+    return false;
+  }
+  cublasLtMatmulAlgoConfigSetAttribute(lt_algo, CUBLASLT_ALGO_CONFIG_TILE_ID,
+                                       &algo.tile, sizeof(int));
+  cublasLtMatmulAlgoConfigSetAttribute(
+      lt_algo, CUBLASLT_ALGO_CONFIG_SPLITK_NUM, &algo.split_k, sizeof(int));
+  cublasLtMatmulAlgoConfigSetAttribute(lt_algo,
+                                       CUBLASLT_ALGO_CONFIG_REDUCTION_SCHEME,
+                                       &algo.reduction, sizeof(int));
+  cublasLtMatmulAlgoConfigSetAttribute(
+      lt_algo, CUBLASLT_ALGO_CONFIG_CTA_SWIZZLING, &algo.swizzle, sizeof(int));
+#if defined(CUDA_VERSION) && CUDA_VERSION >= 11000
+  cublasLtMatmulAlgoConfigSetAttribute(lt_algo, CUBLASLT_ALGO_CONFIG_STAGES_ID,
+                                       &algo.stages, sizeof(int));
+#endif
+  return true;
+}
+
+}  // namespace
+
+bool cublaslt_find_algo(cublasLtHandle_t handle, const GemmKey &key,
+                        LtComputeType compute_type, cudaDataType_t scale_type,
+                        cudaDataType_t a_type, cudaDataType_t b_type,
+                        cudaDataType_t c_type, cublasLtMatmulDesc_t op_desc,
+                        const void *alpha, const void *A,
+                        cublasLtMatrixLayout_t a_desc, const void *B,
+                        cublasLtMatrixLayout_t b_desc, const void *beta,
+                        void *C, cublasLtMatrixLayout_t c_desc,
+                        cudaStream_t stream, cublasLtMatmulAlgo_t *lt_algo) {
+  init_gemm_algo_cache();
+  GemmAlgoCache &cache = GemmAlgoCache::global();
+  GemmAlgo algo;
+  if (tuning() && !cache.find(key, &algo)) {
+    // the heuristic candidates without workspace, timed one by one
+    const int kMaxCandidates = 8;
+    cublasLtMatmulPreference_t pref;
+    cublasLtMatmulHeuristicResult_t results[kMaxCandidates];
+    int returned = 0;
+    CHECK_GPU_ERROR(cublasLtMatmulPreferenceCreate(&pref));
+    cublasLtMatmulAlgoGetHeuristic(handle, op_desc, a_desc, b_desc, c_desc,
+                                   c_desc, pref, kMaxCandidates, results,
+                                   &returned);
+    CHECK_GPU_ERROR(cublasLtMatmulPreferenceDestroy(pref));
+    std::vector<GemmAlgo> candidates;
+    std::vector<cublasLtMatmulAlgo_t> lt_candidates;
+    for (int i = 0; i < returned; i++) {
+      if (results[i].state != CUBLAS_STATUS_SUCCESS) continue;
+      candidates.push_back(lt_algo_config(results[i].algo));
+      lt_candidates.push_back(results[i].algo);
+    }
+    algo = select_fastest_algo(
+        candidates,
+        [&](int c) {
+          const cublasLtMatmulAlgo_t *a = &lt_candidates[c];
+          return time_on_stream(stream, [&]() {
+            return cublasLtMatmul(handle, op_desc, alpha, A, a_desc, B, b_desc,
+                                  beta, C, c_desc, C, c_desc, a, NULL, 0,
+                                  stream) == CUBLAS_STATUS_SUCCESS;
+          });
+        },
+        tune_config().warmup, tune_config().iters);
+    if (algo.time_ms < std::numeric_limits<float>::max()) {
+      cache.insert(key, algo);
+      cache_generation()++;
+    }
+  }
+  if (!cache.lookup(key, &algo) || !algo.is_lt()) return false;
+  if (!init_lt_algo(handle, algo, compute_type, scale_type, a_type, b_type,
+                    c_type, lt_algo)) {
+    return false;
+  }
+  cublasLtMatmulHeuristicResult_t check;
+  return cublasLtMatmulAlgoCheck(handle, op_desc, a_desc, b_desc, c_desc,
+                                 c_desc, lt_algo,
+                                 &check) == CUBLAS_STATUS_SUCCESS;
+}
+
+#if defined(CUDA_VERSION) && CUDA_VERSION >= 11030
+namespace {
+
+/* cublasLt handle of the current device, kept for the process lifetime. The
+ * fp models only hold a cublas handle */
+cublasLtHandle_t device_lt_handle() {
+  static std::mutex mutex;
+  static std::map<int, cublasLtHandle_t> handles;
+  int device;
+  CHECK_GPU_ERROR(cudaGetDevice(&device));
+  std::lock_guard<std::mutex> lock(mutex);
+  auto iter = handles.find(device);
+  if (iter != handles.end()) return iter->second;
+  cublasLtHandle_t handle;
+  CHECK_GPU_ERROR(cublasLtCreate(&handle));
+  handles[device] = handle;
+  return handle;
+}
+
+std::string epilogue_name(GemmEpilogue epilogue) {
+  switch (epilogue) {
+    case GemmEpilogue::kBias:
+      return "_bias";
+    case GemmEpilogue::kBiasRelu:
+      return "_bias_relu";
+    default:
+      return "_bias_gelu";
+  }
+}
+
+cublasLtEpilogue_t lt_epilogue(GemmEpilogue epilogue) {
+  switch (epilogue) {
+    case GemmEpilogue::kBias:
+      return CUBLASLT_EPILOGUE_BIAS;
+    case GemmEpilogue::kBiasRelu:
+      return CUBLASLT_EPILOGUE_RELU_BIAS;
+    default:
+      return CUBLASLT_EPILOGUE_GELU_BIAS;
+  }
+}
+
+/* The arguments of an epilogue gemm that its cublasLt descriptors and algo
+ * depend on, the pointers and scalars aside */
+struct LtGemmShape {
+  int device;
+  cublasOperation_t transa, transb;
+  int m, n, k, lda, ldb, ldc;
+  GemmEpilogue epilogue;
+  cudaDataType_t data_type, compute;
+  bool operator==(const LtGemmShape &o) const {
+    return device == o.device && transa == o.transa && transb == o.transb &&
+           m == o.m && n == o.n && k == o.k && lda == o.lda && ldb == o.ldb &&
+           ldc == o.ldc && epilogue == o.epilogue &&
+           data_type == o.data_type && compute == o.compute;
+  }
+};
+
+struct LtGemmShapeHash {
+  size_t operator()(const LtGemmShape &s) const {
+    size_t h = 0;
+    for (int v : {s.device, (int)s.transa, (int)s.transb, s.m, s.n, s.k, s.lda,
+                  s.ldb, s.ldc, (int)s.epilogue, (int)s.data_type,
+                  (int)s.compute}) {
+      h = h * 1000003 ^ (size_t)v;
+    }
+    return h;
+  }
+};
+
+/* Matmul descriptor and layouts of one shape, created on its first gemm and
+ * reused by the later ones, only the bias pointer is set per call. The algo
+ * is resolved again when the algo cache changes */
+struct LtGemmDescs {
+  cublasLtHandle_t lt_handle;
+  cublasLtMatmulDesc_t op_desc = nullptr;
+  cublasLtMatrixLayout_t a_desc = nullptr, b_desc = nullptr, c_desc = nullptr;
+  uint64_t generation = ~0ull;
+  bool cached = false;
+  cublasLtMatmulAlgo_t algo;
+
+  LtGemmDescs(const LtGemmShape &s, LtComputeType compute_type)
+      : lt_handle(device_lt_handle()) {
+    cublasLtEpilogue_t lt_epi = lt_epilogue(s.epilogue);
+    CHECK_GPU_ERROR(
+        cublasLtMatmulDescCreate(&op_desc, compute_type, s.compute));
+    CHECK_GPU_ERROR(cublasLtMatmulDescSetAttribute(
+        op_desc, CUBLASLT_MATMUL_DESC_TRANSA, &s.transa, sizeof(s.transa)));
+    CHECK_GPU_ERROR(cublasLtMatmulDescSetAttribute(
+        op_desc, CUBLASLT_MATMUL_DESC_TRANSB, &s.transb, sizeof(s.transb)));
+    CHECK_GPU_ERROR(cublasLtMatmulDescSetAttribute(
+        op_desc, CUBLASLT_MATMUL_DESC_EPILOGUE, &lt_epi, sizeof(lt_epi)));
+    CHECK_GPU_ERROR(cublasLtMatrixLayoutCreate(
+        &a_desc, s.data_type, s.transa == CUBLAS_OP_N ? s.m : s.k,
+        s.transa == CUBLAS_OP_N ? s.k : s.m, s.lda));
+    CHECK_GPU_ERROR(cublasLtMatrixLayoutCreate(
+        &b_desc, s.data_type, s.transb == CUBLAS_OP_N ? s.k : s.n,
+        s.transb == CUBLAS_OP_N ? s.n : s.k, s.ldb));
+    CHECK_GPU_ERROR(
+        cublasLtMatrixLayoutCreate(&c_desc, s.data_type, s.m, s.n, s.ldc));
+  }
+
+  ~LtGemmDescs() {
+    if (a_desc) cublasLtMatrixLayoutDestroy(a_desc);
+    if (b_desc) cublasLtMatrixLayoutDestroy(b_desc);
+    if (c_desc) cublasLtMatrixLayoutDestroy(c_desc);
+    if (op_desc) cublasLtMatmulDescDestroy(op_desc);
+  }
+};
+
+/* Descriptors of the epilogue gemms run by this thread. A descriptor is
+ * written by the bias pointer of every call, so it is not shared between
+ * threads */
+LtGemmDescs &local_lt_descs(const LtGemmShape &shape,
+                            LtComputeType compute_type) {
+  static thread_local std::unordered_map<LtGemmShape,
+                                         std::unique_ptr<LtGemmDescs>,
+                                         LtGemmShapeHash>
+      descs;
+  std::unique_ptr<LtGemmDescs> &entry = descs[shape];
+  if (!entry) entry.reset(new LtGemmDescs(shape, compute_type));
+  return *entry;
+}
+
+}  // namespace
+
+bool cublaslt_gemm_bias_act(cublasHandle_t handle, cublasOperation_t transa,
+                            cublasOperation_t transb, int m, int n, int k,
+                            const void *alpha, const void *A, int lda,
+                            const void *B, int ldb, const void *beta, void *C,
+                            int ldc, const void *bias, cudaDataType_t data_type,
+                            cudaDataType_t computeType, GemmEpilogue epilogue) {
+  if (!tune_config().epilogue) return false;
+  cudaStream_t stream;
+  CHECK_GPU_ERROR(cublasGetStream(handle, &stream));
+  LtComputeType compute_type =
+      computeType == CUDA_R_16F ? CUBLAS_COMPUTE_16F : CUBLAS_COMPUTE_32F;
+
+  int device;
+  CHECK_GPU_ERROR(cudaGetDevice(&device));
+  LtGemmShape shape = {device, transa, transb,   m,         n,
+                       k,      lda,    ldb,      ldc,       epilogue,
+                       data_type,      computeType};
+  LtGemmDescs &descs = local_lt_descs(shape, compute_type);
+  cublasLtHandle_t lt_handle = descs.lt_handle;
+  CHECK_GPU_ERROR(cublasLtMatmulDescSetAttribute(
+      descs.op_desc, CUBLASLT_MATMUL_DESC_BIAS_POINTER, &bias, sizeof(bias)));
+
+  uint64_t generation = cache_generation().load();
+  if (descs.generation != generation || tuning()) {
+    GemmKey key = {gemm_dtype(data_type, data_type, computeType) +
+                       epilogue_name(epilogue),
+                   gemm_layout(transa, transb), m, n, k, 1};
+    descs.cached = cublaslt_find_algo(
+        lt_handle, key, compute_type, computeType, data_type, data_type,
+        data_type, descs.op_desc, alpha, A, descs.a_desc, B, descs.b_desc,
+        beta, C, descs.c_desc, stream, &descs.algo);
+    // tuning may have added the algo
+    descs.generation = cache_generation().load();
+  }
+  cublasStatus_t status = cublasLtMatmul(
+      lt_handle, descs.op_desc, alpha, A, descs.a_desc, B, descs.b_desc, beta,
+      C, descs.c_desc, C, descs.c_desc, descs.cached ? &descs.algo : NULL,
+      NULL, 0, stream);
+  return status == CUBLAS_STATUS_SUCCESS;
+}
+#else
+bool cublaslt_gemm_bias_act(cublasHandle_t handle, cublasOperation_t transa,
+                            cublasOperation_t transb, int m, int n, int k,
+                            const void *alpha, const void *A, int lda,
+                            const void *B, int ldb, const void *beta, void *C,
+                            int ldc, const void *bias, cudaDataType_t data_type,
+                            cudaDataType_t computeType, GemmEpilogue epilogue) {
+  // the gelu epilogue of cublasLt needs CUDA 11.3
+  return false;
+}
+#endif
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cublasLt.h>
+#include <cublas_v2.h>
+#include <cuda.h>
+#include <cuda_runtime.h>
+
+#include "gemm_algo_cache.h"
+
+/**
+@file
+Gemm dispatch through the algo cache of gemm_algo_cache.h.
+
+cublas_gemm_ex and cublas_gemm_strided_batched_ex are drop-in for
+cublasGemmEx and cublasGemmStridedBatchedEx: they run the cached algo of the
+shape, or the given algo if the shape has no cached algo. Inference never
+tunes: the untuned shapes are tuned on their first call between
+begin_gemm_tuning and end_gemm_tuning only, which saves the cache to
+LS_GEMM_ALGO_CACHE once. lightseq_benchmark runs such a pass with
+LS_GEMM_TUNE=1, tuning once offline and shipping the file is the intended
+use.
+
+Without a loaded cache or a tuning pass the gemms go straight to cublas.
+Otherwise every thread resolves the algo of a shape once and then reads it
+from its own table, the gemms of the hot path do not lock.
+*/
+namespace lightseq {
+namespace cuda {
+
+/* Load LS_GEMM_ALGO_CACHE into the global cache, once per process. Called by
+ * the dispatch on its first gemm */
+void init_gemm_algo_cache();
+
+/* Tune the untuned gemms run until end_gemm_tuning, e.g. a warmup over the
+ * batch sizes to serve. The output of a gemm with a non-zero beta is restored
+ * after timing its candidates */
+void begin_gemm_tuning();
+/* Stop tuning and save the cache to LS_GEMM_ALGO_CACHE if it changed */
+void end_gemm_tuning();
+
+/* Override LS_GEMM_EPILOGUE, e.g. to compare both paths in one process. Set
+ * it between inferences, not while one is running */
+void set_gemm_epilogue(bool enable);
+
+cublasStatus_t cublas_gemm_ex(
+    cublasHandle_t handle, cublasOperation_t transa, cublasOperation_t transb,
+    int m, int n, int k, const void *alpha, const void *A,
+    cudaDataType_t Atype, int lda, const void *B, cudaDataType_t Btype,
+    int ldb, const void *beta, void *C, cudaDataType_t Ctype, int ldc,
+    cudaDataType_t computeType,
+    cublasGemmAlgo_t algo = CUBLAS_GEMM_DEFAULT_TENSOR_OP);
+
+cublasStatus_t cublas_gemm_strided_batched_ex(
+    cublasHandle_t handle, cublasOperation_t transa, cublasOperation_t transb,
+    int m, int n, int k, const void *alpha, const void *A,
+    cudaDataType_t Atype, int lda, long long int strideA, const void *B,
+    cudaDataType_t Btype, int ldb, long long int strideB, const void *beta,
+    void *C, cudaDataType_t Ctype, int ldc, long long int strideC,
+    int batchCount, cudaDataType_t computeType,
+    cublasGemmAlgo_t algo = CUBLAS_GEMM_DEFAULT_TENSOR_OP);
+
+#if defined(CUDA_VERSION) && CUDA_VERSION >= 11000
+typedef cublasComputeType_t LtComputeType;
+#else
+typedef cudaDataType_t LtComputeType;
+#endif
+
+/**
+Find the cached algo of a cublasLt matmul with D == C and a zero beta,
+tuning it first inside begin_gemm_tuning. Return false if there is none,
+the caller then passes NULL and lets cublasLt pick one with its heuristic.
+*/
+bool cublaslt_find_algo(cublasLtHandle_t handle, const GemmKey &key,
+                        LtComputeType compute_type, cudaDataType_t scale_type,
+                        cudaDataType_t a_type, cudaDataType_t b_type,
+                        cudaDataType_t c_type, cublasLtMatmulDesc_t op_desc,
+                        const void *alpha, const void *A,
+                        cublasLtMatrixLayout_t a_desc, const void *B,
+                        cublasLtMatrixLayout_t b_desc, const void *beta,
+                        void *C, cublasLtMatrixLayout_t c_desc,
+                        cudaStream_t stream, cublasLtMatmulAlgo_t *algo);
+
+enum class GemmEpilogue { kBias, kBiasRelu, kBiasGelu };
+
+/**
+C = epilogue(alpha * op(A) * op(B)) by cublasLt, the bias of the m rows of
+the column major C is broadcast over its n columns. The bias and the
+activation are applied before C is written, instead of another pass over C
+after the gemm. The beta should be zero, A, B, C and the bias are of
+data_type. Return false without running anything if the epilogue is
+disabled by LS_GEMM_EPILOGUE=0 or not supported by this cublasLt (before
+CUDA 11.3, or a shape it rejects), the caller then runs cublas_gemm_ex and
+the elementwise kernel itself. The cublasLt descriptors of a shape are
+created on its first call and kept by the calling thread.
+*/
+bool cublaslt_gemm_bias_act(cublasHandle_t handle, cublasOperation_t transa,
+                            cublasOperation_t transb, int m, int n, int k,
+                            const void *alpha, const void *A, int lda,
+                            const void *B, int ldb, const void *beta, void *C,
+                            int ldc, const void *bias, cudaDataType_t data_type,
+                            cudaDataType_t computeType, GemmEpilogue epilogue);
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+@file
+Cache of the int8 kernels of the quantized models after their transform to
+the cublasLt layouts, CUDA-free so that the format can be tested on host.
+
+A model records the kernels in the order it loads them, see
+load_int8_weight in cublas_helper.h, and later starts read them back
+instead of transforming them again. The file is keyed by the hash of the
+int8 weights, the gpu architecture and the cublasLt version, every entry
+by its shape and layout, an entry that does not match is transformed again
+and the file rewritten.
+
+The cache directory is LS_INT8_WEIGHT_CACHE, unset disables the cache.
+Binary format, little endian:
+  "LSI8" <uint32 version> <uint32 key size> <key>
+  <uint32 entry count>
+  {<int32 rows> <int32 cols> <int32 layout> <uint64 size> <size bytes>} *
+*/
+namespace lightseq {
+namespace cuda {
+
+/* FNV-1a over the 64 bit words of data, then its tail bytes */
+inline uint64_t bytes_hash(const void *data, size_t n,
+                           uint64_t h = 1469598103934665603ull) {
+  const unsigned char *p = (const unsigned char *)data;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    uint64_t word;
+    memcpy(&word, p + i, sizeof(word));
+    h = (h ^ word) * 1099511628211ull;
+  }
+  for (; i < n; i++) h = (h ^ p[i]) * 1099511628211ull;
+  return h ^ n;
+}
+
+inline uint64_t bytes_hash(const std::vector<int8_t> &data,
+                           uint64_t h = 1469598103934665603ull) {
+  return bytes_hash(data.data(), data.size(), h);
+}
+
+struct Int8WeightEntry {
+  int rows;
+  int cols;
+  int layout;
+  std::vector<int8_t> data;
+};
+
+class Int8WeightCache {
+ public:
+  static constexpr uint32_t kVersion = 1;
+
+  Int8WeightCache() {}
+  /* path empty disables the cache */
+  Int8WeightCache(const std::string &path, const std::string &key)
+      : _path(path), _key(key) {}
+
+  bool enabled() const { return !_path.empty(); }
+  const std::string &path() const { return _path; }
+
+  /**
+  The next kernel if the cache has it for this shape and layout, else
+  nullptr and the caller transforms it and adds it.
+  */
+  const std::vector<int8_t> *next(int rows, int cols, int layout) {
+    if (_pos >= _entries.size()) return nullptr;
+    const Int8WeightEntry &e = _entries[_pos];
+    if (e.rows != rows || e.cols != cols || e.layout != layout ||
+        e.data.size() != (size_t)rows * cols) {
+      return nullptr;
+    }
+    _pos++;
+    _num_hits++;
+    return &e.data;
+  }
+
+  /* Record the kernel missed by next, the entries after it are dropped */
+  void add(int rows, int cols, int layout, std::vector<int8_t> data) {
+    _entries.resize(_pos);
+    _entries.push_back({rows, cols, layout, std::move(data)});
+    _pos++;
+    _dirty = true;
+  }
+
+  int num_hits() const { return _num_hits; }
+  size_t size() const { return _entries.size(); }
+  bool dirty() const { return _dirty; }
+
+  std::string serialize() const {
+    std::string res("LSI8", 4);
+    put(&res, kVersion);
+    put(&res, (uint32_t)_key.size());
+    res += _key;
+    put(&res, (uint32_t)_entries.size());
+    for (const Int8WeightEntry &e : _entries) {
+      put(&res, (int32_t)e.rows);
+      put(&res, (int32_t)e.cols);
+      put(&res, (int32_t)e.layout);
+      put(&res, (uint64_t)e.data.size());
+      res.append((const char *)e.data.data(), e.data.size());
+    }
+    return res;
+  }
+
+  /* Replace the entries, return an error message, empty on success */
+  std::string deserialize(const std::string &bytes) {
+    size_t pos = 0;
+    if (bytes.compare(0, 4, "LSI8") != 0) {
+      return "int8 weight cache: bad magic";
+    }
+    pos = 4;
+    uint32_t version, key_size, num_entries;
+    if (!get(bytes, &pos, &version) || version != kVersion) {
+      return "int8 weight cache: unsupported version";
+    }
+    if (!get(bytes, &pos, &key_size) || bytes.size() - pos < key_size ||
+        bytes.compare(pos, key_size, _key) != 0) {
+      return "int8 weight cache: built for another model or device";
+    }
+    pos += key_size;
+    if (!get(bytes, &pos, &num_entries)) {
+      return "int8 weight cache: truncated";
+    }
+    std::vector<Int8WeightEntry> entries(num_entries);
+    for (Int8WeightEntry &e : entries) {
+      int32_t rows, cols, layout;
+      uint64_t size;
+      if (!get(bytes, &pos, &rows) || !get(bytes, &pos, &cols) ||
+          !get(bytes, &pos, &layout) || !get(bytes, &pos, &size) ||
+          bytes.size() - pos < size) {
+        return "int8 weight cache: truncated";
+      }
+      e.rows = rows;
+      e.cols = cols;
+      e.layout = layout;
+      e.data.assign(bytes.begin() + pos, bytes.begin() + pos + size);
+      pos += size;
+    }
+    _entries = std::move(entries);
+    _pos = 0;
+    _dirty = false;
+    return "";
+  }
+
+  std::string load() {
+    std::ifstream fin(_path, std::ios::binary);
+    if (!fin) return "int8 weight cache: failed to open " + _path;
+    std::stringstream buf;
+    buf << fin.rdbuf();
+    return deserialize(buf.str());
+  }
+
+  /* Written to a temporary file renamed over path, so that a concurrent
+   * start never reads a partial cache */
+  std::string save() {
+    std::string tmp = _path + ".tmp" + std::to_string((uintptr_t)this);
+    {
+      std::ofstream fout(tmp, std::ios::binary);
+      if (!fout) return "int8 weight cache: failed to open " + tmp;
+      std::string bytes = serialize();
+      fout.write(bytes.data(), bytes.size());
+      if (!fout) return "int8 weight cache: failed to write " + tmp;
+    }
+    if (rename(tmp.c_str(), _path.c_str()) != 0) {
+      remove(tmp.c_str());
+      return "int8 weight cache: failed to write " + _path;
+    }
+    _dirty = false;
+    return "";
+  }
+
+ private:
+  template <typename T>
+  static void put(std::string *res, T value) {
+    res->append((const char *)&value, sizeof(value));
+  }
+
+  template <typename T>
+  static bool get(const std::string &bytes, size_t *pos, T *value) {
+    if (bytes.size() - *pos < sizeof(T)) return false;
+    memcpy(value, bytes.data() + *pos, sizeof(T));
+    *pos += sizeof(T);
+    return true;
+  }
+
+  std::string _path;
+  std::string _key;
+  std::vector<Int8WeightEntry> _entries;
+  size_t _pos = 0;
+  int _num_hits = 0;
+  bool _dirty = false;
+};
+
+/**
+Path of the cache of a model in LS_INT8_WEIGHT_CACHE, "" if unset. name
+tells the models sharing their weights apart, e.g. the encoder and the
+decoder of a transformer.
+*/
+inline std::string int8_weight_cache_path(const std::string &name,
+                                          uint64_t weight_hash, int arch) {
+  const char *dir = getenv("LS_INT8_WEIGHT_CACHE");
+  if (dir == nullptr || dir[0] == '\0') return "";
+  char hash[17];
+  snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)weight_hash);
+  return std::string(dir) + "/" + name + "_" + hash + "_sm" +
+         std::to_string(arch) + ".lsi8";
+}
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/**
+@file
+Lexical shortlist of the target vocab, CUDA-free so that the format and the
+candidate selection can be tested on host.
+
+A shortlist maps every source token to its most likely translations, e.g.
+from a word alignment of the training data. Decoding a batch with the union
+of the translations of its source tokens as the target vocab shrinks the
+logits gemm and the beam search top-k from the full vocab to a few thousand
+ids, see Decoder::set_vocab_shortlist.
+
+Saved as text, the candidates of a source token are best first:
+  # lightseq lexical shortlist v1
+  vocab <src_vocab_size> <trg_vocab_size>
+  always <trg_id> <trg_id> ...
+  <src_id> <trg_id> <trg_id> ...
+The always lines, e.g. the punctuations and the frequent words, are
+optional and may be repeated.
+*/
+namespace lightseq {
+namespace cuda {
+
+/* Check a target vocab subset: ascending, unique, in [0, vocab_size) and
+ * containing end_id. Return an error message, empty if valid */
+inline std::string check_vocab_shortlist(const std::vector<int> &ids,
+                                         int vocab_size, int end_id) {
+  if (ids.empty()) return "vocab shortlist: empty";
+  if ((int)ids.size() > vocab_size) return "vocab shortlist: too many ids";
+  for (size_t i = 0; i < ids.size(); i++) {
+    if (ids[i] < 0 || ids[i] >= vocab_size) {
+      return "vocab shortlist: id " + std::to_string(ids[i]) +
+             " out of the vocab";
+    }
+    if (i > 0 && ids[i] <= ids[i - 1]) {
+      return "vocab shortlist: ids should be ascending and unique";
+    }
+  }
+  if (!std::binary_search(ids.begin(), ids.end(), end_id)) {
+    return "vocab shortlist: missing end_id " + std::to_string(end_id);
+  }
+  return "";
+}
+
+class LexicalShortlist {
+ public:
+  static constexpr const char *kHeader = "# lightseq lexical shortlist v1";
+  // shortlists are padded to a multiple of it to keep the gemm aligned
+  static const int kAlign = 8;
+
+  int src_vocab_size() const { return _src_vocab_size; }
+  int trg_vocab_size() const { return _trg_vocab_size; }
+  const std::vector<int> &always_ids() const { return _always; }
+  const std::vector<int> &candidates(int src_id) const {
+    return _candidates[src_id];
+  }
+
+  /* Parse a serialized shortlist. Return an error message, empty on
+   * success */
+  std::string deserialize(const std::string &text) {
+    std::istringstream iss(text);
+    std::string line, tag;
+    if (!std::getline(iss, line) || line != kHeader) {
+      return "lexical shortlist: bad header";
+    }
+    int src_vocab_size, trg_vocab_size;
+    if (!std::getline(iss, line)) return "lexical shortlist: missing vocab";
+    std::istringstream vocab_line(line);
+    if (!(vocab_line >> tag >> src_vocab_size >> trg_vocab_size) ||
+        tag != "vocab" || src_vocab_size <= 0 || trg_vocab_size <= 0) {
+      return "lexical shortlist: missing vocab";
+    }
+    std::vector<std::vector<int>> candidates(src_vocab_size);
+    std::vector<int> always;
+    int line_id = 2;
+    while (std::getline(iss, line)) {
+      line_id++;
+      if (line.empty() || line[0] == '#') continue;
+      std::string bad = "lexical shortlist: bad entry at line " +
+                        std::to_string(line_id);
+      std::istringstream fields(line);
+      std::vector<int> *dst = &always;
+      if (line.compare(0, 6, "always") == 0) {
+        fields >> tag;
+      } else {
+        int src_id;
+        if (!(fields >> src_id) || src_id < 0 || src_id >= src_vocab_size) {
+          return bad;
+        }
+        dst = &candidates[src_id];
+      }
+      int trg_id;
+      while (fields >> trg_id) {
+        if (trg_id < 0 || trg_id >= trg_vocab_size) return bad;
+        dst->push_back(trg_id);
+      }
+      if (!fields.eof()) return bad;
+    }
+    _src_vocab_size = src_vocab_size;
+    _trg_vocab_size = trg_vocab_size;
+    _candidates.swap(candidates);
+    _always.swap(always);
+    return "";
+  }
+
+  std::string load(const std::string &path) {
+    std::ifstream fin(path);
+    if (!fin) return "lexical shortlist: failed to open " + path;
+    std::stringstream buf;
+    buf << fin.rdbuf();
+    return deserialize(buf.str());
+  }
+
+  /**
+  Target vocab subset of a batch: the always ids, the required ids (e.g.
+  start_id and end_id) and the top_k best candidates of every source token,
+  top_k <= 0 takes them all. The ids are ascending and unique, padded with
+  the smallest missing ids to a multiple of kAlign. Tokens out of the source
+  vocab, e.g. the padding, are skipped.
+  */
+  std::vector<int> build(const int *src_tokens, int num_tokens, int top_k,
+                         const std::vector<int> &required = {}) const {
+    std::vector<char> picked(_trg_vocab_size, 0);
+    auto pick = [&](int id) {
+      if (id >= 0 && id < _trg_vocab_size) picked[id] = 1;
+    };
+    for (int id : _always) pick(id);
+    for (int id : required) pick(id);
+    for (int i = 0; i < num_tokens; i++) {
+      int src_id = src_tokens[i];
+      if (src_id < 0 || src_id >= _src_vocab_size) continue;
+      const std::vector<int> &cands = _candidates[src_id];
+      int n = top_k > 0 ? std::min(top_k, (int)cands.size()) : cands.size();
+      for (int j = 0; j < n; j++) pick(cands[j]);
+    }
+    std::vector<int> res;
+    for (int id = 0; id < _trg_vocab_size; id++) {
+      if (picked[id]) res.push_back(id);
+    }
+    int padded = std::min(_trg_vocab_size,
+                          (int)(res.size() + kAlign - 1) / kAlign * kAlign);
+    for (int id = 0; (int)res.size() < padded; id++) {
+      if (!picked[id]) res.push_back(id);
+    }
+    std::sort(res.begin(), res.end());
+    return res;
+  }
+
+ private:
+  int _src_vocab_size = 0;
+  int _trg_vocab_size = 0;
+  std::vector<std::vector<int>> _candidates;
+  std::vector<int> _always;
+};
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+/**
+@file
+Int8 kernels of the quantized models, CUDA-free so that it can be tested on
+host.
+
+The kernels are stored as uint8 with a zero point of 127, see dequantize in
+util.h. They are kept in int8 from the weight file to the device: the
+weight classes convert them to x - 127 clamped to [-127, 127], the value
+the dequantization on host and the quantization on device used to give,
+and the models only transform their layout on device, see
+load_int8_weight in cublas_helper.h.
+*/
+namespace lightseq {
+namespace cuda {
+
+inline int8_t weight_uint8_to_int8(unsigned char x) {
+  return (int8_t)std::min(127, (int)x - 127);
+}
+
+inline void uint8_to_int8(const unsigned char *src, int8_t *dst, size_t n) {
+  for (size_t i = 0; i < n; i++) dst[i] = weight_uint8_to_int8(src[i]);
+}
+
+/* Append the uint8 kernel src (a proto bytes field) to dst in int8,
+ * returns its offset in dst */
+inline int append_int8_weight(const std::string &src,
+                              std::vector<int8_t> *dst) {
+  int offset = dst->size();
+  dst->resize(offset + src.size());
+  uint8_to_int8(reinterpret_cast<const unsigned char *>(src.data()),
+                dst->data() + offset, src.size());
+  return offset;
+}
+
+/**
+scale * the sums of the columns of the [rows, cols] int8 kernel weight,
+dequantized with dequant_scale (clip_max / 127). The relu models use it to
+correct the zero point of their ffn activations.
+*/
+inline std::vector<float> int8_scaled_colsum(const int8_t *weight, int rows,
+                                             int cols, float dequant_scale,
+                                             float scale) {
+  std::vector<long> sum(cols, 0);
+  for (int r = 0; r < rows; r++) {
+    for (int c = 0; c < cols; c++) sum[c] += weight[(long)r * cols + c];
+  }
+  std::vector<float> res(cols);
+  for (int c = 0; c < cols; c++) res[c] = sum[c] * dequant_scale * scale;
+  return res;
+}
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,370 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+@file
+Exact-match cache of generation results in front of the model, for traffic
+with repeated segments (UI strings, boilerplate). CUDA-free so that it is
+tested on host, used by the python wrapper and the triton backend.
+
+The key of an input row is (model id, generation config, row ids without the
+trailing padding), so a repeat hits whatever length its batch was padded to.
+The value is the [num_seqs, seq_len] output ids and [num_seqs] scores of the
+row.
+
+The cache is split into shards by key hash, each with its own lock, LRU list
+and share of the byte budget. With admission, a new entry only evicts the
+least recently used one if it was requested more often, by a small count-min
+sketch of the recent request frequencies (TinyLFU), so that one-off
+segments do not flush the repeated ones.
+
+plan_result_batch splits a batch into the cache hits and the unique misses,
+duplicates within the batch run once; fill_result_batch assembles the outputs
+of the whole batch after the misses ran.
+*/
+namespace lightseq {
+namespace cuda {
+
+struct ResultCacheConfig {
+  size_t capacity_bytes = size_t(256) << 20;
+  int num_shards = 16;
+  bool admission = true;
+
+  std::string check() const {
+    if (num_shards < 1) return "num_shards should be positive";
+    return "";
+  }
+};
+
+/* Outputs of one input row */
+struct CachedResult {
+  int num_seqs = 0;
+  int seq_len = 0;
+  std::vector<int> ids;       // [num_seqs, seq_len]
+  std::vector<float> scores;  // [num_seqs]
+
+  size_t bytes() const {
+    return ids.size() * sizeof(int) + scores.size() * sizeof(float);
+  }
+};
+
+struct ResultCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t inserts = 0;
+  uint64_t rejected = 0;  // not admitted, or larger than a shard
+  uint64_t evictions = 0;
+  uint64_t entries = 0;
+  uint64_t bytes = 0;
+  uint64_t capacity_bytes = 0;
+
+  double hit_rate() const {
+    uint64_t total = hits + misses;
+    return total ? double(hits) / total : 0.;
+  }
+};
+
+/* Key of the input row, trailing padding_id stripped, -1 keeps the row as is
+ */
+inline std::string result_cache_key(const std::string &model_id,
+                                    const std::string &config, const int *row,
+                                    int seq_len, int padding_id) {
+  int len = seq_len;
+  while (padding_id >= 0 && len > 0 && row[len - 1] == padding_id) len--;
+  std::string key;
+  key.reserve(model_id.size() + config.size() + 2 + len * sizeof(int));
+  key.append(model_id).push_back('\0');
+  key.append(config).push_back('\0');
+  key.append(reinterpret_cast<const char *>(row), len * sizeof(int));
+  return key;
+}
+
+/**
+Count-min sketch of 4 rows of saturating 4 bit counters, kept in a byte each.
+All the counters are halved every sample_size additions so that the
+estimates follow the recent requests.
+*/
+class FrequencySketch {
+ public:
+  explicit FrequencySketch(size_t width) {
+    size_t n = 16;
+    while (n < width) n *= 2;
+    mask_ = n - 1;
+    table_.assign(kDepth * n, 0);
+    sample_size_ = 10 * n;
+  }
+
+  void add(uint64_t hash) {
+    for (int d = 0; d < kDepth; d++) {
+      uint8_t &c = table_[d * (mask_ + 1) + index(hash, d)];
+      if (c < 15) c++;
+    }
+    if (++additions_ >= sample_size_) {
+      for (uint8_t &c : table_) c >>= 1;
+      additions_ /= 2;
+    }
+  }
+
+  int estimate(uint64_t hash) const {
+    int res = 15;
+    for (int d = 0; d < kDepth; d++) {
+      res = std::min<int>(res, table_[d * (mask_ + 1) + index(hash, d)]);
+    }
+    return res;
+  }
+
+ private:
+  static const int kDepth = 4;
+
+  size_t index(uint64_t hash, int d) const {
+    // a different odd multiplier per row
+    static const uint64_t kSeeds[kDepth] = {
+        0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull,
+        0xD6E8FEB86659FD93ull};
+    uint64_t h = (hash + d) * kSeeds[d];
+    return (size_t)(h >> 32) & mask_;
+  }
+
+  std::vector<uint8_t> table_;
+  size_t mask_;
+  size_t sample_size_;
+  size_t additions_ = 0;
+};
+
+class ResultCache {
+ public:
+  explicit ResultCache(const ResultCacheConfig &config) : config_(config) {
+    std::string res = config.check();
+    if (!res.empty()) throw std::runtime_error(res);
+    for (int i = 0; i < config.num_shards; i++) {
+      shards_.emplace_back(
+          new Shard(config.capacity_bytes / config.num_shards));
+    }
+  }
+
+  const ResultCacheConfig &config() const { return config_; }
+
+  /* Copy of the cached result of the key, false on a miss */
+  bool lookup(const std::string &key, CachedResult *result) {
+    uint64_t hash = hash_(key);
+    Shard &s = shard(hash);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.sketch.add(hash);
+    auto iter = s.index.find(key);
+    if (iter == s.index.end()) {
+      misses_++;
+      return false;
+    }
+    s.lru.splice(s.lru.begin(), s.lru, iter->second);
+    *result = iter->second->value;
+    hits_++;
+    return true;
+  }
+
+  /* False if the result is not admitted */
+  bool insert(const std::string &key, CachedResult result) {
+    uint64_t hash = hash_(key);
+    Shard &s = shard(hash);
+    size_t bytes = entry_bytes(key, result);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto iter = s.index.find(key);
+    if (iter != s.index.end()) erase(&s, iter->second);
+    if (bytes > s.capacity) {
+      rejected_++;
+      return false;
+    }
+    while (s.bytes + bytes > s.capacity) {
+      Entry &victim = s.lru.back();
+      if (config_.admission &&
+          s.sketch.estimate(hash) <= s.sketch.estimate(victim.hash)) {
+        rejected_++;
+        return false;
+      }
+      erase(&s, std::prev(s.lru.end()));
+      evictions_++;
+    }
+    s.lru.emplace_front();
+    Entry &e = s.lru.front();
+    e.key = key;
+    e.hash = hash;
+    e.bytes = bytes;
+    e.value = std::move(result);
+    s.index[e.key] = s.lru.begin();
+    s.bytes += bytes;
+    inserts_++;
+    return true;
+  }
+
+  void clear() {
+    for (auto &s : shards_) {
+      std::lock_guard<std::mutex> lock(s->mutex);
+      s->lru.clear();
+      s->index.clear();
+      s->bytes = 0;
+    }
+  }
+
+  ResultCacheStats stats() const {
+    ResultCacheStats res;
+    res.hits = hits_;
+    res.misses = misses_;
+    res.inserts = inserts_;
+    res.rejected = rejected_;
+    res.evictions = evictions_;
+    res.capacity_bytes = config_.capacity_bytes;
+    for (auto &s : shards_) {
+      std::lock_guard<std::mutex> lock(s->mutex);
+      res.entries += s->lru.size();
+      res.bytes += s->bytes;
+    }
+    return res;
+  }
+
+ private:
+  struct Entry {
+    std::string key;
+    uint64_t hash;
+    size_t bytes;
+    CachedResult value;
+  };
+
+  struct Shard {
+    explicit Shard(size_t capacity)
+        : capacity(capacity),
+          sketch(std::max<size_t>(capacity / 1024, 1024)) {}
+    std::mutex mutex;
+    size_t capacity;
+    size_t bytes = 0;
+    std::list<Entry> lru;  // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    FrequencySketch sketch;
+  };
+
+  // the key twice (entry and index) and a rough node overhead
+  static size_t entry_bytes(const std::string &key,
+                            const CachedResult &result) {
+    return 2 * key.size() + result.bytes() + sizeof(Entry) + 64;
+  }
+
+  Shard &shard(uint64_t hash) {
+    return *shards_[(hash >> 16) % shards_.size()];
+  }
+
+  static void erase(Shard *s, std::list<Entry>::iterator iter) {
+    s->bytes -= iter->bytes;
+    s->index.erase(iter->key);
+    s->lru.erase(iter);
+  }
+
+  ResultCacheConfig config_;
+  std::hash<std::string> hash_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  std::atomic<uint64_t> hits_{0};
+  std::atomic<uint64_t> misses_{0};
+  std::atomic<uint64_t> inserts_{0};
+  std::atomic<uint64_t> rejected_{0};
+  std::atomic<uint64_t> evictions_{0};
+};
+
+/* A batch split into the cache hits and the unique misses */
+struct ResultBatchPlan {
+  std::vector<std::string> keys;   // [batch_size]
+  std::vector<int> miss_index;     // [batch_size], -1 for a hit
+  std::vector<CachedResult> hits;  // [batch_size], set for the hits
+  std::vector<int> miss_rows;      // first row of every unique miss
+};
+
+inline ResultBatchPlan plan_result_batch(ResultCache *cache,
+                                         const std::string &model_id,
+                                         const std::string &config,
+                                         const int *input, int batch_size,
+                                         int seq_len, int padding_id) {
+  ResultBatchPlan plan;
+  plan.miss_index.assign(batch_size, -1);
+  plan.hits.resize(batch_size);
+  std::unordered_map<std::string, int> pending;
+  for (int i = 0; i < batch_size; i++) {
+    plan.keys.push_back(result_cache_key(
+        model_id, config, input + (size_t)i * seq_len, seq_len, padding_id));
+    const std::string &key = plan.keys.back();
+    auto iter = pending.find(key);
+    if (iter != pending.end()) {
+      plan.miss_index[i] = iter->second;
+    } else if (!cache->lookup(key, &plan.hits[i])) {
+      plan.miss_index[i] = plan.miss_rows.size();
+      pending[key] = plan.miss_index[i];
+      plan.miss_rows.push_back(i);
+    }
+  }
+  return plan;
+}
+
+/* Result of row i of the outputs ids [rows, num_seqs, seq_len] and scores
+ * [rows, num_seqs] */
+inline CachedResult result_of_row(const int *ids, const float *scores, int i,
+                                  int num_seqs, int seq_len) {
+  CachedResult res;
+  res.num_seqs = num_seqs;
+  res.seq_len = seq_len;
+  const int *row = ids + (size_t)i * num_seqs * seq_len;
+  res.ids.assign(row, row + num_seqs * seq_len);
+  res.scores.assign(scores + (size_t)i * num_seqs,
+                    scores + (size_t)(i + 1) * num_seqs);
+  return res;
+}
+
+/**
+Cache the results of the misses, [miss_rows.size()], and assemble the outputs
+of the whole batch: ids [batch_size, num_seqs, seq_len] with seq_len the
+longest one, scores [batch_size, num_seqs]. A shorter sequence is padded with
+its last token, the end id of a finished generation.
+*/
+inline void fill_result_batch(ResultCache *cache, ResultBatchPlan *plan,
+                              const std::vector<CachedResult> &miss_results,
+                              std::vector<int> *ids, std::vector<float> *scores,
+                              int *num_seqs, int *seq_len) {
+  for (size_t m = 0; m < plan->miss_rows.size(); m++) {
+    cache->insert(plan->keys[plan->miss_rows[m]], miss_results[m]);
+  }
+  int batch_size = plan->keys.size();
+  auto result = [&](int i) -> const CachedResult & {
+    return plan->miss_index[i] < 0 ? plan->hits[i]
+                                   : miss_results[plan->miss_index[i]];
+  };
+  *num_seqs = 0;
+  *seq_len = 0;
+  for (int i = 0; i < batch_size; i++) {
+    *num_seqs = std::max(*num_seqs, result(i).num_seqs);
+    *seq_len = std::max(*seq_len, result(i).seq_len);
+  }
+  ids->assign((size_t)batch_size * *num_seqs * *seq_len, 0);
+  scores->assign((size_t)batch_size * *num_seqs, 0.f);
+  for (int i = 0; i < batch_size; i++) {
+    const CachedResult &r = result(i);
+    for (int s = 0; s < r.num_seqs; s++) {
+      const int *src = r.ids.data() + (size_t)s * r.seq_len;
+      int *dst = ids->data() + ((size_t)i * *num_seqs + s) * *seq_len;
+      std::copy(src, src + r.seq_len, dst);
+      if (r.seq_len > 0) {
+        std::fill(dst + r.seq_len, dst + *seq_len, src[r.seq_len - 1]);
+      }
+      (*scores)[(size_t)i * *num_seqs + s] = r.scores[s];
+    }
+  }
+}
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <chrono>
+#include <functional>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+@file
+Bookkeeping of the conversation sessions of a generation model, CUDA-free so
+that the eviction policy can be tested on host.
+
+A session keeps the keys and values of a conversation between calls so that
+a call only encodes its new turn, see GptEncoder::run_session_sample. The
+cache decides where the storage of every session lives, the model moves the
+bytes through the SessionStorage hooks:
+  - the device copies fit device_bytes, the least recently used sessions
+    are spilled to host to make room, or released when the host copies would
+    exceed host_bytes (0 disables spilling)
+  - a session idle for more than ttl_ms is released (0 never expires)
+  - a session larger than device_bytes is not kept
+Time is passed in by the caller, in milliseconds.
+*/
+namespace lightseq {
+namespace cuda {
+
+struct SessionCacheConfig {
+  size_t device_bytes = size_t(1) << 30;
+  size_t host_bytes = 0;
+  int64_t ttl_ms = 10 * 60 * 1000;
+
+  std::string check() const {
+    if (ttl_ms < 0) return "ttl_ms should be non-negative";
+    return "";
+  }
+};
+
+enum class SessionPlace { kDevice, kHost };
+
+struct SessionEntry {
+  uint64_t id = 0;
+  int seq_len = 0;          // cached positions
+  std::vector<int> tokens;  // the conversation, the last one is not cached
+  size_t bytes = 0;
+  SessionPlace place = SessionPlace::kDevice;
+  int64_t last_used_ms = 0;
+  void *device_data = nullptr;  // owned by the storage hooks
+  void *host_data = nullptr;
+};
+
+/* Storage of the sessions, each hook updates the data pointers of the entry
+ */
+struct SessionStorage {
+  // allocate bytes of device storage
+  std::function<void(SessionEntry &)> alloc;
+  // device to host, the device storage is freed
+  std::function<void(SessionEntry &)> spill;
+  // host to device, the host storage is freed
+  std::function<void(SessionEntry &)> restore;
+  // free the storage wherever it is
+  std::function<void(SessionEntry &)> release;
+};
+
+inline int64_t session_now_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+class SessionCache {
+ public:
+  SessionCache(const SessionCacheConfig &config, const SessionStorage &storage)
+      : config_(config), storage_(storage) {}
+  ~SessionCache() { clear(); }
+
+  void set_config(const SessionCacheConfig &config) {
+    config_ = config;
+    make_room(0, nullptr);
+  }
+  const SessionCacheConfig &config() const { return config_; }
+
+  /* The session on device, nullptr if unknown or expired */
+  SessionEntry *acquire(uint64_t id, int64_t now_ms) {
+    expire(now_ms);
+    auto it = index_.find(id);
+    if (it == index_.end()) return nullptr;
+    SessionEntry &e = *it->second;
+    touch(it->second, now_ms);
+    if (e.place == SessionPlace::kHost) {
+      if (e.bytes > config_.device_bytes) {
+        release(it->second);
+        return nullptr;
+      }
+      host_bytes_ -= e.bytes;
+      e.place = SessionPlace::kDevice;
+      make_room(e.bytes, &e);
+      storage_.restore(e);
+      device_bytes_ += e.bytes;
+    }
+    return &e;
+  }
+
+  /* Device storage of bytes for the session, replacing its old storage.
+   * nullptr if the session alone exceeds device_bytes, it is then released */
+  SessionEntry *store(uint64_t id, int seq_len, std::vector<int> tokens,
+                      size_t bytes, int64_t now_ms) {
+    erase(id);
+    if (bytes > config_.device_bytes) return nullptr;
+    make_room(bytes, nullptr);
+    lru_.emplace_front();
+    SessionEntry &e = lru_.front();
+    e.id = id;
+    e.seq_len = seq_len;
+    e.tokens = std::move(tokens);
+    e.bytes = bytes;
+    e.place = SessionPlace::kDevice;
+    e.last_used_ms = now_ms;
+    storage_.alloc(e);
+    device_bytes_ += bytes;
+    index_[id] = lru_.begin();
+    return &e;
+  }
+
+  /* Release the session, false if unknown */
+  bool erase(uint64_t id) {
+    auto it = index_.find(id);
+    if (it == index_.end()) return false;
+    release(it->second);
+    return true;
+  }
+
+  /* Release the sessions idle for more than ttl_ms */
+  void expire(int64_t now_ms) {
+    if (config_.ttl_ms == 0) return;
+    while (!lru_.empty() &&
+           now_ms - lru_.back().last_used_ms > config_.ttl_ms) {
+      release(std::prev(lru_.end()));
+    }
+  }
+
+  void clear() {
+    while (!lru_.empty()) release(lru_.begin());
+  }
+
+  bool contains(uint64_t id) const { return index_.count(id) > 0; }
+  const SessionEntry *peek(uint64_t id) const {
+    auto it = index_.find(id);
+    return it == index_.end() ? nullptr : &*it->second;
+  }
+  size_t size() const { return lru_.size(); }
+  size_t device_bytes() const { return device_bytes_; }
+  size_t host_bytes() const { return host_bytes_; }
+
+ private:
+  typedef std::list<SessionEntry>::iterator Iter;
+
+  void touch(Iter it, int64_t now_ms) {
+    it->last_used_ms = now_ms;
+    lru_.splice(lru_.begin(), lru_, it);
+  }
+
+  void release(Iter it) {
+    if (it->place == SessionPlace::kDevice) {
+      device_bytes_ -= it->bytes;
+    } else {
+      host_bytes_ -= it->bytes;
+    }
+    storage_.release(*it);
+    index_.erase(it->id);
+    lru_.erase(it);
+  }
+
+  /* Spill or release the least recently used device sessions but keep until
+   * bytes more fit the device, then the least recently used host sessions
+   * until the host copies fit */
+  void make_room(size_t bytes, const SessionEntry *keep) {
+    for (auto it = lru_.end(); it != lru_.begin() &&
+                               device_bytes_ + bytes > config_.device_bytes;) {
+      --it;
+      if (it->place != SessionPlace::kDevice || &*it == keep) continue;
+      Iter victim = it++;
+      if (config_.host_bytes >= victim->bytes) {
+        storage_.spill(*victim);
+        victim->place = SessionPlace::kHost;
+        device_bytes_ -= victim->bytes;
+        host_bytes_ += victim->bytes;
+      } else {
+        release(victim);
+      }
+    }
+    for (auto it = lru_.end();
+         it != lru_.begin() && host_bytes_ > config_.host_bytes;) {
+      --it;
+      if (it->place != SessionPlace::kHost) continue;
+      release(it++);
+    }
+  }
+
+  SessionCacheConfig config_;
+  SessionStorage storage_;
+  std::list<SessionEntry> lru_;  // most recently used first
+  std::unordered_map<uint64_t, Iter> index_;
+  size_t device_bytes_ = 0;
+  size_t host_bytes_ = 0;
+};
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,355 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+@file
+Per-stage latency instrumentation of the inference models. It is always
+compiled and off by default; when disabled a scope costs one atomic load.
+When enabled, every finished stage goes
+  1. into a lock-free histogram of its stage, for percentiles,
+  2. into a lock-free ring buffer of the latest events, for chrome trace.
+Stages are interned once into integer ids, so the hot path does not touch
+strings. Host stages are timed with steady_clock, gpu stages with cuda
+events (see cuda_stage_timer.h), both land here in host nanoseconds.
+*/
+namespace lightseq {
+namespace cuda {
+
+enum StageTrack { kHostTrack = 0, kGpuTrack = 1 };
+
+struct StageEvent {
+  int stage_id;
+  int track;
+  uint64_t tid;
+  int64_t start_ns;
+  int64_t end_ns;
+};
+
+/**
+Fixed-size ring of the latest stage events, multi-producer and lock-free.
+A writer claims a slot with fetch_add on the head and publishes it with a
+per-slot sequence number (odd while writing), a reader skips slots that are
+being written or were overwritten while it copied them. The oldest events
+are overwritten when the ring is full.
+*/
+class StageRingBuffer {
+ public:
+  explicit StageRingBuffer(size_t capacity) : _head(0) {
+    size_t cap = 1;
+    while (cap < capacity) cap <<= 1;
+    _mask = cap - 1;
+    _slots.reset(new Slot[cap]);
+  }
+
+  size_t capacity() const { return _mask + 1; }
+
+  void push(const StageEvent &e) {
+    uint64_t idx = _head.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = _slots[idx & _mask];
+    slot.seq.store(2 * idx + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.stage_id.store(e.stage_id, std::memory_order_relaxed);
+    slot.track.store(e.track, std::memory_order_relaxed);
+    slot.tid.store(e.tid, std::memory_order_relaxed);
+    slot.start_ns.store(e.start_ns, std::memory_order_relaxed);
+    slot.end_ns.store(e.end_ns, std::memory_order_relaxed);
+    slot.seq.store(2 * idx + 2, std::memory_order_release);
+  }
+
+  // events still in the ring, oldest first
+  std::vector<StageEvent> snapshot() const {
+    std::vector<StageEvent> res;
+    uint64_t head = _head.load(std::memory_order_acquire);
+    uint64_t begin = head > capacity() ? head - capacity() : 0;
+    for (uint64_t idx = begin; idx < head; idx++) {
+      const Slot &slot = _slots[idx & _mask];
+      uint64_t seq = slot.seq.load(std::memory_order_acquire);
+      if (seq != 2 * idx + 2) continue;
+      StageEvent e;
+      e.stage_id = slot.stage_id.load(std::memory_order_relaxed);
+      e.track = slot.track.load(std::memory_order_relaxed);
+      e.tid = slot.tid.load(std::memory_order_relaxed);
+      e.start_ns = slot.start_ns.load(std::memory_order_relaxed);
+      e.end_ns = slot.end_ns.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.seq.load(std::memory_order_relaxed) != seq) continue;
+      res.push_back(e);
+    }
+    return res;
+  }
+
+  // not safe against concurrent push
+  void clear() {
+    for (size_t i = 0; i <= _mask; i++) _slots[i].seq.store(0);
+    _head.store(0);
+  }
+
+ private:
+  struct Slot {
+    std::atomic<uint64_t> seq{0};
+    std::atomic<int> stage_id{0};
+    std::atomic<int> track{0};
+    std::atomic<uint64_t> tid{0};
+    std::atomic<int64_t> start_ns{0};
+    std::atomic<int64_t> end_ns{0};
+  };
+  std::unique_ptr<Slot[]> _slots;
+  size_t _mask;
+  std::atomic<uint64_t> _head;
+};
+
+/**
+Log-linear latency histogram with atomic buckets: 8 sub-buckets per power
+of two of microseconds, so a percentile is within 12.5% of the exact value.
+*/
+class StageHistogram {
+ public:
+  static const int kSubBuckets = 8;
+  static const int kBuckets = kSubBuckets * 40;
+
+  StageHistogram() { reset(); }
+
+  static int bucket_of(int64_t ns) {
+    uint64_t us = ns > 0 ? (uint64_t)ns / 1000 : 0;
+    if (us < (uint64_t)kSubBuckets) return (int)us;
+    int e = 63 - __builtin_clzll(us);
+    int sub = (int)((us >> (e - 3)) & (kSubBuckets - 1));
+    return std::min((e - 2) * kSubBuckets + sub, kBuckets - 1);
+  }
+
+  // [lower, upper) of a bucket in microseconds
+  static double bucket_lower_us(int b) {
+    if (b < kSubBuckets) return b;
+    int e = b / kSubBuckets + 2, sub = b % kSubBuckets;
+    return (double)(1ULL << e) + sub * (double)(1ULL << (e - 3));
+  }
+  static double bucket_upper_us(int b) {
+    if (b < kSubBuckets) return b + 1;
+    int e = b / kSubBuckets + 2;
+    return bucket_lower_us(b) + (double)(1ULL << (e - 3));
+  }
+
+  void add(int64_t ns) {
+    _buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+    _sum_ns.fetch_add(ns, std::memory_order_relaxed);
+    int64_t cur = _min_ns.load(std::memory_order_relaxed);
+    while (ns < cur && !_min_ns.compare_exchange_weak(cur, ns)) {
+    }
+    cur = _max_ns.load(std::memory_order_relaxed);
+    while (ns > cur && !_max_ns.compare_exchange_weak(cur, ns)) {
+    }
+  }
+
+  uint64_t count() const { return _count.load(); }
+  int64_t sum_ns() const { return _sum_ns.load(); }
+  int64_t min_ns() const { return count() ? _min_ns.load() : 0; }
+  int64_t max_ns() const { return _max_ns.load(); }
+
+  // p in [0, 100], linear interpolation inside the bucket, in ms
+  double percentile_ms(double p) const {
+    uint64_t total = count();
+    if (total == 0) return 0;
+    double target = p / 100.0 * total;
+    uint64_t seen = 0;
+    for (int b = 0; b < kBuckets; b++) {
+      uint64_t n = _buckets[b].load(std::memory_order_relaxed);
+      if (n == 0) continue;
+      if (seen + n >= target) {
+        double frac = n ? (target - seen) / n : 0;
+        double lo = bucket_lower_us(b), hi = bucket_upper_us(b);
+        double us = lo + std::max(0.0, std::min(1.0, frac)) * (hi - lo);
+        // the exact extremes are known
+        us = std::max(us, min_ns() / 1000.0);
+        us = std::min(us, max_ns() / 1000.0);
+        return us / 1000.0;
+      }
+      seen += n;
+    }
+    return max_ns() / 1e6;
+  }
+
+  void reset() {
+    for (int b = 0; b < kBuckets; b++) _buckets[b].store(0);
+    _count.store(0);
+    _sum_ns.store(0);
+    _min_ns.store(INT64_MAX);
+    _max_ns.store(0);
+  }
+
+ private:
+  std::atomic<uint64_t> _buckets[kBuckets];
+  std::atomic<uint64_t> _count;
+  std::atomic<int64_t> _sum_ns;
+  std::atomic<int64_t> _min_ns;
+  std::atomic<int64_t> _max_ns;
+};
+
+struct StageStats {
+  uint64_t count = 0;
+  double total_ms = 0;
+  double mean_ms = 0;
+  double min_ms = 0;
+  double max_ms = 0;
+  double p50_ms = 0;
+  double p90_ms = 0;
+  double p99_ms = 0;
+};
+
+class StageProfiler {
+ public:
+  static const int kMaxStages = 4096;
+
+  explicit StageProfiler(size_t ring_capacity = 1 << 16)
+      : _enabled(false), _num_stages(0), _ring_capacity(ring_capacity) {}
+
+  static int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  static uint64_t thread_id() {
+    return std::hash<std::thread::id>()(std::this_thread::get_id());
+  }
+
+  void enable(bool enable) {
+    if (enable) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (!_ring) _ring.reset(new StageRingBuffer(_ring_capacity));
+    }
+    _enabled.store(enable, std::memory_order_release);
+  }
+
+  bool enabled() const { return _enabled.load(std::memory_order_acquire); }
+
+  /* Id of a named stage, registered on first use. Cold path, takes a lock */
+  int stage_id(const std::string &name) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto iter = _ids.find(name);
+    if (iter != _ids.end()) return iter->second;
+    int id = _num_stages.load(std::memory_order_relaxed);
+    if (id >= kMaxStages) {
+      throw std::runtime_error("too many profiling stages");
+    }
+    _names.push_back(name);
+    _hists[id].reset(new StageHistogram());
+    _ids[name] = id;
+    _num_stages.store(id + 1, std::memory_order_release);
+    return id;
+  }
+
+  std::string stage_name(int id) const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _names.at(id);
+  }
+
+  void record(int stage_id, int64_t start_ns, int64_t end_ns,
+              int track = kHostTrack) {
+    if (!enabled()) return;
+    if (stage_id < 0 ||
+        stage_id >= _num_stages.load(std::memory_order_acquire)) {
+      return;
+    }
+    _hists[stage_id]->add(end_ns - start_ns);
+    _ring->push({stage_id, track, thread_id(), start_ns, end_ns});
+  }
+
+  std::map<std::string, StageStats> stats() const {
+    std::map<std::string, StageStats> res;
+    int num = _num_stages.load(std::memory_order_acquire);
+    for (int i = 0; i < num; i++) {
+      const StageHistogram &h = *_hists[i];
+      if (h.count() == 0) continue;
+      StageStats s;
+      s.count = h.count();
+      s.total_ms = h.sum_ns() / 1e6;
+      s.mean_ms = s.total_ms / s.count;
+      s.min_ms = h.min_ns() / 1e6;
+      s.max_ms = h.max_ns() / 1e6;
+      s.p50_ms = h.percentile_ms(50);
+      s.p90_ms = h.percentile_ms(90);
+      s.p99_ms = h.percentile_ms(99);
+      res[stage_name(i)] = s;
+    }
+    return res;
+  }
+
+  // latest events, oldest first
+  std::vector<StageEvent> events() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _ring ? _ring->snapshot() : std::vector<StageEvent>();
+  }
+
+  /* Latest events in chrome trace event format (chrome://tracing) */
+  std::string chrome_trace() const {
+    std::vector<StageEvent> events = this->events();
+    std::ostringstream oss;
+    oss << "{\"traceEvents\": [";
+    for (size_t i = 0; i < events.size(); i++) {
+      const StageEvent &e = events[i];
+      oss << (i ? ",\n" : "\n") << "{\"name\": \"" << stage_name(e.stage_id)
+          << "\", \"cat\": \"" << (e.track == kGpuTrack ? "gpu" : "host")
+          << "\", \"ph\": \"X\", \"ts\": " << e.start_ns / 1000.0
+          << ", \"dur\": " << (e.end_ns - e.start_ns) / 1000.0
+          << ", \"pid\": " << e.track << ", \"tid\": " << e.tid % 100000
+          << "}";
+    }
+    oss << "\n], \"displayTimeUnit\": \"ms\"}\n";
+    return oss.str();
+  }
+
+  // clear the recorded stages, the stage ids stay valid
+  void reset() {
+    int num = _num_stages.load(std::memory_order_acquire);
+    for (int i = 0; i < num; i++) _hists[i]->reset();
+    if (_ring) _ring->clear();
+  }
+
+ private:
+  std::atomic<bool> _enabled;
+  std::atomic<int> _num_stages;
+  size_t _ring_capacity;
+  std::unique_ptr<StageRingBuffer> _ring;
+  std::unique_ptr<StageHistogram> _hists[kMaxStages];
+  std::vector<std::string> _names;
+  std::unordered_map<std::string, int> _ids;
+  mutable std::mutex _mutex;
+};
+
+/* Times the host code of its lifetime */
+class HostStageScope {
+ public:
+  HostStageScope(StageProfiler *profiler, int stage_id)
+      : _profiler(profiler && profiler->enabled() ? profiler : nullptr),
+        _stage_id(stage_id),
+        _start_ns(_profiler ? StageProfiler::now_ns() : 0) {}
+  ~HostStageScope() {
+    if (_profiler) {
+      _profiler->record(_stage_id, _start_ns, StageProfiler::now_ns());
+    }
+  }
+
+ private:
+  StageProfiler *_profiler;
+  int _stage_id;
+  int64_t _start_ns;
+};
+
+}  // namespace cuda
+}  // namespace lightseq
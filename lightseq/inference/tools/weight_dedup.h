@@ -0,0 +1,175 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "weight_loader.h"
+
+/**
+@file
+Deduplication of identical weight tensors at load time, CUDA-free so that it
+can be tested on host.
+
+A weight block (the fp32 values of several tensors, tensor i being
+value[offset[i], offset[i + 1])) is added before its upload: the tensors
+whose content equals the one of a tensor already added, e.g. the target
+token embedding of a model sharing its source and target embeddings, are
+removed from the block and their pointers alias the first copy. Tensors
+are matched by a hash of their bits and then compared, so a collision can
+not alias different weights.
+
+A tensor can also alias the transpose of a tensor already added: the target
+token embedding is stored [hidden, vocab] while the source one is [vocab,
+hidden], so tied embeddings only match once transposed. The user of such a
+tensor reads the aliased copy transposed, see TransformerWeight::
+_trg_emb_tied.
+
+Only tensors of a multiple of 8 elements are removed, the following
+tensors of the block keep the alignment of the vectorized loads.
+*/
+namespace lightseq {
+namespace cuda {
+
+inline uint64_t weight_hash(const float *data, size_t n) {
+  // FNV-1a over the 32 bit words
+  uint64_t h = 1469598103934665603ull;
+  for (size_t i = 0; i < n; i++) {
+    uint32_t bits;
+    memcpy(&bits, data + i, sizeof(bits));
+    h = (h ^ bits) * 1099511628211ull;
+  }
+  return h ^ n;
+}
+
+/* Tensor `tensor` of a block, row-major [rows, cols], that may alias the
+ * transpose of a tensor already added, matched is set if it does */
+struct TransposedMatch {
+  int tensor;
+  size_t rows;
+  size_t cols;
+  bool matched = false;
+};
+
+/* [cols, rows] transpose of the row-major [rows, cols] data */
+inline std::vector<float> transpose_weight(const float *data, size_t rows,
+                                           size_t cols) {
+  std::vector<float> res(rows * cols);
+  parallel_for(cols, [&](int c) {
+    for (size_t r = 0; r < rows; r++) res[c * rows + r] = data[r * cols + c];
+  });
+  return res;
+}
+
+class WeightDedup {
+ public:
+  /**
+  Add a block of tensors, see the file comment. upload(compacted) uploads
+  the remaining tensors and returns their device address, elem_bytes is the
+  size of an element on device. The tensors of transposed that match no
+  tensor as they are are also looked up transposed.
+  Returns the device address of every tensor of the block.
+  */
+  template <typename Upload>
+  std::vector<const void *> add_block(
+      std::vector<float> value, const std::vector<int> &offset,
+      size_t elem_bytes, Upload upload,
+      std::vector<TransposedMatch> *transposed = nullptr) {
+    int num_tensors = offset.size();
+    auto tensor_size = [&](int i) -> size_t {
+      return (i + 1 < num_tensors ? offset[i + 1] : value.size()) - offset[i];
+    };
+    std::vector<uint64_t> hashes(num_tensors);
+    parallel_for(num_tensors, [&](int i) {
+      hashes[i] = weight_hash(value.data() + offset[i], tensor_size(i));
+    });
+
+    int block_id = _blocks.size();
+    std::vector<float> compacted;
+    compacted.reserve(value.size());
+    // (block, offset in the block) of every tensor
+    std::vector<std::pair<int, size_t>> where(num_tensors);
+    for (int i = 0; i < num_tensors; i++) {
+      const float *data = value.data() + offset[i];
+      size_t size = tensor_size(i);
+      int found = size % 8 == 0 && size > 0
+                      ? find(hashes[i], data, size, compacted)
+                      : -1;
+      TransposedMatch *match = nullptr;
+      if (transposed != nullptr) {
+        for (TransposedMatch &t : *transposed) {
+          if (t.tensor == i && t.rows * t.cols == size) match = &t;
+        }
+      }
+      if (found < 0 && match != nullptr && size % 8 == 0 && size > 0) {
+        std::vector<float> t = transpose_weight(data, match->rows, match->cols);
+        found = find(weight_hash(t.data(), size), t.data(), size, compacted);
+        match->matched = found >= 0;
+      }
+      if (found >= 0) {
+        where[i] = {_entries[found].block, _entries[found].offset};
+        _num_aliased++;
+        _saved_bytes += size * elem_bytes;
+        continue;
+      }
+      where[i] = {block_id, compacted.size()};
+      _index.emplace(hashes[i], _entries.size());
+      _entries.push_back({block_id, compacted.size(), size});
+      compacted.insert(compacted.end(), data, data + size);
+    }
+    std::vector<float>().swap(value);
+
+    _bases.push_back((const char *)upload(compacted));
+    _blocks.push_back(std::move(compacted));
+    std::vector<const void *> res;
+    for (const std::pair<int, size_t> &w : where) {
+      res.push_back(_bases[w.first] + w.second * elem_bytes);
+    }
+    return res;
+  }
+
+  /* Free the host copies once all the blocks are added */
+  void release() {
+    std::vector<std::vector<float>>().swap(_blocks);
+    _bases.clear();
+    _entries.clear();
+    _index.clear();
+  }
+
+  int num_aliased() const { return _num_aliased; }
+  size_t saved_bytes() const { return _saved_bytes; }
+
+ private:
+  struct Entry {
+    int block;
+    size_t offset;
+    size_t size;
+  };
+
+  int find(uint64_t hash, const float *data, size_t size,
+           const std::vector<float> &pending) const {
+    auto range = _index.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      const Entry &e = _entries[it->second];
+      if (e.size != size) continue;
+      const float *other = e.block < (int)_blocks.size()
+                               ? _blocks[e.block].data() + e.offset
+                               : pending.data() + e.offset;
+      if (memcmp(other, data, size * sizeof(float)) == 0) return it->second;
+    }
+    return -1;
+  }
+
+  std::vector<std::vector<float>> _blocks;  // host copies, see find
+  std::vector<const char *> _bases;         // device address of the blocks
+  std::vector<Entry> _entries;
+  std::unordered_multimap<uint64_t, int> _index;
+  int _num_aliased = 0;
+  size_t _saved_bytes = 0;
+};
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define LS_F16C_DISPATCH
+#endif
+
+/**
+@file
+Host side of the weight loading, CUDA-free so that it can be tested on host.
+
+The weights of the layers are copied from the parsed proto into one
+preallocated fp32 buffer by a pool of threads, a layer per task. The buffer
+is then converted to the model dtype and uploaded in chunks through pinned
+memory, see weight_upload.h. copy_layers_streaming hands every finished layer
+to the caller while the pool is still copying the next ones, so that the
+upload of a layer overlaps the parsing of the later layers.
+
+The fp32 to fp16 conversion uses the F16C instructions when the cpu has them,
+the scalar fallback rounds to nearest even the same way.
+
+The number of threads is LIGHTSEQ_LOAD_THREADS if set, else the number of
+cores.
+*/
+namespace lightseq {
+namespace cuda {
+
+inline int weight_load_threads() {
+  const char *env = getenv("LIGHTSEQ_LOAD_THREADS");
+  if (env != nullptr && atoi(env) > 0) return atoi(env);
+  return std::max(1, (int)std::thread::hardware_concurrency());
+}
+
+/* Run fn(0) ... fn(n - 1) on num_threads threads, the first exception is
+ * rethrown once all the tasks are done */
+inline void parallel_for(int n, const std::function<void(int)> &fn,
+                         int num_threads = weight_load_threads()) {
+  num_threads = std::min(num_threads, n);
+  if (num_threads <= 1) {
+    for (int i = 0; i < n; i++) fn(i);
+    return;
+  }
+  std::atomic<int> next(0);
+  std::vector<std::exception_ptr> errors(n);
+  auto worker = [&]() {
+    for (int i = next++; i < n; i = next++) {
+      try {
+        fn(i);
+      } catch (...) {
+        errors[i] = std::current_exception();
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int t = 1; t < num_threads; t++) threads.emplace_back(worker);
+  worker();
+  for (std::thread &t : threads) t.join();
+  for (std::exception_ptr &e : errors) {
+    if (e) std::rethrow_exception(e);
+  }
+}
+
+inline size_t layer_size(const std::vector<size_t> &sizes) {
+  size_t res = 0;
+  for (size_t size : sizes) res += size;
+  return res;
+}
+
+/* Copy the fields of one layer to dst, see copy_layers_parallel */
+template <typename Fields>
+std::string copy_layer(const Fields &layer_fields,
+                       const std::vector<size_t> &sizes,
+                       const std::vector<std::string> &names, float *dst) {
+  for (size_t i = 0; i < sizes.size(); i++) {
+    if ((size_t)layer_fields[i]->size() != sizes[i])
+      return "Wrong " + names[i] + "_size !";
+    std::copy(layer_fields[i]->begin(), layer_fields[i]->end(), dst);
+    dst += sizes[i];
+  }
+  return "";
+}
+
+/**
+Copy the weights of num_layers layers into dst in parallel, layer l at
+dst + l * (the sum of sizes). fields(l) returns pointers to the fields of
+layer l (any container of float with size(), begin() and end()), field i
+should have sizes[i] elements.
+Returns "Wrong <names[i]>_size !" of the first wrong field, "" on success.
+*/
+template <typename GetFields>
+std::string copy_layers_parallel(int num_layers,
+                                 const std::vector<size_t> &sizes,
+                                 const std::vector<std::string> &names,
+                                 GetFields fields, float *dst) {
+  size_t stride = layer_size(sizes);
+  std::vector<std::string> errors(num_layers);
+  parallel_for(num_layers, [&](int layer_id) {
+    errors[layer_id] =
+        copy_layer(fields(layer_id), sizes, names, dst + layer_id * stride);
+  });
+  for (const std::string &e : errors) {
+    if (!e.empty()) return e;
+  }
+  return "";
+}
+
+/**
+copy_layers_parallel that calls on_ready(l) on the calling thread for
+l = 0 ... num_layers - 1 in order, as soon as the layers up to l are copied,
+while the pool keeps copying the later layers.
+on_ready is not called from the first wrong layer on, the error is returned
+once the pool is done.
+*/
+template <typename GetFields, typename OnReady>
+std::string copy_layers_streaming(int num_layers,
+                                  const std::vector<size_t> &sizes,
+                                  const std::vector<std::string> &names,
+                                  GetFields fields, float *dst,
+                                  OnReady on_ready,
+                                  int num_threads = weight_load_threads()) {
+  size_t stride = layer_size(sizes);
+  std::vector<std::string> errors(num_layers);
+  std::vector<std::exception_ptr> exceptions(num_layers);
+  std::vector<char> done(num_layers, 0);
+  std::mutex mutex;
+  std::condition_variable copied;
+  std::thread pool([&]() {
+    parallel_for(
+        num_layers,
+        [&](int layer_id) {
+          try {
+            errors[layer_id] = copy_layer(fields(layer_id), sizes, names,
+                                          dst + layer_id * stride);
+          } catch (...) {
+            exceptions[layer_id] = std::current_exception();
+          }
+          std::lock_guard<std::mutex> lock(mutex);
+          done[layer_id] = 1;
+          copied.notify_all();
+        },
+        num_threads);
+  });
+
+  std::exception_ptr ready_error;
+  try {
+    for (int l = 0; l < num_layers; l++) {
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        copied.wait(lock, [&]() { return done[l] != 0; });
+      }
+      if (!errors[l].empty() || exceptions[l]) break;
+      on_ready(l);
+    }
+  } catch (...) {
+    ready_error = std::current_exception();
+  }
+  pool.join();
+  if (ready_error) std::rethrow_exception(ready_error);
+  for (int l = 0; l < num_layers; l++) {
+    if (exceptions[l]) std::rethrow_exception(exceptions[l]);
+    if (!errors[l].empty()) return errors[l];
+  }
+  return "";
+}
+
+/* Offsets of the fields of every layer in the buffer of
+ * copy_layers_parallel */
+inline std::vector<int> layer_offsets(int num_layers,
+                                      const std::vector<size_t> &sizes) {
+  std::vector<int> offset;
+  size_t idx = 0;
+  for (int l = 0; l < num_layers; l++) {
+    for (size_t size : sizes) {
+      offset.push_back(idx);
+      idx += size;
+    }
+  }
+  return offset;
+}
+
+/* IEEE fp16 bits of value, rounded to nearest even */
+inline uint16_t float_to_half_bits(float value) {
+  uint32_t x;
+  memcpy(&x, &value, sizeof(x));
+  uint32_t sign = (x >> 16) & 0x8000;
+  uint32_t abs = x & 0x7fffffff;
+  if (abs >= 0x7f800000) {
+    // inf, or quiet nan keeping the high bits of the payload
+    return sign | 0x7c00 |
+           (abs > 0x7f800000 ? 0x200 | ((abs >> 13) & 0x3ff) : 0);
+  }
+  if (abs >= 0x477ff000) return sign | 0x7c00;  // rounds above 65504
+  if (abs < 0x38800000) {
+    // subnormal, value = m * 2^-24
+    if (abs < 0x33000000) return sign;  // below 2^-25
+    uint32_t mant = (abs & 0x7fffff) | 0x800000;
+    int shift = 126 - (int)(abs >> 23);
+    uint32_t m = mant >> shift;
+    uint32_t rem = mant & ((1u << shift) - 1);
+    uint32_t half = 1u << (shift - 1);
+    if (rem > half || (rem == half && (m & 1))) m++;
+    return sign | m;
+  }
+  uint32_t h = (abs - 0x38000000) >> 13;
+  uint32_t rem = abs & 0x1fff;
+  if (rem > 0x1000 || (rem == 0x1000 && (h & 1))) h++;
+  return sign | h;
+}
+
+#ifdef LS_F16C_DISPATCH
+__attribute__((target("avx,f16c"))) inline void float_to_half_f16c(
+    const float *src, uint16_t *dst, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 x = _mm256_loadu_ps(src + i);
+    __m128i h = _mm256_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT);
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), h);
+  }
+  for (; i < n; i++) dst[i] = float_to_half_bits(src[i]);
+}
+#endif
+
+inline bool cpu_has_f16c() {
+#ifdef LS_F16C_DISPATCH
+  static const bool res = __builtin_cpu_supports("f16c");
+  return res;
+#else
+  return false;
+#endif
+}
+
+/* Convert n floats to fp16 bits, with F16C if simd and the cpu has it */
+inline void float_to_half(const float *src, uint16_t *dst, size_t n,
+                          bool simd = true) {
+#ifdef LS_F16C_DISPATCH
+  if (simd && cpu_has_f16c()) {
+    float_to_half_f16c(src, dst, n);
+    return;
+  }
+#endif
+  for (size_t i = 0; i < n; i++) dst[i] = float_to_half_bits(src[i]);
+}
+
+/* float_to_half split into slices over num_threads threads */
+inline void float_to_half_parallel(const float *src, uint16_t *dst, size_t n,
+                                   int num_threads = weight_load_threads()) {
+  // slices of at least 64K elements, a multiple of 8 for the simd loop
+  const size_t kMinSlice = 1 << 16;
+  int num_slices = std::max<size_t>(1, std::min<size_t>(num_threads,
+                                                        n / kMinSlice));
+  size_t slice = (n / num_slices + 7) / 8 * 8;
+  parallel_for(
+      num_slices,
+      [&](int i) {
+        size_t begin = std::min(n, i * slice);
+        size_t end = i + 1 == num_slices ? n : std::min(n, begin + slice);
+        float_to_half(src + begin, dst + begin, end - begin);
+      },
+      num_threads);
+}
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cuda_fp16.h>
+#include <cuda_runtime.h>
+#include <thrust/device_vector.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "util.h"
+#include "weight_dedup.h"
+#include "weight_loader.h"
+
+/**
+@file
+Upload of the fp32 weights parsed on host into GPU memory of the model
+dtype, see weight_loader.h.
+
+The weights are converted chunk by chunk into two pinned staging buffers,
+the conversion of a chunk overlaps the copy of the previous one.
+upload_layers starts the upload of every layer as soon as it is parsed, the
+layers with deduplicated tensors are uploaded once the whole block is
+parsed since the size of the device buffer is only known after the
+compaction, see weight_dedup.h.
+*/
+namespace lightseq {
+namespace cuda {
+
+inline void convert_weights(const float *src, float *dst, size_t n) {
+  memcpy(dst, src, n * sizeof(float));
+}
+
+inline void convert_weights(const float *src, __half *dst, size_t n) {
+  float_to_half_parallel(src, reinterpret_cast<uint16_t *>(dst), n);
+}
+
+/* Copies of slices of fp32 host memory into the device buffer p_d_dst,
+ * converted to T through the pinned staging buffers */
+template <typename T>
+class StagedUpload {
+ public:
+  explicit StagedUpload(T *p_d_dst, size_t chunk_size = 1 << 22)
+      : _p_d_dst(p_d_dst), _chunk_size(chunk_size) {
+    CHECK_GPU_ERROR(
+        cudaStreamCreateWithFlags(&_stream, cudaStreamNonBlocking));
+    for (int i = 0; i < 2; i++) {
+      CHECK_GPU_ERROR(
+          cudaMallocHost((void **)&_staging[i], chunk_size * sizeof(T)));
+      CHECK_GPU_ERROR(
+          cudaEventCreateWithFlags(&_copied[i], cudaEventDisableTiming));
+    }
+  }
+
+  ~StagedUpload() {
+    cudaStreamSynchronize(_stream);
+    for (int i = 0; i < 2; i++) {
+      cudaFreeHost(_staging[i]);
+      cudaEventDestroy(_copied[i]);
+    }
+    cudaStreamDestroy(_stream);
+  }
+
+  /* Convert src[0, n) and copy it to p_d_dst + offset, src can be reused
+   * once upload returns */
+  void upload(const float *src, size_t offset, size_t n) {
+    for (size_t begin = 0; begin < n; begin += _chunk_size, _chunk++) {
+      int b = _chunk % 2;
+      size_t len = std::min(_chunk_size, n - begin);
+      // the copy of chunk _chunk - 2 is done with the staging buffer
+      CHECK_GPU_ERROR(cudaEventSynchronize(_copied[b]));
+      convert_weights(src + begin, _staging[b], len);
+      CHECK_GPU_ERROR(cudaMemcpyAsync(_p_d_dst + offset + begin, _staging[b],
+                                      len * sizeof(T),
+                                      cudaMemcpyHostToDevice, _stream));
+      CHECK_GPU_ERROR(cudaEventRecord(_copied[b], _stream));
+    }
+  }
+
+  /* Wait for the copies */
+  void finish() { CHECK_GPU_ERROR(cudaStreamSynchronize(_stream)); }
+
+ private:
+  T *_p_d_dst;
+  size_t _chunk_size;
+  size_t _chunk = 0;
+  cudaStream_t _stream;
+  T *_staging[2];
+  cudaEvent_t _copied[2];
+};
+
+/* Convert value to T and copy it into dst, dst is resized to value */
+template <typename T>
+void upload_weights(const std::vector<float> &value,
+                    thrust::device_vector<T> *dst,
+                    size_t chunk_size = 1 << 22) {
+  size_t n = value.size();
+  dst->resize(n);
+  T *p_d_dst = thrust::raw_pointer_cast(dst->data());
+  if (n <= chunk_size) {
+    std::vector<T> raw_value(n);
+    convert_weights(value.data(), raw_value.data(), n);
+    CHECK_GPU_ERROR(cudaMemcpy(p_d_dst, raw_value.data(), n * sizeof(T),
+                               cudaMemcpyHostToDevice));
+    return;
+  }
+  StagedUpload<T> upload(p_d_dst, chunk_size);
+  upload.upload(value.data(), 0, n);
+  upload.finish();
+}
+
+/**
+copy_layers_streaming into dst, resized to the num_layers layers, every
+layer is uploaded once copied while the later ones are still parsed.
+Returns the error of copy_layers_streaming.
+*/
+template <typename T, typename GetFields>
+std::string upload_layers(int num_layers, const std::vector<size_t> &sizes,
+                          const std::vector<std::string> &names,
+                          GetFields fields, thrust::device_vector<T> *dst) {
+  size_t stride = layer_size(sizes);
+  std::vector<float> value(num_layers * stride);
+  dst->resize(value.size());
+  StagedUpload<T> upload(thrust::raw_pointer_cast(dst->data()));
+  std::string res = copy_layers_streaming(
+      num_layers, sizes, names, fields, value.data(), [&](int layer_id) {
+        upload.upload(value.data() + layer_id * stride, layer_id * stride,
+                      stride);
+      });
+  upload.finish();
+  return res;
+}
+
+/* The weights of the quantized models stay on host until their model
+ * uploads them, they are only converted */
+template <typename T>
+void upload_weights(const std::vector<float> &value, std::vector<T> *dst) {
+  dst->resize(value.size());
+  convert_weights(value.data(), dst->data(), value.size());
+}
+
+/**
+upload_weights with the deduplication of the tensors of value, tensor i
+starting at offset[i], transposed as in WeightDedup::add_block, see
+weight_dedup.h.
+Returns the device pointers of the tensors.
+*/
+template <typename T>
+std::vector<const T *> upload_weights(
+    std::vector<float> value, const std::vector<int> &offset,
+    thrust::device_vector<T> *dst, WeightDedup *dedup,
+    std::vector<TransposedMatch> *transposed = nullptr) {
+  std::vector<const void *> ptrs = dedup->add_block(
+      std::move(value), offset, sizeof(T),
+      [&](const std::vector<float> &compacted) {
+        upload_weights(compacted, dst);
+        return (const void *)thrust::raw_pointer_cast(dst->data());
+      },
+      transposed);
+  std::vector<const T *> res;
+  for (const void *p : ptrs) res.push_back((const T *)p);
+  return res;
+}
+
+}  // namespace cuda
+}  // namespace lightseq
@@ -13,6 +13,52 @@ namespace triton {
 namespace backend {
 namespace lightseq {
 
+/* Infer the rows of the source on device, [batch_size, seq_len], missing in
+ * the result cache only and assemble the outputs of the whole batch on host,
+ * target ids [batch_size, num_seqs, len] and scores [batch_size, num_seqs] */
+void infer_with_result_cache(::lightseq::cuda::LSModel* model,
+                             ::lightseq::cuda::ResultCache* cache,
+                             const std::string& model_id, int padding_id,
+                             int* d_source, int batch_size, int seq_len,
+                             std::vector<int>* ids, std::vector<float>* scores,
+                             int* num_seqs, int* len) {
+  std::vector<int> source((size_t)batch_size * seq_len);
+  ::lightseq::cuda::CHECK_GPU_ERROR(
+      cudaMemcpy(source.data(), d_source, sizeof(int) * source.size(),
+                 cudaMemcpyDeviceToHost));
+  // Triton has no per request decoding settings, the model id keys them
+  ::lightseq::cuda::ResultBatchPlan plan = ::lightseq::cuda::plan_result_batch(
+      cache, model_id, "", source.data(), batch_size, seq_len, padding_id);
+  std::vector<::lightseq::cuda::CachedResult> miss_results;
+  int miss_num = plan.miss_rows.size();
+  if (miss_num > 0) {
+    for (int m = 0; m < miss_num; m++) {
+      ::lightseq::cuda::CHECK_GPU_ERROR(cudaMemcpy(
+          d_source + (size_t)m * seq_len,
+          source.data() + (size_t)plan.miss_rows[m] * seq_len,
+          sizeof(int) * seq_len, cudaMemcpyHostToDevice));
+    }
+    model->set_input_shape(0, {miss_num, seq_len});
+    model->Infer();
+
+    std::vector<int> shape = model->get_output_shape(0);
+    std::vector<int> miss_ids((size_t)shape[0] * shape[1] * shape[2]);
+    std::vector<float> miss_scores((size_t)shape[0] * shape[1]);
+    ::lightseq::cuda::CHECK_GPU_ERROR(
+        cudaMemcpy(miss_ids.data(), model->get_output_ptr(0),
+                   sizeof(int) * miss_ids.size(), cudaMemcpyDeviceToHost));
+    ::lightseq::cuda::CHECK_GPU_ERROR(
+        cudaMemcpy(miss_scores.data(), model->get_output_ptr(1),
+                   sizeof(float) * miss_scores.size(), cudaMemcpyDeviceToHost));
+    for (int m = 0; m < miss_num; m++) {
+      miss_results.push_back(::lightseq::cuda::result_of_row(
+          miss_ids.data(), miss_scores.data(), m, shape[1], shape[2]));
+    }
+  }
+  ::lightseq::cuda::fill_result_batch(cache, &plan, miss_results, ids, scores,
+                                      num_seqs, len);
+}
+
 extern "C" {
 
 // Triton calls TRITONBACKEND_Initialize when a backend is loaded into
@@ -279,6 +325,12 @@ TRITONSERVER_Error* TRITONBACKEND_ModelInstanceExecute(
     TRITONBACKEND_Request* request = requests[idx];
     uint32_t input_count;
     TRITONBACKEND_RequestInputCount(request, &input_count);
+    // set by the sequence batcher, 0 outside of a sequence
+    uint64_t correlation_id = 0;
+    LOG_IF_ERROR(TRITONBACKEND_RequestCorrelationId(request, &correlation_id),
+                 "failed getting request correlation id");
+    bool sequence_start = false, sequence_end = false;
+    std::vector<int> source_shape;
 
     for (uint32_t input_idx = 0; input_idx < input_count; input_idx++) {
       TRITONBACKEND_Input* input = nullptr;
@@ -299,6 +351,15 @@ TRITONSERVER_Error* TRITONBACKEND_ModelInstanceExecute(
                      "failed getting input properties");
       }
 
+      if (input_name == kSequenceStartName) {
+        sequence_start = read_sequence_control(input, datatype);
+        continue;
+      }
+      if (input_name == kSequenceEndName) {
+        sequence_end = read_sequence_control(input, datatype);
+        continue;
+      }
+
       // malloc GPU memory by triton api;
       void* d_input = instance_state->get_d_input(input_name);
       void* moved_d_input = d_input;
@@ -329,10 +390,54 @@ TRITONSERVER_Error* TRITONBACKEND_ModelInstanceExecute(
         }
         lightseq_model_ptr->set_input_shape(
             lightseq_input_idx, std::vector<int>(shape, shape + dims_count));
+        if (lightseq_input_idx == 0) {
+          source_shape.assign(shape, shape + dims_count);
+        }
       }
     }
 
-    lightseq_model_ptr->Infer();
+    // a correlation id is a session turn for the models that keep sessions,
+    // the others infer the request on its own as before
+    bool use_session =
+        correlation_id != 0 && lightseq_model_ptr->supports_sessions();
+    // the outputs of a cached infer are on host
+    ::lightseq::cuda::ResultCache* result_cache = model_state->GetResultCache();
+    // a sampled result would be returned again for every repeat
+    bool use_cache = result_cache != nullptr && !use_session &&
+                     lightseq_model_ptr->deterministic() &&
+                     source_shape.size() == 2;
+    std::vector<int> cached_ids;
+    std::vector<float> cached_scores;
+    int cached_num_seqs = 0, cached_len = 0;
+    // the model throws on the errors of a request, e.g. an unknown or expired
+    // session, they are the response of the request
+    TRITONSERVER_Error* infer_error = nullptr;
+    try {
+      if (use_cache) {
+        infer_with_result_cache(
+            lightseq_model_ptr.get(), result_cache,
+            model_state->ResultCacheModelId(),
+            model_state->GetPaddingId(),
+            static_cast<int*>(instance_state->get_d_input(
+                lightseq_model_ptr->get_input_name(0))),
+            source_shape[0], source_shape[1], &cached_ids, &cached_scores,
+            &cached_num_seqs, &cached_len);
+      } else if (use_session) {
+        lightseq_model_ptr->InferSession(correlation_id, sequence_start,
+                                         sequence_end);
+      } else {
+        lightseq_model_ptr->Infer();
+      }
+    } catch (const std::exception& e) {
+      infer_error = TRITONSERVER_ErrorNew(use_session
+                                              ? TRITONSERVER_ERROR_INVALID_ARG
+                                              : TRITONSERVER_ERROR_INTERNAL,
+                                          e.what());
+    }
+    if (infer_error != nullptr) {
+      RESPOND_AND_SET_NULL_IF_ERROR(&responses[idx], infer_error);
+      continue;
+    }
 
     // create response buffer
     TRITONBACKEND_Response* response = responses[idx];
@@ -340,9 +445,14 @@ TRITONSERVER_Error* TRITONBACKEND_ModelInstanceExecute(
          output_idx++) {
       TRITONBACKEND_Output* output = nullptr;
       void* single_output_buffer = nullptr;
-      const std::vector<int> lightseq_shape =
+      std::vector<int> lightseq_shape =
           lightseq_model_ptr->get_output_shape(output_idx);
+      if (use_cache) {
+        lightseq_shape = {source_shape[0], cached_num_seqs};
+        if (output_idx == 0) lightseq_shape.push_back(cached_len);
+      }
       std::string output_name = lightseq_model_ptr->get_output_name(output_idx);
+      if (!model_state->HasOutput(output_name)) continue;
 
       const std::vector<int64_t> triton_shape(lightseq_shape.begin(),
                                               lightseq_shape.end());
@@ -376,6 +486,16 @@ TRITONSERVER_Error* TRITONBACKEND_ModelInstanceExecute(
           continue;
         }
 
+        if (use_cache) {
+          const void* h_output =
+              output_idx == 0 ? static_cast<const void*>(cached_ids.data())
+                              : static_cast<const void*>(cached_scores.data());
+          ::lightseq::cuda::CHECK_GPU_ERROR(
+              cudaMemcpy(single_output_buffer, h_output, buffer_byte_size,
+                         cudaMemcpyDefault));
+          continue;
+        }
+
         const void* d_output = static_cast<const void*>(
             lightseq_model_ptr->get_output_ptr(output_idx));
 
@@ -10,6 +10,12 @@
 #include "transformer.h"
 #include "model_base.h"
 #include "quant_transformer.h"
+#include "../../tools/result_cache.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include <limits>
 
 namespace triton {
 namespace backend {
@@ -36,13 +42,15 @@ class ModelState : public BackendModel {
 
   const std::string& ModelFileName() const { return file_name_; }
 
-  // Datatype of the input and output tensor
+  // Datatype of the input and output tensor, TRITONSERVER_TYPE_INVALID if
+  // the model configuration does not declare it
   TRITONSERVER_DataType GetInputDataTypeByName(std::string input_name) {
     std::unordered_map<std::string, TRITONSERVER_DataType>::iterator iter =
         input_data_type_map_.find(input_name);
     if (iter == input_data_type_map_.end()) {
       LOG_MESSAGE(TRITONSERVER_LOG_ERROR,
                   "input_name error, cannot found in input_data_type_map_");
+      return TRITONSERVER_TYPE_INVALID;
     }
     return iter->second;
   }
@@ -52,9 +60,15 @@ class ModelState : public BackendModel {
     if (iter == output_data_type_map_.end()) {
       LOG_MESSAGE(TRITONSERVER_LOG_ERROR,
                   "output_name error, cannot found in output_data_type_map_");
+      return TRITONSERVER_TYPE_INVALID;
     }
     return iter->second;
   }
+  // The lightseq model may have more outputs than the configuration declares,
+  // e.g. the exit logits of Bert, the others are not returned
+  bool HasOutput(const std::string& output_name) const {
+    return output_data_type_map_.count(output_name) > 0;
+  }
 
   // Shape of the input and output tensor as given in the model
   // configuration file. This shape will not include the batch
@@ -73,6 +87,18 @@ class ModelState : public BackendModel {
 
   std::string GetModelType() { return model_type_; }
 
+  // Shared by the instances, nullptr unless the optional parameter
+  // result_cache_bytes is set for a Transformer
+  ::lightseq::cuda::ResultCache* GetResultCache() {
+    return result_cache_.get();
+  }
+  // Stripped from the end of the source rows of the cache keys, -1 if unset
+  int GetPaddingId() { return padding_id_; }
+  // The model part of the cache keys, the name and the version
+  std::string ResultCacheModelId() {
+    return Name() + ":" + std::to_string(Version());
+  }
+
  private:
   ModelState(TRITONBACKEND_Model* triton_model);
 
@@ -83,6 +109,9 @@ class ModelState : public BackendModel {
   std::vector<int64_t> shape_;
 
   std::string model_type_;
+
+  std::unique_ptr<::lightseq::cuda::ResultCache> result_cache_;
+  int padding_id_ = -1;
 };
 
 ModelState::ModelState(TRITONBACKEND_Model* triton_model)
@@ -134,6 +163,27 @@ TRITONSERVER_Error* ModelState::TensorShape(std::vector<int64_t>& shape) {
   return nullptr;  // success
 }
 
+// Integer value of the string parameter name, an error unless the whole
+// value is an integer in [min_value, max_value]
+TRITONSERVER_Error* ParseIntParameter(const std::string& name,
+                                      const std::string& value,
+                                      long long min_value,
+                                      long long max_value, long long* res) {
+  char* end = nullptr;
+  errno = 0;
+  *res = strtoll(value.c_str(), &end, 10);
+  if (value.empty() || *end != '\0' || errno == ERANGE || *res < min_value ||
+      *res > max_value) {
+    return TRITONSERVER_ErrorNew(
+        TRITONSERVER_ERROR_INVALID_ARG,
+        ("parameter " + name + " should be an integer in [" +
+         std::to_string(min_value) + ", " + std::to_string(max_value) +
+         "], got '" + value + "'")
+            .c_str());
+  }
+  return nullptr;
+}
+
 TRITONSERVER_Error* ModelState::ValidateModelConfig() {
   // If verbose logging is enabled, dump the model's configuration as
   // JSON into the console output.
@@ -200,6 +250,31 @@ TRITONSERVER_Error* ModelState::ValidateModelConfig() {
       "string_value", &model_type_value, &model_type_length));
   model_type_ = std::string(model_type_value);
 
+  common::TritonJson::Value param_obj;
+  const char* param_value;
+  size_t param_length;
+  long long param_int;
+  if (parameters.Find("padding_id", &param_obj)) {
+    RETURN_IF_ERROR(param_obj.MemberAsString("string_value", &param_value,
+                                             &param_length));
+    RETURN_IF_ERROR(ParseIntParameter(
+        "padding_id", std::string(param_value, param_length), -1,
+        std::numeric_limits<int>::max(), &param_int));
+    padding_id_ = param_int;
+  }
+  if (parameters.Find("result_cache_bytes", &param_obj)) {
+    RETURN_IF_ERROR(param_obj.MemberAsString("string_value", &param_value,
+                                             &param_length));
+    RETURN_IF_ERROR(ParseIntParameter(
+        "result_cache_bytes", std::string(param_value, param_length), 0,
+        std::numeric_limits<long long>::max(), &param_int));
+    ::lightseq::cuda::ResultCacheConfig cache_config;
+    cache_config.capacity_bytes = param_int;
+    if (cache_config.capacity_bytes > 0 && model_type_ == "Transformer") {
+      result_cache_.reset(new ::lightseq::cuda::ResultCache(cache_config));
+    }
+  }
+
   // Record the file_name of model paramters
   const char* model_file_name;
   size_t file_name_len;
@@ -324,6 +399,8 @@ ModelInstanceState::ModelInstanceState(
   d_outputs_map.clear();
   for (int idx = 0; idx < lightseq_model_ptr_->get_output_size(); idx++) {
     std::string output_name = lightseq_model_ptr_->get_output_name(idx);
+    // the model keeps writing it to its own buffer
+    if (!model_state_->HasOutput(output_name)) continue;
     TRITONSERVER_DataType data_type =
         model_state_->GetOutputDataTypeByName(output_name);
     uint32_t output_byte_size = TRITONSERVER_DataTypeByteSize(data_type);
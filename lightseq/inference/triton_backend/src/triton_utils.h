@@ -37,3 +37,36 @@ TRITONSERVER_DataType transform_triton_datatype_to_lightseq(
   }
   return TRITONSERVER_TYPE_INVALID;
 }
+
+// control inputs of the sequence batcher, the model config maps
+// CONTROL_SEQUENCE_START and CONTROL_SEQUENCE_END to these names. A request
+// with a correlation id is a turn of a Gpt session, see session_cache.h
+const std::string kSequenceStartName = "START";
+const std::string kSequenceEndName = "END";
+
+/* A sequence control input is true if its first element is not zero */
+inline bool read_sequence_control(TRITONBACKEND_Input* input,
+                                  TRITONSERVER_DataType datatype) {
+  const void* buffer = nullptr;
+  uint64_t buffer_byte_size = 0;
+  TRITONSERVER_MemoryType memory_type = TRITONSERVER_MEMORY_CPU;
+  int64_t memory_type_id = 0;
+  LOG_IF_ERROR(TRITONBACKEND_InputBuffer(input, 0, &buffer, &buffer_byte_size,
+                                         &memory_type, &memory_type_id),
+               "failed get sequence control buffer");
+  uint64_t elt_size = TRITONSERVER_DataTypeByteSize(datatype);
+  if (buffer == nullptr || elt_size == 0 || buffer_byte_size < elt_size) {
+    return false;
+  }
+  std::vector<char> value(elt_size);
+  if (memory_type == TRITONSERVER_MEMORY_GPU) {
+    ::lightseq::cuda::CHECK_GPU_ERROR(
+        cudaMemcpy(value.data(), buffer, elt_size, cudaMemcpyDeviceToHost));
+  } else {
+    memcpy(value.data(), buffer, elt_size);
+  }
+  for (char c : value) {
+    if (c != 0) return true;
+  }
+  return false;
+}
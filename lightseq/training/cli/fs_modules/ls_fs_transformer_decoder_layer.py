@@ -24,7 +24,12 @@ class LSFSTransformerDecoderLayer(LSTransformerDecoderLayer):
     def reorder_incremental_state(self, incremental_state, new_order):
         cache = self.get_self_attn_cache(incremental_state)
         if cache is not None:
+            if "kv_cache_len" in cache:
+                # self-attention k/v are kept and reordered on device
+                self.reorder_kv_cache(new_order)
             for k in cache.keys():
+                if k == "kv_cache_len":
+                    continue
                 if k == "encdec_kv":
                     cur_order = new_order // self.beam_size
                     cur_order = cur_order[:: self.beam_size]
@@ -38,6 +38,7 @@ class TransformerBuilder(CUDAOpBuilder):
             "csrc/layers/cross_entropy_layer.cpp",
             "csrc/layers/transformer_encoder_layer.cpp",
             "csrc/layers/transformer_decoder_layer.cpp",
+            "csrc/layers/decoder_kv_cache.cpp",
             "csrc/layers/transformer_embedding_layer.cpp",
             "csrc/torch/pybind_op.cpp",
         ]
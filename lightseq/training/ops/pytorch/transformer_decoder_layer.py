@@ -188,6 +188,80 @@ class LSTransformerDecoderLayer(TransformerDecoderLayerBase):
             cur_para.copy_(b.view(-1))
             idx += 1
 
+    def enable_kv_cache(self, chunk_size=32):
+        """Keep the self-attention k/v of step-wise inference in a device-side
+        cache that grows by chunk_size steps and is reordered in place, instead
+        of re-allocating and concatenating cache tensors on every step.
+        The cache dict passed to forward then only holds "kv_cache_len" (and
+        "encdec_kv" for layer 0).
+        """
+        cuda_module = transformer_cuda_module
+        create_func = (
+            cuda_module.create_decoder_kv_cache_fp16
+            if self.config.fp16
+            else cuda_module.create_decoder_kv_cache_fp32
+        )
+        create_func(
+            self.config.layer_id,
+            self.config.nhead,
+            self.config.hidden_size // self.config.nhead,
+            self.config.max_seq_len,
+            chunk_size,
+        )
+        self.kv_cache_enabled = True
+
+    def reorder_kv_cache(self, new_order):
+        """Beam search reorder of the managed kv cache, new_order: [batch * beam]"""
+        cuda_module = transformer_cuda_module
+        reorder_func = (
+            cuda_module.decoder_kv_cache_reorder_fp16
+            if self.config.fp16
+            else cuda_module.decoder_kv_cache_reorder_fp32
+        )
+        reorder_func(self.config.layer_id, new_order.to(torch.int32).contiguous())
+
+    def kv_cache_stats(self):
+        """Length, capacity and memory of the managed kv cache"""
+        cuda_module = transformer_cuda_module
+        stats_func = (
+            cuda_module.decoder_kv_cache_stats_fp16
+            if self.config.fp16
+            else cuda_module.decoder_kv_cache_stats_fp32
+        )
+        return stats_func(self.config.layer_id)
+
+    def _forward_kv_cache(
+        self, decoder_states, encoder_out, encoder_padding_mask, cache
+    ):
+        start = "kv_cache_len" not in cache
+        if self.config.layer_id == 0 and start:
+            shape = (
+                self.config.nlayer * 2,
+                encoder_out.shape[0],
+                encoder_out.shape[1] * self.config.hidden_size,
+            )
+            cache["encdec_kv"] = torch.zeros(
+                shape, dtype=decoder_states.dtype, device=decoder_states.device
+            ).contiguous()
+        encdec_kv = [cache["encdec_kv"]] if self.config.layer_id == 0 else []
+        cuda_module = transformer_cuda_module
+        forward_func = (
+            cuda_module.transformer_decoder_layer_fw_kv_cache_fp16
+            if self.config.fp16
+            else cuda_module.transformer_decoder_layer_fw_kv_cache_fp32
+        )
+        (output,) = forward_func(
+            self.config.layer_id,
+            decoder_states,
+            encoder_out,
+            encoder_padding_mask,
+            self.config.pre_layer_norm,
+            start,
+            encdec_kv,
+        )
+        cache["kv_cache_len"] = cache.get("kv_cache_len", 0) + 1
+        return output.to(self.para)
+
     @staticmethod
     def gen_offset(hidden_size, intermediate_size, nlayer):
         """Returns the offset of each module's parameters among all
@@ -432,6 +506,32 @@ class LSTransformerDecoderLayer(TransformerDecoderLayerBase):
             encoder_padding_mask = encoder_padding_mask.to(torch.half)
 
         self.__assign_layer_weight_grad()
+        bs, sl, dim = decoder_states.size()
+        if bs * sl > self.config.max_batch_tokens:
+            raise ValueError(
+                f"Batch token numbers {bs * sl} exceeds the limit"
+                f" {self.config.max_batch_tokens}."
+            )
+        if sl > self.config.max_seq_len:
+            raise ValueError(
+                f"Sequence length {sl} exceeds the limit {self.config.max_seq_len}."
+            )
+        if len(encoder_padding_mask.size()) == 1:
+            assert encoder_out.size(0) == 1 and encoder_out.size(
+                1
+            ) == encoder_padding_mask.size(0)
+        else:
+            assert encoder_out.size(0) == encoder_padding_mask.size(
+                0
+            ) and encoder_out.size(1) == encoder_padding_mask.size(1)
+        if cache is None:
+            assert bs == encoder_out.size(0)
+        else:
+            assert bs % encoder_out.size(0) == 0
+        if cache is not None and getattr(self, "kv_cache_enabled", False):
+            return self._forward_kv_cache(
+                decoder_states, encoder_out, encoder_padding_mask, cache
+            )
         cache_list = []
         if cache is not None:
             # predict
@@ -472,28 +572,6 @@ class LSTransformerDecoderLayer(TransformerDecoderLayerBase):
             cache["dec_self_k"] = new_k
             cache["dec_self_v"] = new_v
             self.config.training = False
-        bs, sl, dim = decoder_states.size()
-        if bs * sl > self.config.max_batch_tokens:
-            raise ValueError(
-                f"Batch token numbers {bs * sl} exceeds the limit"
-                f" {self.config.max_batch_tokens}."
-            )
-        if sl > self.config.max_seq_len:
-            raise ValueError(
-                f"Sequence length {sl} exceeds the limit {self.config.max_seq_len}."
-            )
-        if len(encoder_padding_mask.size()) == 1:
-            assert encoder_out.size(0) == 1 and encoder_out.size(
-                1
-            ) == encoder_padding_mask.size(0)
-        else:
-            assert encoder_out.size(0) == encoder_padding_mask.size(
-                0
-            ) and encoder_out.size(1) == encoder_padding_mask.size(1)
-        if cache is None:
-            assert bs == encoder_out.size(0)
-        else:
-            assert bs % encoder_out.size(0) == 0
         output = LSTransformerDecoderFunc.apply(
             decoder_states,
             encoder_out,
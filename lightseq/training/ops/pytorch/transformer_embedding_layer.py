@@ -16,7 +16,7 @@ _all_layer_grads = dict()
 
 class LSTransformerEmbeddingFunc(Function):
     @staticmethod
-    def forward(ctx, config, input, embeddings, step):
+    def forward(ctx, config, input, embeddings, step, packed_pos_ids):
         cuda_module = transformer_cuda_module
         forward_func = (
             cuda_module.transformer_embedding_layer_fw_fp16
@@ -24,7 +24,9 @@ class LSTransformerEmbeddingFunc(Function):
             else cuda_module.transformer_embedding_layer_fw_fp32
         )
 
-        (output,) = forward_func(config.layer_id, input, step, config.training)
+        (output,) = forward_func(
+            config.layer_id, input, step, config.training, packed_pos_ids
+        )
 
         if config.is_grad_enabled and config.training:
             ctx.save_for_backward(input)
@@ -50,7 +52,7 @@ class LSTransformerEmbeddingFunc(Function):
 
         grad = _all_layer_grads[ctx.config.layer_id]
 
-        return (None, None, grad, None)
+        return (None, None, grad, None, None)
 
 
 class LSTransformerEmbeddingLayer(TransformerEmbeddingLayerBase):
@@ -184,7 +186,9 @@ class LSTransformerEmbeddingLayer(TransformerEmbeddingLayerBase):
         offsets = calc_offset(sizes)
         return offsets
 
-    def forward(self, input, step=0, **kwargs):
+    def forward(self, input, step=0, packed_pos_ids=None, **kwargs):
+        # packed_pos_ids is only used when several samples are packed into one
+        # row, see get_packed_sequence_info, size is [batch_size, seq_len]
         self.config.training = self.training
         self.config.is_grad_enabled = torch.is_grad_enabled()
 
@@ -211,5 +215,12 @@ class LSTransformerEmbeddingLayer(TransformerEmbeddingLayerBase):
                 f"Target sequence length {sl} exceeds the limit"
                 f" {self.config.max_seq_len}."
             )
-        x = LSTransformerEmbeddingFunc.apply(self.config, input, self.para, step)
+        if packed_pos_ids is None:
+            packed_pos_ids = torch.empty(0, dtype=torch.int, device=input.device)
+        else:
+            assert packed_pos_ids.size() == (bs, sl)
+            packed_pos_ids = packed_pos_ids.to(torch.int).contiguous()
+        x = LSTransformerEmbeddingFunc.apply(
+            self.config, input, self.para, step, packed_pos_ids
+        )
         return x.to(self.para)
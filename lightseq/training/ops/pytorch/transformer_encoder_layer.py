@@ -24,6 +24,7 @@ class LSTransformerEncoderFunc(Function):
         input_mask,
         parameters,
         config,
+        packed_seg_ids,
     ):
         cuda_module = transformer_cuda_module
         forward_func = (
@@ -36,7 +37,12 @@ class LSTransformerEncoderFunc(Function):
             input_mask = input_mask.to(torch.half)
 
         (output,) = forward_func(
-            config.layer_id, input, input_mask, config.training, config.pre_layer_norm
+            config.layer_id,
+            input,
+            input_mask,
+            config.training,
+            config.pre_layer_norm,
+            packed_seg_ids,
         )
 
         if config.is_grad_enabled and config.training:
@@ -67,7 +73,7 @@ class LSTransformerEncoderFunc(Function):
 
         grad = _all_layer_grads[ctx.config.layer_id]
 
-        return (grad_input, None, grad, None)
+        return (grad_input, None, grad, None, None)
 
 
 class LSTransformerEncoderLayer(TransformerEncoderLayerBase):
@@ -281,10 +287,14 @@ class LSTransformerEncoderLayer(TransformerEncoderLayerBase):
         )
         return destination
 
-    def forward(self, hidden_states, encoder_padding_mask, **kwargs):
+    def forward(
+        self, hidden_states, encoder_padding_mask, packed_seg_ids=None, **kwargs
+    ):
         # encoder_padding_mask is a mask for the input sequence
         # sizes are [batch_size, seq_len] or [seq_len] when batch_size = 1
         # masked value should be 1.0, unmasked value should be 0.0
+        # packed_seg_ids is only used when several samples are packed into one
+        # row, see get_packed_sequence_info, size is [batch_size, seq_len]
 
         self.config.training = self.training
         self.config.is_grad_enabled = torch.is_grad_enabled()
@@ -315,11 +325,19 @@ class LSTransformerEncoderLayer(TransformerEncoderLayerBase):
             assert bs == encoder_padding_mask.size(
                 0
             ) and sl == encoder_padding_mask.size(1)
+        if packed_seg_ids is None:
+            packed_seg_ids = torch.empty(
+                0, dtype=torch.int, device=hidden_states.device
+            )
+        else:
+            assert packed_seg_ids.size() == (bs, sl)
+            packed_seg_ids = packed_seg_ids.to(torch.int).contiguous()
         output = LSTransformerEncoderFunc.apply(
             hidden_states,
             encoder_padding_mask,
             self.para,
             self.config,
+            packed_seg_ids,
         )
 
         return output.to(self.para)
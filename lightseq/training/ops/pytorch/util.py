@@ -82,6 +82,28 @@ def get_pos_embedding(max_length, embedding_dim):
     return emb
 
 
+def get_packed_sequence_info(row_cu_seqlens, seq_len, device=None):
+    """Segment ids and position ids of a packed batch.
+
+    Several samples are concatenated into each row of a [batch_size, seq_len]
+    batch. row_cu_seqlens[b] is the list of cumulative sample lengths of row b,
+    e.g. [0, 3, 7] for samples of length 3 and 4, the rest of the row is padding.
+    Returns two int32 tensors of shape [batch_size, seq_len]: the segment ids
+    for LSTransformerEncoderLayer (block-diagonal attention) and the position
+    ids for LSTransformerEmbeddingLayer.
+    """
+    from lightseq.training.ops.pytorch import transformer_cuda_module
+
+    row_cu_seqlens = [[int(x) for x in row] for row in row_cu_seqlens]
+    seg_ids, pos_ids = transformer_cuda_module.get_packed_sequence_info(
+        row_cu_seqlens, len(row_cu_seqlens), seq_len
+    )
+    if device is not None:
+        seg_ids = seg_ids.to(device, non_blocking=True)
+        pos_ids = pos_ids.to(device, non_blocking=True)
+    return seg_ids, pos_ids
+
+
 def base_architecture(args):
     args.setdefault("hidden_size", 512)
     args.setdefault("intermediate_size", 2048)
@@ -0,0 +1,11 @@
+# host-side unit tests, no GPU needed
+set -e
+cd "$(dirname "$0")"
+ROOT=../..
+mkdir -p build
+for src in test_*.cpp; do
+  name=${src%.cpp}
+  g++ -std=c++14 -O2 -Wall -pthread -I${ROOT} \
+    -I${ROOT}/lightseq/inference/pywrapper ${src} -o build/${name}
+  ./build/${name}
+done
@@ -0,0 +1,111 @@
+#include <random>
+#include <set>
+
+#include "lightseq/inference/model/batch_compaction.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+void test_drop_fills_holes_from_tail() {
+  BatchCompaction compaction;
+  compaction.reset(6);
+  CHECK_EQ(compaction.num_live(), 6);
+  CHECK(!compaction.compacted());
+  std::vector<BatchMove> saves, moves;
+  compaction.drop({0, 1, 0, 0, 1, 0}, &saves, &moves);
+  CHECK_EQ(compaction.num_live(), 4);
+  CHECK(compaction.compacted());
+  CHECK_EQ(saves.size(), 2u);
+  CHECK_EQ(saves[0].src, 1);
+  CHECK_EQ(saves[0].dst, 1);
+  CHECK_EQ(saves[1].src, 4);
+  CHECK_EQ(saves[1].dst, 4);
+  // slot 1 is filled by slot 5, slot 4 is out of the new prefix
+  CHECK_EQ(moves.size(), 1u);
+  CHECK_EQ(moves[0].src, 5);
+  CHECK_EQ(moves[0].dst, 1);
+  CHECK((compaction.live_items() == std::vector<int>{0, 5, 2, 3}));
+
+  // the saves of a later drop are in original items
+  compaction.drop({1, 0, 0, 1}, &saves, &moves);
+  CHECK_EQ(saves.size(), 2u);
+  CHECK_EQ(saves[0].dst, 0);
+  CHECK_EQ(saves[1].dst, 3);
+  CHECK_EQ(moves.size(), 1u);
+  CHECK_EQ(moves[0].src, 2);
+  CHECK_EQ(moves[0].dst, 0);
+  CHECK((compaction.live_items() == std::vector<int>{2, 5}));
+}
+
+void test_drop_nothing_and_all() {
+  BatchCompaction compaction;
+  compaction.reset(3);
+  std::vector<BatchMove> saves, moves;
+  compaction.drop({0, 0, 0}, &saves, &moves);
+  CHECK(saves.empty());
+  CHECK(moves.empty());
+  CHECK(!compaction.compacted());
+  // finished tail items need no move
+  compaction.drop({0, 1, 1}, &saves, &moves);
+  CHECK_EQ(saves.size(), 2u);
+  CHECK(moves.empty());
+  CHECK_EQ(compaction.num_live(), 1);
+  compaction.drop({1}, &saves, &moves);
+  CHECK_EQ(compaction.num_live(), 0);
+  CHECK(compaction.scatter_moves().empty());
+  // fewer flags than the live slots
+  compaction.reset(2);
+  CHECK_THROW(compaction.drop({1}, &saves, &moves));
+}
+
+// Simulate the decoder: the slots hold their original item id, the finished
+// items are saved, and every item ends up at its original position
+void test_random_decoding() {
+  std::mt19937 gen(3);
+  for (int round = 0; round < 200; round++) {
+    int batch_size = 1 + gen() % 16;
+    BatchCompaction compaction;
+    compaction.reset(batch_size);
+    std::vector<int> slots(batch_size), result(batch_size, -1);
+    for (int i = 0; i < batch_size; i++) slots[i] = i;
+    std::vector<BatchMove> saves, moves;
+    while (compaction.num_live() > 0) {
+      int n = compaction.num_live();
+      std::vector<int> finished(n);
+      for (int i = 0; i < n; i++) finished[i] = gen() % 4 == 0;
+      compaction.drop(finished, &saves, &moves);
+      // in place and in parallel: no slot is both a src and a dst
+      std::set<int> srcs, dsts;
+      for (const BatchMove &m : moves) {
+        CHECK(m.src >= compaction.num_live());
+        CHECK(m.dst < compaction.num_live());
+        CHECK(finished[m.dst]);
+        CHECK(!finished[m.src]);
+        srcs.insert(m.src);
+        dsts.insert(m.dst);
+      }
+      for (int s : srcs) CHECK(!dsts.count(s));
+      for (const BatchMove &m : saves) {
+        CHECK_EQ(slots[m.src], m.dst);
+        result[m.dst] = slots[m.src];
+      }
+      for (const BatchMove &m : moves) slots[m.dst] = slots[m.src];
+      slots.resize(compaction.num_live());
+      for (int i = 0; i < compaction.num_live(); i++) {
+        CHECK_EQ(slots[i], compaction.live_items()[i]);
+      }
+      if (gen() % 5 == 0) break;  // max step reached
+    }
+    for (const BatchMove &m : compaction.scatter_moves()) {
+      result[m.dst] = slots[m.src];
+    }
+    for (int i = 0; i < batch_size; i++) CHECK_EQ(result[i], i);
+  }
+}
+
+int main() {
+  RUN_TEST(test_drop_fills_holes_from_tail);
+  RUN_TEST(test_drop_nothing_and_all);
+  RUN_TEST(test_random_decoding);
+  return 0;
+}
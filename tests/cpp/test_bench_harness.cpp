@@ -0,0 +1,202 @@
+#include "lightseq/inference/benchmark/stub_model.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+SyntheticModelShape small_shape(const std::string &model) {
+  SyntheticModelShape shape;
+  shape.model = model;
+  shape.enc_layers = 2;
+  shape.dec_layers = 2;
+  shape.hidden = 16;
+  shape.heads = 4;
+  shape.inner = 32;
+  shape.vocab = 50;
+  shape.max_step = 64;
+  return shape;
+}
+
+void test_latency_stats() {
+  std::vector<double> latency;
+  for (int i = 100; i >= 1; i--) latency.push_back(i);
+  LatencyStats stats = compute_latency_stats(latency);
+  CHECK_EQ(stats.count, 100);
+  CHECK_NEAR(stats.mean_ms, 50.5, 1e-9);
+  CHECK_NEAR(stats.min_ms, 1, 1e-9);
+  CHECK_NEAR(stats.max_ms, 100, 1e-9);
+  CHECK_NEAR(stats.p50_ms, 50.5, 1e-9);
+  CHECK_NEAR(stats.p90_ms, 90.1, 1e-9);
+  CHECK_NEAR(stats.p99_ms, 99.01, 1e-9);
+  LatencyStats one = compute_latency_stats({3.0});
+  CHECK_NEAR(one.p99_ms, 3.0, 1e-9);
+  CHECK_EQ(compute_latency_stats({}).count, 0);
+}
+
+void test_sweep_expansion() {
+  BenchSweep sweep;
+  sweep.models = {"Transformer", "Bert", "Gpt"};
+  sweep.batch_sizes = {1, 8};
+  sweep.seq_lens = {16};
+  sweep.beam_sizes = {1, 4};
+  sweep.sampling_methods = {"beam_search", "topk"};
+  std::vector<BenchCase> cases = expand_bench_sweep(sweep);
+  // transformer: beam_search/beam4 and topk/beam1 per batch size
+  // bert: one case per batch size, gpt: topk/beam1 per batch size
+  CHECK_EQ(cases.size(), (size_t)8);
+  for (const BenchCase &c : cases) {
+    if (c.model == "Bert") CHECK(c.sampling_method.empty());
+    if (c.model == "Gpt") CHECK(c.sampling_method == "topk");
+    CHECK((c.sampling_method == "beam_search") == (c.beam_size > 1));
+  }
+  CHECK(cases[0].name() == "Transformer/bs1/len16/beam_search/beam4");
+}
+
+void test_synthetic_is_reproducible() {
+  std::vector<int> a = synthetic_token_ids(4, 8, 50, 7);
+  std::vector<int> b = synthetic_token_ids(4, 8, 50, 7);
+  std::vector<int> c = synthetic_token_ids(4, 8, 50, 8);
+  CHECK(a == b);
+  CHECK(a != c);
+  for (int id : a) CHECK(id >= 1 && id < 49);
+  SyntheticRng rng(1);
+  for (int i = 0; i < 1000; i++) {
+    float v = rng.uniform(-2.f, 2.f);
+    CHECK(v >= -2.f && v < 2.f);
+  }
+}
+
+void test_param_count() {
+  SyntheticModelShape bert = small_shape("Bert");
+  size_t h = 16, i = 32, v = 50, s = 64;
+  size_t layer = 4 * h * h + 8 * h + 2 * h * i + i + h;
+  CHECK_EQ(bert.param_count(), v * h + s * h + 2 * h + 2 * layer);
+  SyntheticModelShape transformer = small_shape("Transformer");
+  CHECK(transformer.param_count() > 2 * bert.param_count());
+  SyntheticModelShape moe = small_shape("Moe");
+  CHECK(moe.param_count() > transformer.param_count());
+  SyntheticModelShape bad = small_shape("Bert");
+  bad.heads = 3;
+  CHECK_THROW(bad.check());
+  bad = small_shape("Vit");
+  CHECK_THROW(bad.check());
+}
+
+void test_generated_tokens() {
+  // [2, 2, 4], the second beams are not counted, 7 is the end id
+  std::vector<int> ids = {1, 2, 3, 4, 9, 9, 9, 9, 1, 7, 7, 7, 9, 9, 9, 9};
+  CHECK_EQ(bench_generated_tokens(ids, {2, 2, 4}, 0, 7), (size_t)(4 + 2));
+  // gpt [2, 5] with 2 prompt tokens
+  ids = {5, 6, 1, 7, 7, 5, 6, 1, 2, 3};
+  CHECK_EQ(bench_generated_tokens(ids, {2, 5}, 2, 7), (size_t)(2 + 3));
+  CHECK_EQ(bench_generated_tokens({}, {0, 5}, 2, 7), (size_t)0);
+}
+
+void test_run_case_on_stub() {
+  HostBenchBackend backend;
+  SyntheticModelShape shape = small_shape("Transformer");
+  StubModel model(shape, 8);
+  BenchCase c = {"Transformer", 2, 10, 4, "beam_search"};
+  BenchResult r = run_bench_case(&model, c, &backend, shape.vocab, 1, 5, 1);
+  CHECK_EQ(r.latency.count, 5);
+  CHECK(r.latency.min_ms <= r.latency.p50_ms);
+  CHECK(r.latency.p50_ms <= r.latency.max_ms);
+  // the best beam of [batch_size, beam, len] generated ids
+  CHECK_NEAR(r.tokens_per_infer, 2 * 10, 1e-9);
+  // input ids, [8, 4, 64] ids and [8, 4] scores
+  CHECK(r.device_memory_in_use_bytes >=
+        (size_t)(2 * 10 + 8 * 4 * 64 + 8 * 4) * 4);
+  CHECK_EQ(backend.current_bytes(), (size_t)0);
+
+  CHECK(r.stages.empty());
+
+  BenchResult profiled =
+      run_bench_case(&model, c, &backend, shape.vocab, 1, 5, 1, true);
+  CHECK_EQ(profiled.stages.at("infer").count, (uint64_t)5);
+  CHECK(profiled.stages.count("stub.layer_0.ffn"));
+  CHECK(!model.profiling_enabled());
+  profiled.variant = "epilogue_on";
+  std::string json = bench_results_to_json({profiled}, {});
+  CHECK(json.find("\"variant\": \"epilogue_on\"") != std::string::npos);
+  CHECK(json.find("\"stub.layer_0.ffn\": {\"count\": ") !=
+        std::string::npos);
+
+  SyntheticModelShape gpt_shape = small_shape("Gpt");
+  StubModel gpt(gpt_shape, 8);
+  BenchCase gpt_case = {"Gpt", 2, 10, 1, "topk"};
+  r = run_bench_case(&gpt, gpt_case, &backend, gpt_shape.vocab, 0, 2, 1);
+  // the prompt is not counted
+  CHECK_NEAR(r.tokens_per_infer, 2 * gpt_shape.extra_decode_length, 1e-9);
+
+  BenchCase too_long = {"Transformer", 2, 65, 4, "beam_search"};
+  CHECK_THROW(
+      run_bench_case(&model, too_long, &backend, shape.vocab, 0, 1, 1));
+}
+
+void test_sweep_and_json() {
+  const char *argv[] = {"bench",           "--models=Transformer,Bert,Gpt",
+                        "--batch_sizes=1,4", "--seq_lens=8,100",
+                        "--beam_sizes=1,2",  "--hidden=16",
+                        "--heads=4",         "--inner=32",
+                        "--vocab=50",        "--max_step=64",
+                        "--layers=1",        "--iters=3",
+                        "--warmup=0",        "--device=stub"};
+  BenchOptions opt = parse_bench_options(14, (char **)argv);
+  CHECK_EQ(opt.shape.enc_layers, 1);
+  CHECK_EQ(opt.shape.dec_layers, 1);
+  int created = 0;
+  BenchModelCreator create = [&created](const SyntheticModelShape &shape,
+                                        int max_batch_size) {
+    created++;
+    CHECK_EQ(max_batch_size, 4);
+    if (shape.model == "Gpt") throw std::runtime_error("no \"gpt\" today");
+    return new StubModel(shape, max_batch_size);
+  };
+  HostBenchBackend backend;
+  std::vector<BenchResult> results = run_bench_sweep(opt, create, &backend);
+  // transformer beam_search/2 and topk/1, bert, gpt topk/1
+  CHECK_EQ(created, 4);
+  CHECK_EQ(results.size(), (size_t)16);
+  int errors = 0;
+  for (const BenchResult &r : results) {
+    if (r.bench_case.seq_len == 100 || r.bench_case.model == "Gpt") {
+      CHECK(!r.error.empty());
+      errors++;
+    } else {
+      CHECK(r.error.empty());
+      CHECK(r.tokens_per_sec > 0);
+    }
+  }
+  CHECK_EQ(errors, 10);
+
+  std::string json = bench_results_to_json(results, {{"device", "stub"}});
+  CHECK(json.find("\"device\": \"stub\"") != std::string::npos);
+  CHECK(json.find("\"p99\": ") != std::string::npos);
+  CHECK(json.find("\"tokens_per_sec\": ") != std::string::npos);
+  CHECK(json.find("\"device_memory_in_use_bytes\": ") != std::string::npos);
+  CHECK(json.find("no \\\"gpt\\\" today") != std::string::npos);
+}
+
+void test_bad_options() {
+  const char *unknown[] = {"bench", "--batch_size=1"};
+  CHECK_THROW(parse_bench_options(2, (char **)unknown));
+  const char *no_value[] = {"bench", "--iters"};
+  CHECK_THROW(parse_bench_options(2, (char **)no_value));
+  const char *ab[] = {"bench", "--epilogue_ab=1"};
+  BenchOptions opt = parse_bench_options(2, (char **)ab);
+  CHECK(opt.epilogue_ab);
+  CHECK(opt.profile);
+  const char *bad_model[] = {"bench", "--models=Vit"};
+  CHECK_THROW(parse_bench_options(2, (char **)bad_model));
+}
+
+int main() {
+  RUN_TEST(test_latency_stats);
+  RUN_TEST(test_sweep_expansion);
+  RUN_TEST(test_synthetic_is_reproducible);
+  RUN_TEST(test_param_count);
+  RUN_TEST(test_generated_tokens);
+  RUN_TEST(test_run_case_on_stub);
+  RUN_TEST(test_sweep_and_json);
+  RUN_TEST(test_bad_options);
+  return 0;
+}
@@ -0,0 +1,109 @@
+#include "lightseq/inference/pywrapper/dlpack_tensor.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+DLTensor make_tensor(std::vector<int64_t> *shape, DLDataType dtype,
+                     int64_t *strides = nullptr) {
+  static int dummy[64];
+  DLTensor t;
+  t.data = dummy;
+  t.device = {kDLCUDA, 0};
+  t.ndim = shape->size();
+  t.dtype = dtype;
+  t.shape = shape->data();
+  t.strides = strides;
+  t.byte_offset = 0;
+  return t;
+}
+
+void test_dtype() {
+  DLDataType f16 = dl_dtype(kFloat16);
+  CHECK_EQ(f16.code, kDLFloat);
+  CHECK_EQ(f16.bits, 16);
+  CHECK_EQ(f16.lanes, 1);
+  CHECK_EQ(data_type_bytes(kFloat32), 4);
+  CHECK_EQ(data_type_bytes(kFloat16), 2);
+  CHECK_EQ(data_type_bytes(kInt8), 1);
+  CHECK_EQ(data_type_bytes(kInt64), 8);
+  CHECK_EQ(dl_dtype_str(dl_dtype(kInt32)), "int32");
+  CHECK_EQ(dl_dtype_str(dl_dtype(kUInt8)), "uint8");
+  CHECK_THROW(dl_dtype(kNotSupported));
+}
+
+void test_check() {
+  std::vector<int64_t> shape = {2, 5};
+  DLTensor t = make_tensor(&shape, dl_dtype(kInt32));
+  std::vector<int> max_shape = {8, 16};
+  CHECK_EQ(check_dl_tensor(t, kInt32, max_shape, 0), "");
+  CHECK_EQ(dl_numel(t), 10);
+  CHECK((dl_shape(t) == std::vector<int>{2, 5}));
+  // dtype, device, ndim and shape
+  CHECK(check_dl_tensor(t, kFloat32, max_shape, 0) != "");
+  CHECK(check_dl_tensor(t, kInt32, max_shape, 1) != "");
+  CHECK(check_dl_tensor(t, kInt32, {8, 16, 4}, 0) != "");
+  CHECK(check_dl_tensor(t, kInt32, {8, 4}, 0) != "");
+  t.device.device_type = kDLCPU;
+  CHECK(check_dl_tensor(t, kInt32, max_shape, 0) != "");
+  t.device.device_type = kDLCUDAManaged;
+  CHECK_EQ(check_dl_tensor(t, kInt32, max_shape, 0), "");
+  std::vector<int64_t> empty = {0, 5};
+  t = make_tensor(&empty, dl_dtype(kInt32));
+  CHECK(check_dl_tensor(t, kInt32, max_shape, 0) != "");
+}
+
+void test_compact() {
+  std::vector<int64_t> shape = {2, 3, 4};
+  int64_t row_major[] = {12, 4, 1};
+  int64_t transposed[] = {12, 1, 3};
+  CHECK(dl_is_compact(make_tensor(&shape, dl_dtype(kFloat32))));
+  CHECK(dl_is_compact(make_tensor(&shape, dl_dtype(kFloat32), row_major)));
+  DLTensor t = make_tensor(&shape, dl_dtype(kFloat32), transposed);
+  CHECK(!dl_is_compact(t));
+  CHECK(check_dl_tensor(t, kFloat32, {2, 3, 4}, 0) != "");
+  // the stride of a size-1 dim does not matter, as torch may report it
+  std::vector<int64_t> one = {1, 4};
+  int64_t strides[] = {1, 1};
+  CHECK(dl_is_compact(make_tensor(&one, dl_dtype(kFloat32), strides)));
+}
+
+void test_data_ptr() {
+  std::vector<int64_t> shape = {4};
+  DLTensor t = make_tensor(&shape, dl_dtype(kFloat32));
+  t.byte_offset = 8;
+  CHECK_EQ(dl_data_ptr(t), static_cast<char *>(t.data) + 8);
+}
+
+void test_managed_tensor() {
+  int freed = 0;
+  float *data = new float[6];
+  DLManagedTensor *t = make_dl_managed_tensor(
+      data, kFloat16, {2, 3}, {kDLCUDA, 1}, [&freed](void *p) {
+        delete[] static_cast<float *>(p);
+        freed++;
+      });
+  CHECK_EQ(t->dl_tensor.data, data);
+  CHECK_EQ(t->dl_tensor.ndim, 2);
+  CHECK_EQ(t->dl_tensor.shape[0], 2);
+  CHECK_EQ(t->dl_tensor.shape[1], 3);
+  CHECK(t->dl_tensor.strides == nullptr);
+  CHECK_EQ(t->dl_tensor.device.device_id, 1);
+  CHECK_EQ(t->dl_tensor.dtype.bits, 16);
+  CHECK_EQ(check_dl_tensor(t->dl_tensor, kFloat16, {2, 3}, 1), "");
+  {
+    // consumed and released once
+    DLManagedTensorPtr owner(t);
+    CHECK_EQ(freed, 0);
+  }
+  CHECK_EQ(freed, 1);
+  DLManagedTensorPtr empty;
+}
+
+int main() {
+  RUN_TEST(test_dtype);
+  RUN_TEST(test_check);
+  RUN_TEST(test_compact);
+  RUN_TEST(test_data_ptr);
+  RUN_TEST(test_managed_tensor);
+  return 0;
+}
@@ -0,0 +1,126 @@
+#include <random>
+
+#include "lightseq/inference/kernels/early_exit.h"
+#include "lightseq/inference/model/batch_compaction.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+void test_criterion() {
+  float uniform[] = {1.f, 1.f, 1.f, 1.f};
+  CHECK_NEAR(exit_entropy(uniform, 4), 1.f, 1e-6);
+  CHECK_NEAR(exit_max_prob(uniform, 4), 0.25f, 1e-6);
+  float confident[] = {20.f, 0.f, 0.f};
+  CHECK(exit_entropy(confident, 3) < 1e-6);
+  CHECK_NEAR(exit_max_prob(confident, 3), 1.f, 1e-6);
+  // p = {0.5, 0.5, 0}: entropy log(2) / log(3)
+  float half[] = {0.f, 0.f, -1000.f};
+  CHECK_NEAR(exit_entropy(half, 3), std::log(2.f) / std::log(3.f), 1e-6);
+
+  CHECK(should_exit(confident, 3, kExitEntropy, 0.1f));
+  CHECK(!should_exit(uniform, 4, kExitEntropy, 0.9f));
+  CHECK(should_exit(half, 3, kExitMaxProb, 0.5f));
+  CHECK(!should_exit(half, 3, kExitMaxProb, 0.6f));
+  CHECK(!should_exit(confident, 3, kExitNone, 0.f));
+}
+
+void test_config() {
+  EarlyExitConfig config;
+  CHECK(!config.enabled());
+  CHECK_EQ(config.check(), "");
+  config.criterion = kExitEntropy;
+  config.threshold = 0.2f;
+  CHECK(config.enabled());
+  CHECK_EQ(config.check(), "");
+  config.threshold = 1.5f;
+  CHECK(config.check() != "");
+  config.criterion = 3;
+  config.threshold = 0.2f;
+  CHECK(config.check() != "");
+}
+
+std::vector<std::vector<float>> random_logits(int num_heads, int batch_size,
+                                              int num_labels,
+                                              std::mt19937 *gen) {
+  std::normal_distribution<float> dist(0.f, 3.f);
+  std::vector<std::vector<float>> res(num_heads);
+  for (auto &logits : res) {
+    for (int i = 0; i < batch_size * num_labels; i++) {
+      logits.push_back(dist(*gen));
+    }
+  }
+  return res;
+}
+
+// The encoder checks the live slots after each head and compacts the batch,
+// every sample should exit at the head of the CPU reference
+void test_compaction_matches_reference() {
+  std::mt19937 gen(7);
+  for (int round = 0; round < 100; round++) {
+    int batch_size = 1 + gen() % 12, num_labels = 2 + gen() % 4;
+    int num_heads = 1 + gen() % 5;
+    auto head_logits = random_logits(num_heads, batch_size, num_labels, &gen);
+    EarlyExitConfig config;
+    config.criterion = gen() % 2 ? kExitEntropy : kExitMaxProb;
+    config.threshold = config.criterion == kExitEntropy ? 0.3f : 0.8f;
+
+    BatchCompaction compaction;
+    compaction.reset(batch_size);
+    std::vector<int> exit_head(batch_size, -1);
+    std::vector<BatchMove> saves, moves;
+    for (int h = 0; h < num_heads && compaction.num_live() > 0; h++) {
+      bool last = h == num_heads - 1;
+      std::vector<int> finished(compaction.num_live());
+      for (int s = 0; s < compaction.num_live(); s++) {
+        int item = compaction.live_items()[s];
+        finished[s] =
+            last || should_exit(head_logits[h].data() + item * num_labels,
+                                num_labels, config.criterion, config.threshold);
+      }
+      compaction.drop(finished, &saves, &moves);
+      for (const BatchMove &m : saves) exit_head[m.dst] = h;
+    }
+    CHECK_EQ(compaction.num_live(), 0);
+    CHECK((exit_head ==
+           early_exit_heads(head_logits, batch_size, num_labels, config)));
+  }
+}
+
+void test_calibrate() {
+  // 2 heads of 3 samples, 2 labels. Head 0 is confident and right on
+  // samples 0 and 1, less confident and wrong on sample 2
+  std::vector<std::vector<float>> head_logits = {
+      {10.f, 0.f, 0.f, 4.f, 3.f, 0.f},
+      {1.f, 0.f, 0.f, 1.f, 0.f, 1.f}};
+  std::vector<int> head_layers = {2, 12};
+  std::vector<int> labels = {0, 1, 1};
+  ExitCalibration res = calibrate_early_exit(head_logits, head_layers, labels,
+                                             2, kExitMaxProb, 0.f);
+  // samples 0 and 1 exit, sample 2 is less confident and should not
+  CHECK_NEAR(res.accuracy, 1.f, 1e-6);
+  CHECK_NEAR(res.avg_layers, (2 + 2 + 12) / 3.f, 1e-5);
+  EarlyExitConfig config;
+  config.criterion = kExitMaxProb;
+  config.threshold = res.threshold;
+  CHECK((early_exit_heads(head_logits, 3, 2, config) ==
+         std::vector<int>{0, 0, 1}));
+
+  // tolerating the error of sample 2, all exit at head 0
+  res = calibrate_early_exit(head_logits, head_layers, labels, 2,
+                             kExitEntropy, 0.34f);
+  CHECK_NEAR(res.avg_layers, 2.f, 1e-6);
+  CHECK_NEAR(res.accuracy, 2 / 3.f, 1e-6);
+
+  CHECK_THROW(calibrate_early_exit(head_logits, {2}, labels, 2, kExitMaxProb,
+                                   0.f));
+  CHECK_THROW(calibrate_early_exit(head_logits, head_layers, {0, 1}, 2,
+                                   kExitMaxProb, 0.f));
+}
+
+int main() {
+  RUN_TEST(test_criterion);
+  RUN_TEST(test_config);
+  RUN_TEST(test_compaction_matches_reference);
+  RUN_TEST(test_calibrate);
+  return 0;
+}
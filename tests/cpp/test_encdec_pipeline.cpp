@@ -0,0 +1,106 @@
+#include <algorithm>
+
+#include "lightseq/inference/model/encdec_pipeline.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+// Stub model on two simulated streams: a stream runs its work in issue
+// order, an event is the end time of the work it is recorded after, and the
+// host blocks until a decode is finished
+struct StubModel {
+  double enc_ms;
+  double dec_ms;
+  double host = 0;
+  double enc_stream = 0;
+  double dec_stream = 0;
+  std::vector<double> slot_encoded;
+  std::vector<double> slot_free;
+  std::vector<int> slot_batch;  // batch held by a slot, -1 if free
+  std::vector<int> decoded;
+
+  StubModel(int depth, double enc, double dec)
+      : enc_ms(enc),
+        dec_ms(dec),
+        slot_encoded(depth, 0),
+        slot_free(depth, 0),
+        slot_batch(depth, -1) {}
+
+  void encode(int batch, int slot) {
+    CHECK_EQ(slot_batch[slot], -1);  // the decoder is done with the slot
+    slot_batch[slot] = batch;
+    double start = std::max({host, enc_stream, slot_free[slot]});
+    enc_stream = start + enc_ms;
+    slot_encoded[slot] = enc_stream;
+  }
+
+  void decode(int batch, int slot) {
+    CHECK_EQ(slot_batch[slot], batch);
+    double start = std::max({host, dec_stream, slot_encoded[slot]});
+    dec_stream = start + dec_ms;
+    slot_free[slot] = dec_stream;
+    slot_batch[slot] = -1;
+    host = dec_stream;
+    decoded.push_back(batch);
+  }
+
+  double run(const EncDecPipeline &pipeline, int num_batches) {
+    pipeline.run(
+        num_batches, [this](int b, int s) { encode(b, s); },
+        [this](int b, int s) { decode(b, s); });
+    return host;
+  }
+};
+
+void test_schedule() {
+  EncDecPipeline pipeline(2);
+  std::vector<PipelineStep> steps = pipeline.schedule(3);
+  // e0 e1 d0 e2 d1 d2
+  CHECK_EQ(steps.size(), 6u);
+  int expect[][3] = {{1, 0, 0}, {1, 1, 1}, {0, 0, 0},
+                     {1, 2, 0}, {0, 1, 1}, {0, 2, 0}};
+  for (int i = 0; i < 6; i++) {
+    CHECK_EQ(steps[i].encode, expect[i][0] == 1);
+    CHECK_EQ(steps[i].batch, expect[i][1]);
+    CHECK_EQ(steps[i].slot, expect[i][2]);
+  }
+  CHECK(pipeline.schedule(0).empty());
+  CHECK_THROW(EncDecPipeline(0));
+}
+
+void test_serial_depth() {
+  EncDecPipeline pipeline(1);
+  std::vector<PipelineStep> steps = pipeline.schedule(3);
+  for (int i = 0; i < 6; i++) {
+    CHECK_EQ(steps[i].encode, i % 2 == 0);
+    CHECK_EQ(steps[i].batch, i / 2);
+  }
+  StubModel model(1, 2, 10);
+  CHECK_NEAR(model.run(pipeline, 4), 4 * 12.0, 1e-9);
+}
+
+void test_overlap() {
+  for (int depth = 2; depth <= 4; depth++) {
+    for (int num_batches = 1; num_batches <= 9; num_batches++) {
+      EncDecPipeline pipeline(depth);
+      // decoder bound: only the first encoder is exposed
+      StubModel model(depth, 2, 10);
+      CHECK_NEAR(model.run(pipeline, num_batches), 2 + 10.0 * num_batches,
+                 1e-9);
+      CHECK_EQ(model.decoded.size(), (size_t)num_batches);
+      for (int i = 0; i < num_batches; i++) CHECK_EQ(model.decoded[i], i);
+      for (int s = 0; s < depth; s++) CHECK_EQ(model.slot_batch[s], -1);
+    }
+  }
+  // encoder bound: the decoder waits the encoder
+  EncDecPipeline pipeline(2);
+  StubModel model(2, 10, 2);
+  CHECK_NEAR(model.run(pipeline, 5), 5 * 10.0 + 2, 1e-9);
+}
+
+int main() {
+  RUN_TEST(test_schedule);
+  RUN_TEST(test_serial_depth);
+  RUN_TEST(test_overlap);
+  return 0;
+}
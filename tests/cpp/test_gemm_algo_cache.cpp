@@ -0,0 +1,229 @@
+#include "lightseq/inference/tools/gemm_algo_cache.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+GemmAlgo make_algo(int id, float time_ms) {
+  GemmAlgo algo;
+  algo.algo = id;
+  algo.time_ms = time_ms;
+  return algo;
+}
+
+void test_exact_find() {
+  GemmAlgoCache cache;
+  GemmKey key = {"f16f16f16", "TN", 128, 1024, 1024, 1};
+  GemmAlgo algo;
+  CHECK(!cache.find(key, &algo));
+  cache.insert(key, make_algo(101, 0.5f));
+  CHECK(cache.find(key, &algo));
+  CHECK_EQ(algo.algo, 101);
+  CHECK(!algo.is_lt());
+  GemmKey other = key;
+  other.m = 64;
+  CHECK(!cache.find(other, &algo));
+  CHECK_EQ(key.str(), std::string("f16f16f16/TN/128x1024x1024"));
+}
+
+// the qkv gemm of the encoder, hidden 1024: (hidden * 3, tokens, hidden)
+GemmKey qkv_gemm(int tokens) {
+  return {"f16f16f16", "NN", 3072, tokens, 1024, 1};
+}
+
+void test_nearest_tokens_fallback() {
+  GemmAlgoCache cache;
+  cache.insert(qkv_gemm(64), make_algo(1, 1));
+  cache.insert(qkv_gemm(256), make_algo(2, 1));
+  // the output projection, (hidden, tokens, hidden)
+  cache.insert({"f16f16f16", "NN", 1024, 100, 1024, 1}, make_algo(3, 1));
+  GemmAlgo algo;
+  // the next larger token count is preferred
+  CHECK(cache.lookup(qkv_gemm(65), &algo));
+  CHECK_EQ(algo.algo, 2);
+  CHECK(cache.lookup(qkv_gemm(8), &algo));
+  CHECK_EQ(algo.algo, 1);
+  // then the previous one
+  CHECK(cache.lookup(qkv_gemm(1000), &algo));
+  CHECK_EQ(algo.algo, 2);
+  CHECK(cache.lookup(qkv_gemm(64), &algo));
+  CHECK_EQ(algo.algo, 1);
+  CHECK(cache.lookup({"f16f16f16", "NN", 1024, 7, 1024, 1}, &algo));
+  CHECK_EQ(algo.algo, 3);
+  // never across the model dims, batch, dtype or layout
+  CHECK(!cache.lookup({"f16f16f16", "NN", 4096, 64, 1024, 1}, &algo));
+  CHECK(!cache.lookup({"f16f16f16", "NN", 3072, 64, 512, 1}, &algo));
+  CHECK(!cache.lookup({"f16f16f16", "NN", 3072, 64, 1024, 8}, &algo));
+  CHECK(!cache.lookup({"f32f32f32", "NN", 3072, 64, 1024, 1}, &algo));
+  CHECK(!cache.lookup({"f16f16f16", "TN", 3072, 64, 1024, 1}, &algo));
+}
+
+void test_col32_tokens_in_m() {
+  // the int8 qkv gemm of the COL32 orders, (tokens, hidden * 3, hidden)
+  GemmAlgoCache cache;
+  cache.insert({"i8i8i32", "col32_col4_4r2_8c", 128, 3072, 1024, 1},
+               make_algo(4, 1));
+  GemmAlgo algo;
+  CHECK(cache.lookup({"i8i8i32", "col32_col4_4r2_8c", 40, 3072, 1024, 1},
+                     &algo));
+  CHECK_EQ(algo.algo, 4);
+  CHECK(!cache.lookup({"i8i8i32", "col32_col4_4r2_8c", 128, 1024, 1024, 1},
+                      &algo));
+}
+
+void test_insert_keeps_faster() {
+  GemmAlgoCache cache;
+  GemmKey key = {"f32f32f32", "NN", 32, 32, 32, 4};
+  cache.insert(key, make_algo(5, 2.0f));
+  cache.insert(key, make_algo(6, 3.0f));
+  GemmAlgo algo;
+  CHECK(cache.find(key, &algo));
+  CHECK_EQ(algo.algo, 5);
+  cache.insert(key, make_algo(7, 1.0f));
+  CHECK(cache.find(key, &algo));
+  CHECK_EQ(algo.algo, 7);
+  CHECK_EQ(cache.size(), (size_t)1);
+}
+
+void test_serialize_round_trip() {
+  GemmAlgoCache cache;
+  cache.set_device("NVIDIA A100 sm80");
+  cache.insert({"f16f16f16", "TN", 128, 1024, 1024, 1}, make_algo(103, 0.25f));
+  GemmAlgo lt = make_algo(21, 0.125f);
+  lt.tile = 15;
+  lt.split_k = 2;
+  lt.reduction = 1;
+  lt.swizzle = 0;
+  lt.stages = 8;
+  lt.workspace = 1 << 20;
+  cache.insert({"i8i8i32", "col32_col4_4r2_8c", 512, 768, 3072, 1}, lt);
+  std::string text = cache.serialize();
+  CHECK_EQ(text.find(GemmAlgoCache::kHeader), (size_t)0);
+  CHECK(text.find("device NVIDIA_A100_sm80\n") != std::string::npos);
+
+  GemmAlgoCache loaded;
+  loaded.set_device("NVIDIA A100 sm80");
+  CHECK_EQ(loaded.deserialize(text), std::string(""));
+  CHECK_EQ(loaded.size(), (size_t)2);
+  GemmAlgo algo;
+  CHECK(loaded.find({"i8i8i32", "col32_col4_4r2_8c", 512, 768, 3072, 1},
+                    &algo));
+  CHECK(algo.is_lt());
+  CHECK_EQ(algo.algo, 21);
+  CHECK_EQ(algo.tile, 15);
+  CHECK_EQ(algo.split_k, 2);
+  CHECK_EQ(algo.reduction, 1);
+  CHECK_EQ(algo.swizzle, 0);
+  CHECK_EQ(algo.stages, 8);
+  CHECK_EQ(algo.workspace, (int64_t)(1 << 20));
+  CHECK_NEAR(algo.time_ms, 0.125f, 1e-6);
+  CHECK(loaded.find({"f16f16f16", "TN", 128, 1024, 1024, 1}, &algo));
+  CHECK_EQ(algo.algo, 103);
+  CHECK_EQ(loaded.serialize(), text);
+}
+
+void test_deserialize_errors() {
+  GemmAlgoCache src;
+  src.set_device("T4_sm75");
+  src.insert({"f16f16f16", "TN", 1, 2, 3, 1}, make_algo(99, 1));
+  std::string text = src.serialize();
+
+  GemmAlgoCache cache;
+  CHECK(!cache.deserialize("lightseq gemm cache v0\n").empty());
+  CHECK(!cache.deserialize(std::string(GemmAlgoCache::kHeader) + "\n").empty());
+  std::string bad_entry = text + "f16f16f16 TN 1 2 three 1 99\n";
+  std::string err = cache.deserialize(bad_entry);
+  CHECK(err.find("line 4") != std::string::npos);
+  // nothing is merged from a bad file
+  CHECK_EQ(cache.size(), (size_t)0);
+
+  cache.set_device("A100_sm80");
+  err = cache.deserialize(text);
+  CHECK(err.find("tuned on T4_sm75, running on A100_sm80") !=
+        std::string::npos);
+  CHECK_EQ(cache.size(), (size_t)0);
+
+  cache.set_device("T4 sm75");
+  CHECK_EQ(cache.deserialize(text + "\n# comment\n"), std::string(""));
+  CHECK_EQ(cache.size(), (size_t)1);
+}
+
+void test_save_load() {
+  std::string path = "/tmp/lightseq_test_gemm_algo_cache.txt";
+  GemmAlgoCache cache;
+  cache.set_device("dev");
+  CHECK(!cache.dirty());
+  cache.insert({"f16f16f16", "NN", 16, 16, 16, 12}, make_algo(100, 1));
+  CHECK(cache.dirty());
+  CHECK_EQ(cache.save(path), std::string(""));
+  CHECK(!cache.dirty());
+
+  GemmAlgoCache loaded;
+  loaded.set_device("dev");
+  CHECK_EQ(loaded.load(path), std::string(""));
+  CHECK(!loaded.dirty());
+  CHECK_EQ(loaded.size(), (size_t)1);
+  remove(path.c_str());
+  CHECK(!loaded.load(path).empty());
+  loaded.clear();
+  CHECK_EQ(loaded.size(), (size_t)0);
+}
+
+void test_select_fastest() {
+  std::vector<GemmAlgo> candidates;
+  for (int i = 0; i < 4; i++) candidates.push_back(make_algo(100 + i, 0));
+  // candidate 1 is unsupported, candidate 2 is the fastest
+  float times[] = {3.0f, -1.0f, 1.0f, 2.0f};
+  std::vector<int> calls(4, 0);
+  GemmAlgo best = select_fastest_algo(
+      candidates,
+      [&](int c) {
+        calls[c]++;
+        return times[c];
+      },
+      2, 5);
+  CHECK_EQ(best.algo, 102);
+  CHECK_NEAR(best.time_ms, 1.0f, 1e-6);
+  CHECK_EQ(calls[0], 7);
+  // an unsupported candidate stops at its first call
+  CHECK_EQ(calls[1], 1);
+
+  best = select_fastest_algo(
+      candidates, [](int) { return -1.0f; }, 1, 3);
+  CHECK_EQ(best.algo, -1);
+  CHECK(best.time_ms == std::numeric_limits<float>::max());
+}
+
+void test_tune_config_from_env() {
+  unsetenv("LS_GEMM_ALGO_CACHE");
+  unsetenv("LS_GEMM_TUNE");
+  unsetenv("LS_GEMM_EPILOGUE");
+  GemmTuneConfig config = GemmTuneConfig::from_env();
+  CHECK(config.cache_path.empty());
+  CHECK(!config.tune);
+  CHECK(config.epilogue);
+  setenv("LS_GEMM_ALGO_CACHE", "/tmp/algo.txt", 1);
+  setenv("LS_GEMM_TUNE", "1", 1);
+  config = GemmTuneConfig::from_env();
+  CHECK_EQ(config.cache_path, std::string("/tmp/algo.txt"));
+  CHECK(config.tune);
+  setenv("LS_GEMM_TUNE", "0", 1);
+  CHECK(!GemmTuneConfig::from_env().tune);
+  setenv("LS_GEMM_EPILOGUE", "0", 1);
+  CHECK(!GemmTuneConfig::from_env().epilogue);
+  unsetenv("LS_GEMM_ALGO_CACHE");
+  unsetenv("LS_GEMM_TUNE");
+  unsetenv("LS_GEMM_EPILOGUE");
+}
+
+int main() {
+  RUN_TEST(test_exact_find);
+  RUN_TEST(test_nearest_tokens_fallback);
+  RUN_TEST(test_col32_tokens_in_m);
+  RUN_TEST(test_insert_keeps_faster);
+  RUN_TEST(test_serialize_round_trip);
+  RUN_TEST(test_deserialize_errors);
+  RUN_TEST(test_save_load);
+  RUN_TEST(test_select_fastest);
+  RUN_TEST(test_tune_config_from_env);
+  return 0;
+}
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "lightseq/inference/tools/int8_weight_cache.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+std::vector<int8_t> kernel(int size, int seed) {
+  std::vector<int8_t> res(size);
+  for (int i = 0; i < size; i++) {
+    res[i] = (int8_t)((i * 31 + seed) % 255 - 127);
+  }
+  return res;
+}
+
+void test_round_trip() {
+  Int8WeightCache cache("unused", "quant_encoder 1 sm80 cublasLt11");
+  CHECK(cache.next(4, 8, 2) == nullptr);
+  cache.add(4, 8, 2, kernel(32, 1));
+  cache.add(8, 2, 0, kernel(16, 2));
+  CHECK(cache.dirty());
+
+  Int8WeightCache loaded("unused", "quant_encoder 1 sm80 cublasLt11");
+  CHECK_EQ(loaded.deserialize(cache.serialize()), std::string(""));
+  CHECK_EQ(loaded.size(), 2u);
+  const std::vector<int8_t> *e = loaded.next(4, 8, 2);
+  CHECK(e != nullptr && *e == kernel(32, 1));
+  e = loaded.next(8, 2, 0);
+  CHECK(e != nullptr && *e == kernel(16, 2));
+  CHECK(loaded.next(8, 2, 0) == nullptr);
+  CHECK_EQ(loaded.num_hits(), 2);
+  CHECK(!loaded.dirty());
+}
+
+void test_mismatch() {
+  Int8WeightCache cache("unused", "key");
+  cache.add(4, 8, 2, kernel(32, 1));
+  cache.add(8, 2, 0, kernel(16, 2));
+  cache.add(2, 2, 0, kernel(4, 3));
+  std::string bytes = cache.serialize();
+
+  // built for another device
+  Int8WeightCache other("unused", "key2");
+  CHECK(!other.deserialize(bytes).empty());
+  CHECK(!other.deserialize(bytes.substr(0, bytes.size() - 1)).empty());
+  CHECK(!other.deserialize("LSI9").empty());
+
+  // a kernel of another layout is transformed again, the rest is dropped
+  Int8WeightCache loaded("unused", "key");
+  CHECK(loaded.deserialize(bytes).empty());
+  CHECK(loaded.next(4, 8, 2) != nullptr);
+  CHECK(loaded.next(8, 2, 1) == nullptr);
+  loaded.add(8, 2, 1, kernel(16, 4));
+  CHECK(loaded.dirty());
+  CHECK_EQ(loaded.size(), 2u);
+  CHECK(loaded.next(2, 2, 0) == nullptr);
+}
+
+void test_save_load() {
+  char dir[] = "/tmp/ls_int8_cacheXXXXXX";
+  CHECK(mkdtemp(dir) != nullptr);
+  setenv("LS_INT8_WEIGHT_CACHE", dir, 1);
+  std::string path = int8_weight_cache_path("quant_decoder", 0xabc, 75);
+  CHECK_EQ(path,
+           std::string(dir) + "/quant_decoder_0000000000000abc_sm75.lsi8");
+  unsetenv("LS_INT8_WEIGHT_CACHE");
+  CHECK_EQ(int8_weight_cache_path("quant_decoder", 0xabc, 75), std::string(""));
+
+  Int8WeightCache cache(path, "key");
+  CHECK(!cache.load().empty());
+  cache.add(4, 8, 2, kernel(32, 1));
+  CHECK_EQ(cache.save(), std::string(""));
+  CHECK(!cache.dirty());
+  Int8WeightCache loaded(path, "key");
+  CHECK_EQ(loaded.load(), std::string(""));
+  CHECK(loaded.next(4, 8, 2) != nullptr);
+  remove(path.c_str());
+  rmdir(dir);
+}
+
+void test_bytes_hash() {
+  std::vector<int8_t> a = kernel(37, 1), b = a;
+  CHECK_EQ(bytes_hash(a), bytes_hash(b));
+  b[36] ^= 1;
+  CHECK(bytes_hash(a) != bytes_hash(b));
+  // chained over several tensors, the split point matters
+  std::vector<int8_t> head(a.begin(), a.begin() + 8);
+  std::vector<int8_t> tail(a.begin() + 8, a.end());
+  std::vector<int8_t> head2(a.begin(), a.begin() + 16);
+  std::vector<int8_t> tail2(a.begin() + 16, a.end());
+  CHECK(bytes_hash(tail, bytes_hash(head)) !=
+        bytes_hash(tail2, bytes_hash(head2)));
+}
+
+int main() {
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_mismatch);
+  RUN_TEST(test_save_load);
+  RUN_TEST(test_bytes_hash);
+  return 0;
+}
@@ -0,0 +1,99 @@
+#include "lightseq/csrc/layers/includes/kv_cache_layout.h"
+#include "tests/cpp/test_util.h"
+
+void test_capacity_grows_in_chunks() {
+  KVCacheLayout layout(2, 4, 100, 32);
+  CHECK_EQ(layout.capacity_for(1), 32);
+  CHECK_EQ(layout.capacity_for(32), 32);
+  CHECK_EQ(layout.capacity_for(33), 64);
+  // the last chunk is clamped to max_seq_len
+  CHECK_EQ(layout.capacity_for(97), 100);
+  CHECK_EQ(layout.capacity_for(100), 100);
+  CHECK_THROW(layout.capacity_for(101));
+  CHECK_THROW(KVCacheLayout(2, 4, 100, 0));
+}
+
+void test_need_realloc() {
+  KVCacheLayout layout(2, 4, 100, 8);
+  CHECK(layout.need_realloc(1, 1));
+  layout.max_batch_beams = 6;
+  layout.capacity = 8;
+  CHECK(!layout.need_realloc(6, 8));
+  // beam search shrinking the batch reuses the allocation
+  CHECK(!layout.need_realloc(3, 5));
+  CHECK(layout.need_realloc(7, 1));
+  CHECK(layout.need_realloc(6, 9));
+}
+
+void test_offset_and_usage() {
+  KVCacheLayout layout(3, 4, 64, 16);
+  layout.max_batch_beams = 2;
+  layout.batch_beams = 2;
+  layout.capacity = 16;
+  layout.length = 5;
+  CHECK_EQ(layout.row_stride(), (size_t)64);
+  CHECK_EQ(layout.offset(0, 0, 0, 0), (size_t)0);
+  CHECK_EQ(layout.offset(0, 0, 1, 0), (size_t)4);
+  CHECK_EQ(layout.offset(0, 1, 0, 0), (size_t)64);
+  CHECK_EQ(layout.offset(1, 2, 3, 1), (size_t)(5 * 64 + 3 * 4 + 1));
+  CHECK_EQ(layout.allocated_elements(), (size_t)(2 * 3 * 16 * 4));
+  CHECK_EQ(layout.used_elements(), (size_t)(2 * 3 * 5 * 4));
+}
+
+void test_reorder() {
+  KVCacheLayout layout(2, 2, 16, 4);
+  layout.max_batch_beams = 3;
+  layout.batch_beams = 3;
+  layout.capacity = 4;
+  layout.length = 3;
+  std::vector<float> src(layout.allocated_elements(), -1.f);
+  for (int b = 0; b < 3; b++) {
+    for (int h = 0; h < 2; h++) {
+      for (int s = 0; s < layout.length; s++) {
+        for (int d = 0; d < 2; d++) {
+          src[layout.offset(b, h, s, d)] = b * 1000 + h * 100 + s * 10 + d;
+        }
+      }
+    }
+  }
+  std::vector<float> dst(layout.allocated_elements(), -2.f);
+  kv_cache_reorder_cpu(dst.data(), src.data(), {2, 0, 0}, layout);
+  const int order[3] = {2, 0, 0};
+  for (int b = 0; b < 3; b++) {
+    for (int h = 0; h < 2; h++) {
+      for (int s = 0; s < layout.capacity; s++) {
+        for (int d = 0; d < 2; d++) {
+          float expected =
+              s < layout.length ? order[b] * 1000 + h * 100 + s * 10 + d : -2.f;
+          CHECK_EQ(dst[layout.offset(b, h, s, d)], expected);
+        }
+      }
+    }
+  }
+}
+
+void test_reorder_shrinking_batch() {
+  KVCacheLayout layout(1, 2, 16, 4);
+  layout.max_batch_beams = 4;
+  layout.batch_beams = 4;
+  layout.capacity = 4;
+  layout.length = 2;
+  std::vector<int> src(layout.allocated_elements());
+  for (size_t i = 0; i < src.size(); i++) src[i] = i;
+  std::vector<int> dst(layout.allocated_elements(), 0);
+  kv_cache_reorder_cpu(dst.data(), src.data(), {3, 1}, layout);
+  CHECK_EQ(dst[layout.offset(0, 0, 1, 1)], src[layout.offset(3, 0, 1, 1)]);
+  CHECK_EQ(dst[layout.offset(1, 0, 0, 0)], src[layout.offset(1, 0, 0, 0)]);
+  CHECK_EQ(dst[layout.offset(2, 0, 0, 0)], 0);
+  CHECK_THROW(kv_cache_reorder_cpu(dst.data(), src.data(), {4}, layout));
+  CHECK_THROW(kv_cache_reorder_cpu(dst.data(), src.data(), {-1}, layout));
+}
+
+int main() {
+  RUN_TEST(test_capacity_grows_in_chunks);
+  RUN_TEST(test_need_realloc);
+  RUN_TEST(test_offset_and_usage);
+  RUN_TEST(test_reorder);
+  RUN_TEST(test_reorder_shrinking_batch);
+  return 0;
+}
@@ -0,0 +1,89 @@
+#include "lightseq/inference/tools/lexical_shortlist.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+const char *kText =
+    "# lightseq lexical shortlist v1\n"
+    "vocab 4 40\n"
+    "always 0 1\n"
+    "# comment\n"
+    "0 10 11 12\n"
+    "2 30 12\n"
+    "\n"
+    "always 2\n";
+
+void test_deserialize() {
+  LexicalShortlist shortlist;
+  CHECK_EQ(shortlist.deserialize(kText), "");
+  CHECK_EQ(shortlist.src_vocab_size(), 4);
+  CHECK_EQ(shortlist.trg_vocab_size(), 40);
+  CHECK((shortlist.always_ids() == std::vector<int>{0, 1, 2}));
+  CHECK((shortlist.candidates(0) == std::vector<int>{10, 11, 12}));
+  CHECK(shortlist.candidates(1).empty());
+  CHECK((shortlist.candidates(2) == std::vector<int>{30, 12}));
+}
+
+void test_deserialize_errors() {
+  LexicalShortlist shortlist;
+  CHECK(shortlist.deserialize("vocab 4 40\n") != "");
+  CHECK(shortlist.deserialize("# lightseq lexical shortlist v1\n") != "");
+  std::string header = "# lightseq lexical shortlist v1\nvocab 4 40\n";
+  CHECK(shortlist.deserialize(header + "4 1\n") != "");
+  CHECK(shortlist.deserialize(header + "0 40\n") != "");
+  CHECK(shortlist.deserialize(header + "0 1 x\n") != "");
+  CHECK(shortlist.deserialize(header + "always -1\n") != "");
+  // a failed parse keeps the loaded shortlist
+  CHECK_EQ(shortlist.deserialize(kText), "");
+  CHECK(shortlist.deserialize(header + "0 40\n") != "");
+  CHECK_EQ(shortlist.trg_vocab_size(), 40);
+  CHECK_EQ(shortlist.candidates(0).size(), 3u);
+  CHECK(shortlist.load("/nonexistent/shortlist.txt") != "");
+}
+
+void test_build() {
+  LexicalShortlist shortlist;
+  CHECK_EQ(shortlist.deserialize(kText), "");
+  // token 3 has no candidate, 4 is out of the source vocab
+  int tokens[] = {2, 3, 0, 4};
+  std::vector<int> ids = shortlist.build(tokens, 4, 0, {39});
+  // {0, 1, 2, 10, 11, 12, 30, 39} is already aligned
+  CHECK((ids == std::vector<int>{0, 1, 2, 10, 11, 12, 30, 39}));
+  CHECK_EQ(check_vocab_shortlist(ids, 40, 39), "");
+
+  // top 1 of each token: {0, 1, 2, 10, 30} padded with 3, 4, 5
+  ids = shortlist.build(tokens, 4, 1);
+  CHECK((ids == std::vector<int>{0, 1, 2, 3, 4, 5, 10, 30}));
+  ids = shortlist.build(tokens, 0, 1);
+  CHECK_EQ(ids.size(), 8u);
+}
+
+void test_build_small_vocab() {
+  LexicalShortlist shortlist;
+  CHECK_EQ(shortlist.deserialize("# lightseq lexical shortlist v1\n"
+                                 "vocab 2 5\n"
+                                 "0 4\n"),
+           "");
+  int tokens[] = {0};
+  // the padding stops at the target vocab size
+  CHECK((shortlist.build(tokens, 1, 0) == std::vector<int>{0, 1, 2, 3, 4}));
+}
+
+void test_check() {
+  CHECK_EQ(check_vocab_shortlist({1, 3, 5}, 6, 3), "");
+  CHECK(check_vocab_shortlist({}, 6, 3) != "");
+  CHECK(check_vocab_shortlist({1, 5}, 6, 3) != "");
+  CHECK(check_vocab_shortlist({3, 1}, 6, 3) != "");
+  CHECK(check_vocab_shortlist({3, 3}, 6, 3) != "");
+  CHECK(check_vocab_shortlist({3, 6}, 6, 3) != "");
+  CHECK(check_vocab_shortlist({-1, 3}, 6, 3) != "");
+}
+
+int main() {
+  RUN_TEST(test_deserialize);
+  RUN_TEST(test_deserialize_errors);
+  RUN_TEST(test_build);
+  RUN_TEST(test_build_small_vocab);
+  RUN_TEST(test_check);
+  return 0;
+}
@@ -0,0 +1,259 @@
+#include <random>
+
+#include "lightseq/inference/kernels/logits_processor.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+const int kEos = 1;
+
+std::vector<float> process(const LogitsProcessorConfig &config,
+                           std::vector<float> logits,
+                           const std::vector<int> &seq, int generated_len,
+                           int pad_id = -1) {
+  process_logits_cpu(config, logits.data(), nullptr, logits.size(), seq.data(),
+                     seq.size(), generated_len, kEos, pad_id);
+  return logits;
+}
+
+void test_check() {
+  LogitsProcessorConfig config;
+  CHECK(!config.enabled());
+  CHECK_EQ(config.check(10), "");
+  config.temperature = 0.f;
+  CHECK(config.check(10) != "");
+  config = LogitsProcessorConfig();
+  config.top_p = 0.f;
+  CHECK(config.check(10) != "");
+  config = LogitsProcessorConfig();
+  config.min_length = 5;
+  config.max_length = 5;
+  CHECK(config.check(10) != "");
+  config = LogitsProcessorConfig();
+  config.bad_words = {{3, 10}};
+  CHECK(config.enabled());
+  CHECK(config.check(10) != "");
+  config.bad_words = {{}};
+  CHECK(config.check(10) != "");
+  config.bad_words = {{3, 9}};
+  CHECK_EQ(config.check(10), "");
+  CHECK(!config.samples());
+}
+
+// the processors that make the decoding random, see ResultCache
+void test_samples() {
+  LogitsProcessorConfig config;
+  config.repetition_penalty = 1.2f;
+  config.no_repeat_ngram_size = 3;
+  config.min_length = 2;
+  CHECK(!config.samples());
+  config.temperature = 0.7f;
+  CHECK(config.samples());
+  config = LogitsProcessorConfig();
+  config.top_k = 4;
+  CHECK(config.samples());
+  config = LogitsProcessorConfig();
+  config.top_p = 0.9f;
+  CHECK(config.samples());
+}
+
+void test_flat_bad_words() {
+  FlatBadWords flat({{4}, {1, 2, 3}, {7, 8}});
+  CHECK_EQ(flat.size(), 3);
+  CHECK((flat.offsets == std::vector<int>{0, 1, 4, 6}));
+  CHECK((flat.tokens == std::vector<int>{4, 1, 2, 3, 7, 8}));
+  CHECK_EQ(FlatBadWords({}).size(), 0);
+}
+
+void test_bias_and_temperature() {
+  LogitsProcessorConfig config;
+  config.temperature = 2.f;
+  std::vector<float> logits = {1.f, 2.f, -4.f};
+  std::vector<float> bias = {1.f, 0.f, 0.f};
+  std::vector<int> seq = {0};
+  process_logits_cpu(config, logits.data(), bias.data(), 3, seq.data(), 1, 1,
+                     kEos);
+  CHECK_NEAR(logits[0], 1.f, 1e-6);
+  CHECK_NEAR(logits[1], 1.f, 1e-6);
+  CHECK_NEAR(logits[2], -2.f, 1e-6);
+}
+
+void test_repetition_penalty() {
+  LogitsProcessorConfig config;
+  config.repetition_penalty = 2.f;
+  // token 2 is repeated and penalized once, pad 4 is not penalized
+  std::vector<float> out =
+      process(config, {1.f, 1.f, 4.f, -3.f, 2.f}, {4, 2, 3, 2, 4}, 3, 4);
+  CHECK_NEAR(out[0], 1.f, 1e-6);
+  CHECK_NEAR(out[2], 2.f, 1e-6);
+  CHECK_NEAR(out[3], -6.f, 1e-6);
+  CHECK_NEAR(out[4], 2.f, 1e-6);
+}
+
+void test_no_repeat_ngram() {
+  LogitsProcessorConfig config;
+  config.no_repeat_ngram_size = 2;
+  // the sequence ends with 3, the bigrams (3, 5) and (3, 6) are banned
+  std::vector<float> out =
+      process(config, std::vector<float>(8, 0.f), {3, 5, 2, 3, 6, 3}, 6);
+  CHECK_EQ(out[5], kMaskedLogit);
+  CHECK_EQ(out[6], kMaskedLogit);
+  CHECK_EQ(out[2], 0.f);
+  CHECK_EQ(out[3], 0.f);
+  // trigrams: the sequence ends with (2, 3), only (2, 3, 6) is seen
+  config.no_repeat_ngram_size = 3;
+  out = process(config, std::vector<float>(8, 0.f), {2, 3, 6, 2, 3}, 5);
+  CHECK_EQ(out[6], kMaskedLogit);
+  int banned = 0;
+  for (float l : out) banned += l == kMaskedLogit;
+  CHECK_EQ(banned, 1);
+  // too short to complete a n-gram
+  config.no_repeat_ngram_size = 4;
+  out = process(config, std::vector<float>(8, 0.f), {2, 3, 2}, 3);
+  for (float l : out) CHECK_EQ(l, 0.f);
+}
+
+void test_bad_words() {
+  LogitsProcessorConfig config;
+  config.bad_words = {{4}, {2, 3, 7}, {6, 5}};
+  std::vector<float> out =
+      process(config, std::vector<float>(8, 0.f), {0, 2, 3}, 3);
+  CHECK_EQ(out[4], kMaskedLogit);
+  CHECK_EQ(out[7], kMaskedLogit);
+  CHECK_EQ(out[5], 0.f);
+  // the prefix is longer than the sequence
+  out = process(config, std::vector<float>(8, 0.f), {3}, 1);
+  CHECK_EQ(out[7], 0.f);
+  out = process(config, std::vector<float>(8, 0.f), {6}, 1);
+  CHECK_EQ(out[5], kMaskedLogit);
+}
+
+void test_min_max_length() {
+  LogitsProcessorConfig config;
+  config.min_length = 2;
+  config.max_length = 4;
+  std::vector<float> logits = {0.5f, 3.f, 1.f};
+  CHECK_EQ(process(config, logits, {0}, 1)[kEos], kMaskedLogit);
+  CHECK_EQ(process(config, logits, {0, 2}, 2)[kEos], 3.f);
+  // the 4th generated token is forced to eos
+  std::vector<float> out = process(config, logits, {0, 2, 2, 2}, 3);
+  CHECK_EQ(out[kEos], 0.f);
+  CHECK_EQ(out[0], kMaskedLogit);
+  CHECK_EQ(out[2], kMaskedLogit);
+}
+
+void test_top_k() {
+  LogitsProcessorConfig config;
+  config.top_k = 2;
+  std::vector<float> out = process(config, {1.f, 5.f, 3.f, 2.f}, {0}, 1);
+  CHECK_EQ(out[0], kMaskedLogit);
+  CHECK_EQ(out[1], 5.f);
+  CHECK_EQ(out[2], 3.f);
+  CHECK_EQ(out[3], kMaskedLogit);
+  // ties at the threshold are kept
+  out = process(config, {4.f, 5.f, 4.f, 2.f}, {0}, 1);
+  CHECK_EQ(out[0], 4.f);
+  CHECK_EQ(out[2], 4.f);
+  CHECK_EQ(out[3], kMaskedLogit);
+}
+
+void test_top_p() {
+  LogitsProcessorConfig config;
+  // probs 0.5, 0.25, 0.125, 0.125
+  std::vector<float> logits = {std::log(4.f), std::log(2.f), 0.f, 0.f};
+  config.top_p = 0.5f;
+  std::vector<float> out = process(config, logits, {0}, 1);
+  CHECK_NEAR(out[0], logits[0], 1e-6);
+  CHECK_EQ(out[1], kMaskedLogit);
+  config.top_p = 0.6f;
+  out = process(config, logits, {0}, 1);
+  CHECK_NEAR(out[1], logits[1], 1e-6);
+  CHECK_EQ(out[2], kMaskedLogit);
+  CHECK_EQ(out[3], kMaskedLogit);
+  // the threshold falls on the tie, both are kept
+  config.top_p = 0.8f;
+  out = process(config, logits, {0}, 1);
+  CHECK_EQ(out[2], 0.f);
+  CHECK_EQ(out[3], 0.f);
+}
+
+void test_ordered_float() {
+  std::vector<float> values = {-1e30f, -3.5f, -1e-20f, -0.f,
+                               0.f,    1e-20f, 2.f,    1e30f};
+  for (size_t i = 0; i < values.size(); i++) {
+    CHECK_EQ(ordered_to_float(float_to_ordered(values[i])), values[i]);
+    if (i > 0) {
+      CHECK(float_to_ordered(values[i - 1]) <= float_to_ordered(values[i]));
+    }
+  }
+  CHECK(float_to_ordered(kMaskedLogit) < float_to_ordered(-1.f));
+}
+
+void test_bisect_matches_reference() {
+  std::mt19937 gen(11);
+  std::uniform_real_distribution<float> dist(-6.f, 6.f);
+  for (int round = 0; round < 20; round++) {
+    int vocab = 50 + round * 7;
+    std::vector<float> logits(vocab);
+    for (float &l : logits) l = dist(gen);
+    // ties and masked logits, as left by the earlier processors
+    logits[3] = logits[5];
+    logits[7] = kMaskedLogit;
+
+    LogitsProcessorConfig config;
+    config.top_k = 1 + round * 3 % vocab;
+    std::vector<float> expect = process(config, logits, {0}, 1);
+    std::vector<float> out = logits;
+    top_k_filter_bisect(out.data(), vocab, config.top_k);
+    CHECK(out == expect);
+
+    config = LogitsProcessorConfig();
+    config.top_p = 0.05f + 0.045f * round;
+    expect = process(config, logits, {0}, 1);
+    out = logits;
+    top_p_filter_bisect(out.data(), vocab, config.top_p);
+    CHECK(out == expect);
+  }
+  // the bisection itself: the largest value that keeps
+  CHECK_EQ(bisect_ordered_threshold(0, 100, [](uint32_t t) { return t <= 37; }),
+           (uint32_t)37);
+  CHECK_EQ(bisect_ordered_threshold(5, 5, [](uint32_t t) { return true; }),
+           (uint32_t)5);
+}
+
+void test_multinomial_sample() {
+  std::vector<float> logits = {0.f, kMaskedLogit, 0.f, std::log(2.f)};
+  // probs 0.25, 0, 0.25, 0.5
+  CHECK_EQ(multinomial_sample_cpu(logits.data(), 4, 0.1f), 0);
+  CHECK_EQ(multinomial_sample_cpu(logits.data(), 4, 0.3f), 2);
+  CHECK_EQ(multinomial_sample_cpu(logits.data(), 4, 0.6f), 3);
+  CHECK_EQ(multinomial_sample_cpu(logits.data(), 4, 1.f), 3);
+  // the empirical distribution follows the probs
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<float> dist(0.f, 1.f);
+  std::vector<int> counts(4, 0);
+  int n = 20000;
+  for (int i = 0; i < n; i++) {
+    counts[multinomial_sample_cpu(logits.data(), 4, 1.f - dist(gen))]++;
+  }
+  CHECK_EQ(counts[1], 0);
+  CHECK_NEAR(counts[3] / (float)n, 0.5f, 0.02f);
+  CHECK_NEAR(counts[0] / (float)n, 0.25f, 0.02f);
+}
+
+int main() {
+  RUN_TEST(test_check);
+  RUN_TEST(test_samples);
+  RUN_TEST(test_flat_bad_words);
+  RUN_TEST(test_bias_and_temperature);
+  RUN_TEST(test_repetition_penalty);
+  RUN_TEST(test_no_repeat_ngram);
+  RUN_TEST(test_bad_words);
+  RUN_TEST(test_min_max_length);
+  RUN_TEST(test_top_k);
+  RUN_TEST(test_top_p);
+  RUN_TEST(test_ordered_float);
+  RUN_TEST(test_bisect_matches_reference);
+  RUN_TEST(test_multinomial_sample);
+  return 0;
+}
@@ -0,0 +1,280 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "lightseq/inference/pywrapper/model_pool.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+PoolMemory host_memory() {
+  PoolMemory m;
+  m.malloc = [](size_t bytes) { return ::malloc(bytes ? bytes : 1); };
+  m.free = [](void *ptr) { ::free(ptr); };
+  m.copy_to_device = [](void *dst, const void *src, size_t bytes, void *) {
+    memcpy(dst, src, bytes);
+  };
+  m.copy_to_host = [](void *dst, const void *src, size_t bytes, void *) {
+    memcpy(dst, src, bytes);
+  };
+  return m;
+}
+
+// blocks the infers while closed
+struct Gate {
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool open = true;
+
+  void set(bool value) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      open = value;
+    }
+    cv.notify_all();
+  }
+  void pass() {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this]() { return open; });
+  }
+};
+
+// tokens [batch, len] -> doubled [batch, len] and row sums [batch]
+class MockModel : public LSModel {
+ public:
+  MockModel(int max_batch, Gate *gate)
+      : LSModel({"token_ids"}, {"doubled", "row_sum"}),
+        max_batch_(max_batch),
+        gate_(gate) {}
+
+  void Infer() override {
+    const std::vector<int> &shape = input_shapes_[0];
+    if (input_[0] < 0) throw std::runtime_error("negative token");
+    CHECK(!busy_.exchange(true));
+    gate_->pass();
+    for (int b = 0; b < shape[0]; b++) {
+      int sum = 0;
+      for (int t = 0; t < shape[1]; t++) {
+        int v = input_[b * shape[1] + t];
+        doubled_[b * shape[1] + t] = 2 * v;
+        sum += v;
+      }
+      row_sum_[b] = sum;
+    }
+    set_output_shape(0, shape);
+    set_output_shape(1, {shape[0]});
+    max_seen_batch = std::max(max_seen_batch, shape[0]);
+    infers++;
+    busy_ = false;
+  }
+  void set_input_ptr(int index, void *ptr) override {
+    input_ = static_cast<int *>(ptr);
+  }
+  void set_output_ptr(int index, void *ptr) override {
+    if (index == 0) doubled_ = static_cast<int *>(ptr);
+    if (index == 1) row_sum_ = static_cast<int *>(ptr);
+  }
+  const void *get_output_ptr(int index) override {
+    return index == 0 ? (void *)doubled_ : (void *)row_sum_;
+  }
+  std::vector<int> get_input_max_shape(int index) override {
+    return {max_batch_, 16};
+  }
+  std::vector<int> get_output_max_shape(int index) override {
+    if (index == 0) return {max_batch_, 16};
+    return {max_batch_};
+  }
+  DataType get_input_dtype(int index) override { return kInt32; }
+  DataType get_output_dtype(int index) override { return kInt32; }
+
+  int max_seen_batch = 0;
+  int infers = 0;
+
+ private:
+  int max_batch_;
+  Gate *gate_;
+  std::atomic<bool> busy_{false};
+  int *input_ = nullptr;
+  int *doubled_ = nullptr;
+  int *row_sum_ = nullptr;
+};
+
+PoolTensor tokens(int batch, int len, int base) {
+  std::vector<int> values(batch * len);
+  for (size_t i = 0; i < values.size(); i++) values[i] = base + (int)i;
+  return PoolTensor::of<int>(kInt32, {batch, len}, values);
+}
+
+void check_outputs(const std::vector<PoolTensor> &out, int batch, int len,
+                   int base) {
+  CHECK_EQ(out.size(), 2u);
+  CHECK_EQ(out[0].shape, std::vector<int>({batch, len}));
+  CHECK_EQ(out[1].shape, std::vector<int>({batch}));
+  for (int i = 0; i < batch * len; i++) {
+    CHECK_EQ(out[0].as<int>()[i], 2 * (base + i));
+  }
+  for (int b = 0; b < batch; b++) {
+    int sum = 0;
+    for (int t = 0; t < len; t++) sum += base + b * len + t;
+    CHECK_EQ(out[1].as<int>()[b], sum);
+  }
+}
+
+void test_queue() {
+  MpmcQueue<int> q(3);
+  CHECK_EQ(q.capacity(), 4u);
+  int v;
+  CHECK(!q.try_pop(&v));
+  for (int i = 0; i < 4; i++) {
+    v = i;
+    CHECK(q.try_push(v));
+  }
+  v = 9;
+  CHECK(!q.try_push(v));
+  CHECK_EQ(v, 9);
+  CHECK_EQ(q.size_approx(), 4u);
+  for (int i = 0; i < 4; i++) {
+    CHECK(q.try_pop(&v));
+    CHECK_EQ(v, i);
+  }
+  CHECK(!q.try_pop(&v));
+}
+
+void test_queue_threads() {
+  const int kThreads = 4, kPerThread = 20000;
+  MpmcQueue<int> q(64);
+  std::atomic<long> sum{0};
+  std::atomic<int> popped{0};
+  std::vector<std::thread> threads;
+  for (int p = 0; p < kThreads; p++) {
+    threads.emplace_back([&q, p]() {
+      for (int i = 1; i <= kPerThread; i++) {
+        int v = p * kPerThread + i;
+        while (!q.try_push(v)) std::this_thread::yield();
+      }
+    });
+  }
+  for (int c = 0; c < kThreads; c++) {
+    threads.emplace_back([&]() {
+      int v;
+      while (popped < kThreads * kPerThread) {
+        if (q.try_pop(&v)) {
+          sum += v;
+          popped++;
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  long n = (long)kThreads * kPerThread;
+  CHECK_EQ(sum.load(), n * (n + 1) / 2);
+  CHECK_EQ(q.size_approx(), 0u);
+}
+
+void test_submit() {
+  Gate gate;
+  std::vector<MockModel *> models;
+  ModelPoolConfig config;
+  config.num_instances = 3;
+  {
+    ModelPool pool(
+        [&]() {
+          models.push_back(new MockModel(4, &gate));
+          return models.back();
+        },
+        config, host_memory());
+    CHECK_EQ(pool.num_instances(), 3);
+    std::vector<std::thread> callers;
+    for (int c = 0; c < 4; c++) {
+      callers.emplace_back([&pool, c]() {
+        for (int i = 0; i < 50; i++) {
+          int batch = 1 + i % 4, len = 1 + (i + c) % 16, base = c * 1000 + i;
+          auto res = pool.submit({tokens(batch, len, base)});
+          check_outputs(res.get(), batch, len, base);
+        }
+      });
+    }
+    for (auto &t : callers) t.join();
+    int infers = 0;
+    for (MockModel *m : models) infers += m->infers;
+    CHECK_EQ(infers, 200);
+  }
+}
+
+void test_errors() {
+  Gate gate;
+  ModelPoolConfig config;
+  config.queue_capacity = 2;
+  MockModel *model = nullptr;
+  ModelPool pool(
+      [&]() { return model = new MockModel(4, &gate); }, config,
+      host_memory());
+  // the request errors are set on the future
+  CHECK_THROW(pool.submit({}).get());
+  CHECK_THROW(pool.submit({tokens(5, 2, 0)}).get());
+  CHECK_THROW(pool.submit({tokens(1, 17, 0)}).get());
+  CHECK_THROW(pool.submit({tokens(1, 3, -1)}).get());
+  check_outputs(pool.submit({tokens(2, 3, 7)}).get(), 2, 3, 7);
+
+  // one request runs, two are queued, the next one does not fit
+  gate.set(false);
+  std::vector<std::future<std::vector<PoolTensor>>> res;
+  res.push_back(pool.submit({tokens(1, 2, 0)}));
+  while (pool.queued() > 0) std::this_thread::yield();
+  res.push_back(pool.submit({tokens(1, 2, 10)}));
+  res.push_back(pool.submit({tokens(1, 2, 20)}));
+  CHECK_THROW(pool.submit({tokens(1, 2, 30)}));
+  gate.set(true);
+  for (int i = 0; i < 3; i++) check_outputs(res[i].get(), 1, 2, i * 10);
+
+  CHECK_THROW(ModelPool([&]() { return new MockModel(4, &gate); },
+                        ModelPoolConfig{0, 16, false}, host_memory()));
+}
+
+void test_micro_batch() {
+  Gate gate;
+  ModelPoolConfig config;
+  config.micro_batch = true;
+  MockModel *model = nullptr;
+  {
+    ModelPool pool(
+        [&]() { return model = new MockModel(6, &gate); }, config,
+        host_memory());
+    gate.set(false);
+    std::vector<std::future<std::vector<PoolTensor>>> res;
+    res.push_back(pool.submit({tokens(1, 4, 0)}));
+    while (pool.queued() > 0) std::this_thread::yield();
+    // merged: 2 + 1 + 3 rows, the length 5 one and the bad one are not
+    res.push_back(pool.submit({tokens(2, 4, 100)}));
+    res.push_back(pool.submit({tokens(1, 4, 200)}));
+    res.push_back(pool.submit({tokens(1, 40, 0)}));
+    res.push_back(pool.submit({tokens(3, 4, 300)}));
+    res.push_back(pool.submit({tokens(1, 5, 400)}));
+    res.push_back(pool.submit({tokens(1, 4, 500)}));
+    gate.set(true);
+    check_outputs(res[0].get(), 1, 4, 0);
+    check_outputs(res[1].get(), 2, 4, 100);
+    check_outputs(res[2].get(), 1, 4, 200);
+    CHECK_THROW(res[3].get());
+    check_outputs(res[4].get(), 3, 4, 300);
+    check_outputs(res[5].get(), 1, 5, 400);
+    check_outputs(res[6].get(), 1, 4, 500);
+    CHECK_EQ(model->max_seen_batch, 6);
+    CHECK_EQ(model->infers, 4);
+  }
+}
+
+int main() {
+  RUN_TEST(test_queue);
+  RUN_TEST(test_queue_threads);
+  RUN_TEST(test_submit);
+  RUN_TEST(test_errors);
+  RUN_TEST(test_micro_batch);
+  return 0;
+}
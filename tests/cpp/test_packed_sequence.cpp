@@ -0,0 +1,76 @@
+#include "lightseq/csrc/layers/includes/packed_sequence.h"
+#include "tests/cpp/test_util.h"
+
+void test_segment_ids() {
+  // row 0: samples of len 2 and 3, 1 pad; row 1: one sample of len 6
+  std::vector<std::vector<int>> cu_seqlens = {{0, 2, 5}, {0, 6}};
+  std::vector<int> seg_ids = get_packed_segment_ids(cu_seqlens, 2, 6);
+  std::vector<int> expected = {0, 0, 1, 1, 1, -1, 0, 0, 0, 0, 0, 0};
+  CHECK(seg_ids == expected);
+}
+
+void test_segment_ids_empty_row() {
+  // a row without any sample is all padding
+  std::vector<std::vector<int>> cu_seqlens = {{0, 1, 2, 4}, {0}};
+  std::vector<int> seg_ids = get_packed_segment_ids(cu_seqlens, 2, 4);
+  std::vector<int> expected = {0, 1, 2, 2, -1, -1, -1, -1};
+  CHECK(seg_ids == expected);
+}
+
+void test_position_ids() {
+  std::vector<std::vector<int>> cu_seqlens = {{0, 2, 5}, {0, 6}};
+  std::vector<int> pos_ids = get_packed_position_ids(cu_seqlens, 2, 6);
+  std::vector<int> expected = {0, 1, 0, 1, 2, 0, 0, 1, 2, 3, 4, 5};
+  CHECK(pos_ids == expected);
+  CHECK_EQ(get_packed_max_sample_len(cu_seqlens), 6);
+}
+
+void test_dense_batch_is_one_sample_per_row() {
+  // a dense batch without padding is a special case of packing
+  std::vector<std::vector<int>> cu_seqlens = {{0, 3}, {0, 3}, {0, 3}};
+  std::vector<int> seg_ids = get_packed_segment_ids(cu_seqlens, 3, 3);
+  std::vector<int> pos_ids = get_packed_position_ids(cu_seqlens, 3, 3);
+  for (int i = 0; i < 9; i++) {
+    CHECK_EQ(seg_ids[i], 0);
+    CHECK_EQ(pos_ids[i], i % 3);
+  }
+}
+
+void test_block_diagonal_mask() {
+  // the attention mask derived from segment ids is block-diagonal per row
+  std::vector<std::vector<int>> cu_seqlens = {{0, 2, 5}};
+  int seq_len = 6;
+  std::vector<int> seg_ids = get_packed_segment_ids(cu_seqlens, 1, seq_len);
+  int attended = 0;
+  for (int q = 0; q < seq_len; q++) {
+    for (int k = 0; k < seq_len; k++) {
+      bool visible = seg_ids[q] == seg_ids[k];
+      if (q < 2) CHECK_EQ(visible, k < 2);
+      if (q >= 2 && q < 5) CHECK_EQ(visible, k >= 2 && k < 5);
+      if (visible && seg_ids[q] >= 0) attended++;
+    }
+  }
+  CHECK_EQ(attended, 2 * 2 + 3 * 3);
+}
+
+void test_invalid_cu_seqlens() {
+  // wrong number of rows
+  CHECK_THROW(get_packed_segment_ids({{0, 4}}, 2, 4));
+  // not starting at 0
+  CHECK_THROW(get_packed_segment_ids({{1, 3}}, 1, 4));
+  // empty sample
+  CHECK_THROW(get_packed_position_ids({{0, 2, 2}}, 1, 4));
+  // exceeding the row
+  CHECK_THROW(get_packed_position_ids({{0, 3, 5}}, 1, 4));
+  CHECK_THROW(get_packed_position_ids({{}}, 1, 4));
+}
+
+int main() {
+  RUN_TEST(test_segment_ids);
+  RUN_TEST(test_segment_ids_empty_row);
+  RUN_TEST(test_position_ids);
+  RUN_TEST(test_dense_batch_is_one_sample_per_row);
+  RUN_TEST(test_block_diagonal_mask);
+  RUN_TEST(test_invalid_cu_seqlens);
+  return 0;
+}
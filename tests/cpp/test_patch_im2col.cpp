@@ -0,0 +1,89 @@
+#include <random>
+
+#include "lightseq/inference/kernels/patch_im2col.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+std::vector<float> random_vec(size_t n, std::mt19937 *gen) {
+  std::uniform_real_distribution<float> dist(-1.f, 1.f);
+  std::vector<float> v(n);
+  for (float &x : v) x = dist(*gen);
+  return v;
+}
+
+void test_im2col_layout() {
+  // 2 images, 2 channels, 4x4 pixels, 2x2 patches
+  int patch_size = 2, image_size = 4, batch_size = 2, channel = 2;
+  std::vector<float> input(batch_size * channel * image_size * image_size);
+  for (size_t i = 0; i < input.size(); i++) input[i] = i;
+  int col_dim = channel * patch_size * patch_size;
+  std::vector<float> col(batch_size * 4 * col_dim);
+  patch_im2col_cpu(input.data(), col.data(), patch_size, image_size,
+                   batch_size, channel);
+  // image 0, patch 0: channel 0 rows 0-1 cols 0-1, then channel 1
+  float patch0[] = {0, 1, 4, 5, 16, 17, 20, 21};
+  for (int c = 0; c < col_dim; c++) CHECK_EQ(col[c], patch0[c]);
+  // image 0, patch 1 is the top right one
+  CHECK_EQ(col[col_dim], 2.f);
+  CHECK_EQ(col[col_dim + 3], 7.f);
+  // image 0, patch 2 is the bottom left one
+  CHECK_EQ(col[2 * col_dim], 8.f);
+  // image 1, patch 3, last element: channel 1, pixel (3, 3)
+  CHECK_EQ(col[8 * col_dim - 1], 63.f);
+}
+
+void check_gemm_matches_conv(int patch_size, int image_size, int batch_size,
+                             int hidden_dim, int channel) {
+  std::mt19937 gen(patch_size * 131 + image_size);
+  int patch_per_row = image_size / patch_size;
+  int max_step = patch_per_row * patch_per_row + 1;
+  int col_dim = channel * patch_size * patch_size;
+  std::vector<float> weight = random_vec(hidden_dim * col_dim, &gen);
+  std::vector<float> bias = random_vec(hidden_dim, &gen);
+  std::vector<float> pos = random_vec(max_step * hidden_dim, &gen);
+  std::vector<float> cls = random_vec(hidden_dim, &gen);
+  std::vector<float> input =
+      random_vec(batch_size * channel * image_size * image_size, &gen);
+  size_t out_size = (size_t)batch_size * max_step * hidden_dim;
+  std::vector<float> expect(out_size, 0.f), out(out_size, 0.f);
+  patch_emb_conv_cpu(weight.data(), bias.data(), pos.data(), cls.data(),
+                     input.data(), expect.data(), patch_size, image_size,
+                     batch_size, max_step, hidden_dim, channel);
+  patch_emb_gemm_cpu(weight.data(), bias.data(), pos.data(), cls.data(),
+                     input.data(), out.data(), patch_size, image_size,
+                     batch_size, max_step, hidden_dim, channel);
+  for (size_t i = 0; i < out_size; i++) CHECK_NEAR(out[i], expect[i], 1e-4);
+}
+
+void test_gemm_matches_conv() {
+  check_gemm_matches_conv(2, 4, 2, 8, 2);
+  check_gemm_matches_conv(4, 16, 3, 24, 3);
+  // a single patch per image
+  check_gemm_matches_conv(8, 8, 1, 16, 3);
+  // ViT-B/16 at 32x32: the col_dim equals the hidden size
+  check_gemm_matches_conv(16, 32, 2, 768, 3);
+}
+
+void test_cls_token() {
+  int patch_size = 2, image_size = 2, hidden_dim = 4, max_step = 2;
+  std::vector<float> weight(hidden_dim * 4, 1.f), bias(hidden_dim, 0.5f);
+  std::vector<float> pos = {1, 2, 3, 4, 10, 20, 30, 40};
+  std::vector<float> cls = {-1, -2, -3, -4};
+  std::vector<float> input = {1, 1, 1, 1};
+  std::vector<float> out(max_step * hidden_dim);
+  patch_emb_gemm_cpu(weight.data(), bias.data(), pos.data(), cls.data(),
+                     input.data(), out.data(), patch_size, image_size, 1,
+                     max_step, hidden_dim, 1);
+  for (int h = 0; h < hidden_dim; h++) {
+    CHECK_NEAR(out[h], 0.f, 1e-6);
+    CHECK_NEAR(out[hidden_dim + h], 4.5f + pos[hidden_dim + h], 1e-6);
+  }
+}
+
+int main() {
+  RUN_TEST(test_im2col_layout);
+  RUN_TEST(test_gemm_matches_conv);
+  RUN_TEST(test_cls_token);
+  return 0;
+}
@@ -0,0 +1,60 @@
+#include "lightseq/inference/kernels/pooling.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+// 2 samples of 3 tokens, hidden size 2, pad id 0
+const std::vector<int> kTokens = {5, 7, 0, 0, 9, 0};
+const std::vector<float> kHidden = {1.f, -2.f, 3.f, 4.f,  100.f, 100.f,
+                                    8.f, 8.f,  -1.f, -3.f, 100.f, 100.f};
+
+void test_cls() {
+  std::vector<float> res =
+      pool_hidden_states(kHidden, kTokens, 2, 3, 2, 0, kPoolCls);
+  // the first token, even if it is a pad
+  CHECK((res == std::vector<float>{1.f, -2.f, 8.f, 8.f}));
+}
+
+void test_mean() {
+  std::vector<float> res =
+      pool_hidden_states(kHidden, kTokens, 2, 3, 2, 0, kPoolMean);
+  CHECK_NEAR(res[0], 2.f, 1e-6);
+  CHECK_NEAR(res[1], 1.f, 1e-6);
+  CHECK_NEAR(res[2], -1.f, 1e-6);
+  CHECK_NEAR(res[3], -3.f, 1e-6);
+}
+
+void test_max() {
+  std::vector<float> res =
+      pool_hidden_states(kHidden, kTokens, 2, 3, 2, 0, kPoolMax);
+  CHECK((res == std::vector<float>{3.f, 4.f, -1.f, -3.f}));
+}
+
+void test_all_pad() {
+  std::vector<int> tokens = {0, 0};
+  std::vector<float> hidden = {1.f, 2.f};
+  CHECK_EQ(pool_hidden_dim(hidden.data(), tokens.data(), 0, 2, 1, 0, kPoolMean),
+           0.f);
+  CHECK_EQ(pool_hidden_dim(hidden.data(), tokens.data(), 0, 2, 1, 0, kPoolMax),
+           0.f);
+}
+
+void test_parse() {
+  CHECK_EQ(parse_pooling_mode("none"), kPoolNone);
+  CHECK_EQ(parse_pooling_mode("cls"), kPoolCls);
+  CHECK_EQ(parse_pooling_mode("mean"), kPoolMean);
+  CHECK_EQ(parse_pooling_mode("max"), kPoolMax);
+  CHECK_THROW(parse_pooling_mode("sum"));
+  CHECK_EQ(check_pooling_mode(kPoolMax), "");
+  CHECK(check_pooling_mode(4) != "");
+  CHECK(check_pooling_mode(-1) != "");
+}
+
+int main() {
+  RUN_TEST(test_cls);
+  RUN_TEST(test_mean);
+  RUN_TEST(test_max);
+  RUN_TEST(test_all_pad);
+  RUN_TEST(test_parse);
+  return 0;
+}
@@ -0,0 +1,74 @@
+#include <math.h>
+
+#include "lightseq/inference/tools/quant_weight.h"
+#include "lightseq/inference/tools/weight_loader.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+// the previous path: dequantize on host, then quantize on device
+float dequantize(unsigned char i, float clip_max) {
+  return ((float)i - 127) * clip_max / 127;
+}
+
+int8_t quantize(float x, float clip_max) {
+  float q = floorf(x * 127 / clip_max + 0.5f);
+  return (int8_t)std::max(-127.f, std::min(127.f, q));
+}
+
+float half_bits_to_float(uint16_t h) {
+  int exp = (h >> 10) & 0x1f;
+  int mant = h & 0x3ff;
+  float v = exp == 0 ? ldexpf(mant, -24) : ldexpf(mant | 0x400, exp - 25);
+  return h & 0x8000 ? -v : v;
+}
+
+void test_same_as_dequantize_quantize() {
+  for (float clip_max : {0.1f, 1.f, 2.5f, 7.3f, 100.f}) {
+    for (int i = 0; i < 256; i++) {
+      unsigned char x = i;
+      float f = dequantize(x, clip_max);
+      CHECK_EQ(weight_uint8_to_int8(x), quantize(f, clip_max));
+      // the fp16 models dequantized into half
+      float h = half_bits_to_float(float_to_half_bits(f));
+      CHECK_EQ(weight_uint8_to_int8(x), quantize(h, clip_max));
+    }
+  }
+}
+
+void test_append() {
+  std::vector<int8_t> dst;
+  std::string a("\x00\x7f\xff", 3), b("\x80", 1);
+  CHECK_EQ(append_int8_weight(a, &dst), 0);
+  CHECK_EQ(append_int8_weight(b, &dst), 3);
+  CHECK_EQ(dst.size(), 4u);
+  CHECK_EQ(dst[0], -127);
+  CHECK_EQ(dst[1], 0);
+  CHECK_EQ(dst[2], 127);
+  CHECK_EQ(dst[3], 1);
+}
+
+void test_scaled_colsum() {
+  int rows = 37, cols = 5;
+  float clip_max = 3.f, scale = 0.5f;
+  std::vector<unsigned char> u8(rows * cols);
+  for (size_t i = 0; i < u8.size(); i++) u8[i] = (i * 97 + 13) % 255;
+  std::vector<int8_t> i8(u8.size());
+  uint8_to_int8(u8.data(), i8.data(), u8.size());
+  std::vector<float> res =
+      int8_scaled_colsum(i8.data(), rows, cols, clip_max / 127, scale);
+  for (int c = 0; c < cols; c++) {
+    float expect = 0;
+    for (int r = 0; r < rows; r++) {
+      expect += dequantize(u8[r * cols + c], clip_max);
+    }
+    CHECK_NEAR(res[c], expect * scale, 1e-4);
+  }
+}
+
+int main() {
+  RUN_TEST(test_same_as_dequantize_quantize);
+  RUN_TEST(test_append);
+  RUN_TEST(test_scaled_colsum);
+  return 0;
+}
@@ -0,0 +1,187 @@
+#include <thread>
+
+#include "lightseq/inference/tools/result_cache.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+CachedResult make_result(int token, int seq_len, int num_seqs = 1) {
+  CachedResult r;
+  r.num_seqs = num_seqs;
+  r.seq_len = seq_len;
+  r.ids.assign(num_seqs * seq_len, token);
+  for (int s = 0; s < num_seqs; s++) r.scores.push_back(-0.5f * (token + s));
+  return r;
+}
+
+std::string key_of(int id) {
+  int row[] = {id, id + 1, 7};
+  return result_cache_key("m", "", row, 3, -1);
+}
+
+ResultCacheConfig make_config(size_t capacity_bytes, int num_shards,
+                              bool admission) {
+  ResultCacheConfig config;
+  config.capacity_bytes = capacity_bytes;
+  config.num_shards = num_shards;
+  config.admission = admission;
+  return config;
+}
+
+void test_key() {
+  int a[] = {5, 6, 0, 0}, b[] = {5, 6, 0}, c[] = {5, 6, 0, 0};
+  // padding 0 stripped, the rows are the same segment
+  CHECK_EQ(result_cache_key("m", "cfg", a, 4, 0),
+           result_cache_key("m", "cfg", b, 3, 0));
+  CHECK(result_cache_key("m", "cfg", a, 4, -1) !=
+        result_cache_key("m", "cfg", b, 3, -1));
+  CHECK(result_cache_key("m", "cfg", a, 4, 0) !=
+        result_cache_key("m2", "cfg", c, 4, 0));
+  CHECK(result_cache_key("m", "cfg", a, 4, 0) !=
+        result_cache_key("m", "cfg2", c, 4, 0));
+  // model id and config cannot run into each other
+  CHECK(result_cache_key("ab", "c", a, 2, -1) !=
+        result_cache_key("a", "bc", a, 2, -1));
+}
+
+void test_lookup_insert() {
+  ResultCache cache(make_config(1 << 20, 4, true));
+  CachedResult r;
+  CHECK(!cache.lookup(key_of(1), &r));
+  CHECK(cache.insert(key_of(1), make_result(3, 4, 2)));
+  CHECK(cache.lookup(key_of(1), &r));
+  CHECK_EQ(r.num_seqs, 2);
+  CHECK_EQ(r.ids.size(), 8u);
+  CHECK_NEAR(r.scores[1], -2.f, 1e-6);
+  // replaced, not duplicated
+  CHECK(cache.insert(key_of(1), make_result(4, 4)));
+  ResultCacheStats s = cache.stats();
+  CHECK_EQ(s.entries, 1u);
+  CHECK_EQ(s.hits, 1u);
+  CHECK_EQ(s.misses, 1u);
+  CHECK_EQ(s.inserts, 2u);
+  CHECK_NEAR(s.hit_rate(), 0.5, 1e-9);
+  CHECK(s.bytes > 0 && s.bytes <= s.capacity_bytes);
+  cache.clear();
+  CHECK_EQ(cache.stats().entries, 0u);
+  CHECK_EQ(cache.stats().bytes, 0u);
+}
+
+void test_lru_budget() {
+  // room for a few entries in a single shard, LRU without admission
+  ResultCache cache(make_config(1200, 1, false));
+  for (int i = 0; i < 20; i++) {
+    CachedResult r;
+    cache.lookup(key_of(0), &r);
+    cache.insert(key_of(i), make_result(i, 16));
+  }
+  ResultCacheStats s = cache.stats();
+  CHECK(s.bytes <= 1200u);
+  CHECK(s.evictions > 0);
+  CachedResult r;
+  // the most recently used ones are kept
+  CHECK(cache.lookup(key_of(0), &r));
+  CHECK(cache.lookup(key_of(19), &r));
+  CHECK(!cache.lookup(key_of(1), &r));
+  // larger than the whole budget
+  CHECK(!cache.insert(key_of(99), make_result(1, 1000)));
+}
+
+void test_admission() {
+  ResultCache cache(make_config(2000, 1, true));
+  CachedResult r;
+  // repeated segments, requested often
+  for (int round = 0; round < 5; round++) {
+    for (int i = 0; i < 4; i++) {
+      if (!cache.lookup(key_of(i), &r)) {
+        cache.insert(key_of(i), make_result(i, 16));
+      }
+    }
+  }
+  // a scan of one-off segments does not flush them
+  for (int i = 100; i < 300; i++) {
+    if (!cache.lookup(key_of(i), &r)) {
+      cache.insert(key_of(i), make_result(i, 16));
+    }
+  }
+  for (int i = 0; i < 4; i++) CHECK(cache.lookup(key_of(i), &r));
+  CHECK(cache.stats().rejected > 0);
+}
+
+void test_batch_plan() {
+  ResultCache cache(make_config(1 << 20, 4, true));
+  const int pad = 0, seq_len = 3;
+  int warm[] = {9, 8, 0};
+  cache.insert(result_cache_key("m", "", warm, seq_len, pad),
+               make_result(50, 2, 2));
+  int input[] = {1, 2, 0,   // miss
+                 9, 8, 0,   // hit
+                 1, 2, 0,   // in-batch duplicate of row 0
+                 4, 0, 0};  // miss
+  ResultBatchPlan plan = plan_result_batch(&cache, "m", "", input, 4, seq_len,
+                                           pad);
+  CHECK_EQ(plan.miss_rows, std::vector<int>({0, 3}));
+  CHECK_EQ(plan.miss_index, std::vector<int>({0, -1, 0, 1}));
+
+  // the misses ran as a batch of 2: ids [2, 2, 4], scores [2, 2]
+  int ids[] = {1, 1, 2, 2, 1, 1, 1, 2, 6, 6, 2, 2, 6, 2, 2, 2};
+  float scores[] = {-1.f, -2.f, -3.f, -4.f};
+  std::vector<CachedResult> results;
+  for (int m = 0; m < 2; m++) {
+    results.push_back(result_of_row(ids, scores, m, 2, 4));
+  }
+  std::vector<int> out_ids;
+  std::vector<float> out_scores;
+  int num_seqs, out_len;
+  fill_result_batch(&cache, &plan, results, &out_ids, &out_scores, &num_seqs,
+                    &out_len);
+  CHECK_EQ(num_seqs, 2);
+  CHECK_EQ(out_len, 4);
+  CHECK_EQ(out_ids.size(), 4u * 2 * 4);
+  // row 1 from the cache, its length 2 padded with its last token
+  CHECK_EQ(std::vector<int>(out_ids.begin() + 8, out_ids.begin() + 16),
+           std::vector<int>({50, 50, 50, 50, 50, 50, 50, 50}));
+  // row 2 is row 0
+  CHECK_EQ(std::vector<int>(out_ids.begin() + 16, out_ids.begin() + 24),
+           std::vector<int>(ids, ids + 8));
+  CHECK_EQ(std::vector<int>(out_ids.begin() + 24, out_ids.end()),
+           std::vector<int>(ids + 8, ids + 16));
+  CHECK_NEAR(out_scores[7], -4.f, 1e-6);
+  CHECK_NEAR(out_scores[2], -25.f, 1e-6);
+
+  // the whole batch hits now
+  plan = plan_result_batch(&cache, "m", "", input, 4, seq_len, pad);
+  CHECK(plan.miss_rows.empty());
+}
+
+void test_threads() {
+  ResultCache cache(make_config(64 << 10, 8, true));
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&cache, t]() {
+      CachedResult r;
+      for (int i = 0; i < 5000; i++) {
+        int id = (i * 7 + t) % 300;
+        if (cache.lookup(key_of(id), &r)) {
+          CHECK_EQ(r.ids[0], id);
+        } else {
+          cache.insert(key_of(id), make_result(id, 8));
+        }
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  ResultCacheStats s = cache.stats();
+  CHECK_EQ(s.hits + s.misses, 20000u);
+  CHECK(s.bytes <= s.capacity_bytes);
+}
+
+int main() {
+  RUN_TEST(test_key);
+  RUN_TEST(test_lookup_insert);
+  RUN_TEST(test_lru_budget);
+  RUN_TEST(test_admission);
+  RUN_TEST(test_batch_plan);
+  RUN_TEST(test_threads);
+  return 0;
+}
@@ -0,0 +1,73 @@
+#include <math.h>
+
+#include "lightseq/inference/kernels/sequence_scoring.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+void test_target_tokens() {
+  const int end_id = 2, start_id = 1;
+  int target[] = {5, 7, 2, 2, 9};
+  CHECK_EQ(score_target_len(target, 5, end_id), 3);
+  // no end, every position is scored
+  CHECK_EQ(score_target_len(target, 2, end_id), 2);
+  CHECK_EQ(score_input_token(target, 0, start_id), start_id);
+  CHECK_EQ(score_input_token(target, 1, start_id), 5);
+  CHECK_EQ(score_input_token(target, 3, start_id), 2);
+}
+
+void test_passes() {
+  for (int batch_size : {1, 3, 8}) {
+    for (int n : {1, 5, 100}) {
+      for (int trg_seq_len : {1, 17, 256}) {
+        int max_token_num = 8 * 256, head_num = 16;
+        std::vector<ScorePass> passes =
+            score_passes(batch_size, n, trg_seq_len, head_num, max_token_num);
+        std::vector<int> seen(batch_size * n, 0);
+        for (const ScorePass &pass : passes) {
+          CHECK(pass.cand_num >= 1);
+          CHECK(batch_size * pass.cand_num * trg_seq_len <= max_token_num);
+          CHECK(head_num * pass.cand_num * trg_seq_len <= kScoreMaxGridY);
+          for (int i = 0; i < batch_size * pass.cand_num; i++) {
+            seen[score_target_id(pass, i)]++;
+          }
+        }
+        for (int s : seen) CHECK_EQ(s, 1);
+      }
+    }
+  }
+  // all the candidates in one pass when they fit
+  CHECK_EQ(score_passes(4, 10, 20, 8, 1024).size(), 1u);
+  CHECK_EQ(score_passes(4, 0, 20, 8, 1024).size(), 0u);
+}
+
+void test_log_prob_reference() {
+  const int vocab_size = 4, trg_seq_len = 3, end_id = 3;
+  int targets[] = {0, 3, 1,  // scored through the end
+                   2, 1, 0};
+  std::vector<float> logits(2 * trg_seq_len * vocab_size);
+  for (size_t i = 0; i < logits.size(); i++) logits[i] = (i * 7 % 5) * 0.3f;
+  float token_lp[2 * trg_seq_len], seq_lp[2];
+  score_log_prob_reference(logits.data(), targets, 2, trg_seq_len, vocab_size,
+                           end_id, token_lp, seq_lp);
+  for (int i = 0; i < 2; i++) {
+    float sum = 0.f;
+    for (int t = 0; t < trg_seq_len; t++) {
+      const float *row = &logits[(i * trg_seq_len + t) * vocab_size];
+      float z = 0.f;
+      for (int v = 0; v < vocab_size; v++) z += expf(row[v]);
+      float expect = logf(expf(row[targets[i * trg_seq_len + t]]) / z);
+      if (i == 0 && t == 2) expect = 0.f;
+      CHECK_NEAR(token_lp[i * trg_seq_len + t], expect, 1e-5);
+      sum += expect;
+    }
+    CHECK_NEAR(seq_lp[i], sum, 1e-5);
+  }
+}
+
+int main() {
+  RUN_TEST(test_target_tokens);
+  RUN_TEST(test_passes);
+  RUN_TEST(test_log_prob_reference);
+  return 0;
+}
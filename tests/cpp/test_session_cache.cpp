@@ -0,0 +1,149 @@
+#include <map>
+
+#include "lightseq/inference/tools/session_cache.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+// fake storage, the data pointers only record where the bytes are
+struct FakeStorage {
+  std::map<uint64_t, std::string> where;
+  int spills = 0, restores = 0;
+
+  SessionStorage hooks() {
+    SessionStorage s;
+    s.alloc = [this](SessionEntry &e) {
+      e.device_data = &e;
+      where[e.id] = "device";
+    };
+    s.spill = [this](SessionEntry &e) {
+      CHECK(e.device_data != nullptr);
+      e.host_data = &e;
+      e.device_data = nullptr;
+      where[e.id] = "host";
+      spills++;
+    };
+    s.restore = [this](SessionEntry &e) {
+      CHECK(e.host_data != nullptr);
+      e.device_data = &e;
+      e.host_data = nullptr;
+      where[e.id] = "device";
+      restores++;
+    };
+    s.release = [this](SessionEntry &e) { where.erase(e.id); };
+    return s;
+  }
+};
+
+SessionCacheConfig make_config(size_t device_bytes, size_t host_bytes,
+                               int64_t ttl_ms) {
+  SessionCacheConfig config;
+  config.device_bytes = device_bytes;
+  config.host_bytes = host_bytes;
+  config.ttl_ms = ttl_ms;
+  return config;
+}
+
+void test_store_and_acquire() {
+  FakeStorage storage;
+  SessionCache cache(make_config(100, 0, 0), storage.hooks());
+  CHECK(cache.acquire(1, 0) == nullptr);
+  SessionEntry *e = cache.store(1, 5, {7, 8, 9, 10, 11, 12}, 40, 0);
+  CHECK(e != nullptr);
+  CHECK_EQ(e->seq_len, 5);
+  CHECK_EQ(cache.device_bytes(), 40u);
+  e = cache.acquire(1, 10);
+  CHECK(e != nullptr);
+  CHECK_EQ(e->tokens.size(), 6u);
+  CHECK_EQ(e->last_used_ms, 10);
+  // a new turn replaces the storage
+  cache.store(1, 8, {1}, 60, 20);
+  CHECK_EQ(cache.size(), 1u);
+  CHECK_EQ(cache.device_bytes(), 60u);
+  CHECK(cache.erase(1));
+  CHECK(!cache.erase(1));
+  CHECK_EQ(cache.device_bytes(), 0u);
+  CHECK(storage.where.empty());
+}
+
+void test_lru_eviction() {
+  FakeStorage storage;
+  SessionCache cache(make_config(100, 0, 0), storage.hooks());
+  cache.store(1, 1, {}, 40, 0);
+  cache.store(2, 1, {}, 40, 1);
+  cache.acquire(1, 2);
+  // session 2 is the least recently used
+  cache.store(3, 1, {}, 40, 3);
+  CHECK(cache.contains(1));
+  CHECK(!cache.contains(2));
+  CHECK(cache.contains(3));
+  CHECK_EQ(cache.device_bytes(), 80u);
+  // larger than the whole budget, not kept
+  CHECK(cache.store(4, 1, {}, 101, 4) == nullptr);
+  CHECK(!cache.contains(4));
+  CHECK_EQ(cache.size(), 2u);
+}
+
+void test_spill_to_host() {
+  FakeStorage storage;
+  SessionCache cache(make_config(100, 80, 0), storage.hooks());
+  cache.store(1, 1, {}, 40, 0);
+  cache.store(2, 1, {}, 40, 1);
+  cache.store(3, 1, {}, 40, 2);
+  CHECK_EQ(storage.where[1], std::string("host"));
+  CHECK_EQ(cache.device_bytes(), 80u);
+  CHECK_EQ(cache.host_bytes(), 40u);
+  // restored to device, spilling the least recently used one
+  SessionEntry *e = cache.acquire(1, 3);
+  CHECK(e != nullptr && e->place == SessionPlace::kDevice);
+  CHECK_EQ(storage.where[1], std::string("device"));
+  CHECK_EQ(storage.where[2], std::string("host"));
+  CHECK_EQ(storage.restores, 1);
+  CHECK_EQ(cache.device_bytes(), 80u);
+  CHECK_EQ(cache.host_bytes(), 40u);
+  // the host copies are bounded too, the oldest one is released
+  cache.store(4, 1, {}, 40, 4);
+  cache.store(5, 1, {}, 40, 5);
+  CHECK_EQ(cache.size(), 4u);
+  CHECK(!cache.contains(2));
+  CHECK(cache.host_bytes() <= 80u);
+  CHECK_EQ(storage.where.size(), cache.size());
+}
+
+void test_ttl() {
+  FakeStorage storage;
+  SessionCache cache(make_config(1000, 1000, 100), storage.hooks());
+  cache.store(1, 1, {}, 10, 0);
+  cache.store(2, 1, {}, 10, 50);
+  CHECK(cache.acquire(1, 100) != nullptr);
+  // session 2 idle for 101 ms
+  CHECK(cache.acquire(2, 151) == nullptr);
+  CHECK(cache.contains(1));
+  cache.expire(200);
+  CHECK_EQ(cache.size(), 1u);
+  cache.expire(201);
+  CHECK_EQ(cache.size(), 0u);
+  CHECK_EQ(cache.device_bytes(), 0u);
+}
+
+void test_shrink_budget() {
+  FakeStorage storage;
+  SessionCache cache(make_config(100, 100, 0), storage.hooks());
+  cache.store(1, 1, {}, 50, 0);
+  cache.store(2, 1, {}, 50, 1);
+  cache.set_config(make_config(50, 0, 0));
+  CHECK_EQ(cache.size(), 1u);
+  CHECK(cache.contains(2));
+  CHECK_EQ(cache.host_bytes(), 0u);
+  cache.clear();
+  CHECK(storage.where.empty());
+}
+
+int main() {
+  RUN_TEST(test_store_and_acquire);
+  RUN_TEST(test_lru_eviction);
+  RUN_TEST(test_spill_to_host);
+  RUN_TEST(test_ttl);
+  RUN_TEST(test_shrink_budget);
+  return 0;
+}
@@ -0,0 +1,94 @@
+#include <math.h>
+
+#include "lightseq/inference/kernels/split_k_attention.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+std::vector<float> values(int size, int seed) {
+  std::vector<float> res(size);
+  for (int i = 0; i < size; i++) {
+    res[i] = ((i * 37 + seed * 11) % 101) / 50.f - 1.f;
+  }
+  return res;
+}
+
+// softmax(scale * q . k) * v over the whole row
+void naive_attention(const float *q, const float *k, const float *v,
+                     int num_rows, int step_num, int max_step, int dim,
+                     float scale, float *out) {
+  std::vector<float> p(step_num);
+  for (int r = 0; r < num_rows; r++) {
+    float m = -INFINITY, l = 0.f;
+    for (int j = 0; j < step_num; j++) {
+      float score = 0.f;
+      for (int d = 0; d < dim; d++) {
+        score += q[r * dim + d] * k[((long)r * max_step + j) * dim + d];
+      }
+      p[j] = score * scale;
+      m = std::max(m, p[j]);
+    }
+    for (int j = 0; j < step_num; j++) {
+      p[j] = expf(p[j] - m);
+      l += p[j];
+    }
+    for (int d = 0; d < dim; d++) {
+      float acc = 0.f;
+      for (int j = 0; j < step_num; j++) {
+        acc += p[j] * v[((long)r * max_step + j) * dim + d];
+      }
+      out[r * dim + d] = acc / l;
+    }
+  }
+}
+
+void check_plan(int step_num, int num_rows, int num_sms) {
+  int rows = 3, dim = 8, max_step = step_num + 5;
+  float scale = 1.f / sqrtf(dim);
+  std::vector<float> q = values(rows * dim, 1);
+  std::vector<float> k = values(rows * max_step * dim, 2);
+  std::vector<float> v = values(rows * max_step * dim, 3);
+  SplitKPlan plan = split_k_plan(step_num, num_rows, num_sms);
+  std::vector<float> out(rows * dim), expect(rows * dim);
+  split_k_attention_reference(q.data(), k.data(), v.data(), rows, step_num,
+                              max_step, dim, scale, plan, out.data());
+  naive_attention(q.data(), k.data(), v.data(), rows, step_num, max_step, dim,
+                  scale, expect.data());
+  for (int i = 0; i < rows * dim; i++) CHECK_NEAR(out[i], expect[i], 1e-5);
+}
+
+void test_same_as_softmax() {
+  // a single split
+  check_plan(7, 1024, 80);
+  // uneven last chunk
+  check_plan(1000, 8, 80);
+  // longer than a block
+  check_plan(3000, 1024, 80);
+  check_plan(4097, 4, 108);
+}
+
+void test_plan() {
+  for (int step_num : {1, 63, 64, 200, 1024, 1025, 4096, 10000}) {
+    for (int num_rows : {1, 8, 64, 4096}) {
+      SplitKPlan plan = split_k_plan(step_num, num_rows, 80);
+      CHECK(plan.num_splits >= 1);
+      CHECK(plan.chunk <= kSplitKMaxChunk);
+      // no empty split
+      CHECK(plan.chunk * plan.num_splits >= step_num);
+      CHECK(plan.chunk * (plan.num_splits - 1) < step_num);
+      CHECK(plan.num_splits * num_rows <=
+            split_k_max_partials(4096, 10000, 80));
+    }
+  }
+  // enough rows fill the gpu
+  CHECK_EQ(split_k_plan(512, 4096, 80).num_splits, 1);
+  // a small batch is split
+  CHECK(split_k_plan(512, 8, 80).num_splits > 1);
+  CHECK_EQ(split_k_plan(3000, 4096, 80).num_splits, 3);
+}
+
+int main() {
+  RUN_TEST(test_same_as_softmax);
+  RUN_TEST(test_plan);
+  return 0;
+}
@@ -0,0 +1,131 @@
+#include "lightseq/inference/tools/stage_profiler.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+void test_histogram_buckets() {
+  // buckets are contiguous and cover their own bounds
+  for (int b = 0; b + 1 < StageHistogram::kBuckets; b++) {
+    CHECK(StageHistogram::bucket_lower_us(b) <
+          StageHistogram::bucket_upper_us(b));
+    CHECK_NEAR(StageHistogram::bucket_upper_us(b),
+               StageHistogram::bucket_lower_us(b + 1), 1e-9);
+  }
+  int64_t samples_ns[] = {0, 500, 1000, 1500, 7777, 123456, 98765432};
+  for (int64_t ns : samples_ns) {
+    int b = StageHistogram::bucket_of(ns);
+    double us = ns / 1e3;
+    CHECK(us >= StageHistogram::bucket_lower_us(b) || b == 0);
+    CHECK(us < StageHistogram::bucket_upper_us(b));
+  }
+}
+
+void test_histogram_percentile() {
+  StageHistogram h;
+  // 1ms .. 100ms
+  for (int i = 1; i <= 100; i++) h.add(i * 1000000LL);
+  CHECK_EQ(h.count(), (uint64_t)100);
+  CHECK_EQ(h.min_ns(), 1000000LL);
+  CHECK_EQ(h.max_ns(), 100000000LL);
+  CHECK_EQ(h.sum_ns(), 5050LL * 1000000);
+  // 8 sub-buckets per power of two bound the relative error by 1/8
+  CHECK_NEAR(h.percentile_ms(50), 50, 50 / 8.0);
+  CHECK_NEAR(h.percentile_ms(90), 90, 90 / 8.0);
+  CHECK_NEAR(h.percentile_ms(99), 99, 99 / 8.0);
+  CHECK(h.percentile_ms(100) <= 100);
+  h.reset();
+  CHECK_EQ(h.count(), (uint64_t)0);
+  CHECK_NEAR(h.percentile_ms(50), 0, 1e-9);
+}
+
+void test_ring_wraparound() {
+  StageRingBuffer ring(6);
+  CHECK_EQ(ring.capacity(), (size_t)8);
+  for (int i = 0; i < 20; i++) ring.push({i, kHostTrack, 0, i, i + 1});
+  std::vector<StageEvent> events = ring.snapshot();
+  CHECK_EQ(events.size(), (size_t)8);
+  for (int i = 0; i < 8; i++) CHECK_EQ(events[i].stage_id, 12 + i);
+  ring.clear();
+  CHECK(ring.snapshot().empty());
+}
+
+void test_multithread_record() {
+  StageProfiler profiler(1 << 10);
+  profiler.enable(true);
+  int a = profiler.stage_id("a");
+  int b = profiler.stage_id("b");
+  CHECK_EQ(profiler.stage_id("a"), a);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&profiler, a, b, t]() {
+      for (int i = 0; i < 10000; i++) {
+        profiler.record(i % 2 ? a : b, i, i + 1000 * (t + 1));
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  std::map<std::string, StageStats> stats = profiler.stats();
+  CHECK_EQ(stats["a"].count, (uint64_t)20000);
+  CHECK_EQ(stats["b"].count, (uint64_t)20000);
+  CHECK_NEAR(stats["a"].min_ms, 0.001, 1e-9);
+  CHECK_NEAR(stats["a"].max_ms, 0.004, 1e-9);
+  std::vector<StageEvent> events = profiler.events();
+  CHECK_EQ(events.size(), (size_t)1024);
+  for (const StageEvent &e : events) {
+    CHECK(e.stage_id == a || e.stage_id == b);
+    CHECK(e.end_ns > e.start_ns);
+  }
+}
+
+void test_disabled_records_nothing() {
+  StageProfiler profiler;
+  int id = profiler.stage_id("infer");
+  { HostStageScope scope(&profiler, id); }
+  profiler.record(id, 0, 100);
+  CHECK(profiler.stats().empty());
+  CHECK(profiler.chrome_trace().find("\"name\"") == std::string::npos);
+  // a null profiler is a no-op as well
+  { HostStageScope scope(nullptr, id); }
+}
+
+void test_host_scope_and_trace() {
+  StageProfiler profiler;
+  profiler.enable(true);
+  int outer = profiler.stage_id("infer");
+  int inner = profiler.stage_id("decoder.layer_0.ffn");
+  for (int i = 0; i < 3; i++) {
+    HostStageScope scope(&profiler, outer);
+    profiler.record(inner, 1000, 3000, kGpuTrack);
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  std::map<std::string, StageStats> stats = profiler.stats();
+  CHECK_EQ(stats.size(), (size_t)2);
+  CHECK_EQ(stats["infer"].count, (uint64_t)3);
+  CHECK(stats["infer"].min_ms >= 0.2);
+  CHECK(stats["infer"].p50_ms <= stats["infer"].max_ms * 1.125);
+  CHECK_NEAR(stats["decoder.layer_0.ffn"].mean_ms, 0.002, 1e-9);
+
+  std::string trace = profiler.chrome_trace();
+  CHECK(trace.find("\"traceEvents\"") == 1);
+  CHECK(trace.find("\"name\": \"decoder.layer_0.ffn\", \"cat\": \"gpu\"") !=
+        std::string::npos);
+  CHECK(trace.find("\"name\": \"infer\", \"cat\": \"host\"") !=
+        std::string::npos);
+  CHECK(trace.find("\"ph\": \"X\", \"ts\": 1, \"dur\": 2, \"pid\": 1") !=
+        std::string::npos);
+
+  profiler.reset();
+  CHECK(profiler.stats().empty());
+  CHECK(profiler.chrome_trace().find("\"name\"") == std::string::npos);
+  CHECK_EQ(profiler.stage_id("infer"), outer);
+}
+
+int main() {
+  RUN_TEST(test_histogram_buckets);
+  RUN_TEST(test_histogram_percentile);
+  RUN_TEST(test_ring_wraparound);
+  RUN_TEST(test_multithread_record);
+  RUN_TEST(test_disabled_records_nothing);
+  RUN_TEST(test_host_scope_and_trace);
+  return 0;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/* Minimal helpers for the host-side unit tests, abort on the first failure */
+#define CHECK(cond)                                                  \
+  do {                                                               \
+    if (!(cond)) {                                                   \
+      fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, \
+              #cond);                                                \
+      exit(1);                                                       \
+    }                                                                \
+  } while (0)
+
+#define CHECK_EQ(a, b) CHECK((a) == (b))
+
+#define CHECK_NEAR(a, b, eps) CHECK(std::fabs((a) - (b)) <= (eps))
+
+#define CHECK_THROW(expr)      \
+  do {                         \
+    bool thrown = false;       \
+    try {                      \
+      expr;                    \
+    } catch (...) {            \
+      thrown = true;           \
+    }                          \
+    CHECK(thrown);             \
+  } while (0)
+
+#define RUN_TEST(func)                  \
+  do {                                  \
+    func();                             \
+    printf("[PASSED] %s\n", #func);     \
+  } while (0)
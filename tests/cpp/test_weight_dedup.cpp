@@ -0,0 +1,156 @@
+#include "lightseq/inference/tools/weight_dedup.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+std::vector<float> iota_tensor(int size, float start) {
+  std::vector<float> res(size);
+  for (int i = 0; i < size; i++) res[i] = start + i;
+  return res;
+}
+
+std::vector<float> concat(const std::vector<std::vector<float>> &tensors,
+                          std::vector<int> *offset) {
+  std::vector<float> res;
+  offset->clear();
+  for (const std::vector<float> &t : tensors) {
+    offset->push_back(res.size());
+    res.insert(res.end(), t.begin(), t.end());
+  }
+  return res;
+}
+
+// fake device memory: the uploaded blocks, addressed by their data()
+struct FakeDevice {
+  std::vector<std::vector<float>> blocks;
+  const void *operator()(const std::vector<float> &value) {
+    blocks.push_back(value);
+    return blocks.back().data();
+  }
+};
+
+void test_tied_embedding() {
+  std::vector<float> emb = iota_tensor(64, 0.f);
+  std::vector<float> pos = iota_tensor(16, 100.f);
+  std::vector<float> kv = iota_tensor(32, 200.f);
+  std::vector<float> bias = iota_tensor(8, 300.f);
+  WeightDedup dedup;
+  FakeDevice device;
+  device.blocks.reserve(2);
+  std::vector<int> offset;
+  std::vector<const void *> src = dedup.add_block(
+      concat({emb, pos}, &offset), offset, sizeof(float), std::ref(device));
+  CHECK_EQ(device.blocks[0].size(), 80u);
+  CHECK(src[0] == device.blocks[0].data());
+  CHECK(src[1] == device.blocks[0].data() + 64);
+
+  // the target embedding and the position embedding are the source ones
+  std::vector<const void *> trg =
+      dedup.add_block(concat({emb, pos, kv, bias}, &offset), offset,
+                      sizeof(float), std::ref(device));
+  CHECK_EQ(device.blocks[1].size(), 40u);
+  CHECK(trg[0] == src[0]);
+  CHECK(trg[1] == src[1]);
+  CHECK(trg[2] == device.blocks[1].data());
+  CHECK(trg[3] == device.blocks[1].data() + 32);
+  CHECK_EQ(dedup.num_aliased(), 2);
+  CHECK_EQ(dedup.saved_bytes(), 80 * sizeof(float));
+}
+
+// the target embedding is stored [hidden, vocab], the transpose of the
+// source [vocab, hidden] one
+void test_transposed_tied_embedding() {
+  const int vocab = 16, hidden = 4;
+  std::vector<float> src_emb = iota_tensor(vocab * hidden, 0.f);
+  std::vector<float> trg_emb(vocab * hidden);
+  for (int v = 0; v < vocab; v++) {
+    for (int h = 0; h < hidden; h++)
+      trg_emb[h * vocab + v] = src_emb[v * hidden + h];
+  }
+  std::vector<float> pos = iota_tensor(8, 100.f);
+  std::vector<float> bias = iota_tensor(vocab, 300.f);
+  WeightDedup dedup;
+  FakeDevice device;
+  device.blocks.reserve(3);
+  std::vector<int> offset;
+  std::vector<const void *> src = dedup.add_block(
+      concat({src_emb, pos}, &offset), offset, sizeof(float),
+      std::ref(device));
+
+  // not looked up transposed unless asked
+  std::vector<const void *> trg =
+      dedup.add_block(concat({trg_emb, bias}, &offset), offset,
+                      sizeof(float), std::ref(device));
+  CHECK(trg[0] == device.blocks[1].data());
+  CHECK_EQ(dedup.num_aliased(), 0);
+
+  dedup.release();
+  src = dedup.add_block(concat({src_emb, pos}, &offset), offset,
+                        sizeof(float), std::ref(device));
+  std::vector<TransposedMatch> transposed = {{0, hidden, vocab}};
+  trg = dedup.add_block(concat({trg_emb, bias}, &offset), offset,
+                        sizeof(float), std::ref(device), &transposed);
+  CHECK(transposed[0].matched);
+  CHECK(trg[0] == src[0]);
+  CHECK_EQ(device.blocks[3].size(), (size_t)vocab);
+  CHECK(trg[1] == device.blocks[3].data());
+  CHECK_EQ(dedup.saved_bytes(), vocab * hidden * sizeof(float));
+
+  // an untied target embedding is kept
+  trg_emb[5] += 1.f;
+  transposed[0].matched = false;
+  trg = dedup.add_block(concat({trg_emb, bias}, &offset), offset,
+                        sizeof(float), std::ref(device), &transposed);
+  CHECK(!transposed[0].matched);
+  CHECK(trg[0] != src[0]);
+}
+
+void test_within_block() {
+  // layer weights repeated in the same block, with the element size of fp16
+  std::vector<float> kernel = iota_tensor(16, 1.f);
+  std::vector<float> other = iota_tensor(16, 2.f);
+  WeightDedup dedup;
+  FakeDevice device;
+  std::vector<int> offset;
+  std::vector<const void *> res =
+      dedup.add_block(concat({kernel, other, kernel}, &offset), offset, 2,
+                      std::ref(device));
+  CHECK_EQ(device.blocks[0].size(), 32u);
+  const char *base = (const char *)device.blocks[0].data();
+  CHECK(res[0] == base);
+  CHECK(res[1] == base + 16 * 2);
+  CHECK(res[2] == base);
+  CHECK_EQ(dedup.saved_bytes(), 16u * 2);
+}
+
+void test_not_aliased() {
+  WeightDedup dedup;
+  FakeDevice device;
+  device.blocks.reserve(3);
+  std::vector<int> offset;
+  // sizes not a multiple of 8 keep the alignment of the next tensors
+  std::vector<float> odd = iota_tensor(6, 0.f);
+  dedup.add_block(concat({odd, odd}, &offset), offset, 4, std::ref(device));
+  CHECK_EQ(device.blocks[0].size(), 12u);
+
+  // same hash bucket but different content, -0 is not 0
+  std::vector<float> zeros(8, 0.f), neg_zeros(8, -0.f);
+  dedup.add_block(concat({zeros, neg_zeros}, &offset), offset, 4,
+                  std::ref(device));
+  CHECK_EQ(device.blocks[1].size(), 16u);
+  CHECK_EQ(dedup.num_aliased(), 0);
+
+  // released blocks are not matched any more
+  dedup.release();
+  dedup.add_block(concat({zeros}, &offset), offset, 4, std::ref(device));
+  CHECK_EQ(device.blocks[2].size(), 8u);
+  CHECK_EQ(dedup.num_aliased(), 0);
+}
+
+int main() {
+  RUN_TEST(test_tied_embedding);
+  RUN_TEST(test_transposed_tied_embedding);
+  RUN_TEST(test_within_block);
+  RUN_TEST(test_not_aliased);
+  return 0;
+}
@@ -0,0 +1,165 @@
+#include <math.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+
+#include "lightseq/inference/tools/weight_loader.h"
+#include "tests/cpp/test_util.h"
+
+using namespace lightseq::cuda;
+
+void test_parallel_for() {
+  for (int threads : {1, 3, 8}) {
+    std::vector<int> hits(100, 0);
+    parallel_for(
+        100, [&](int i) { hits[i]++; }, threads);
+    CHECK((hits == std::vector<int>(100, 1)));
+  }
+  parallel_for(
+      0, [](int i) { throw std::runtime_error("no task"); }, 4);
+  CHECK_THROW(parallel_for(
+      10,
+      [](int i) {
+        if (i == 7) throw std::runtime_error("task 7");
+      },
+      4));
+}
+
+void test_copy_layers() {
+  // 3 layers of fields of size 2 and 1
+  std::vector<std::vector<std::vector<float>>> layers = {
+      {{1, 2}, {3}}, {{4, 5}, {6}}, {{7, 8}, {9}}};
+  auto fields = [&](int l) {
+    return std::vector<const std::vector<float> *>{&layers[l][0],
+                                                   &layers[l][1]};
+  };
+  std::vector<float> dst(9);
+  CHECK_EQ(copy_layers_parallel(3, {2, 1}, {"kernel", "bias"}, fields,
+                                dst.data()),
+           "");
+  CHECK((dst == std::vector<float>{1, 2, 3, 4, 5, 6, 7, 8, 9}));
+  CHECK((layer_offsets(3, {2, 1}) == std::vector<int>{0, 2, 3, 5, 6, 8}));
+
+  // the error of the first wrong layer
+  layers[2][0].push_back(0);
+  layers[1][1].push_back(0);
+  CHECK_EQ(copy_layers_parallel(3, {2, 1}, {"kernel", "bias"}, fields,
+                                dst.data()),
+           "Wrong bias_size !");
+}
+
+// layer l is handed over in order while the later layers are still copied
+void test_copy_layers_streaming() {
+  std::vector<std::vector<std::vector<float>>> layers = {
+      {{1, 2}, {3}}, {{4, 5}, {6}}, {{7, 8}, {9}}, {{10, 11}, {12}}};
+  std::vector<float> dst(12);
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool first_ready = false;
+  auto fields = [&](int l) {
+    if (l == 3) {
+      // the last layer waits for the first one to be handed over
+      std::unique_lock<std::mutex> lock(mutex);
+      cv.wait(lock, [&]() { return first_ready; });
+    }
+    return std::vector<const std::vector<float> *>{&layers[l][0],
+                                                   &layers[l][1]};
+  };
+  std::vector<int> ready;
+  std::vector<float> seen;
+  auto on_ready = [&](int l) {
+    ready.push_back(l);
+    seen.insert(seen.end(), dst.begin() + l * 3, dst.begin() + l * 3 + 3);
+    std::lock_guard<std::mutex> lock(mutex);
+    first_ready = true;
+    cv.notify_all();
+  };
+  for (int threads : {1, 2, 4}) {
+    first_ready = false;
+    ready.clear();
+    seen.clear();
+    CHECK_EQ(copy_layers_streaming(4, {2, 1}, {"kernel", "bias"}, fields,
+                                   dst.data(), on_ready, threads),
+             "");
+    CHECK((ready == std::vector<int>{0, 1, 2, 3}));
+    CHECK((seen == std::vector<float>{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12}));
+  }
+
+  // nothing from the first wrong layer on
+  layers[1][1].push_back(0);
+  ready.clear();
+  CHECK_EQ(copy_layers_streaming(4, {2, 1}, {"kernel", "bias"}, fields,
+                                 dst.data(), on_ready, 4),
+           "Wrong bias_size !");
+  CHECK((ready == std::vector<int>{0}));
+  layers[1][1].pop_back();
+
+  // the exceptions of the fields and of on_ready are rethrown
+  CHECK_THROW(copy_layers_streaming(
+      4, {2, 1}, {"kernel", "bias"},
+      [&](int l) -> std::vector<const std::vector<float> *> {
+        throw std::runtime_error("parse");
+      },
+      dst.data(), on_ready, 4));
+  CHECK_THROW(copy_layers_streaming(
+      4, {2, 1}, {"kernel", "bias"}, fields, dst.data(),
+      [](int l) { throw std::runtime_error("upload"); }, 4));
+}
+
+void test_half_bits() {
+  CHECK_EQ(float_to_half_bits(0.f), 0x0000);
+  CHECK_EQ(float_to_half_bits(-0.f), 0x8000);
+  CHECK_EQ(float_to_half_bits(1.f), 0x3c00);
+  CHECK_EQ(float_to_half_bits(-2.f), 0xc000);
+  CHECK_EQ(float_to_half_bits(0.1f), 0x2e66);
+  CHECK_EQ(float_to_half_bits(65504.f), 0x7bff);
+  CHECK_EQ(float_to_half_bits(65519.f), 0x7bff);
+  CHECK_EQ(float_to_half_bits(65520.f), 0x7c00);
+  CHECK_EQ(float_to_half_bits(INFINITY), 0x7c00);
+  CHECK_EQ(float_to_half_bits(-INFINITY), 0xfc00);
+  CHECK((float_to_half_bits(NAN) & 0x7e00) == 0x7e00);
+  // ties to even
+  CHECK_EQ(float_to_half_bits(1.f + ldexpf(1.f, -11)), 0x3c00);
+  CHECK_EQ(float_to_half_bits(1.f + 3 * ldexpf(1.f, -11)), 0x3c02);
+  // subnormals
+  CHECK_EQ(float_to_half_bits(ldexpf(1.f, -14)), 0x0400);
+  CHECK_EQ(float_to_half_bits(ldexpf(1.f, -24)), 0x0001);
+  CHECK_EQ(float_to_half_bits(ldexpf(1.f, -25)), 0x0000);
+  CHECK_EQ(float_to_half_bits(ldexpf(1.5f, -25)), 0x0001);
+  CHECK_EQ(float_to_half_bits(ldexpf(3.f, -25)), 0x0002);
+  CHECK_EQ(float_to_half_bits(1e-10f), 0x0000);
+}
+
+// the simd path and the parallel slices give the bits of the scalar one
+void test_simd_matches_scalar() {
+  std::mt19937 gen(3);
+  std::vector<float> src;
+  std::uniform_real_distribution<float> exp(-30.f, 17.f);
+  for (int i = 0; i < 300001; i++) {
+    float x = ldexpf(1.f + (gen() % 4096) / 4096.f, (int)exp(gen));
+    src.push_back(gen() % 2 ? x : -x);
+  }
+  src.push_back(INFINITY);
+  src.push_back(65520.f);
+  std::vector<uint16_t> scalar(src.size()), simd(src.size()),
+      parallel(src.size());
+  float_to_half(src.data(), scalar.data(), src.size(), false);
+  float_to_half(src.data(), simd.data(), src.size(), true);
+  float_to_half_parallel(src.data(), parallel.data(), src.size(), 3);
+  for (size_t i = 0; i < src.size(); i++) {
+    CHECK_EQ(scalar[i], float_to_half_bits(src[i]));
+  }
+  CHECK((simd == scalar));
+  CHECK((parallel == scalar));
+}
+
+int main() {
+  RUN_TEST(test_parallel_for);
+  RUN_TEST(test_copy_layers);
+  RUN_TEST(test_copy_layers_streaming);
+  RUN_TEST(test_half_bits);
+  RUN_TEST(test_simd_matches_scalar);
+  return 0;
+}